@@ -385,6 +385,9 @@ static inline void virtio_9p_feature_set(struct virtio_9p_device *d)
 {
 	d->vdev->features = 0;
 	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_9P_F_MOUNT_TAG);
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_VERSION_1);
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_RING_PACKED);
+	VIRTIO_FEATURE_SET(d->vdev->features, VIRTIO_F_IN_ORDER);
 }
 
 static int virtio_9p_configure(struct virtio_9p_device *d)
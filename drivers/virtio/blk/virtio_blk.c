@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 #include <virtio/virtio_bus.h>
 #include <virtio/virtio_ids.h>
 #include <uk/blkdev.h>
@@ -50,7 +51,9 @@
  *	Multi-queue,
  *	Maximum size of a segment for requests,
  *	Maximum number of segments per request,
- *	Flush
+ *	Flush,
+ *	Discard,
+ *	Write zeroes
  **/
 #define VIRTIO_BLK_DRV_FEATURES(features)				\
 	do {								\
@@ -61,7 +64,11 @@
 		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_MQ);		\
 		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_SIZE_MAX);	\
 		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_FLUSH);	\
+		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_DISCARD);	\
+		VIRTIO_FEATURE_SET(features, VIRTIO_BLK_F_WRITE_ZEROES);\
 		VIRTIO_FEATURE_SET(features, VIRTIO_F_VERSION_1);	\
+		VIRTIO_FEATURE_SET(features, VIRTIO_F_RING_PACKED);	\
+		VIRTIO_FEATURE_SET(features, VIRTIO_F_IN_ORDER);	\
 	} while (0)
 
 static struct uk_alloc *a;
@@ -120,9 +127,33 @@ struct virtio_blkdev_request {
 	struct uk_blkreq *req;
 	struct uk_list_head free_list_head;
 	struct virtio_blk_outhdr virtio_blk_outhdr;
+	/* Range of discard and write zeroes requests */
+	struct virtio_blk_discard_write_zeroes range;
 	uint8_t status;
 };
 
+/* Appends `len` bytes at `buf` to the sglist in chunks of at most
+ * `segment_max_size` bytes
+ */
+static int virtio_blkdev_sglist_append_data(struct uk_sglist *sg,
+		uintptr_t buf, size_t len, size_t segment_max_size)
+{
+	size_t segment_size;
+	size_t idx;
+	int rc;
+
+	for (idx = 0; idx < len; idx += segment_max_size) {
+		segment_size = len - idx;
+		segment_size = (segment_size > segment_max_size) ?
+				segment_max_size : segment_size;
+		rc = uk_sglist_append(sg, (void *)(buf + idx), segment_size);
+		if (unlikely(rc != 0))
+			return rc;
+	}
+
+	return 0;
+}
+
 static int virtio_blkdev_request_set_sglist(struct uk_blkdev_queue *queue,
 		struct virtio_blkdev_request *virtio_blk_req,
 		__sector sector_size,
@@ -131,10 +162,8 @@ static int virtio_blkdev_request_set_sglist(struct uk_blkdev_queue *queue,
 	struct virtio_blk_device *vbdev;
 	struct uk_blkreq *req;
 	size_t data_size = 0;
-	size_t segment_size;
 	size_t segment_max_size;
-	size_t idx;
-	uintptr_t start_data;
+	int i;
 	int rc = 0;
 
 	UK_ASSERT(queue);
@@ -142,7 +171,6 @@ static int virtio_blkdev_request_set_sglist(struct uk_blkdev_queue *queue,
 
 	req = virtio_blk_req->req;
 	vbdev = queue->vbd;
-	start_data = (uintptr_t)req->aio_buf;
 	data_size = req->nb_sectors * sector_size;
 	segment_max_size = vbdev->max_size_segment;
 
@@ -156,22 +184,38 @@ static int virtio_blkdev_request_set_sglist(struct uk_blkdev_queue *queue,
 	}
 
 	/* Append to sglist chunks of `segment_max_size` size
-	 * Only for read / write operations
+	 * for read / write operations, or the range of sectors
+	 * for discard / write zeroes operations
 	 **/
-	if (have_data)
-		for (idx = 0; idx < data_size; idx += segment_max_size) {
-			segment_size = data_size - idx;
-			segment_size = (segment_size > segment_max_size) ?
-					segment_max_size : segment_size;
-			rc = uk_sglist_append(&queue->sg,
-					(void *)(start_data + idx),
-					segment_size);
+	if (have_data && req->iovcnt > 0) {
+		for (i = 0; i < req->iovcnt; i++) {
+			rc = virtio_blkdev_sglist_append_data(&queue->sg,
+					(uintptr_t)req->iov[i].iov_base,
+					req->iov[i].iov_len,
+					segment_max_size);
 			if (unlikely(rc != 0)) {
 				uk_pr_err("Failed to append to sg list %d\n",
 						rc);
 				goto out;
 			}
 		}
+	} else if (have_data) {
+		rc = virtio_blkdev_sglist_append_data(&queue->sg,
+				(uintptr_t)req->aio_buf, data_size,
+				segment_max_size);
+		if (unlikely(rc != 0)) {
+			uk_pr_err("Failed to append to sg list %d\n", rc);
+			goto out;
+		}
+	} else if (req->operation == UK_BLKREQ_DISCARD ||
+		   req->operation == UK_BLKREQ_WRITE_ZEROES) {
+		rc = uk_sglist_append(&queue->sg, &virtio_blk_req->range,
+				sizeof(struct virtio_blk_discard_write_zeroes));
+		if (unlikely(rc != 0)) {
+			uk_pr_err("Failed to append to sg list %d\n", rc);
+			goto out;
+		}
+	}
 
 	rc = uk_sglist_append(&queue->sg, &virtio_blk_req->status,
 			sizeof(uint8_t));
@@ -184,6 +228,41 @@ out:
 	return rc;
 }
 
+/* Checks that the data buffers of a request cover exactly its sectors and
+ * that they fit in the ring once split into segments of at most
+ * `max_size_segment` bytes
+ */
+static int virtio_blkdev_request_check_iov(struct virtio_blk_device *vbdev,
+		struct uk_blkreq *req)
+{
+	struct uk_blkdev_cap *cap = &vbdev->blkdev.capabilities;
+	size_t data_size = 0;
+	size_t nb_segs = 0;
+	int i;
+
+	if (req->iov == NULL || req->iovcnt > cap->max_segments)
+		return -EINVAL;
+
+	for (i = 0; i < req->iovcnt; i++) {
+		if (req->iov[i].iov_base == NULL ||
+		    req->iov[i].iov_len % cap->ssize)
+			return -EINVAL;
+		if (!IS_ALIGNED((uintptr_t)req->iov[i].iov_base, cap->ioalign))
+			return -EINVAL;
+		data_size += req->iov[i].iov_len;
+		nb_segs += DIV_ROUND_UP(req->iov[i].iov_len,
+					vbdev->max_size_segment);
+	}
+
+	if (data_size != req->nb_sectors * cap->ssize)
+		return -EINVAL;
+
+	if (nb_segs > cap->max_segments)
+		return -EINVAL;
+
+	return 0;
+}
+
 static int virtio_blkdev_request_write(struct uk_blkdev_queue *queue,
 		struct virtio_blkdev_request *virtio_blk_req,
 		__u16 *read_segs, __u16 *write_segs)
@@ -203,8 +282,13 @@ static int virtio_blkdev_request_write(struct uk_blkdev_queue *queue,
 			cap->mode == O_RDONLY)
 		return -EPERM;
 
-	if (req->aio_buf == NULL)
+	if (req->iovcnt > 0) {
+		rc = virtio_blkdev_request_check_iov(vbdev, req);
+		if (rc)
+			return rc;
+	} else if (req->aio_buf == NULL) {
 		return -EINVAL;
+	}
 
 	if (req->nb_sectors == 0)
 		return -EINVAL;
@@ -269,6 +353,62 @@ out:
 	return rc;
 }
 
+static int virtio_blkdev_request_discard(struct uk_blkdev_queue *queue,
+		struct virtio_blkdev_request *virtio_blk_req,
+		__u16 *read_segs, __u16 *write_segs)
+{
+	struct uk_blkdev_cap *cap;
+	struct uk_blkreq *req;
+	__sector max_sectors;
+	int rc = 0;
+
+	UK_ASSERT(queue);
+	UK_ASSERT(virtio_blk_req);
+
+	cap = &queue->vbd->blkdev.capabilities;
+	req = virtio_blk_req->req;
+	if (req->operation == UK_BLKREQ_DISCARD)
+		max_sectors = cap->max_discard_sectors;
+	else
+		max_sectors = cap->max_write_zeroes_sectors;
+
+	if (!max_sectors)
+		return -ENOTSUP;
+
+	if (cap->mode == O_RDONLY)
+		return -EPERM;
+
+	if (req->nb_sectors == 0)
+		return -EINVAL;
+
+	if (req->start_sector + req->nb_sectors > cap->sectors)
+		return -EINVAL;
+
+	if (req->nb_sectors > max_sectors)
+		return -EINVAL;
+
+	/* The range is described by the payload, not by the header */
+	virtio_blk_req->range.sector = req->start_sector;
+	virtio_blk_req->range.num_sectors = req->nb_sectors;
+	virtio_blk_req->range.flags = 0;
+	virtio_blk_req->virtio_blk_outhdr.sector = 0;
+
+	rc = virtio_blkdev_request_set_sglist(queue, virtio_blk_req, 0, false);
+	if (rc) {
+		uk_pr_err("Failed to set sglist %d\n", rc);
+		goto out;
+	}
+
+	*read_segs = 2;
+	*write_segs = 1;
+	virtio_blk_req->virtio_blk_outhdr.type =
+			(req->operation == UK_BLKREQ_DISCARD) ?
+			VIRTIO_BLK_T_DISCARD : VIRTIO_BLK_T_WRITE_ZEROES;
+
+out:
+	return rc;
+}
+
 static void virtio_blkdev_queue_cleanup_requests(struct uk_blkdev_queue *queue)
 {
 	struct virtio_blkdev_request *request, *request_tmp;
@@ -321,16 +461,25 @@ static int virtio_blkdev_queue_enqueue(struct uk_blkdev_queue *queue,
 	else if (req->operation == UK_BLKREQ_FFLUSH)
 		rc = virtio_blkdev_request_flush(queue, virtio_blk_req,
 				&read_segs, &write_segs);
+	else if (req->operation == UK_BLKREQ_DISCARD ||
+			req->operation == UK_BLKREQ_WRITE_ZEROES)
+		rc = virtio_blkdev_request_discard(queue, virtio_blk_req,
+				&read_segs, &write_segs);
 	else
-		return -EINVAL;
+		rc = -EINVAL;
 
 	if (rc)
-		goto out;
+		goto err_free;
 
 	rc = virtqueue_buffer_enqueue(queue->vq, virtio_blk_req, &queue->sg,
 				      read_segs, write_segs);
+	if (unlikely(rc < 0))
+		goto err_free;
 
-out:
+	return rc;
+
+err_free:
+	uk_free(a, virtio_blk_req);
 	return rc;
 }
 
@@ -772,6 +921,8 @@ static int virtio_blkdev_feature_negotiate(struct virtio_blk_device *vbdev)
 	__u16 num_queues;
 	__u32 max_segments;
 	__u32 max_size_segment;
+	__u32 max_discard_sectors = 0;
+	__u32 max_write_zeroes_sectors = 0;
 	int rc = 0;
 
 	UK_ASSERT(vbdev);
@@ -851,6 +1002,41 @@ static int virtio_blkdev_feature_negotiate(struct virtio_blk_device *vbdev)
 	} else
 		max_size_segment = __PAGE_SIZE;
 
+	/* Devices report a limit of 0 if the number of sectors is only
+	 * limited by the size of the range in the request
+	 */
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_BLK_F_DISCARD)) {
+		rc = virtio_config_get(vbdev->vdev,
+			__offsetof(struct virtio_blk_config,
+				   max_discard_sectors),
+			&max_discard_sectors,
+			sizeof(max_discard_sectors),
+			1);
+		if (unlikely(rc)) {
+			uk_pr_err("Failed to get max discard sectors %d\n",
+					rc);
+			goto exit;
+		}
+		if (!max_discard_sectors)
+			max_discard_sectors = UINT32_MAX;
+	}
+
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_BLK_F_WRITE_ZEROES)) {
+		rc = virtio_config_get(vbdev->vdev,
+			__offsetof(struct virtio_blk_config,
+				   max_write_zeroes_sectors),
+			&max_write_zeroes_sectors,
+			sizeof(max_write_zeroes_sectors),
+			1);
+		if (unlikely(rc)) {
+			uk_pr_err("Failed to get max write zeroes sectors %d\n",
+					rc);
+			goto exit;
+		}
+		if (!max_write_zeroes_sectors)
+			max_write_zeroes_sectors = UINT32_MAX;
+	}
+
 	cap->ssize = ssize;
 	cap->sectors = sectors;
 	cap->ioalign = sizeof(void *);
@@ -858,6 +1044,9 @@ static int virtio_blkdev_feature_negotiate(struct virtio_blk_device *vbdev)
 			host_features, VIRTIO_BLK_F_RO)) ? O_RDONLY : O_RDWR;
 	cap->max_sectors_per_req =
 			max_size_segment / ssize * (max_segments - 2);
+	cap->max_segments = MIN(max_segments - 2, UINT16_MAX);
+	cap->max_discard_sectors = max_discard_sectors;
+	cap->max_write_zeroes_sectors = max_write_zeroes_sectors;
 
 	vbdev->max_vqueue_pairs = num_queues;
 	vbdev->max_segments = max_segments;
@@ -68,6 +68,12 @@ struct virtqueue {
 	UK_TAILQ_ENTRY(struct virtqueue) next;
 	/* EVENT_IDX notification suppression is used */
 	__u8 uses_event_idx;
+	/* Packed ring layout is used (VIRTIO_F_RING_PACKED) */
+	__u8 uses_packed;
+	/* Buffers are used in the order they were made available
+	 * (VIRTIO_F_IN_ORDER)
+	 */
+	__u8 uses_in_order;
 	/* Private data structure used by the driver of the queue */
 	void *priv;
 };
@@ -83,7 +89,8 @@ struct virtqueue {
 __paddr_t virtqueue_physaddr(struct virtqueue *vq);
 
 /**
- * Fetch the avail address of the descriptor ring.
+ * Fetch the avail address of the descriptor ring. With packed virtqueues,
+ * this is the address of the driver event suppression structure.
  * @param vq
  *	Reference to the virtqueue.
  *
@@ -93,7 +100,8 @@ __paddr_t virtqueue_physaddr(struct virtqueue *vq);
 __paddr_t virtqueue_get_avail_addr(struct virtqueue *vq);
 
 /**
- * Fetch the used address of the descriptor ring.
+ * Fetch the used address of the descriptor ring. With packed virtqueues,
+ * this is the address of the device event suppression structure.
  * @param vq
  *	Reference to the virtqueue.
  *
@@ -168,6 +176,30 @@ int virtqueue_notify_enabled(struct virtqueue *vq);
  */
 int virtqueue_buffer_dequeue(struct virtqueue *vq, void **cookie, __u32 *len);
 
+/**
+ * Remove a burst of user buffers from the virtqueue. The used ring is
+ * synchronized only once for the whole burst, and with VIRTIO_F_IN_ORDER
+ * buffers are retired without walking their descriptor chains.
+ *
+ * @param vq
+ *	Reference to the virtqueue.
+ * @param cookie
+ *	Array of at least `*cnt` entries that receives the cookies of the
+ *	dequeued buffers, in the order they were used by the device.
+ * @param len
+ *	Array of at least `*cnt` entries that receives the length of the data
+ *	written by the device into each buffer. Can be NULL.
+ * @param[in,out] cnt
+ *	Maximum number of buffers to dequeue. On return, it contains the
+ *	number of buffers that were dequeued.
+ * @return
+ *	>= 0 At least one buffer was dequeued from the ring and the count
+ *	indicates the number of used slots in the ring after dequeueing.
+ *	-ENOMSG There was no used buffer in the ring, `*cnt` is set to 0.
+ */
+int virtqueue_buffer_dequeue_burst(struct virtqueue *vq, void **cookie,
+				   __u32 *len, __u16 *cnt);
+
 /**
  * Create a descriptor chain starting at index head,
  * using vq->bufs also starting at index head.
@@ -115,6 +115,12 @@ static void vm_set_features(struct virtio_dev *vdev)
 	/* Give virtio_ring a chance to accept features. */
 	vdev->features = virtqueue_feature_negotiate(vdev->features);
 
+	/* Legacy devices configure the queue with a single page frame number
+	 * that implies the split ring layout.
+	 */
+	if (vm_dev->version == 1)
+		vdev->features &= ~(1ULL << VIRTIO_F_RING_PACKED);
+
 	/* Make sure there are no mixed devices */
 	if (vm_dev->version == 2 &&
 	    !uk_test_bit(VIRTIO_F_VERSION_1, &vdev->features)) {
@@ -0,0 +1,374 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+#include <errno.h>
+
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/errptr.h>
+#include <uk/atomic.h>
+#include <uk/essentials.h>
+#include <uk/netdev.h>
+#include <uk/plat/io.h>
+#include <uk/plat/lcpu.h>
+#include <uk/plat/common/cpu.h>
+#include <virtio/virtio_bus.h>
+#include <virtio/virtio_net.h>
+
+#include "../../ring/virtqueue_vring.h"
+
+#define TEST_VQ_SIZE		16
+#define TEST_MAX_VQS		(2 * 8 + 1)
+#define TEST_CMD_MAX		16
+
+/* Emulated virtio-net device. It offers a MAC address and, optionally, a
+ * control queue and multiple queue pairs. Commands on the control queue are
+ * recorded and answered with `ack`.
+ */
+struct test_vnet {
+	struct virtio_dev vdev;
+	__u64 host_features;
+	__u8 status;
+	struct virtio_net_config config;
+	/* Number of virtqueues the driver asked for */
+	__u16 nr_vqs;
+	struct virtqueue *vqs[TEST_MAX_VQS];
+	__u16 ctrl_idx;
+	virtio_net_ctrl_ack ack;
+	/* Last command received on the control queue */
+	unsigned int nr_cmds;
+	__u8 cmd[TEST_CMD_MAX];
+	__u32 cmd_len;
+};
+
+#define to_test_vnet(vdev) __containerof(vdev, struct test_vnet, vdev)
+
+static void test_vnet_reset(struct virtio_dev *vdev)
+{
+	to_test_vnet(vdev)->status = 0;
+}
+
+static int test_vnet_config_get(struct virtio_dev *vdev, __u16 offset,
+				void *buf, __u32 len, __u8 type_len __unused)
+{
+	struct test_vnet *tv = to_test_vnet(vdev);
+
+	if (offset + len > sizeof(tv->config))
+		return -EINVAL;
+	memcpy(buf, (__u8 *)&tv->config + offset, len);
+	return 0;
+}
+
+static __u64 test_vnet_features_get(struct virtio_dev *vdev)
+{
+	return to_test_vnet(vdev)->host_features;
+}
+
+static void test_vnet_features_set(struct virtio_dev *vdev __unused)
+{
+}
+
+static __u8 test_vnet_status_get(struct virtio_dev *vdev)
+{
+	return to_test_vnet(vdev)->status;
+}
+
+static void test_vnet_status_set(struct virtio_dev *vdev, __u8 status)
+{
+	to_test_vnet(vdev)->status = status;
+}
+
+static int test_vnet_vqs_find(struct virtio_dev *vdev, __u16 num_vq,
+			      __u16 *vq_size)
+{
+	struct test_vnet *tv = to_test_vnet(vdev);
+	__u16 i;
+
+	if (num_vq > TEST_MAX_VQS)
+		return -ENOENT;
+
+	tv->nr_vqs = num_vq;
+	for (i = 0; i < num_vq; i++)
+		vq_size[i] = TEST_VQ_SIZE;
+	return num_vq;
+}
+
+/* The device only sees physical addresses. All buffers of a control command
+ * are part of the request that the driver passes as cookie.
+ */
+static void *test_vnet_buf(void *cookie, __u64 paddr)
+{
+	char *v = (char *)cookie + (paddr - ukplat_virt_to_phys(cookie));
+
+	UK_ASSERT(ukplat_virt_to_phys(v) == paddr);
+	return v;
+}
+
+static void test_vnet_ctrl(struct test_vnet *tv, struct virtqueue *vq)
+{
+	struct virtqueue_vring *vrq = to_virtqueue_vring(vq);
+	struct vring *vr = &vrq->vring;
+	__u16 avail_idx, head, d, used_idx;
+	void *cookie, *buf;
+
+	avail_idx = UK_READ_ONCE(vr->avail->idx);
+	rmb();
+	while (tv->ctrl_idx != avail_idx) {
+		head = vr->avail->ring[tv->ctrl_idx & (vr->num - 1)];
+		cookie = vrq->vq_info[head].cookie;
+
+		tv->cmd_len = 0;
+		d = head;
+		for (;;) {
+			buf = test_vnet_buf(cookie, vr->desc[d].addr);
+			if (vr->desc[d].flags & VRING_DESC_F_WRITE) {
+				*(virtio_net_ctrl_ack *)buf = tv->ack;
+			} else {
+				UK_ASSERT(tv->cmd_len + vr->desc[d].len <=
+					  TEST_CMD_MAX);
+				memcpy(&tv->cmd[tv->cmd_len], buf,
+				       vr->desc[d].len);
+				tv->cmd_len += vr->desc[d].len;
+			}
+			if (!(vr->desc[d].flags & VRING_DESC_F_NEXT))
+				break;
+			d = vr->desc[d].next;
+		}
+		tv->nr_cmds++;
+		tv->ctrl_idx++;
+
+		used_idx = vr->used->idx & (vr->num - 1);
+		vr->used->ring[used_idx].id = head;
+		vr->used->ring[used_idx].len = sizeof(virtio_net_ctrl_ack);
+		wmb();
+		vr->used->idx++;
+	}
+}
+
+static int test_vnet_notify(struct virtio_dev *vdev, __u16 queue_id)
+{
+	struct test_vnet *tv = to_test_vnet(vdev);
+
+	/* The control queue is the last one */
+	if (VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_NET_F_CTRL_VQ) &&
+	    queue_id == tv->nr_vqs - 1)
+		test_vnet_ctrl(tv, tv->vqs[queue_id]);
+	return 0;
+}
+
+static struct virtqueue *test_vnet_vq_setup(struct virtio_dev *vdev,
+					    __u16 queue_id, __u16 num_desc,
+					    virtqueue_callback_t callback,
+					    struct uk_alloc *a)
+{
+	struct test_vnet *tv = to_test_vnet(vdev);
+	struct virtqueue *vq;
+
+	if (queue_id >= tv->nr_vqs)
+		return ERR2PTR(-ENOENT);
+
+	vq = virtqueue_create(queue_id, num_desc, __PAGE_SIZE, callback,
+			      test_vnet_notify, vdev, a);
+	if (PTRISERR(vq))
+		return vq;
+
+	UK_TAILQ_INSERT_TAIL(&vdev->vqs, vq, next);
+	tv->vqs[queue_id] = vq;
+	return vq;
+}
+
+static struct virtio_config_ops test_vnet_cops = {
+	.device_reset = test_vnet_reset,
+	.config_get = test_vnet_config_get,
+	.features_get = test_vnet_features_get,
+	.features_set = test_vnet_features_set,
+	.status_get = test_vnet_status_get,
+	.status_set = test_vnet_status_set,
+	.vqs_find = test_vnet_vqs_find,
+	.vq_setup = test_vnet_vq_setup,
+};
+
+/* Registers the emulated device with the virtio bus and returns the netdev
+ * that the driver created for it, or NULL on failure
+ */
+static struct uk_netdev *test_vnet_add(struct test_vnet *tv, int mq,
+				       __u16 max_pairs)
+{
+	static const __u8 mac[UK_NETDEV_HWADDR_LEN] = { 0x02, 0, 0, 0, 0, 1 };
+	unsigned int count = uk_netdev_count();
+
+	memset(tv, 0, sizeof(*tv));
+	tv->vdev.id.virtio_device_id = VIRTIO_ID_NET;
+	tv->vdev.cops = &test_vnet_cops;
+	tv->ack = VIRTIO_NET_OK;
+	memcpy(tv->config.mac, mac, sizeof(mac));
+
+	VIRTIO_FEATURE_SET(tv->host_features, VIRTIO_NET_F_MAC);
+	if (mq) {
+		VIRTIO_FEATURE_SET(tv->host_features, VIRTIO_NET_F_CTRL_VQ);
+		VIRTIO_FEATURE_SET(tv->host_features, VIRTIO_NET_F_MQ);
+		tv->config.max_virtqueue_pairs = max_pairs;
+	}
+
+	if (virtio_bus_register_device(&tv->vdev) < 0 ||
+	    uk_netdev_count() != count + 1)
+		return NULL;
+	return uk_netdev_get(count);
+}
+
+static __u16 test_rx_alloc(void *argp __unused,
+			   struct uk_netbuf *pkts[] __unused, __u16 count __unused)
+{
+	/* Nothing is received, so the queues can stay empty */
+	return 0;
+}
+
+/* Configures `pairs` queue pairs and starts the device */
+static int test_vnet_start(struct uk_netdev *dev, __u16 pairs)
+{
+	struct uk_netdev_conf conf = {
+		.nb_rx_queues = pairs,
+		.nb_tx_queues = pairs,
+	};
+	struct uk_netdev_rxqueue_conf rxq_conf = {
+		.a = uk_alloc_get_default(),
+		.alloc_rxpkts = test_rx_alloc,
+	};
+	struct uk_netdev_txqueue_conf txq_conf = {
+		.a = uk_alloc_get_default(),
+	};
+	__u16 i;
+	int rc;
+
+	rc = uk_netdev_configure(dev, &conf);
+	if (rc < 0)
+		return rc;
+
+	/* Queues may be configured in any order */
+	for (i = pairs; i > 0; i--) {
+		rc = uk_netdev_rxq_configure(dev, i - 1, 0, &rxq_conf);
+		if (rc < 0)
+			return rc;
+		rc = uk_netdev_txq_configure(dev, i - 1, 0, &txq_conf);
+		if (rc < 0)
+			return rc;
+	}
+
+	return uk_netdev_start(dev);
+}
+
+static __u16 test_expected_pairs(__u16 max_pairs)
+{
+	return MIN((__u32)max_pairs,
+		   MIN(ukplat_lcpu_count(),
+		       (__u32)CONFIG_LIBUKNETDEV_MAXNBQUEUES));
+}
+
+UK_TESTCASE(virtio_net_mq, test_single_pair)
+{
+	static struct test_vnet tv;
+	struct uk_netdev_info info;
+	struct uk_netdev *dev;
+
+	dev = test_vnet_add(&tv, 0, 0);
+	UK_TEST_EXPECT_NOT_NULL(dev);
+	UK_TEST_EXPECT_SNUM_EQ(uk_netdev_probe(dev), 0);
+
+	uk_netdev_info_get(dev, &info);
+	UK_TEST_EXPECT_SNUM_EQ(info.max_rx_queues, 1);
+	UK_TEST_EXPECT_SNUM_EQ(info.max_tx_queues, 1);
+
+	/* Without a control queue only the first pair is requested */
+	UK_TEST_EXPECT_SNUM_EQ(test_vnet_start(dev, 1), 0);
+	UK_TEST_EXPECT_SNUM_EQ(tv.nr_vqs, 2);
+	UK_TEST_EXPECT_SNUM_EQ(tv.nr_cmds, 0);
+}
+
+UK_TESTCASE(virtio_net_mq, test_multi_pair)
+{
+	static struct test_vnet tv;
+	struct uk_netdev_info info;
+	struct uk_netdev *dev;
+	__u16 pairs = test_expected_pairs(4);
+	struct virtio_net_ctrl_mq mq;
+
+	dev = test_vnet_add(&tv, 1, 4);
+	UK_TEST_EXPECT_NOT_NULL(dev);
+	UK_TEST_EXPECT_SNUM_EQ(uk_netdev_probe(dev), 0);
+
+	/* Not more pairs than the device offers or than there are LCPUs */
+	uk_netdev_info_get(dev, &info);
+	UK_TEST_EXPECT_SNUM_EQ(info.max_rx_queues, pairs);
+	UK_TEST_EXPECT_SNUM_EQ(info.max_tx_queues, pairs);
+
+	UK_TEST_EXPECT_SNUM_EQ(test_vnet_start(dev, pairs), 0);
+
+	/* The control queue follows all pairs offered by the device */
+	UK_TEST_EXPECT_SNUM_EQ(tv.nr_vqs, 2 * 4 + 1);
+	UK_TEST_EXPECT_NOT_NULL(tv.vqs[2 * 4]);
+	UK_TEST_EXPECT_NOT_NULL(tv.vqs[2 * (pairs - 1)]);
+	UK_TEST_EXPECT_NOT_NULL(tv.vqs[2 * (pairs - 1) + 1]);
+
+	/* The number of used pairs is announced once on start */
+	UK_TEST_EXPECT_SNUM_EQ(tv.nr_cmds, 1);
+	UK_TEST_EXPECT_SNUM_EQ(tv.cmd_len,
+			       sizeof(struct virtio_net_ctrl_hdr) + sizeof(mq));
+	UK_TEST_EXPECT_SNUM_EQ(tv.cmd[0], VIRTIO_NET_CTRL_MQ);
+	UK_TEST_EXPECT_SNUM_EQ(tv.cmd[1], VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET);
+	memcpy(&mq, &tv.cmd[sizeof(struct virtio_net_ctrl_hdr)], sizeof(mq));
+	UK_TEST_EXPECT_SNUM_EQ(mq.virtqueue_pairs, pairs);
+}
+
+UK_TESTCASE(virtio_net_mq, test_queue_combination)
+{
+	static struct test_vnet tv;
+	struct uk_netdev_conf conf = { 0 };
+	struct uk_netdev *dev;
+	__u16 pairs = test_expected_pairs(4);
+
+	dev = test_vnet_add(&tv, 1, 4);
+	UK_TEST_EXPECT_NOT_NULL(dev);
+	UK_TEST_EXPECT_SNUM_EQ(uk_netdev_probe(dev), 0);
+
+	/* RX and TX queues come in pairs */
+	conf.nb_rx_queues = pairs;
+	conf.nb_tx_queues = pairs - 1;
+	UK_TEST_EXPECT_SNUM_LT(uk_netdev_configure(dev, &conf), 0);
+
+	conf.nb_rx_queues = pairs + 1;
+	conf.nb_tx_queues = pairs + 1;
+	UK_TEST_EXPECT_SNUM_LT(uk_netdev_configure(dev, &conf), 0);
+
+	UK_TEST_EXPECT_SNUM_EQ(tv.nr_vqs, 0);
+}
+
+UK_TESTCASE(virtio_net_mq, test_invalid_pairs)
+{
+	static struct test_vnet tv;
+	struct uk_netdev *dev;
+
+	dev = test_vnet_add(&tv, 1, 0);
+	UK_TEST_EXPECT_NOT_NULL(dev);
+	UK_TEST_EXPECT_SNUM_EQ(uk_netdev_probe(dev), -EINVAL);
+	UK_TEST_EXPECT(tv.status & VIRTIO_CONFIG_STATUS_FAIL);
+}
+
+UK_TESTCASE(virtio_net_mq, test_rejected)
+{
+	static struct test_vnet tv;
+	struct uk_netdev *dev;
+
+	dev = test_vnet_add(&tv, 1, 2);
+	UK_TEST_EXPECT_NOT_NULL(dev);
+	UK_TEST_EXPECT_SNUM_EQ(uk_netdev_probe(dev), 0);
+
+	/* Starting fails if the device does not accept the pairs */
+	tv.ack = VIRTIO_NET_ERR;
+	UK_TEST_EXPECT_SNUM_EQ(test_vnet_start(dev, 1), -EIO);
+	UK_TEST_EXPECT_SNUM_EQ(tv.nr_cmds, 1);
+}
+
+uk_testsuite_register(virtio_net_mq, NULL);
@@ -58,6 +58,19 @@
 #define VTNET_HDR_SIZE_PADDED(_vndev)			\
 	(ALIGN_UP((size_t)virtio_net_hdr_size(_vndev), 4) + 4)
 
+/**
+ * With mergeable buffers, the device writes the VirtIO header and the frame
+ * contiguously to a single descriptor and may spread a packet over multiple
+ * receive buffers.
+ */
+#define VTNET_RX_MRG(_vndev)					\
+	VIRTIO_FEATURE_HAS((_vndev)->vdev->features, VIRTIO_NET_F_MRG_RXBUF)
+
+/* Headroom of a receive buffer that is occupied by the VirtIO header */
+#define VTNET_RX_HDR_ROOM(_vndev)				\
+	(VTNET_RX_MRG(_vndev) ? (size_t)virtio_net_hdr_size(_vndev)	\
+			      : VTNET_HDR_SIZE_PADDED(_vndev))
+
 #define  VTNET_INTR_EN				UK_BIT(0)
 #define  VTNET_INTR_EN_MASK			0x01
 #define  VTNET_INTR_USR_EN			UK_BIT(1)
@@ -68,6 +81,13 @@
  */
 #define NET_MAX_FRAGMENTS    ((__U16_MAX >> __PAGE_SHIFT) + 2)
 
+/**
+ * Number of used buffers taken off a virtqueue at once.
+ */
+#define VTNET_DEQUEUE_BURST  32
+/* Maximum size of the command-specific data of a control queue command */
+#define VTNET_CTRL_DATA_MAX  8
+
 #define to_virtionetdev(ndev) \
 	__containerof(ndev, struct virtio_net_device, netdev)
 
@@ -125,6 +145,18 @@ struct uk_netdev_rx_queue {
 	struct uk_sglist_seg sgsegs[NET_MAX_FRAGMENTS];
 };
 
+/**
+ * @internal buffer for a command sent over the control queue.
+ */
+struct virtio_net_ctrl {
+	struct virtio_net_ctrl_hdr hdr;
+	__u8 data[VTNET_CTRL_DATA_MAX];
+	/* Keep the device-writable part apart from the device-readable one,
+	 * otherwise uk_sglist merges them into a single segment.
+	 */
+	virtio_net_ctrl_ack ack __align(16);
+};
+
 struct virtio_net_device {
 	/* Virtio Device */
 	struct virtio_dev *vdev;
@@ -133,6 +165,13 @@ struct virtio_net_device {
 	struct uk_netdev netdev;
 	/* Count of the number of the virtqueues */
 	__u16 max_vqueue_pairs;
+	/* Count of the queue pairs offered by the device */
+	__u16 dev_vqueue_pairs;
+	/* Count of the queue pairs in use */
+	__u16 nb_vqueue_pairs;
+	/* Control queue, if VIRTIO_NET_F_CTRL_VQ is negotiated */
+	struct virtqueue *ctrlq;
+	struct virtio_net_ctrl *ctrl;
 	/* List of the Rx/Tx queue */
 	__u16    rx_vqueue_cnt;
 	struct   uk_netdev_rx_queue *rxqs;
@@ -184,9 +223,17 @@ static void virtio_netdev_xmit_free(struct uk_netdev_tx_queue *txq);
 static int virtio_netdev_xmit(struct uk_netdev *dev,
 			      struct uk_netdev_tx_queue *queue,
 			      struct uk_netbuf *pkt);
+static int virtio_netdev_xmit_burst(struct uk_netdev *dev,
+				    struct uk_netdev_tx_queue *queue,
+				    struct uk_netbuf **pkts,
+				    __u16 *cnt);
 static int virtio_netdev_recv(struct uk_netdev *dev,
 			      struct uk_netdev_rx_queue *queue,
 			      struct uk_netbuf **pkt);
+static int virtio_netdev_recv_burst(struct uk_netdev *dev,
+				    struct uk_netdev_rx_queue *queue,
+				    struct uk_netbuf **pkts,
+				    __u16 *cnt);
 static const struct uk_hwaddr *virtio_net_mac_get(struct uk_netdev *n);
 static __u16 virtio_net_mtu_get(struct uk_netdev *n);
 static unsigned virtio_net_promisc_get(struct uk_netdev *n);
@@ -263,25 +310,27 @@ static int virtio_netdev_recv_done(struct virtqueue *vq, void *priv)
 
 static void virtio_netdev_xmit_free(struct uk_netdev_tx_queue *txq)
 {
-	struct uk_netbuf *pkt = NULL;
+	struct uk_netbuf *pkts[VTNET_DEQUEUE_BURST];
 	int cnt = 0;
-	int rc;
+	__u16 i, nr;
 
-	for (;;) {
-		rc = virtqueue_buffer_dequeue(txq->vq, (void **) &pkt, NULL);
-		if (rc < 0)
-			break;
+	do {
+		nr = ARRAY_SIZE(pkts);
+		virtqueue_buffer_dequeue_burst(txq->vq, (void **) pkts, NULL,
+					       &nr);
 
-		UK_ASSERT(pkt);
+		for (i = 0; i < nr; i++) {
+			UK_ASSERT(pkts[i]);
 
-		/**
-		 * Releasing the free buffer back to netbuf. The netbuf could
-		 * use the destructor to inform the stack regarding the free up
-		 * of memory.
-		 */
-		uk_netbuf_free(pkt);
-		cnt++;
-	}
+			/**
+			 * Releasing the free buffer back to netbuf. The netbuf
+			 * could use the destructor to inform the stack
+			 * regarding the free up of memory.
+			 */
+			uk_netbuf_free(pkts[i]);
+		}
+		cnt += nr;
+	} while (nr == ARRAY_SIZE(pkts));
 	uk_pr_debug("Free %"__PRIu16" descriptors\n", cnt);
 }
 
@@ -298,26 +347,30 @@ static int virtio_netdev_rx_fillup(struct virtio_net_device *vndev,
 	__u16 req;
 	__u16 cnt = 0;
 	__u16 filled = 0;
+	__u16 per_buf;
 
 	/**
-	 * Fixed amount of memory is allocated to each received buffer. In
-	 * our case since we don't support jumbo frame or LRO yet we require
-	 * that the buffer feed to the ring descriptor is atleast
-	 * ethernet MTU + virtio net header.
-	 * Because we using 2 descriptor for a single netbuf, our effective
-	 * queue size is just the half.
+	 * Fixed amount of memory is allocated to each received buffer. Without
+	 * mergeable buffers, we require that the buffer feed to the ring
+	 * descriptor is atleast ethernet MTU + virtio net header and we use
+	 * 2 descriptors for a single netbuf, so that our effective queue size
+	 * is just the half. With mergeable buffers, a netbuf occupies a single
+	 * descriptor and the device spreads larger packets over multiple
+	 * netbufs.
 	 */
-	nb_desc = ALIGN_DOWN(nb_desc, 2);
+	per_buf = VTNET_RX_MRG(vndev) ? 1 : 2;
+	nb_desc -= nb_desc % per_buf;
 	while (filled < nb_desc) {
-		req = MIN(nb_desc / 2, RX_FILLUP_BATCHLEN);
+		req = MIN((nb_desc - filled) / per_buf, RX_FILLUP_BATCHLEN);
 		cnt = rxq->alloc_rxpkts(rxq->alloc_rxpkts_argp, netbuf, req);
 		for (i = 0; i < cnt; i++) {
 			uk_pr_debug("Enqueue netbuf %"PRIu16"/%"PRIu16" (%p) to virtqueue %p...\n",
 				    i + 1, cnt, netbuf[i], rxq);
 			rc = virtio_netdev_rxq_enqueue(vndev, rxq, netbuf[i]);
 			if (unlikely(rc < 0)) {
-				uk_pr_err("Failed to add a buffer to receive virtqueue %p: %d\n",
-					  rxq, rc);
+				if (rc != -ENOSPC)
+					uk_pr_err("Failed to add a buffer to receive virtqueue %p: %d\n",
+						  rxq, rc);
 
 				/*
 				 * Release netbufs that we are not going
@@ -328,7 +381,7 @@ static int virtio_netdev_rx_fillup(struct virtio_net_device *vndev,
 				status |= UK_NETDEV_STATUS_UNDERRUN;
 				goto out;
 			}
-			filled += 2;
+			filled += per_buf;
 		}
 
 		if (unlikely(cnt < req)) {
@@ -341,7 +394,7 @@ static int virtio_netdev_rx_fillup(struct virtio_net_device *vndev,
 
 out:
 	uk_pr_debug("Programmed %"PRIu16" receive netbufs to receive virtqueue %p (status %x)\n",
-		    filled / 2, rxq, status);
+		    filled / per_buf, rxq, status);
 
 	/**
 	 * Notify the host, when we submit new descriptor(s).
@@ -352,30 +405,25 @@ out:
 	return status;
 }
 
-static int virtio_netdev_xmit(struct uk_netdev *dev,
-			      struct uk_netdev_tx_queue *queue,
-			      struct uk_netbuf *pkt)
+/**
+ * Prepends the virtio header to `pkt` and adds the packet to the transmit
+ * virtqueue without notifying the host.
+ *
+ * @return
+ *   - (>=0): Number of descriptors still available on the virtqueue
+ *   - (-ENOSPC): No space left on the virtqueue, `pkt` is unchanged
+ *   - (<0): Other error (e.g., not enough headroom), `pkt` is unchanged
+ */
+static int virtio_netdev_xmit_enqueue(struct virtio_net_device *vndev,
+				      struct uk_netdev_tx_queue *queue,
+				      struct uk_netbuf *pkt)
 {
-	struct virtio_net_device *vndev;
 	struct virtio_net_hdr *vhdr;
 	int rc = 0;
-	int status = 0x0;
 	size_t total_len = 0;
 	__u8  *buf_start;
 	size_t buf_len;
 
-	UK_ASSERT(dev);
-	UK_ASSERT(pkt && queue);
-
-	vndev = to_virtionetdev(dev);
-
-	/**
-	 * We are reclaiming the free descriptors from buffers. The function is
-	 * not protected by means of locks. We need to be careful if there are
-	 * multiple context through which we free the tx descriptors.
-	 */
-	virtio_netdev_xmit_free(queue);
-
 	buf_start = pkt->data;
 	buf_len = pkt->len;
 
@@ -385,8 +433,7 @@ static int virtio_netdev_xmit(struct uk_netdev *dev,
 	rc = uk_netbuf_header(pkt, VTNET_HDR_SIZE_PADDED(vndev));
 	if (unlikely(rc != 1)) {
 		uk_pr_err("Failed to prepend virtio header\n");
-		rc = -ENOSPC;
-		goto err_exit;
+		return -EINVAL;
 	}
 	vhdr = pkt->data;
 
@@ -462,6 +509,45 @@ static int virtio_netdev_xmit(struct uk_netdev *dev,
 	 */
 	rc = virtqueue_buffer_enqueue(queue->vq, pkt, &queue->sg,
 				      queue->sg.sg_nseg, 0);
+	if (likely(rc >= 0))
+		return rc;
+
+	if (rc == -ENOSPC)
+		uk_pr_debug("No more descriptor available\n");
+	else
+		uk_pr_err("Failed to enqueue descriptors into the ring: %d\n",
+			  rc);
+
+err_remove_vhdr:
+	/**
+	 * Remove header before exiting because we could not send
+	 */
+	uk_netbuf_header(pkt, -((int16_t)VTNET_HDR_SIZE_PADDED(vndev)));
+	UK_ASSERT(rc < 0);
+	return rc;
+}
+
+static int virtio_netdev_xmit(struct uk_netdev *dev,
+			      struct uk_netdev_tx_queue *queue,
+			      struct uk_netbuf *pkt)
+{
+	struct virtio_net_device *vndev;
+	int status = 0x0;
+	int rc;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(pkt && queue);
+
+	vndev = to_virtionetdev(dev);
+
+	/**
+	 * We are reclaiming the free descriptors from buffers. The function is
+	 * not protected by means of locks. We need to be careful if there are
+	 * multiple context through which we free the tx descriptors.
+	 */
+	virtio_netdev_xmit_free(queue);
+
+	rc = virtio_netdev_xmit_enqueue(vndev, queue, pkt);
 	if (likely(rc >= 0)) {
 		status |= UK_NETDEV_STATUS_SUCCESS;
 		/**
@@ -473,24 +559,58 @@ static int virtio_netdev_xmit(struct uk_netdev *dev,
 		 * return UK_NETDEV_STATUS_MORE.
 		 */
 		status |= likely(rc > 0) ? UK_NETDEV_STATUS_MORE : 0x0;
-	} else if (rc == -ENOSPC) {
-		uk_pr_debug("No more descriptor available\n");
-		/**
-		 * Remove header before exiting because we could not send
-		 */
-		uk_netbuf_header(pkt, -((int16_t)VTNET_HDR_SIZE_PADDED(vndev)));
-	} else {
-		uk_pr_err("Failed to enqueue descriptors into the ring: %d\n",
-			  rc);
-		goto err_remove_vhdr;
+	} else if (rc != -ENOSPC) {
+		return rc;
 	}
 	return status;
+}
 
-err_remove_vhdr:
-	uk_netbuf_header(pkt, -((int16_t)VTNET_HDR_SIZE_PADDED(vndev)));
-err_exit:
-	UK_ASSERT(rc < 0);
-	return rc;
+static int virtio_netdev_xmit_burst(struct uk_netdev *dev,
+				    struct uk_netdev_tx_queue *queue,
+				    struct uk_netbuf **pkts,
+				    __u16 *cnt)
+{
+	struct virtio_net_device *vndev;
+	int status = 0x0;
+	int avail = 0;
+	int rc = 0;
+	__u16 i;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(pkts && queue);
+	UK_ASSERT(cnt);
+
+	vndev = to_virtionetdev(dev);
+
+	/* Reclaim the descriptors of finished transmissions once per batch */
+	virtio_netdev_xmit_free(queue);
+
+	for (i = 0; i < *cnt; i++) {
+		UK_ASSERT(pkts[i]);
+
+		rc = virtio_netdev_xmit_enqueue(vndev, queue, pkts[i]);
+		if (unlikely(rc < 0))
+			break;
+		avail = rc;
+		if (unlikely(avail == 0)) {
+			/* The ring is full after this packet */
+			i++;
+			break;
+		}
+	}
+	*cnt = i;
+
+	if (unlikely(i == 0))
+		return (rc == -ENOSPC) ? 0x0 : rc;
+
+	/**
+	 * Notify the host once about all new buffers.
+	 */
+	virtqueue_host_notify(queue->vq);
+
+	status |= UK_NETDEV_STATUS_SUCCESS;
+	status |= likely(avail > 0) ? UK_NETDEV_STATUS_MORE : 0x0;
+	return status;
 }
 
 static int virtio_netdev_rxq_enqueue(struct virtio_net_device *vndev,
@@ -517,7 +637,7 @@ static int virtio_netdev_rxq_enqueue(struct virtio_net_device *vndev,
 	/**
 	 * Retrieve the buffer header length.
 	 */
-	rc = uk_netbuf_header(netbuf, VTNET_HDR_SIZE_PADDED(vndev));
+	rc = uk_netbuf_header(netbuf, VTNET_RX_HDR_ROOM(vndev));
 	if (unlikely(rc != 1)) {
 		uk_pr_err("Failed to allocate space to prepend virtio header\n");
 		return -EINVAL;
@@ -527,39 +647,65 @@ static int virtio_netdev_rxq_enqueue(struct virtio_net_device *vndev,
 	sg = &rxq->sg;
 	uk_sglist_reset(sg);
 
-	/* Appending the header buffer to the sglist */
-	uk_sglist_append(sg, rxhdr, virtio_net_hdr_size(vndev));
+	if (VTNET_RX_MRG(vndev)) {
+		/* Header and data share a single descriptor */
+		uk_sglist_append(sg, rxhdr, netbuf->len);
+	} else {
+		/* Appending the header buffer to the sglist */
+		uk_sglist_append(sg, rxhdr, virtio_net_hdr_size(vndev));
 
-	/* Appending the data buffer to the sglist */
-	uk_sglist_append(sg, buf_start, buf_len);
+		/* Appending the data buffer to the sglist */
+		uk_sglist_append(sg, buf_start, buf_len);
+	}
 
 	rc = virtqueue_buffer_enqueue(rxq->vq, netbuf, sg, 0,
 				      sg->sg_nseg);
 	return rc;
 }
 
-static int virtio_netdev_rxq_dequeue(struct virtio_net_device *vndev,
+/**
+ * Prepares a received buffer of `len` bytes (including the virtio header)
+ * for the network stack. With mergeable buffers, the remaining buffers of
+ * the packet are taken from `bufs` first and then from the virtqueue, and are
+ * chained to `buf`.
+ *
+ * @param bufs
+ *   Further buffers that were already dequeued, `lens` holds their lengths
+ * @param nr_bufs
+ *   Number of buffers in `bufs`. Set to the number of buffers that were
+ *   consumed from `bufs`, also on failure.
+ * @param inuse
+ *   Updated to the number of used descriptors if buffers had to be dequeued
+ * @return
+ *   0 on success, <0 on failure. In both cases all consumed buffers of the
+ *   packet are chained to `buf`.
+ */
+static int virtio_netdev_rxq_prepare(struct virtio_net_device *vndev,
 				     struct uk_netdev_rx_queue *rxq,
-				     struct uk_netbuf **netbuf)
+				     struct uk_netbuf *buf, __u32 len,
+				     struct uk_netbuf **bufs, __u32 *lens,
+				     __u16 *nr_bufs, int *inuse)
 {
-	int ret;
 	int rc __maybe_unused = 0;
-	struct uk_netbuf *buf = NULL;
 	struct virtio_net_hdr *vhdr;
-	__u32 len;
+	struct uk_netbuf *seg, *tail;
+	__u16 hdr_size = virtio_net_hdr_size(vndev);
+	__u16 hdr_room = VTNET_RX_HDR_ROOM(vndev);
+	__u16 consumed = 0;
+	__u16 num_buffers;
+	__u32 seg_len;
+	int ret = 0;
 
-	UK_ASSERT(netbuf);
-
-	ret = virtqueue_buffer_dequeue(rxq->vq, (void **) &buf, &len);
-	if (ret < 0) {
-		uk_pr_debug("No data available in the queue\n");
-		*netbuf = NULL;
-		return rxq->nb_desc;
-	}
-	if (unlikely((len < (__u32)virtio_net_hdr_size(vndev) + UK_ETH_HDR_UNTAGGED_LEN) ||
-		     len > VIRTIO_PKT_BUFFER_LEN(vndev))) {
+	/**
+	 * With mergeable buffers, `buf->len` still covers the whole buffer
+	 * that we programmed to the descriptor.
+	 */
+	if (unlikely((len < (__u32)hdr_size + UK_ETH_HDR_UNTAGGED_LEN) ||
+		     len > (VTNET_RX_MRG(vndev) ? buf->len
+			    : VIRTIO_PKT_BUFFER_LEN(vndev)))) {
 		uk_pr_err("Received invalid packet size: %"__PRIu32"\n", len);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 
 	/**
@@ -574,18 +720,104 @@ static int virtio_netdev_rxq_dequeue(struct virtio_net_device *vndev,
 		/* NOTE: csum_start is without virtio header
 		 *       (uk_netbuf_header() will remove it again)
 		 */
-		buf->csum_start  = vhdr->csum_start + VTNET_HDR_SIZE_PADDED(vndev);
+		buf->csum_start  = vhdr->csum_start + hdr_room;
+	}
+	switch (vhdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+	case VIRTIO_NET_HDR_GSO_TCPV4:
+		buf->flags |= UK_NETBUF_F_GSO_TCPV4;
+		break;
+	case VIRTIO_NET_HDR_GSO_TCPV6:
+		buf->flags |= UK_NETBUF_F_GSO_TCPV6;
+		break;
+	default:
+		break;
+	}
+	if (buf->flags & (UK_NETBUF_F_GSO_TCPV4 | UK_NETBUF_F_GSO_TCPV6)) {
+		buf->header_len = vhdr->hdr_len;
+		buf->gso_size   = vhdr->gso_size;
 	}
+	num_buffers = VTNET_RX_MRG(vndev) ? vhdr->num_buffers : 1;
 
 	/**
 	 * Removing the virtio header from the buffer and adjusting length.
-	 * We pad the rx buffer while enqueuing for alignment of the packet
-	 * data. We compensate for this by subtracting the padding to the
-	 * length on dequeue.
+	 * Without mergeable buffers, we pad the rx buffer while enqueuing for
+	 * alignment of the packet data. We compensate for this by adding the
+	 * padding to the length before removing it again.
 	 */
-	buf->len = len + VTNET_HDR_SIZE_PADDED(vndev);
-	rc = uk_netbuf_header(buf, -((int16_t)VTNET_HDR_SIZE_PADDED(vndev)));
+	buf->len = len - hdr_size + hdr_room;
+	rc = uk_netbuf_header(buf, -((int16_t)hdr_room));
 	UK_ASSERT(rc == 1);
+
+	if (unlikely(num_buffers == 0)) {
+		uk_pr_err("Received packet without buffers\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/**
+	 * Continuation buffers carry frame data only, starting at the
+	 * beginning of the buffer. We consume all of them even if one is
+	 * invalid, so that they are not mistaken for new packets.
+	 */
+	tail = buf;
+	while (--num_buffers) {
+		if (consumed < *nr_bufs) {
+			seg = bufs[consumed];
+			seg_len = lens[consumed];
+			consumed++;
+		} else {
+			rc = virtqueue_buffer_dequeue(rxq->vq, (void **) &seg,
+						      &seg_len);
+			if (unlikely(rc < 0)) {
+				uk_pr_err("Received incomplete packet: %"__PRIu16" buffers missing\n",
+					  num_buffers);
+				ret = -EINVAL;
+				goto out;
+			}
+			*inuse = rc;
+		}
+
+		if (unlikely(seg_len > seg->len)) {
+			uk_pr_err("Received invalid buffer size: %"__PRIu32"\n",
+				  seg_len);
+			ret = -EINVAL;
+		}
+		seg->len = seg_len;
+		uk_netbuf_connect(tail, seg);
+		tail = seg;
+	}
+
+out:
+	*nr_bufs = consumed;
+	return ret;
+}
+
+static int virtio_netdev_rxq_dequeue(struct virtio_net_device *vndev,
+				     struct uk_netdev_rx_queue *rxq,
+				     struct uk_netbuf **netbuf)
+{
+	int ret;
+	int rc;
+	struct uk_netbuf *buf = NULL;
+	__u32 len;
+	__u16 nr_bufs = 0;
+
+	UK_ASSERT(netbuf);
+
+	ret = virtqueue_buffer_dequeue(rxq->vq, (void **) &buf, &len);
+	if (ret < 0) {
+		uk_pr_debug("No data available in the queue\n");
+		*netbuf = NULL;
+		return rxq->nb_desc;
+	}
+
+	rc = virtio_netdev_rxq_prepare(vndev, rxq, buf, len, NULL, NULL,
+				       &nr_bufs, &ret);
+	if (unlikely(rc < 0)) {
+		uk_netbuf_free(buf);
+		*netbuf = NULL;
+		return rc;
+	}
 	*netbuf = buf;
 
 	return ret;
@@ -662,6 +894,106 @@ err_exit:
 	return rc;
 }
 
+static int virtio_netdev_recv_burst(struct uk_netdev *dev,
+				    struct uk_netdev_rx_queue *queue,
+				    struct uk_netbuf **pkts,
+				    __u16 *cnt)
+{
+	struct virtio_net_device *vndev;
+	__u32 lens[VTNET_DEQUEUE_BURST];
+	int status = 0x0;
+	int inuse = -1;
+	int rc = 0;
+	__u16 i, j, n, nr, nr_max, nr_deq, base, nr_bufs;
+
+	UK_ASSERT(dev && queue);
+	UK_ASSERT(pkts);
+	UK_ASSERT(cnt);
+
+	vndev = to_virtionetdev(dev);
+	n = *cnt;
+
+	/* Queue interrupts have to be off when calling receive */
+	UK_ASSERT(!(queue->intr_enabled & VTNET_INTR_EN));
+
+	i = 0;
+	nr_deq = 0;
+again:
+	while (i < n) {
+		nr_max = MIN(n - i, VTNET_DEQUEUE_BURST);
+		nr = nr_max;
+		base = i;
+		rc = virtqueue_buffer_dequeue_burst(queue->vq,
+						    (void **) &pkts[base],
+						    lens, &nr);
+		if (rc < 0)
+			break;
+		inuse = rc;
+		nr_deq += nr;
+
+		/**
+		 * Drop invalid packets by compacting the array in place.
+		 * Buffers that continue a packet are chained to its first
+		 * buffer and skipped.
+		 */
+		for (j = 0; j < nr; j++) {
+			pkts[i] = pkts[base + j];
+			nr_bufs = nr - j - 1;
+			rc = virtio_netdev_rxq_prepare(vndev, queue, pkts[i],
+						       lens[j],
+						       &pkts[base + j + 1],
+						       &lens[j + 1], &nr_bufs,
+						       &inuse);
+			j += nr_bufs;
+			if (unlikely(rc < 0)) {
+				uk_netbuf_free(pkts[i]);
+				continue;
+			}
+			i++;
+		}
+
+		/* The queue is drained */
+		if (nr < nr_max)
+			break;
+	}
+	*cnt = i;
+
+	/**
+	 * Re-program the descriptors of the whole batch with a single
+	 * notification to the host.
+	 */
+	if (nr_deq > 0) {
+		status |= (i > 0) ? UK_NETDEV_STATUS_SUCCESS : 0x0;
+		status |= virtio_netdev_rx_fillup(vndev, queue,
+						  (queue->nb_desc - inuse), 1);
+	}
+
+	if (queue->intr_enabled & VTNET_INTR_USR_EN_MASK) {
+		/* Keep the interrupt off if we stopped on a full batch */
+		if (i == n && virtqueue_hasdata(queue->vq))
+			return status | UK_NETDEV_STATUS_MORE;
+
+		/* Need to enable the interrupt on the last packet */
+		rc = virtqueue_intr_enable(queue->vq);
+		if (rc == 1) {
+			/**
+			 * Packets arrived after reading the queue and before
+			 * enabling the interrupt
+			 */
+			if (nr_deq == 0)
+				goto again;
+			status |= UK_NETDEV_STATUS_MORE;
+		}
+	} else if (nr_deq > 0) {
+		/**
+		 * For polling case, we report always there are further
+		 * packets unless the queue is empty.
+		 */
+		status |= UK_NETDEV_STATUS_MORE;
+	}
+	return status;
+}
+
 static struct uk_netdev_rx_queue *virtio_netdev_rx_queue_setup(
 				struct uk_netdev *n, uint16_t queue_id,
 				uint16_t nb_desc,
@@ -676,7 +1008,7 @@ static struct uk_netdev_rx_queue *virtio_netdev_rx_queue_setup(
 	UK_ASSERT(conf->alloc_rxpkts);
 
 	vndev = to_virtionetdev(n);
-	if (queue_id >= vndev->max_vqueue_pairs) {
+	if (queue_id >= vndev->nb_vqueue_pairs) {
 		uk_pr_err("Invalid virtqueue identifier: %"__PRIu16"\n",
 			  queue_id);
 		rc = -EINVAL;
@@ -728,13 +1060,13 @@ static int virtio_netdev_vqueue_setup(struct virtio_net_device *vndev,
 	uint16_t max_desc, hwvq_id;
 	struct virtqueue *vq;
 
+	/* Queues can be set up in any order, so index them by their id */
+	id = queue_id;
 	if (queue_type == VNET_RX) {
-		id = vndev->rx_vqueue_cnt;
 		callback = virtio_netdev_recv_done;
 		max_desc = vndev->rxqs[id].max_nb_desc;
 		hwvq_id = vndev->rxqs[id].hwvq_id;
 	} else {
-		id = vndev->tx_vqueue_cnt;
 		/* We don't support the callback from the txqueue yet */
 		callback = NULL;
 		max_desc = vndev->txqs[id].max_nb_desc;
@@ -791,7 +1123,7 @@ static struct uk_netdev_tx_queue *virtio_netdev_tx_queue_setup(
 
 	UK_ASSERT(n);
 	vndev = to_virtionetdev(n);
-	if (queue_id >= vndev->max_vqueue_pairs) {
+	if (queue_id >= vndev->nb_vqueue_pairs) {
 		uk_pr_err("Invalid virtqueue identifier: %"__PRIu16"\n",
 			  queue_id);
 		rc = -EINVAL;
@@ -825,7 +1157,7 @@ static int virtio_netdev_rxq_info_get(struct uk_netdev *dev,
 	UK_ASSERT(dev);
 	UK_ASSERT(qinfo);
 	vndev = to_virtionetdev(dev);
-	if (unlikely(queue_id >= vndev->max_vqueue_pairs)) {
+	if (unlikely(queue_id >= vndev->nb_vqueue_pairs)) {
 		uk_pr_err("Invalid virtqueue id: %"__PRIu16"\n", queue_id);
 		rc = -EINVAL;
 		goto exit;
@@ -852,7 +1184,7 @@ static int virtio_netdev_txq_info_get(struct uk_netdev *dev,
 	UK_ASSERT(qinfo);
 
 	vndev = to_virtionetdev(dev);
-	if (unlikely(queue_id >= vndev->max_vqueue_pairs)) {
+	if (unlikely(queue_id >= vndev->nb_vqueue_pairs)) {
 		uk_pr_err("Invalid queue_id %"__PRIu16"\n", queue_id);
 		rc = -EINVAL;
 		goto exit;
@@ -941,6 +1273,17 @@ static int virtio_netdev_feature_negotiate(struct uk_netdev *n)
 	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_STATUS))
 		VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_STATUS);
 
+	/**
+	 * Control queue and multiple queue pairs
+	 * NOTE: The device keeps using only the first queue pair until we
+	 *       tell it over the control queue how many pairs we use.
+	 */
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_CTRL_VQ)) {
+		VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_CTRL_VQ);
+		if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_MQ))
+			VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_MQ);
+	}
+
 	/**
 	 * Gratuitous ARP
 	 * NOTE: We tell that we will do gratuitous ARPs ourselves.
@@ -960,6 +1303,14 @@ static int virtio_netdev_feature_negotiate(struct uk_netdev *n)
 		VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_GUEST_CSUM);
 	}
 
+	/**
+	 * Mergeable receive buffers
+	 * NOTE: This lets the device spread a received packet over multiple
+	 *       netbufs, which is required to receive coalesced packets.
+	 */
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_MRG_RXBUF))
+		VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_MRG_RXBUF);
+
 	/* VirtIO modern */
 	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_F_VERSION_1))
 		VIRTIO_FEATURE_SET(drv_features, VIRTIO_F_VERSION_1);
@@ -974,6 +1325,25 @@ static int virtio_netdev_feature_negotiate(struct uk_netdev *n)
 	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_HOST_TSO4))
 		VIRTIO_FEATURE_SET(drv_features, VIRTIO_NET_F_HOST_TSO4);
 
+#if CONFIG_LIBVIRTIO_NET_LRO
+	/**
+	 * Large receive offload
+	 * NOTE: This enables receiving of packets marked with
+	 *       VIRTIO_NET_HDR_GSO_TCPV4 and VIRTIO_NET_HDR_GSO_TCPV6. We only
+	 *       accept them with mergeable buffers, so that we do not have to
+	 *       provide receive buffers for the largest possible packet.
+	 */
+	if (VIRTIO_FEATURE_HAS(drv_features, VIRTIO_NET_F_GUEST_CSUM) &&
+	    VIRTIO_FEATURE_HAS(drv_features, VIRTIO_NET_F_MRG_RXBUF)) {
+		if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_GUEST_TSO4))
+			VIRTIO_FEATURE_SET(drv_features,
+					   VIRTIO_NET_F_GUEST_TSO4);
+		if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_NET_F_GUEST_TSO6))
+			VIRTIO_FEATURE_SET(drv_features,
+					   VIRTIO_NET_F_GUEST_TSO6);
+	}
+#endif /* CONFIG_LIBVIRTIO_NET_LRO */
+
 	/**
 	 * Use index based event supression when it's available.
 	 * This allows a more fine-grained control when the hypervisor should
@@ -983,6 +1353,20 @@ static int virtio_netdev_feature_negotiate(struct uk_netdev *n)
 	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_F_EVENT_IDX))
 		VIRTIO_FEATURE_SET(drv_features, VIRTIO_F_EVENT_IDX);
 
+	/**
+	 * Use the packed virtqueue layout when it's available. The ring
+	 * library drops it again if it was built without support for it.
+	 */
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_F_RING_PACKED))
+		VIRTIO_FEATURE_SET(drv_features, VIRTIO_F_RING_PACKED);
+
+	/**
+	 * Let the device complete buffers in batches when it uses them in
+	 * order anyway.
+	 */
+	if (VIRTIO_FEATURE_HAS(host_features, VIRTIO_F_IN_ORDER))
+		VIRTIO_FEATURE_SET(drv_features, VIRTIO_F_IN_ORDER);
+
 	/**
 	 * Announce our enabled driver features back to the backend device
 	 */
@@ -1017,6 +1401,30 @@ static int virtio_netdev_feature_negotiate(struct uk_netdev *n)
 		vndev->max_mtu = vndev->mtu = UK_ETH_PAYLOAD_MAXLEN;
 	}
 
+	vndev->dev_vqueue_pairs = 1;
+	if (VIRTIO_FEATURE_HAS(drv_features, VIRTIO_NET_F_MQ)) {
+		virtio_config_get(vndev->vdev,
+				  __offsetof(struct virtio_net_config,
+					     max_virtqueue_pairs),
+				  &vndev->dev_vqueue_pairs,
+				  sizeof(vndev->dev_vqueue_pairs), 1);
+		/* The id of the control queue has to fit into 16 bits */
+		if (unlikely(vndev->dev_vqueue_pairs <
+				VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
+			     vndev->dev_vqueue_pairs >=
+				VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX)) {
+			uk_pr_err("%p: Invalid number of queue pairs: %"__PRIu16"\n",
+				  n, vndev->dev_vqueue_pairs);
+			rc = -EINVAL;
+			goto err_negotiate_feature;
+		}
+	}
+
+	/* More queue pairs than LCPUs would only share LCPUs again */
+	vndev->max_vqueue_pairs = MIN(vndev->dev_vqueue_pairs,
+				      MIN(ukplat_lcpu_count(),
+					  CONFIG_LIBUKNETDEV_MAXNBQUEUES));
+
 	virtio_dev_status_update(vndev->vdev,
 				 (VIRTIO_CONFIG_STATUS_ACK |
 				  VIRTIO_CONFIG_STATUS_DRIVER |
@@ -1029,22 +1437,106 @@ err_negotiate_feature:
 	return rc;
 }
 
+static int virtio_netdev_ctrlq_setup(struct virtio_net_device *vndev,
+				     __u16 hwvq_id, __u16 nr_desc)
+{
+	struct virtqueue *vq;
+
+	vndev->ctrl = uk_malloc(a, sizeof(*vndev->ctrl));
+	if (unlikely(!vndev->ctrl))
+		return -ENOMEM;
+
+	vq = virtio_vqueue_setup(vndev->vdev, hwvq_id, nr_desc, NULL, a);
+	if (unlikely(PTRISERR(vq))) {
+		uk_pr_err("Failed to set up control queue\n");
+		uk_free(a, vndev->ctrl);
+		vndev->ctrl = NULL;
+		return PTR2ERR(vq);
+	}
+
+	/* We poll for the completion of commands */
+	virtqueue_intr_disable(vq);
+	vndev->ctrlq = vq;
+
+	return 0;
+}
+
+/**
+ * Sends a command over the control queue and busy-waits until the device
+ * acknowledges it. Commands are only issued while the device is configured,
+ * so there is never more than one in flight.
+ */
+static int virtio_netdev_ctrl_cmd(struct virtio_net_device *vndev,
+				  __u8 class, __u8 cmd,
+				  const void *data, __u16 len)
+{
+	struct virtio_net_ctrl *ctrl = vndev->ctrl;
+	struct uk_sglist_seg sgsegs[4];
+	struct uk_sglist sg;
+	__u16 read_bufs;
+	void *cookie;
+	__u32 used_len;
+	int rc;
+
+	UK_ASSERT(vndev->ctrlq && ctrl);
+	UK_ASSERT(len <= sizeof(ctrl->data));
+
+	ctrl->hdr.class = class;
+	ctrl->hdr.cmd = cmd;
+	memcpy(ctrl->data, data, len);
+	ctrl->ack = VIRTIO_NET_ERR;
+
+	uk_sglist_init(&sg, ARRAY_SIZE(sgsegs), &sgsegs[0]);
+	rc = uk_sglist_append(&sg, &ctrl->hdr, sizeof(ctrl->hdr) + len);
+	if (unlikely(rc < 0))
+		return rc;
+	read_bufs = sg.sg_nseg;
+	rc = uk_sglist_append(&sg, &ctrl->ack, sizeof(ctrl->ack));
+	if (unlikely(rc < 0))
+		return rc;
+
+	rc = virtqueue_buffer_enqueue(vndev->ctrlq, ctrl, &sg, read_bufs,
+				      sg.sg_nseg - read_bufs);
+	if (unlikely(rc < 0))
+		return rc;
+	virtqueue_host_notify(vndev->ctrlq);
+
+	while (virtqueue_buffer_dequeue(vndev->ctrlq, &cookie, &used_len) < 0)
+		ukarch_spinwait();
+	UK_ASSERT(cookie == ctrl);
+
+	return (ctrl->ack == VIRTIO_NET_OK) ? 0 : -EIO;
+}
+
 static int virtio_netdev_rxtx_alloc(struct virtio_net_device *vndev,
 				    const struct uk_netdev_conf *conf)
 {
 	int rc = 0;
 	int i = 0;
 	int vq_avail = 0;
-	int total_vqs = conf->nb_rx_queues + conf->nb_tx_queues;
-	__u16 qdesc_size[total_vqs];
+	int total_vqs;
+	__u16 ctrlq_id;
+	__u16 *qdesc_size;
 
-	if (conf->nb_rx_queues != 1 || conf->nb_tx_queues != 1) {
+	if (conf->nb_rx_queues != conf->nb_tx_queues ||
+	    conf->nb_rx_queues == 0 ||
+	    conf->nb_rx_queues > vndev->max_vqueue_pairs) {
 		uk_pr_err("Queue combination not supported: %"__PRIu16"/%"__PRIu16" rx/tx\n",
 			  conf->nb_rx_queues, conf->nb_tx_queues);
 
 		return -ENOTSUP;
 	}
 
+	/**
+	 * The control queue comes after all the queue pairs offered by the
+	 * device, even if we use fewer of them.
+	 */
+	ctrlq_id = 2 * vndev->dev_vqueue_pairs;
+	if (VIRTIO_FEATURE_HAS(vndev->vdev->features, VIRTIO_NET_F_CTRL_VQ))
+		total_vqs = ctrlq_id + 1;
+	else
+		total_vqs = 2 * conf->nb_rx_queues;
+
 	/**
 	 * TODO:
 	 * The virtio device management data structure are allocated using the
@@ -1052,9 +1544,10 @@ static int virtio_netdev_rxtx_alloc(struct virtio_net_device *vndev,
 	 * wiser to move it to the allocator of each individual queue. This
 	 * would better considering NUMA support.
 	 */
-	vndev->rxqs = uk_malloc(a, sizeof(*vndev->rxqs) * conf->nb_rx_queues);
-	vndev->txqs = uk_malloc(a, sizeof(*vndev->txqs) * conf->nb_tx_queues);
-	if (unlikely(!vndev->rxqs || !vndev->txqs)) {
+	qdesc_size = uk_malloc(a, sizeof(*qdesc_size) * total_vqs);
+	vndev->rxqs = uk_calloc(a, conf->nb_rx_queues, sizeof(*vndev->rxqs));
+	vndev->txqs = uk_calloc(a, conf->nb_tx_queues, sizeof(*vndev->txqs));
+	if (unlikely(!qdesc_size || !vndev->rxqs || !vndev->txqs)) {
 		uk_pr_err("Failed to allocate memory for queue management\n");
 		rc = -ENOMEM;
 		goto err_free_txrx;
@@ -1077,7 +1570,7 @@ static int virtio_netdev_rxtx_alloc(struct virtio_net_device *vndev,
 	 * ...
 	 * Virtqueue-ctrlq
 	 */
-	for (i = 0; i < vndev->max_vqueue_pairs; i++) {
+	for (i = 0; i < conf->nb_rx_queues; i++) {
 		/**
 		 * Initialize the received queue with the information received
 		 * from the device.
@@ -1100,14 +1593,25 @@ static int virtio_netdev_rxtx_alloc(struct virtio_net_device *vndev,
 				sizeof(vndev->txqs[i].sgsegs[0])),
 			       &vndev->txqs[i].sgsegs[0]);
 	}
+
+	if (VIRTIO_FEATURE_HAS(vndev->vdev->features, VIRTIO_NET_F_CTRL_VQ)) {
+		rc = virtio_netdev_ctrlq_setup(vndev, ctrlq_id,
+					       qdesc_size[ctrlq_id]);
+		if (unlikely(rc < 0))
+			goto err_free_txrx;
+	}
+
+	vndev->nb_vqueue_pairs = conf->nb_rx_queues;
+	uk_free(a, qdesc_size);
 exit:
 	return rc;
 
 err_free_txrx:
-	if (!vndev->rxqs)
-		uk_free(a, vndev->rxqs);
-	if (!vndev->txqs)
-		uk_free(a, vndev->txqs);
+	uk_free(a, qdesc_size);
+	uk_free(a, vndev->rxqs);
+	uk_free(a, vndev->txqs);
+	vndev->rxqs = NULL;
+	vndev->txqs = NULL;
 	goto exit;
 }
 
@@ -1193,13 +1697,19 @@ static void virtio_net_info_get(struct uk_netdev *dev,
 				       VIRTIO_NET_F_HOST_TSO4)
 		    || VIRTIO_FEATURE_HAS(vndev->vdev->features,
 					  VIRTIO_NET_F_GSO))
-		   ? UK_NETDEV_F_TSO4 : 0);
+		   ? UK_NETDEV_F_TSO4 : 0)
+		| ((VIRTIO_FEATURE_HAS(vndev->vdev->features,
+				       VIRTIO_NET_F_GUEST_TSO4)
+		    || VIRTIO_FEATURE_HAS(vndev->vdev->features,
+					  VIRTIO_NET_F_GUEST_TSO6))
+		   ? UK_NETDEV_F_LRO : 0);
 }
 
 static int virtio_net_start(struct uk_netdev *n)
 {
 	struct virtio_net_device *d;
 	int i = 0;
+	int rc;
 
 	UK_ASSERT(n != NULL);
 	d = to_virtionetdev(n);
@@ -1209,24 +1719,41 @@ static int virtio_net_start(struct uk_netdev *n)
 	 * network stack to manually enable them with a call to
 	 * enable_tx|rx_intr()
 	 */
-	for (i = 0; i < d->rx_vqueue_cnt; i++) {
-		virtqueue_intr_disable(d->rxqs[i].vq);
-		d->rxqs[i].intr_enabled = 0;
-	}
-
-	for (i = 0; i < d->tx_vqueue_cnt; i++) {
-		virtqueue_intr_disable(d->txqs[i].vq);
-		d->txqs[i].intr_enabled = 0;
+	for (i = 0; i < d->nb_vqueue_pairs; i++) {
+		if (d->rxqs[i].vq) {
+			virtqueue_intr_disable(d->rxqs[i].vq);
+			d->rxqs[i].intr_enabled = 0;
+		}
+		if (d->txqs[i].vq) {
+			virtqueue_intr_disable(d->txqs[i].vq);
+			d->txqs[i].intr_enabled = 0;
+		}
 	}
 
 	/*
 	 * Set the DRIVER_OK status bit. At this point the device is "live".
 	 */
 	virtio_dev_drv_up(d->vdev);
+
+	if (VIRTIO_FEATURE_HAS(d->vdev->features, VIRTIO_NET_F_MQ)) {
+		struct virtio_net_ctrl_mq mq = {
+			.virtqueue_pairs = d->nb_vqueue_pairs,
+		};
+
+		rc = virtio_netdev_ctrl_cmd(d, VIRTIO_NET_CTRL_MQ,
+					    VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+					    &mq, sizeof(mq));
+		if (unlikely(rc < 0)) {
+			uk_pr_err(DRIVER_NAME": %"__PRIu16" failed to enable %"__PRIu16" queue pairs: %d\n",
+				  d->uid, d->nb_vqueue_pairs, rc);
+			return rc;
+		}
+	}
 	uk_pr_info(DRIVER_NAME": %"__PRIu16" started\n", d->uid);
 
-	for (i = 0; i < d->rx_vqueue_cnt; i++)
-		virtqueue_host_notify(d->rxqs[i].vq);
+	for (i = 0; i < d->nb_vqueue_pairs; i++)
+		if (d->rxqs[i].vq)
+			virtqueue_host_notify(d->rxqs[i].vq);
 
 	return 0;
 }
@@ -1263,6 +1790,8 @@ static int virtio_net_add_dev(struct virtio_dev *vdev)
 	/* register netdev */
 	vndev->netdev.rx_one = virtio_netdev_recv;
 	vndev->netdev.tx_one = virtio_netdev_xmit;
+	vndev->netdev.rx_burst = virtio_netdev_recv_burst;
+	vndev->netdev.tx_burst = virtio_netdev_xmit_burst;
 	vndev->netdev.ops = &virtio_netdev_ops;
 
 	rc = uk_netdev_drv_register(&vndev->netdev, a, drv_name);
@@ -1274,10 +1803,7 @@ static int virtio_net_add_dev(struct virtio_dev *vdev)
 	rc = 0;
 	vndev->promisc = 0;
 
-	/**
-	 * TODO:
-	 * Adding multiqueue support for the virtio net driver.
-	 */
+	/* Updated with the device limit during feature negotiation */
 	vndev->max_vqueue_pairs = 1;
 	uk_pr_debug("virtio-net device registered with libuknet\n");
 
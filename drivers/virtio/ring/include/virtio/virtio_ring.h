@@ -81,6 +81,36 @@ extern "C" {
 /* Arbitrary descriptor layouts. */
 #define VIRTIO_F_ANY_LAYOUT       27
 
+/* Support for packed virtqueue layout */
+#define VIRTIO_F_RING_PACKED      34
+
+/* Buffers are used by the device in the same order they were made available */
+#define VIRTIO_F_IN_ORDER         35
+
+/*
+ * Mark a descriptor as available or used in packed ring.
+ * Notice: they are defined as shifts instead of shifted values.
+ */
+#define VRING_PACKED_DESC_F_AVAIL       7
+#define VRING_PACKED_DESC_F_USED        15
+
+/* Enable events in packed ring. */
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0x0
+/* Disable events in packed ring. */
+#define VRING_PACKED_EVENT_FLAG_DISABLE 0x1
+/*
+ * Enable events for a specific descriptor in packed ring.
+ * (as specified by Descriptor Ring Change Event Offset/Wrap Counter).
+ * Only valid if VIRTIO_F_EVENT_IDX has been negotiated.
+ */
+#define VRING_PACKED_EVENT_FLAG_DESC    0x2
+
+/*
+ * Wrap counter bit shift in event suppression structure
+ * of packed ring.
+ */
+#define VRING_PACKED_EVENT_F_WRAP_CTR   15
+
 /**
  * Virtqueue descriptors: 16 bytes.
  * These can chain together via "next".
@@ -186,6 +216,65 @@ static inline unsigned int vring_size(unsigned int num, unsigned long align)
 	return size;
 }
 
+/**
+ * Packed virtqueue descriptors: 16 bytes. The descriptor ring is used by
+ * the driver and the device in both directions.
+ */
+struct vring_packed_desc {
+	/* Buffer Address. */
+	__virtio_le64 addr;
+	/* Buffer Length. */
+	__virtio_le32 len;
+	/* Buffer ID. */
+	__virtio_le16 id;
+	/* The flags depending on descriptor type. */
+	__virtio_le16 flags;
+};
+
+struct vring_packed_desc_event {
+	/* Descriptor Ring Change Event Offset/Wrap Counter. */
+	__virtio_le16 off_wrap;
+	/* Descriptor Ring Change Event Flags. */
+	__virtio_le16 flags;
+};
+
+struct vring_packed {
+	unsigned int num;
+
+	struct vring_packed_desc *desc;
+	struct vring_packed_desc_event *driver;
+	struct vring_packed_desc_event *device;
+};
+
+/* The packed ring is a continuous chunk of memory which looks like this:
+ *
+ * struct vring_packed {
+ *      // The descriptor ring (16 bytes each)
+ *      struct vring_packed_desc desc[num];
+ *
+ *      // Driver event suppression (written by the driver)
+ *      struct vring_packed_desc_event driver;
+ *
+ *      // Device event suppression (written by the device)
+ *      struct vring_packed_desc_event device;
+ * };
+ */
+static inline void vring_packed_init(struct vring_packed *vr,
+				     unsigned int num, uint8_t *p)
+{
+	vr->num = num;
+	vr->desc = (struct vring_packed_desc *) p;
+	vr->driver = (struct vring_packed_desc_event *) (p +
+			num * sizeof(struct vring_packed_desc));
+	vr->device = vr->driver + 1;
+}
+
+static inline unsigned int vring_packed_size(unsigned int num)
+{
+	return num * sizeof(struct vring_packed_desc)
+		+ 2 * sizeof(struct vring_packed_desc_event);
+}
+
 static inline int vring_need_event(__u16 event_idx, __u16 new_idx,
 				   __u16 old_idx)
 {
@@ -0,0 +1,267 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <stdio.h>
+#include <errno.h>
+
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/errptr.h>
+#include <uk/sglist.h>
+#include <uk/atomic.h>
+#include <uk/plat/time.h>
+#include <uk/plat/common/cpu.h>
+#include <virtio/virtio_bus.h>
+
+#include "../virtqueue_vring.h"
+
+#define TEST_NR_DESCS		256
+#define TEST_BUF_LEN		64
+#define BENCH_ROUNDS		20000
+#define BENCH_BATCH		32
+
+/* Leave a gap between the buffers so that uk_sglist_append() does not merge
+ * them into a single segment
+ */
+static char test_buf[2][2 * TEST_BUF_LEN];
+
+static int test_notify(struct virtio_dev *vdev __unused,
+		       __u16 queue_id __unused)
+{
+	return 0;
+}
+
+/* Minimal device emulation: consumes every available buffer and reports it
+ * as used with a length equal to the sum of its device-writable segments.
+ * With `batch` > 1, consecutive buffers are completed in order with a single
+ * used entry, as allowed by VIRTIO_F_IN_ORDER.
+ */
+struct test_device {
+	__u16 idx;
+	__u8 wrap_counter;
+	unsigned int batch;
+};
+
+static unsigned int test_device_split(struct test_device *dev,
+				      struct virtqueue *vq)
+{
+	struct virtqueue_vring *vrq = to_virtqueue_vring(vq);
+	struct vring *vr = &vrq->vring;
+	__u16 avail_idx, head = 0, d, used_idx;
+	unsigned int n = 0, k;
+	__u32 len = 0;
+
+	avail_idx = UK_READ_ONCE(vr->avail->idx);
+	rmb();
+	while (dev->idx != avail_idx) {
+		for (k = 0; k < dev->batch && dev->idx != avail_idx; k++) {
+			head = vr->avail->ring[dev->idx & (vr->num - 1)];
+			len = 0;
+			d = head;
+			for (;;) {
+				if (vr->desc[d].flags & VRING_DESC_F_WRITE)
+					len += vr->desc[d].len;
+				n++;
+				if (!(vr->desc[d].flags & VRING_DESC_F_NEXT))
+					break;
+				d = vr->desc[d].next;
+			}
+			dev->idx++;
+		}
+
+		/* Only the last buffer of the batch is reported */
+		used_idx = vr->used->idx & (vr->num - 1);
+		vr->used->ring[used_idx].id = head;
+		vr->used->ring[used_idx].len = len;
+		wmb();
+		vr->used->idx += k;
+	}
+	return n;
+}
+
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+static int test_device_packed_avail(struct test_device *dev,
+				    struct vring_packed *vr)
+{
+	__u16 flags;
+	int avail, used;
+
+	flags = UK_READ_ONCE(vr->desc[dev->idx].flags);
+	avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+	return (avail != used && avail == dev->wrap_counter);
+}
+
+static unsigned int test_device_packed(struct test_device *dev,
+				       struct virtqueue *vq)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+	struct vring_packed *vr = &vpq->vring;
+	__u16 flags, head, id = 0;
+	unsigned int n = 0, k;
+	__u8 head_wrap;
+	__u32 len = 0;
+
+	while (test_device_packed_avail(dev, vr)) {
+		head = dev->idx;
+		head_wrap = dev->wrap_counter;
+		for (k = 0; k < dev->batch; k++) {
+			if (k > 0 && !test_device_packed_avail(dev, vr))
+				break;
+			rmb();
+
+			len = 0;
+			do {
+				flags = vr->desc[dev->idx].flags;
+				if (flags & VRING_DESC_F_WRITE)
+					len += vr->desc[dev->idx].len;
+				id = vr->desc[dev->idx].id;
+				n++;
+				if (++dev->idx >= vr->num) {
+					dev->idx = 0;
+					dev->wrap_counter ^= 1;
+				}
+			} while (flags & VRING_DESC_F_NEXT);
+		}
+
+		/* Only the last buffer of the batch is reported, in the slot
+		 * of the first one
+		 */
+		vr->desc[head].id = id;
+		vr->desc[head].len = len;
+		wmb();
+		vr->desc[head].flags = head_wrap ?
+			((1 << VRING_PACKED_DESC_F_AVAIL) |
+			 (1 << VRING_PACKED_DESC_F_USED)) : 0;
+	}
+	return n;
+}
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
+static unsigned int test_device_run(struct test_device *dev,
+				    struct virtqueue *vq)
+{
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (vq->uses_packed)
+		return test_device_packed(dev, vq);
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+	return test_device_split(dev, vq);
+}
+
+#define TEST_F_PACKED		0x1
+#define TEST_F_IN_ORDER		0x2
+#define TEST_F_EVENT_IDX	0x4
+
+static struct virtqueue *test_vq_create(struct virtio_dev *vdev,
+					struct test_device *dev, int flags)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+
+	vdev->features = 0;
+	if (flags & TEST_F_PACKED)
+		VIRTIO_FEATURE_SET(vdev->features, VIRTIO_F_RING_PACKED);
+	if (flags & TEST_F_IN_ORDER)
+		VIRTIO_FEATURE_SET(vdev->features, VIRTIO_F_IN_ORDER);
+	if (flags & TEST_F_EVENT_IDX)
+		VIRTIO_FEATURE_SET(vdev->features, VIRTIO_F_EVENT_IDX);
+
+	dev->idx = 0;
+	dev->wrap_counter = 1;
+	dev->batch = (flags & TEST_F_IN_ORDER) ? 8 : 1;
+
+	return virtqueue_create(0, TEST_NR_DESCS, __PAGE_SIZE, NULL,
+				test_notify, vdev, a);
+}
+
+static void test_sg_init(struct uk_sglist *sg, struct uk_sglist_seg *segs,
+			 int nr_segs)
+{
+	int i;
+
+	uk_sglist_init(sg, 2, segs);
+	for (i = 0; i < nr_segs; i++)
+		uk_sglist_append(sg, test_buf[i], TEST_BUF_LEN);
+}
+
+/* Measures the descriptor throughput of the driver side of a ring. The
+ * device is emulated on the same CPU and the time spent in it is not
+ * accounted. Buffers are submitted and reaped in batches, the way network
+ * drivers do with burst I/O.
+ */
+static int bench_ring(int flags, int nr_segs)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct virtio_dev vdev;
+	struct test_device dev;
+	struct virtqueue *vq;
+	struct uk_sglist sg;
+	struct uk_sglist_seg segs[2];
+	unsigned long nr_descs = 0;
+	void *c[BENCH_BATCH];
+	__nsec start, end, t, dev_time = 0;
+	unsigned int i, j;
+	__u16 cnt;
+	int rc;
+
+	vq = test_vq_create(&vdev, &dev, flags);
+	if (PTRISERR(vq))
+		return PTR2ERR(vq);
+	if (flags & TEST_F_IN_ORDER)
+		dev.batch = BENCH_BATCH;
+
+	test_sg_init(&sg, segs, nr_segs);
+
+	start = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		for (j = 0; j < BENCH_BATCH; j++) {
+			rc = virtqueue_buffer_enqueue(vq, test_buf, &sg,
+						      nr_segs, 0);
+			if (unlikely(rc < 0))
+				goto out;
+		}
+		virtqueue_notify_enabled(vq);
+
+		t = ukplat_monotonic_clock();
+		nr_descs += test_device_run(&dev, vq);
+		dev_time += ukplat_monotonic_clock() - t;
+
+		cnt = BENCH_BATCH;
+		virtqueue_buffer_dequeue_burst(vq, c, NULL, &cnt);
+		if (unlikely(cnt != BENCH_BATCH)) {
+			rc = -EIO;
+			goto out;
+		}
+	}
+	end = ukplat_monotonic_clock() - dev_time;
+
+	printf("virtio_ring: %-6s%-9s %d seg(s): %8lu descs/ms (%lu ns per batch of %d)\n",
+	       (flags & TEST_F_PACKED) ? "packed" : "split",
+	       (flags & TEST_F_IN_ORDER) ? " in-order" : "", nr_segs,
+	       (unsigned long)(nr_descs * ukarch_time_msec_to_nsec(1)
+			       / (end - start ? end - start : 1)),
+	       (unsigned long)((end - start) / BENCH_ROUNDS), BENCH_BATCH);
+	rc = 0;
+
+out:
+	virtqueue_destroy(vq, a);
+	return rc;
+}
+
+UK_TESTCASE(virtio_ring_bench, bench_split_vs_packed)
+{
+	int nr_segs;
+
+	for (nr_segs = 1; nr_segs <= 2; nr_segs++) {
+		UK_TEST_EXPECT_ZERO(bench_ring(0, nr_segs));
+		UK_TEST_EXPECT_ZERO(bench_ring(TEST_F_IN_ORDER, nr_segs));
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+		UK_TEST_EXPECT_ZERO(bench_ring(TEST_F_PACKED, nr_segs));
+		UK_TEST_EXPECT_ZERO(bench_ring(TEST_F_PACKED
+					       | TEST_F_IN_ORDER, nr_segs));
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+	}
+}
+
+uk_testsuite_register(virtio_ring_bench, NULL);
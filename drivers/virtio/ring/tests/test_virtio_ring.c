@@ -0,0 +1,351 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/errptr.h>
+#include <uk/sglist.h>
+#include <uk/atomic.h>
+#include <uk/arch/limits.h>
+#include <uk/plat/common/cpu.h>
+#include <virtio/virtio_bus.h>
+
+#include "../virtqueue_vring.h"
+
+#define TEST_NR_DESCS		256
+#define TEST_BUF_LEN		64
+
+/* Leave a gap between the buffers so that uk_sglist_append() does not merge
+ * them into a single segment
+ */
+static char test_buf[2][2 * TEST_BUF_LEN];
+
+static int test_notify(struct virtio_dev *vdev __unused,
+		       __u16 queue_id __unused)
+{
+	return 0;
+}
+
+/* Minimal device emulation: consumes every available buffer and reports it
+ * as used with a length equal to the sum of its device-writable segments.
+ * With `batch` > 1, consecutive buffers are completed in order with a single
+ * used entry, as allowed by VIRTIO_F_IN_ORDER.
+ */
+struct test_device {
+	__u16 idx;
+	__u8 wrap_counter;
+	unsigned int batch;
+};
+
+static unsigned int test_device_split(struct test_device *dev,
+				      struct virtqueue *vq)
+{
+	struct virtqueue_vring *vrq = to_virtqueue_vring(vq);
+	struct vring *vr = &vrq->vring;
+	__u16 avail_idx, head = 0, d, used_idx;
+	unsigned int n = 0, k;
+	__u32 len = 0;
+
+	avail_idx = UK_READ_ONCE(vr->avail->idx);
+	rmb();
+	while (dev->idx != avail_idx) {
+		for (k = 0; k < dev->batch && dev->idx != avail_idx; k++) {
+			head = vr->avail->ring[dev->idx & (vr->num - 1)];
+			len = 0;
+			d = head;
+			for (;;) {
+				if (vr->desc[d].flags & VRING_DESC_F_WRITE)
+					len += vr->desc[d].len;
+				n++;
+				if (!(vr->desc[d].flags & VRING_DESC_F_NEXT))
+					break;
+				d = vr->desc[d].next;
+			}
+			dev->idx++;
+		}
+
+		/* Only the last buffer of the batch is reported */
+		used_idx = vr->used->idx & (vr->num - 1);
+		vr->used->ring[used_idx].id = head;
+		vr->used->ring[used_idx].len = len;
+		wmb();
+		vr->used->idx += k;
+	}
+	return n;
+}
+
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+static int test_device_packed_avail(struct test_device *dev,
+				    struct vring_packed *vr)
+{
+	__u16 flags;
+	int avail, used;
+
+	flags = UK_READ_ONCE(vr->desc[dev->idx].flags);
+	avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+	used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+	return (avail != used && avail == dev->wrap_counter);
+}
+
+static unsigned int test_device_packed(struct test_device *dev,
+				       struct virtqueue *vq)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+	struct vring_packed *vr = &vpq->vring;
+	__u16 flags, head, id = 0;
+	unsigned int n = 0, k;
+	__u8 head_wrap;
+	__u32 len = 0;
+
+	while (test_device_packed_avail(dev, vr)) {
+		head = dev->idx;
+		head_wrap = dev->wrap_counter;
+		for (k = 0; k < dev->batch; k++) {
+			if (k > 0 && !test_device_packed_avail(dev, vr))
+				break;
+			rmb();
+
+			len = 0;
+			do {
+				flags = vr->desc[dev->idx].flags;
+				if (flags & VRING_DESC_F_WRITE)
+					len += vr->desc[dev->idx].len;
+				id = vr->desc[dev->idx].id;
+				n++;
+				if (++dev->idx >= vr->num) {
+					dev->idx = 0;
+					dev->wrap_counter ^= 1;
+				}
+			} while (flags & VRING_DESC_F_NEXT);
+		}
+
+		/* Only the last buffer of the batch is reported, in the slot
+		 * of the first one
+		 */
+		vr->desc[head].id = id;
+		vr->desc[head].len = len;
+		wmb();
+		vr->desc[head].flags = head_wrap ?
+			((1 << VRING_PACKED_DESC_F_AVAIL) |
+			 (1 << VRING_PACKED_DESC_F_USED)) : 0;
+	}
+	return n;
+}
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
+static unsigned int test_device_run(struct test_device *dev,
+				    struct virtqueue *vq)
+{
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (vq->uses_packed)
+		return test_device_packed(dev, vq);
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+	return test_device_split(dev, vq);
+}
+
+#define TEST_F_PACKED		0x1
+#define TEST_F_IN_ORDER		0x2
+#define TEST_F_EVENT_IDX	0x4
+
+static struct virtqueue *test_vq_create(struct virtio_dev *vdev,
+					struct test_device *dev, int flags)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+
+	vdev->features = 0;
+	if (flags & TEST_F_PACKED)
+		VIRTIO_FEATURE_SET(vdev->features, VIRTIO_F_RING_PACKED);
+	if (flags & TEST_F_IN_ORDER)
+		VIRTIO_FEATURE_SET(vdev->features, VIRTIO_F_IN_ORDER);
+	if (flags & TEST_F_EVENT_IDX)
+		VIRTIO_FEATURE_SET(vdev->features, VIRTIO_F_EVENT_IDX);
+
+	dev->idx = 0;
+	dev->wrap_counter = 1;
+	dev->batch = (flags & TEST_F_IN_ORDER) ? 8 : 1;
+
+	return virtqueue_create(0, TEST_NR_DESCS, __PAGE_SIZE, NULL,
+				test_notify, vdev, a);
+}
+
+static void test_sg_init(struct uk_sglist *sg, struct uk_sglist_seg *segs,
+			 int nr_segs)
+{
+	int i;
+
+	uk_sglist_init(sg, 2, segs);
+	for (i = 0; i < nr_segs; i++)
+		uk_sglist_append(sg, test_buf[i], TEST_BUF_LEN);
+}
+
+/* Fills the queue, lets the device consume it and checks that buffers come
+ * back in order and with the expected length. Several rounds with odd-sized
+ * chains make the indexes (and the packed wrap counters) wrap around. Odd
+ * rounds use the burst dequeue API.
+ *
+ * Returns the number of mismatches or a negative error code.
+ */
+static int ring_roundtrip(int flags)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct virtio_dev vdev;
+	struct test_device dev;
+	struct virtqueue *vq;
+	struct uk_sglist sg;
+	struct uk_sglist_seg segs[2];
+	unsigned long cookie, expected;
+	unsigned int round, nr, i;
+	int rc, errors = 0;
+	void *c[16];
+	__u32 len[16];
+	__u16 cnt;
+
+	vq = test_vq_create(&vdev, &dev, flags);
+	if (PTRISERR(vq))
+		return PTR2ERR(vq);
+
+	errors += (vq->uses_packed != !!(flags & TEST_F_PACKED));
+	errors += (vq->uses_in_order != !!(flags & TEST_F_IN_ORDER));
+	errors += (virtqueue_vring_get_num(vq) != TEST_NR_DESCS);
+
+	cookie = 1;
+	expected = 1;
+	for (round = 0; round < 6; round++) {
+		/* Alternate between single and two-descriptor chains */
+		test_sg_init(&sg, segs, ((round >> 1) & 1) + 1);
+
+		nr = 0;
+		do {
+			rc = virtqueue_buffer_enqueue(vq, (void *)cookie, &sg,
+						      1, sg.sg_nseg - 1);
+			if (rc >= 0) {
+				cookie++;
+				nr++;
+			}
+		} while (rc > 0);
+		errors += (nr == 0);
+		errors += !virtqueue_is_full(vq) && rc != -ENOSPC;
+		errors += virtqueue_hasdata(vq);
+
+		test_device_run(&dev, vq);
+		errors += !virtqueue_hasdata(vq);
+
+		for (;;) {
+			if (round & 1) {
+				cnt = ARRAY_SIZE(c);
+				rc = virtqueue_buffer_dequeue_burst(vq, c, len,
+								    &cnt);
+				errors += (rc < 0) != (cnt == 0);
+			} else {
+				rc = virtqueue_buffer_dequeue(vq, &c[0],
+							      &len[0]);
+				cnt = (rc >= 0) ? 1 : 0;
+			}
+			if (rc < 0)
+				break;
+
+			for (i = 0; i < cnt; i++) {
+				errors += ((unsigned long)c[i] != expected);
+				errors += (len[i] != (__u32)TEST_BUF_LEN
+						     * (sg.sg_nseg - 1));
+				expected++;
+			}
+		}
+		errors += (rc != -ENOMSG);
+		errors += (expected != cookie);
+		errors += virtqueue_is_full(vq);
+		errors += virtqueue_hasdata(vq);
+	}
+
+	virtqueue_destroy(vq, a);
+	return errors;
+}
+
+UK_TESTCASE(virtio_ring, test_split_roundtrip)
+{
+	UK_TEST_EXPECT_ZERO(ring_roundtrip(0));
+}
+
+UK_TESTCASE(virtio_ring, test_split_in_order)
+{
+	UK_TEST_EXPECT_ZERO(ring_roundtrip(TEST_F_IN_ORDER));
+}
+
+/* The device asks to be notified when a given buffer is made available. A
+ * batch of buffers needs a notification if the event index is anywhere in
+ * the batch, not only if it is the last buffer.
+ */
+UK_TESTCASE(virtio_ring, test_split_notify_batch)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct virtio_dev vdev;
+	struct test_device dev;
+	struct virtqueue *vq;
+	struct virtqueue_vring *vrq;
+	struct uk_sglist sg;
+	struct uk_sglist_seg segs[2];
+	__u16 start;
+	int i;
+
+	vq = test_vq_create(&vdev, &dev, TEST_F_EVENT_IDX);
+	UK_TEST_ASSERT(!PTRISERR(vq));
+	UK_TEST_EXPECT(vq->uses_event_idx);
+	vrq = to_virtqueue_vring(vq);
+	test_sg_init(&sg, segs, 1);
+
+	/* Nothing was added yet */
+	UK_TEST_EXPECT_ZERO(virtqueue_notify_enabled(vq));
+
+	/* Event index on the first of four buffers */
+	start = vrq->vring.avail->idx;
+	vring_avail_event(&vrq->vring) = start;
+	for (i = 0; i < 4; i++)
+		UK_TEST_EXPECT(virtqueue_buffer_enqueue(vq, test_buf, &sg,
+							1, 0) >= 0);
+	UK_TEST_EXPECT_SNUM_EQ(virtqueue_notify_enabled(vq), 1);
+
+	/* The batch was accounted, so no new notification is needed */
+	UK_TEST_EXPECT_ZERO(virtqueue_notify_enabled(vq));
+
+	/* Event index beyond the next batch */
+	vring_avail_event(&vrq->vring) = start + 8;
+	for (i = 0; i < 4; i++)
+		UK_TEST_EXPECT(virtqueue_buffer_enqueue(vq, test_buf, &sg,
+							1, 0) >= 0);
+	UK_TEST_EXPECT_ZERO(virtqueue_notify_enabled(vq));
+
+	virtqueue_destroy(vq, a);
+}
+
+UK_TESTCASE(virtio_ring, test_negotiate)
+{
+	__u64 f = (1ULL << VIRTIO_F_RING_PACKED) | (1ULL << VIRTIO_F_IN_ORDER);
+	__u64 expected = f | (1ULL << VIRTIO_F_VERSION_1);
+
+	/* Legacy devices never get features beyond bit 31 */
+	UK_TEST_EXPECT_ZERO(virtqueue_feature_negotiate(f));
+
+#ifndef CONFIG_LIBVIRTIO_RING_PACKED
+	expected &= ~(1ULL << VIRTIO_F_RING_PACKED);
+#endif /* !CONFIG_LIBVIRTIO_RING_PACKED */
+	f |= 1ULL << VIRTIO_F_VERSION_1;
+	UK_TEST_EXPECT_SNUM_EQ(virtqueue_feature_negotiate(f), expected);
+}
+
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+UK_TESTCASE(virtio_ring, test_packed_roundtrip)
+{
+	UK_TEST_EXPECT_ZERO(ring_roundtrip(TEST_F_PACKED));
+}
+
+UK_TESTCASE(virtio_ring, test_packed_in_order)
+{
+	UK_TEST_EXPECT_ZERO(ring_roundtrip(TEST_F_PACKED | TEST_F_IN_ORDER));
+}
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
+uk_testsuite_register(virtio_ring, NULL);
@@ -41,6 +41,7 @@
 #include <uk/sglist.h>
 #include <uk/atomic.h>
 #include <uk/plat/io.h>
+#include <uk/trace.h>
 #include <virtio/virtio_ring.h>
 #include <virtio/virtqueue.h>
 #include <virtio/virtio_bus.h>
@@ -51,30 +52,13 @@
 #include <uk/falloc.h>
 #endif /* CONFIG_LIBUKVMEM */
 
-#define VIRTQUEUE_MAX_SIZE  32768
-#define to_virtqueue_vring(vq)			\
-	__containerof(vq, struct virtqueue_vring, vq)
-
-struct virtqueue_desc_info {
-	void *cookie;
-	__u16 desc_count;
-};
-
-struct virtqueue_vring {
-	struct virtqueue vq;
-	/* Descriptor Ring */
-	struct vring vring;
-	/* Reference to the vring */
-	void   *vring_mem;
-	/* Keep track of available descriptors */
-	__u16 desc_avail;
-	/* Index of the next available slot */
-	__u16 head_free_desc;
-	/* Index of the last used descriptor by the host */
-	__u16 last_used_desc_idx;
-	/* Cookie to identify driver buffer */
-	struct virtqueue_desc_info vq_info[];
-};
+#include "virtqueue_vring.h"
+
+UK_TRACEPOINT(trace_virtio_ring_interrupt, "queue %u", unsigned int);
+UK_TRACEPOINT(trace_virtio_ring_enqueue, "queue %u %p read %u write %u",
+	      unsigned int, void *, unsigned int, unsigned int);
+UK_TRACEPOINT(trace_virtio_ring_dequeue, "queue %u %p len %u",
+	      unsigned int, void *, unsigned int);
 
 /**
  * Static function Declaration(s).
@@ -91,6 +75,8 @@ static inline int virtqueue_buffer_enqueue_segments(
 						    __u16 write_bufs);
 static void virtqueue_vring_init(struct virtqueue_vring *vrq, __u16 nr_desc,
 				 __u16 align);
+static inline void virtqueue_vring_detach_used(struct virtqueue_vring *vrq,
+					       void **cookie, __u32 *len);
 
 /**
  * Driver implementation
@@ -101,6 +87,11 @@ void virtqueue_intr_disable(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (virtqueue_is_packed(vq)) {
+		virtqueue_packed_intr_disable(vq);
+		return;
+	}
+
 	vrq = to_virtqueue_vring(vq);
 
 	if (vq->uses_event_idx) {
@@ -118,6 +109,9 @@ int virtqueue_intr_enable(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (virtqueue_is_packed(vq))
+		return virtqueue_packed_intr_enable(vq);
+
 	vrq = to_virtqueue_vring(vq);
 	/* Check if there are no more packets enabled */
 	if (!virtqueue_hasdata(vq)) {
@@ -173,6 +167,7 @@ static inline void virtqueue_ring_update_avail(struct virtqueue_vring *vrq,
 	 */
 	wmb();
 	vrq->vring.avail->idx++;
+	vrq->nr_added++;
 }
 
 static inline void virtqueue_detach_desc(struct virtqueue_vring *vrq,
@@ -205,18 +200,22 @@ int virtqueue_notify_enabled(struct virtqueue *vq)
 	uint16_t old, new;
 
 	UK_ASSERT(vq);
+
+	if (virtqueue_is_packed(vq))
+		return virtqueue_packed_notify_enabled(vq);
+
 	vrq = to_virtqueue_vring(vq);
-	if (vq->uses_event_idx) {
-		new = vrq->vring.avail->idx;
-		/* TODO: Use the actually submitted count instead of assuming
-		 *       that a single descriptor was submitted. This would be
-		 *       more efficient when we would have batching implemented.
-		 */
-		old = new - 1;
 
+	/* Make the available index visible before reading the device event */
+	mb();
+
+	new = vrq->vring.avail->idx;
+	old = new - vrq->nr_added;
+	vrq->nr_added = 0;
+
+	if (vq->uses_event_idx)
 		return vring_need_event(vring_avail_event(&vrq->vring),
 					new, old);
-	}
 
 	return ((vrq->vring.used->flags & VRING_USED_F_NO_NOTIFY) == 0);
 }
@@ -228,6 +227,7 @@ static inline int virtqueue_buffer_enqueue_segments(
 {
 	int i = 0, total_desc = 0;
 	struct uk_sglist_seg *segs;
+	__u32 in_len = 0;
 	__u16 idx = 0;
 
 	total_desc = read_bufs + write_bufs;
@@ -237,13 +237,16 @@ static inline int virtqueue_buffer_enqueue_segments(
 		vrq->vring.desc[idx].addr = segs->ss_paddr;
 		vrq->vring.desc[idx].len = segs->ss_len;
 		vrq->vring.desc[idx].flags = 0;
-		if (i >= read_bufs)
+		if (i >= read_bufs) {
 			vrq->vring.desc[idx].flags |= VRING_DESC_F_WRITE;
+			in_len += segs->ss_len;
+		}
 
 		if (i < total_desc - 1)
 			vrq->vring.desc[idx].flags |= VRING_DESC_F_NEXT;
 		idx = vrq->vring.desc[idx].next;
 	}
+	vrq->vq_info[head].in_len = in_len;
 	return idx;
 }
 
@@ -253,6 +256,9 @@ int virtqueue_hasdata(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+	if (virtqueue_is_packed(vq))
+		return virtqueue_packed_hasdata(vq);
+
 	vring = to_virtqueue_vring(vq);
 	return (vring->last_used_desc_idx != vring->vring.used->idx);
 }
@@ -265,6 +271,15 @@ __u64 virtqueue_feature_negotiate(__u64 feature_set)
 	feature |= 1ULL << VIRTIO_F_VERSION_1;
 	/* Allow event index feature */
 	feature |= 1ULL << VIRTIO_F_EVENT_IDX;
+	/* Features beyond bit 31 are only defined for modern (v1.0+) devices */
+	if (VIRTIO_FEATURE_HAS(feature_set, VIRTIO_F_VERSION_1)) {
+		/* Allow in-order completion of buffers */
+		feature |= 1ULL << VIRTIO_F_IN_ORDER;
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+		/* Allow the packed layout */
+		feature |= 1ULL << VIRTIO_F_RING_PACKED;
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+	}
 
 	feature &= feature_set;
 	return feature;
@@ -276,6 +291,8 @@ int virtqueue_ring_interrupt(void *obj)
 
 	UK_ASSERT(vq);
 
+	trace_virtio_ring_interrupt(vq->queue_id);
+
 	/* It is possible that the vqueue is empty if the
 	 * interrupt arrives before the data is observable
 	 * by the device. In that case there's not much we
@@ -293,6 +310,11 @@ __paddr_t virtqueue_physaddr(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (virtqueue_is_packed(vq))
+		return ukplat_virt_to_phys(to_virtqueue_packed(vq)->vring_mem);
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
 	vrq = to_virtqueue_vring(vq);
 	return ukplat_virt_to_phys(vrq->vring_mem);
 }
@@ -303,6 +325,15 @@ __paddr_t virtqueue_get_avail_addr(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (virtqueue_is_packed(vq)) {
+		struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+		return virtqueue_physaddr(vq) +
+			((char *)vpq->vring.driver - (char *)vpq->vring.desc);
+	}
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
 	vrq = to_virtqueue_vring(vq);
 	return virtqueue_physaddr(vq) +
 		((char *)vrq->vring.avail - (char *)vrq->vring.desc);
@@ -314,6 +345,15 @@ __paddr_t virtqueue_get_used_addr(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (virtqueue_is_packed(vq)) {
+		struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+		return virtqueue_physaddr(vq) +
+			((char *)vpq->vring.device - (char *)vpq->vring.desc);
+	}
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
 	vrq = to_virtqueue_vring(vq);
 	return virtqueue_physaddr(vq) +
 		((char *)vrq->vring.used - (char *)vrq->vring.desc);
@@ -325,36 +365,141 @@ unsigned int virtqueue_vring_get_num(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (virtqueue_is_packed(vq))
+		return to_virtqueue_packed(vq)->vring.num;
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
 	vrq = to_virtqueue_vring(vq);
 	return vrq->vring.num;
 }
 
+/**
+ * Retires the oldest used buffer. The caller has to make sure that there is
+ * one and that the used ring index was read before (rmb).
+ */
+static inline void virtqueue_vring_detach_used(struct virtqueue_vring *vrq,
+					       void **cookie, __u32 *len)
+{
+	struct virtqueue_desc_info *vq_info;
+	struct vring_used_elem *elem;
+	__u16 used_idx, head_idx;
+
+	used_idx = vrq->last_used_desc_idx++ & (vrq->vring.num - 1);
+
+	if (vrq->vq.uses_in_order) {
+		/**
+		 * Buffers are used in submission order and descriptors are
+		 * handed out sequentially, so the buffer and its descriptors
+		 * follow from index arithmetic. The device may complete a
+		 * whole batch with a single used entry that carries the id of
+		 * the last buffer, so we read the used ring only once per
+		 * batch. Lengths are only reported for the last buffer of a
+		 * batch, the others are assumed to be completely written.
+		 */
+		head_idx = vrq->next_used_head;
+		vq_info = &vrq->vq_info[head_idx];
+		if (vrq->batch_last_id == VIRTQUEUE_BATCH_NONE) {
+			elem = &vrq->vring.used->ring[used_idx];
+			vrq->batch_last_id = elem->id;
+			vrq->batch_last_len = elem->len;
+		}
+		if (head_idx == vrq->batch_last_id) {
+			vrq->batch_last_id = VIRTQUEUE_BATCH_NONE;
+			if (len)
+				*len = vrq->batch_last_len;
+		} else if (len) {
+			*len = vq_info->in_len;
+		}
+
+		vrq->next_used_head = (head_idx + vq_info->desc_count)
+				      & (vrq->vring.num - 1);
+		vrq->desc_avail += vq_info->desc_count;
+		*cookie = vq_info->cookie;
+		vq_info->cookie = NULL;
+		return;
+	}
+
+	elem = &vrq->vring.used->ring[used_idx];
+	head_idx = elem->id;
+	if (len)
+		*len = elem->len;
+	*cookie = vrq->vq_info[head_idx].cookie;
+	virtqueue_detach_desc(vrq, head_idx);
+	vrq->vq_info[head_idx].cookie = NULL;
+}
+
 int virtqueue_buffer_dequeue(struct virtqueue *vq, void **cookie, __u32 *len)
 {
 	struct virtqueue_vring *vrq = NULL;
-	__u16 used_idx, head_idx;
-	struct vring_used_elem *elem;
+	int rc;
 
 	UK_ASSERT(vq);
 	UK_ASSERT(cookie);
+
+	if (virtqueue_is_packed(vq)) {
+		rc = virtqueue_packed_buffer_dequeue(vq, cookie, len);
+		if (rc >= 0)
+			trace_virtio_ring_dequeue(vq->queue_id, *cookie,
+						  len ? *len : 0);
+		return rc;
+	}
+
 	vrq = to_virtqueue_vring(vq);
 
 	/* No new descriptor since last dequeue operation */
 	if (!virtqueue_hasdata(vq))
 		return -ENOMSG;
-	used_idx = vrq->last_used_desc_idx++ & (vrq->vring.num - 1);
-	elem = &vrq->vring.used->ring[used_idx];
 	/**
 	 * We are reading from the used descriptor information updated by the
 	 * host.
 	 */
 	rmb();
-	head_idx = elem->id;
-	if (len)
-		*len = elem->len;
-	*cookie = vrq->vq_info[head_idx].cookie;
-	virtqueue_detach_desc(vrq, head_idx);
-	vrq->vq_info[head_idx].cookie = NULL;
+	virtqueue_vring_detach_used(vrq, cookie, len);
+	trace_virtio_ring_dequeue(vq->queue_id, *cookie, len ? *len : 0);
+	return (vrq->vring.num - vrq->desc_avail);
+}
+
+int virtqueue_buffer_dequeue_burst(struct virtqueue *vq, void **cookie,
+				   __u32 *len, __u16 *cnt)
+{
+	struct virtqueue_vring *vrq;
+	__u16 i, nr_used;
+	int rc;
+
+	UK_ASSERT(vq);
+	UK_ASSERT(cookie);
+	UK_ASSERT(cnt);
+
+	if (virtqueue_is_packed(vq)) {
+		rc = virtqueue_packed_buffer_dequeue_burst(vq, cookie, len,
+							   cnt);
+		for (i = 0; i < *cnt; i++)
+			trace_virtio_ring_dequeue(vq->queue_id, cookie[i],
+						  len ? len[i] : 0);
+		return rc;
+	}
+
+	vrq = to_virtqueue_vring(vq);
+
+	nr_used = UK_READ_ONCE(vrq->vring.used->idx) - vrq->last_used_desc_idx;
+	if (nr_used == 0) {
+		*cnt = 0;
+		return -ENOMSG;
+	}
+	if (nr_used > *cnt)
+		nr_used = *cnt;
+
+	/* One barrier covers all used entries up to the index we read */
+	rmb();
+	for (i = 0; i < nr_used; i++) {
+		virtqueue_vring_detach_used(vrq, &cookie[i],
+					    len ? &len[i] : NULL);
+		trace_virtio_ring_dequeue(vq->queue_id, cookie[i],
+					  len ? len[i] : 0);
+	}
+
+	*cnt = nr_used;
 	return (vrq->vring.num - vrq->desc_avail);
 }
 
@@ -368,6 +513,12 @@ int virtqueue_buffer_enqueue(struct virtqueue *vq, void *cookie,
 
 	UK_ASSERT(vq);
 
+	trace_virtio_ring_enqueue(vq->queue_id, cookie, read_bufs, write_bufs);
+
+	if (virtqueue_is_packed(vq))
+		return virtqueue_packed_buffer_enqueue(vq, cookie, sg,
+						       read_bufs, write_bufs);
+
 	vrq = to_virtqueue_vring(vq);
 	total_desc = read_bufs + write_bufs;
 	if (unlikely(total_desc < 1 || total_desc > vrq->vring.num)) {
@@ -411,14 +562,82 @@ static void virtqueue_vring_init(struct virtqueue_vring *vrq, __u16 nr_desc,
 
 	vrq->desc_avail = vrq->vring.num;
 	vrq->head_free_desc = 0;
+	vrq->nr_added = 0;
 	vrq->last_used_desc_idx = 0;
+	vrq->next_used_head = 0;
+	vrq->batch_last_id = VIRTQUEUE_BATCH_NONE;
 	for (i = 0; i < nr_desc - 1; i++)
 		vrq->vring.desc[i].next = i + 1;
 	/**
 	 * When we reach this descriptor we have completely used all the
-	 * descriptor in the vring.
+	 * descriptor in the vring. With in-order completion, descriptors are
+	 * freed in the order they were allocated, so the free list is simply
+	 * the ring itself and never needs to be relinked.
+	 */
+	if (vrq->vq.uses_in_order)
+		vrq->vring.desc[nr_desc - 1].next = 0;
+	else
+		vrq->vring.desc[nr_desc - 1].next = VIRTQUEUE_MAX_SIZE;
+}
+
+void *virtqueue_vring_mem_alloc(struct uk_alloc *a __maybe_unused,
+				size_t size)
+{
+	void *mem;
+#ifdef CONFIG_LIBUKVMEM
+	struct uk_pagetable *pt = ukplat_pt_get_active();
+	__paddr_t paddr = __PADDR_ANY;
+	__vaddr_t vaddr = __VADDR_ANY;
+	int rc;
+
+	size = PAGE_ALIGN_UP(size);
+
+	rc = pt->fa->falloc(pt->fa, &paddr, size >> PAGE_SHIFT, 0);
+	if (unlikely(rc))
+		return NULL;
+
+	rc = uk_vma_map_dma(uk_vas_get_active(), &vaddr, size,
+			    PAGE_ATTR_PROT_RW, UK_VMA_MAP_POPULATE,
+			    "virtqueue", paddr);
+	if (unlikely(rc)) {
+		pt->fa->ffree(pt->fa, paddr, size >> PAGE_SHIFT);
+		return NULL;
+	}
+
+	mem = (void *)vaddr;
+#else /* CONFIG_LIBUKVMEM */
+	/**
+	 * Initialize the value before referencing it in
+	 * uk_posix_memalign as we don't set NULL on all failures in the
+	 * allocation.
 	 */
-	vrq->vring.desc[nr_desc - 1].next = VIRTQUEUE_MAX_SIZE;
+	mem = NULL;
+	if (uk_posix_memalign(a, &mem, __PAGE_SIZE, size) != 0)
+		return NULL;
+#endif /* !CONFIG_LIBUKVMEM */
+	memset(mem, 0, size);
+	return mem;
+}
+
+void virtqueue_vring_mem_free(struct uk_alloc *a __maybe_unused, void *mem,
+			      size_t size __maybe_unused)
+{
+#ifdef CONFIG_LIBUKVMEM
+	struct uk_pagetable *pt = ukplat_pt_get_active();
+	__paddr_t paddr = ukplat_virt_to_phys(mem);
+	int rc;
+
+	size = PAGE_ALIGN_UP(size);
+
+	rc = uk_vma_unmap(uk_vas_get_active(), (__vaddr_t)mem, size, 0);
+	if (unlikely(rc)) {
+		uk_pr_err("Failed to unmap vring: %d\n", rc);
+		return;
+	}
+	pt->fa->ffree(pt->fa, paddr, size >> PAGE_SHIFT);
+#else /* CONFIG_LIBUKVMEM */
+	uk_free(a, mem);
+#endif /* !CONFIG_LIBUKVMEM */
 }
 
 struct virtqueue *virtqueue_create(__u16 queue_id, __u16 nr_descs, __u16 align,
@@ -429,9 +648,15 @@ struct virtqueue *virtqueue_create(__u16 queue_id, __u16 nr_descs, __u16 align,
 	struct virtqueue_vring *vrq;
 	struct virtqueue *vq;
 	int rc;
-	size_t ring_size = 0;
 
 	UK_ASSERT(a);
+	UK_ASSERT(vdev);
+
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_RING_PACKED))
+		return virtqueue_packed_create(queue_id, nr_descs, callback,
+					       notify, vdev, a);
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
 
 	vrq = uk_malloc(a, sizeof(*vrq) +
 			nr_descs * sizeof(struct virtqueue_desc_info));
@@ -440,42 +665,13 @@ struct virtqueue *virtqueue_create(__u16 queue_id, __u16 nr_descs, __u16 align,
 		rc = -ENOMEM;
 		goto err_exit;
 	}
-	/**
-	 * Initialize the value before referencing it in
-	 * uk_posix_memalign as we don't set NULL on all failures in the
-	 * allocation.
-	 */
-	vrq->vring_mem = NULL;
 
-	ring_size = vring_size(nr_descs, align);
-#ifdef CONFIG_LIBUKVMEM
-	struct uk_pagetable *pt = ukplat_pt_get_active();
-	__paddr_t paddr = __PADDR_ANY;
-	__vaddr_t vaddr = __VADDR_ANY;
-
-	ring_size = PAGE_ALIGN_UP(ring_size);
-
-	rc = pt->fa->falloc(pt->fa, &paddr, ring_size >> PAGE_SHIFT, 0);
-	if (unlikely(rc))
-		goto err_freevq;
-
-	rc = uk_vma_map_dma(uk_vas_get_active(), &vaddr, ring_size,
-			    PAGE_ATTR_PROT_RW, UK_VMA_MAP_POPULATE,
-			    "virtqueue", paddr);
-	if (unlikely(rc))
-		goto err_freevq;
-
-	vrq->vring_mem = (void *)vaddr;
-#else /* CONFIG_LIBUKVMEM */
-	if (uk_posix_memalign(a, &vrq->vring_mem,
-			      __PAGE_SIZE, ring_size) != 0) {
+	vrq->vring_mem = virtqueue_vring_mem_alloc(a,
+						   vring_size(nr_descs, align));
+	if (!vrq->vring_mem) {
 		rc = -ENOMEM;
 		goto err_freevq;
 	}
-#endif /* !CONFIG_LIBUKVMEM */
-	memset(vrq->vring_mem, 0, ring_size);
-	virtqueue_vring_init(vrq, nr_descs, align);
-
 	vq = &vrq->vq;
 	vq->queue_id = queue_id;
 	vq->vdev = vdev;
@@ -483,6 +679,12 @@ struct virtqueue *virtqueue_create(__u16 queue_id, __u16 nr_descs, __u16 align,
 	vq->vq_notify_host = notify;
 	vq->uses_event_idx =
 	    VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_EVENT_IDX);
+	vq->uses_in_order =
+	    VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_IN_ORDER);
+	vq->uses_packed = 0;
+
+	vrq->align = align;
+	virtqueue_vring_init(vrq, nr_descs, align);
 	return vq;
 
 err_freevq:
@@ -498,10 +700,22 @@ void virtqueue_destroy(struct virtqueue *vq, struct uk_alloc *a)
 
 	UK_ASSERT(vq);
 
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (virtqueue_is_packed(vq)) {
+		struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+		virtqueue_vring_mem_free(a, vpq->vring_mem,
+					 vring_packed_size(vpq->vring.num));
+		uk_free(a, vpq);
+		return;
+	}
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
 	vrq = to_virtqueue_vring(vq);
 
 	/* Free the ring */
-	uk_free(a, vrq->vring_mem);
+	virtqueue_vring_mem_free(a, vrq->vring_mem,
+				 vring_size(vrq->vring.num, vrq->align));
 
 	/* Free the virtqueue metadata */
 	uk_free(a, vrq);
@@ -513,6 +727,11 @@ int virtqueue_is_full(struct virtqueue *vq)
 
 	UK_ASSERT(vq);
 
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+	if (virtqueue_is_packed(vq))
+		return (to_virtqueue_packed(vq)->desc_avail == 0);
+#endif /* CONFIG_LIBVIRTIO_RING_PACKED */
+
 	vrq = to_virtqueue_vring(vq);
 	return (vrq->desc_avail == 0);
 }
@@ -0,0 +1,368 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Packed virtqueue layout (virtio 1.1, section 2.7).
+ *
+ * Unlike the split layout, the driver and the device share a single
+ * descriptor ring. The driver makes a buffer available by writing its
+ * descriptors at `next_avail_idx` and flipping the AVAIL/USED flag bits of
+ * the head descriptor last. The device overwrites the head slot of each
+ * buffer it consumed with a used descriptor carrying the buffer id. Both
+ * sides keep a wrap counter that toggles whenever they wrap around the
+ * ring so that stale descriptors from the previous lap can be told apart.
+ */
+#include <uk/config.h>
+#include <string.h>
+#include <uk/print.h>
+#include <uk/errptr.h>
+#include <uk/atomic.h>
+#include <uk/plat/common/cpu.h>
+#include <virtio/virtio_bus.h>
+
+#include "virtqueue_vring.h"
+
+#define VRING_PACKED_DESC_AVAIL		(1 << VRING_PACKED_DESC_F_AVAIL)
+#define VRING_PACKED_DESC_USED		(1 << VRING_PACKED_DESC_F_USED)
+
+static inline int virtqueue_packed_desc_is_used(struct virtqueue_packed *vpq,
+						__u16 idx, __u8 wrap_counter)
+{
+	__u16 flags;
+	int avail, used;
+
+	flags = UK_READ_ONCE(vpq->vring.desc[idx].flags);
+	avail = !!(flags & VRING_PACKED_DESC_AVAIL);
+	used = !!(flags & VRING_PACKED_DESC_USED);
+
+	return (avail == used) && (used == wrap_counter);
+}
+
+int virtqueue_packed_hasdata(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+	/* The device does not mark the other buffers of a used batch */
+	if (vpq->batch_last_id != VIRTQUEUE_BATCH_NONE)
+		return 1;
+
+	return virtqueue_packed_desc_is_used(vpq, vpq->last_used_idx,
+					     vpq->used_wrap_counter);
+}
+
+void virtqueue_packed_intr_disable(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+	vpq->vring.driver->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+}
+
+int virtqueue_packed_intr_enable(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+	if (virtqueue_packed_hasdata(vq))
+		return 1;
+
+	if (vq->uses_event_idx) {
+		/* Ask for an interrupt as soon as the next descriptor we are
+		 * waiting for is used.
+		 */
+		vpq->vring.driver->off_wrap = vpq->last_used_idx |
+			(vpq->used_wrap_counter <<
+			 VRING_PACKED_EVENT_F_WRAP_CTR);
+		/* The offset must be visible before the flags */
+		wmb();
+		vpq->vring.driver->flags = VRING_PACKED_EVENT_FLAG_DESC;
+	} else {
+		vpq->vring.driver->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	}
+
+	/**
+	 * Re-check for used descriptors after enabling the interrupts so
+	 * that we do not miss any that arrived in the meantime (virtio
+	 * specification section 2.7.21).
+	 */
+	mb();
+	if (virtqueue_packed_hasdata(vq)) {
+		virtqueue_packed_intr_disable(vq);
+		return 1;
+	}
+	return 0;
+}
+
+int virtqueue_packed_notify_enabled(struct virtqueue *vq)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+	__u16 old, new, off_wrap, flags, event_idx;
+	__u8 wrap_counter;
+
+	/* Make the descriptors visible before reading the device event */
+	mb();
+
+	old = vpq->next_avail_idx - vpq->nr_added;
+	new = vpq->next_avail_idx;
+	vpq->nr_added = 0;
+
+	off_wrap = UK_READ_ONCE(vpq->vring.device->off_wrap);
+	flags = UK_READ_ONCE(vpq->vring.device->flags);
+
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return (flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+
+	wrap_counter = off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR;
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if (wrap_counter != vpq->avail_wrap_counter)
+		event_idx -= vpq->vring.num;
+
+	return vring_need_event(event_idx, new, old);
+}
+
+/**
+ * Retires the oldest used buffer. The caller has to make sure that there is
+ * one and that its descriptor flags were read before (rmb).
+ */
+static inline void virtqueue_packed_detach_used(struct virtqueue_packed *vpq,
+						void **cookie, __u32 *len)
+{
+	struct virtqueue_packed_desc_info *vq_info;
+	__u16 id, last_used;
+
+	last_used = vpq->last_used_idx;
+	if (vpq->vq.uses_in_order) {
+		/**
+		 * Buffer ids are handed out in ring order and buffers are
+		 * used in submission order. A single used descriptor, carrying
+		 * the id of the last buffer, may complete a whole batch. The
+		 * device skips the descriptors of the other buffers, so we
+		 * read the ring only once per batch.
+		 */
+		id = vpq->next_used_id;
+		if (vpq->batch_last_id == VIRTQUEUE_BATCH_NONE) {
+			vpq->batch_last_id = vpq->vring.desc[last_used].id;
+			vpq->batch_last_len = vpq->vring.desc[last_used].len;
+		}
+		if (id == vpq->batch_last_id) {
+			vpq->batch_last_id = VIRTQUEUE_BATCH_NONE;
+			if (len)
+				*len = vpq->batch_last_len;
+		} else if (len) {
+			*len = vpq->vq_info[id].in_len;
+		}
+		vpq->next_used_id = vpq->vq_info[id].next;
+	} else {
+		id = vpq->vring.desc[last_used].id;
+		if (len)
+			*len = vpq->vring.desc[last_used].len;
+	}
+	UK_ASSERT(id < vpq->vring.num);
+
+	vq_info = &vpq->vq_info[id];
+	UK_ASSERT(vq_info->desc_count > 0);
+	*cookie = vq_info->cookie;
+
+	/* The device skips the remaining descriptors of the chain */
+	last_used += vq_info->desc_count;
+	if (last_used >= vpq->vring.num) {
+		last_used -= vpq->vring.num;
+		vpq->used_wrap_counter ^= 1;
+	}
+	vpq->last_used_idx = last_used;
+	vpq->desc_avail += vq_info->desc_count;
+
+	vq_info->cookie = NULL;
+	vq_info->desc_count = 0;
+	/* Put the buffer id back to the free list. In order, ids are
+	 * released in the order they were allocated and the list does not
+	 * change.
+	 */
+	if (!vpq->vq.uses_in_order) {
+		vq_info->next = vpq->free_id;
+		vpq->free_id = id;
+	}
+}
+
+int virtqueue_packed_buffer_dequeue(struct virtqueue *vq, void **cookie,
+				    __u32 *len)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+
+	if (!virtqueue_packed_hasdata(vq))
+		return -ENOMSG;
+
+	/**
+	 * We read the remaining fields of the used descriptor only after
+	 * having observed its flags.
+	 */
+	rmb();
+	virtqueue_packed_detach_used(vpq, cookie, len);
+
+	return (vpq->vring.num - vpq->desc_avail);
+}
+
+int virtqueue_packed_buffer_dequeue_burst(struct virtqueue *vq, void **cookie,
+					  __u32 *len, __u16 *cnt)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+	__u16 i;
+
+	for (i = 0; i < *cnt; i++) {
+		/* The rest of an in-order batch was synchronized already */
+		if (vpq->batch_last_id == VIRTQUEUE_BATCH_NONE) {
+			if (!virtqueue_packed_desc_is_used(vpq,
+							   vpq->last_used_idx,
+							   vpq->used_wrap_counter))
+				break;
+			rmb();
+		}
+		virtqueue_packed_detach_used(vpq, &cookie[i],
+					     len ? &len[i] : NULL);
+	}
+
+	*cnt = i;
+	if (i == 0)
+		return -ENOMSG;
+	return (vpq->vring.num - vpq->desc_avail);
+}
+
+int virtqueue_packed_buffer_enqueue(struct virtqueue *vq, void *cookie,
+				    struct uk_sglist *sg, __u16 read_bufs,
+				    __u16 write_bufs)
+{
+	struct virtqueue_packed *vpq = to_virtqueue_packed(vq);
+	struct vring_packed_desc *desc;
+	struct uk_sglist_seg *segs;
+	__u16 head, idx, id, flags, head_flags = 0;
+	__u32 total_desc, i, in_len = 0;
+
+	total_desc = read_bufs + write_bufs;
+	if (unlikely(total_desc < 1 || total_desc > vpq->vring.num)) {
+		uk_pr_err("%"__PRIu32" invalid number of descriptor\n",
+			  total_desc);
+		return -EINVAL;
+	} else if (vpq->desc_avail < total_desc) {
+		uk_pr_debug("Available descriptor:%"__PRIu16", Requested descriptor:%"__PRIu32"\n",
+			    vpq->desc_avail, total_desc);
+		return -ENOSPC;
+	}
+	UK_ASSERT(cookie);
+
+	/* There are at least as many free ids as free descriptors */
+	id = vpq->free_id;
+	UK_ASSERT(id < vpq->vring.num);
+	vpq->free_id = vpq->vq_info[id].next;
+	vpq->vq_info[id].cookie = cookie;
+	vpq->vq_info[id].desc_count = total_desc;
+
+	head = idx = vpq->next_avail_idx;
+	for (i = 0; i < total_desc; i++) {
+		segs = &sg->sg_segs[i];
+		desc = &vpq->vring.desc[idx];
+
+		flags = vpq->avail_used_flags;
+		if (i >= read_bufs) {
+			flags |= VRING_DESC_F_WRITE;
+			in_len += segs->ss_len;
+		}
+		if (i < total_desc - 1)
+			flags |= VRING_DESC_F_NEXT;
+
+		desc->addr = segs->ss_paddr;
+		desc->len = segs->ss_len;
+		desc->id = id;
+		/* The head is made available last, after the whole chain */
+		if (i == 0)
+			head_flags = flags;
+		else
+			desc->flags = flags;
+
+		if (++idx >= vpq->vring.num) {
+			idx = 0;
+			vpq->avail_wrap_counter ^= 1;
+			vpq->avail_used_flags ^= VRING_PACKED_DESC_AVAIL |
+						 VRING_PACKED_DESC_USED;
+		}
+	}
+
+	vpq->vq_info[id].in_len = in_len;
+	vpq->next_avail_idx = idx;
+	vpq->desc_avail -= total_desc;
+	vpq->nr_added += total_desc;
+
+	uk_pr_debug("Old head:%d, new head:%d, total_desc:%d\n",
+		    head, idx, total_desc);
+
+	/**
+	 * Write barrier to make sure the device observes the complete
+	 * descriptor chain once the head becomes available.
+	 */
+	wmb();
+	vpq->vring.desc[head].flags = head_flags;
+
+	return vpq->desc_avail;
+}
+
+struct virtqueue *virtqueue_packed_create(__u16 queue_id, __u16 nr_descs,
+					  virtqueue_callback_t callback,
+					  virtqueue_notify_host_t notify,
+					  struct virtio_dev *vdev,
+					  struct uk_alloc *a)
+{
+	struct virtqueue_packed *vpq;
+	struct virtqueue *vq;
+	__u16 i;
+
+	UK_ASSERT(nr_descs > 0 && nr_descs <= VIRTQUEUE_MAX_SIZE);
+
+	vpq = uk_malloc(a, sizeof(*vpq) +
+			nr_descs * sizeof(struct virtqueue_packed_desc_info));
+	if (!vpq) {
+		uk_pr_err("Allocation of virtqueue failed\n");
+		return ERR2PTR(-ENOMEM);
+	}
+
+	vpq->vring_mem = virtqueue_vring_mem_alloc(a,
+						   vring_packed_size(nr_descs));
+	if (!vpq->vring_mem) {
+		uk_pr_err("Allocation of vring failed\n");
+		uk_free(a, vpq);
+		return ERR2PTR(-ENOMEM);
+	}
+	vring_packed_init(&vpq->vring, nr_descs, vpq->vring_mem);
+
+	vpq->desc_avail = nr_descs;
+	vpq->next_avail_idx = 0;
+	vpq->last_used_idx = 0;
+	vpq->nr_added = 0;
+	/* Both wrap counters start at 1 (virtio specification 2.7.1) */
+	vpq->avail_wrap_counter = 1;
+	vpq->used_wrap_counter = 1;
+	vpq->avail_used_flags = VRING_PACKED_DESC_AVAIL;
+
+	vq = &vpq->vq;
+	vq->queue_id = queue_id;
+	vq->vdev = vdev;
+	vq->vq_callback = callback;
+	vq->vq_notify_host = notify;
+	vq->uses_event_idx =
+	    VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_EVENT_IDX);
+	vq->uses_in_order =
+	    VIRTIO_FEATURE_HAS(vdev->features, VIRTIO_F_IN_ORDER);
+	vq->uses_packed = 1;
+
+	vpq->free_id = 0;
+	vpq->next_used_id = 0;
+	vpq->batch_last_id = VIRTQUEUE_BATCH_NONE;
+	for (i = 0; i < nr_descs; i++) {
+		vpq->vq_info[i].cookie = NULL;
+		vpq->vq_info[i].desc_count = 0;
+		vpq->vq_info[i].next = i + 1;
+	}
+	/* In order, ids are recycled in ring order */
+	if (vq->uses_in_order)
+		vpq->vq_info[nr_descs - 1].next = 0;
+	return vq;
+}
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (c) 2018, NEC Europe Ltd., NEC Corporation. All rights reserved.
+ * Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Internal representation of split and packed virtqueues. Only used by
+ * virtio_ring and by tests that emulate devices; drivers go through
+ * <virtio/virtqueue.h>.
+ */
+#ifndef __VIRTIO_RING_VIRTQUEUE_VRING_H__
+#define __VIRTIO_RING_VIRTQUEUE_VRING_H__
+
+#include <errno.h>
+#include <uk/config.h>
+#include <uk/alloc.h>
+#include <uk/errptr.h>
+#include <uk/sglist.h>
+#include <uk/essentials.h>
+#include <virtio/virtio_ring.h>
+#include <virtio/virtqueue.h>
+
+#define VIRTQUEUE_MAX_SIZE  32768
+/* `batch_last_id` value if no used batch is being retired */
+#define VIRTQUEUE_BATCH_NONE	VIRTQUEUE_MAX_SIZE
+#define to_virtqueue_vring(vq)			\
+	__containerof(vq, struct virtqueue_vring, vq)
+
+struct virtqueue_desc_info {
+	void *cookie;
+	__u16 desc_count;
+	/* Device-writable length of the buffer */
+	__u32 in_len;
+};
+
+struct virtqueue_vring {
+	struct virtqueue vq;
+	/* Descriptor Ring */
+	struct vring vring;
+	/* Reference to the vring */
+	void   *vring_mem;
+	/* Keep track of available descriptors */
+	__u16 desc_avail;
+	/* Index of the next available slot */
+	__u16 head_free_desc;
+	/* Index of the last used descriptor by the host */
+	__u16 last_used_desc_idx;
+	/* Alignment of the used ring, needed to compute the vring size */
+	__u16 align;
+	/* Buffers made available since the last notification check */
+	__u16 nr_added;
+	/* Head of the oldest buffer not returned yet (IN_ORDER only) */
+	__u16 next_used_head;
+	/* Last buffer of the used batch being retired (IN_ORDER only) */
+	__u16 batch_last_id;
+	__u32 batch_last_len;
+	/* Cookie to identify driver buffer */
+	struct virtqueue_desc_info vq_info[];
+};
+
+/**
+ * Allocates zeroed, page-aligned memory that is suitable to be shared with
+ * the device as a ring.
+ *
+ * @return
+ *	The virtual address of the ring memory or NULL on failure.
+ */
+void *virtqueue_vring_mem_alloc(struct uk_alloc *a, size_t size);
+
+/**
+ * Releases ring memory obtained with `virtqueue_vring_mem_alloc()`.
+ */
+void virtqueue_vring_mem_free(struct uk_alloc *a, void *mem, size_t size);
+
+#ifdef CONFIG_LIBVIRTIO_RING_PACKED
+#define to_virtqueue_packed(vq)			\
+	__containerof(vq, struct virtqueue_packed, vq)
+
+struct virtqueue_packed_desc_info {
+	void *cookie;
+	/* Number of ring descriptors used by the buffer */
+	__u16 desc_count;
+	/* Next free buffer id, if this id is not in use */
+	__u16 next;
+	/* Device-writable length of the buffer */
+	__u32 in_len;
+};
+
+struct virtqueue_packed {
+	struct virtqueue vq;
+	/* Descriptor ring and event suppression structures */
+	struct vring_packed vring;
+	/* Reference to the vring */
+	void   *vring_mem;
+	/* Keep track of available descriptors */
+	__u16 desc_avail;
+	/* Head of the list of free buffer ids */
+	__u16 free_id;
+	/* Ring index of the next descriptor made available to the device */
+	__u16 next_avail_idx;
+	/* Ring index of the next descriptor to be used by the device */
+	__u16 last_used_idx;
+	/* AVAIL/USED flag bits of descriptors made available next */
+	__u16 avail_used_flags;
+	/* Descriptors made available since the last notification check */
+	__u16 nr_added;
+	/* Id of the oldest buffer not returned yet (IN_ORDER only) */
+	__u16 next_used_id;
+	/* Last buffer of the used batch being retired (IN_ORDER only) */
+	__u16 batch_last_id;
+	__u32 batch_last_len;
+	__u8 avail_wrap_counter;
+	__u8 used_wrap_counter;
+	/* Cookie to identify driver buffer, indexed by buffer id */
+	struct virtqueue_packed_desc_info vq_info[];
+};
+
+void virtqueue_packed_intr_disable(struct virtqueue *vq);
+int virtqueue_packed_intr_enable(struct virtqueue *vq);
+int virtqueue_packed_notify_enabled(struct virtqueue *vq);
+int virtqueue_packed_hasdata(struct virtqueue *vq);
+int virtqueue_packed_buffer_dequeue(struct virtqueue *vq, void **cookie,
+				    __u32 *len);
+int virtqueue_packed_buffer_dequeue_burst(struct virtqueue *vq, void **cookie,
+					  __u32 *len, __u16 *cnt);
+int virtqueue_packed_buffer_enqueue(struct virtqueue *vq, void *cookie,
+				    struct uk_sglist *sg, __u16 read_bufs,
+				    __u16 write_bufs);
+struct virtqueue *virtqueue_packed_create(__u16 queue_id, __u16 nr_descs,
+					  virtqueue_callback_t callback,
+					  virtqueue_notify_host_t notify,
+					  struct virtio_dev *vdev,
+					  struct uk_alloc *a);
+
+#define virtqueue_is_packed(vq)		((vq)->uses_packed)
+#else /* !CONFIG_LIBVIRTIO_RING_PACKED */
+/* Never called since no virtqueue is packed, but keeps the dispatch in
+ * virtio_ring.c free of preprocessor conditionals
+ */
+static inline void virtqueue_packed_intr_disable(struct virtqueue *vq __unused)
+{
+}
+
+static inline int virtqueue_packed_intr_enable(struct virtqueue *vq __unused)
+{
+	return 0;
+}
+
+static inline int virtqueue_packed_notify_enabled(struct virtqueue *vq __unused)
+{
+	return 0;
+}
+
+static inline int virtqueue_packed_hasdata(struct virtqueue *vq __unused)
+{
+	return 0;
+}
+
+static inline int virtqueue_packed_buffer_dequeue(struct virtqueue *vq __unused,
+						  void **cookie __unused,
+						  __u32 *len __unused)
+{
+	return -ENOTSUP;
+}
+
+static inline int
+virtqueue_packed_buffer_dequeue_burst(struct virtqueue *vq __unused,
+				      void **cookie __unused,
+				      __u32 *len __unused,
+				      __u16 *cnt __unused)
+{
+	return -ENOTSUP;
+}
+
+static inline int virtqueue_packed_buffer_enqueue(struct virtqueue *vq __unused,
+						  void *cookie __unused,
+						  struct uk_sglist *sg __unused,
+						  __u16 read_bufs __unused,
+						  __u16 write_bufs __unused)
+{
+	return -ENOTSUP;
+}
+
+static inline struct virtqueue *
+virtqueue_packed_create(__u16 queue_id __unused, __u16 nr_descs __unused,
+			virtqueue_callback_t callback __unused,
+			virtqueue_notify_host_t notify __unused,
+			struct virtio_dev *vdev __unused,
+			struct uk_alloc *a __unused)
+{
+	return ERR2PTR(-ENOTSUP);
+}
+
+#define virtqueue_is_packed(vq)		0
+#endif /* !CONFIG_LIBVIRTIO_RING_PACKED */
+
+#endif /* __VIRTIO_RING_VIRTQUEUE_VRING_H__ */
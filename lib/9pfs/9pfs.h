@@ -34,10 +34,15 @@
 #define __UK_9PFS__
 
 #include <stdbool.h>
+#include <uk/config.h>
+#include <uk/arch/time.h>
+#include <uk/list.h>
+#include <uk/mutex.h>
 #include <uk/9pdev.h>
 #include <uk/9pfid.h>
 
 #include <vfscore/prex.h>
+#include <vfscore/vnode.h>
 
 /**
  * Protocol version; the default version is `9P2000.L`,
@@ -62,6 +67,27 @@ enum uk_9pfs_proto {
 	UK_9P_PROTO_MAX
 };
 
+/**
+ * Cache mode of a mount, selected with the `cache=` mount option
+ */
+enum uk_9pfs_cache {
+	/* Every operation goes to the host */
+	UK_9PFS_CACHE_NONE,
+	/* File data is cached in the page cache, if it is available */
+	UK_9PFS_CACHE_MMAP,
+	/*
+	 * Additionally, name lookups (also of names that do not exist),
+	 * attributes and directory listings are cached for the cache timeout
+	 * of the mount. Changes made by the host may be missed in that time.
+	 */
+	UK_9PFS_CACHE_LOOSE
+};
+
+/**
+ * Number of hash buckets of the lookup cache of a mount.
+ */
+#define UK_9PFS_CACHE_BUCKETS	256
+
 /**
  * An entry containing the necessary data for mounting the filesystem
  */
@@ -82,6 +108,16 @@ struct uk_9pfs_mount_data {
 	 * offering several exported file systems.
 	 */
 	char			*aname;
+	/* Cache mode */
+	enum uk_9pfs_cache	cache;
+	/* Time for which cached metadata is used, in nanoseconds */
+	__nsec			cache_ttl;
+	/* Lookup cache, for `UK_9PFS_CACHE_LOOSE` */
+	struct uk_mutex		cache_lock;
+	struct uk_hlist_head	cache_hash[UK_9PFS_CACHE_BUCKETS];
+	/* Cache entries, most recently used first */
+	struct uk_list_head	cache_lru;
+	unsigned int		cache_nr;
 };
 
 /**
@@ -102,6 +138,20 @@ struct uk_9pfs_file_data {
 	int                    readdir_off;
 	/* Total size of the data in the `readdir` buf */
 	int                    readdir_sz;
+#if CONFIG_LIB9PFS_READAHEAD
+	/* Buffer for data read ahead of sequential reads */
+	char                   *ra_buf;
+	/* File offset of the data in `ra_buf` */
+	uint64_t               ra_off;
+	/* Number of valid bytes in `ra_buf` */
+	uint32_t               ra_len;
+	/* Node generation that the data in `ra_buf` belongs to */
+	uint32_t               ra_gen;
+	/* Read request filling `ra_buf`, if one is in flight */
+	struct uk_9preq        *ra_req;
+	/* File offset following the last read, to detect sequential reads */
+	uint64_t               ra_next;
+#endif /* CONFIG_LIB9PFS_READAHEAD */
 };
 
 /**
@@ -114,6 +164,26 @@ struct uk_9pfs_node_data {
 	int                    nb_open_files;
 	/* Is a 9P remove call required when `nb_open_files` reaches 0? */
 	bool                   removed;
+	/* File id opened for writing, shared by all writes to the node */
+	struct uk_9pfid        *wfid;
+	/* Incremented when the data of the node changes */
+	uint32_t               gen;
+	/* Cached attributes, for `UK_9PFS_CACHE_LOOSE` */
+	struct vattr           attr;
+	/* Time until which `attr` is valid */
+	__nsec                 attr_expiry;
+	/* Cached directory reads, for `UK_9PFS_CACHE_LOOSE` */
+	struct uk_list_head    dir_chunks;
+	/* Time until which `dir_chunks` are valid */
+	__nsec                 dir_expiry;
+#if CONFIG_LIB9PFS_WRITEBEHIND
+	/* Buffer collecting sequential writes */
+	char                   *wb_buf;
+	/* File offset of the data in `wb_buf` */
+	uint64_t               wb_off;
+	/* Number of bytes in `wb_buf` that are not written to the host yet */
+	uint32_t               wb_len;
+#endif /* CONFIG_LIB9PFS_WRITEBEHIND */
 };
 
 /**
@@ -137,6 +207,70 @@ int uk_9pfs_allocate_vnode_data(struct vnode *vp, struct uk_9pfid *fid);
  */
 void uk_9pfs_free_vnode_data(struct vnode *vp);
 
+/**
+ * Initializes the lookup cache of a mount.
+ */
+void uk_9pfs_cache_init(struct uk_9pfs_mount_data *md);
+
+/**
+ * Looks up a name in the lookup cache.
+ *
+ * @param dvp
+ *   Directory that contains the name
+ * @param name
+ *   Name to look up
+ * @param vpp
+ *   Set to the referenced and locked vnode of the name, if it is cached
+ * @return
+ *   1 if the vnode was found, -ENOENT if the name is cached as not existing,
+ *   0 if nothing is cached about the name
+ */
+int uk_9pfs_cache_lookup(struct vnode *dvp, const char *name,
+			 struct vnode **vpp);
+
+/**
+ * Adds the result of a name lookup to the lookup cache.
+ *
+ * @param dvp
+ *   Directory that contains the name
+ * @param name
+ *   Name that was looked up
+ * @param vp
+ *   Vnode of the name, or NULL if it does not exist
+ */
+void uk_9pfs_cache_enter(struct vnode *dvp, const char *name,
+			 struct vnode *vp);
+
+/**
+ * Removes a name from the lookup cache.
+ */
+void uk_9pfs_cache_remove(struct vnode *dvp, const char *name);
+
+/**
+ * Removes all entries from the lookup cache of a mount.
+ */
+void uk_9pfs_cache_purge(struct uk_9pfs_mount_data *md);
+
+/**
+ * Copies a cached directory read that started at the given offset into buf,
+ * which must be `UK_9PFS_READDIR_BUFSZ` bytes long.
+ *
+ * @return
+ *   The size of the data, or -ENOENT if the read is not cached
+ */
+int uk_9pfs_dir_cache_get(struct vnode *vp, uint64_t off, char *buf);
+
+/**
+ * Adds a directory read that started at the given offset to the cache.
+ */
+void uk_9pfs_dir_cache_put(struct vnode *vp, uint64_t off, const char *buf,
+			   int size);
+
+/**
+ * Drops all cached directory reads of a directory.
+ */
+void uk_9pfs_dir_cache_drop(struct vnode *vp);
+
 /**
  * Default `readdir` buffer size.
  */
@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <uk/assert.h>
+#include <uk/plat/time.h>
+#include <vfscore/mount.h>
+#include <vfscore/vnode.h>
+
+#include "9pfs.h"
+
+/*
+ * Results of name lookups for `cache=loose` mounts. Entries of names that
+ * exist hold a reference to the vnode, which keeps its fid and cached
+ * attributes alive between lookups. Entries expire after the cache timeout
+ * of the mount and the least recently used entry is dropped when the cache is
+ * full.
+ */
+struct uk_9pfs_cache_entry {
+	struct uk_hlist_node hash_link;
+	struct uk_list_head lru_link;
+	/* Inode number of the directory that contains the name */
+	uint64_t dino;
+	/* Vnode of the name, NULL if the name does not exist */
+	struct vnode *vp;
+	__nsec expiry;
+	char name[];
+};
+
+/* Cached reply to a directory read */
+struct uk_9pfs_dir_chunk {
+	struct uk_list_head link;
+	/* Directory offset that the read started from */
+	uint64_t off;
+	int size;
+	char data[];
+};
+
+static unsigned long uk_9pfs_cache_hash(uint64_t dino, const char *name)
+{
+	unsigned long val = 5381 ^ dino;
+
+	while (*name)
+		val = ((val << 5) + val) + *name++;
+
+	return val & (UK_9PFS_CACHE_BUCKETS - 1);
+}
+
+static void uk_9pfs_cache_unlink(struct uk_9pfs_mount_data *md,
+				 struct uk_9pfs_cache_entry *e)
+{
+	uk_hlist_del(&e->hash_link);
+	uk_list_del(&e->lru_link);
+	md->cache_nr--;
+}
+
+static void uk_9pfs_cache_free(struct uk_9pfs_cache_entry *e)
+{
+	if (e->vp)
+		vrele(e->vp);
+	free(e);
+}
+
+static struct uk_9pfs_cache_entry *
+uk_9pfs_cache_find(struct uk_9pfs_mount_data *md, uint64_t dino,
+		   const char *name)
+{
+	struct uk_9pfs_cache_entry *e;
+
+	uk_hlist_for_each_entry(e,
+				&md->cache_hash[uk_9pfs_cache_hash(dino, name)],
+				hash_link) {
+		if (e->dino == dino && !strcmp(e->name, name))
+			return e;
+	}
+
+	return NULL;
+}
+
+void uk_9pfs_cache_init(struct uk_9pfs_mount_data *md)
+{
+	int i;
+
+	uk_mutex_init(&md->cache_lock);
+	for (i = 0; i < UK_9PFS_CACHE_BUCKETS; i++)
+		UK_INIT_HLIST_HEAD(&md->cache_hash[i]);
+	UK_INIT_LIST_HEAD(&md->cache_lru);
+	md->cache_nr = 0;
+}
+
+int uk_9pfs_cache_lookup(struct vnode *dvp, const char *name,
+			 struct vnode **vpp)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(dvp->v_mount);
+	struct uk_9pfs_cache_entry *e;
+	struct vnode *vp;
+
+	uk_mutex_lock(&md->cache_lock);
+	e = uk_9pfs_cache_find(md, dvp->v_ino, name);
+	if (!e) {
+		uk_mutex_unlock(&md->cache_lock);
+		return 0;
+	}
+
+	if (ukplat_monotonic_clock() >= e->expiry) {
+		uk_9pfs_cache_unlink(md, e);
+		uk_mutex_unlock(&md->cache_lock);
+		uk_9pfs_cache_free(e);
+		return 0;
+	}
+
+	uk_list_del(&e->lru_link);
+	uk_list_add(&e->lru_link, &md->cache_lru);
+
+	vp = e->vp;
+	if (!vp) {
+		uk_mutex_unlock(&md->cache_lock);
+		return -ENOENT;
+	}
+
+	/* Return the vnode like vfscore_vget(): referenced and locked */
+	vref(vp);
+	uk_mutex_unlock(&md->cache_lock);
+
+	vn_lock(vp);
+	*vpp = vp;
+	return 1;
+}
+
+void uk_9pfs_cache_enter(struct vnode *dvp, const char *name,
+			 struct vnode *vp)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(dvp->v_mount);
+	struct uk_9pfs_cache_entry *e, *old, *evict = NULL, *en;
+	size_t len = strlen(name);
+	__nsec now = ukplat_monotonic_clock();
+	UK_LIST_HEAD(expired);
+
+	e = malloc(sizeof(*e) + len + 1);
+	if (!e)
+		return;
+
+	e->dino = dvp->v_ino;
+	e->vp = vp;
+	e->expiry = now + md->cache_ttl;
+	memcpy(e->name, name, len + 1);
+	if (vp)
+		vref(vp);
+
+	uk_mutex_lock(&md->cache_lock);
+	/* Expired entries would pin their vnode until the name is looked up
+	 * again, so reap them from the cold end of the LRU list.
+	 */
+	while (!uk_list_empty(&md->cache_lru)) {
+		old = uk_list_last_entry(&md->cache_lru,
+					 struct uk_9pfs_cache_entry, lru_link);
+		if (now < old->expiry)
+			break;
+		uk_9pfs_cache_unlink(md, old);
+		uk_list_add(&old->lru_link, &expired);
+	}
+
+	old = uk_9pfs_cache_find(md, e->dino, name);
+	if (old)
+		uk_9pfs_cache_unlink(md, old);
+	else if (md->cache_nr == CONFIG_LIB9PFS_CACHE_ENTRIES) {
+		evict = uk_list_last_entry(&md->cache_lru,
+					   struct uk_9pfs_cache_entry,
+					   lru_link);
+		uk_9pfs_cache_unlink(md, evict);
+	}
+
+	uk_hlist_add_head(&e->hash_link,
+			  &md->cache_hash[uk_9pfs_cache_hash(e->dino, name)]);
+	uk_list_add(&e->lru_link, &md->cache_lru);
+	md->cache_nr++;
+	uk_mutex_unlock(&md->cache_lock);
+
+	/* Releasing a vnode may call into 9pfs, so do it without the lock */
+	if (old)
+		uk_9pfs_cache_free(old);
+	if (evict)
+		uk_9pfs_cache_free(evict);
+	uk_list_for_each_entry_safe(old, en, &expired, lru_link)
+		uk_9pfs_cache_free(old);
+}
+
+void uk_9pfs_cache_remove(struct vnode *dvp, const char *name)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(dvp->v_mount);
+	struct uk_9pfs_cache_entry *e;
+
+	uk_mutex_lock(&md->cache_lock);
+	e = uk_9pfs_cache_find(md, dvp->v_ino, name);
+	if (e)
+		uk_9pfs_cache_unlink(md, e);
+	uk_mutex_unlock(&md->cache_lock);
+
+	if (e)
+		uk_9pfs_cache_free(e);
+}
+
+void uk_9pfs_cache_purge(struct uk_9pfs_mount_data *md)
+{
+	struct uk_9pfs_cache_entry *e;
+
+	for (;;) {
+		uk_mutex_lock(&md->cache_lock);
+		if (uk_list_empty(&md->cache_lru)) {
+			uk_mutex_unlock(&md->cache_lock);
+			break;
+		}
+		e = uk_list_first_entry(&md->cache_lru,
+					struct uk_9pfs_cache_entry, lru_link);
+		uk_9pfs_cache_unlink(md, e);
+		uk_mutex_unlock(&md->cache_lock);
+
+		uk_9pfs_cache_free(e);
+	}
+}
+
+int uk_9pfs_dir_cache_get(struct vnode *vp, uint64_t off, char *buf)
+{
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	struct uk_9pfs_dir_chunk *c;
+
+	if (ukplat_monotonic_clock() >= nd->dir_expiry) {
+		uk_9pfs_dir_cache_drop(vp);
+		return -ENOENT;
+	}
+
+	uk_list_for_each_entry(c, &nd->dir_chunks, link) {
+		if (c->off == off) {
+			memcpy(buf, c->data, c->size);
+			return c->size;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void uk_9pfs_dir_cache_put(struct vnode *vp, uint64_t off, const char *buf,
+			   int size)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	struct uk_9pfs_dir_chunk *c;
+
+	UK_ASSERT(size >= 0);
+
+	c = malloc(sizeof(*c) + size);
+	if (!c)
+		return;
+
+	c->off = off;
+	c->size = size;
+	memcpy(c->data, buf, size);
+
+	/* The listing expires as a whole, counting from its first chunk */
+	if (uk_list_empty(&nd->dir_chunks))
+		nd->dir_expiry = ukplat_monotonic_clock() + md->cache_ttl;
+	uk_list_add_tail(&c->link, &nd->dir_chunks);
+}
+
+void uk_9pfs_dir_cache_drop(struct vnode *vp)
+{
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	struct uk_9pfs_dir_chunk *c, *cn;
+
+	uk_list_for_each_entry_safe(c, cn, &nd->dir_chunks, link) {
+		uk_list_del(&c->link);
+		free(c);
+	}
+	nd->dir_expiry = 0;
+}
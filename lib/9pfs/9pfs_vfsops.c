@@ -100,6 +100,25 @@ static int uk_9pfs_parse_option(struct uk_9pfs_mount_data *md,
 		md->aname = strdup(option + 6);
 		if (!md->aname)
 			return -ENOMEM;
+	} else if (strncmp(option, "cache=", 6) == 0) {
+		const char *mode = option + 6;
+
+		if (strcmp(mode, "none") == 0)
+			md->cache = UK_9PFS_CACHE_NONE;
+		else if (strcmp(mode, "mmap") == 0)
+			md->cache = UK_9PFS_CACHE_MMAP;
+		else if (strcmp(mode, "loose") == 0 ||
+			 strcmp(mode, "fscache") == 0)
+			md->cache = UK_9PFS_CACHE_LOOSE;
+		else
+			return -EINVAL;
+	} else if (strncmp(option, "cache_ttl=", 10) == 0) {
+		char *end;
+		unsigned long ms = strtoul(option + 10, &end, 10);
+
+		if (end == option + 10 || *end != '\0')
+			return -EINVAL;
+		md->cache_ttl = ukarch_time_msec_to_nsec((__nsec)ms);
 	}
 
 	return 0;
@@ -119,6 +138,13 @@ static int uk_9pfs_parse_options(struct uk_9pfs_mount_data *md,
 	}
 
 	md->proto = UK_9P_PROTO_2000L;
+#if CONFIG_LIB9PFS_PAGECACHE
+	md->cache = UK_9PFS_CACHE_MMAP;
+#else /* !CONFIG_LIB9PFS_PAGECACHE */
+	md->cache = UK_9PFS_CACHE_NONE;
+#endif /* !CONFIG_LIB9PFS_PAGECACHE */
+	md->cache_ttl = ukarch_time_msec_to_nsec(
+				(__nsec)CONFIG_LIB9PFS_CACHE_TTL);
 	md->uname = strdup("");
 	md->aname = strdup("");
 
@@ -179,6 +205,7 @@ static int uk_9pfs_mount(struct mount *mp, const char *dev,
 		goto out_free_mdata;
 
 	mp->m_data = md;
+	uk_9pfs_cache_init(md);
 
 	/* Establish connection with the given 9P endpoint. */
 	md->dev = uk_9pdev_connect(md->trans, dev, data, NULL);
@@ -220,6 +247,11 @@ static int uk_9pfs_mount(struct mount *mp, const char *dev,
 		goto out_disconnect;
 	}
 
+#if CONFIG_LIBVFSCORE_PAGECACHE
+	if (md->cache != UK_9PFS_CACHE_NONE)
+		mp->m_flags |= MNT_PAGECACHE;
+#endif /* CONFIG_LIBVFSCORE_PAGECACHE */
+
 	return 0;
 
 out_disconnect:
@@ -244,6 +276,7 @@ static int uk_9pfs_unmount(struct mount *mp, int flags __unused)
 	struct uk_9pfs_mount_data *md = UK_9PFS_MD(mp);
 
 	uk_9pfs_release_tree_fids(mp->m_root);
+	uk_9pfs_cache_purge(md);
 	vfscore_release_mp_dentries(mp);
 	uk_9pdev_disconnect(md->dev);
 	free(md->uname);
@@ -44,6 +44,7 @@
 #include <vfscore/vnode.h>
 #include <vfscore/file.h>
 #include <vfscore/fs.h>
+#include <vfscore/pagecache.h>
 
 #include "9pfs.h"
 
@@ -154,6 +155,363 @@ static uint64_t uk_9pfs_ino(struct uk_9p_stat *stat)
 	return stat->qid.path;
 }
 
+/* Part of the data of an uio that is transferred by one request */
+struct uk_9pfs_io {
+	struct uk_9preq *req;
+	uint64_t off;
+	uint32_t count;
+};
+
+/*
+ * Transfers the data of the uio with up to CONFIG_LIB9PFS_IODEPTH requests in
+ * flight. Replies are collected in order and the uio is advanced past the data
+ * of each one. After a short read, the requests that follow it are discarded
+ * and sent again from the new uio offset. A transfer of 0 bytes ends the loop,
+ * as does reaching `end` when reading.
+ *
+ * A short write ends the transfer. The writes in flight behind it may still
+ * have written data past the reported count: `past` is set to the end of that
+ * data, or to 0 if there is none.
+ */
+static int uk_9pfs_io(struct uk_9pdev *dev, struct uk_9pfid *fid,
+		      struct uio *uio, bool write, uint64_t end,
+		      uint64_t *past)
+{
+	struct uk_9pfs_io io[CONFIG_LIB9PFS_IODEPTH];
+	struct uk_9pfs_io *cur;
+	struct uk_9preq *req;
+	struct iovec *iov;
+	unsigned int head = 0, nio = 0;
+	uint64_t off = uio->uio_offset;
+	uint32_t chunk, count;
+	/* Position up to which requests have been sent */
+	int sidx = 0;
+	char *sbuf = NULL;
+	size_t slen = 0;
+	/* Position up to which replies have been collected */
+	int ridx = 0;
+	bool drain = false, done = false;
+	int64_t bytes;
+	int rc = 0;
+
+	if (past)
+		*past = 0;
+
+	/*
+	 * Split large transfers so that all requests in flight carry data, but
+	 * do not issue requests smaller than a page.
+	 */
+	chunk = write ? uk_9p_write_maxcount(dev, fid)
+		      : uk_9p_read_maxcount(dev, fid);
+	chunk = MIN(chunk, MAX(ALIGN_UP((uint64_t)uio->uio_resid /
+					CONFIG_LIB9PFS_IODEPTH, __PAGE_SIZE),
+			       __PAGE_SIZE));
+
+	for (;;) {
+		while (!drain && nio < CONFIG_LIB9PFS_IODEPTH && off < end) {
+			while (!slen && sidx < uio->uio_iovcnt) {
+				iov = &uio->uio_iov[sidx++];
+				sbuf = iov->iov_base;
+				slen = iov->iov_len;
+			}
+			if (!slen)
+				break;
+
+			count = MIN(MIN(chunk, slen), end - off);
+			if (write)
+				req = uk_9p_write_start(dev, fid, off, count,
+							sbuf);
+			else
+				req = uk_9p_read_start(dev, fid, off, count,
+						       sbuf);
+			if (PTRISERR(req)) {
+				/* Try again once a request has completed */
+				if (nio)
+					break;
+				return PTR2ERR(req);
+			}
+
+			cur = &io[(head + nio) % CONFIG_LIB9PFS_IODEPTH];
+			cur->req = req;
+			cur->off = off;
+			cur->count = count;
+			nio++;
+
+			off += count;
+			sbuf += count;
+			slen -= count;
+		}
+
+		if (!nio) {
+			if (done || !drain)
+				break;
+
+			/* Send the rest again after a short transfer */
+			drain = false;
+			off = uio->uio_offset;
+			sidx = ridx;
+			slen = 0;
+			continue;
+		}
+
+		cur = &io[head];
+		head = (head + 1) % CONFIG_LIB9PFS_IODEPTH;
+		nio--;
+
+		if (write)
+			bytes = uk_9p_write_wait(dev, cur->req);
+		else
+			bytes = uk_9p_read_wait(dev, cur->req);
+		if (drain) {
+			if (write && past && bytes > 0)
+				*past = MAX(*past, cur->off + MIN((uint64_t)bytes,
+								  cur->count));
+			continue;
+		}
+		if (unlikely(bytes < 0 || bytes > cur->count)) {
+			rc = bytes < 0 ? (int)bytes : -EIO;
+			drain = done = true;
+			continue;
+		}
+
+		while (!uio->uio_iov[ridx].iov_len)
+			ridx++;
+		iov = &uio->uio_iov[ridx];
+
+		UK_ASSERT(uio->uio_offset <= __OFF_MAX - bytes);
+		UK_ASSERT(uio->uio_resid >= bytes);
+		UK_ASSERT(iov->iov_len >= (uint64_t)bytes);
+
+		iov->iov_base = (char *)iov->iov_base + bytes;
+		iov->iov_len -= bytes;
+		uio->uio_offset += bytes;
+		uio->uio_resid -= bytes;
+
+		if (bytes < cur->count) {
+			drain = true;
+			done = write || !bytes;
+		}
+	}
+
+	return rc;
+}
+
+/*
+ * Returns the fid that writes to the node go through. It is opened on first
+ * use and kept until the node is released.
+ */
+static struct uk_9pfid *uk_9pfs_wfid(struct vnode *vp)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	struct uk_9pfid *fid;
+	int rc;
+
+	if (nd->wfid)
+		return nd->wfid;
+
+	/* Clone vnode fid. */
+	fid = uk_9p_walk(md->dev, nd->fid, NULL);
+	if (PTRISERR(fid))
+		return fid;
+
+	if (md->proto == UK_9P_PROTO_2000L)
+		rc = uk_9p_lopen(md->dev, fid, O_WRONLY);
+	else if (md->proto == UK_9P_PROTO_2000U)
+		rc = uk_9p_open(md->dev, fid, UK_9P_OWRITE);
+	else
+		rc = -EOPNOTSUPP;
+
+	if (rc < 0) {
+		uk_9pfid_put(fid);
+		return ERR2PTR(rc);
+	}
+
+	nd->wfid = fid;
+	return fid;
+}
+
+static int uk_9pfs_do_setattr(struct vnode *vp, struct uk_9pfid *fid,
+			      struct vattr *attr);
+
+/*
+ * Writes the data of the uio to the host through the write fid. If a write
+ * comes back short, the file is truncated back so that it does not extend
+ * past the reported count because of the writes that were in flight behind
+ * it. Data that they wrote within the previous size of the file stays, as
+ * after a failed write(2) on a local file system.
+ */
+static int uk_9pfs_write_io(struct vnode *vp, struct uio *uio)
+{
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	uint64_t past, size;
+	int rc, err;
+
+	UK_ASSERT(nd->wfid);
+	rc = uk_9pfs_io(UK_9PFS_MD(vp->v_mount)->dev, nd->wfid, uio, true,
+			UINT64_MAX, &past);
+
+	size = MAX((uint64_t)uio->uio_offset, (uint64_t)vp->v_size);
+	if (unlikely(past > size)) {
+		err = uk_9pfs_do_setattr(vp, nd->wfid, &(struct vattr){
+			.va_mask = AT_SIZE,
+			.va_size = size,
+		});
+		if (err && !rc)
+			rc = -err;
+	}
+	return rc;
+}
+
+#if CONFIG_LIB9PFS_WRITEBEHIND
+#define UK_9PFS_WB_SIZE		(CONFIG_LIB9PFS_WRITEBEHIND * 1024)
+
+/*
+ * Writes the data collected in the write-behind buffer to the host. The data
+ * is dropped if this fails, so the error is reported only once.
+ */
+static int uk_9pfs_wb_flush(struct vnode *vp)
+{
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	struct iovec iov;
+	struct uio uio;
+	int rc;
+
+	if (!nd->wb_len)
+		return 0;
+
+	iov.iov_base = nd->wb_buf;
+	iov.iov_len = nd->wb_len;
+	uio.uio_iov = &iov;
+	uio.uio_iovcnt = 1;
+	uio.uio_offset = nd->wb_off;
+	uio.uio_resid = nd->wb_len;
+	uio.uio_rw = UIO_WRITE;
+
+	rc = uk_9pfs_write_io(vp, &uio);
+	if (!rc && uio.uio_resid)
+		rc = -EIO;
+
+	nd->wb_len = 0;
+	return rc;
+}
+
+/*
+ * Collects the data of the uio in the write-behind buffer. Returns 1 if the
+ * write has to go to the host directly instead.
+ */
+static int uk_9pfs_wb_write(struct vnode *vp, struct uio *uio, int ioflag)
+{
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+	int n, rc;
+
+	if (nd->wb_len && ((uint64_t)uio->uio_offset !=
+			   nd->wb_off + nd->wb_len ||
+			   uio->uio_resid > UK_9PFS_WB_SIZE - nd->wb_len ||
+			   (ioflag & IO_SYNC))) {
+		rc = uk_9pfs_wb_flush(vp);
+		if (rc)
+			return rc;
+	}
+
+	if ((ioflag & IO_SYNC) || uio->uio_resid >= UK_9PFS_WB_SIZE)
+		return 1;
+	n = uio->uio_resid;
+
+	if (!nd->wb_buf) {
+		nd->wb_buf = malloc(UK_9PFS_WB_SIZE);
+		if (!nd->wb_buf)
+			return 1;
+	}
+
+	if (!nd->wb_len)
+		nd->wb_off = uio->uio_offset;
+	rc = vfscore_uiomove(nd->wb_buf + nd->wb_len, n, uio);
+	if (rc)
+		return -rc;
+	nd->wb_len += n;
+
+	return 0;
+}
+#else /* !CONFIG_LIB9PFS_WRITEBEHIND */
+static inline int uk_9pfs_wb_flush(struct vnode *vp __unused)
+{
+	return 0;
+}
+#endif /* !CONFIG_LIB9PFS_WRITEBEHIND */
+
+#if CONFIG_LIB9PFS_READAHEAD
+#define UK_9PFS_RA_SIZE		(CONFIG_LIB9PFS_READAHEAD * 1024)
+
+static bool uk_9pfs_ra_enabled(struct vnode *vp, struct vfscore_file *fp)
+{
+	/* The page cache reads ahead by itself. */
+	return !vfscore_pagecache_enabled(vp) && !(fp->f_flags & O_DIRECT);
+}
+
+/* Waits for the read-ahead request of the file, if there is one. */
+static void uk_9pfs_ra_wait(struct uk_9pdev *dev, struct uk_9pfs_file_data *fd)
+{
+	int64_t bytes;
+
+	if (!fd->ra_req)
+		return;
+
+	bytes = uk_9p_read_wait(dev, fd->ra_req);
+	fd->ra_req = NULL;
+
+	/* Errors are not reported, the data is read again when needed. */
+	fd->ra_len = bytes > 0 ? bytes : 0;
+}
+
+/* Copies the data at the offset of the uio from the read-ahead buffer. */
+static int uk_9pfs_ra_read(struct vnode *vp, struct uk_9pfs_file_data *fd,
+			   struct uio *uio)
+{
+	uint64_t off = uio->uio_offset;
+	uint32_t len;
+
+	uk_9pfs_ra_wait(UK_9PFS_MD(vp->v_mount)->dev, fd);
+	if (fd->ra_gen != UK_9PFS_ND(vp)->gen)
+		fd->ra_len = 0;
+
+	if (off < fd->ra_off || off >= fd->ra_off + fd->ra_len)
+		return 0;
+
+	len = MIN(fd->ra_off + fd->ra_len - off, (uint64_t)uio->uio_resid);
+	return vfscore_uiomove(fd->ra_buf + (off - fd->ra_off), len, uio);
+}
+
+/* Starts reading the data at the given offset into the read-ahead buffer. */
+static void uk_9pfs_ra_start(struct vnode *vp, struct uk_9pfs_file_data *fd,
+			     uint64_t off)
+{
+	struct uk_9preq *req;
+
+	UK_ASSERT(!fd->ra_req);
+
+	if (off >= (uint64_t)vp->v_size)
+		return;
+
+	if (!fd->ra_buf) {
+		fd->ra_buf = malloc(UK_9PFS_RA_SIZE);
+		if (!fd->ra_buf)
+			return;
+	}
+
+	req = uk_9p_read_start(UK_9PFS_MD(vp->v_mount)->dev, fd->fid, off,
+			       MIN((uint64_t)UK_9PFS_RA_SIZE, vp->v_size - off),
+			       fd->ra_buf);
+	if (PTRISERR(req))
+		return;
+
+	fd->ra_req = req;
+	fd->ra_off = off;
+	fd->ra_len = 0;
+	fd->ra_gen = UK_9PFS_ND(vp)->gen;
+}
+#endif /* CONFIG_LIB9PFS_READAHEAD */
+
 int uk_9pfs_allocate_vnode_data(struct vnode *vp, struct uk_9pfid *fid)
 {
 	struct uk_9pfs_node_data *nd;
@@ -165,6 +523,15 @@ int uk_9pfs_allocate_vnode_data(struct vnode *vp, struct uk_9pfid *fid)
 	nd->fid = fid;
 	nd->nb_open_files = 0;
 	nd->removed = false;
+	nd->wfid = NULL;
+	nd->gen = 0;
+	nd->attr_expiry = 0;
+	UK_INIT_LIST_HEAD(&nd->dir_chunks);
+	nd->dir_expiry = 0;
+#if CONFIG_LIB9PFS_WRITEBEHIND
+	nd->wb_buf = NULL;
+	nd->wb_len = 0;
+#endif /* CONFIG_LIB9PFS_WRITEBEHIND */
 	vp->v_data = nd;
 
 	return 0;
@@ -178,6 +545,15 @@ void uk_9pfs_free_vnode_data(struct vnode *vp)
 	if (!vp->v_data)
 		return;
 
+	/* There is no one left to report an error to. */
+	uk_9pfs_wb_flush(vp);
+#if CONFIG_LIB9PFS_WRITEBEHIND
+	free(nd->wb_buf);
+#endif /* CONFIG_LIB9PFS_WRITEBEHIND */
+	if (nd->wfid)
+		uk_9pfid_put(nd->wfid);
+	uk_9pfs_dir_cache_drop(vp);
+
 	if (nd->removed)
 		uk_9p_remove(dev, nd->fid);
 
@@ -233,18 +609,90 @@ out:
 	return -rc;
 }
 
-static int uk_9pfs_close(struct vnode *vn __unused, struct vfscore_file *file)
+static int uk_9pfs_close(struct vnode *vn, struct vfscore_file *file)
 {
 	struct uk_9pfs_file_data *fd = UK_9PFS_FD(file);
+	int rc;
+
+	rc = uk_9pfs_wb_flush(vn);
 
 	if (fd->readdir_buf)
 		free(fd->readdir_buf);
 
+#if CONFIG_LIB9PFS_READAHEAD
+	uk_9pfs_ra_wait(UK_9PFS_MD(vn->v_mount)->dev, fd);
+	free(fd->ra_buf);
+#endif /* CONFIG_LIB9PFS_READAHEAD */
+
 	uk_9pfid_put(fd->fid);
 	free(fd);
 	UK_9PFS_ND(file->f_dentry->d_vnode)->nb_open_files--;
 
-	return 0;
+	return -rc;
+}
+
+static void uk_9pfs_attr_from_stat_l(struct vnode *vp,
+				     const struct uk_9p_attr *stat,
+				     struct vattr *attr)
+{
+	attr->va_type = stat->mode & S_IFMT;
+	attr->va_mode = stat->mode & UK_ALLPERMS;
+	attr->va_nlink = stat->nlink;
+	attr->va_uid = stat->uid;
+	attr->va_gid = stat->gid;
+	attr->va_nodeid = vp->v_ino;
+	attr->va_atime.tv_sec = stat->atime_sec;
+	attr->va_atime.tv_nsec = stat->atime_nsec;
+	attr->va_mtime.tv_sec = stat->mtime_sec;
+	attr->va_mtime.tv_nsec = stat->mtime_nsec;
+	attr->va_ctime.tv_sec = stat->ctime_sec;
+	attr->va_ctime.tv_nsec = stat->ctime_nsec;
+	attr->va_rdev = stat->rdev;
+	attr->va_nblocks = stat->blocks;
+	attr->va_size = stat->size;
+}
+
+static void uk_9pfs_attr_from_stat(struct vnode *vp,
+				   const struct uk_9p_stat *stat,
+				   struct vattr *attr)
+{
+	attr->va_type = uk_9pfs_vtype_from_mode(stat->mode);
+	attr->va_mode = uk_9pfs_posix_mode_from_mode(stat->mode);
+	attr->va_nodeid = vp->v_ino;
+	attr->va_size = stat->length;
+
+	attr->va_atime.tv_sec = stat->atime;
+	attr->va_atime.tv_nsec = 0;
+	attr->va_mtime.tv_sec = stat->mtime;
+	attr->va_mtime.tv_nsec = 0;
+	attr->va_ctime.tv_sec = 0;
+	attr->va_ctime.tv_nsec = 0;
+}
+
+/* Keeps attributes that were fetched from the host for `cache=loose` */
+static void uk_9pfs_attr_cache(struct vnode *vp, const struct vattr *attr)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
+
+	if (md->cache != UK_9PFS_CACHE_LOOSE)
+		return;
+
+	nd->attr = *attr;
+	nd->attr_expiry = ukplat_monotonic_clock() + md->cache_ttl;
+}
+
+/* Drops what is cached about a name after the directory was changed */
+static void uk_9pfs_dir_changed(struct vnode *dvp, const char *name)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(dvp->v_mount);
+
+	if (md->cache != UK_9PFS_CACHE_LOOSE)
+		return;
+
+	uk_9pfs_cache_remove(dvp, name);
+	uk_9pfs_dir_cache_drop(dvp);
+	UK_9PFS_ND(dvp)->attr_expiry = 0;
 }
 
 static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
@@ -255,21 +703,37 @@ static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
 	struct uk_9pfid *dfid = UK_9PFS_VFID(dvp);
 	struct uk_9pfid *fid;
 	struct vnode *vp;
+	struct vattr attr;
+	bool attr_valid = false;
+	bool loose = md->cache == UK_9PFS_CACHE_LOOSE;
 	int rc;
 
 	if (strlen(name) > NAME_MAX)
 		return ENAMETOOLONG;
 
+	if (loose) {
+		rc = uk_9pfs_cache_lookup(dvp, name, vpp);
+		if (rc > 0)
+			return 0;
+		if (rc < 0)
+			return -rc;
+	}
+
 	fid = uk_9p_walk(dev, dfid, name);
 	if (PTRISERR(fid)) {
 		rc = PTR2ERR(fid);
+		if (loose && rc == -ENOENT)
+			uk_9pfs_cache_enter(dvp, name, NULL);
 		goto out;
 	}
 
 	if (md->proto == UK_9P_PROTO_2000L) {
 		struct uk_9p_attr stat;
+		/* With cache=loose, also fetch what a following stat needs */
 		struct uk_9preq *stat_req = uk_9p_getattr(
-		    dev, fid, UK_9P_GETATTR_MODE | UK_9P_GETATTR_SIZE, &stat);
+		    dev, fid, loose ? UK_9P_GETATTR_BASIC
+				    : UK_9P_GETATTR_MODE | UK_9P_GETATTR_SIZE,
+		    &stat);
 		if (PTRISERR(stat_req)) {
 			rc = PTR2ERR(stat_req);
 			goto out_fid;
@@ -291,7 +755,7 @@ static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
 			 * it may be reused.
 			 */
 			if (vp->v_data)
-				goto out_fid;
+				goto out_cache;
 		}
 
 		if (!vp) {
@@ -304,6 +768,11 @@ static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
 		vp->v_type = uk_9pfs_vtype_from_mode_l(stat.mode);
 		vp->v_size = stat.size;
 
+		if ((stat.valid & UK_9P_GETATTR_BASIC) == UK_9P_GETATTR_BASIC) {
+			uk_9pfs_attr_from_stat_l(vp, &stat, &attr);
+			attr_valid = true;
+		}
+
 	} else if (md->proto == UK_9P_PROTO_2000U) {
 		struct uk_9p_stat stat;
 		struct uk_9preq *stat_req = uk_9p_stat(dev, fid, &stat);
@@ -325,7 +794,7 @@ static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
 			 * it may be reused.
 			 */
 			if (vp->v_data)
-				goto out_fid;
+				goto out_cache;
 		}
 
 		if (!vp) {
@@ -338,6 +807,9 @@ static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
 		vp->v_type = uk_9pfs_vtype_from_mode(stat.mode);
 		vp->v_size = stat.length;
 
+		uk_9pfs_attr_from_stat(vp, &stat, &attr);
+		attr_valid = true;
+
 	} else {
 		rc = -EOPNOTSUPP;
 		goto out_fid;
@@ -347,10 +819,18 @@ static int uk_9pfs_lookup(struct vnode *dvp, const char *name,
 	if (rc != 0)
 		goto out_fid;
 
+	if (attr_valid)
+		uk_9pfs_attr_cache(vp, &attr);
+	if (loose)
+		uk_9pfs_cache_enter(dvp, name, vp);
+
 	*vpp = vp;
 
 	return 0;
 
+out_cache:
+	if (loose)
+		uk_9pfs_cache_enter(dvp, name, vp);
 out_fid:
 	uk_9pfid_put(fid);
 out:
@@ -392,6 +872,8 @@ static int uk_9pfs_create(struct vnode *dvp, const char *name, mode_t mode)
 	if (!S_ISREG(mode))
 		return EINVAL;
 
+	uk_9pfs_dir_changed(dvp, name);
+
 	if (md->proto == UK_9P_PROTO_2000L) {
 		struct uk_9pfid *fid =
 		    uk_9p_walk(md->dev, UK_9PFS_VFID(dvp), NULL);
@@ -415,11 +897,14 @@ static int uk_9pfs_remove_generic(struct vnode *dvp, struct vnode *vp)
 }
 
 static int uk_9pfs_remove(struct vnode *dvp, struct vnode *vp,
-			  const char *name __unused)
+			  const char *name)
 {
 	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
 	int rc = 0;
 
+	uk_9pfs_dir_changed(dvp, name);
+	nd->attr_expiry = 0;
+
 	if (!nd->nb_open_files)
 		rc = uk_9pfs_remove_generic(dvp, vp);
 	else
@@ -433,20 +918,56 @@ static int uk_9pfs_mkdir(struct vnode *dvp, const char *name, mode_t mode)
 	if (!S_ISDIR(mode))
 		return EINVAL;
 
+	uk_9pfs_dir_changed(dvp, name);
+
 	return uk_9pfs_create_generic(dvp, name, mode);
 }
 
 static int uk_9pfs_rmdir(struct vnode *dvp, struct vnode *vp,
-			 const char *name __unused)
+			 const char *name)
 {
+	uk_9pfs_dir_changed(dvp, name);
+
 	return uk_9pfs_remove_generic(dvp, vp);
 }
 
+/*
+ * Reads the next chunk of directory entries from the host, starting at the
+ * current file offset. On `cache=loose` mounts, the chunks are kept with the
+ * directory vnode until they expire or the directory is modified.
+ */
+static int uk_9pfs_readdir_fetch(struct vnode *vp, struct vfscore_file *fp,
+				 char *buf)
+{
+	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
+	struct uk_9pfs_file_data *fd = UK_9PFS_FD(fp);
+	int rc;
+
+	if (md->cache == UK_9PFS_CACHE_LOOSE) {
+		rc = uk_9pfs_dir_cache_get(vp, fp->f_offset, buf);
+		if (rc >= 0)
+			return rc;
+	}
+
+	if (md->proto == UK_9P_PROTO_2000L)
+		rc = uk_9p_readdir(md->dev, fd->fid, fp->f_offset,
+				   UK_9PFS_READDIR_BUFSZ, buf);
+	else if (md->proto == UK_9P_PROTO_2000U)
+		rc = uk_9p_read(md->dev, fd->fid, fp->f_offset,
+				UK_9PFS_READDIR_BUFSZ, buf);
+	else
+		rc = -EOPNOTSUPP;
+
+	if (rc >= 0 && md->cache == UK_9PFS_CACHE_LOOSE)
+		uk_9pfs_dir_cache_put(vp, fp->f_offset, buf, rc);
+
+	return rc;
+}
+
 static int uk_9pfs_readdir(struct vnode *vp, struct vfscore_file *fp,
 		struct dirent64 *dir)
 {
 	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
-	struct uk_9pdev *dev = md->dev;
 	struct uk_9pfs_file_data *fd = UK_9PFS_FD(fp);
 	int rc;
 	struct uk_9preq fake_request;
@@ -465,16 +986,7 @@ again:
 	if (fd->readdir_off == fd->readdir_sz) {
 		fd->readdir_off = 0;
 
-		if (md->proto == UK_9P_PROTO_2000L)
-			fd->readdir_sz = uk_9p_readdir(
-			    dev, fd->fid, fp->f_offset, UK_9PFS_READDIR_BUFSZ,
-			    fd->readdir_buf);
-		else if (md->proto == UK_9P_PROTO_2000U)
-			fd->readdir_sz =
-			    uk_9p_read(dev, fd->fid, fp->f_offset,
-				       UK_9PFS_READDIR_BUFSZ, fd->readdir_buf);
-		else
-			fd->readdir_sz = -EOPNOTSUPP;
+		fd->readdir_sz = uk_9pfs_readdir_fetch(vp, fp, fd->readdir_buf);
 
 		if (fd->readdir_sz < 0) {
 			rc = fd->readdir_sz;
@@ -577,10 +1089,12 @@ static int uk_9pfs_read(struct vnode *vp, struct vfscore_file *fp,
 			struct uio *uio, int ioflag __unused)
 {
 	struct uk_9pdev *dev = UK_9PFS_MD(vp->v_mount)->dev;
-	struct uk_9pfid *fid = UK_9PFS_FD(fp)->fid;
-	struct iovec *iov;
-	int64_t bytes;
-	int i = 0;
+	struct uk_9pfs_file_data *fd = UK_9PFS_FD(fp);
+#if CONFIG_LIB9PFS_READAHEAD
+	bool ra = uk_9pfs_ra_enabled(vp, fp);
+	uint64_t start = uio->uio_offset;
+#endif /* CONFIG_LIB9PFS_READAHEAD */
+	int rc;
 
 	if (vp->v_type == VDIR)
 		return EISDIR;
@@ -593,41 +1107,44 @@ static int uk_9pfs_read(struct vnode *vp, struct vfscore_file *fp,
 	if (!uio->uio_resid)
 		return 0;
 
-	while (i < uio->uio_iovcnt) {
-		iov = &uio->uio_iov[i];
-		if (!iov->iov_len) {
-			i++;
-			continue;
-		}
+	rc = uk_9pfs_wb_flush(vp);
+	if (rc)
+		return -rc;
 
-		bytes = uk_9p_read(dev, fid, uio->uio_offset,
-				   iov->iov_len, iov->iov_base);
-		if (unlikely(bytes < 0))
-			return -(int)bytes;
-		if (!bytes)
-			break;
+#if CONFIG_LIB9PFS_READAHEAD
+	if (ra) {
+		rc = uk_9pfs_ra_read(vp, fd, uio);
+		if (rc)
+			return rc;
+	}
+#endif /* CONFIG_LIB9PFS_READAHEAD */
 
-		UK_ASSERT(uio->uio_offset <= __OFF_MAX - bytes);
-		UK_ASSERT(uio->uio_resid >= bytes);
-		UK_ASSERT(iov->iov_len >= (uint64_t)bytes);
+	if (uio->uio_resid && uio->uio_offset < (off_t)vp->v_size) {
+		rc = uk_9pfs_io(dev, fd->fid, uio, false, vp->v_size, NULL);
+		if (rc)
+			return -rc;
+	}
 
-		iov->iov_base = (char *)iov->iov_base + bytes;
-		iov->iov_len -= bytes;
-		uio->uio_offset += bytes;
-		uio->uio_resid -= bytes;
+#if CONFIG_LIB9PFS_READAHEAD
+	if (ra) {
+		/*
+		 * Read on after sequential reads, once the data that was read
+		 * ahead before is used up.
+		 */
+		if (start == fd->ra_next &&
+		    (uint64_t)uio->uio_offset >= fd->ra_off + fd->ra_len)
+			uk_9pfs_ra_start(vp, fd, uio->uio_offset);
+		fd->ra_next = uio->uio_offset;
 	}
+#endif /* CONFIG_LIB9PFS_READAHEAD */
 
 	return 0;
 }
 
 static int uk_9pfs_write(struct vnode *vp, struct uio *uio, int ioflag)
 {
-	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
-	struct uk_9pdev *dev = md->dev;
 	struct uk_9pfid *fid;
-	struct iovec *iov;
-	int64_t bytes;
-	int rc, i = 0;
+	int rc;
 
 	if (vp->v_type == VDIR)
 		return EISDIR;
@@ -643,46 +1160,20 @@ static int uk_9pfs_write(struct vnode *vp, struct uio *uio, int ioflag)
 	if (ioflag & IO_APPEND)
 		uio->uio_offset = vp->v_size;
 
-	/* Clone vnode fid. */
-	fid = uk_9p_walk(dev, UK_9PFS_VFID(vp), NULL);
+	fid = uk_9pfs_wfid(vp);
 	if (PTRISERR(fid))
 		return -PTR2ERR(fid);
 
-	if (md->proto == UK_9P_PROTO_2000L)
-		rc = uk_9p_lopen(dev, fid, O_WRONLY);
-	else if (md->proto == UK_9P_PROTO_2000U)
-		rc = uk_9p_open(dev, fid, UK_9P_OWRITE);
-	else
-		rc = -EOPNOTSUPP;
-
-	if (rc < 0)
-		goto out;
-
-	while (i < uio->uio_iovcnt) {
-		iov = &uio->uio_iov[i];
-		if (!iov->iov_len) {
-			i++;
-			continue;
-		}
-
-		bytes = uk_9p_write(dev, fid, uio->uio_offset,
-				    iov->iov_len, iov->iov_base);
-		if (unlikely(bytes < 0)) {
-			rc = (int)bytes;
-			break;
-		}
-		if (!bytes)
-			break;
+	UK_9PFS_ND(vp)->gen++;
+	UK_9PFS_ND(vp)->attr_expiry = 0;
 
-		UK_ASSERT(uio->uio_offset <= __OFF_MAX - bytes);
-		UK_ASSERT(uio->uio_resid >= bytes);
-		UK_ASSERT(iov->iov_len >= (uint64_t)bytes);
-
-		iov->iov_base = (char *)iov->iov_base + bytes;
-		iov->iov_len -= bytes;
-		uio->uio_offset += bytes;
-		uio->uio_resid -= bytes;
-	}
+#if CONFIG_LIB9PFS_WRITEBEHIND
+	rc = uk_9pfs_wb_write(vp, uio, ioflag);
+	if (rc == 1)
+		rc = uk_9pfs_write_io(vp, uio);
+#else /* !CONFIG_LIB9PFS_WRITEBEHIND */
+	rc = uk_9pfs_write_io(vp, uio);
+#endif /* !CONFIG_LIB9PFS_WRITEBEHIND */
 
 	/*
 	 * If the uio offset after completion of the write requests is bigger
@@ -692,8 +1183,6 @@ static int uk_9pfs_write(struct vnode *vp, struct uio *uio, int ioflag)
 	if (uio->uio_offset > vp->v_size)
 		vp->v_size = uio->uio_offset;
 
-out:
-	uk_9pfid_put(fid);
 	return -rc;
 }
 
@@ -701,10 +1190,21 @@ static int uk_9pfs_getattr(struct vnode *vp, struct vattr *attr)
 {
 	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
 	struct uk_9pdev *dev = md->dev;
+	struct uk_9pfs_node_data *nd = UK_9PFS_ND(vp);
 	struct uk_9pfid *fid = UK_9PFS_VFID(vp);
 	struct uk_9preq *stat_req;
 	int rc = 0;
 
+	rc = uk_9pfs_wb_flush(vp);
+	if (rc)
+		goto out;
+
+	if (md->cache == UK_9PFS_CACHE_LOOSE &&
+	    ukplat_monotonic_clock() < nd->attr_expiry) {
+		*attr = nd->attr;
+		goto out;
+	}
+
 	if (md->proto == UK_9P_PROTO_2000L) {
 		struct uk_9p_attr stat;
 
@@ -721,21 +1221,7 @@ static int uk_9pfs_getattr(struct vnode *vp, struct vattr *attr)
 			goto out;
 		}
 
-		attr->va_type = stat.mode & S_IFMT;
-		attr->va_mode = stat.mode & UK_ALLPERMS;
-		attr->va_nlink = stat.nlink;
-		attr->va_uid = stat.uid;
-		attr->va_gid = stat.gid;
-		attr->va_nodeid = vp->v_ino;
-		attr->va_atime.tv_sec = stat.atime_sec;
-		attr->va_atime.tv_nsec = stat.atime_nsec;
-		attr->va_mtime.tv_sec = stat.mtime_sec;
-		attr->va_mtime.tv_nsec = stat.mtime_nsec;
-		attr->va_ctime.tv_sec = stat.ctime_sec;
-		attr->va_ctime.tv_nsec = stat.ctime_nsec;
-		attr->va_rdev = stat.rdev;
-		attr->va_nblocks = stat.blocks;
-		attr->va_size = stat.size;
+		uk_9pfs_attr_from_stat_l(vp, &stat, attr);
 
 	} else if (md->proto == UK_9P_PROTO_2000U) {
 		struct uk_9p_stat stat;
@@ -749,21 +1235,14 @@ static int uk_9pfs_getattr(struct vnode *vp, struct vattr *attr)
 		/* No stat string fields are used below. */
 		uk_9pdev_req_remove(dev, stat_req);
 
-		attr->va_type = uk_9pfs_vtype_from_mode(stat.mode);
-		attr->va_mode = uk_9pfs_posix_mode_from_mode(stat.mode);
-		attr->va_nodeid = vp->v_ino;
-		attr->va_size = stat.length;
-
-		attr->va_atime.tv_sec = stat.atime;
-		attr->va_atime.tv_nsec = 0;
-		attr->va_mtime.tv_sec = stat.mtime;
-		attr->va_mtime.tv_nsec = 0;
-		attr->va_ctime.tv_sec = 0;
-		attr->va_ctime.tv_nsec = 0;
+		uk_9pfs_attr_from_stat(vp, &stat, attr);
 	} else {
 		rc = -EOPNOTSUPP;
+		goto out;
 	}
 
+	uk_9pfs_attr_cache(vp, attr);
+
 out:
 	return -rc;
 }
@@ -885,6 +1364,16 @@ static int uk_9pfs_do_setattr(struct vnode *vp, struct uk_9pfid *fid,
 
 static int uk_9pfs_setattr(struct vnode *vp, struct vattr *attr)
 {
+	int rc;
+
+	rc = uk_9pfs_wb_flush(vp);
+	if (rc)
+		return -rc;
+
+	if (attr->va_mask & AT_SIZE)
+		UK_9PFS_ND(vp)->gen++;
+	UK_9PFS_ND(vp)->attr_expiry = 0;
+
 	return uk_9pfs_do_setattr(vp, UK_9PFS_VFID(vp), attr);
 }
 
@@ -892,6 +1381,11 @@ static int uk_9pfs_fsync(struct vnode *vp, struct vfscore_file *fp)
 {
 	struct uk_9pfs_mount_data *md = UK_9PFS_MD(vp->v_mount);
 	struct uk_9pfid *fid = UK_9PFS_FD(fp)->fid;
+	int rc;
+
+	rc = uk_9pfs_wb_flush(vp);
+	if (rc)
+		return -rc;
 
 	if (md->proto == UK_9P_PROTO_2000L) {
 		return -uk_9p_fsync(md->dev, fid);
@@ -906,7 +1400,7 @@ static int uk_9pfs_fsync(struct vnode *vp, struct vfscore_file *fp)
 
 static int uk_9pfs_truncate(struct vnode *vp, off_t off)
 {
-	return uk_9pfs_do_setattr(vp, UK_9PFS_VFID(vp), &(struct vattr){
+	return uk_9pfs_setattr(vp, &(struct vattr){
 		.va_mask = AT_SIZE,
 		.va_size = off,
 	});
@@ -914,7 +1408,7 @@ static int uk_9pfs_truncate(struct vnode *vp, off_t off)
 
 static int uk_9pfs_rename(struct vnode *dvp1, struct vnode *vp1,
 			  const char *name1,
-			  struct vnode *dvp2, struct vnode *vp2 __unused,
+			  struct vnode *dvp2, struct vnode *vp2,
 			  const char *name2)
 {
 	struct uk_9pfs_mount_data *dmd1 = UK_9PFS_MD(dvp1->v_mount);
@@ -927,6 +1421,11 @@ static int uk_9pfs_rename(struct vnode *dvp1, struct vnode *vp1,
 	if (dmd1->dev != dmd2->dev)
 		return EXDEV;
 
+	uk_9pfs_dir_changed(dvp1, name1);
+	uk_9pfs_dir_changed(dvp2, name2);
+	if (vp2)
+		UK_9PFS_ND(vp2)->attr_expiry = 0;
+
 	if (dmd1->proto == UK_9P_PROTO_2000L) {
 		rc = uk_9p_renameat(dmd1->dev, dfid1, name1, dfid2, name2);
 		if (rc == -EOPNOTSUPP)
@@ -948,6 +1447,9 @@ static int uk_9pfs_link(struct vnode *dvp, struct vnode *svp, const char *name)
 	if (dmd->dev != smd->dev)
 		return EXDEV;
 
+	uk_9pfs_dir_changed(dvp, name);
+	UK_9PFS_ND(svp)->attr_expiry = 0;
+
 	if (dmd->proto == UK_9P_PROTO_2000L)
 		return -uk_9p_link(dmd->dev, dfid, sfid, name);
 	else
@@ -1004,6 +1506,8 @@ static int uk_9pfs_symlink(struct vnode *dvp, const char *op, const char *np)
 	struct uk_9pfid *dfid = UK_9PFS_VFID(dvp);
 	struct uk_9pfid *fid;
 
+	uk_9pfs_dir_changed(dvp, op);
+
 	fid = uk_9p_symlink(md->dev, dfid, op, np, 0);
 	if (PTRISERR(fid))
 		return -PTR2ERR(fid);
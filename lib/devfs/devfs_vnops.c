@@ -277,6 +277,8 @@ struct vnops devfs_vnops = {
 	devfs_readlink,		/* read link */
 	devfs_symlink,		/* symbolic link */
 	devfs_poll,		/* poll */
+	(vnop_getpage_t) NULL,	/* get page */
+	(vnop_putpage_t) NULL,	/* put page */
 };
 
 /*
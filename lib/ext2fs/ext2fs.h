@@ -0,0 +1,312 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __EXT2FS_H__
+#define __EXT2FS_H__
+
+#include <uk/arch/types.h>
+#include <uk/blkcache.h>
+#include <uk/essentials.h>
+#include <uk/mutex.h>
+#include <vfscore/mount.h>
+#include <vfscore/vnode.h>
+
+/*
+ * On-disk format. All fields are little-endian, like all platforms that
+ * Unikraft supports, so they are accessed directly.
+ */
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "ext2fs requires a little-endian architecture"
+#endif
+
+#define EXT2_SUPER_OFFSET		1024
+#define EXT2_SUPER_SIZE			1024
+#define EXT2_SUPER_MAGIC		0xef53
+#define EXT2_VALID_FS			0x0001
+
+#define EXT2_GOOD_OLD_REV		0
+#define EXT2_GOOD_OLD_INODE_SIZE	128
+#define EXT2_GOOD_OLD_FIRST_INO		11
+#define EXT2_MIN_BLOCK_LOG_SIZE		10
+#define EXT2_MAX_BLOCK_LOG_SIZE		16
+
+#define EXT2_ROOT_INO			2
+#define EXT2_LINK_MAX			65000
+
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL		0x0004
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
+
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
+#define EXT4_FEATURE_RO_COMPAT_HUGE_FILE	0x0008
+
+#define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
+#define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004
+#define EXT4_FEATURE_INCOMPAT_EXTENTS		0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT		0x0080
+#define EXT4_FEATURE_INCOMPAT_MMP		0x0100
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG		0x0200
+#define EXT4_FEATURE_INCOMPAT_EA_INODE		0x0400
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED		0x2000
+#define EXT4_FEATURE_INCOMPAT_LARGEDIR		0x4000
+
+/* Features that we can read */
+#define EXT2FS_INCOMPAT_SUPP	(EXT2_FEATURE_INCOMPAT_FILETYPE |	\
+				 EXT3_FEATURE_INCOMPAT_RECOVER |	\
+				 EXT4_FEATURE_INCOMPAT_EXTENTS |	\
+				 EXT4_FEATURE_INCOMPAT_64BIT |		\
+				 EXT4_FEATURE_INCOMPAT_MMP |		\
+				 EXT4_FEATURE_INCOMPAT_FLEX_BG |	\
+				 EXT4_FEATURE_INCOMPAT_EA_INODE |	\
+				 EXT4_FEATURE_INCOMPAT_CSUM_SEED |	\
+				 EXT4_FEATURE_INCOMPAT_LARGEDIR)
+
+/* Features that we can also write */
+#define EXT2FS_INCOMPAT_WRITE	(EXT2_FEATURE_INCOMPAT_FILETYPE |	\
+				 EXT4_FEATURE_INCOMPAT_64BIT |		\
+				 EXT4_FEATURE_INCOMPAT_FLEX_BG)
+#define EXT2FS_RO_COMPAT_WRITE	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER |	\
+				 EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+
+struct ext2_super_block {
+	__u32 s_inodes_count;
+	__u32 s_blocks_count;
+	__u32 s_r_blocks_count;
+	__u32 s_free_blocks_count;
+	__u32 s_free_inodes_count;
+	__u32 s_first_data_block;
+	__u32 s_log_block_size;
+	__u32 s_log_cluster_size;
+	__u32 s_blocks_per_group;
+	__u32 s_clusters_per_group;
+	__u32 s_inodes_per_group;
+	__u32 s_mtime;
+	__u32 s_wtime;
+	__u16 s_mnt_count;
+	__s16 s_max_mnt_count;
+	__u16 s_magic;
+	__u16 s_state;
+	__u16 s_errors;
+	__u16 s_minor_rev_level;
+	__u32 s_lastcheck;
+	__u32 s_checkinterval;
+	__u32 s_creator_os;
+	__u32 s_rev_level;
+	__u16 s_def_resuid;
+	__u16 s_def_resgid;
+	/* EXT2_DYNAMIC_REV */
+	__u32 s_first_ino;
+	__u16 s_inode_size;
+	__u16 s_block_group_nr;
+	__u32 s_feature_compat;
+	__u32 s_feature_incompat;
+	__u32 s_feature_ro_compat;
+	__u8  s_uuid[16];
+	char  s_volume_name[16];
+	char  s_last_mounted[64];
+	__u32 s_algorithm_usage_bitmap;
+	__u8  s_prealloc_blocks;
+	__u8  s_prealloc_dir_blocks;
+	__u16 s_reserved_gdt_blocks;
+	__u8  s_journal_uuid[16];
+	__u32 s_journal_inum;
+	__u32 s_journal_dev;
+	__u32 s_last_orphan;
+	__u32 s_hash_seed[4];
+	__u8  s_def_hash_version;
+	__u8  s_jnl_backup_type;
+	__u16 s_desc_size;
+	__u32 s_default_mount_opts;
+	__u32 s_first_meta_bg;
+	__u32 s_mkfs_time;
+	__u32 s_jnl_blocks[17];
+	/* EXT4_FEATURE_INCOMPAT_64BIT */
+	__u32 s_blocks_count_hi;
+	__u32 s_r_blocks_count_hi;
+	__u32 s_free_blocks_count_hi;
+	__u8  s_pad[676];
+};
+
+UK_CTASSERT(sizeof(struct ext2_super_block) == EXT2_SUPER_SIZE);
+
+#define EXT2_MIN_DESC_SIZE		32
+#define EXT2_MIN_DESC_SIZE_64BIT	64
+
+struct ext2_group_desc {
+	__u32 bg_block_bitmap;
+	__u32 bg_inode_bitmap;
+	__u32 bg_inode_table;
+	__u16 bg_free_blocks_count;
+	__u16 bg_free_inodes_count;
+	__u16 bg_used_dirs_count;
+	__u16 bg_flags;
+	__u32 bg_reserved[3];
+	/* EXT4_FEATURE_INCOMPAT_64BIT */
+	__u32 bg_block_bitmap_hi;
+	__u32 bg_inode_bitmap_hi;
+	__u32 bg_inode_table_hi;
+	__u16 bg_free_blocks_count_hi;
+	__u16 bg_free_inodes_count_hi;
+	__u16 bg_used_dirs_count_hi;
+	__u16 bg_pad[7];
+};
+
+UK_CTASSERT(sizeof(struct ext2_group_desc) == EXT2_MIN_DESC_SIZE_64BIT);
+
+#define EXT2_NDIR_BLOCKS		12
+#define EXT2_IND_BLOCK			12
+#define EXT2_DIND_BLOCK			13
+#define EXT2_TIND_BLOCK			14
+#define EXT2_N_BLOCKS			15
+
+#define EXT2_INDEX_FL			0x00001000
+#define EXT4_HUGE_FILE_FL		0x00040000
+#define EXT4_EXTENTS_FL			0x00080000
+#define EXT4_INLINE_DATA_FL		0x10000000
+
+/* The part of the inode that is common to all revisions */
+struct ext2_inode {
+	__u16 i_mode;
+	__u16 i_uid;
+	__u32 i_size;
+	__u32 i_atime;
+	__u32 i_ctime;
+	__u32 i_mtime;
+	__u32 i_dtime;
+	__u16 i_gid;
+	__u16 i_links_count;
+	__u32 i_blocks;
+	__u32 i_flags;
+	__u32 i_osd1;
+	__u32 i_block[EXT2_N_BLOCKS];
+	__u32 i_generation;
+	__u32 i_file_acl;
+	__u32 i_size_high;
+	__u32 i_faddr;
+	__u16 i_blocks_hi;
+	__u16 i_file_acl_high;
+	__u16 i_uid_high;
+	__u16 i_gid_high;
+	__u32 i_reserved2;
+};
+
+UK_CTASSERT(sizeof(struct ext2_inode) == EXT2_GOOD_OLD_INODE_SIZE);
+
+/* Symbolic links shorter than this are stored in i_block */
+#define EXT2_FAST_SYMLINK_MAX		(sizeof(((struct ext2_inode *)0)->i_block))
+
+#define EXT4_EXT_MAGIC			0xf30a
+#define EXT4_EXT_INIT_MAX_LEN		32768
+
+struct ext4_extent_header {
+	__u16 eh_magic;
+	__u16 eh_entries;
+	__u16 eh_max;
+	__u16 eh_depth;
+	__u32 eh_generation;
+};
+
+struct ext4_extent_idx {
+	__u32 ei_block;
+	__u32 ei_leaf_lo;
+	__u16 ei_leaf_hi;
+	__u16 ei_unused;
+};
+
+struct ext4_extent {
+	__u32 ee_block;
+	__u16 ee_len;
+	__u16 ee_start_hi;
+	__u32 ee_start_lo;
+};
+
+#define EXT2_NAME_LEN			255
+
+#define EXT2_FT_UNKNOWN			0
+#define EXT2_FT_REG_FILE		1
+#define EXT2_FT_DIR			2
+#define EXT2_FT_CHRDEV			3
+#define EXT2_FT_BLKDEV			4
+#define EXT2_FT_FIFO			5
+#define EXT2_FT_SOCK			6
+#define EXT2_FT_SYMLINK			7
+
+struct ext2_dir_entry {
+	__u32 inode;
+	__u16 rec_len;
+	__u8  name_len;
+	__u8  file_type;
+	char  name[];
+};
+
+#define EXT2_DIR_REC_LEN(name_len)	ALIGN_UP(8U + (name_len), 4)
+
+/*
+ * In-memory state
+ */
+struct ext2fs_mount {
+	struct uk_mutex lock;		/* Serializes all operations */
+	struct uk_blkcache *bc;
+	int rdonly;
+
+	struct ext2_super_block sb;	/* Copy of the primary superblock */
+	void *gdt;			/* Copy of the group descriptors */
+	int meta_dirty;			/* sb or gdt need to be written */
+
+	__u32 bsize;
+	__u32 log_bsize;
+	__u32 addr_per_block;		/* Block numbers per indirect block */
+	__u32 inode_size;
+	__u32 desc_size;
+	__u32 ngroups;
+	__u32 gdt_blocks;
+	__u64 blocks_count;
+};
+
+struct ext2fs_inode {
+	__u32 ino;
+	struct ext2_inode raw;
+	__u64 last_alloc;		/* Goal for the next block allocation */
+};
+
+#define EXT2FS_MP(mp)		((struct ext2fs_mount *)(mp)->m_data)
+#define EXT2FS_IP(vp)		((struct ext2fs_inode *)(vp)->v_data)
+
+/* The root vnode has inode number 0 in vfscore */
+#define EXT2FS_VINO(ino)	((ino) == EXT2_ROOT_INO ? 0 : (ino))
+
+extern struct vnops ext2fs_vnops;
+
+/* ext2fs_subr.c */
+struct ext2_group_desc *ext2fs_gd(struct ext2fs_mount *emp, __u32 group);
+__u64 ext2fs_isize(const struct ext2_inode *raw);
+void ext2fs_set_isize(struct ext2fs_mount *emp, struct ext2_inode *raw,
+		      __u64 size);
+int ext2fs_iget(struct ext2fs_mount *emp, __u32 ino, struct ext2fs_inode **ipp);
+int ext2fs_iupdate(struct ext2fs_mount *emp, struct ext2fs_inode *ip);
+int ext2fs_ialloc(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		  mode_t mode, struct ext2fs_inode **ipp);
+int ext2fs_ifree(struct ext2fs_mount *emp, struct ext2fs_inode *ip);
+int ext2fs_is_fast_symlink(struct ext2fs_mount *emp, struct ext2fs_inode *ip);
+int ext2fs_bmap(struct ext2fs_mount *emp, struct ext2fs_inode *ip, __u64 lblk,
+		int alloc, __u64 *pblk, int *new);
+int ext2fs_itrunc(struct ext2fs_mount *emp, struct ext2fs_inode *ip,
+		  __u64 size);
+int ext2fs_dir_lookup(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		      const char *name, __u32 *ino);
+int ext2fs_dir_add(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		   const char *name, __u32 ino, mode_t mode);
+int ext2fs_dir_remove(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		      const char *name);
+int ext2fs_dir_set(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		   const char *name, __u32 ino, mode_t mode);
+int ext2fs_dir_empty(struct ext2fs_mount *emp, struct ext2fs_inode *dip);
+int ext2fs_dir_next(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		    __u64 *off, __u32 *ino, __u8 *type, char *name);
+int ext2fs_sync(struct ext2fs_mount *emp);
+__u32 ext2fs_now(void);
+
+#endif /* __EXT2FS_H__ */
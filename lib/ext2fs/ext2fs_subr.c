@@ -0,0 +1,1121 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+/*
+ * ext2fs_subr.c - inodes, block allocation and directories. All functions
+ * expect the mount lock to be held and return positive errno values.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <uk/assert.h>
+#include <uk/errptr.h>
+#include <uk/print.h>
+
+#include "ext2fs.h"
+
+#define EXT2_XATTR_MAGIC	0xea020000
+
+struct ext2_xattr_header {
+	__u32 h_magic;
+	__u32 h_refcount;
+};
+
+__u32 ext2fs_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (__u32)now.tv_sec;
+}
+
+static inline struct uk_blkbuf *ext2fs_bread(struct ext2fs_mount *emp,
+					     __u64 blk, int flags)
+{
+	if (unlikely(blk >= emp->blocks_count)) {
+		uk_pr_err("ext2fs: Block %"__PRIu64" out of range\n", blk);
+		return ERR2PTR(-EIO);
+	}
+	return uk_blkcache_get(emp->bc, blk, flags);
+}
+
+/*
+ * Group descriptors. The upper halves of the fields exist only with 64-bit
+ * descriptors.
+ */
+static inline int ext2fs_is64(struct ext2fs_mount *emp)
+{
+	return emp->desc_size >= EXT2_MIN_DESC_SIZE_64BIT;
+}
+
+struct ext2_group_desc *ext2fs_gd(struct ext2fs_mount *emp, __u32 group)
+{
+	UK_ASSERT(group < emp->ngroups);
+	return (struct ext2_group_desc *)((char *)emp->gdt +
+					  group * emp->desc_size);
+}
+
+#define GD_BLOCK(emp, gd, field)					\
+	((__u64)(gd)->field |						\
+	 (ext2fs_is64(emp) ? (__u64)(gd)->field##_hi << 32 : 0))
+
+#define GD_COUNT(emp, gd, field)					\
+	((__u32)(gd)->field |						\
+	 (ext2fs_is64(emp) ? (__u32)(gd)->field##_hi << 16 : 0))
+
+#define GD_COUNT_ADD(emp, gd, field, delta)				\
+	do {								\
+		__u32 __n = GD_COUNT(emp, gd, field) + (delta);		\
+									\
+		(gd)->field = (__u16)__n;				\
+		if (ext2fs_is64(emp))					\
+			(gd)->field##_hi = (__u16)(__n >> 16);		\
+	} while (0)
+
+static void ext2fs_sb_free_blocks_add(struct ext2fs_mount *emp, int delta)
+{
+	struct ext2_super_block *sb = &emp->sb;
+	__u64 n = sb->s_free_blocks_count;
+
+	if (sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT)
+		n |= (__u64)sb->s_free_blocks_count_hi << 32;
+	n += delta;
+	sb->s_free_blocks_count = (__u32)n;
+	if (sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT)
+		sb->s_free_blocks_count_hi = (__u32)(n >> 32);
+	emp->meta_dirty = 1;
+}
+
+/*
+ * Bitmaps
+ */
+static long ext2fs_find_zero(const __u8 *map, __u32 nbits, __u32 start)
+{
+	__u32 i = start;
+
+	while (i < nbits) {
+		if (!(i & 7) && map[i >> 3] == 0xff) {
+			i += 8;
+			continue;
+		}
+		if (!(map[i >> 3] & (1 << (i & 7))))
+			return i;
+		i++;
+	}
+	return -1;
+}
+
+/* Allocates a block, close to `goal` if possible */
+static int ext2fs_balloc(struct ext2fs_mount *emp, __u64 goal, __u64 *pblk)
+{
+	struct ext2_super_block *sb = &emp->sb;
+	struct ext2_group_desc *gd;
+	struct uk_blkbuf *buf;
+	__u32 g0, g, n, nbits, start;
+	__u8 *map;
+	long bit;
+
+	if (goal < sb->s_first_data_block || goal >= emp->blocks_count)
+		goal = sb->s_first_data_block;
+	g0 = (goal - sb->s_first_data_block) / sb->s_blocks_per_group;
+	start = (goal - sb->s_first_data_block) % sb->s_blocks_per_group;
+
+	/* The first group is visited twice to wrap around the goal */
+	for (n = 0; n <= emp->ngroups; n++, start = 0) {
+		g = (g0 + n) % emp->ngroups;
+		gd = ext2fs_gd(emp, g);
+		if (!GD_COUNT(emp, gd, bg_free_blocks_count))
+			continue;
+
+		nbits = MIN((__u64)sb->s_blocks_per_group,
+			    emp->blocks_count - sb->s_first_data_block -
+			    (__u64)g * sb->s_blocks_per_group);
+		buf = ext2fs_bread(emp, GD_BLOCK(emp, gd, bg_block_bitmap), 0);
+		if (unlikely(PTRISERR(buf)))
+			return -PTR2ERR(buf);
+		map = buf->data;
+		bit = ext2fs_find_zero(map, nbits, start);
+		if (bit < 0) {
+			uk_blkcache_put(buf);
+			continue;
+		}
+
+		map[bit >> 3] |= 1 << (bit & 7);
+		uk_blkcache_dirty(buf);
+		uk_blkcache_put(buf);
+
+		GD_COUNT_ADD(emp, gd, bg_free_blocks_count, -1);
+		ext2fs_sb_free_blocks_add(emp, -1);
+		*pblk = sb->s_first_data_block +
+			(__u64)g * sb->s_blocks_per_group + bit;
+		return 0;
+	}
+	return ENOSPC;
+}
+
+static void ext2fs_bfree(struct ext2fs_mount *emp, __u64 blk)
+{
+	struct ext2_super_block *sb = &emp->sb;
+	struct ext2_group_desc *gd;
+	struct uk_blkbuf *buf;
+	__u32 g, bit;
+	__u8 *map;
+
+	if (unlikely(blk < sb->s_first_data_block ||
+		     blk >= emp->blocks_count)) {
+		uk_pr_err("ext2fs: Freeing invalid block %"__PRIu64"\n", blk);
+		return;
+	}
+	g = (blk - sb->s_first_data_block) / sb->s_blocks_per_group;
+	bit = (blk - sb->s_first_data_block) % sb->s_blocks_per_group;
+	gd = ext2fs_gd(emp, g);
+
+	uk_blkcache_forget(emp->bc, blk);
+	buf = ext2fs_bread(emp, GD_BLOCK(emp, gd, bg_block_bitmap), 0);
+	if (unlikely(PTRISERR(buf)))
+		return;
+	map = buf->data;
+	if (unlikely(!(map[bit >> 3] & (1 << (bit & 7))))) {
+		uk_pr_err("ext2fs: Freeing free block %"__PRIu64"\n", blk);
+	} else {
+		map[bit >> 3] &= ~(1 << (bit & 7));
+		uk_blkcache_dirty(buf);
+		GD_COUNT_ADD(emp, gd, bg_free_blocks_count, 1);
+		ext2fs_sb_free_blocks_add(emp, 1);
+	}
+	uk_blkcache_put(buf);
+}
+
+/* Frees a block of an inode */
+static void ext2fs_ibfree(struct ext2fs_mount *emp, struct ext2fs_inode *ip,
+			  __u32 *slot)
+{
+	ext2fs_bfree(emp, *slot);
+	ip->raw.i_blocks -= emp->bsize >> 9;
+	*slot = 0;
+}
+
+/*
+ * Inodes
+ */
+__u64 ext2fs_isize(const struct ext2_inode *raw)
+{
+	__u64 size = raw->i_size;
+
+	if (S_ISREG(raw->i_mode))
+		size |= (__u64)raw->i_size_high << 32;
+	return size;
+}
+
+void ext2fs_set_isize(struct ext2fs_mount *emp, struct ext2_inode *raw,
+		      __u64 size)
+{
+	raw->i_size = (__u32)size;
+	if (!S_ISREG(raw->i_mode))
+		return;
+
+	raw->i_size_high = (__u32)(size >> 32);
+	if (size > INT32_MAX &&
+	    !(emp->sb.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+		emp->sb.s_feature_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+		emp->meta_dirty = 1;
+	}
+}
+
+static int ext2fs_iloc(struct ext2fs_mount *emp, __u32 ino, __u64 *blk,
+		       __u32 *off)
+{
+	__u32 ipg = emp->sb.s_inodes_per_group;
+	__u64 byte;
+
+	if (unlikely(ino < 1 || ino > emp->sb.s_inodes_count)) {
+		uk_pr_err("ext2fs: Invalid inode %"__PRIu32"\n", ino);
+		return EIO;
+	}
+	byte = (__u64)((ino - 1) % ipg) * emp->inode_size;
+	*blk = GD_BLOCK(emp, ext2fs_gd(emp, (ino - 1) / ipg),
+			bg_inode_table) + byte / emp->bsize;
+	*off = byte % emp->bsize;
+	return 0;
+}
+
+int ext2fs_iget(struct ext2fs_mount *emp, __u32 ino, struct ext2fs_inode **ipp)
+{
+	struct ext2fs_inode *ip;
+	struct uk_blkbuf *buf;
+	__u64 blk;
+	__u32 off;
+	int rc;
+
+	rc = ext2fs_iloc(emp, ino, &blk, &off);
+	if (unlikely(rc))
+		return rc;
+
+	ip = calloc(1, sizeof(*ip));
+	if (unlikely(!ip))
+		return ENOMEM;
+
+	buf = ext2fs_bread(emp, blk, 0);
+	if (unlikely(PTRISERR(buf))) {
+		free(ip);
+		return -PTR2ERR(buf);
+	}
+	memcpy(&ip->raw, (char *)buf->data + off, sizeof(ip->raw));
+	uk_blkcache_put(buf);
+
+	ip->ino = ino;
+	*ipp = ip;
+	return 0;
+}
+
+int ext2fs_iupdate(struct ext2fs_mount *emp, struct ext2fs_inode *ip)
+{
+	struct uk_blkbuf *buf;
+	__u64 blk;
+	__u32 off;
+	int rc;
+
+	rc = ext2fs_iloc(emp, ip->ino, &blk, &off);
+	if (unlikely(rc))
+		return rc;
+
+	buf = ext2fs_bread(emp, blk, 0);
+	if (unlikely(PTRISERR(buf)))
+		return -PTR2ERR(buf);
+	memcpy((char *)buf->data + off, &ip->raw, sizeof(ip->raw));
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+	return 0;
+}
+
+/* Directories are spread over the groups with the most free inodes, other
+ * inodes go into the group of their directory
+ */
+static __u32 ext2fs_igroup(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+			   mode_t mode)
+{
+	__u32 g, best = 0, free, best_free = 0;
+
+	if (!S_ISDIR(mode))
+		return dip ? (dip->ino - 1) / emp->sb.s_inodes_per_group : 0;
+
+	for (g = 0; g < emp->ngroups; g++) {
+		free = GD_COUNT(emp, ext2fs_gd(emp, g), bg_free_inodes_count);
+		if (free > best_free) {
+			best = g;
+			best_free = free;
+		}
+	}
+	return best;
+}
+
+int ext2fs_ialloc(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		  mode_t mode, struct ext2fs_inode **ipp)
+{
+	__u32 ipg = emp->sb.s_inodes_per_group;
+	struct ext2_group_desc *gd;
+	struct ext2fs_inode *ip;
+	struct uk_blkbuf *buf;
+	__u32 g0, g, n, ino, now, off;
+	__u64 blk;
+	__u8 *map;
+	long bit = -1;
+	int rc;
+
+	g0 = ext2fs_igroup(emp, dip, mode);
+	for (n = 0; n < emp->ngroups; n++) {
+		g = (g0 + n) % emp->ngroups;
+		gd = ext2fs_gd(emp, g);
+		if (!GD_COUNT(emp, gd, bg_free_inodes_count))
+			continue;
+
+		buf = ext2fs_bread(emp, GD_BLOCK(emp, gd, bg_inode_bitmap), 0);
+		if (unlikely(PTRISERR(buf)))
+			return -PTR2ERR(buf);
+		map = buf->data;
+		bit = ext2fs_find_zero(map, ipg, 0);
+		if (bit >= 0 && (__u32)bit + 1 + g * ipg >= emp->sb.s_first_ino) {
+			map[bit >> 3] |= 1 << (bit & 7);
+			uk_blkcache_dirty(buf);
+			uk_blkcache_put(buf);
+			break;
+		}
+		uk_blkcache_put(buf);
+		bit = -1;
+	}
+	if (bit < 0)
+		return ENOSPC;
+
+	GD_COUNT_ADD(emp, gd, bg_free_inodes_count, -1);
+	if (S_ISDIR(mode))
+		GD_COUNT_ADD(emp, gd, bg_used_dirs_count, 1);
+	emp->sb.s_free_inodes_count--;
+	emp->meta_dirty = 1;
+	ino = g * ipg + bit + 1;
+
+	/* Clear the whole on-disk inode, including the extra fields */
+	rc = ext2fs_iloc(emp, ino, &blk, &off);
+	if (unlikely(rc))
+		return rc;
+	buf = ext2fs_bread(emp, blk, 0);
+	if (unlikely(PTRISERR(buf)))
+		return -PTR2ERR(buf);
+	memset((char *)buf->data + off, 0, emp->inode_size);
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+
+	ip = calloc(1, sizeof(*ip));
+	if (unlikely(!ip))
+		return ENOMEM;
+	ip->ino = ino;
+	ip->raw.i_mode = mode;
+	now = ext2fs_now();
+	ip->raw.i_atime = now;
+	ip->raw.i_ctime = now;
+	ip->raw.i_mtime = now;
+	ip->raw.i_generation = now ^ ino;
+	*ipp = ip;
+	return 0;
+}
+
+/* Releases the extended attribute block of an inode */
+static void ext2fs_xattr_free(struct ext2fs_mount *emp,
+			      struct ext2fs_inode *ip)
+{
+	struct ext2_xattr_header *hdr;
+	struct uk_blkbuf *buf;
+	int last = 0;
+
+	buf = ext2fs_bread(emp, ip->raw.i_file_acl, 0);
+	if (unlikely(PTRISERR(buf)))
+		return;
+	hdr = buf->data;
+	if (hdr->h_magic == EXT2_XATTR_MAGIC) {
+		if (hdr->h_refcount <= 1) {
+			last = 1;
+		} else {
+			hdr->h_refcount--;
+			uk_blkcache_dirty(buf);
+		}
+	}
+	uk_blkcache_put(buf);
+
+	if (last)
+		ext2fs_ibfree(emp, ip, &ip->raw.i_file_acl);
+	else
+		ip->raw.i_file_acl = 0;
+}
+
+int ext2fs_ifree(struct ext2fs_mount *emp, struct ext2fs_inode *ip)
+{
+	__u32 ipg = emp->sb.s_inodes_per_group;
+	struct ext2_group_desc *gd;
+	struct uk_blkbuf *buf;
+	__u32 bit = (ip->ino - 1) % ipg;
+	__u8 *map;
+	int rc;
+
+	rc = ext2fs_itrunc(emp, ip, 0);
+	if (unlikely(rc))
+		return rc;
+	if (ip->raw.i_file_acl)
+		ext2fs_xattr_free(emp, ip);
+	ip->raw.i_dtime = ext2fs_now();
+	rc = ext2fs_iupdate(emp, ip);
+	if (unlikely(rc))
+		return rc;
+
+	gd = ext2fs_gd(emp, (ip->ino - 1) / ipg);
+	buf = ext2fs_bread(emp, GD_BLOCK(emp, gd, bg_inode_bitmap), 0);
+	if (unlikely(PTRISERR(buf)))
+		return -PTR2ERR(buf);
+	map = buf->data;
+	map[bit >> 3] &= ~(1 << (bit & 7));
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+
+	GD_COUNT_ADD(emp, gd, bg_free_inodes_count, 1);
+	if (S_ISDIR(ip->raw.i_mode))
+		GD_COUNT_ADD(emp, gd, bg_used_dirs_count, -1);
+	emp->sb.s_free_inodes_count++;
+	emp->meta_dirty = 1;
+	return 0;
+}
+
+/* Fast symbolic links keep the target in i_block instead of a data block */
+int ext2fs_is_fast_symlink(struct ext2fs_mount *emp, struct ext2fs_inode *ip)
+{
+	__u32 ea_blocks = ip->raw.i_file_acl ? emp->bsize >> 9 : 0;
+
+	return S_ISLNK(ip->raw.i_mode) && ip->raw.i_blocks == ea_blocks;
+}
+
+/*
+ * Block mapping
+ */
+static int ext2fs_extent_map(struct ext2fs_mount *emp,
+			     struct ext2fs_inode *ip, __u64 lblk, __u64 *pblk)
+{
+	struct ext4_extent_header *eh = (void *)ip->raw.i_block;
+	struct uk_blkbuf *buf = NULL;
+	struct ext4_extent_idx *ei;
+	struct ext4_extent *ex;
+	__u64 leaf;
+	__u32 len;
+	int i, level;
+	int rc = 0;
+
+	*pblk = 0;
+	for (level = 0; ; level++) {
+		if (unlikely(eh->eh_magic != EXT4_EXT_MAGIC ||
+			     eh->eh_entries > eh->eh_max || level > 5)) {
+			uk_pr_err("ext2fs: Inode %"__PRIu32": Corrupted extent tree\n",
+				  ip->ino);
+			rc = EIO;
+			break;
+		}
+
+		if (!eh->eh_depth) {
+			ex = (struct ext4_extent *)(eh + 1);
+			for (i = 0; i < eh->eh_entries; i++) {
+				len = ex[i].ee_len;
+				if (lblk < ex[i].ee_block ||
+				    lblk - ex[i].ee_block >=
+				    (len > EXT4_EXT_INIT_MAX_LEN ?
+				     len - EXT4_EXT_INIT_MAX_LEN : len))
+					continue;
+				/* Uninitialized extents read as zeros */
+				if (len <= EXT4_EXT_INIT_MAX_LEN)
+					*pblk = ((__u64)ex[i].ee_start_hi << 32 |
+						 ex[i].ee_start_lo) +
+						lblk - ex[i].ee_block;
+				break;
+			}
+			break;
+		}
+
+		ei = (struct ext4_extent_idx *)(eh + 1);
+		for (i = 0; i < eh->eh_entries && ei[i].ei_block <= lblk; i++)
+			;
+		if (!i)
+			break;
+		leaf = (__u64)ei[i - 1].ei_leaf_hi << 32 | ei[i - 1].ei_leaf_lo;
+
+		if (buf)
+			uk_blkcache_put(buf);
+		buf = ext2fs_bread(emp, leaf, 0);
+		if (unlikely(PTRISERR(buf))) {
+			rc = -PTR2ERR(buf);
+			buf = NULL;
+			break;
+		}
+		eh = buf->data;
+	}
+
+	if (buf)
+		uk_blkcache_put(buf);
+	return rc;
+}
+
+/* The group of an inode is the default place for its blocks */
+static __u64 ext2fs_bgoal(struct ext2fs_mount *emp, struct ext2fs_inode *ip)
+{
+	if (ip->last_alloc)
+		return ip->last_alloc + 1;
+	return emp->sb.s_first_data_block +
+	       (__u64)((ip->ino - 1) / emp->sb.s_inodes_per_group) *
+	       emp->sb.s_blocks_per_group;
+}
+
+/*
+ * Maps a logical block of an inode to a physical block. Holes map to 0 unless
+ * `alloc` is set, in which case the missing blocks are allocated and `*new`
+ * tells if the data block is new. The caller writes back the inode.
+ */
+int ext2fs_bmap(struct ext2fs_mount *emp, struct ext2fs_inode *ip, __u64 lblk,
+		int alloc, __u64 *pblk, int *new)
+{
+	__u32 apb = emp->addr_per_block;
+	struct uk_blkbuf *buf = NULL, *nbuf;
+	unsigned int offsets[4], depth, i;
+	__u32 *slot;
+	__u64 blk;
+	int rc = 0;
+
+	if (new)
+		*new = 0;
+
+	if (ip->raw.i_flags & EXT4_EXTENTS_FL) {
+		if (unlikely(alloc))
+			return EROFS;
+		return ext2fs_extent_map(emp, ip, lblk, pblk);
+	}
+
+	if (lblk < EXT2_NDIR_BLOCKS) {
+		offsets[0] = lblk;
+		depth = 0;
+	} else if ((lblk -= EXT2_NDIR_BLOCKS) < apb) {
+		offsets[0] = EXT2_IND_BLOCK;
+		offsets[1] = lblk;
+		depth = 1;
+	} else if ((lblk -= apb) < (__u64)apb * apb) {
+		offsets[0] = EXT2_DIND_BLOCK;
+		offsets[1] = lblk / apb;
+		offsets[2] = lblk % apb;
+		depth = 2;
+	} else if ((lblk -= (__u64)apb * apb) < (__u64)apb * apb * apb) {
+		offsets[0] = EXT2_TIND_BLOCK;
+		offsets[1] = lblk / ((__u64)apb * apb);
+		offsets[2] = (lblk / apb) % apb;
+		offsets[3] = lblk % apb;
+		depth = 3;
+	} else {
+		return EFBIG;
+	}
+
+	slot = &ip->raw.i_block[offsets[0]];
+	for (i = 0; ; i++) {
+		blk = *slot;
+		if (!blk) {
+			if (!alloc)
+				break;
+
+			rc = ext2fs_balloc(emp, ext2fs_bgoal(emp, ip), &blk);
+			if (unlikely(rc))
+				break;
+			ip->last_alloc = blk;
+			ip->raw.i_blocks += emp->bsize >> 9;
+			*slot = (__u32)blk;
+			if (buf)
+				uk_blkcache_dirty(buf);
+
+			if (i == depth) {
+				if (new)
+					*new = 1;
+			} else {
+				/* New indirect blocks start out empty */
+				nbuf = ext2fs_bread(emp, blk,
+						    UK_BLKCACHE_NOREAD);
+				if (unlikely(PTRISERR(nbuf))) {
+					rc = -PTR2ERR(nbuf);
+					break;
+				}
+				memset(nbuf->data, 0, emp->bsize);
+				uk_blkcache_dirty(nbuf);
+				uk_blkcache_put(nbuf);
+			}
+		}
+		if (i == depth)
+			break;
+
+		if (buf)
+			uk_blkcache_put(buf);
+		buf = ext2fs_bread(emp, blk, 0);
+		if (unlikely(PTRISERR(buf))) {
+			rc = -PTR2ERR(buf);
+			buf = NULL;
+			break;
+		}
+		slot = (__u32 *)buf->data + offsets[i + 1];
+	}
+
+	if (buf)
+		uk_blkcache_put(buf);
+	*pblk = rc ? 0 : blk;
+	return rc;
+}
+
+/*
+ * Frees the blocks of the tree in `*slot` that map logical blocks from `from`
+ * on. The tree maps logical blocks from `first` on and has `level` levels of
+ * indirect blocks. Indirect blocks that become empty are freed as well.
+ */
+static void ext2fs_trunc_tree(struct ext2fs_mount *emp,
+			      struct ext2fs_inode *ip, __u32 *slot,
+			      unsigned int level, __u64 first, __u64 from)
+{
+	__u32 apb = emp->addr_per_block;
+	struct uk_blkbuf *buf;
+	__u64 span = 1;
+	__u32 *map, i;
+	int empty = 1, changed = 0;
+
+	if (!*slot)
+		return;
+	if (!level) {
+		if (first >= from)
+			ext2fs_ibfree(emp, ip, slot);
+		return;
+	}
+
+	for (i = 1; i < level; i++)
+		span *= apb;
+
+	buf = ext2fs_bread(emp, *slot, 0);
+	if (unlikely(PTRISERR(buf)))
+		return;
+	map = buf->data;
+	for (i = 0; i < apb; i++) {
+		if (map[i] && first + (i + 1) * span > from) {
+			ext2fs_trunc_tree(emp, ip, &map[i], level - 1,
+					  first + i * span, from);
+			changed |= !map[i];
+		}
+		if (map[i])
+			empty = 0;
+	}
+	if (changed)
+		uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+
+	if (empty)
+		ext2fs_ibfree(emp, ip, slot);
+}
+
+int ext2fs_itrunc(struct ext2fs_mount *emp, struct ext2fs_inode *ip,
+		  __u64 size)
+{
+	__u32 apb = emp->addr_per_block;
+	__u64 from, first, pblk, off;
+	struct uk_blkbuf *buf;
+	unsigned int i;
+	int rc;
+
+	if (ext2fs_is_fast_symlink(emp, ip)) {
+		if (!size)
+			memset(ip->raw.i_block, 0, sizeof(ip->raw.i_block));
+		goto out;
+	}
+	if (unlikely(ip->raw.i_flags & EXT4_EXTENTS_FL))
+		return EROFS;
+
+	/* The tail of the last block must read as zeros when the file grows */
+	off = size % emp->bsize;
+	if (off && size < ext2fs_isize(&ip->raw)) {
+		rc = ext2fs_bmap(emp, ip, size / emp->bsize, 0, &pblk, NULL);
+		if (unlikely(rc))
+			return rc;
+		if (pblk) {
+			buf = ext2fs_bread(emp, pblk, 0);
+			if (unlikely(PTRISERR(buf)))
+				return -PTR2ERR(buf);
+			memset((char *)buf->data + off, 0, emp->bsize - off);
+			uk_blkcache_dirty(buf);
+			uk_blkcache_put(buf);
+		}
+	}
+
+	from = DIV_ROUND_UP(size, emp->bsize);
+	for (i = 0; i < EXT2_NDIR_BLOCKS; i++)
+		ext2fs_trunc_tree(emp, ip, &ip->raw.i_block[i], 0, i, from);
+	first = EXT2_NDIR_BLOCKS;
+	ext2fs_trunc_tree(emp, ip, &ip->raw.i_block[EXT2_IND_BLOCK], 1,
+			  first, from);
+	first += apb;
+	ext2fs_trunc_tree(emp, ip, &ip->raw.i_block[EXT2_DIND_BLOCK], 2,
+			  first, from);
+	first += (__u64)apb * apb;
+	ext2fs_trunc_tree(emp, ip, &ip->raw.i_block[EXT2_TIND_BLOCK], 3,
+			  first, from);
+	ip->last_alloc = 0;
+
+out:
+	ext2fs_set_isize(emp, &ip->raw, size);
+	return ext2fs_iupdate(emp, ip);
+}
+
+/*
+ * Directories
+ */
+static inline __u32 ext2fs_rec_len(struct ext2fs_mount *emp,
+				   const struct ext2_dir_entry *de)
+{
+	if (emp->bsize == 65536 && (de->rec_len == 65535 || !de->rec_len))
+		return 65536;
+	return de->rec_len;
+}
+
+static inline void ext2fs_set_rec_len(struct ext2_dir_entry *de, __u32 len)
+{
+	de->rec_len = (len == 65536) ? 65535 : len;
+}
+
+static __u8 ext2fs_file_type(struct ext2fs_mount *emp, mode_t mode)
+{
+	if (!(emp->sb.s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE))
+		return EXT2_FT_UNKNOWN;
+
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		return EXT2_FT_REG_FILE;
+	case S_IFDIR:
+		return EXT2_FT_DIR;
+	case S_IFCHR:
+		return EXT2_FT_CHRDEV;
+	case S_IFBLK:
+		return EXT2_FT_BLKDEV;
+	case S_IFIFO:
+		return EXT2_FT_FIFO;
+	case S_IFSOCK:
+		return EXT2_FT_SOCK;
+	case S_IFLNK:
+		return EXT2_FT_SYMLINK;
+	default:
+		return EXT2_FT_UNKNOWN;
+	}
+}
+
+/* Returns the referenced buffer of a directory block */
+static struct uk_blkbuf *ext2fs_dir_block(struct ext2fs_mount *emp,
+					  struct ext2fs_inode *dip, __u64 lblk)
+{
+	__u64 pblk;
+	int rc;
+
+	rc = ext2fs_bmap(emp, dip, lblk, 0, &pblk, NULL);
+	if (unlikely(rc))
+		return ERR2PTR(-rc);
+	if (unlikely(!pblk)) {
+		uk_pr_err("ext2fs: Directory %"__PRIu32" has a hole\n",
+			  dip->ino);
+		return ERR2PTR(-EIO);
+	}
+	return ext2fs_bread(emp, pblk, 0);
+}
+
+static int ext2fs_dir_check(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+			    const struct ext2_dir_entry *de, __u32 off)
+{
+	__u32 rec_len = ext2fs_rec_len(emp, de);
+
+	if (unlikely(rec_len < EXT2_DIR_REC_LEN(0) || rec_len & 3 ||
+		     off + rec_len > emp->bsize ||
+		     EXT2_DIR_REC_LEN(de->name_len) > rec_len)) {
+		uk_pr_err("ext2fs: Directory %"__PRIu32": Corrupted entry\n",
+			  dip->ino);
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Finds the entry `name` in a directory. Returns the referenced buffer of its
+ * block, the entry, and the previous entry in the block if there is one.
+ */
+static int ext2fs_dir_find(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+			   const char *name, struct uk_blkbuf **bufp,
+			   struct ext2_dir_entry **dep,
+			   struct ext2_dir_entry **prevp)
+{
+	__u64 lblk, nblocks = ext2fs_isize(&dip->raw) / emp->bsize;
+	struct ext2_dir_entry *de, *prev;
+	size_t len = strlen(name);
+	struct uk_blkbuf *buf;
+	__u32 off;
+	int rc;
+
+	for (lblk = 0; lblk < nblocks; lblk++) {
+		buf = ext2fs_dir_block(emp, dip, lblk);
+		if (unlikely(PTRISERR(buf)))
+			return -PTR2ERR(buf);
+
+		prev = NULL;
+		for (off = 0; off < emp->bsize;
+		     off += ext2fs_rec_len(emp, de)) {
+			de = (struct ext2_dir_entry *)((char *)buf->data + off);
+			rc = ext2fs_dir_check(emp, dip, de, off);
+			if (unlikely(rc)) {
+				uk_blkcache_put(buf);
+				return rc;
+			}
+			if (de->inode && de->name_len == len &&
+			    !memcmp(de->name, name, len)) {
+				*bufp = buf;
+				*dep = de;
+				if (prevp)
+					*prevp = prev;
+				return 0;
+			}
+			prev = de;
+		}
+		uk_blkcache_put(buf);
+	}
+	return ENOENT;
+}
+
+/* Hashed directory indexes are not maintained, so they are dropped on the
+ * first modification. The index blocks read as empty entries.
+ */
+static int ext2fs_dir_modified(struct ext2fs_mount *emp,
+			       struct ext2fs_inode *dip)
+{
+	dip->raw.i_flags &= ~EXT2_INDEX_FL;
+	dip->raw.i_mtime = ext2fs_now();
+	dip->raw.i_ctime = dip->raw.i_mtime;
+	return ext2fs_iupdate(emp, dip);
+}
+
+int ext2fs_dir_lookup(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		      const char *name, __u32 *ino)
+{
+	struct ext2_dir_entry *de;
+	struct uk_blkbuf *buf;
+	int rc;
+
+	rc = ext2fs_dir_find(emp, dip, name, &buf, &de, NULL);
+	if (rc)
+		return rc;
+	*ino = de->inode;
+	uk_blkcache_put(buf);
+	return 0;
+}
+
+static void ext2fs_dir_fill(struct ext2fs_mount *emp,
+			    struct ext2_dir_entry *de, const char *name,
+			    size_t len, __u32 ino, mode_t mode)
+{
+	de->inode = ino;
+	de->name_len = len;
+	de->file_type = ext2fs_file_type(emp, mode);
+	memcpy(de->name, name, len);
+}
+
+int ext2fs_dir_add(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		   const char *name, __u32 ino, mode_t mode)
+{
+	__u64 lblk, pblk, size = ext2fs_isize(&dip->raw);
+	size_t len = strlen(name);
+	__u32 need = EXT2_DIR_REC_LEN(len);
+	__u32 off, rec_len, used;
+	struct ext2_dir_entry *de, *nde;
+	struct uk_blkbuf *buf;
+	int rc;
+
+	if (len > EXT2_NAME_LEN)
+		return ENAMETOOLONG;
+
+	/* Use the first gap that is large enough */
+	for (lblk = 0; lblk < size / emp->bsize; lblk++) {
+		buf = ext2fs_dir_block(emp, dip, lblk);
+		if (unlikely(PTRISERR(buf)))
+			return -PTR2ERR(buf);
+
+		for (off = 0; off < emp->bsize; off += rec_len) {
+			de = (struct ext2_dir_entry *)((char *)buf->data + off);
+			rc = ext2fs_dir_check(emp, dip, de, off);
+			if (unlikely(rc)) {
+				uk_blkcache_put(buf);
+				return rc;
+			}
+			rec_len = ext2fs_rec_len(emp, de);
+			used = de->inode ? EXT2_DIR_REC_LEN(de->name_len) : 0;
+			if (rec_len - used < need)
+				continue;
+
+			if (used) {
+				nde = (struct ext2_dir_entry *)
+					((char *)de + used);
+				ext2fs_set_rec_len(nde, rec_len - used);
+				ext2fs_set_rec_len(de, used);
+				de = nde;
+			}
+			ext2fs_dir_fill(emp, de, name, len, ino, mode);
+			uk_blkcache_dirty(buf);
+			uk_blkcache_put(buf);
+			return ext2fs_dir_modified(emp, dip);
+		}
+		uk_blkcache_put(buf);
+	}
+
+	/* Append a block */
+	rc = ext2fs_bmap(emp, dip, size / emp->bsize, 1, &pblk, NULL);
+	if (unlikely(rc))
+		return rc;
+	buf = ext2fs_bread(emp, pblk, UK_BLKCACHE_NOREAD);
+	if (unlikely(PTRISERR(buf)))
+		return -PTR2ERR(buf);
+	memset(buf->data, 0, emp->bsize);
+	de = buf->data;
+	ext2fs_set_rec_len(de, emp->bsize);
+	ext2fs_dir_fill(emp, de, name, len, ino, mode);
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+
+	ext2fs_set_isize(emp, &dip->raw, size + emp->bsize);
+	return ext2fs_dir_modified(emp, dip);
+}
+
+int ext2fs_dir_remove(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		      const char *name)
+{
+	struct ext2_dir_entry *de, *prev;
+	struct uk_blkbuf *buf;
+	int rc;
+
+	rc = ext2fs_dir_find(emp, dip, name, &buf, &de, &prev);
+	if (rc)
+		return rc;
+
+	if (prev)
+		ext2fs_set_rec_len(prev, ext2fs_rec_len(emp, prev) +
+				   ext2fs_rec_len(emp, de));
+	else
+		de->inode = 0;
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+	return ext2fs_dir_modified(emp, dip);
+}
+
+int ext2fs_dir_set(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		   const char *name, __u32 ino, mode_t mode)
+{
+	struct ext2_dir_entry *de;
+	struct uk_blkbuf *buf;
+	int rc;
+
+	rc = ext2fs_dir_find(emp, dip, name, &buf, &de, NULL);
+	if (rc)
+		return rc;
+
+	de->inode = ino;
+	de->file_type = ext2fs_file_type(emp, mode);
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+	return ext2fs_dir_modified(emp, dip);
+}
+
+/* Returns 1 if a directory has no entries other than "." and "..", 0 if it
+ * has, and a negative error code otherwise
+ */
+int ext2fs_dir_empty(struct ext2fs_mount *emp, struct ext2fs_inode *dip)
+{
+	__u64 lblk, nblocks = ext2fs_isize(&dip->raw) / emp->bsize;
+	struct ext2_dir_entry *de;
+	struct uk_blkbuf *buf;
+	__u32 off;
+	int rc, empty = 1;
+
+	for (lblk = 0; lblk < nblocks && empty; lblk++) {
+		buf = ext2fs_dir_block(emp, dip, lblk);
+		if (unlikely(PTRISERR(buf)))
+			return PTR2ERR(buf);
+
+		for (off = 0; off < emp->bsize;
+		     off += ext2fs_rec_len(emp, de)) {
+			de = (struct ext2_dir_entry *)((char *)buf->data + off);
+			rc = ext2fs_dir_check(emp, dip, de, off);
+			if (unlikely(rc)) {
+				uk_blkcache_put(buf);
+				return -rc;
+			}
+			if (!de->inode)
+				continue;
+			if (de->name_len == 1 && de->name[0] == '.')
+				continue;
+			if (de->name_len == 2 && de->name[0] == '.' &&
+			    de->name[1] == '.')
+				continue;
+			empty = 0;
+			break;
+		}
+		uk_blkcache_put(buf);
+	}
+	return empty;
+}
+
+/*
+ * Returns the first entry in use at or after the byte offset `*off` of a
+ * directory and advances `*off` past it. Offsets within an entry resume at
+ * the next one. `name` must hold EXT2_NAME_LEN + 1 bytes.
+ */
+int ext2fs_dir_next(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+		    __u64 *off, __u32 *ino, __u8 *type, char *name)
+{
+	__u64 lblk, size = ext2fs_isize(&dip->raw);
+	struct ext2_dir_entry *de;
+	struct uk_blkbuf *buf;
+	__u32 boff, rec_len;
+	int rc;
+
+	while (*off < size) {
+		lblk = *off / emp->bsize;
+		buf = ext2fs_dir_block(emp, dip, lblk);
+		if (unlikely(PTRISERR(buf)))
+			return -PTR2ERR(buf);
+
+		for (boff = 0; boff < emp->bsize; boff += rec_len) {
+			de = (struct ext2_dir_entry *)((char *)buf->data + boff);
+			rc = ext2fs_dir_check(emp, dip, de, boff);
+			if (unlikely(rc)) {
+				uk_blkcache_put(buf);
+				return rc;
+			}
+			rec_len = ext2fs_rec_len(emp, de);
+			if (boff < *off % emp->bsize || !de->inode)
+				continue;
+
+			*ino = de->inode;
+			*type = (emp->sb.s_feature_incompat &
+				 EXT2_FEATURE_INCOMPAT_FILETYPE) ?
+				de->file_type : EXT2_FT_UNKNOWN;
+			memcpy(name, de->name, de->name_len);
+			name[de->name_len] = '\0';
+			*off = lblk * emp->bsize + boff + rec_len;
+			uk_blkcache_put(buf);
+			return 0;
+		}
+		uk_blkcache_put(buf);
+		*off = (lblk + 1) * emp->bsize;
+	}
+	return ENOENT;
+}
+
+/*
+ * Writes the superblock and the group descriptors if they changed, and all
+ * modified blocks. Only the primary copies of the superblock and the group
+ * descriptors are updated, like e2fsck expects.
+ */
+int ext2fs_sync(struct ext2fs_mount *emp)
+{
+	struct uk_blkbuf *buf;
+	__u64 blk;
+	__u32 i, len, gdt_size;
+
+	if (emp->rdonly)
+		return 0;
+
+	if (emp->meta_dirty) {
+		emp->sb.s_wtime = ext2fs_now();
+		blk = EXT2_SUPER_OFFSET / emp->bsize;
+		buf = ext2fs_bread(emp, blk, 0);
+		if (unlikely(PTRISERR(buf)))
+			return -PTR2ERR(buf);
+		memcpy((char *)buf->data + EXT2_SUPER_OFFSET % emp->bsize,
+		       &emp->sb, sizeof(emp->sb));
+		uk_blkcache_dirty(buf);
+		uk_blkcache_put(buf);
+
+		gdt_size = emp->ngroups * emp->desc_size;
+		for (i = 0; i < emp->gdt_blocks; i++) {
+			blk = emp->sb.s_first_data_block + 1 + i;
+			len = MIN(emp->bsize, gdt_size - i * emp->bsize);
+			buf = ext2fs_bread(emp, blk, 0);
+			if (unlikely(PTRISERR(buf)))
+				return -PTR2ERR(buf);
+			memcpy(buf->data, (char *)emp->gdt + i * emp->bsize,
+			       len);
+			uk_blkcache_dirty(buf);
+			uk_blkcache_put(buf);
+		}
+		emp->meta_dirty = 0;
+	}
+	return -uk_blkcache_sync(emp->bc);
+}
@@ -0,0 +1,380 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
+
+#include <uk/config.h>
+#include <uk/errptr.h>
+#include <uk/print.h>
+#include <vfscore/dentry.h>
+#include <vfscore/mount.h>
+
+#include "ext2fs.h"
+
+#define EXT2FS_PROBE_BSIZE	4096
+
+static int ext2fs_mount(struct mount *mp, const char *dev, int flags,
+			const void *data);
+static int ext2fs_unmount(struct mount *mp, int flags);
+static int ext2fs_vfs_sync(struct mount *mp);
+static int ext2fs_statfs(struct mount *mp, struct statfs *st);
+
+#define ext2fs_vget	((vfsop_vget_t)vfscore_nullop)
+
+struct vfsops ext2fs_vfsops = {
+	.vfs_mount	= ext2fs_mount,
+	.vfs_unmount	= ext2fs_unmount,
+	.vfs_sync	= ext2fs_vfs_sync,
+	.vfs_vget	= ext2fs_vget,
+	.vfs_statfs	= ext2fs_statfs,
+	.vfs_vnops	= &ext2fs_vnops
+};
+
+static struct vfscore_fs_type ext2fs_fs = {
+	.vs_name	= "ext2",
+	.vs_init	= NULL,
+	.vs_op		= &ext2fs_vfsops
+};
+
+UK_FS_REGISTER(ext2fs_fs);
+
+/* The device is given by its ukblkdev id, the first device by default */
+static struct uk_blkdev *ext2fs_blkdev(const char *dev)
+{
+	unsigned long id = 0;
+	char *end;
+
+	if (dev && *dev) {
+		id = strtoul(dev, &end, 10);
+		if (*end)
+			return NULL;
+	}
+	return uk_blkdev_get(id);
+}
+
+/* Reads the superblock through a temporary cache, before the block size of
+ * the file system is known
+ */
+static int ext2fs_read_super(struct uk_blkdev *bdev,
+			     struct ext2_super_block *sb)
+{
+	struct uk_blkcache *bc;
+	struct uk_blkbuf *buf;
+	int rc;
+
+	bc = uk_blkcache_create(bdev, EXT2FS_PROBE_BSIZE, 1);
+	if (unlikely(PTRISERR(bc)))
+		return -PTR2ERR(bc);
+
+	buf = uk_blkcache_get(bc, 0, 0);
+	if (unlikely(PTRISERR(buf))) {
+		rc = -PTR2ERR(buf);
+	} else {
+		memcpy(sb, (char *)buf->data + EXT2_SUPER_OFFSET, sizeof(*sb));
+		uk_blkcache_put(buf);
+		rc = 0;
+	}
+	uk_blkcache_destroy(bc);
+	return rc;
+}
+
+static int ext2fs_check_super(struct ext2fs_mount *emp, int *rdonly)
+{
+	struct ext2_super_block *sb = &emp->sb;
+	__u32 incompat = sb->s_feature_incompat;
+
+	if (sb->s_magic != EXT2_SUPER_MAGIC) {
+		uk_pr_err("ext2fs: Bad magic number\n");
+		return EINVAL;
+	}
+	if (sb->s_log_block_size >
+	    EXT2_MAX_BLOCK_LOG_SIZE - EXT2_MIN_BLOCK_LOG_SIZE) {
+		uk_pr_err("ext2fs: Unsupported block size\n");
+		return EINVAL;
+	}
+	emp->log_bsize = sb->s_log_block_size + EXT2_MIN_BLOCK_LOG_SIZE;
+	emp->bsize = 1 << emp->log_bsize;
+	emp->addr_per_block = emp->bsize / sizeof(__u32);
+
+	if (sb->s_rev_level == EXT2_GOOD_OLD_REV) {
+		sb->s_first_ino = EXT2_GOOD_OLD_FIRST_INO;
+		sb->s_inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+		incompat = 0;
+	}
+	emp->inode_size = sb->s_inode_size;
+	if (emp->inode_size < EXT2_GOOD_OLD_INODE_SIZE ||
+	    emp->inode_size > emp->bsize ||
+	    (emp->inode_size & (emp->inode_size - 1))) {
+		uk_pr_err("ext2fs: Bad inode size %"__PRIu32"\n",
+			  emp->inode_size);
+		return EINVAL;
+	}
+	if (!sb->s_blocks_per_group || !sb->s_inodes_per_group ||
+	    sb->s_blocks_per_group > emp->bsize * 8 ||
+	    sb->s_inodes_per_group > emp->bsize * 8) {
+		uk_pr_err("ext2fs: Bad group geometry\n");
+		return EINVAL;
+	}
+
+	if (incompat & ~EXT2FS_INCOMPAT_SUPP) {
+		uk_pr_err("ext2fs: Unsupported features 0x%"__PRIx32"\n",
+			  incompat & ~EXT2FS_INCOMPAT_SUPP);
+		return EINVAL;
+	}
+
+	emp->blocks_count = sb->s_blocks_count;
+	if (incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		emp->blocks_count |= (__u64)sb->s_blocks_count_hi << 32;
+		emp->desc_size = sb->s_desc_size;
+		if (emp->desc_size < EXT2_MIN_DESC_SIZE_64BIT ||
+		    emp->desc_size > emp->bsize ||
+		    (emp->desc_size & (emp->desc_size - 1))) {
+			uk_pr_err("ext2fs: Bad group descriptor size\n");
+			return EINVAL;
+		}
+	} else {
+		emp->desc_size = EXT2_MIN_DESC_SIZE;
+	}
+	if (sb->s_first_data_block >= emp->blocks_count) {
+		uk_pr_err("ext2fs: Bad block count\n");
+		return EINVAL;
+	}
+
+	if (!*rdonly &&
+	    ((incompat & ~EXT2FS_INCOMPAT_WRITE) ||
+	     (sb->s_feature_ro_compat & ~EXT2FS_RO_COMPAT_WRITE) ||
+	     emp->blocks_count > UINT32_MAX)) {
+		uk_pr_warn("ext2fs: Features 0x%"__PRIx32"/0x%"__PRIx32
+			   " not supported for writing, mounting read-only\n",
+			   incompat, sb->s_feature_ro_compat);
+		*rdonly = 1;
+	}
+
+	/* Changes that bypass the journal would be overwritten when it is
+	 * replayed
+	 */
+	if (!*rdonly &&
+	    (sb->s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL)) {
+		uk_pr_warn("ext2fs: Journal not supported, mounting read-only\n");
+		*rdonly = 1;
+	}
+	return 0;
+}
+
+static int ext2fs_read_gdt(struct ext2fs_mount *emp)
+{
+	struct uk_blkbuf *buf;
+	__u32 i, len, gdt_size;
+
+	emp->ngroups = DIV_ROUND_UP(emp->blocks_count -
+				    emp->sb.s_first_data_block,
+				    emp->sb.s_blocks_per_group);
+	if ((__u64)emp->ngroups * emp->sb.s_inodes_per_group <
+	    emp->sb.s_inodes_count) {
+		uk_pr_err("ext2fs: Bad inode count\n");
+		return EINVAL;
+	}
+	gdt_size = emp->ngroups * emp->desc_size;
+	emp->gdt_blocks = DIV_ROUND_UP(gdt_size, emp->bsize);
+	emp->gdt = malloc(gdt_size);
+	if (unlikely(!emp->gdt))
+		return ENOMEM;
+
+	for (i = 0; i < emp->gdt_blocks; i++) {
+		len = MIN(emp->bsize, gdt_size - i * emp->bsize);
+		buf = uk_blkcache_get(emp->bc,
+				      emp->sb.s_first_data_block + 1 + i, 0);
+		if (unlikely(PTRISERR(buf))) {
+			free(emp->gdt);
+			return -PTR2ERR(buf);
+		}
+		memcpy((char *)emp->gdt + i * emp->bsize, buf->data, len);
+		uk_blkcache_put(buf);
+	}
+	return 0;
+}
+
+static int ext2fs_mount(struct mount *mp, const char *dev,
+			int flags __unused, const void *data __unused)
+{
+	struct vnode *rvp = mp->m_root->d_vnode;
+	struct ext2fs_mount *emp;
+	struct ext2fs_inode *rip;
+	struct uk_blkdev *bdev;
+	int rc, rdonly;
+
+	rvp->v_data = NULL;
+
+	bdev = ext2fs_blkdev(dev);
+	if (!bdev) {
+		uk_pr_err("ext2fs: No block device \"%s\"\n", dev ? dev : "");
+		return ENODEV;
+	}
+
+	emp = calloc(1, sizeof(*emp));
+	if (!emp)
+		return ENOMEM;
+	uk_mutex_init(&emp->lock);
+
+	rc = ext2fs_read_super(bdev, &emp->sb);
+	if (rc)
+		goto out_free;
+
+	rdonly = !!(mp->m_flags & MNT_RDONLY);
+	rc = ext2fs_check_super(emp, &rdonly);
+	if (rc)
+		goto out_free;
+
+	if (uk_blkdev_ssize(bdev) > emp->bsize ||
+	    uk_blkdev_size(bdev) < emp->blocks_count * emp->bsize) {
+		uk_pr_err("ext2fs: File system does not fit the device\n");
+		rc = EINVAL;
+		goto out_free;
+	}
+	if (!rdonly && uk_blkdev_mode(bdev) == O_RDONLY) {
+		uk_pr_warn("ext2fs: Device is read-only\n");
+		rdonly = 1;
+	}
+	if (rdonly)
+		mp->m_flags |= MNT_RDONLY;
+
+	emp->bc = uk_blkcache_create(bdev, emp->bsize, 0);
+	if (PTRISERR(emp->bc)) {
+		rc = -PTR2ERR(emp->bc);
+		goto out_free;
+	}
+
+	rc = ext2fs_read_gdt(emp);
+	if (rc)
+		goto out_destroy;
+
+	rc = ext2fs_iget(emp, EXT2_ROOT_INO, &rip);
+	if (rc)
+		goto out_free_gdt;
+	if (!S_ISDIR(rip->raw.i_mode)) {
+		uk_pr_err("ext2fs: Root inode is not a directory\n");
+		free(rip);
+		rc = EINVAL;
+		goto out_free_gdt;
+	}
+
+	if (!(emp->sb.s_state & EXT2_VALID_FS))
+		uk_pr_warn("ext2fs: File system was not cleanly unmounted\n");
+
+	emp->rdonly = rdonly;
+	if (!rdonly) {
+		emp->sb.s_state &= ~EXT2_VALID_FS;
+		emp->sb.s_mnt_count++;
+		emp->sb.s_mtime = ext2fs_now();
+		emp->meta_dirty = 1;
+		rc = ext2fs_sync(emp);
+		if (rc) {
+			free(rip);
+			goto out_free_gdt;
+		}
+	}
+
+	rvp->v_data = rip;
+	rvp->v_mode = rip->raw.i_mode;
+	rvp->v_size = ext2fs_isize(&rip->raw);
+	mp->m_data = emp;
+
+#if CONFIG_LIBEXT2FS_PAGECACHE
+	mp->m_flags |= MNT_PAGECACHE;
+#endif
+
+	uk_pr_info("ext2fs: Mounted %"__PRIu64" blocks of %"__PRIu32
+		   " bytes%s\n", emp->blocks_count, emp->bsize,
+		   rdonly ? " read-only" : "");
+	return 0;
+
+out_free_gdt:
+	free(emp->gdt);
+out_destroy:
+	uk_blkcache_destroy(emp->bc);
+out_free:
+	free(emp);
+	return rc;
+}
+
+static void ext2fs_release_tree(struct dentry *d)
+{
+	struct dentry *p, *tmp;
+
+	uk_list_for_each_entry_safe(p, tmp, &d->d_child_list, d_child_link) {
+		ext2fs_release_tree(p);
+		drele(p);
+	}
+}
+
+static int ext2fs_unmount(struct mount *mp, int flags __unused)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(mp);
+	int rc;
+
+	ext2fs_release_tree(mp->m_root);
+	vfscore_release_mp_dentries(mp);
+
+	uk_mutex_lock(&emp->lock);
+	if (!emp->rdonly) {
+		emp->sb.s_state |= EXT2_VALID_FS;
+		emp->meta_dirty = 1;
+	}
+	rc = ext2fs_sync(emp);
+	uk_mutex_unlock(&emp->lock);
+	if (rc)
+		uk_pr_err("ext2fs: Failed to write back: %d\n", rc);
+
+	uk_blkcache_destroy(emp->bc);
+	free(emp->gdt);
+	free(emp);
+	return rc;
+}
+
+static int ext2fs_vfs_sync(struct mount *mp)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(mp);
+	int rc;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_sync(emp);
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_statfs(struct mount *mp, struct statfs *st)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(mp);
+	struct ext2_super_block *sb = &emp->sb;
+	__u64 bfree, rsvd;
+
+	uk_mutex_lock(&emp->lock);
+	bfree = sb->s_free_blocks_count;
+	rsvd = sb->s_r_blocks_count;
+	if (emp->desc_size >= EXT2_MIN_DESC_SIZE_64BIT) {
+		bfree |= (__u64)sb->s_free_blocks_count_hi << 32;
+		rsvd |= (__u64)sb->s_r_blocks_count_hi << 32;
+	}
+
+	st->f_type = EXT2_SUPER_MAGIC;
+	st->f_bsize = emp->bsize;
+	st->f_frsize = emp->bsize;
+	st->f_blocks = emp->blocks_count;
+	st->f_bfree = bfree;
+	st->f_bavail = bfree > rsvd ? bfree - rsvd : 0;
+	st->f_files = sb->s_inodes_count;
+	st->f_ffree = sb->s_free_inodes_count;
+	memcpy(&st->f_fsid, sb->s_uuid, sizeof(st->f_fsid));
+	st->f_namelen = EXT2_NAME_LEN;
+	st->f_flags = emp->rdonly ? ST_RDONLY : 0;
+	uk_mutex_unlock(&emp->lock);
+	return 0;
+}
@@ -0,0 +1,816 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <uk/errptr.h>
+#include <uk/print.h>
+#include <vfscore/file.h>
+#include <vfscore/fs.h>
+#include <vfscore/mount.h>
+#include <vfscore/uio.h>
+#include <vfscore/vnode.h>
+
+#include "ext2fs.h"
+
+/* Source of zeros for reading holes */
+static const char ext2fs_zeros[256];
+
+static enum vtype ext2fs_vtype(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		return VREG;
+	case S_IFDIR:
+		return VDIR;
+	case S_IFLNK:
+		return VLNK;
+	case S_IFCHR:
+		return VCHR;
+	case S_IFBLK:
+		return VBLK;
+	case S_IFIFO:
+		return VFIFO;
+	case S_IFSOCK:
+		return VSOCK;
+	default:
+		return VNON;
+	}
+}
+
+static unsigned char ext2fs_dtype(__u8 file_type)
+{
+	static const unsigned char dtypes[] = {
+		[EXT2_FT_UNKNOWN]	= DT_UNKNOWN,
+		[EXT2_FT_REG_FILE]	= DT_REG,
+		[EXT2_FT_DIR]		= DT_DIR,
+		[EXT2_FT_CHRDEV]	= DT_CHR,
+		[EXT2_FT_BLKDEV]	= DT_BLK,
+		[EXT2_FT_FIFO]		= DT_FIFO,
+		[EXT2_FT_SOCK]		= DT_SOCK,
+		[EXT2_FT_SYMLINK]	= DT_LNK,
+	};
+
+	return file_type < ARRAY_SIZE(dtypes) ? dtypes[file_type] : DT_UNKNOWN;
+}
+
+/*
+ * Returns the locked vnode of an inode, loading the inode if the vnode is
+ * new. The mount lock must not be held: vfscore_vget() may wait for the lock
+ * of a vnode whose owner waits for the mount lock.
+ */
+static int ext2fs_vget(struct mount *mp, __u32 ino, struct vnode **vpp)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(mp);
+	struct ext2fs_inode *ip;
+	struct vnode *vp;
+	int rc;
+
+	if (vfscore_vget(mp, EXT2FS_VINO(ino), &vp)) {
+		*vpp = vp;
+		return 0;
+	}
+	if (!vp)
+		return ENOMEM;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_iget(emp, ino, &ip);
+	uk_mutex_unlock(&emp->lock);
+	if (rc) {
+		vput(vp);
+		return rc;
+	}
+
+	vp->v_data = ip;
+	vp->v_type = ext2fs_vtype(ip->raw.i_mode);
+	vp->v_mode = ip->raw.i_mode;
+	vp->v_size = ext2fs_isize(&ip->raw);
+	*vpp = vp;
+	return 0;
+}
+
+static int ext2fs_lookup(struct vnode *dvp, const char *name,
+			 struct vnode **vpp)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	__u32 ino;
+	int rc;
+
+	*vpp = NULL;
+	if (*name == '\0')
+		return ENOENT;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_dir_lookup(emp, EXT2FS_IP(dvp), name, &ino);
+	uk_mutex_unlock(&emp->lock);
+	if (rc)
+		return rc;
+
+	return ext2fs_vget(dvp->v_mount, ino, vpp);
+}
+
+static int ext2fs_uiozero(size_t len, struct uio *uio)
+{
+	size_t chunk;
+	int rc;
+
+	while (len > 0) {
+		chunk = MIN(len, sizeof(ext2fs_zeros));
+		rc = vfscore_uiomove((void *)ext2fs_zeros, chunk, uio);
+		if (rc)
+			return rc;
+		len -= chunk;
+	}
+	return 0;
+}
+
+static int ext2fs_read(struct vnode *vp, struct vfscore_file *fp __unused,
+		       struct uio *uio, int ioflag __unused)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	struct uk_blkbuf *buf;
+	__u64 size, pblk;
+	size_t boff, len;
+	int rc = 0;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (uio->uio_offset < 0)
+		return EINVAL;
+
+	uk_mutex_lock(&emp->lock);
+	size = ext2fs_isize(&ip->raw);
+	while (uio->uio_resid > 0 && (__u64)uio->uio_offset < size) {
+		boff = uio->uio_offset % emp->bsize;
+		len = MIN((__u64)(emp->bsize - boff),
+			  size - uio->uio_offset);
+		len = MIN(len, (size_t)uio->uio_resid);
+
+		rc = ext2fs_bmap(emp, ip, uio->uio_offset / emp->bsize, 0,
+				 &pblk, NULL);
+		if (rc)
+			break;
+		if (!pblk) {
+			rc = ext2fs_uiozero(len, uio);
+			if (rc)
+				break;
+			continue;
+		}
+
+		buf = uk_blkcache_get(emp->bc, pblk, 0);
+		if (PTRISERR(buf)) {
+			rc = -PTR2ERR(buf);
+			break;
+		}
+		rc = vfscore_uiomove((char *)buf->data + boff, len, uio);
+		uk_blkcache_put(buf);
+		if (rc)
+			break;
+	}
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_write(struct vnode *vp, struct uio *uio, int ioflag)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	struct uk_blkbuf *buf;
+	__u64 size, pblk;
+	ssize_t resid = uio->uio_resid;
+	size_t boff, len;
+	int new, rc = 0, rc2;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	size = ext2fs_isize(&ip->raw);
+	if (ioflag & IO_APPEND)
+		uio->uio_offset = size;
+	if (uio->uio_offset < 0) {
+		rc = EINVAL;
+		goto out;
+	}
+
+	while (uio->uio_resid > 0) {
+		boff = uio->uio_offset % emp->bsize;
+		len = MIN((size_t)(emp->bsize - boff), (size_t)uio->uio_resid);
+
+		rc = ext2fs_bmap(emp, ip, uio->uio_offset / emp->bsize, 1,
+				 &pblk, &new);
+		if (rc)
+			break;
+
+		/* Blocks that are overwritten completely are not read */
+		buf = uk_blkcache_get(emp->bc, pblk,
+				      (new || len == emp->bsize) ?
+				      UK_BLKCACHE_NOREAD : 0);
+		if (PTRISERR(buf)) {
+			rc = -PTR2ERR(buf);
+			break;
+		}
+		if (new && len != emp->bsize)
+			memset(buf->data, 0, emp->bsize);
+		rc = vfscore_uiomove((char *)buf->data + boff, len, uio);
+		uk_blkcache_dirty(buf);
+		uk_blkcache_put(buf);
+		if (rc)
+			break;
+		if ((__u64)uio->uio_offset > size)
+			size = uio->uio_offset;
+	}
+
+	if (uio->uio_resid != resid) {
+		ext2fs_set_isize(emp, &ip->raw, size);
+		vp->v_size = size;
+		ip->raw.i_mtime = ext2fs_now();
+		ip->raw.i_ctime = ip->raw.i_mtime;
+	}
+	/* Allocated blocks are recorded in the inode even on errors */
+	rc2 = ext2fs_iupdate(emp, ip);
+	if (!rc)
+		rc = rc2;
+	if (!rc && (ioflag & IO_SYNC))
+		rc = ext2fs_sync(emp);
+
+	/* Report a short write if the file system filled up midway */
+	if (rc == ENOSPC && uio->uio_resid != resid)
+		rc = 0;
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_fsync(struct vnode *vp, struct vfscore_file *fp __unused)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	int rc;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_sync(emp);
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+/* The offset of a directory is the byte offset of the next entry */
+static int ext2fs_readdir(struct vnode *vp, struct vfscore_file *fp,
+			  struct dirent64 *dir)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	__u64 off = fp->f_offset;
+	__u32 ino;
+	__u8 type;
+	int rc;
+
+	if (fp->f_offset < 0)
+		return ENOENT;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_dir_next(emp, EXT2FS_IP(vp), &off, &ino, &type,
+			     dir->d_name);
+	uk_mutex_unlock(&emp->lock);
+	if (rc)
+		return rc;
+
+	dir->d_ino = ino;
+	dir->d_off = off;
+	dir->d_reclen = sizeof(*dir);
+	dir->d_type = ext2fs_dtype(type);
+	fp->f_offset = off;
+	return 0;
+}
+
+/*
+ * Writes a newly allocated inode and enters it into a directory. The inode is
+ * freed again if the entry cannot be added.
+ */
+static int ext2fs_link_new(struct ext2fs_mount *emp, struct ext2fs_inode *dip,
+			   const char *name, struct ext2fs_inode *ip)
+{
+	int rc;
+
+	rc = ext2fs_iupdate(emp, ip);
+	if (!rc)
+		rc = ext2fs_dir_add(emp, dip, name, ip->ino, ip->raw.i_mode);
+	if (rc) {
+		ip->raw.i_links_count = 0;
+		ext2fs_ifree(emp, ip);
+	}
+	return rc;
+}
+
+static int ext2fs_create(struct vnode *dvp, const char *name, mode_t mode)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	struct ext2fs_inode *ip;
+	int rc;
+
+	if (!S_ISREG(mode))
+		return EINVAL;
+	if (strlen(name) > EXT2_NAME_LEN)
+		return ENAMETOOLONG;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_ialloc(emp, EXT2FS_IP(dvp), mode, &ip);
+	if (!rc) {
+		ip->raw.i_links_count = 1;
+		rc = ext2fs_link_new(emp, EXT2FS_IP(dvp), name, ip);
+		free(ip);
+	}
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_mkdir(struct vnode *dvp, const char *name, mode_t mode)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	struct ext2fs_inode *dip = EXT2FS_IP(dvp);
+	struct ext2_dir_entry *de;
+	struct ext2fs_inode *ip;
+	struct uk_blkbuf *buf;
+	__u64 pblk;
+	int rc;
+
+	if (strlen(name) > EXT2_NAME_LEN)
+		return ENAMETOOLONG;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	if (dip->raw.i_links_count >= EXT2_LINK_MAX) {
+		rc = EMLINK;
+		goto out;
+	}
+
+	rc = ext2fs_ialloc(emp, dip, S_IFDIR | (mode & UK_ALLPERMS), &ip);
+	if (rc)
+		goto out;
+	ip->raw.i_links_count = 2;
+
+	/* The first block holds "." and ".." */
+	rc = ext2fs_bmap(emp, ip, 0, 1, &pblk, NULL);
+	if (!rc) {
+		buf = uk_blkcache_get(emp->bc, pblk, UK_BLKCACHE_NOREAD);
+		if (PTRISERR(buf))
+			rc = -PTR2ERR(buf);
+	}
+	if (rc) {
+		ip->raw.i_links_count = 0;
+		ext2fs_ifree(emp, ip);
+		free(ip);
+		goto out;
+	}
+	memset(buf->data, 0, emp->bsize);
+	de = buf->data;
+	de->inode = ip->ino;
+	de->rec_len = EXT2_DIR_REC_LEN(1);
+	de->name_len = 1;
+	de->file_type = (emp->sb.s_feature_incompat &
+			 EXT2_FEATURE_INCOMPAT_FILETYPE) ? EXT2_FT_DIR : 0;
+	de->name[0] = '.';
+	de = (struct ext2_dir_entry *)((char *)de + de->rec_len);
+	de->inode = dip->ino;
+	de->rec_len = emp->bsize - EXT2_DIR_REC_LEN(1);
+	de->name_len = 2;
+	de->file_type = (emp->sb.s_feature_incompat &
+			 EXT2_FEATURE_INCOMPAT_FILETYPE) ? EXT2_FT_DIR : 0;
+	de->name[0] = '.';
+	de->name[1] = '.';
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+	ext2fs_set_isize(emp, &ip->raw, emp->bsize);
+
+	rc = ext2fs_link_new(emp, dip, name, ip);
+	free(ip);
+	if (rc)
+		goto out;
+
+	dip->raw.i_links_count++;
+	rc = ext2fs_iupdate(emp, dip);
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_remove(struct vnode *dvp, struct vnode *vp,
+			 const char *name)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_dir_remove(emp, EXT2FS_IP(dvp), name);
+	if (!rc) {
+		/* The inode is freed once the vnode is inactive */
+		if (ip->raw.i_links_count)
+			ip->raw.i_links_count--;
+		ip->raw.i_ctime = ext2fs_now();
+		rc = ext2fs_iupdate(emp, ip);
+	}
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_rmdir(struct vnode *dvp, struct vnode *vp, const char *name)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	struct ext2fs_inode *dip = EXT2FS_IP(dvp);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	int rc;
+
+	if (vp->v_type != VDIR)
+		return ENOTDIR;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_dir_empty(emp, ip);
+	if (rc <= 0) {
+		rc = rc ? -rc : ENOTEMPTY;
+		goto out;
+	}
+	rc = ext2fs_dir_remove(emp, dip, name);
+	if (rc)
+		goto out;
+
+	ip->raw.i_links_count = 0;
+	ip->raw.i_ctime = ext2fs_now();
+	rc = ext2fs_iupdate(emp, ip);
+	if (dip->raw.i_links_count > 2)
+		dip->raw.i_links_count--;
+	if (!rc)
+		rc = ext2fs_iupdate(emp, dip);
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_rename(struct vnode *dvp1, struct vnode *vp1,
+			 const char *name1, struct vnode *dvp2,
+			 struct vnode *vp2, const char *name2)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp1->v_mount);
+	struct ext2fs_inode *dip1 = EXT2FS_IP(dvp1);
+	struct ext2fs_inode *dip2 = EXT2FS_IP(dvp2);
+	struct ext2fs_inode *ip1 = EXT2FS_IP(vp1);
+	struct ext2fs_inode *ip2 = vp2 ? EXT2FS_IP(vp2) : NULL;
+	int isdir = S_ISDIR(ip1->raw.i_mode);
+	int rc;
+
+	if (strlen(name2) > EXT2_NAME_LEN)
+		return ENAMETOOLONG;
+	if (emp->rdonly)
+		return EROFS;
+	/* Renaming a file onto a hard link of itself does nothing */
+	if (ip1 == ip2)
+		return 0;
+
+	uk_mutex_lock(&emp->lock);
+	if (isdir && dip1 != dip2 && !ip2 &&
+	    dip2->raw.i_links_count >= EXT2_LINK_MAX) {
+		rc = EMLINK;
+		goto out;
+	}
+
+	if (ip2) {
+		if (S_ISDIR(ip2->raw.i_mode)) {
+			rc = ext2fs_dir_empty(emp, ip2);
+			if (rc <= 0) {
+				rc = rc ? -rc : ENOTEMPTY;
+				goto out;
+			}
+		}
+		rc = ext2fs_dir_set(emp, dip2, name2, ip1->ino,
+				    ip1->raw.i_mode);
+		if (rc)
+			goto out;
+		if (S_ISDIR(ip2->raw.i_mode)) {
+			ip2->raw.i_links_count = 0;
+			dip2->raw.i_links_count--;
+		} else if (ip2->raw.i_links_count) {
+			ip2->raw.i_links_count--;
+		}
+		ip2->raw.i_ctime = ext2fs_now();
+		rc = ext2fs_iupdate(emp, ip2);
+	} else {
+		rc = ext2fs_dir_add(emp, dip2, name2, ip1->ino,
+				    ip1->raw.i_mode);
+	}
+	if (rc)
+		goto out;
+
+	rc = ext2fs_dir_remove(emp, dip1, name1);
+	if (rc)
+		goto out;
+
+	if (isdir && dip1 != dip2) {
+		rc = ext2fs_dir_set(emp, ip1, "..", dip2->ino, S_IFDIR);
+		if (rc)
+			goto out;
+		dip1->raw.i_links_count--;
+		dip2->raw.i_links_count++;
+		rc = ext2fs_iupdate(emp, dip1);
+	}
+	if (!rc)
+		rc = ext2fs_iupdate(emp, dip2);
+
+	ip1->raw.i_ctime = ext2fs_now();
+	if (!rc)
+		rc = ext2fs_iupdate(emp, ip1);
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_link(struct vnode *dvp, struct vnode *vp, const char *name)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EPERM;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	if (ip->raw.i_links_count >= EXT2_LINK_MAX) {
+		rc = EMLINK;
+		goto out;
+	}
+	rc = ext2fs_dir_add(emp, EXT2FS_IP(dvp), name, ip->ino,
+			    ip->raw.i_mode);
+	if (rc)
+		goto out;
+	ip->raw.i_links_count++;
+	ip->raw.i_ctime = ext2fs_now();
+	rc = ext2fs_iupdate(emp, ip);
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_symlink(struct vnode *dvp, const char *name,
+			  const char *link)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(dvp->v_mount);
+	size_t len = strlen(link);
+	struct ext2fs_inode *ip;
+	struct uk_blkbuf *buf;
+	__u64 pblk;
+	int rc;
+
+	if (strlen(name) > EXT2_NAME_LEN || len >= emp->bsize)
+		return ENAMETOOLONG;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	rc = ext2fs_ialloc(emp, EXT2FS_IP(dvp), S_IFLNK | S_IRWXU | S_IRWXG | S_IRWXO, &ip);
+	if (rc)
+		goto out;
+	ip->raw.i_links_count = 1;
+
+	/* Short targets are kept in the inode, longer ones in a block */
+	if (len < EXT2_FAST_SYMLINK_MAX) {
+		memcpy(ip->raw.i_block, link, len);
+	} else {
+		rc = ext2fs_bmap(emp, ip, 0, 1, &pblk, NULL);
+		if (!rc) {
+			buf = uk_blkcache_get(emp->bc, pblk,
+					      UK_BLKCACHE_NOREAD);
+			if (PTRISERR(buf)) {
+				rc = -PTR2ERR(buf);
+			} else {
+				memset(buf->data, 0, emp->bsize);
+				memcpy(buf->data, link, len);
+				uk_blkcache_dirty(buf);
+				uk_blkcache_put(buf);
+			}
+		}
+		if (rc) {
+			ip->raw.i_links_count = 0;
+			ext2fs_ifree(emp, ip);
+			free(ip);
+			goto out;
+		}
+	}
+	ext2fs_set_isize(emp, &ip->raw, len);
+
+	rc = ext2fs_link_new(emp, EXT2FS_IP(dvp), name, ip);
+	free(ip);
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_readlink(struct vnode *vp, struct uio *uio)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	struct uk_blkbuf *buf;
+	__u64 pblk;
+	size_t len;
+	int rc;
+
+	if (vp->v_type != VLNK)
+		return EINVAL;
+
+	uk_mutex_lock(&emp->lock);
+	len = MIN(ext2fs_isize(&ip->raw), (__u64)uio->uio_resid);
+	if (ext2fs_is_fast_symlink(emp, ip)) {
+		len = MIN(len, EXT2_FAST_SYMLINK_MAX);
+		rc = vfscore_uiomove(ip->raw.i_block, len, uio);
+		goto out;
+	}
+
+	len = MIN(len, (size_t)emp->bsize);
+	rc = ext2fs_bmap(emp, ip, 0, 0, &pblk, NULL);
+	if (rc)
+		goto out;
+	if (!pblk) {
+		rc = EIO;
+		goto out;
+	}
+	buf = uk_blkcache_get(emp->bc, pblk, 0);
+	if (PTRISERR(buf)) {
+		rc = -PTR2ERR(buf);
+		goto out;
+	}
+	rc = vfscore_uiomove(buf->data, len, uio);
+	uk_blkcache_put(buf);
+out:
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_getattr(struct vnode *vp, struct vattr *attr)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2_inode *raw = &EXT2FS_IP(vp)->raw;
+
+	uk_mutex_lock(&emp->lock);
+	attr->va_type = vp->v_type;
+	attr->va_mode = raw->i_mode & ~S_IFMT;
+	attr->va_nlink = raw->i_links_count;
+	attr->va_uid = raw->i_uid | (__u32)raw->i_uid_high << 16;
+	attr->va_gid = raw->i_gid | (__u32)raw->i_gid_high << 16;
+	attr->va_nodeid = EXT2FS_IP(vp)->ino;
+	attr->va_size = ext2fs_isize(raw);
+	attr->va_nblocks = raw->i_blocks;
+	attr->va_atime.tv_sec = raw->i_atime;
+	attr->va_mtime.tv_sec = raw->i_mtime;
+	attr->va_ctime.tv_sec = raw->i_ctime;
+	if (vp->v_type == VCHR || vp->v_type == VBLK)
+		attr->va_rdev = raw->i_block[0] ? raw->i_block[0]
+						 : raw->i_block[1];
+	uk_mutex_unlock(&emp->lock);
+	return 0;
+}
+
+static __u32 ext2fs_time(const struct timespec *ts)
+{
+	if (ts->tv_nsec == UTIME_NOW)
+		return ext2fs_now();
+	return (__u32)ts->tv_sec;
+}
+
+static int ext2fs_setattr(struct vnode *vp, struct vattr *attr)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	int rc;
+
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	if (attr->va_mask & AT_MODE) {
+		ip->raw.i_mode = (ip->raw.i_mode & S_IFMT) |
+				 (attr->va_mode & UK_ALLPERMS);
+		vp->v_mode = ip->raw.i_mode;
+	}
+	if (attr->va_mask & AT_UID) {
+		ip->raw.i_uid = (__u16)attr->va_uid;
+		ip->raw.i_uid_high = (__u16)(attr->va_uid >> 16);
+	}
+	if (attr->va_mask & AT_GID) {
+		ip->raw.i_gid = (__u16)attr->va_gid;
+		ip->raw.i_gid_high = (__u16)(attr->va_gid >> 16);
+	}
+	if (attr->va_mask & AT_ATIME)
+		ip->raw.i_atime = ext2fs_time(&attr->va_atime);
+	if (attr->va_mask & AT_MTIME)
+		ip->raw.i_mtime = ext2fs_time(&attr->va_mtime);
+	if (attr->va_mask & AT_CTIME)
+		ip->raw.i_ctime = ext2fs_time(&attr->va_ctime);
+	else
+		ip->raw.i_ctime = ext2fs_now();
+	rc = ext2fs_iupdate(emp, ip);
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_truncate(struct vnode *vp, off_t length)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+	int rc;
+
+	if (vp->v_type == VDIR)
+		return EISDIR;
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (length < 0)
+		return EINVAL;
+	if (emp->rdonly)
+		return EROFS;
+
+	uk_mutex_lock(&emp->lock);
+	ip->raw.i_mtime = ext2fs_now();
+	ip->raw.i_ctime = ip->raw.i_mtime;
+	rc = ext2fs_itrunc(emp, ip, length);
+	if (!rc)
+		vp->v_size = length;
+	uk_mutex_unlock(&emp->lock);
+	return rc;
+}
+
+static int ext2fs_inactive(struct vnode *vp)
+{
+	struct ext2fs_mount *emp = EXT2FS_MP(vp->v_mount);
+	struct ext2fs_inode *ip = EXT2FS_IP(vp);
+
+	if (!ip)
+		return 0;
+
+	/* Unlinked inodes live on until their last user is gone */
+	if (!ip->raw.i_links_count && !emp->rdonly) {
+		uk_mutex_lock(&emp->lock);
+		ext2fs_ifree(emp, ip);
+		uk_mutex_unlock(&emp->lock);
+	}
+	free(ip);
+	vp->v_data = NULL;
+	return 0;
+}
+
+#define ext2fs_open		((vnop_open_t)vfscore_vop_nullop)
+#define ext2fs_close		((vnop_close_t)vfscore_vop_nullop)
+#define ext2fs_seek		((vnop_seek_t)vfscore_vop_nullop)
+#define ext2fs_ioctl		((vnop_ioctl_t)vfscore_vop_einval)
+#define ext2fs_cache		((vnop_cache_t)NULL)
+#define ext2fs_fallocate	((vnop_fallocate_t)vfscore_vop_nullop)
+#define ext2fs_poll		((vnop_poll_t)vfscore_vop_einval)
+
+struct vnops ext2fs_vnops = {
+	.vop_open	= ext2fs_open,
+	.vop_close	= ext2fs_close,
+	.vop_read	= ext2fs_read,
+	.vop_write	= ext2fs_write,
+	.vop_seek	= ext2fs_seek,
+	.vop_ioctl	= ext2fs_ioctl,
+	.vop_fsync	= ext2fs_fsync,
+	.vop_readdir	= ext2fs_readdir,
+	.vop_lookup	= ext2fs_lookup,
+	.vop_create	= ext2fs_create,
+	.vop_remove	= ext2fs_remove,
+	.vop_rename	= ext2fs_rename,
+	.vop_mkdir	= ext2fs_mkdir,
+	.vop_rmdir	= ext2fs_rmdir,
+	.vop_getattr	= ext2fs_getattr,
+	.vop_setattr	= ext2fs_setattr,
+	.vop_inactive	= ext2fs_inactive,
+	.vop_truncate	= ext2fs_truncate,
+	.vop_link	= ext2fs_link,
+	.vop_cache	= ext2fs_cache,
+	.vop_fallocate	= ext2fs_fallocate,
+	.vop_readlink	= ext2fs_readlink,
+	.vop_symlink	= ext2fs_symlink,
+	.vop_poll	= ext2fs_poll,
+};
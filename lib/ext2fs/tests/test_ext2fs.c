@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <uk/test.h>
+#include <uk/blkdev_ramdisk.h>
+#include "../ext2fs.h"
+
+#define TEST_DIR		"/.test_ext2fs"
+#define TEST_DISK		3
+
+/* A minimal ext2 file system of 256 blocks of 1 KiB in a single group, with
+ * only the filetype feature, lost+found and a file in the root directory. It
+ * passes e2fsck -f.
+ */
+#define TEST_BSIZE		1024
+#define TEST_BLOCKS		256
+#define TEST_INODES		32
+#define TEST_GROUP_BLOCKS	(TEST_BSIZE * 8)
+
+#define TEST_GDT_BLK		2
+#define TEST_BBITMAP_BLK	3
+#define TEST_IBITMAP_BLK	4
+#define TEST_ITABLE_BLK		5
+#define TEST_ROOT_BLK		(TEST_ITABLE_BLK +			\
+				 TEST_INODES * EXT2_GOOD_OLD_INODE_SIZE /	\
+				 TEST_BSIZE)
+#define TEST_LPF_BLK		(TEST_ROOT_BLK + 1)
+#define TEST_HELLO_BLK		(TEST_ROOT_BLK + 2)
+#define TEST_USED_BLOCKS	TEST_HELLO_BLK	/* Blocks 1 to TEST_HELLO_BLK */
+
+#define TEST_LPF_INO		11
+#define TEST_HELLO_INO		12
+
+#define TEST_HELLO		"Hello from ext2!\n"
+
+static struct uk_blkdev_ramdisk *test_disk;
+
+static void *test_block(__u32 blkno)
+{
+	return test_disk->data + blkno * TEST_BSIZE;
+}
+
+static void test_set_bits(__u8 *bitmap, unsigned int from, unsigned int to)
+{
+	for (; from < to; from++)
+		bitmap[from / 8] |= 1 << (from % 8);
+}
+
+static void test_set_inode(__u32 ino, __u16 mode, __u16 links, __u32 size,
+			   __u32 blkno)
+{
+	struct ext2_inode *raw = (struct ext2_inode *)
+		((char *)test_block(TEST_ITABLE_BLK) +
+		 (ino - 1) * EXT2_GOOD_OLD_INODE_SIZE);
+
+	raw->i_mode = mode;
+	raw->i_links_count = links;
+	raw->i_size = size;
+	raw->i_blocks = TEST_BSIZE / 512;
+	raw->i_block[0] = blkno;
+}
+
+static struct ext2_dir_entry *test_add_dirent(struct ext2_dir_entry *de,
+					      __u32 ino, const char *name,
+					      __u8 type, int last)
+{
+	char *end = test_disk->data +
+		    ALIGN_UP((char *)de - test_disk->data + 1, TEST_BSIZE);
+
+	de->inode = ino;
+	de->name_len = strlen(name);
+	de->file_type = type;
+	de->rec_len = last ? end - (char *)de : EXT2_DIR_REC_LEN(de->name_len);
+	memcpy(de->name, name, de->name_len);
+	return (struct ext2_dir_entry *)((char *)de + de->rec_len);
+}
+
+/* Formats the RAM disk and mounts it on TEST_DIR */
+static int test_mkfs_mount(__u32 feature_compat)
+{
+	struct ext2_super_block *sb;
+	struct ext2_group_desc *gd;
+	struct ext2_dir_entry *de;
+	char dev[8];
+
+	test_disk = uk_blkdev_ramdisk_get(TEST_DISK, 0);
+	if (!test_disk)
+		return -ENODEV;
+
+	sb = (struct ext2_super_block *)(test_disk->data + EXT2_SUPER_OFFSET);
+	sb->s_inodes_count = TEST_INODES;
+	sb->s_blocks_count = TEST_BLOCKS;
+	sb->s_free_blocks_count = TEST_BLOCKS - 1 - TEST_USED_BLOCKS;
+	sb->s_free_inodes_count = TEST_INODES - TEST_HELLO_INO;
+	sb->s_first_data_block = 1;
+	sb->s_blocks_per_group = TEST_GROUP_BLOCKS;
+	sb->s_clusters_per_group = TEST_GROUP_BLOCKS;
+	sb->s_inodes_per_group = TEST_INODES;
+	sb->s_max_mnt_count = -1;
+	sb->s_magic = EXT2_SUPER_MAGIC;
+	sb->s_state = EXT2_VALID_FS;
+	sb->s_errors = 1;
+	sb->s_rev_level = 1;
+	sb->s_first_ino = TEST_LPF_INO;
+	sb->s_inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+	sb->s_feature_compat = feature_compat;
+	sb->s_feature_incompat = EXT2_FEATURE_INCOMPAT_FILETYPE;
+
+	gd = test_block(TEST_GDT_BLK);
+	gd->bg_block_bitmap = TEST_BBITMAP_BLK;
+	gd->bg_inode_bitmap = TEST_IBITMAP_BLK;
+	gd->bg_inode_table = TEST_ITABLE_BLK;
+	gd->bg_free_blocks_count = sb->s_free_blocks_count;
+	gd->bg_free_inodes_count = sb->s_free_inodes_count;
+	gd->bg_used_dirs_count = 2;
+
+	/* Bits past the end of the file system are set */
+	test_set_bits(test_block(TEST_BBITMAP_BLK), 0, TEST_USED_BLOCKS);
+	test_set_bits(test_block(TEST_BBITMAP_BLK), TEST_BLOCKS - 1,
+		      TEST_GROUP_BLOCKS);
+	test_set_bits(test_block(TEST_IBITMAP_BLK), 0, TEST_HELLO_INO);
+	test_set_bits(test_block(TEST_IBITMAP_BLK), TEST_INODES,
+		      TEST_GROUP_BLOCKS);
+
+	test_set_inode(EXT2_ROOT_INO, S_IFDIR | 0755, 3, TEST_BSIZE,
+		       TEST_ROOT_BLK);
+	de = test_block(TEST_ROOT_BLK);
+	de = test_add_dirent(de, EXT2_ROOT_INO, ".", EXT2_FT_DIR, 0);
+	de = test_add_dirent(de, EXT2_ROOT_INO, "..", EXT2_FT_DIR, 0);
+	de = test_add_dirent(de, TEST_LPF_INO, "lost+found", EXT2_FT_DIR, 0);
+	test_add_dirent(de, TEST_HELLO_INO, "hello", EXT2_FT_REG_FILE, 1);
+
+	test_set_inode(TEST_LPF_INO, S_IFDIR | 0700, 2, TEST_BSIZE,
+		       TEST_LPF_BLK);
+	de = test_block(TEST_LPF_BLK);
+	de = test_add_dirent(de, TEST_LPF_INO, ".", EXT2_FT_DIR, 0);
+	test_add_dirent(de, EXT2_ROOT_INO, "..", EXT2_FT_DIR, 1);
+
+	test_set_inode(TEST_HELLO_INO, S_IFREG | 0644, 1,
+		       sizeof(TEST_HELLO) - 1, TEST_HELLO_BLK);
+	memcpy(test_block(TEST_HELLO_BLK), TEST_HELLO, sizeof(TEST_HELLO) - 1);
+
+	if (mkdir(TEST_DIR, 0755) && errno != EEXIST)
+		return -errno;
+	snprintf(dev, sizeof(dev), "%d", test_disk->id);
+	if (mount(dev, TEST_DIR, "ext2", 0, NULL))
+		return -errno;
+	return 0;
+}
+
+static ssize_t test_read_file(const char *path, char *buf, size_t len)
+{
+	ssize_t rc;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	rc = read(fd, buf, len);
+	close(fd);
+	return rc;
+}
+
+UK_TESTCASE(ext2fs, test_ext2fs_read)
+{
+	struct ext2_super_block *sb;
+	char buf[64];
+	struct stat st;
+
+	UK_TEST_ASSERT(test_mkfs_mount(0) == 0);
+	sb = (struct ext2_super_block *)(test_disk->data + EXT2_SUPER_OFFSET);
+
+	UK_TEST_EXPECT_ZERO(stat(TEST_DIR "/hello", &st));
+	UK_TEST_EXPECT(S_ISREG(st.st_mode));
+	UK_TEST_EXPECT_SNUM_EQ(st.st_size, sizeof(TEST_HELLO) - 1);
+	UK_TEST_EXPECT_SNUM_EQ(test_read_file(TEST_DIR "/hello", buf,
+					      sizeof(buf)),
+			       sizeof(TEST_HELLO) - 1);
+	UK_TEST_EXPECT_ZERO(memcmp(buf, TEST_HELLO, sizeof(TEST_HELLO) - 1));
+
+	UK_TEST_EXPECT_ZERO(stat(TEST_DIR "/lost+found", &st));
+	UK_TEST_EXPECT(S_ISDIR(st.st_mode));
+	UK_TEST_EXPECT_SNUM_EQ(test_read_file(TEST_DIR "/missing", buf,
+					      sizeof(buf)),
+			       -ENOENT);
+
+	/* A read-write mount is marked as not clean until it is unmounted */
+	UK_TEST_EXPECT_ZERO(sb->s_state & EXT2_VALID_FS);
+	UK_TEST_EXPECT_ZERO(umount(TEST_DIR));
+	UK_TEST_EXPECT_NOT_ZERO(sb->s_state & EXT2_VALID_FS);
+}
+
+UK_TESTCASE(ext2fs, test_ext2fs_write_remount)
+{
+	static char data[3 * TEST_BSIZE + 100], buf[sizeof(data)];
+	struct ext2_super_block *sb;
+	char dev[8];
+	unsigned int i;
+	int fd;
+
+	UK_TEST_ASSERT(test_mkfs_mount(0) == 0);
+	sb = (struct ext2_super_block *)(test_disk->data + EXT2_SUPER_OFFSET);
+
+	/* A file that spans several blocks, in a new directory */
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (char)(i * 7 + i / TEST_BSIZE);
+	UK_TEST_EXPECT_ZERO(mkdir(TEST_DIR "/dir", 0755));
+	fd = open(TEST_DIR "/dir/file", O_WRONLY | O_CREAT | O_EXCL, 0644);
+	UK_TEST_ASSERT(fd >= 0);
+	UK_TEST_EXPECT_SNUM_EQ(write(fd, data, sizeof(data)), sizeof(data));
+	UK_TEST_EXPECT_ZERO(close(fd));
+
+	UK_TEST_EXPECT_ZERO(rename(TEST_DIR "/hello", TEST_DIR "/dir/hello"));
+	UK_TEST_EXPECT_ZERO(unlink(TEST_DIR "/dir/hello"));
+	UK_TEST_EXPECT_SNUM_EQ(rmdir(TEST_DIR "/dir"), -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, ENOTEMPTY);
+
+	/* The changes are on the disk after unmounting */
+	UK_TEST_EXPECT_ZERO(umount(TEST_DIR));
+	UK_TEST_EXPECT_SNUM_EQ(sb->s_free_inodes_count,
+			       TEST_INODES - TEST_HELLO_INO - 1);
+	UK_TEST_EXPECT_SNUM_EQ(sb->s_free_blocks_count,
+			       TEST_BLOCKS - 1 - TEST_USED_BLOCKS - 4);
+
+	snprintf(dev, sizeof(dev), "%d", test_disk->id);
+	UK_TEST_ASSERT(mount(dev, TEST_DIR, "ext2", 0, NULL) == 0);
+	UK_TEST_EXPECT_SNUM_EQ(test_read_file(TEST_DIR "/dir/file", buf,
+					      sizeof(buf)),
+			       sizeof(data));
+	UK_TEST_EXPECT_ZERO(memcmp(buf, data, sizeof(data)));
+	UK_TEST_EXPECT_SNUM_EQ(test_read_file(TEST_DIR "/hello", buf,
+					      sizeof(buf)),
+			       -ENOENT);
+
+	UK_TEST_EXPECT_ZERO(unlink(TEST_DIR "/dir/file"));
+	UK_TEST_EXPECT_ZERO(rmdir(TEST_DIR "/dir"));
+	UK_TEST_EXPECT_ZERO(umount(TEST_DIR));
+	UK_TEST_EXPECT_SNUM_EQ(sb->s_free_inodes_count,
+			       TEST_INODES - TEST_HELLO_INO + 1);
+	UK_TEST_EXPECT_SNUM_EQ(sb->s_free_blocks_count,
+			       TEST_BLOCKS - 1 - TEST_USED_BLOCKS + 1);
+}
+
+/* Writes would bypass the journal, so journaled file systems are read-only */
+UK_TESTCASE(ext2fs, test_ext2fs_journal_rdonly)
+{
+	struct ext2_super_block *sb;
+	char buf[64];
+
+	UK_TEST_ASSERT(test_mkfs_mount(EXT3_FEATURE_COMPAT_HAS_JOURNAL) == 0);
+	sb = (struct ext2_super_block *)(test_disk->data + EXT2_SUPER_OFFSET);
+
+	UK_TEST_EXPECT_SNUM_EQ(test_read_file(TEST_DIR "/hello", buf,
+					      sizeof(buf)),
+			       sizeof(TEST_HELLO) - 1);
+	UK_TEST_EXPECT_SNUM_EQ(open(TEST_DIR "/new", O_WRONLY | O_CREAT, 0644),
+			       -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, EROFS);
+	UK_TEST_EXPECT_SNUM_EQ(unlink(TEST_DIR "/hello"), -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, EROFS);
+
+	UK_TEST_EXPECT_NOT_ZERO(sb->s_state & EXT2_VALID_FS);
+	UK_TEST_EXPECT_ZERO(sb->s_mnt_count);
+	UK_TEST_EXPECT_ZERO(umount(TEST_DIR));
+	UK_TEST_EXPECT_ZERO(test_disk->writes);
+}
+
+uk_testsuite_register(ext2fs, NULL);
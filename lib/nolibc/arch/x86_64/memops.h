@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __NOLIBC_ARCH_MEMOPS_H__
+#define __NOLIBC_ARCH_MEMOPS_H__
+
+#include <uk/arch/lcpu.h>
+#include <uk/essentials.h>
+
+/*
+ * Bulk copies and fills use string instructions. On CPUs with enhanced
+ * REP MOVSB/STOSB (ERMS), the byte variants are handled in microcode on
+ * whole cache lines and are the fastest option for large buffers. Fast
+ * short REP MOV (FSRM) makes them worthwhile for short buffers, too.
+ * Without ERMS, the quadword variants are used for the bulk of the data.
+ *
+ * The CPU features are detected on the first bulk operation. Vector
+ * registers are not used because memory is also copied before the extended
+ * register state is set up during boot.
+ */
+
+/* Lengths for which the string instructions are used */
+static __sz nolibc_x86_rep_min;
+static int nolibc_x86_erms;
+
+static void nolibc_x86_memops_detect(void)
+{
+	__u32 eax, ebx, ecx, edx;
+	int fsrm = 0;
+
+	ukarch_x86_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	if (eax >= 7) {
+		ukarch_x86_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+		nolibc_x86_erms = !!(ebx & X86_CPUID7_EBX_ERMS);
+		fsrm = !!(edx & X86_CPUID7_EDX_FSRM);
+	}
+
+	if (fsrm)
+		nolibc_x86_rep_min = 128;
+	else if (nolibc_x86_erms)
+		nolibc_x86_rep_min = 512;
+	else
+		nolibc_x86_rep_min = 2048;
+}
+
+static inline int nolibc_arch_memops(__sz len)
+{
+	if (unlikely(!nolibc_x86_rep_min))
+		nolibc_x86_memops_detect();
+
+	return len >= nolibc_x86_rep_min;
+}
+
+/* Copies forward, so it may also be used for overlapping buffers with
+ * dst below src
+ */
+static inline void nolibc_arch_memcpy(void *dst, const void *src, __sz len)
+{
+	__sz qwords;
+
+	if (!nolibc_x86_erms) {
+		qwords = len >> 3;
+		len &= 7;
+		__asm__ __volatile__("rep movsq"
+				     : "+D"(dst), "+S"(src), "+c"(qwords)
+				     :
+				     : "memory");
+	}
+
+	__asm__ __volatile__("rep movsb"
+			     : "+D"(dst), "+S"(src), "+c"(len)
+			     :
+			     : "memory");
+}
+
+static inline void nolibc_arch_memset(void *dst, int val, __sz len)
+{
+	__u64 qval;
+	__sz qwords;
+
+	if (!nolibc_x86_erms) {
+		qval = (__u8)val * 0x0101010101010101ULL;
+		qwords = len >> 3;
+		len &= 7;
+		__asm__ __volatile__("rep stosq"
+				     : "+D"(dst), "+c"(qwords)
+				     : "a"(qval)
+				     : "memory");
+	}
+
+	__asm__ __volatile__("rep stosb"
+			     : "+D"(dst), "+c"(len)
+			     : "a"(val)
+			     : "memory");
+}
+
+#endif /* __NOLIBC_ARCH_MEMOPS_H__ */
@@ -63,12 +63,96 @@
 #include <stdio.h>
 #include <ctype.h>
 
-void *memcpy(void *dst, const void *src, size_t len)
+#if defined(__X86_64__)
+#include "arch/x86_64/memops.h"
+#else
+#define nolibc_arch_memops(len)			0
+#define nolibc_arch_memcpy(dst, src, len)	do {} while (0)
+#define nolibc_arch_memset(dst, val, len)	do {} while (0)
+#endif
+
+/*
+ * memcpy(), memset(), memmove() and memchr() operate a word at a time on
+ * aligned destinations. Sources of copies may be unaligned. Architectures
+ * can take over bulk copies and fills (see arch/<ARCH>/memops.h).
+ */
+typedef unsigned long __attribute__((__may_alias__)) nolibc_word;
+typedef unsigned long __attribute__((__may_alias__, __aligned__(1)))
+	nolibc_uword;
+
+#define WSIZE		sizeof(nolibc_word)
+#define WMASK		(WSIZE - 1)
+/* Shorter lengths are processed byte by byte */
+#define WMIN		(2 * WSIZE)
+
+#define WONES		((nolibc_word)-1 / 0xff)
+#define WHIGHS		(WONES * 0x80)
+#define WHASZERO(w)	(((w) - WONES) & ~(w) & WHIGHS)
+
+/* Copies forward, so it may also be used for overlapping buffers with
+ * dst below src
+ */
+static inline void copy_fwd(__u8 *d, const __u8 *s, size_t len)
 {
-	size_t p;
+	nolibc_word w0, w1, w2, w3;
+
+	if (len >= WMIN) {
+		if (nolibc_arch_memops(len)) {
+			nolibc_arch_memcpy(d, s, len);
+			return;
+		}
+
+		for (; (__uptr)d & WMASK; --len)
+			*d++ = *s++;
+
+		for (; len >= 4 * WSIZE; len -= 4 * WSIZE) {
+			w0 = ((const nolibc_uword *)s)[0];
+			w1 = ((const nolibc_uword *)s)[1];
+			w2 = ((const nolibc_uword *)s)[2];
+			w3 = ((const nolibc_uword *)s)[3];
+			((nolibc_word *)d)[0] = w0;
+			((nolibc_word *)d)[1] = w1;
+			((nolibc_word *)d)[2] = w2;
+			((nolibc_word *)d)[3] = w3;
+			d += 4 * WSIZE;
+			s += 4 * WSIZE;
+		}
 
-	for (p = 0; p < len; ++p)
-		*((__u8 *)(((__uptr)dst) + p)) = *((__u8 *)(((__uptr)src) + p));
+		for (; len >= WSIZE; len -= WSIZE) {
+			*(nolibc_word *)d = *(const nolibc_uword *)s;
+			d += WSIZE;
+			s += WSIZE;
+		}
+	}
+
+	for (; len > 0; --len)
+		*d++ = *s++;
+}
+
+/* Copies backward, for overlapping buffers with dst above src */
+static inline void copy_bwd(__u8 *d, const __u8 *s, size_t len)
+{
+	d += len;
+	s += len;
+
+	if (len >= WMIN) {
+		for (; (__uptr)d & WMASK; --len)
+			*--d = *--s;
+
+		for (; len >= WSIZE; len -= WSIZE) {
+			d -= WSIZE;
+			s -= WSIZE;
+			*(nolibc_word *)d = *(const nolibc_uword *)s;
+		}
+	}
+
+	for (; len > 0; --len)
+		*--d = *--s;
+}
+
+void *memcpy(void *dst, const void *src, size_t len)
+{
+	copy_fwd(dst, src, len);
 
 	return dst;
 }
@@ -76,6 +160,31 @@ void *memcpy(void *dst, const void *src, size_t len)
 void *memset(void *ptr, int val, size_t len)
 {
 	__u8 *p = (__u8 *) ptr;
+	nolibc_word w;
+
+	if (len >= WMIN) {
+		if (nolibc_arch_memops(len)) {
+			nolibc_arch_memset(ptr, val, len);
+			return ptr;
+		}
+
+		for (; (__uptr)p & WMASK; --len)
+			*(p++) = (__u8)val;
+
+		w = WONES * (__u8)val;
+		for (; len >= 4 * WSIZE; len -= 4 * WSIZE) {
+			((nolibc_word *)p)[0] = w;
+			((nolibc_word *)p)[1] = w;
+			((nolibc_word *)p)[2] = w;
+			((nolibc_word *)p)[3] = w;
+			p += 4 * WSIZE;
+		}
+
+		for (; len >= WSIZE; len -= WSIZE) {
+			*(nolibc_word *)p = w;
+			p += WSIZE;
+		}
+	}
 
 	for (; len > 0; --len)
 		*(p++) = (__u8)val;
@@ -85,11 +194,28 @@ void *memset(void *ptr, int val, size_t len)
 
 void *memchr(const void *ptr, int val, size_t len)
 {
-	uintptr_t o = 0;
+	const __u8 *p = (const __u8 *)ptr;
+	const nolibc_word *w;
+	nolibc_word k;
 
-	for (o = 0; o < (uintptr_t)len; ++o)
-		if (*((const uint8_t *)(((uintptr_t)ptr) + o)) == (uint8_t)val)
-			return (void *)((uintptr_t)ptr + o);
+	for (; ((__uptr)p & WMASK) && len > 0; ++p, --len)
+		if (*p == (__u8)val)
+			return (void *)p;
+
+	/* Aligned words never cross a page boundary, so this never reads
+	 * beyond the page that contains the match
+	 */
+	if (len >= WSIZE) {
+		k = WONES * (__u8)val;
+		w = (const nolibc_word *)p;
+		for (; len >= WSIZE && !WHASZERO(*w ^ k); ++w, len -= WSIZE)
+			;
+		p = (const __u8 *)w;
+	}
+
+	for (; len > 0; ++p, --len)
+		if (*p == (__u8)val)
+			return (void *)p;
 
 	return NULL; /* did not find val */
 }
@@ -107,21 +233,11 @@ void *memrchr(const void *m, int c, size_t n)
 
 void *memmove(void *dst, const void *src, size_t len)
 {
-	uint8_t *d = dst;
-	const uint8_t *s = src;
-
-	if ((intptr_t)src == (intptr_t)dst) {
-		return dst;
-	} else if ((intptr_t)src > (intptr_t)dst) {
-		for (; len > 0; --len)
-			*(d++) = *(s++);
-	} else {
-		s += len - 1;
-		d += len - 1;
-
-		for (; len > 0; --len)
-			*(d--) = *(s--);
-	}
+	/* A forward copy is safe unless dst starts within src */
+	if ((__uptr)dst - (__uptr)src >= len)
+		copy_fwd(dst, src, len);
+	else if (dst != src)
+		copy_bwd(dst, src, len);
 
 	return dst;
 }
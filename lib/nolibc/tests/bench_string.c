@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include <uk/test.h>
+#include <uk/essentials.h>
+#include <uk/plat/time.h>
+
+#define BENCH_BYTES	(32UL << 20)
+
+/* Calls through volatile pointers so that the compiler cannot inline or
+ * drop the measured operations
+ */
+static void *(*volatile bench_memcpy)(void *, const void *, size_t) = memcpy;
+static void *(*volatile bench_memset)(void *, int, size_t) = memset;
+
+UK_TESTCASE(nolibc_bench, bench_memops)
+{
+	static const __sz lens[] = { 8, 64, 512, 4096, 65536, 1UL << 20 };
+	__nsec t_cpy, t_set;
+	__u8 *src, *dst;
+	__sz len, i, n;
+	unsigned int l;
+
+	src = malloc(lens[ARRAY_SIZE(lens) - 1]);
+	dst = malloc(lens[ARRAY_SIZE(lens) - 1]);
+	UK_TEST_ASSERT(src && dst);
+	memset(src, 0x5a, lens[ARRAY_SIZE(lens) - 1]);
+
+	for (l = 0; l < ARRAY_SIZE(lens); l++) {
+		len = lens[l];
+		n = BENCH_BYTES / len;
+
+		t_cpy = ukplat_monotonic_clock();
+		for (i = 0; i < n; i++)
+			bench_memcpy(dst, src, len);
+		t_cpy = ukplat_monotonic_clock() - t_cpy;
+
+		t_set = ukplat_monotonic_clock();
+		for (i = 0; i < n; i++)
+			bench_memset(dst, (int)i, len);
+		t_set = ukplat_monotonic_clock() - t_set;
+
+		uk_pr_info("%7"__PRIsz" B: memcpy %5"__PRIu64" MB/s, memset %5"__PRIu64" MB/s\n",
+			   len,
+			   (__u64)BENCH_BYTES * 1000 / MAX(t_cpy, (__nsec)1),
+			   (__u64)BENCH_BYTES * 1000 / MAX(t_set, (__nsec)1));
+	}
+
+	free(src);
+	free(dst);
+}
+
+uk_testsuite_register(nolibc_bench, NULL);
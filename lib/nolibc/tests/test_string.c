@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/essentials.h>
+
+#define BUF_LEN		4096
+#define MAX_OFF		8
+#define GUARD		0xee
+
+static __u8 src_buf[BUF_LEN + 2 * MAX_OFF];
+static __u8 dst_buf[BUF_LEN + 2 * MAX_OFF];
+static __u8 ref_buf[BUF_LEN + 2 * MAX_OFF];
+
+/* Covers every short length and samples the longer ones, which also
+ * exercise the architecture-specific bulk paths
+ */
+static __sz next_len(__sz len)
+{
+	return (len < 64) ? len + 1 : len + 37;
+}
+
+static void fill_pattern(__u8 *buf, __sz len, __u8 seed)
+{
+	__sz i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (__u8)(seed + i * 7);
+}
+
+/* Returns the number of bytes in buf that differ from ref */
+static int count_diffs(const __u8 *buf, const __u8 *ref, __sz len)
+{
+	int diffs = 0;
+	__sz i;
+
+	for (i = 0; i < len; i++)
+		diffs += (buf[i] != ref[i]);
+	return diffs;
+}
+
+UK_TESTCASE(nolibc, test_memcpy)
+{
+	unsigned int soff, doff;
+	int err = 0;
+	__sz len, i;
+
+	fill_pattern(src_buf, sizeof(src_buf), 1);
+	for (len = 0; len <= BUF_LEN; len = next_len(len)) {
+		for (soff = 0; soff < MAX_OFF; soff++) {
+			for (doff = 0; doff < MAX_OFF; doff++) {
+				memset(ref_buf, GUARD, sizeof(ref_buf));
+				for (i = 0; i < len; i++)
+					ref_buf[doff + i] = src_buf[soff + i];
+
+				memset(dst_buf, GUARD, sizeof(dst_buf));
+				UK_TEST_ASSERT(memcpy(dst_buf + doff,
+						      src_buf + soff, len)
+					       == dst_buf + doff);
+				err += count_diffs(dst_buf, ref_buf,
+						   sizeof(dst_buf));
+			}
+		}
+	}
+	UK_TEST_EXPECT_ZERO(err);
+}
+
+UK_TESTCASE(nolibc, test_memmove)
+{
+	int shift, err = 0;
+	__sz len, i;
+
+	for (len = 0; len <= BUF_LEN - 2 * MAX_OFF; len = next_len(len)) {
+		for (shift = -MAX_OFF; shift <= MAX_OFF; shift++) {
+			fill_pattern(dst_buf, sizeof(dst_buf), 3);
+			memcpy(ref_buf, dst_buf, sizeof(ref_buf));
+			for (i = 0; i < len; i++)
+				src_buf[i] = ref_buf[MAX_OFF + i];
+			for (i = 0; i < len; i++)
+				ref_buf[MAX_OFF + shift + i] = src_buf[i];
+
+			memmove(dst_buf + MAX_OFF + shift, dst_buf + MAX_OFF,
+				len);
+			err += count_diffs(dst_buf, ref_buf, sizeof(dst_buf));
+		}
+	}
+	UK_TEST_EXPECT_ZERO(err);
+}
+
+UK_TESTCASE(nolibc, test_memset)
+{
+	unsigned int off;
+	int err = 0;
+	__sz len, i;
+
+	for (len = 0; len <= BUF_LEN; len = next_len(len)) {
+		for (off = 0; off < MAX_OFF; off++) {
+			memset(ref_buf, GUARD, sizeof(ref_buf));
+			for (i = 0; i < len; i++)
+				ref_buf[off + i] = 0xa5;
+
+			memset(dst_buf, GUARD, sizeof(dst_buf));
+			/* Only the lowest byte of the value is used */
+			memset(dst_buf + off, 0x1a5, len);
+			err += count_diffs(dst_buf, ref_buf, sizeof(dst_buf));
+		}
+	}
+	UK_TEST_EXPECT_ZERO(err);
+}
+
+UK_TESTCASE(nolibc, test_memchr)
+{
+	static const __u8 vals[] = { 0x00, 0x01, 0x7f, 0x80, 0xff };
+	unsigned int off, v;
+	int err = 0;
+	__sz len, pos;
+
+	for (v = 0; v < ARRAY_SIZE(vals); v++) {
+		/* Neighbors differ from the searched value by one bit */
+		memset(src_buf, vals[v] ^ 0x01, sizeof(src_buf));
+		for (len = 0; len <= 256; len++) {
+			for (off = 0; off < MAX_OFF; off++) {
+				err += (memchr(src_buf + off, vals[v], len)
+					!= NULL);
+
+				for (pos = 0; pos < len; pos += 13) {
+					src_buf[off + pos] = vals[v];
+					/* A match behind the range is ignored */
+					src_buf[off + len] = vals[v];
+					err += (memchr(src_buf + off, vals[v],
+						       len)
+						!= src_buf + off + pos);
+					src_buf[off + pos] = vals[v] ^ 0x01;
+					src_buf[off + len] = vals[v] ^ 0x01;
+				}
+			}
+		}
+	}
+	UK_TEST_EXPECT_ZERO(err);
+}
+
+uk_testsuite_register(nolibc, NULL);
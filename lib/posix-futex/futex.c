@@ -49,16 +49,17 @@
 #include <uk/syscall.h>
 #include <uk/atomic.h>
 #include <uk/thread.h>
-#include <uk/thread.h>
 #include <uk/list.h>
 #if CONFIG_LIBPOSIX_PROCESS_CLONE
 #include <uk/process.h>
 #endif /* CONFIG_LIBPOSIX_PROCESS_CLONE */
 #include <uk/sched.h>
-#include <uk/list.h>
+#include <uk/ctors.h>
+#include <uk/essentials.h>
 #include <uk/assert.h>
 #include <uk/print.h>
 #include <uk/spinlock.h>
+#include <uk/arch/lcpu.h>
 #include <uk/plat/lcpu.h>
 #include <uk/plat/time.h>
 
@@ -67,42 +68,179 @@
  */
 struct uk_futex {
 	uint32_t *uaddr; /** The futex address. */
+	uint32_t bitset; /** Wake-ups must share a bit with this mask. */
+	uint32_t tid; /** TID of the thread if it waits for a PI futex,
+		       * 0 otherwise.
+		       */
 	struct uk_thread *thread; /** The thread waiting on the futex. */
-	struct uk_list_head list_node; /** The list containing all the futexes
-					 * on which the threads are waiting.
+	struct uk_list_head list_node; /** The wait queue of the bucket of
+					 * the futex address. Wakers remove
+					 * the futexes that they wake up.
 					 */
 };
 
-static UK_LIST_HEAD(futex_list);
-static uk_spinlock futex_list_lock = UK_SPINLOCK_INITIALIZER();
+/** @struct uk_futex_bucket
+ *  @brief Wait queue shared by all futex addresses that hash to it.
+ */
+struct uk_futex_bucket {
+	uk_spinlock lock;
+	struct uk_list_head waiters;
+} __align(CACHE_LINE_SIZE);
+
+#define FUTEX_HASH_ORDER	CONFIG_LIBPOSIX_FUTEX_HASH_ORDER
+
+static struct uk_futex_bucket futex_buckets[1UL << FUTEX_HASH_ORDER];
+
+static void futex_buckets_init(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < ARRAY_SIZE(futex_buckets); i++) {
+		uk_spin_init(&futex_buckets[i].lock);
+		UK_INIT_LIST_HEAD(&futex_buckets[i].waiters);
+	}
+}
+UK_CTOR(futex_buckets_init);
+
+static inline struct uk_futex_bucket *futex_bucket(const uint32_t *uaddr)
+{
+	/* Fibonacci hashing of the index of the futex word */
+	uint64_t key = (uintptr_t)uaddr / sizeof(*uaddr);
+
+	return &futex_buckets[(key * 0x9e3779b97f4a7c15ULL) >>
+			      (64 - FUTEX_HASH_ORDER)];
+}
+
+/*
+ * Locks the bucket that a waiter is queued in. Requeueing changes the address
+ * of a waiter only with the locks of both buckets held, so the bucket cannot
+ * change anymore once we hold the lock of the bucket of the current address.
+ */
+static struct uk_futex_bucket *futex_lock_waiter(struct uk_futex *f,
+						 unsigned long *irqf)
+{
+	struct uk_futex_bucket *b;
+
+	for (;;) {
+		b = futex_bucket(uk_load_n(&f->uaddr));
+		uk_spin_lock_irqsave(&b->lock, *irqf);
+		if (b == futex_bucket(f->uaddr))
+			return b;
+		uk_spin_unlock_irqrestore(&b->lock, *irqf);
+	}
+}
+
+/* Locks two buckets in address order to prevent deadlocks */
+static void futex_lock_pair(struct uk_futex_bucket *b1,
+			    struct uk_futex_bucket *b2, unsigned long *irqf)
+{
+	*irqf = ukplat_lcpu_save_irqf();
+	if (b1 > b2) {
+		uk_spin_lock(&b2->lock);
+		uk_spin_lock(&b1->lock);
+	} else {
+		uk_spin_lock(&b1->lock);
+		if (b2 != b1)
+			uk_spin_lock(&b2->lock);
+	}
+}
+
+static void futex_unlock_pair(struct uk_futex_bucket *b1,
+			      struct uk_futex_bucket *b2, unsigned long irqf)
+{
+	if (b2 != b1)
+		uk_spin_unlock(&b2->lock);
+	uk_spin_unlock(&b1->lock);
+	ukplat_lcpu_restore_irqf(irqf);
+}
+
+/* Dequeues and wakes up a waiter. The bucket lock must be held. */
+static void futex_wake_one(struct uk_futex *f)
+{
+	uk_list_del_init(&f->list_node);
+
+	/* TODO: Replace with uk_thread_wakeup when the new
+	 * scheduler API is ready
+	 */
+	uk_thread_wake(f->thread);
+}
+
+/*
+ * Blocks the current thread until it is dequeued by a waker or the timeout
+ * expires. Must be called with the bucket lock held, which is released.
+ * Blocking before the lock is released ensures that a wake-up is not lost.
+ *
+ * @return
+ *	0: the thread was woken up;
+ *	-ETIMEDOUT: the futex timed out
+ */
+static int futex_block(struct uk_futex_bucket *b, struct uk_futex *f,
+		       const __nsec *timeout, unsigned long irqf)
+{
+	uk_list_add_tail(&f->list_node, &b->waiters);
+
+	if (timeout) {
+		/* Block at most until `timeout` nanosecs */
+		uk_pr_debug("FUTEX: Wait %"__PRIsnsec" nsec for wake-up\n",
+			    (__snsec) (*timeout));
+		uk_thread_block_until(f->thread, (__snsec) (*timeout));
+	} else {
+		/* Block indefinitely */
+		uk_pr_debug("FUTEX: Wait indefinitely for wake-up\n");
+		uk_thread_block(f->thread);
+	}
+	uk_spin_unlock_irqrestore(&b->lock, irqf);
+	uk_sched_yield();
+
+	uk_pr_debug("FUTEX: Woke up (uaddr: %p)\n", f->uaddr);
+	b = futex_lock_waiter(f, &irqf);
+
+	/* If the futex is still in the wait queue, then it timed out */
+	if (!uk_list_empty(&f->list_node)) {
+		uk_list_del(&f->list_node);
+		uk_spin_unlock_irqrestore(&b->lock, irqf);
+
+		uk_pr_debug("FUTEX: Woke up because of timeout\n");
+		return -ETIMEDOUT;
+	}
+	uk_spin_unlock_irqrestore(&b->lock, irqf);
+
+	return 0;
+}
 
 /**
  * Prepare to wait on a futex.
  *
  * Get the futex value atomically and compare it with the expected value. Add
- * the thread to the wait list and then block it if the value is equal to the
- * expected one. If the futex was not removed from the list when the thread was
- * unblocked, then it means that it timed out.
+ * the thread to the wait queue and then block it if the value is equal to the
+ * expected one. The comparison is done with the bucket lock held, so that a
+ * concurrent wake-up either sees the waiter or happens before the comparison.
  *
  * @param uaddr		The futex userspace address
  * @param val		The expected value
  * @param timeout	The deadline until the function will block at most.
  * 			If it is NULL, the thread will wait indefinitely.
+ * @param bitset	Wake-ups that share no bit with bitset are ignored
  *
  * @return
  *	0: uaddr contains val and the thread finished waiting;
  *	<1: -EAGAIN (uaddr does not contain val) or -ETIMEDOUT (the futex timed
  *       out)
  */
-static int futex_wait(uint32_t *uaddr, uint32_t val, const __nsec *timeout)
+static int futex_wait(uint32_t *uaddr, uint32_t val, const __nsec *timeout,
+		      uint32_t bitset)
 {
 	unsigned long irqf;
-	struct uk_list_head *itr, *tmp;
-	struct uk_futex *f_tmp;
-	struct uk_thread *current = uk_thread_current();
-	struct uk_futex f = {.uaddr = uaddr, .thread = current};
-
+	struct uk_futex_bucket *b = futex_bucket(uaddr);
+	struct uk_futex f = {
+		.uaddr = uaddr,
+		.bitset = bitset,
+		.thread = uk_thread_current()
+	};
+
+	uk_spin_lock_irqsave(&b->lock, irqf);
 	if (uk_load_n(uaddr) != val) {
+		uk_spin_unlock_irqrestore(&b->lock, irqf);
 		uk_pr_debug("FUTEX_WAIT: Condition not met (*uaddr != %"PRIu32", uaddr: %p)\n",
 			    val, uaddr);
 		return -EAGAIN;
@@ -112,83 +250,36 @@ static int futex_wait(uint32_t *uaddr, uint32_t val, const __nsec *timeout)
 	uk_pr_debug("FUTEX_WAIT: Condition met (*uaddr == %"PRIu32", uaddr: %p)\n",
 			val, uaddr);
 
-	/* Enqueue thread to wait list */
-	irqf = ukplat_lcpu_save_irqf();
-	uk_spin_lock(&futex_list_lock);
-	uk_list_add_tail(&f.list_node, &futex_list);
-	uk_spin_unlock(&futex_list_lock);
-	ukplat_lcpu_restore_irqf(irqf);
-
-	if (timeout) {
-		/* Block at most until `timeout` nanosecs */
-		uk_pr_debug("FUTEX_WAIT: Wait %"__PRIsnsec" nsec for wake-up\n",
-				(__snsec) (*timeout));
-		uk_thread_block_until(current, (__snsec) (*timeout));
-	} else {
-		/* Block indefinitely */
-		uk_pr_debug("FUTEX_WAIT: Wait indefinitely for wake-up\n");
-		uk_thread_block(current);
-	}
-	uk_sched_yield();
-
-	uk_pr_debug("FUTEX_WAIT: Woke up (uaddr: %p)\n", uaddr);
-	irqf = ukplat_lcpu_save_irqf();
-	uk_spin_lock(&futex_list_lock);
-
-	/* If the futex is still in the wait list, then it timed out */
-	uk_list_for_each_safe(itr, tmp, &futex_list) {
-		f_tmp = uk_list_entry(itr, struct uk_futex, list_node);
-
-		if (f_tmp->uaddr == uaddr && f_tmp->thread == current) {
-			/* Remove the thread from the futex list */
-			uk_list_del(&f_tmp->list_node);
-			uk_spin_unlock(&futex_list_lock);
-			ukplat_lcpu_restore_irqf(irqf);
-
-			uk_pr_debug("FUTEX_WAIT: Woke up because of timeout\n");
-			return -ETIMEDOUT;
-		}
-	}
-	uk_spin_unlock(&futex_list_lock);
-	ukplat_lcpu_restore_irqf(irqf);
-
-	return 0;
+	return futex_block(b, &f, timeout, irqf);
 }
 
 /**
  * Wake up threads waiting on a futex.
  *
- * Find val threads in the wait list for the futex, remove the futexes from the
- * list and wake up the threads.
+ * Find val threads in the wait queue for the futex, remove the futexes from
+ * the queue and wake up the threads. Only the bucket of the futex is scanned.
  *
- * @param uaddr	The futex userspace address
- * @param val	The number of threads waiting on the futex to be woken up
+ * @param uaddr		The futex userspace address
+ * @param val		The number of threads waiting on the futex to be woken
+ *			up
+ * @param bitset	Only waiters that share a bit with bitset are woken up
  *
  * @return
  *	0: no threads were woken up;
  *	>0: the number of threads woken up
  */
-static int futex_wake(uint32_t *uaddr, uint32_t val)
+static int futex_wake(uint32_t *uaddr, uint32_t val, uint32_t bitset)
 {
 	unsigned long irqf;
-	struct uk_list_head *itr, *tmp;
-	struct uk_futex *f;
+	struct uk_futex_bucket *b = futex_bucket(uaddr);
+	struct uk_futex *f, *tmp;
 	uint32_t count = 0;
 
-	irqf = ukplat_lcpu_save_irqf();
-	uk_spin_lock(&futex_list_lock);
+	uk_spin_lock_irqsave(&b->lock, irqf);
 
-	uk_list_for_each_safe(itr, tmp, &futex_list) {
-		f = uk_list_entry(itr, struct uk_futex, list_node);
-
-		if (f->uaddr == uaddr) {
-			/* Remove the thread from the futex list */
-			uk_list_del(&f->list_node);
-
-			/* TODO: Replace with uk_thread_wakeup when the new
-			 * scheduler API is ready
-			 */
-			uk_thread_wake(f->thread);
+	uk_list_for_each_entry_safe(f, tmp, &b->waiters, list_node) {
+		if (f->uaddr == uaddr && !f->tid && (f->bitset & bitset)) {
+			futex_wake_one(f);
 
 			/* Wake at most val threads */
 			if (++count >= val)
@@ -196,8 +287,7 @@ static int futex_wake(uint32_t *uaddr, uint32_t val)
 		}
 	}
 
-	uk_spin_unlock(&futex_list_lock);
-	ukplat_lcpu_restore_irqf(irqf);
+	uk_spin_unlock_irqrestore(&b->lock, irqf);
 
 	return (int) count;
 }
@@ -216,54 +306,181 @@ static int futex_wake(uint32_t *uaddr, uint32_t val)
  * @param val		Number of waiters to wake
  * @param val2		Number of waiters to requeue (0-INT_MAX)
  * @param uaddr2	Target futex user address
- * @param val3		uaddr expected value
+ * @param val3		uaddr expected value, NULL to requeue unconditionally
  *
  * @return
  *	>=0: on success, the number of tasks requeued or woken;
  *	<0: on error
  */
-static int futex_cmp_requeue(uint32_t *uaddr, uint32_t val, uint32_t val2,
-			     uint32_t *uaddr2, uint32_t val3)
+static int futex_requeue(uint32_t *uaddr, uint32_t val, uint32_t val2,
+			 uint32_t *uaddr2, const uint32_t *val3)
 {
 	unsigned long irqf;
-	struct uk_list_head *itr, *tmp;
-	struct uk_futex *f;
-	int woken_uaddr1;
+	struct uk_futex_bucket *b1 = futex_bucket(uaddr);
+	struct uk_futex_bucket *b2 = futex_bucket(uaddr2);
+	struct uk_futex *f, *tmp;
+	uint32_t woken_uaddr1 = 0;
 	uint32_t waiters_uaddr2 = 0;
 
-	if (!((uint32_t)val3 == uk_load_n(uaddr)))
-		return -EAGAIN;
+	futex_lock_pair(b1, b2, &irqf);
 
-	/* Wake up val waiters on uaddr */
-	woken_uaddr1 = futex_wake(uaddr, val);
+	if (val3 && *val3 != uk_load_n(uaddr)) {
+		futex_unlock_pair(b1, b2, irqf);
+		return -EAGAIN;
+	}
 
-	if (!val2)
-		return woken_uaddr1;
+	uk_list_for_each_entry_safe(f, tmp, &b1->waiters, list_node) {
+		if (f->uaddr != uaddr || f->tid)
+			continue;
 
-	irqf = ukplat_lcpu_save_irqf();
-	uk_spin_lock(&futex_list_lock);
+		/* Wake up val waiters on uaddr */
+		if (woken_uaddr1 < val) {
+			futex_wake_one(f);
+			woken_uaddr1++;
+			continue;
+		}
 
-	/* Requeue val2 waiters on uaddr2 */
-	uk_list_for_each_safe(itr, tmp, &futex_list) {
-		f = uk_list_entry(itr, struct uk_futex, list_node);
+		/* Requeue at most val2 threads */
+		if (waiters_uaddr2 >= val2)
+			break;
 
-		if (f->uaddr == uaddr) {
-			/* Requeue thread to uaddr2 */
+		uk_store_n(&f->uaddr, uaddr2);
+		if (b2 != b1) {
 			uk_list_del(&f->list_node);
-			f->uaddr = uaddr2;
-			uk_list_add_tail(&f->list_node, &futex_list);
+			uk_list_add_tail(&f->list_node, &b2->waiters);
+		}
+		waiters_uaddr2++;
+	}
+
+	futex_unlock_pair(b1, b2, irqf);
 
-			/* Requeue at most val2 threads */
-			if (++waiters_uaddr2 >= val2)
+	return (int) (woken_uaddr1 + waiters_uaddr2);
+}
+
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+/**
+ * Acquire a PI futex.
+ *
+ * The futex word holds the TID of the owner, or 0 if the futex is free. The
+ * FUTEX_WAITERS bit tells the owner to release the futex with FUTEX_UNLOCK_PI,
+ * which hands the futex over to the first waiter. Our schedulers have no
+ * thread priorities, so there are no priorities to inherit. Owners that
+ * exit without releasing the futex are not detected.
+ *
+ * @param uaddr		The futex userspace address
+ * @param timeout	The deadline until the function will block at most.
+ *			If it is NULL, the thread will wait indefinitely.
+ * @param trylock	Fail instead of blocking if the futex is owned
+ *
+ * @return
+ *	0: the calling thread owns the futex;
+ *	<0: -EDEADLK (the caller already owns the futex), -EAGAIN (trylock
+ *	    of an owned futex) or -ETIMEDOUT (the futex timed out)
+ */
+static int futex_lock_pi(uint32_t *uaddr, const __nsec *timeout, int trylock)
+{
+	unsigned long irqf;
+	struct uk_futex_bucket *b = futex_bucket(uaddr);
+	struct uk_futex f = {
+		.uaddr = uaddr,
+		.bitset = FUTEX_BITSET_MATCH_ANY,
+		.thread = uk_thread_current()
+	};
+	pid_t tid = uk_syscall_r_gettid();
+	uint32_t v;
+
+	if (tid < 0)
+		return tid;
+	f.tid = tid;
+
+	uk_spin_lock_irqsave(&b->lock, irqf);
+	v = uk_load_n(uaddr);
+	for (;;) {
+		if ((v & FUTEX_TID_MASK) == f.tid) {
+			uk_spin_unlock_irqrestore(&b->lock, irqf);
+			return -EDEADLK;
+		}
+
+		/* Take over a free futex, keeping the waiters bit */
+		if (!(v & FUTEX_TID_MASK)) {
+			if (uk_compare_exchange_n(uaddr, &v,
+						  (v & ~FUTEX_TID_MASK) | f.tid))
 				break;
+			continue;
+		}
+
+		if (trylock) {
+			uk_spin_unlock_irqrestore(&b->lock, irqf);
+			return -EAGAIN;
+		}
+
+		/* Make the owner enter the kernel on release */
+		if ((v & FUTEX_WAITERS) ||
+		    uk_compare_exchange_n(uaddr, &v, v | FUTEX_WAITERS)) {
+			uk_pr_debug("FUTEX_LOCK_PI: Owned by %"PRIu32" (uaddr: %p)\n",
+				    v & FUTEX_TID_MASK, uaddr);
+
+			/* The futex is ours if we are woken up */
+			return futex_block(b, &f, timeout, irqf);
 		}
 	}
+	uk_spin_unlock_irqrestore(&b->lock, irqf);
 
-	uk_spin_unlock(&futex_list_lock);
-	ukplat_lcpu_restore_irqf(irqf);
+	return 0;
+}
+
+/**
+ * Release a PI futex.
+ *
+ * The futex is handed over to the first thread that waits for it, or is
+ * released if there are no waiters.
+ *
+ * @param uaddr		The futex userspace address
+ *
+ * @return
+ *	0: the futex was released;
+ *	<0: -EPERM (the calling thread does not own the futex)
+ */
+static int futex_unlock_pi(uint32_t *uaddr)
+{
+	unsigned long irqf;
+	struct uk_futex_bucket *b = futex_bucket(uaddr);
+	struct uk_futex *f, *next = NULL;
+	pid_t tid = uk_syscall_r_gettid();
+	uint32_t waiters = 0;
+
+	if (tid < 0)
+		return tid;
+
+	uk_spin_lock_irqsave(&b->lock, irqf);
+	if ((uk_load_n(uaddr) & FUTEX_TID_MASK) != (uint32_t) tid) {
+		uk_spin_unlock_irqrestore(&b->lock, irqf);
+		return -EPERM;
+	}
+
+	uk_list_for_each_entry(f, &b->waiters, list_node) {
+		if (f->uaddr != uaddr || !f->tid)
+			continue;
+		if (next) {
+			waiters = FUTEX_WAITERS;
+			break;
+		}
+		next = f;
+	}
+
+	if (next) {
+		uk_pr_debug("FUTEX_UNLOCK_PI: Hand over to %"PRIu32" (uaddr: %p)\n",
+			    next->tid, uaddr);
+		uk_store_n(uaddr, next->tid | waiters);
+		futex_wake_one(next);
+	} else {
+		uk_store_n(uaddr, 0);
+	}
+	uk_spin_unlock_irqrestore(&b->lock, irqf);
 
-	return woken_uaddr1 + waiters_uaddr2;
+	return 0;
 }
+#endif /* CONFIG_LIBPOSIX_PROCESS_PIDS */
 
 /**
  * According to man pages, there exists no libc wrapper for futex
@@ -311,33 +528,57 @@ UK_LLSYSCALL_R_DEFINE(int, futex, uint32_t *, uaddr, int, futex_op,
 			timeout_ns = ukplat_monotonic_clock() +
 				     ukarch_time_sec_to_nsec(timeout->tv_sec) +
 				     timeout->tv_nsec;
-		return futex_wait(uaddr, val, timeout ? &timeout_ns : NULL);
+		return futex_wait(uaddr, val, timeout ? &timeout_ns : NULL,
+				  FUTEX_BITSET_MATCH_ANY);
 
 	case FUTEX_WAIT_BITSET:
-		/*
-		 * Special case implementation for cases where the val3/mask has
-		 * all bits set. Some applications do this to use the absolute
-		 * timeout mode. We return ENOSYS for all non-supported calls.
-		 */
-		if (val3 != UINT32_MAX)
-			return -ENOSYS;
+		if (!val3)
+			return -EINVAL;
 
+		/* `timeout` is absolute */
 		if (timeout)
 			timeout_ns = ukarch_time_sec_to_nsec(timeout->tv_sec)
 				     + timeout->tv_nsec;
 
-		return futex_wait(uaddr, val, timeout ? &timeout_ns : NULL);
+		return futex_wait(uaddr, val, timeout ? &timeout_ns : NULL,
+				  val3);
 
 	case FUTEX_WAKE:
-		return futex_wake(uaddr, val);
+		return futex_wake(uaddr, val, FUTEX_BITSET_MATCH_ANY);
+
+	case FUTEX_WAKE_BITSET:
+		if (!val3)
+			return -EINVAL;
+
+		return futex_wake(uaddr, val, val3);
 
-	case FUTEX_FD:
 	case FUTEX_REQUEUE:
-		return -ENOSYS;
+		return futex_requeue(uaddr, val, (unsigned long)timeout,
+				     uaddr2, NULL);
 
 	case FUTEX_CMP_REQUEUE:
-		return futex_cmp_requeue(uaddr, val, (unsigned long)timeout,
-					 uaddr2, val3);
+		return futex_requeue(uaddr, val, (unsigned long)timeout,
+				     uaddr2, &val3);
+
+#if CONFIG_LIBPOSIX_PROCESS_PIDS
+	case FUTEX_LOCK_PI:
+	case FUTEX_LOCK_PI2:
+		/* `timeout` is absolute */
+		if (timeout)
+			timeout_ns = ukarch_time_sec_to_nsec(timeout->tv_sec)
+				     + timeout->tv_nsec;
+
+		return futex_lock_pi(uaddr, timeout ? &timeout_ns : NULL, 0);
+
+	case FUTEX_TRYLOCK_PI:
+		return futex_lock_pi(uaddr, NULL, 1);
+
+	case FUTEX_UNLOCK_PI:
+		return futex_unlock_pi(uaddr);
+#endif /* CONFIG_LIBPOSIX_PROCESS_PIDS */
+
+	case FUTEX_FD:
+		return -ENOSYS;
 
 	default:
 		return -ENOSYS;
@@ -387,7 +628,8 @@ static void pfutex_child_cleartid_term(struct uk_thread *child __unused)
 {
 	if (child_tid_clear_ref != NULL) {
 		*((pid_t *) child_tid_clear_ref) = 0;
-		futex_wake((uint32_t *) child_tid_clear_ref, 0);
+		futex_wake((uint32_t *) child_tid_clear_ref, 0,
+			   FUTEX_BITSET_MATCH_ANY);
 	}
 }
 UK_THREAD_INIT_PRIO(0x0, pfutex_child_cleartid_term, UK_PRIO_EARLIEST);
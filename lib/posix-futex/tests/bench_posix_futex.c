@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Authors: Adina Smeu <adina.smeu@gmail.com>
+ *
+ *
+ * Copyright (c) 2022 Adina Smeu <adina.smeu@gmail.com>
+ *                     All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <uk/test.h>
+
+#include <time.h>
+
+#include <linux/futex.h>
+#include <uk/atomic.h>
+#include <uk/syscall.h>
+#include <uk/sched.h>
+#include <uk/plat/time.h>
+
+#if defined(__X86_32__) || defined(__x86_64__)
+#define NR_FUTEX	202
+#elif (defined __ARM_32__) || (defined __ARM_64__)
+#define NR_FUTEX	240
+#endif
+
+static int futex(uint32_t *uaddr, int futex_op, uint32_t val,
+		 const struct timespec *timeout, uint32_t *uaddr2,
+		 uint32_t val3)
+{
+	return uk_syscall(NR_FUTEX, uaddr, futex_op, val, timeout, uaddr2,
+			  val3);
+}
+
+static void wait_thread(struct uk_thread *t)
+{
+	while (!uk_thread_is_exited(t))
+		uk_sched_yield();
+}
+
+#define BENCH_CONTENDERS	4
+#define BENCH_PARKED		16
+#define BENCH_ITERATIONS	10000
+
+struct bench_args {
+	uint32_t *lock;
+	uint32_t *counter;
+};
+
+/* Mutex from "Futexes Are Tricky": 0 free, 1 locked, 2 locked and
+ * contended
+ */
+static void bench_mutex_lock(uint32_t *lock)
+{
+	uint32_t c = 0;
+
+	if (uk_compare_exchange_n(lock, &c, 1))
+		return;
+	if (c != 2)
+		c = uk_exchange_n(lock, 2);
+	while (c) {
+		futex(lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+		c = uk_exchange_n(lock, 2);
+	}
+}
+
+static void bench_mutex_unlock(uint32_t *lock)
+{
+	if (uk_exchange_n(lock, 0) == 2)
+		futex(lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static __noreturn void bench_contender_func(void *arg)
+{
+	struct bench_args *args = (struct bench_args *)arg;
+	int i;
+
+	for (i = 0; i < BENCH_ITERATIONS; ++i) {
+		bench_mutex_lock(args->lock);
+		++(*args->counter);
+		/* Let the other contenders find the mutex locked */
+		uk_sched_yield();
+		bench_mutex_unlock(args->lock);
+	}
+	uk_sched_thread_exit();
+}
+
+static __noreturn void bench_parked_func(void *arg)
+{
+	futex((uint32_t *)arg, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+	uk_sched_thread_exit();
+}
+
+/**
+ * Contended mutex while unrelated threads wait on other futexes. The wait
+ * queues of the other futexes should not slow down the mutex.
+ */
+UK_TESTCASE(posix_futex_bench, bench_futex_contention)
+{
+	uint32_t lock = 0, counter = 0;
+	uint32_t parked_vals[BENCH_PARKED] = { 0 };
+	struct uk_thread *contenders[BENCH_CONTENDERS];
+	struct uk_thread *parked[BENCH_PARKED];
+	struct bench_args args = { .lock = &lock, .counter = &counter };
+	__nsec t0, t1;
+	int i, woken = 0;
+
+	for (i = 0; i < BENCH_PARKED; ++i) {
+		parked[i] = uk_sched_thread_create(uk_sched_current(),
+				bench_parked_func, parked_vals + i, "Parked");
+		UK_TEST_ASSERT(parked[i] != NULL);
+	}
+	uk_sched_yield();
+
+	t0 = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_CONTENDERS; ++i) {
+		contenders[i] = uk_sched_thread_create(uk_sched_current(),
+				bench_contender_func, &args, "Contender");
+		UK_TEST_ASSERT(contenders[i] != NULL);
+	}
+	for (i = 0; i < BENCH_CONTENDERS; ++i)
+		wait_thread(contenders[i]);
+	t1 = ukplat_monotonic_clock();
+	UK_TEST_EXPECT_SNUM_EQ(counter, BENCH_CONTENDERS * BENCH_ITERATIONS);
+
+	for (i = 0; i < BENCH_PARKED; ++i) {
+		parked_vals[i] = 1;
+		woken += futex(parked_vals + i, FUTEX_WAKE_PRIVATE, 1, NULL,
+			       NULL, 0);
+		wait_thread(parked[i]);
+	}
+	UK_TEST_EXPECT_SNUM_EQ(woken, BENCH_PARKED);
+
+	uk_pr_info("bench_futex_contention: %"__PRInsec" ns per lock/unlock (%d threads, %d parked waiters)\n",
+		   (t1 - t0) / (BENCH_CONTENDERS * BENCH_ITERATIONS),
+		   BENCH_CONTENDERS, BENCH_PARKED);
+}
+
+uk_testsuite_register(posix_futex_bench, NULL);
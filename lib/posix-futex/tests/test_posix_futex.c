@@ -52,6 +52,7 @@ struct test_args {
 	uint32_t val;
 	uint32_t nr_wake;
 	uint64_t nr_requeue;
+	uint32_t bitset;
 
 	uint32_t *futex_val;
 	uint32_t *requeue_futex_val;
@@ -442,4 +443,179 @@ UK_TESTCASE(posix_futex_testsuite, test_cmp_requeue_two_waiters_one_waker)
 	UK_TEST_EXPECT_SNUM_EQ(var_to_change, 3);
 }
 
+/**
+ * Wait on the futex with the bitset of the arguments.
+ */
+static __noreturn void bitset_waiter_func(void *arg)
+{
+	struct test_args *args = (struct test_args *)arg;
+
+	args->rets[0] = futex(args->futex_val, FUTEX_WAIT_BITSET, args->val,
+			      NULL, NULL, args->bitset);
+	uk_sched_thread_exit();
+}
+
+UK_TESTCASE(posix_futex_testsuite, test_bitset_zero)
+{
+	uint32_t futex_val = 0;
+	int ret;
+
+	ret = futex(&futex_val, FUTEX_WAIT_BITSET, 0, NULL, NULL, 0);
+	UK_TEST_EXPECT_SNUM_EQ(ret, -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, EINVAL);
+
+	ret = futex(&futex_val, FUTEX_WAKE_BITSET, 1, NULL, NULL, 0);
+	UK_TEST_EXPECT_SNUM_EQ(ret, -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, EINVAL);
+}
+
+UK_TESTCASE(posix_futex_testsuite, test_wake_bitset)
+{
+	uint32_t futex_val = 0;
+	int rets[2] = { -1, -1 };
+	struct uk_thread *threads[2];
+	struct test_args args[2];
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		args[i] = (struct test_args){
+			.futex_val = &futex_val,
+			.val = 0,
+			.bitset = 1 << i,
+			.rets = rets + i,
+		};
+		threads[i] = uk_sched_thread_create(uk_sched_current(),
+				bitset_waiter_func, args + i, "Waiter");
+	}
+
+	/* Let both threads block */
+	uk_sched_yield();
+
+	/* Only waiters that share a bit with the mask are woken */
+	UK_TEST_EXPECT_ZERO(futex(&futex_val, FUTEX_WAKE_BITSET, 2, NULL,
+				  NULL, 4));
+	UK_TEST_EXPECT_SNUM_EQ(futex(&futex_val, FUTEX_WAKE_BITSET, 2, NULL,
+				     NULL, 2), 1);
+	wait_thread(threads[1]);
+	UK_TEST_EXPECT_ZERO(rets[1]);
+	UK_TEST_EXPECT_SNUM_EQ(rets[0], -1);
+
+	/* FUTEX_WAKE matches all bitsets */
+	UK_TEST_EXPECT_SNUM_EQ(futex(&futex_val, FUTEX_WAKE, 2, NULL, NULL, 0),
+			       1);
+	wait_thread(threads[0]);
+	UK_TEST_EXPECT_ZERO(rets[0]);
+}
+
+UK_TESTCASE(posix_futex_testsuite, test_requeue)
+{
+	uint32_t i;
+	uint32_t futex_val = 0;
+	uint32_t requeue_futex_val = 0;
+	uint32_t var_to_change = 0;
+	uint32_t var_to_change_vals[3][1];
+	int rets[3][1];
+	struct uk_thread *threads[3];
+	struct test_args args[3];
+
+	for (i = 0; i < 3; ++i) {
+		args[i] = (struct test_args){
+			.futex_val = &futex_val,
+			.var_to_change = &var_to_change,
+			.var_to_change_vals = var_to_change_vals[i],
+			.rets = rets[i],
+			.num_iterations = 1,
+		};
+		threads[i] = uk_sched_thread_create(uk_sched_current(),
+				waiter_func, args + i, "Waiter");
+	}
+	uk_sched_yield();
+
+	/* Wake one waiter and move the others without comparing the value */
+	futex_val = 1;
+	UK_TEST_EXPECT_SNUM_EQ(futex(&futex_val, FUTEX_REQUEUE, 1,
+				     (struct timespec *)2, &requeue_futex_val,
+				     0), 3);
+	UK_TEST_EXPECT_ZERO(futex(&futex_val, FUTEX_WAKE, 2, NULL, NULL, 0));
+	UK_TEST_EXPECT_SNUM_EQ(futex(&requeue_futex_val, FUTEX_WAKE, 2, NULL,
+				     NULL, 0), 2);
+
+	for (i = 0; i < 3; ++i) {
+		wait_thread(threads[i]);
+		UK_TEST_EXPECT_ZERO(rets[i][0]);
+	}
+	UK_TEST_EXPECT_SNUM_EQ(var_to_change, 3);
+}
+
+/**
+ * Acquire and release the PI futex of the arguments.
+ */
+static __noreturn void pi_locker_func(void *arg)
+{
+	struct test_args *args = (struct test_args *)arg;
+
+	args->rets[0] = futex(args->futex_val, FUTEX_LOCK_PI, 0, NULL, NULL,
+			      0);
+	args->var_to_change_vals[0] = uk_load_n(args->futex_val);
+	++(*args->var_to_change);
+	args->rets[1] = futex(args->futex_val, FUTEX_UNLOCK_PI, 0, NULL, NULL,
+			      0);
+	uk_sched_thread_exit();
+}
+
+UK_TESTCASE(posix_futex_testsuite, test_pi)
+{
+	uint32_t futex_val = 0;
+	uint32_t var_to_change = 0;
+	uint32_t owner, var_to_change_vals[1];
+	int rets[2] = { -1, -1 };
+	struct uk_thread *thread;
+	struct test_args args;
+	int ret;
+
+	/* PI futexes need thread IDs */
+	ret = futex(&futex_val, FUTEX_TRYLOCK_PI, 0, NULL, NULL, 0);
+	if (ret && (errno == ENOSYS || errno == ENOTSUP))
+		return;
+
+	UK_TEST_EXPECT_ZERO(ret);
+	owner = futex_val & FUTEX_TID_MASK;
+	UK_TEST_EXPECT_NOT_ZERO(owner);
+	UK_TEST_EXPECT_ZERO(futex_val & FUTEX_WAITERS);
+
+	ret = futex(&futex_val, FUTEX_TRYLOCK_PI, 0, NULL, NULL, 0);
+	UK_TEST_EXPECT_SNUM_EQ(ret, -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, EDEADLK);
+
+	/* A contender marks the futex and gets it handed over */
+	args = (struct test_args){
+		.futex_val = &futex_val,
+		.var_to_change = &var_to_change,
+		.var_to_change_vals = var_to_change_vals,
+		.rets = rets,
+	};
+	thread = uk_sched_thread_create(uk_sched_current(), pi_locker_func,
+					&args, "PI locker");
+	uk_sched_yield();
+	UK_TEST_EXPECT_SNUM_EQ(futex_val, owner | FUTEX_WAITERS);
+	UK_TEST_EXPECT_ZERO(var_to_change);
+
+	UK_TEST_EXPECT_ZERO(futex(&futex_val, FUTEX_UNLOCK_PI, 0, NULL, NULL,
+				  0));
+	UK_TEST_EXPECT_NOT_ZERO(futex_val & FUTEX_TID_MASK);
+	UK_TEST_EXPECT_SNUM_NQ(futex_val & FUTEX_TID_MASK, owner);
+
+	/* The futex is no longer ours */
+	ret = futex(&futex_val, FUTEX_UNLOCK_PI, 0, NULL, NULL, 0);
+	UK_TEST_EXPECT_SNUM_EQ(ret, -1);
+	UK_TEST_EXPECT_SNUM_EQ(errno, EPERM);
+
+	wait_thread(thread);
+	UK_TEST_EXPECT_ZERO(rets[0]);
+	UK_TEST_EXPECT_ZERO(rets[1]);
+	UK_TEST_EXPECT_SNUM_NQ(var_to_change_vals[0] & FUTEX_TID_MASK, owner);
+	UK_TEST_EXPECT_SNUM_EQ(var_to_change, 1);
+	UK_TEST_EXPECT_ZERO(futex_val);
+}
+
 uk_testsuite_register(posix_futex_testsuite, NULL);
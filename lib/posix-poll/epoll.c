@@ -5,16 +5,19 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 
 #include <uk/atomic.h>
 #include <uk/assert.h>
 #include <uk/essentials.h>
 #include <uk/file/nops.h>
 #include <uk/file/pollqueue.h>
+#include <uk/list.h>
 #include <uk/posix-fd.h>
 #include <uk/posix-fdtab.h>
 #include <uk/posix-poll.h>
 #include <uk/timeutil.h>
+#include <uk/spinlock.h>
 #include <uk/syscall.h>
 
 #if CONFIG_LIBVFSCORE
@@ -31,6 +34,9 @@ static const char EPOLL_VOLID[] = "epoll_vol";
 
 #define events2mask(ev) (((ev) & EPOLL_EVENTS) | UKFD_POLL_ALWAYS)
 
+/* Initial number of buckets of the fd index; must be a power of two */
+#define EPOLL_BUCKETS_MIN 16
+
 #if CONFIG_LIBVFSCORE
 struct epoll_legacy {
 	struct eventpoll_cb ecb;
@@ -42,7 +48,9 @@ struct epoll_legacy {
 #endif /* CONFIG_LIBVFSCORE */
 
 struct epoll_entry {
-	struct epoll_entry *next;
+	struct epoll_entry *next; /* Next entry in the same fd bucket */
+	struct uk_list_head ready_link;
+	int ready; /* Linked into a ready list, protected by `ready_lock` */
 #if CONFIG_LIBVFSCORE
 	int legacy;
 #endif /* CONFIG_LIBVFSCORE */
@@ -68,14 +76,58 @@ struct epoll_entry {
 #define IS_ONESHOT(ent)  (!!((ent)->event.events & EPOLLONESHOT))
 
 
+/*
+ * Registered entries are indexed in a hash table keyed by fd, so that
+ * epoll_ctl() does not depend on the number of monitored files. Since fds
+ * are small, densely allocated integers, the low bits of the fd are used as
+ * hash.
+ *
+ * Entries that received events are additionally queued on a ready list by
+ * the event callbacks, so epoll_wait() only visits entries that have
+ * something to report instead of all registered ones. Level-triggered entries
+ * that are still ready after being reported are queued again at the tail,
+ * which distributes events fairly if there are more than `maxevents`.
+ */
 struct epoll_alloc {
 	struct uk_alloc *alloc;
 	struct uk_file f;
 	uk_file_refcnt frefcnt;
 	struct uk_file_state fstate;
-	struct epoll_entry *list;
+	struct epoll_entry **buckets;
+	unsigned int nbuckets;
+	unsigned int nentries;
+	uk_spinlock ready_lock;
+	struct uk_list_head ready;
 };
 
+#define epoll_alloc_of(epf) __containerof(epf, struct epoll_alloc, f)
+
+static inline struct epoll_entry **epoll_bucket(struct epoll_alloc *al, int fd)
+{
+	return &al->buckets[(unsigned int)fd & (al->nbuckets - 1)];
+}
+
+/* Queue `ent` for the next epoll_wait() unless it is already queued */
+static void epoll_ready(struct epoll_alloc *al, struct epoll_entry *ent)
+{
+	uk_spin_lock(&al->ready_lock);
+	if (!ent->ready) {
+		ent->ready = 1;
+		uk_list_add_tail(&ent->ready_link, &al->ready);
+	}
+	uk_spin_unlock(&al->ready_lock);
+}
+
+static void epoll_unready(struct epoll_alloc *al, struct epoll_entry *ent)
+{
+	uk_spin_lock(&al->ready_lock);
+	if (ent->ready) {
+		ent->ready = 0;
+		uk_list_del(&ent->ready_link);
+	}
+	uk_spin_unlock(&al->ready_lock);
+}
+
 
 static void epoll_unregister_entry(struct epoll_entry *ent)
 {
@@ -100,9 +152,11 @@ static void epoll_event_callback(uk_pollevent set,
 	if (op == UK_POLL_CHAINOP_SET) {
 		struct epoll_entry *ent = __containerof(
 			tick, struct epoll_entry, tick);
-		struct uk_pollq *upq = (struct uk_pollq *)tick->arg;
+		struct epoll_alloc *al = (struct epoll_alloc *)tick->arg;
+		struct uk_pollq *upq = &al->fstate.pollq;
 
 		(void)uk_or(&ent->revents, set);
+		epoll_ready(al, ent);
 		uk_pollq_set_n(upq, UKFD_POLLIN,
 			       IS_EDGEPOLL(ent) ? 1 : UK_POLLQ_NOTIFY_ALL);
 		if (IS_ONESHOT(ent))
@@ -134,8 +188,12 @@ static void vfs_poll_register(struct vfscore_file *vfd,
 	} else {
 		uk_list_add_tail(&leg->f_link, &vfd->f_ep);
 		(void)uk_and(&leg->revents, leg->mask);
-		if (leg->revents)
+		if (leg->revents) {
+			epoll_ready(epoll_alloc_of(leg->epf),
+				    __containerof(leg, struct epoll_entry,
+						  legacy_cb));
 			uk_file_event_set(leg->epf, UKFD_POLLIN);
+		}
 	}
 }
 #endif /* CONFIG_LIBVFSCORE */
@@ -144,20 +202,24 @@ static void vfs_poll_register(struct vfscore_file *vfd,
 
 static void epoll_release(const struct uk_file *epf, int what)
 {
-	struct epoll_alloc *al = __containerof(epf, struct epoll_alloc, f);
+	struct epoll_alloc *al = epoll_alloc_of(epf);
 
 	if (what & UK_FILE_RELEASE_RES) {
-		struct epoll_entry **list = (struct epoll_entry **)epf->node;
-		struct epoll_entry *p = *list;
-
 		/* Free entries */
-		while (p) {
-			struct epoll_entry *ent = p;
+		for (unsigned int i = 0; i < al->nbuckets; i++) {
+			struct epoll_entry *p = al->buckets[i];
+
+			while (p) {
+				struct epoll_entry *ent = p;
 
-			p = p->next;
-			epoll_unregister_entry(ent);
-			uk_free(al->alloc, ent);
+				p = p->next;
+				epoll_unregister_entry(ent);
+				uk_free(al->alloc, ent);
+			}
 		}
+		uk_free(al->alloc, al->buckets);
+		al->buckets = NULL;
+		al->nbuckets = 0;
 	}
 	if (what & UK_FILE_RELEASE_OBJ) {
 		/* Free alloc */
@@ -175,7 +237,7 @@ static struct epoll_entry **epoll_find(const struct uk_file *epf, int fd,
 				       union uk_shim_file sf)
 #endif
 {
-	struct epoll_entry **p = (struct epoll_entry **)epf->node;
+	struct epoll_entry **p = epoll_bucket(epoll_alloc_of(epf), fd);
 
 	while (*p) {
 		struct epoll_entry *ent = *p;
@@ -194,12 +256,54 @@ static struct epoll_entry **epoll_find(const struct uk_file *epf, int fd,
 	return p;
 }
 
-static int epoll_add(const struct uk_file *epf, struct epoll_entry **tail,
-		     int fd, const struct uk_file *f,
+/* Doubles the number of buckets once there are as many entries as buckets.
+ * Failing to grow the index is not an error; the chains just get longer.
+ */
+static void epoll_index_grow(struct epoll_alloc *al)
+{
+	struct epoll_entry **old = al->buckets;
+	unsigned int oldn = al->nbuckets;
+	struct epoll_entry **nb;
+
+	if (al->nentries < oldn || oldn > (UINT_MAX >> 1))
+		return;
+
+	nb = uk_calloc(al->alloc, 2 * oldn, sizeof(*nb));
+	if (unlikely(!nb))
+		return;
+
+	al->buckets = nb;
+	al->nbuckets = 2 * oldn;
+	for (unsigned int i = 0; i < oldn; i++) {
+		while (old[i]) {
+			struct epoll_entry *ent = old[i];
+			struct epoll_entry **b = epoll_bucket(al, ent->fd);
+
+			old[i] = ent->next;
+			ent->next = *b;
+			*b = ent;
+		}
+	}
+	uk_free(al->alloc, old);
+}
+
+static void epoll_index_add(struct epoll_alloc *al, struct epoll_entry *ent)
+{
+	struct epoll_entry **b;
+
+	epoll_index_grow(al);
+	b = epoll_bucket(al, ent->fd);
+	ent->next = *b;
+	*b = ent;
+	al->nentries++;
+}
+
+static int epoll_add(const struct uk_file *epf, int fd,
+		     const struct uk_file *f,
 		     const struct epoll_event *event)
 {
 	const int edge = !!(event->events & EPOLLET);
-	struct epoll_alloc *al = __containerof(epf, struct epoll_alloc, f);
+	struct epoll_alloc *al = epoll_alloc_of(epf);
 	struct epoll_entry *ent;
 	uk_pollevent ev;
 
@@ -211,6 +315,7 @@ static int epoll_add(const struct uk_file *epf, struct epoll_entry **tail,
 	uk_file_acquire_weak(f);
 	*ent = (struct epoll_entry){
 		.next = NULL,
+		.ready = 0,
 #if CONFIG_LIBVFSCORE
 		.legacy = 0,
 #endif /* CONFIG_LIBVFSCORE */
@@ -218,16 +323,16 @@ static int epoll_add(const struct uk_file *epf, struct epoll_entry **tail,
 		.f = f,
 		.event = *event,
 		.tick = UK_POLL_CHAIN_CALLBACK(events2mask(event->events),
-					       epoll_event_callback,
-					       &epf->state->pollq),
+					       epoll_event_callback, al),
 		.revents = 0
 	};
-	*tail = ent;
+	epoll_index_add(al, ent);
 	/* Poll, register & update if needed */
 	ev = uk_pollq_poll_register(&f->state->pollq, &ent->tick, 1);
 	if (ev) {
 		/* Need atomic OR since we're registered for updates */
 		(void)uk_or(&ent->revents, ev);
+		epoll_ready(al, ent);
 		uk_pollq_set_n(&epf->state->pollq, UKFD_POLLIN,
 			       edge ? 1 : UK_POLLQ_NOTIFY_ALL);
 	}
@@ -236,11 +341,10 @@ static int epoll_add(const struct uk_file *epf, struct epoll_entry **tail,
 
 #if CONFIG_LIBVFSCORE
 static int epoll_add_legacy(const struct uk_file *epf,
-			    struct epoll_entry **tail,
 			    int fd, struct vfscore_file *vf,
 			    const struct epoll_event *event)
 {
-	struct epoll_alloc *al = __containerof(epf, struct epoll_alloc, f);
+	struct epoll_alloc *al = epoll_alloc_of(epf);
 	struct epoll_entry *ent;
 
 	/* New entry */
@@ -250,6 +354,7 @@ static int epoll_add_legacy(const struct uk_file *epf,
 
 	*ent = (struct epoll_entry){
 		.next = NULL,
+		.ready = 0,
 		.legacy = 1,
 		.fd = fd,
 		.vf = vf,
@@ -263,7 +368,7 @@ static int epoll_add_legacy(const struct uk_file *epf,
 	};
 	UK_INIT_LIST_HEAD(&ent->legacy_cb.ecb.cb_link);
 	UK_INIT_LIST_HEAD(&ent->legacy_cb.f_link);
-	*tail = ent;
+	epoll_index_add(al, ent);
 	/* Poll, register & update if needed */
 	vfs_poll_register(vf, &ent->legacy_cb);
 
@@ -302,11 +407,14 @@ static void epoll_entry_mod_legacy(struct epoll_entry *ent,
 
 static void epoll_entry_del(const struct uk_file *epf, struct epoll_entry **p)
 {
-	struct epoll_alloc *al = __containerof(epf, struct epoll_alloc, f);
+	struct epoll_alloc *al = epoll_alloc_of(epf);
 	struct epoll_entry *ent = *p;
 
 	*p = ent->next;
+	al->nentries--;
+	/* No more callbacks can queue the entry after unregistering */
 	epoll_unregister_entry(ent);
+	epoll_unready(al, ent);
 	uk_free(al->alloc, ent);
 }
 
@@ -321,6 +429,8 @@ void eventpoll_signal(struct eventpoll_cb *ecb, unsigned int revents)
 	revents &= leg->mask;
 	if (revents) {
 		(void)uk_or(&leg->revents, revents);
+		epoll_ready(epoll_alloc_of(leg->epf),
+			    __containerof(leg, struct epoll_entry, legacy_cb));
 		uk_file_event_set(leg->epf, UKFD_POLLIN);
 	}
 }
@@ -358,14 +468,22 @@ struct uk_file *uk_epollfile_create(void)
 
 	if (!al)
 		return NULL;
+	al->buckets = uk_calloc(a, EPOLL_BUCKETS_MIN, sizeof(*al->buckets));
+	if (!al->buckets) {
+		uk_free(a, al);
+		return NULL;
+	}
 	/* Set fields */
 	al->alloc = a;
-	al->list = NULL;
+	al->nbuckets = EPOLL_BUCKETS_MIN;
+	al->nentries = 0;
+	uk_spin_init(&al->ready_lock);
+	UK_INIT_LIST_HEAD(&al->ready);
 	al->fstate = UK_FILE_STATE_INITIALIZER(al->fstate);
 	al->frefcnt = UK_FILE_REFCNT_INITIALIZER;
 	al->f = (struct uk_file){
 		.vol = EPOLL_VOLID,
-		.node = &al->list,
+		.node = al,
 		.refcnt = &al->frefcnt,
 		.state = &al->fstate,
 		.ops = &uk_file_nops,
@@ -439,12 +557,12 @@ int uk_sys_epoll_ctl(const struct uk_file *epf, int op, int fd,
 		else
 #if CONFIG_LIBVFSCORE
 			if (legacy)
-				ret = epoll_add_legacy(epf, entp,
-						       fd, sf.vfile, event);
+				ret = epoll_add_legacy(epf, fd, sf.vfile,
+						       event);
 			else
 #endif /* CONFIG_LIBVFSCORE */
-				ret = epoll_add(epf, entp,
-						fd, sf.ofile->file, event);
+				ret = epoll_add(epf, fd, sf.ofile->file,
+						event);
 		break;
 
 	case EPOLL_CTL_MOD:
@@ -485,7 +603,7 @@ int uk_sys_epoll_pwait2(const struct uk_file *epf, struct epoll_event *events,
 			int maxevents, const struct timespec *timeout,
 			const sigset_t *sigmask, size_t sigsetsize __unused)
 {
-	struct epoll_entry **list;
+	struct epoll_alloc *al;
 	__nsec deadline;
 
 	if (unlikely(epf->vol != EPOLL_VOLID))
@@ -499,7 +617,7 @@ int uk_sys_epoll_pwait2(const struct uk_file *epf, struct epoll_event *events,
 		return -ENOSYS;
 	}
 
-	list = (struct epoll_entry **)epf->node;
+	al = epoll_alloc_of(epf);
 
 	if (timeout) {
 		__snsec tout = uk_time_spec_to_nsec(timeout);
@@ -512,19 +630,31 @@ int uk_sys_epoll_pwait2(const struct uk_file *epf, struct epoll_event *events,
 	}
 
 	while (uk_file_poll_until(epf, UKFD_POLLIN, deadline)) {
-		int lvlev = 0;
+		UK_LIST_HEAD(again);
+		int lvlev;
 		int nout = 0;
 
 		uk_file_event_clear(epf, UKFD_POLLIN);
 		uk_file_rlock(epf);
 
-		/* gather & output event list */
-		for (struct epoll_entry *p = *list;
-		     p && nout < maxevents;
-		     p = p->next) {
+		/* gather & output events of ready entries */
+		while (nout < maxevents) {
+			struct epoll_entry *p;
 			unsigned int revents;
 			unsigned int *revp;
 
+			uk_spin_lock(&al->ready_lock);
+			p = uk_list_first_entry_or_null(&al->ready,
+							struct epoll_entry,
+							ready_link);
+			if (p) {
+				uk_list_del(&p->ready_link);
+				p->ready = 0;
+			}
+			uk_spin_unlock(&al->ready_lock);
+			if (!p)
+				break;
+
 #if CONFIG_LIBVFSCORE
 			if (p->legacy)
 				revp = &p->legacy_cb.revents;
@@ -532,37 +662,56 @@ int uk_sys_epoll_pwait2(const struct uk_file *epf, struct epoll_event *events,
 #endif /* CONFIG_LIBVFSCORE */
 				revp = &p->revents;
 
+			/* Events that arrive from now on queue the entry again */
 			revents = uk_exchange_n(revp, 0);
-			if (revents) {
-				if (!IS_EDGEPOLL(p)) {
-					unsigned int mask;
+			if (!revents)
+				continue;
+
+			if (!IS_EDGEPOLL(p)) {
+				unsigned int mask;
 
-					mask = events2mask(p->event.events);
+				mask = events2mask(p->event.events);
 #if CONFIG_LIBVFSCORE
-					if (p->legacy) {
-						vfs_poll(p->vf, &revents,
-							 &p->legacy_cb.ecb);
-						revents &= mask;
-					} else
+				if (p->legacy) {
+					vfs_poll(p->vf, &revents,
+						 &p->legacy_cb.ecb);
+					revents &= mask;
+				} else
 #endif /* CONFIG_LIBVFSCORE */
-					{
-						revents = uk_file_poll_immediate(p->f, mask);
-					}
-					if (!revents)
-						continue;
-
-					lvlev = 1;
-					(void)uk_or(revp, revents);
+				{
+					revents = uk_file_poll_immediate(p->f, mask);
 				}
+				if (!revents)
+					continue;
+			}
 
-				events[nout].events = revents;
-				events[nout].data = p->event.data;
-				nout++;
+			/* Level-triggered entries that are still ready are
+			 * reported again on the next call, unless they are
+			 * disarmed after this one.
+			 */
+			if (!IS_EDGEPOLL(p) && !IS_ONESHOT(p)) {
+				(void)uk_or(revp, revents);
+				uk_spin_lock(&al->ready_lock);
+				if (!p->ready) {
+					p->ready = 1;
+					uk_list_add_tail(&p->ready_link,
+							 &again);
+				}
+				uk_spin_unlock(&al->ready_lock);
 			}
+
+			events[nout].events = revents;
+			events[nout].data = p->event.data;
+			nout++;
 		}
+
+		uk_spin_lock(&al->ready_lock);
+		uk_list_splice_tail(&again, &al->ready);
+		lvlev = !uk_list_empty(&al->ready);
+		uk_spin_unlock(&al->ready_lock);
 		uk_file_runlock(epf);
 
-		/* If lvlev, update pollin back in */
+		/* If entries remain ready, update pollin back in */
 		if (lvlev)
 			uk_file_event_set(epf, UKFD_POLLIN);
 
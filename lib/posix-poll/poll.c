@@ -4,13 +4,25 @@
  * You may not use this file except in compliance with the License.
  */
 
+#include <errno.h>
 #include <poll.h>
 
+#include <uk/alloc.h>
+#include <uk/assert.h>
 #include <uk/essentials.h>
+#include <uk/file/pollqueue.h>
+#include <uk/posix-fd.h>
 #include <uk/posix-poll.h>
+#include <uk/sched.h>
+#include <uk/spinlock.h>
+#include <uk/thread.h>
 #include <uk/timeutil.h>
 #include <uk/syscall.h>
 
+#if CONFIG_LIBVFSCORE
+#include <vfscore/file.h>
+#endif /* CONFIG_LIBVFSCORE */
+
 /* For performance we copy between epoll and poll events with no conversion. */
 /* This assumes them to be equal, which we ensure with these asserts */
 UK_CTASSERT(EPOLLIN == POLLIN);
@@ -24,32 +36,299 @@ UK_CTASSERT(EPOLLRDBAND == POLLRDBAND);
 UK_CTASSERT(EPOLLWRNORM == POLLWRNORM);
 UK_CTASSERT(EPOLLWRBAND == POLLWRBAND);
 
-/* HACK: Because we need to support both vfscore and uk_file, we need to defer
- * to epoll(), which can handle both. This has the limitation of not supporting
- * multiple pollfd entries with the same fd, in which case we fail early with
- * -ENOSYS.
- * Once vfscore shim is no longer needed, we can switch to a more efficient
- * and correct bespoke implementation.
+/*
+ * poll() is served by a bespoke engine that checks the files first and does
+ * not allocate anything if an event is already pending or if the caller does
+ * not want to wait. Only if the calling thread has to block, an update
+ * chaining ticket is registered on the poll queue of every file, which wakes
+ * the thread on new events.
+ *
+ * With LIBPOSIX_POLL_CACHE, the registrations of the last blocking call are
+ * kept per thread and reused if the next call polls the same files for the
+ * same events, as event loops typically do.
  */
 
-/* Internal syscalls */
+/* Registration of a single pollfd entry */
+struct poll_reg {
+	int fd;
+	const struct uk_file *f; /* NULL if `fd` is invalid */
+	struct uk_poll_chain tick;
+};
 
-int uk_sys_ppoll(struct pollfd *fds, nfds_t nfds,
-		 const struct timespec *timeout,
-		 const sigset_t *sigmask, size_t sigsetsize)
+/* Registrations for the pollfd array of a blocking call */
+struct poll_set {
+	struct uk_alloc *alloc;
+	struct uk_thread *thread;
+	uk_spinlock lock;
+	int waiting; /* Thread is in poll(), protected by `lock` */
+	int woken; /* Events arrived while waiting, protected by `lock` */
+	nfds_t nregs;
+	struct poll_reg regs[];
+};
+
+#define poll_mask(p) ((uk_pollevent)(p)->events | UKFD_POLL_ALWAYS)
+
+#if CONFIG_LIBPOSIX_POLL_CACHE
+static __uk_tls struct poll_set *poll_cache;
+#endif /* CONFIG_LIBPOSIX_POLL_CACHE */
+
+static void poll_event_callback(uk_pollevent set __unused,
+				enum uk_poll_chain_op op,
+				struct uk_poll_chain *tick)
 {
-	const struct uk_file *ef;
+	struct poll_set *ps = (struct poll_set *)tick->arg;
+
+	if (op != UK_POLL_CHAINOP_SET)
+		return;
+
+	uk_spin_lock(&ps->lock);
+	if (ps->waiting && !ps->woken) {
+		ps->woken = 1;
+		uk_thread_wake(ps->thread);
+	}
+	uk_spin_unlock(&ps->lock);
+}
+
+static void poll_set_free(struct poll_set *ps)
+{
+	for (nfds_t i = 0; i < ps->nregs; i++) {
+		struct poll_reg *r = &ps->regs[i];
+
+		if (r->f) {
+			/* No more callbacks run once unregistered */
+			uk_pollq_unregister(&r->f->state->pollq, &r->tick);
+			uk_file_release_weak(r->f);
+		}
+	}
+	uk_free(ps->alloc, ps);
+}
+
+/* Polls the files of `fds` without blocking.
+ *
+ * @return
+ *   Number of entries with events, or POLL_LEGACY if a vfscore file is
+ *   polled
+ */
+#define POLL_LEGACY -1
+
+static int poll_scan(struct pollfd *fds, nfds_t nfds)
+{
+	int ret = 0;
+
+	for (nfds_t i = 0; i < nfds; i++) {
+		struct pollfd *p = &fds[i];
+		union uk_shim_file sf;
+		int r;
+
+		p->revents = 0;
+		if (p->fd < 0)
+			continue;
+
+		r = uk_fdtab_shim_get(p->fd, &sf);
+		if (unlikely(r < 0)) {
+			p->revents = POLLNVAL;
+			ret++;
+			continue;
+		}
+#if CONFIG_LIBVFSCORE
+		if (r == UK_SHIM_LEGACY) {
+			fdrop(sf.vfile);
+			return POLL_LEGACY;
+		}
+#endif /* CONFIG_LIBVFSCORE */
+		UK_ASSERT(r == UK_SHIM_OFILE);
+		p->revents = uk_file_poll_immediate(sf.ofile->file,
+						    poll_mask(p));
+		uk_fdtab_ret(sf.ofile);
+		if (p->revents)
+			ret++;
+	}
+	return ret;
+}
+
+/* Same as poll_scan(), but with the files looked up by poll_set_get() */
+static int poll_scan_set(struct pollfd *fds, const struct poll_set *ps)
+{
+	int ret = 0;
+
+	for (nfds_t i = 0; i < ps->nregs; i++) {
+		const struct poll_reg *r = &ps->regs[i];
+		struct pollfd *p = &fds[i];
+
+		if (r->fd < 0)
+			p->revents = 0;
+		else if (unlikely(!r->f))
+			p->revents = POLLNVAL;
+		else
+			p->revents = uk_file_poll_immediate(r->f,
+							    r->tick.mask);
+		if (p->revents)
+			ret++;
+	}
+	return ret;
+}
+
+/* Looks up the file of `fd` and takes a weak reference to it, which keeps
+ * its poll queue valid while we are registered, even if the file gets closed
+ * in the meantime
+ */
+static const struct uk_file *poll_file_get(int fd)
+{
+	const struct uk_file *f;
+	union uk_shim_file sf;
+	int r;
+
+	r = uk_fdtab_shim_get(fd, &sf);
+	if (unlikely(r < 0))
+		return NULL;
+#if CONFIG_LIBVFSCORE
+	/* A vfscore file was opened in between; treat it as invalid */
+	if (unlikely(r == UK_SHIM_LEGACY)) {
+		fdrop(sf.vfile);
+		return NULL;
+	}
+#endif /* CONFIG_LIBVFSCORE */
+	f = sf.ofile->file;
+	uk_file_acquire_weak(f);
+	uk_fdtab_ret(sf.ofile);
+	return f;
+}
+
+#if CONFIG_LIBPOSIX_POLL_CACHE
+/* Checks whether the registrations of `ps` are for the same files and events
+ * as requested by `fds`
+ */
+static int poll_set_match(const struct poll_set *ps,
+			  const struct pollfd *fds, nfds_t nfds)
+{
+	if (ps->nregs != nfds)
+		return 0;
+	for (nfds_t i = 0; i < nfds; i++) {
+		const struct poll_reg *r = &ps->regs[i];
+		const struct uk_file *f;
+
+		if (r->fd != fds[i].fd)
+			return 0;
+		if (r->fd < 0)
+			continue;
+		if (r->f && r->tick.mask != poll_mask(&fds[i]))
+			return 0;
+		f = poll_file_get(r->fd);
+		if (f)
+			uk_file_release_weak(f);
+		if (f != r->f)
+			return 0;
+	}
+	return 1;
+}
+#endif /* CONFIG_LIBPOSIX_POLL_CACHE */
+
+/* Returns registrations for `fds`, either cached or newly created */
+static struct poll_set *poll_set_get(const struct pollfd *fds, nfds_t nfds)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct poll_set *ps;
+
+#if CONFIG_LIBPOSIX_POLL_CACHE
+	if (poll_cache && poll_set_match(poll_cache, fds, nfds))
+		return poll_cache;
+#endif /* CONFIG_LIBPOSIX_POLL_CACHE */
+
+	ps = uk_malloc(a, sizeof(*ps) + nfds * sizeof(ps->regs[0]));
+	if (unlikely(!ps))
+		return NULL;
+
+	ps->alloc = a;
+	ps->thread = uk_thread_current();
+	uk_spin_init(&ps->lock);
+	ps->waiting = 0;
+	ps->woken = 0;
+	ps->nregs = nfds;
+	for (nfds_t i = 0; i < nfds; i++) {
+		struct poll_reg *r = &ps->regs[i];
+
+		r->fd = fds[i].fd;
+		r->f = (r->fd >= 0) ? poll_file_get(r->fd) : NULL;
+		if (!r->f)
+			continue;
+		r->tick = UK_POLL_CHAIN_CALLBACK(poll_mask(&fds[i]),
+						 poll_event_callback, ps);
+		uk_pollq_register(&r->f->state->pollq, &r->tick);
+	}
+
+#if CONFIG_LIBPOSIX_POLL_CACHE
+	if (poll_cache)
+		poll_set_free(poll_cache);
+	poll_cache = ps;
+#endif /* CONFIG_LIBPOSIX_POLL_CACHE */
+	return ps;
+}
+
+static void poll_set_put(struct poll_set *ps)
+{
+	uk_spin_lock(&ps->lock);
+	ps->waiting = 0;
+	uk_spin_unlock(&ps->lock);
+#if !CONFIG_LIBPOSIX_POLL_CACHE
+	poll_set_free(ps);
+#endif /* !CONFIG_LIBPOSIX_POLL_CACHE */
+}
+
+#if CONFIG_LIBPOSIX_POLL_CACHE
+static void poll_cache_term(struct uk_thread *t __unused)
+{
+	if (poll_cache) {
+		poll_set_free(poll_cache);
+		poll_cache = NULL;
+	}
+}
+UK_THREAD_INIT_PRIO(0x0, poll_cache_term, UK_PRIO_LATEST);
+#endif /* CONFIG_LIBPOSIX_POLL_CACHE */
+
+/* Blocks until one of the files in `fds` has events or until `deadline` */
+static int poll_wait(struct pollfd *fds, nfds_t nfds, __nsec deadline)
+{
+	struct poll_set *ps;
 	int ret;
-	int monitored;
 
-	if (unlikely(!fds))
-		return -EFAULT;
-	if (timeout && uk_time_spec_to_nsec(timeout) < 0)
-		return -EINVAL;
-	if (unlikely(sigmask)) {
-		uk_pr_warn_once("STUB: ppoll no sigmask support\n");
-		return -ENOSYS;
+	ps = poll_set_get(fds, nfds);
+	if (unlikely(!ps))
+		return -ENOMEM;
+
+	for (;;) {
+		uk_spin_lock(&ps->lock);
+		ps->waiting = 1;
+		ps->woken = 0;
+		uk_spin_unlock(&ps->lock);
+
+		/* Events that arrive from now on wake us up */
+		ret = poll_scan_set(fds, ps);
+		if (ret)
+			break;
+		if (deadline && ukplat_monotonic_clock() >= deadline)
+			break;
+
+		uk_spin_lock(&ps->lock);
+		if (!ps->woken)
+			uk_thread_block_until(ps->thread, deadline);
+		uk_spin_unlock(&ps->lock);
+		uk_sched_yield();
 	}
+	poll_set_put(ps);
+	return ret;
+}
+
+#if CONFIG_LIBVFSCORE
+/* HACK: vfscore files can only be polled through epoll(), which is not able
+ * to monitor multiple pollfd entries with the same fd. In this case we fail
+ * with -ENOSYS.
+ */
+static int poll_legacy(struct pollfd *fds, nfds_t nfds,
+		       const struct timespec *timeout)
+{
+	const struct uk_file *ef;
+	int ret;
+	int monitored;
 
 	ef = uk_epollfile_create();
 	if (unlikely(!ef))
@@ -62,10 +341,10 @@ int uk_sys_ppoll(struct pollfd *fds, nfds_t nfds,
 		struct pollfd *p = &fds[i];
 		int r = 0;
 
-		if (p->fd > 0) {
+		if (p->fd >= 0) {
 			struct epoll_event ev = {
 				.events = p->events,
-				.data.fd = p->fd
+				.data.u64 = i
 			};
 
 			r = uk_sys_epoll_ctl(ef, EPOLL_CTL_ADD, p->fd, &ev);
@@ -94,32 +373,58 @@ int uk_sys_ppoll(struct pollfd *fds, nfds_t nfds,
 	/* Wait */
 	if (!ret) {
 		struct epoll_event ev[monitored];
-		nfds_t pi;
 
-		ret = uk_sys_epoll_pwait2(ef, ev, monitored, timeout,
-					  sigmask, sigsetsize);
+		ret = uk_sys_epoll_pwait2(ef, ev, monitored, timeout, NULL, 0);
 		/* Process epoll() output */
-		/*
-		 * HACK: this relies on epoll returning entries in the order
-		 * of registration; currently this is the case, but beware.
-		 */
-		pi = 0;
-		for (int ei = 0; ei < ret; ei++) {
-			while (pi < nfds && fds[pi].fd != ev[ei].data.fd)
-				pi++;
-			if (unlikely(pi == nfds)) {
-				uk_pr_err("Bad fd returned from epoll: %d\n",
-					  ev[ei].data.fd);
-				ret = ei;
-				break;
-			}
-			fds[pi].revents = ev[ei].events;
-		}
+		for (int ei = 0; ei < ret; ei++)
+			fds[ev[ei].data.u64].revents = ev[ei].events;
 	}
 out:
 	uk_file_release(ef);
 	return ret;
 }
+#endif /* CONFIG_LIBVFSCORE */
+
+/* Internal syscalls */
+
+int uk_sys_ppoll(struct pollfd *fds, nfds_t nfds,
+		 const struct timespec *timeout,
+		 const sigset_t *sigmask, size_t sigsetsize __unused)
+{
+	__nsec deadline;
+	int ret;
+
+	if (unlikely(!fds && nfds))
+		return -EFAULT;
+	if (unlikely(nfds > CONFIG_LIBPOSIX_FDTAB_MAXFDS))
+		return -EINVAL;
+	if (timeout && uk_time_spec_to_nsec(timeout) < 0)
+		return -EINVAL;
+	if (unlikely(sigmask)) {
+		uk_pr_warn_once("STUB: ppoll no sigmask support\n");
+		return -ENOSYS;
+	}
+
+	/* Fast path: events are pending or the caller does not wait */
+	ret = poll_scan(fds, nfds);
+#if CONFIG_LIBVFSCORE
+	if (ret == POLL_LEGACY)
+		return poll_legacy(fds, nfds, timeout);
+#endif /* CONFIG_LIBVFSCORE */
+	if (ret)
+		return ret;
+
+	if (timeout) {
+		__nsec tout = uk_time_spec_to_nsec(timeout);
+
+		if (!tout)
+			return 0;
+		deadline = ukplat_monotonic_clock() + tout;
+	} else {
+		deadline = 0;
+	}
+	return poll_wait(fds, nfds, deadline);
+}
 
 /* Userspace syscalls */
 
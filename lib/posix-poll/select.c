@@ -4,21 +4,27 @@
  * You may not use this file except in compliance with the License.
  */
 
+#include <uk/alloc.h>
 #include <uk/essentials.h>
 #include <uk/posix-fd.h>
 #include <uk/posix-poll.h>
 #include <uk/timeutil.h>
 #include <uk/syscall.h>
 
-/* HACK: Because we need to support both vfscore and uk_file, we need to defer
- * to epoll(), which can handle both. Once vfscore shim is no longer needed, we
- * can switch to a more efficient bespoke implementation.
+/* select() is implemented on top of the poll engine. Up to this many fds
+ * are converted on the stack, larger sets are allocated.
  */
+#define SELECT_STACK_FDS 32
 
 #define SELECT_READ   UKFD_POLLIN
 #define SELECT_WRITE  UKFD_POLLOUT
 #define SELECT_EXCEPT (EPOLLPRI|UKFD_POLL_ALWAYS)
 
+/* Events that make an fd count as ready in each set, as on Linux */
+#define SELECT_READ_SET   (UKFD_POLLIN|EPOLLHUP|EPOLLERR)
+#define SELECT_WRITE_SET  (UKFD_POLLOUT|EPOLLERR)
+#define SELECT_EXCEPT_SET (EPOLLPRI)
+
 /* Internal syscalls */
 
 int uk_sys_pselect(int nfds, fd_set *restrict readfds,
@@ -27,9 +33,12 @@ int uk_sys_pselect(int nfds, fd_set *restrict readfds,
 		   struct timespec *restrict timeout,
 		   const struct uk_ksigset *sigset)
 {
-	const struct uk_file *ef;
+	struct pollfd stackfds[SELECT_STACK_FDS];
+	struct pollfd *fds = stackfds;
+	struct uk_alloc *a = NULL;
+	nfds_t monitored;
+	__nsec t0 = 0;
 	int ret;
-	int monitored;
 
 	if (unlikely(nfds < 0))
 		return -EINVAL;
@@ -44,12 +53,21 @@ int uk_sys_pselect(int nfds, fd_set *restrict readfds,
 		return -ENOSYS;
 	}
 
-	ef = uk_epollfile_create();
-	if (unlikely(!ef))
-		return -ENOMEM;
+	/* Count monitored fds */
+	monitored = 0;
+	for (int fd = 0; fd < nfds; fd++)
+		if ((readfds && FD_ISSET(fd, readfds)) ||
+		    (writefds && FD_ISSET(fd, writefds)) ||
+		    (exceptfds && FD_ISSET(fd, exceptfds)))
+			monitored++;
+	if (monitored > SELECT_STACK_FDS) {
+		a = uk_alloc_get_default();
+		fds = uk_malloc(a, monitored * sizeof(*fds));
+		if (unlikely(!fds))
+			return -ENOMEM;
+	}
 
-	/* Walk fds, add to epoll */
-	ret = 0;
+	/* Walk fds, convert to pollfds */
 	monitored = 0;
 	for (int fd = 0; fd < nfds; fd++) {
 		int r = 0, w = 0, x = 0;
@@ -62,59 +80,62 @@ int uk_sys_pselect(int nfds, fd_set *restrict readfds,
 			x = FD_ISSET(fd, exceptfds) ? SELECT_EXCEPT : 0;
 
 		if (r|w|x) {
-			struct epoll_event ev = {
-				.events = r|w|x,
-				.data.fd = fd
+			fds[monitored] = (struct pollfd){
+				.fd = fd,
+				.events = r|w|x
 			};
-
-			ret = uk_sys_epoll_ctl(ef, EPOLL_CTL_ADD, fd, &ev);
-			if (unlikely(ret))
-				break;
 			monitored++;
 		}
 	}
-	if (!monitored)
-		monitored = 1;
-
-	if (!ret) {
-		struct epoll_event ev[monitored];
-		__nsec t0;
-
-		if (timeout)
-			t0 = ukplat_monotonic_clock();
-		/* Wait */
-		if (sigset)
-			ret = uk_sys_epoll_pwait2(ef, ev, monitored, timeout,
-						  sigset->ss, sigset->ss_len);
-		else
-			ret = uk_sys_epoll_pwait2(ef, ev, monitored, timeout,
-						  NULL, 0);
-		/* Writeout */
-		if (timeout) {
-			__snsec waited = ukplat_monotonic_clock() - t0;
-			__snsec left = uk_time_spec_to_nsec(timeout) - waited;
-
-			*timeout = uk_time_spec_from_nsec(left > 0 ? left : 0);
+
+	if (timeout)
+		t0 = ukplat_monotonic_clock();
+	/* Wait */
+	ret = uk_sys_ppoll(fds, monitored, timeout, NULL, 0);
+	if (unlikely(ret < 0))
+		goto out;
+	/* Writeout */
+	if (timeout) {
+		__snsec waited = ukplat_monotonic_clock() - t0;
+		__snsec left = uk_time_spec_to_nsec(timeout) - waited;
+
+		*timeout = uk_time_spec_from_nsec(left > 0 ? left : 0);
+	}
+	for (nfds_t i = 0; i < monitored; i++) {
+		if (unlikely(fds[i].revents & POLLNVAL)) {
+			ret = -EBADF;
+			goto out;
+		}
+	}
+	if (readfds)
+		FD_ZERO(readfds);
+	if (writefds)
+		FD_ZERO(writefds);
+	if (exceptfds)
+		FD_ZERO(exceptfds);
+	/* Like Linux, count every fd once for each set it is reported in */
+	ret = 0;
+	for (nfds_t i = 0; i < monitored; i++) {
+		int fd = fds[i].fd;
+		unsigned int events = fds[i].events;
+		unsigned int revents = fds[i].revents;
+
+		if ((events & SELECT_READ) && (revents & SELECT_READ_SET)) {
+			FD_SET(fd, readfds);
+			ret++;
 		}
-		if (readfds)
-			FD_ZERO(readfds);
-		if (writefds)
-			FD_ZERO(writefds);
-		if (exceptfds)
-			FD_ZERO(exceptfds);
-		for (int i = 0; i < ret; i++) {
-			int fd = ev[i].data.fd;
-
-			if (readfds && ev[i].events & SELECT_READ)
-				FD_SET(fd, readfds);
-			if (writefds && ev[i].events & SELECT_WRITE)
-				FD_SET(fd, writefds);
-			if (exceptfds && ev[i].events & SELECT_EXCEPT)
-				FD_SET(fd, exceptfds);
+		if ((events & SELECT_WRITE) && (revents & SELECT_WRITE_SET)) {
+			FD_SET(fd, writefds);
+			ret++;
+		}
+		if ((events & EPOLLPRI) && (revents & SELECT_EXCEPT_SET)) {
+			FD_SET(fd, exceptfds);
+			ret++;
 		}
 	}
-
-	uk_file_release(ef);
+out:
+	if (a)
+		uk_free(a, fds);
 	return ret;
 }
 
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+
+#include <uk/test.h>
+#include <uk/essentials.h>
+#include <uk/file.h>
+#include <uk/file/nops.h>
+#include <uk/posix-fd.h>
+#include <uk/posix-fdtab.h>
+#include <uk/posix-poll.h>
+#include <uk/plat/time.h>
+
+#define BENCH_NR_FILES		512
+#define BENCH_ITERATIONS	20000
+
+/* Minimal files whose events are set directly by the benchmarks */
+struct test_file {
+	struct uk_file f;
+	uk_file_refcnt frefcnt;
+	struct uk_file_state fstate;
+	int fd;
+};
+
+static struct test_file files[BENCH_NR_FILES];
+static const struct timespec no_wait = { 0, 0 };
+
+static void test_file_release(const struct uk_file *f __unused,
+			      int what __unused)
+{
+}
+
+static int test_files_open(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		files[i].fstate = UK_FILE_STATE_INITIALIZER(files[i].fstate);
+		files[i].frefcnt = UK_FILE_REFCNT_INITIALIZER;
+		files[i].f = (struct uk_file){
+			.vol = "bench_epoll",
+			.node = &files[i],
+			.refcnt = &files[i].frefcnt,
+			.state = &files[i].fstate,
+			.ops = &uk_file_nops,
+			._release = test_file_release
+		};
+		files[i].fd = uk_fdtab_open(&files[i].f, O_RDONLY);
+		if (files[i].fd < 0)
+			return files[i].fd;
+	}
+	return 0;
+}
+
+static void test_files_close(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (files[i].fd >= 0)
+			uk_sys_close(files[i].fd);
+		uk_file_release(&files[i].f);
+	}
+}
+
+static int ctl(const struct uk_file *epf, int op, unsigned int i,
+	       unsigned int events)
+{
+	struct epoll_event ev = { .events = events, .data.u32 = i };
+
+	return uk_sys_epoll_ctl(epf, op, files[i].fd, &ev);
+}
+
+static int wait_now(const struct uk_file *epf, struct epoll_event *ev,
+		    int maxevents)
+{
+	return uk_sys_epoll_pwait2(epf, ev, maxevents, &no_wait, NULL, 0);
+}
+
+/* Returns the average time of an epoll_wait() that reports a single event
+ * among `n` registered entries
+ */
+static __nsec bench_wait(unsigned int n)
+{
+	struct epoll_event ev;
+	struct uk_file *epf;
+	unsigned int i;
+	__nsec t = 0;
+
+	epf = uk_epollfile_create();
+	if (!epf)
+		return 0;
+	for (i = 0; i < n; i++)
+		ctl(epf, EPOLL_CTL_ADD, i, EPOLLIN | EPOLLET);
+
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		struct test_file *tf = &files[(i * 7) % n];
+		__nsec start;
+
+		uk_file_event_clear(&tf->f, UKFD_POLLIN);
+		uk_file_event_set(&tf->f, UKFD_POLLIN);
+		start = ukplat_monotonic_clock();
+		wait_now(epf, &ev, 1);
+		t += ukplat_monotonic_clock() - start;
+	}
+
+	uk_file_release(epf);
+	return t / BENCH_ITERATIONS;
+}
+
+UK_TESTCASE(posix_poll_bench, bench_epoll_wait)
+{
+	unsigned int n;
+
+	UK_TEST_ASSERT(test_files_open(BENCH_NR_FILES) == 0);
+	for (n = 8; n <= BENCH_NR_FILES; n *= 4)
+		uk_pr_info("epoll_wait with %3u entries: %"__PRIu64" ns\n",
+			   n, bench_wait(n));
+	test_files_close(BENCH_NR_FILES);
+}
+
+uk_testsuite_register(posix_poll_bench, NULL);
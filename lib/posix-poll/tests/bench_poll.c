@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+
+#include <uk/test.h>
+#include <uk/essentials.h>
+#include <uk/file.h>
+#include <uk/file/nops.h>
+#include <uk/posix-fd.h>
+#include <uk/posix-fdtab.h>
+#include <uk/posix-poll.h>
+#include <uk/plat/time.h>
+
+#define BENCH_NR_FILES		64
+#define BENCH_ITERATIONS	20000
+
+/* Minimal files whose events are set directly by the benchmarks */
+struct test_file {
+	struct uk_file f;
+	uk_file_refcnt frefcnt;
+	struct uk_file_state fstate;
+	int fd;
+};
+
+static struct test_file files[BENCH_NR_FILES];
+
+static void test_file_release(const struct uk_file *f __unused,
+			      int what __unused)
+{
+}
+
+static int test_files_open(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		files[i].fstate = UK_FILE_STATE_INITIALIZER(files[i].fstate);
+		files[i].frefcnt = UK_FILE_REFCNT_INITIALIZER;
+		files[i].f = (struct uk_file){
+			.vol = "bench_poll",
+			.node = &files[i],
+			.refcnt = &files[i].frefcnt,
+			.state = &files[i].fstate,
+			.ops = &uk_file_nops,
+			._release = test_file_release
+		};
+		files[i].fd = uk_fdtab_open(&files[i].f, O_RDONLY);
+		if (files[i].fd < 0)
+			return files[i].fd;
+	}
+	return 0;
+}
+
+static void test_files_close(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (files[i].fd >= 0)
+			uk_sys_close(files[i].fd);
+		uk_file_release(&files[i].f);
+	}
+}
+
+static void test_pollfds(struct pollfd *fds, unsigned int n, short events)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		fds[i] = (struct pollfd){ .fd = files[i].fd, .events = events };
+}
+
+UK_TESTCASE(posix_poll_poll_bench, bench_poll)
+{
+	struct pollfd fds[BENCH_NR_FILES];
+	__nsec t;
+	int i;
+
+	UK_TEST_ASSERT(test_files_open(BENCH_NR_FILES) == 0);
+	test_pollfds(fds, BENCH_NR_FILES, POLLIN);
+	uk_file_event_set(&files[BENCH_NR_FILES - 1].f, UKFD_POLLIN);
+
+	t = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_ITERATIONS; i++)
+		uk_sys_ppoll(fds, BENCH_NR_FILES, NULL, NULL, 0);
+	t = ukplat_monotonic_clock() - t;
+	uk_pr_info("poll with %u fds: %"__PRIu64" ns\n",
+		   BENCH_NR_FILES, t / BENCH_ITERATIONS);
+
+	test_files_close(BENCH_NR_FILES);
+}
+
+uk_testsuite_register(posix_poll_poll_bench, NULL);
@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+
+#include <uk/test.h>
+#include <uk/essentials.h>
+#include <uk/file.h>
+#include <uk/file/nops.h>
+#include <uk/posix-fd.h>
+#include <uk/posix-fdtab.h>
+#include <uk/posix-poll.h>
+
+#define NR_FILES		512
+#define NR_FAIR			4
+
+/* Minimal files whose events are set directly by the tests */
+struct test_file {
+	struct uk_file f;
+	uk_file_refcnt frefcnt;
+	struct uk_file_state fstate;
+	int fd;
+};
+
+static struct test_file files[NR_FILES];
+static const struct timespec no_wait = { 0, 0 };
+
+static void test_file_release(const struct uk_file *f __unused,
+			      int what __unused)
+{
+}
+
+static int test_files_open(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		files[i].fstate = UK_FILE_STATE_INITIALIZER(files[i].fstate);
+		files[i].frefcnt = UK_FILE_REFCNT_INITIALIZER;
+		files[i].f = (struct uk_file){
+			.vol = "test_epoll",
+			.node = &files[i],
+			.refcnt = &files[i].frefcnt,
+			.state = &files[i].fstate,
+			.ops = &uk_file_nops,
+			._release = test_file_release
+		};
+		files[i].fd = uk_fdtab_open(&files[i].f, O_RDONLY);
+		if (files[i].fd < 0)
+			return files[i].fd;
+	}
+	return 0;
+}
+
+static void test_files_close(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (files[i].fd >= 0)
+			uk_sys_close(files[i].fd);
+		uk_file_release(&files[i].f);
+	}
+}
+
+static int ctl(const struct uk_file *epf, int op, unsigned int i,
+	       unsigned int events)
+{
+	struct epoll_event ev = { .events = events, .data.u32 = i };
+
+	return uk_sys_epoll_ctl(epf, op, files[i].fd, &ev);
+}
+
+static int wait_now(const struct uk_file *epf, struct epoll_event *ev,
+		    int maxevents)
+{
+	return uk_sys_epoll_pwait2(epf, ev, maxevents, &no_wait, NULL, 0);
+}
+
+UK_TESTCASE(posix_poll, test_epoll_ctl)
+{
+	struct uk_file *epf;
+	unsigned int i;
+	int err = 0;
+
+	epf = uk_epollfile_create();
+	UK_TEST_ASSERT(epf != NULL);
+	UK_TEST_ASSERT(test_files_open(NR_FILES) == 0);
+
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_ADD, 0, EPOLLIN));
+	UK_TEST_EXPECT_SNUM_EQ(ctl(epf, EPOLL_CTL_ADD, 0, EPOLLIN), -EEXIST);
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_MOD, 0, EPOLLOUT));
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_DEL, 0, 0));
+	UK_TEST_EXPECT_SNUM_EQ(ctl(epf, EPOLL_CTL_DEL, 0, 0), -ENOENT);
+	UK_TEST_EXPECT_SNUM_EQ(ctl(epf, EPOLL_CTL_MOD, 0, EPOLLIN), -ENOENT);
+
+	/* Enough entries to grow the fd index a few times */
+	for (i = 0; i < NR_FILES; i++)
+		err += ctl(epf, EPOLL_CTL_ADD, i, EPOLLIN) != 0;
+	for (i = 0; i < NR_FILES; i++)
+		err += ctl(epf, EPOLL_CTL_MOD, i, EPOLLIN) != 0;
+	/* Delete every other entry and check that the rest is still found */
+	for (i = 0; i < NR_FILES; i += 2)
+		err += ctl(epf, EPOLL_CTL_DEL, i, 0) != 0;
+	for (i = 0; i < NR_FILES; i++)
+		err += ctl(epf, EPOLL_CTL_MOD, i, EPOLLIN) !=
+		       ((i % 2) ? 0 : -ENOENT);
+	UK_TEST_EXPECT_ZERO(err);
+
+	/* Remaining entries are freed with the epoll file */
+	uk_file_release(epf);
+	test_files_close(NR_FILES);
+}
+
+UK_TESTCASE(posix_poll, test_epoll_triggers)
+{
+	struct epoll_event ev[4];
+	struct uk_file *epf;
+
+	epf = uk_epollfile_create();
+	UK_TEST_ASSERT(epf != NULL);
+	UK_TEST_ASSERT(test_files_open(3) == 0);
+
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_ADD, 0, EPOLLIN));
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_ADD, 1, EPOLLIN | EPOLLET));
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_ADD, 2,
+				EPOLLIN | EPOLLONESHOT));
+	UK_TEST_EXPECT_ZERO(wait_now(epf, ev, ARRAY_SIZE(ev)));
+
+	/* Level-triggered: reported for as long as the event is set */
+	uk_file_event_set(&files[0].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_SNUM_EQ(wait_now(epf, ev, ARRAY_SIZE(ev)), 1);
+	UK_TEST_EXPECT_SNUM_EQ(ev[0].data.u32, 0);
+	UK_TEST_EXPECT_SNUM_EQ(ev[0].events, EPOLLIN);
+	UK_TEST_EXPECT_SNUM_EQ(wait_now(epf, ev, ARRAY_SIZE(ev)), 1);
+	uk_file_event_clear(&files[0].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_ZERO(wait_now(epf, ev, ARRAY_SIZE(ev)));
+
+	/* Edge-triggered: reported once per event */
+	uk_file_event_set(&files[1].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_SNUM_EQ(wait_now(epf, ev, ARRAY_SIZE(ev)), 1);
+	UK_TEST_EXPECT_SNUM_EQ(ev[0].data.u32, 1);
+	UK_TEST_EXPECT_ZERO(wait_now(epf, ev, ARRAY_SIZE(ev)));
+	uk_file_event_clear(&files[1].f, UKFD_POLLIN);
+	uk_file_event_set(&files[1].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_SNUM_EQ(wait_now(epf, ev, ARRAY_SIZE(ev)), 1);
+
+	/* One-shot: reported once until re-armed */
+	uk_file_event_set(&files[2].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_SNUM_EQ(wait_now(epf, ev, ARRAY_SIZE(ev)), 1);
+	UK_TEST_EXPECT_SNUM_EQ(ev[0].data.u32, 2);
+	uk_file_event_clear(&files[2].f, UKFD_POLLIN);
+	uk_file_event_set(&files[2].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_ZERO(wait_now(epf, ev, ARRAY_SIZE(ev)));
+
+	/* Deleting a ready entry drops its pending events */
+	uk_file_event_clear(&files[1].f, UKFD_POLLIN);
+	uk_file_event_set(&files[1].f, UKFD_POLLIN);
+	UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_DEL, 1, 0));
+	UK_TEST_EXPECT_ZERO(wait_now(epf, ev, ARRAY_SIZE(ev)));
+
+	uk_file_release(epf);
+	test_files_close(3);
+}
+
+UK_TESTCASE(posix_poll, test_epoll_maxevents)
+{
+	struct epoll_event ev;
+	struct uk_file *epf;
+	unsigned int seen = 0;
+	unsigned int i;
+
+	epf = uk_epollfile_create();
+	UK_TEST_ASSERT(epf != NULL);
+	UK_TEST_ASSERT(test_files_open(NR_FAIR) == 0);
+
+	for (i = 0; i < NR_FAIR; i++) {
+		UK_TEST_EXPECT_ZERO(ctl(epf, EPOLL_CTL_ADD, i, EPOLLIN));
+		uk_file_event_set(&files[i].f, UKFD_POLLIN);
+	}
+
+	/* Events that did not fit are reported by the following calls, and
+	 * level-triggered entries take turns
+	 */
+	for (i = 0; i < NR_FAIR; i++) {
+		UK_TEST_EXPECT_SNUM_EQ(wait_now(epf, &ev, 1), 1);
+		seen |= 1U << ev.data.u32;
+	}
+	UK_TEST_EXPECT_SNUM_EQ(seen, (1U << NR_FAIR) - 1);
+
+	uk_file_release(epf);
+	test_files_close(NR_FAIR);
+}
+
+uk_testsuite_register(posix_poll, NULL);
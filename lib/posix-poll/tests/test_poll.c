@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+
+#include <uk/test.h>
+#include <uk/essentials.h>
+#include <uk/file.h>
+#include <uk/file/nops.h>
+#include <uk/posix-fd.h>
+#include <uk/posix-fdtab.h>
+#include <uk/posix-poll.h>
+#include <uk/sched.h>
+#include <uk/plat/time.h>
+
+#define NR_FILES		4
+
+#define MSEC(ms)		((__nsec)(ms) * 1000000UL)
+
+/* Minimal files whose events are set directly by the tests */
+struct test_file {
+	struct uk_file f;
+	uk_file_refcnt frefcnt;
+	struct uk_file_state fstate;
+	int fd;
+};
+
+static struct test_file files[NR_FILES];
+static const struct timespec no_wait = { 0, 0 };
+
+static void test_file_release(const struct uk_file *f __unused,
+			      int what __unused)
+{
+}
+
+static int test_files_open(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		files[i].fstate = UK_FILE_STATE_INITIALIZER(files[i].fstate);
+		files[i].frefcnt = UK_FILE_REFCNT_INITIALIZER;
+		files[i].f = (struct uk_file){
+			.vol = "test_poll",
+			.node = &files[i],
+			.refcnt = &files[i].frefcnt,
+			.state = &files[i].fstate,
+			.ops = &uk_file_nops,
+			._release = test_file_release
+		};
+		files[i].fd = uk_fdtab_open(&files[i].f, O_RDONLY);
+		if (files[i].fd < 0)
+			return files[i].fd;
+	}
+	return 0;
+}
+
+static void test_files_close(unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (files[i].fd >= 0)
+			uk_sys_close(files[i].fd);
+		uk_file_release(&files[i].f);
+	}
+}
+
+static void test_pollfds(struct pollfd *fds, unsigned int n, short events)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		fds[i] = (struct pollfd){ .fd = files[i].fd, .events = events };
+}
+
+UK_TESTCASE(posix_poll_poll, test_poll_immediate)
+{
+	struct pollfd fds[NR_FILES + 2];
+
+	UK_TEST_ASSERT(test_files_open(NR_FILES) == 0);
+	test_pollfds(fds, NR_FILES, POLLIN);
+	UK_TEST_EXPECT_ZERO(uk_sys_ppoll(fds, NR_FILES, &no_wait, NULL, 0));
+
+	uk_file_event_set(&files[1].f, UKFD_POLLIN | UKFD_POLLOUT);
+	UK_TEST_EXPECT_SNUM_EQ(uk_sys_ppoll(fds, NR_FILES, &no_wait, NULL, 0),
+			       1);
+	UK_TEST_EXPECT_ZERO(fds[0].revents);
+	UK_TEST_EXPECT_SNUM_EQ(fds[1].revents, POLLIN);
+
+	/* Negative fds are ignored, duplicates and invalid fds are reported */
+	fds[0].fd = -1;
+	fds[NR_FILES] = fds[1];
+	fds[NR_FILES + 1] = (struct pollfd){ .fd = 1000, .events = POLLIN };
+	UK_TEST_EXPECT_SNUM_EQ(uk_sys_ppoll(fds, NR_FILES + 2, &no_wait,
+					    NULL, 0), 3);
+	UK_TEST_EXPECT_ZERO(fds[0].revents);
+	UK_TEST_EXPECT_SNUM_EQ(fds[NR_FILES].revents, POLLIN);
+	UK_TEST_EXPECT_SNUM_EQ(fds[NR_FILES + 1].revents, POLLNVAL);
+
+	/* Errors and hangups are always reported */
+	uk_file_event_set(&files[2].f, EPOLLHUP);
+	UK_TEST_EXPECT_SNUM_EQ(uk_sys_ppoll(fds, NR_FILES, &no_wait, NULL, 0),
+			       2);
+	UK_TEST_EXPECT_SNUM_EQ(fds[2].revents, POLLHUP);
+
+	test_files_close(NR_FILES);
+}
+
+struct test_waker {
+	struct test_file *tf;
+	__nsec delay;
+};
+
+static void __noreturn test_waker_fn(void *argp)
+{
+	struct test_waker *w = (struct test_waker *)argp;
+
+	uk_sched_thread_sleep(w->delay);
+	uk_file_event_set(&w->tf->f, UKFD_POLLIN);
+	uk_sched_thread_exit();
+}
+
+UK_TESTCASE(posix_poll_poll, test_poll_block)
+{
+	const struct timespec tout = uk_time_spec_from_msec(10);
+	struct test_waker w;
+	struct pollfd fds[NR_FILES];
+	__nsec t;
+	int i;
+
+	UK_TEST_ASSERT(test_files_open(NR_FILES) == 0);
+	test_pollfds(fds, NR_FILES, POLLIN);
+
+	/* Times out without events */
+	t = ukplat_monotonic_clock();
+	UK_TEST_EXPECT_ZERO(uk_sys_ppoll(fds, NR_FILES, &tout, NULL, 0));
+	UK_TEST_EXPECT(ukplat_monotonic_clock() - t >= MSEC(10));
+
+	/* Woken up by another thread, repeatedly with the same fds */
+	for (i = 0; i < NR_FILES; i++) {
+		w = (struct test_waker){ .tf = &files[i], .delay = MSEC(2) };
+		UK_TEST_ASSERT(uk_sched_thread_create(uk_sched_current(),
+						      test_waker_fn, &w,
+						      "test_waker") != NULL);
+		UK_TEST_EXPECT_SNUM_EQ(uk_sys_ppoll(fds, NR_FILES, NULL,
+						    NULL, 0), 1);
+		UK_TEST_EXPECT_SNUM_EQ(fds[i].revents, POLLIN);
+		uk_file_event_clear(&files[i].f, UKFD_POLLIN);
+	}
+
+	/* Events on other files do not complete the call */
+	fds[0].events = POLLOUT;
+	uk_file_event_set(&files[1].f, UKFD_POLLOUT);
+	w = (struct test_waker){ .tf = &files[0], .delay = MSEC(2) };
+	UK_TEST_ASSERT(uk_sched_thread_create(uk_sched_current(),
+					      test_waker_fn, &w,
+					      "test_waker") != NULL);
+	UK_TEST_EXPECT_ZERO(uk_sys_ppoll(fds, 1, &tout, NULL, 0));
+	uk_sched_thread_sleep(MSEC(5));
+
+	test_files_close(NR_FILES);
+}
+
+UK_TESTCASE(posix_poll_poll, test_select)
+{
+	struct timespec tout = { 0, 0 };
+	fd_set rfds, wfds;
+	int nfds;
+
+	UK_TEST_ASSERT(test_files_open(NR_FILES) == 0);
+	nfds = files[NR_FILES - 1].fd + 1;
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	FD_SET(files[0].fd, &rfds);
+	FD_SET(files[1].fd, &rfds);
+	FD_SET(files[1].fd, &wfds);
+	UK_TEST_EXPECT_ZERO(uk_sys_pselect(nfds, &rfds, &wfds, NULL, &tout,
+					   NULL));
+	UK_TEST_EXPECT_ZERO(FD_ISSET(files[0].fd, &rfds));
+
+	/* An fd counts once per set */
+	uk_file_event_set(&files[1].f, UKFD_POLLIN | UKFD_POLLOUT);
+	FD_SET(files[0].fd, &rfds);
+	FD_SET(files[1].fd, &rfds);
+	FD_SET(files[1].fd, &wfds);
+	UK_TEST_EXPECT_SNUM_EQ(uk_sys_pselect(nfds, &rfds, &wfds, NULL, &tout,
+					      NULL), 2);
+	UK_TEST_EXPECT_ZERO(FD_ISSET(files[0].fd, &rfds));
+	UK_TEST_EXPECT(FD_ISSET(files[1].fd, &rfds));
+	UK_TEST_EXPECT(FD_ISSET(files[1].fd, &wfds));
+
+	test_files_close(NR_FILES);
+	FD_ZERO(&rfds);
+	FD_SET(files[0].fd, &rfds);
+	UK_TEST_EXPECT_SNUM_EQ(uk_sys_pselect(nfds, &rfds, NULL, NULL, &tout,
+					      NULL), -EBADF);
+}
+
+uk_testsuite_register(posix_poll_poll, NULL);
@@ -35,21 +35,207 @@
 #include <uk/essentials.h>
 #include <uk/print.h>
 #include <uk/syscall.h>
+#include <uk/alloc.h>
+#include <uk/arch/time.h>
+#include <uk/atomic.h>
+#include <uk/mutex.h>
+#include <uk/timer.h>
+#include <uk/plat/time.h>
 
+/* Values of the Linux kernel ABI, which libcs do not always provide */
+#ifndef SIGEV_NONE
+#define SIGEV_NONE 1
+#endif /* !SIGEV_NONE */
+#ifndef TIMER_ABSTIME
+#define TIMER_ABSTIME 1
+#endif /* !TIMER_ABSTIME */
+#ifndef DELAYTIMER_MAX
+#define DELAYTIMER_MAX 0x7fffffff
+#endif /* !DELAYTIMER_MAX */
+
+/* Head of struct sigevent in the kernel ABI */
+struct posix_timer_sigevent {
+	union {
+		int sival_int;
+		void *sival_ptr;
+	} sigev_value;
+	int sigev_signo;
+	int sigev_notify;
+};
+
+/*
+ * POSIX timers are backed by kernel timers. As there is no signal delivery
+ * yet, only timers without notification (SIGEV_NONE) are supported; these
+ * can be polled with timer_gettime() and timer_getoverrun().
+ */
+struct posix_timer {
+	struct uk_timer timer;
+	struct uk_alloc *a;
+	clockid_t clkid;
+	__nsec interval;
+	int overrun;
+};
+
+/* Timers are identified by their index in this table */
+static struct uk_mutex posix_timers_lock =
+	UK_MUTEX_INITIALIZER(posix_timers_lock);
+static struct posix_timer **posix_timers;
+static int posix_timers_size;
+
+static void posix_timer_expired(struct uk_timer *t, void *argp)
+{
+	struct posix_timer *pt = (struct posix_timer *)argp;
+	__nsec missed;
+
+	if (!pt->interval)
+		return;
+
+	/* Periods that passed while the timer function was delayed */
+	missed = (ukplat_monotonic_clock() - t->expires) / pt->interval;
+	pt->overrun = (int)MIN(missed, (__nsec)DELAYTIMER_MAX);
+	(void)uk_timer_arm(t, t->expires + (missed + 1) * pt->interval);
+}
+
+static int posix_timer_clock_valid(clockid_t clkid)
+{
+	return clkid == CLOCK_MONOTONIC || clkid == CLOCK_MONOTONIC_COARSE ||
+	       clkid == CLOCK_REALTIME;
+}
+
+static inline __nsec posix_timer_clock(clockid_t clkid)
+{
+	return (clkid == CLOCK_REALTIME) ? ukplat_wall_clock()
+					 : ukplat_monotonic_clock();
+}
+
+static inline __nsec posix_timer_ts2nsec(const struct timespec *ts)
+{
+	return ukarch_time_sec_to_nsec((__nsec)ts->tv_sec) +
+	       (__nsec)ts->tv_nsec;
+}
+
+static inline void posix_timer_nsec2ts(__nsec ns, struct timespec *ts)
+{
+	ts->tv_sec = ukarch_time_nsec_to_sec(ns);
+	ts->tv_nsec = ukarch_time_subsec(ns);
+}
+
+static inline int posix_timer_ts_valid(const struct timespec *ts)
+{
+	return ts->tv_sec >= 0 && ts->tv_nsec >= 0 &&
+	       ts->tv_nsec < (long)ukarch_time_sec_to_nsec(1);
+}
+
+/* Looks up a timer; must be called with `posix_timers_lock` held */
+static struct posix_timer *posix_timer_get(timer_t timerid)
+{
+	int id = (int)(__sptr)timerid;
+
+	if (unlikely(id < 0 || id >= posix_timers_size))
+		return NULL;
+	return posix_timers[id];
+}
+
+static int posix_timer_alloc_id(struct posix_timer *pt)
+{
+	struct posix_timer **table;
+	int id, size;
+
+	for (id = 0; id < posix_timers_size; id++) {
+		if (!posix_timers[id])
+			goto found;
+	}
+
+	size = (posix_timers_size) ? 2 * posix_timers_size : 16;
+	table = uk_realloc(uk_alloc_get_default(), posix_timers,
+			   size * sizeof(*table));
+	if (unlikely(!table))
+		return -EAGAIN;
+	for (id = posix_timers_size; id < size; id++)
+		table[id] = NULL;
+	id = posix_timers_size;
+	posix_timers = table;
+	posix_timers_size = size;
+found:
+	posix_timers[id] = pt;
+	return id;
+}
 
 UK_SYSCALL_R_DEFINE(int, timer_create, clockid_t, clockid,
 		    struct sigevent *__restrict, sevp,
 		    timer_t *__restrict, timerid)
 {
-	UK_WARN_STUBBED();
-	return -ENOTSUP;
+	const struct posix_timer_sigevent *sev;
+	struct posix_timer *pt;
+	struct uk_alloc *a;
+	int id;
+
+	if (unlikely(!timerid))
+		return -EFAULT;
+	if (unlikely(!posix_timer_clock_valid(clockid)))
+		return -EINVAL;
+
+	/* Without sevp, SIGALRM is delivered on expiry */
+	sev = (const struct posix_timer_sigevent *)sevp;
+	if (!sev || sev->sigev_notify != SIGEV_NONE) {
+		uk_pr_warn_once("STUB: timer_create only supports SIGEV_NONE\n");
+		return -ENOTSUP;
+	}
+
+	a = uk_alloc_get_default();
+	pt = uk_malloc(a, sizeof(*pt));
+	if (unlikely(!pt))
+		return -EAGAIN;
+	pt->a = a;
+	pt->clkid = clockid;
+	pt->interval = 0;
+	pt->overrun = 0;
+	uk_timer_init(&pt->timer, posix_timer_expired, pt);
+
+	uk_mutex_lock(&posix_timers_lock);
+	id = posix_timer_alloc_id(pt);
+	uk_mutex_unlock(&posix_timers_lock);
+	if (unlikely(id < 0)) {
+		uk_free(a, pt);
+		return id;
+	}
+
+	/* The kernel ABI returns an int; libcs convert it to their timer_t */
+	*(int *)timerid = id;
+	return 0;
 }
 
 UK_SYSCALL_R_DEFINE(int, timer_delete,
 		    timer_t, timerid)
 {
-	UK_WARN_STUBBED();
-	return -ENOTSUP;
+	struct posix_timer *pt;
+
+	uk_mutex_lock(&posix_timers_lock);
+	pt = posix_timer_get(timerid);
+	if (pt)
+		posix_timers[(int)(__sptr)timerid] = NULL;
+	uk_mutex_unlock(&posix_timers_lock);
+	if (unlikely(!pt))
+		return -EINVAL;
+
+	uk_timer_disarm(&pt->timer);
+	uk_free(pt->a, pt);
+	return 0;
+}
+
+static void posix_timer_value(struct posix_timer *pt,
+			      struct itimerspec *curr_value)
+{
+	__nsec expires, now;
+
+	expires = uk_load_n(&pt->timer.expires);
+	now = ukplat_monotonic_clock();
+	if (!pt->interval && !uk_timer_pending(&pt->timer))
+		expires = 0;
+
+	posix_timer_nsec2ts((expires > now) ? expires - now : 0,
+			    &curr_value->it_value);
+	posix_timer_nsec2ts(pt->interval, &curr_value->it_interval);
 }
 
 UK_SYSCALL_R_DEFINE(int, timer_settime,
@@ -58,21 +244,75 @@ UK_SYSCALL_R_DEFINE(int, timer_settime,
 		    const struct itimerspec *__restrict, new_value,
 		    struct itimerspec *__restrict, old_value)
 {
-	UK_WARN_STUBBED();
-	return -ENOTSUP;
+	struct posix_timer *pt;
+	__nsec value, now, mono;
+	int ret = 0;
+
+	if (unlikely(!new_value))
+		return -EFAULT;
+	if (unlikely(!posix_timer_ts_valid(&new_value->it_value) ||
+		     !posix_timer_ts_valid(&new_value->it_interval)))
+		return -EINVAL;
+
+	uk_mutex_lock(&posix_timers_lock);
+	pt = posix_timer_get(timerid);
+	if (unlikely(!pt)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Stop the timer function while we change the settings */
+	uk_timer_disarm(&pt->timer);
+	if (old_value)
+		posix_timer_value(pt, old_value);
+
+	pt->interval = 0;
+	pt->overrun = 0;
+	value = posix_timer_ts2nsec(&new_value->it_value);
+	if (!value)
+		goto out; /* Disarm */
+
+	mono = ukplat_monotonic_clock();
+	if (flags & TIMER_ABSTIME) {
+		/* Translate the expiry time to the monotonic clock */
+		now = posix_timer_clock(pt->clkid);
+		mono += (value > now) ? value - now : 0;
+	} else {
+		mono += value;
+	}
+	pt->interval = posix_timer_ts2nsec(&new_value->it_interval);
+	ret = uk_timer_arm(&pt->timer, mono);
+out:
+	uk_mutex_unlock(&posix_timers_lock);
+	return ret;
 }
 
 UK_SYSCALL_R_DEFINE(int, timer_gettime,
 		    timer_t, timerid,
 		    struct itimerspec *, curr_value)
 {
-	UK_WARN_STUBBED();
-	return -ENOTSUP;
+	struct posix_timer *pt;
+
+	if (unlikely(!curr_value))
+		return -EFAULT;
+
+	uk_mutex_lock(&posix_timers_lock);
+	pt = posix_timer_get(timerid);
+	if (pt)
+		posix_timer_value(pt, curr_value);
+	uk_mutex_unlock(&posix_timers_lock);
+	return (pt) ? 0 : -EINVAL;
 }
 
 UK_SYSCALL_R_DEFINE(int, timer_getoverrun,
 		    timer_t, timerid)
 {
-	UK_WARN_STUBBED();
-	return -ENOTSUP;
+	struct posix_timer *pt;
+	int ret;
+
+	uk_mutex_lock(&posix_timers_lock);
+	pt = posix_timer_get(timerid);
+	ret = (pt) ? uk_load_n(&pt->overrun) : -EINVAL;
+	uk_mutex_unlock(&posix_timers_lock);
+	return ret;
 }
@@ -15,7 +15,7 @@
 #include <uk/posix-fdtab.h>
 #include <uk/posix-timerfd.h>
 #include <uk/mutex.h>
-#include <uk/sched.h>
+#include <uk/timer.h>
 #include <uk/timeutil.h>
 #include <uk/syscall.h>
 
@@ -26,8 +26,9 @@ static const char TIMERFD_VOLID[] = "timerfd_vol";
 struct timerfd_node {
 	struct itimerspec set;
 	__u64 val;
+	__u64 nexp;
 	clockid_t clkid;
-	struct uk_thread *upthread;
+	struct uk_timer timer;
 };
 
 struct timerfd_alloc {
@@ -71,55 +72,42 @@ struct timerfd_status _timerfd_valnext(const struct itimerspec *set,
 	return ret;
 }
 
-static __nsec _timerfd_update(const struct uk_file *f)
+static inline int _timerfd_armed(const struct itimerspec *set)
 {
-	__nsec deadline;
-	struct timespec t;
-	__nsec now;
-	struct timerfd_status st;
-	struct timerfd_node *d = (struct timerfd_node *)f->node;
-	struct itimerspec set = d->set;
+	return set->it_value.tv_sec || set->it_value.tv_nsec;
+}
 
-	/* Clear & sleep if timer disarmed */
-	if (!set.it_value.tv_sec && !set.it_value.tv_nsec) {
-		if (d->val) {
-			uk_file_event_clear(f, UKFD_POLLIN);
-			d->val = 0;
-		}
-		return 0;
-	}
+/*
+ * Adds the expirations since the last update to the value of the timer and
+ * (re-)arms the kernel timer for the next one. Called with the kernel timer
+ * disarmed, or by the kernel timer itself, so `set` and `nexp` are stable.
+ */
+static int _timerfd_update(const struct uk_file *f)
+{
+	struct timerfd_node *d = (struct timerfd_node *)f->node;
+	struct timerfd_status st;
+	struct timespec t;
 
-	/* Get time & decide value & deadline */
 	uk_syscall_r_clock_gettime(d->clkid, (uintptr_t)&t);
-	now = ukplat_monotonic_clock();
-	st = _timerfd_valnext(&set, &t);
-	deadline = now + st.next;
-
-	/* Update val & events */
-	if (st.exp != d->val) {
-		d->val = st.exp;
-		if (st.exp)
-			uk_file_event_set(f, UKFD_POLLIN);
-		else
-			uk_file_event_clear(f, UKFD_POLLIN);
+	st = _timerfd_valnext(&d->set, &t);
+
+	if (st.exp > d->nexp) {
+		(void)uk_add_fetch(&d->val, st.exp - d->nexp);
+		d->nexp = st.exp;
+		uk_file_event_set(f, UKFD_POLLIN);
 	}
-	return deadline;
+	if (st.next)
+		return uk_timer_arm(&d->timer,
+				    ukplat_monotonic_clock() + st.next);
+	return 0;
 }
 
-static void _timerfd_set(struct timerfd_node *d, const struct itimerspec *set)
+static void timerfd_expired(struct uk_timer *t __unused, void *argp)
 {
-	if (!set->it_value.tv_sec && !set->it_value.tv_nsec) {
-		/* Disarm */
-		if (d->set.it_value.tv_sec || d->set.it_value.tv_nsec) {
-			d->set.it_value = set->it_value;
-			uk_thread_wake(d->upthread);
-		}
-	} else {
-		/* Arm */
-		d->set.it_value = set->it_value;
-		d->set.it_interval = set->it_interval;
-		uk_thread_wake(d->upthread);
-	}
+	const struct uk_file *f = (const struct uk_file *)argp;
+
+	UK_ASSERT(f->vol == TIMERFD_VOLID);
+	(void)_timerfd_update(f);
 }
 
 /* Ops */
@@ -149,35 +137,14 @@ static ssize_t timerfd_read(const struct uk_file *f,
 	return sizeof(v);
 }
 
-static __noreturn void timerfd_updatefn(void *arg)
-{
-	__nsec deadline;
-	const struct uk_file *f = (struct uk_file *)arg;
-
-	UK_ASSERT(f->vol == TIMERFD_VOLID);
-	for (;;) {
-		uk_file_wlock(f);
-		deadline = _timerfd_update(f);
-		/* Unlock & wait */
-		uk_thread_block_until(uk_thread_current(), deadline);
-		uk_file_wunlock(f);
-
-		uk_sched_yield();
-	}
-}
-
 static void timerfd_release(const struct uk_file *f, int what)
 {
 	UK_ASSERT(f->vol == TIMERFD_VOLID);
 	if (what & UK_FILE_RELEASE_RES) {
 		struct timerfd_node *d = (struct timerfd_node *)f->node;
 
-		/* Disarm */
-		uk_file_rlock(f);
-		uk_thread_terminate(d->upthread);
-		uk_file_runlock(f);
-		/* Collect thread */
-		uk_thread_release(d->upthread);
+		/* Disarm; waits for a running update */
+		uk_timer_disarm(&d->timer);
 	}
 	if (what & UK_FILE_RELEASE_OBJ) {
 		struct timerfd_alloc *al;
@@ -201,7 +168,6 @@ struct uk_file *uk_timerfile_create(clockid_t id)
 {
 	struct uk_alloc *a;
 	struct timerfd_alloc *al;
-	struct uk_thread *ut;
 
 	/* Check clock id */
 	if (unlikely(uk_syscall_r_clock_getres(id, (uintptr_t)NULL)))
@@ -221,9 +187,10 @@ struct uk_file *uk_timerfile_create(clockid_t id)
 			.it_value = {0, 0},
 		},
 		.val = 0,
-		.clkid = id,
-		.upthread = NULL
+		.nexp = 0,
+		.clkid = id
 	};
+	uk_timer_init(&al->node.timer, timerfd_expired, &al->f);
 	al->fstate = UK_FILE_STATE_INITIALIZER(al->fstate);
 	al->frefcnt = UK_FILE_REFCNT_INITIALIZER;
 	al->f = (struct uk_file){
@@ -235,18 +202,6 @@ struct uk_file *uk_timerfile_create(clockid_t id)
 		._release = timerfd_release
 	};
 
-	/* Create update thread */
-	ut = uk_sched_thread_create(
-		uk_sched_current(),
-		timerfd_updatefn, &al->f,
-		"timerfd_update_thread"
-	);
-	if (unlikely(!ut)) {
-		uk_free(a, al);
-		return ERR2PTR(-ENODEV);
-	}
-	al->node.upthread = ut;
-
 	return &al->f;
 }
 
@@ -274,15 +229,29 @@ int uk_sys_timerfd_create(clockid_t id, int flags)
 }
 
 
+/* Current value as returned by gettime, relative to the clock */
+static void _timerfd_get(struct timerfd_node *d, struct itimerspec *curr)
+{
+	struct timerfd_status st;
+	struct timespec t;
+
+	curr->it_interval = d->set.it_interval;
+	if (!_timerfd_armed(&d->set)) {
+		curr->it_value = (struct timespec){ 0, 0 };
+		return;
+	}
+	uk_syscall_r_clock_gettime(d->clkid, (uintptr_t)&t);
+	st = _timerfd_valnext(&d->set, &t);
+	curr->it_value = uk_time_spec_from_nsec(st.next);
+}
+
 int uk_sys_timerfd_settime(const struct uk_file *f, int flags,
 			   const struct itimerspec *new_value,
 			   struct itimerspec *old_value)
 {
 	struct timerfd_node *d;
-	const struct itimerspec *set;
-	struct itimerspec absset;
-	const int disarm = !new_value->it_value.tv_sec &&
-			   !new_value->it_value.tv_nsec;
+	const int disarm = !_timerfd_armed(new_value);
+	int ret = 0;
 
 	if (unlikely(flags & ~TFD_TIMER_ABSTIME))
 		return -EINVAL;
@@ -291,44 +260,45 @@ int uk_sys_timerfd_settime(const struct uk_file *f, int flags,
 
 	d = f->node;
 	uk_file_wlock(f);
-	if (disarm || flags & TFD_TIMER_ABSTIME) {
-		set = new_value;
+	/* Stop updates while we change the settings */
+	uk_timer_disarm(&d->timer);
+	if (old_value)
+		_timerfd_get(d, old_value);
+
+	if (disarm) {
+		d->set.it_value = new_value->it_value;
+	} else if (flags & TFD_TIMER_ABSTIME) {
+		d->set = *new_value;
 	} else {
 		struct timespec t;
 
 		uk_syscall_r_clock_gettime(d->clkid, (uintptr_t)&t);
-		absset.it_interval = new_value->it_interval;
-		absset.it_value = uk_time_spec_sum(&new_value->it_value, &t);
-		set = &absset;
+		d->set.it_interval = new_value->it_interval;
+		d->set.it_value = uk_time_spec_sum(&new_value->it_value, &t);
 	}
-	if (old_value)
-		*old_value = d->set;
-	_timerfd_set(d, set);
-	(void)_timerfd_update(f);
+
+	/* Expirations of the previous setting are dropped */
+	d->nexp = 0;
+	(void)uk_exchange_n(&d->val, 0);
+	uk_file_event_clear(f, UKFD_POLLIN);
+	if (!disarm)
+		ret = _timerfd_update(f);
 	uk_file_wunlock(f);
-	return 0;
+	return ret;
 }
 
 int uk_sys_timerfd_gettime(const struct uk_file *f,
 			   struct itimerspec *curr_value)
 {
 	struct timerfd_node *d;
-	struct timespec t;
-	struct timerfd_status st;
-	struct itimerspec set;
 
 	if (unlikely(f->vol != TIMERFD_VOLID))
 		return -EINVAL;
 
 	d = f->node;
 	uk_file_rlock(f);
-	uk_syscall_r_clock_gettime(d->clkid, (uintptr_t)&t);
-	set = d->set;
-	st = _timerfd_valnext(&set, &t);
+	_timerfd_get(d, curr_value);
 	uk_file_runlock(f);
-
-	curr_value->it_interval = set.it_interval;
-	curr_value->it_value = uk_time_spec_from_nsec(st.next);
 	return 0;
 }
 
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Interface of ramfs for other libraries
+ */
+#ifndef __RAMFS_RAMFS_H__
+#define __RAMFS_RAMFS_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct vnode;
+
+/**
+ * Makes a regular file without data reference an existing buffer instead of
+ * copying it. The buffer is not freed with the node. As long as the file is
+ * not written to, reads are served directly from the buffer; the first write
+ * copies the data to pages owned by the node.
+ *
+ * @param vp
+ *   Virtual node of the file
+ * @param data
+ *   Buffer that holds the file data; must stay mapped and unmodified as
+ *   long as the file exists or until it is first written to
+ * @param size
+ *   Size of the file data
+ * @return
+ *   0 on success, ENOTSUP if the file is not on ramfs, EISDIR or EINVAL if
+ *   it is not an empty regular file
+ */
+int ramfs_set_file_data(struct vnode *vp, const void *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RAMFS_RAMFS_H__ */
@@ -34,8 +34,12 @@
 #define _RAMFS_H
 
 #include <vfscore/prex.h>
+#include <ramfs/ramfs.h>
 #include <stdbool.h>
 
+struct vnode;
+struct vfsops;
+
 /**
  * struct ramfs_node - A filesystem entry node for RamFS
  */
@@ -60,10 +64,22 @@ struct ramfs_node {
 	size_t rn_namelen;
 	/* Size of the file */
 	size_t rn_size;
-	/* Buffer to the file data */
+	/*
+	 * Buffer to the link target of a symbolic link, or to the data of
+	 * a regular file that references an external buffer
+	 */
 	char *rn_buf;
 	/* Size of the allocated buffer */
 	size_t rn_bufsize;
+	/*
+	 * Root of the page tree holding the data of a regular file. Pages
+	 * that were never written are holes and read as zeros.
+	 */
+	void *rn_pages;
+	/* Number of levels of the page tree, 0 if it is empty */
+	unsigned int rn_height;
+	/* Number of pages that are referenced by memory mappings */
+	unsigned long rn_mapcnt;
 	/* Last change time */
 	struct timespec rn_ctime;
 	/* Last access time */
@@ -99,6 +115,8 @@ struct ramfs_node *ramfs_allocate_node(const char *name, int type, mode_t mode);
  */
 void ramfs_free_node(struct ramfs_node *node);
 
+extern struct vfsops ramfs_vfsops;
+
 /**
  * Transforms a vnode into a ramfs_node.
  *
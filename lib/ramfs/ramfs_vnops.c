@@ -45,6 +45,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <uk/alloc.h>
 #include <uk/page.h>
 #include <vfscore/vnode.h>
 #include <vfscore/mount.h>
@@ -62,9 +63,21 @@
 #define RAMFS_IS_DELETED(np) ((np)->rn_mode & RAMFS_DELMODE)
 #define RAMFS_MARK_DELETED(np) (np)->rn_mode |= RAMFS_DELMODE
 
+/*
+ * File data is kept in a radix tree of pages. A tree of height 1 is a single
+ * data page, every further level adds an index page of RAMFS_SLOTS pointers.
+ */
+#define RAMFS_SLOT_SHIFT (__PAGE_SHIFT - 3)
+#define RAMFS_SLOTS (1UL << RAMFS_SLOT_SHIFT)
+#define RAMFS_TREE_PAGES(height) \
+	((height) ? 1UL << (((height) - 1) * RAMFS_SLOT_SHIFT) : 0)
+
 static struct uk_mutex ramfs_lock = UK_MUTEX_INITIALIZER(ramfs_lock);
 static uint64_t inode_count = 1; /* inode 0 is reserved to root */
 
+/* Source for reading holes */
+static char ramfs_zero_page[__PAGE_SIZE];
+
 static void
 set_times_to_now(struct timespec *time1, struct timespec *time2,
 		 struct timespec *time3)
@@ -80,6 +93,142 @@ set_times_to_now(struct timespec *time1, struct timespec *time2,
 		memcpy(time3, &now, sizeof(struct timespec));
 }
 
+static void *
+ramfs_page_alloc(void)
+{
+	void *page = uk_palloc(uk_alloc_get_default(), 1);
+
+	if (page)
+		memset(page, 0, __PAGE_SIZE);
+	return page;
+}
+
+static void
+ramfs_page_free(void *page)
+{
+	uk_pfree(uk_alloc_get_default(), page, 1);
+}
+
+/*
+ * Returns the data page with index `idx`, or NULL if it is a hole and
+ * `alloc` is not set or no memory is left
+ */
+static char *
+ramfs_page_get(struct ramfs_node *np, unsigned long idx, bool alloc)
+{
+	unsigned int height;
+	void **slot, *node;
+
+	if (idx >= RAMFS_TREE_PAGES(np->rn_height)) {
+		if (!alloc)
+			return NULL;
+		if (!np->rn_pages) {
+			np->rn_height = 1;
+			while (idx >= RAMFS_TREE_PAGES(np->rn_height))
+				np->rn_height++;
+		}
+		while (idx >= RAMFS_TREE_PAGES(np->rn_height)) {
+			node = ramfs_page_alloc();
+			if (!node)
+				return NULL;
+			((void **) node)[0] = np->rn_pages;
+			np->rn_pages = node;
+			np->rn_height++;
+		}
+	}
+
+	slot = &np->rn_pages;
+	for (height = np->rn_height; height > 1; height--) {
+		if (!*slot) {
+			if (!alloc)
+				return NULL;
+			*slot = ramfs_page_alloc();
+			if (!*slot)
+				return NULL;
+		}
+		node = *slot;
+		slot = &((void **) node)[(idx / RAMFS_TREE_PAGES(height - 1))
+					  % RAMFS_SLOTS];
+	}
+	if (!*slot && alloc)
+		*slot = ramfs_page_alloc();
+	return *slot;
+}
+
+/*
+ * Frees the pages of a subtree with the given height that starts at page
+ * index `base`, as far as they are at page index `from` or beyond. If `keep`
+ * is set, the data pages are zeroed instead.
+ */
+static void
+ramfs_page_trim_tree(void **slot, unsigned int height, unsigned long base,
+		     unsigned long from, bool keep)
+{
+	unsigned long span, i;
+	void **node = *slot;
+
+	if (!node)
+		return;
+
+	if (height > 1) {
+		span = RAMFS_TREE_PAGES(height - 1);
+		for (i = 0; i < RAMFS_SLOTS; i++) {
+			if (base + (i + 1) * span <= from)
+				continue;
+			ramfs_page_trim_tree(&node[i], height - 1,
+					     base + i * span, from, keep);
+		}
+		if (base < from || keep)
+			return;
+	} else if (base < from) {
+		return;
+	} else if (keep) {
+		memset(node, 0, __PAGE_SIZE);
+		return;
+	}
+	ramfs_page_free(node);
+	*slot = NULL;
+}
+
+/*
+ * Drops the data of a regular file from page index `from` onwards. Pages
+ * that are referenced by memory mappings are only zeroed and freed once the
+ * last reference is gone.
+ */
+static void
+ramfs_page_trim(struct ramfs_node *np, unsigned long from)
+{
+	ramfs_page_trim_tree(&np->rn_pages, np->rn_height, 0, from,
+			     np->rn_mapcnt > 0);
+	if (!np->rn_pages)
+		np->rn_height = 0;
+}
+
+/*
+ * Copies the data of a file that references an external buffer to pages
+ * owned by the node
+ */
+static int
+ramfs_unborrow(struct ramfs_node *np)
+{
+	size_t off, len;
+	char *page;
+
+	for (off = 0; off < np->rn_size; off += __PAGE_SIZE) {
+		page = ramfs_page_get(np, off / __PAGE_SIZE, true);
+		if (!page) {
+			ramfs_page_trim(np, 0);
+			return ENOMEM;
+		}
+		len = MIN(np->rn_size - off, __PAGE_SIZE);
+		memcpy(page, np->rn_buf + off, len);
+	}
+	np->rn_buf = NULL;
+	np->rn_bufsize = 0;
+	np->rn_owns_buf = true;
+	return 0;
+}
+
 struct ramfs_node *
 ramfs_allocate_node(const char *name, int type, mode_t mode)
 {
@@ -119,6 +268,9 @@ ramfs_free_node(struct ramfs_node *np)
 {
 	if (np->rn_buf != NULL && np->rn_owns_buf)
 		free(np->rn_buf);
+	/* Pages that are still mapped must stay valid */
+	if (np->rn_mapcnt == 0)
+		ramfs_page_trim(np, 0);
 
 	free(np->rn_name);
 	free(np);
@@ -348,34 +500,34 @@ static int
 ramfs_truncate(struct vnode *vp, off_t length)
 {
 	struct ramfs_node *np;
-	void *new_buf;
-	size_t new_size;
+	char *page;
+	int error;
 
 	uk_pr_debug("truncate %s length=%lld\n", RAMFS_NODE(vp)->rn_name,
 		 (long long) length);
 	np = vp->v_data;
 
-	if (length == 0) {
-		if (np->rn_buf != NULL) {
-			if (np->rn_owns_buf)
-				free(np->rn_buf);
+	if (np->rn_buf && !np->rn_owns_buf) {
+		if (length == 0) {
 			np->rn_buf = NULL;
 			np->rn_bufsize = 0;
+			np->rn_owns_buf = true;
+		} else if ((size_t) length > np->rn_size) {
+			/* Data beyond the external buffer reads as zeros */
+			error = ramfs_unborrow(np);
+			if (error)
+				return error;
 		}
-	} else if ((size_t) length > np->rn_bufsize) {
-		/* TODO: this could use a page level allocator */
-		new_size = round_pgup(length);
-		new_buf = malloc(new_size);
-		if (!new_buf)
-			return EIO;
-		if (np->rn_size != 0) {
-			memcpy(new_buf, np->rn_buf, vp->v_size);
-			if (np->rn_owns_buf)
-				free(np->rn_buf);
-		}
-		np->rn_buf = (char *) new_buf;
-		np->rn_bufsize = new_size;
-		np->rn_owns_buf = true;
+	} else if ((size_t) length < np->rn_size) {
+		/* Extending leaves a hole, shrinking drops the pages past the
+		 * end and clears the tail of the last page, so that a later
+		 * extension reads zeros
+		 */
+		ramfs_page_trim(np, round_pgup(length) / __PAGE_SIZE);
+		page = ramfs_page_get(np, length / __PAGE_SIZE, false);
+		if (page && length % __PAGE_SIZE)
+			memset(page + length % __PAGE_SIZE, 0,
+			       __PAGE_SIZE - length % __PAGE_SIZE);
 	}
 	np->rn_size = length;
 	vp->v_size = length;
@@ -409,7 +561,9 @@ ramfs_read(struct vnode *vp, struct vfscore_file *fp __unused,
 	   struct uio *uio, int ioflag __unused)
 {
 	struct ramfs_node *np =  vp->v_data;
-	size_t len;
+	size_t len, off, chunk;
+	char *page;
+	int error;
 
 	if (vp->v_type == VDIR)
 		return EISDIR;
@@ -430,7 +584,22 @@ ramfs_read(struct vnode *vp, struct vfscore_file *fp __unused,
 
 	set_times_to_now(&(np->rn_atime), NULL, NULL);
 
-	return vfscore_uiomove(np->rn_buf + uio->uio_offset, len, uio);
+	if (np->rn_buf)
+		return vfscore_uiomove(np->rn_buf + uio->uio_offset, len, uio);
+
+	while (len > 0) {
+		off = uio->uio_offset % __PAGE_SIZE;
+		chunk = MIN(len, __PAGE_SIZE - off);
+		page = ramfs_page_get(np, uio->uio_offset / __PAGE_SIZE,
+				      false);
+		if (!page)
+			page = ramfs_zero_page;
+		error = vfscore_uiomove(page + off, chunk, uio);
+		if (error)
+			return error;
+		len -= chunk;
+	}
+	return 0;
 }
 
 int
@@ -438,11 +607,13 @@ ramfs_set_file_data(struct vnode *vp, const void *data, size_t size)
 {
 	struct ramfs_node *np =  vp->v_data;
 
+	if (vp->v_mount->m_op != &ramfs_vfsops)
+		return ENOTSUP;
 	if (vp->v_type == VDIR)
 		return EISDIR;
 	if (vp->v_type != VREG)
 		return EINVAL;
-	if (np->rn_buf)
+	if (np->rn_buf || np->rn_pages)
 		return EINVAL;
 
 	np->rn_buf = (char *) data;
@@ -458,6 +629,9 @@ static int
 ramfs_write(struct vnode *vp, struct uio *uio, int ioflag)
 {
 	struct ramfs_node *np =  vp->v_data;
+	size_t off, chunk, resid;
+	char *page;
+	int error;
 
 	if (vp->v_type == VDIR)
 		return EISDIR;
@@ -473,33 +647,41 @@ ramfs_write(struct vnode *vp, struct uio *uio, int ioflag)
 	if (ioflag & IO_APPEND)
 		uio->uio_offset = np->rn_size;
 
-	if ((size_t) uio->uio_offset + uio->uio_resid > (size_t) vp->v_size) {
-		/* Expand the file size before writing to it */
-		off_t end_pos = uio->uio_offset + uio->uio_resid;
-
-		if (end_pos > (off_t) np->rn_bufsize) {
-			// XXX: this could use a page level allocator
-			size_t new_size = round_pgup(end_pos);
-			void *new_buf = calloc(1, new_size);
-
-			if (!new_buf)
-				return EIO;
-			if (np->rn_size != 0) {
-				memcpy(new_buf, np->rn_buf, vp->v_size);
-				if (np->rn_owns_buf)
-					free(np->rn_buf);
-			}
-			np->rn_buf = (char *) new_buf;
-			np->rn_bufsize = new_size;
-		}
-		np->rn_size = end_pos;
-		vp->v_size = end_pos;
-		np->rn_owns_buf = true;
+	/* Borrowed data is read-only, write to a copy */
+	if (np->rn_buf && !np->rn_owns_buf) {
+		error = ramfs_unborrow(np);
+		if (error)
+			return error;
 	}
 
 	set_times_to_now(&(np->rn_mtime), &(np->rn_ctime), NULL);
-	return vfscore_uiomove(np->rn_buf + uio->uio_offset, uio->uio_resid,
-			       uio);
+
+	/* Only the pages that are written to are allocated. If we run out of
+	 * memory, the write ends short, after the data written so far.
+	 */
+	resid = uio->uio_resid;
+	error = 0;
+	while (uio->uio_resid > 0) {
+		off = uio->uio_offset % __PAGE_SIZE;
+		chunk = MIN((size_t) uio->uio_resid, __PAGE_SIZE - off);
+		page = ramfs_page_get(np, uio->uio_offset / __PAGE_SIZE, true);
+		if (!page) {
+			error = ENOSPC;
+			break;
+		}
+		error = vfscore_uiomove(page + off, chunk, uio);
+		if (error)
+			break;
+		if ((size_t) uio->uio_offset > np->rn_size) {
+			np->rn_size = uio->uio_offset;
+			vp->v_size = uio->uio_offset;
+		}
+	}
+
+	/* Report partial writes as such */
+	if (error == ENOSPC && (size_t) uio->uio_resid < resid)
+		error = 0;
+	return error;
 }
 
 static int
@@ -534,12 +716,21 @@ ramfs_rename(struct vnode *dvp1, struct vnode *vp1, const char *name1 __unused,
 		np->rn_child = old_np->rn_child;
 		old_np->rn_child = NULL;
 
+		/* Copy file data */
+		np->rn_size = old_np->rn_size;
 		if (old_np->rn_buf) {
-			/* Copy file data */
 			np->rn_buf = old_np->rn_buf;
-			np->rn_size = old_np->rn_size;
 			np->rn_bufsize = old_np->rn_bufsize;
+			np->rn_owns_buf = old_np->rn_owns_buf;
 			old_np->rn_buf = NULL;
+		} else if (old_np->rn_pages) {
+			/* Move the page tree, including its mappings */
+			np->rn_pages = old_np->rn_pages;
+			np->rn_height = old_np->rn_height;
+			np->rn_mapcnt = old_np->rn_mapcnt;
+			old_np->rn_pages = NULL;
+			old_np->rn_height = 0;
+			old_np->rn_mapcnt = 0;
 		}
 		/* Remove source file */
 		ramfs_remove_node(dvp1->v_data, vp1->v_data);
@@ -660,6 +851,49 @@ ramfs_inactive(struct vnode *vp)
 	return 0;
 }
 
+static int
+ramfs_getpage(struct vnode *vp, off_t off, void **pagep)
+{
+	struct ramfs_node *np = vp->v_data;
+	char *page;
+	int error;
+
+	if (vp->v_type != VREG)
+		return EINVAL;
+	if (off < 0 || off >= LONG_MAX || off % __PAGE_SIZE)
+		return EINVAL;
+
+	if (np->rn_buf && !np->rn_owns_buf) {
+		error = ramfs_unborrow(np);
+		if (error)
+			return error;
+	}
+
+	/* Pages past the end of the file are allocated as well, they are
+	 * kept zeroed and become part of the file if it is extended
+	 */
+	page = ramfs_page_get(np, off / __PAGE_SIZE, true);
+	if (!page)
+		return ENOMEM;
+	np->rn_mapcnt++;
+	*pagep = page;
+	return 0;
+}
+
+static int
+ramfs_putpage(struct vnode *vp, off_t off __unused)
+{
+	struct ramfs_node *np = vp->v_data;
+
+	if (np->rn_mapcnt == 0)
+		return 0;
+
+	/* Free what truncations and mappings left past the end */
+	if (--np->rn_mapcnt == 0)
+		ramfs_page_trim(np, round_pgup(np->rn_size) / __PAGE_SIZE);
+	return 0;
+}
+
 static int ramfs_ioctl(struct vnode *dvp __unused,
 			 struct vfscore_file *fp __unused,
 			 unsigned long com,
@@ -724,4 +958,6 @@ struct vnops ramfs_vnops = {
 		ramfs_readlink,         /* read link */
 		ramfs_symlink,          /* symbolic link */
 		ramfs_poll,             /* poll */
+		ramfs_getpage,          /* get page */
+		ramfs_putpage,          /* put page */
 };
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <uk/test.h>
+#include <uk/vmem.h>
+#include <uk/vma_types.h>
+#include <uk/plat/paging.h>
+#include <vfscore/dentry.h>
+#include <vfscore/file.h>
+#include <vfscore/pagecache.h>
+#include <vfscore/vnode.h>
+#include "../ramfs.h"
+
+#define TEST_DIR		"/.test_ramfs"
+#define TEST_FILE		TEST_DIR "/mapped"
+#define TEST_PAGES		4
+#define TEST_LEN		(TEST_PAGES * PAGE_SIZE)
+
+static struct vnode *test_vnode(int fd)
+{
+	struct vfscore_file *fp;
+	struct vnode *vp;
+
+	fp = vfscore_get_file(fd);
+	if (!fp)
+		return NULL;
+	vp = fp->f_dentry->d_vnode;
+	vfscore_put_file(fp);
+	return vp;
+}
+
+static int test_setup(void)
+{
+	if (mkdir(TEST_DIR, 0755) && errno != EEXIST)
+		return -errno;
+	if (mount("", TEST_DIR, "ramfs", 0, NULL))
+		return -errno;
+	return 0;
+}
+
+/* Two read-only mappings share the pages of a file. The pages of the second
+ * one are unmapped before being faulted in, except for the first one. The
+ * file references of the pages that remain mapped must survive unmapping it
+ * and truncating the file.
+ */
+UK_TESTCASE(ramfs, test_map_partial_unmap_truncate)
+{
+	struct uk_vas *vas = uk_vas_get_active();
+	__vaddr_t va = __VADDR_ANY, vb = __VADDR_ANY;
+	char buf[PAGE_SIZE];
+	struct ramfs_node *np;
+	struct vnode *vp;
+	unsigned int i;
+	int fd, rc;
+
+	UK_TEST_ASSERT(vas != NULL);
+	UK_TEST_ASSERT(test_setup() == 0);
+
+	fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	UK_TEST_ASSERT(fd >= 0);
+	vp = test_vnode(fd);
+	UK_TEST_ASSERT(vp != NULL);
+	np = RAMFS_NODE(vp);
+
+	memset(buf, 'a', sizeof(buf));
+	for (i = 0; i < TEST_PAGES; i++)
+		UK_TEST_ASSERT(write(fd, buf, sizeof(buf)) == sizeof(buf));
+
+	rc = uk_vma_map_file(vas, &va, TEST_LEN, PAGE_ATTR_PROT_READ, 0,
+			     fd, 0);
+	UK_TEST_ASSERT(rc == 0);
+	rc = uk_vma_map_file(vas, &vb, TEST_LEN, PAGE_ATTR_PROT_READ, 0,
+			     fd, 0);
+	UK_TEST_ASSERT(rc == 0);
+	UK_TEST_EXPECT_SNUM_EQ(np->rn_mapcnt, 2 * TEST_PAGES);
+
+	/* Mappings are populated at creation. Drop all but the first page
+	 * of the second mapping, as if they had never been faulted in.
+	 */
+	vn_lock(vp);
+	for (i = 1; i < TEST_PAGES; i++) {
+		rc = ukplat_page_unmap(vas->pt, vb + i * PAGE_SIZE, 1,
+				       PAGE_FLAG_KEEP_FRAMES);
+		UK_TEST_EXPECT_ZERO(rc);
+		vfscore_putpage(vp, i * PAGE_SIZE);
+	}
+	vn_unlock(vp);
+	UK_TEST_EXPECT_SNUM_EQ(np->rn_mapcnt, TEST_PAGES + 1);
+
+	/* Only the page that is present gives up its reference */
+	UK_TEST_EXPECT_ZERO(uk_vma_unmap(vas, vb, TEST_LEN, 0));
+	UK_TEST_EXPECT_SNUM_EQ(np->rn_mapcnt, TEST_PAGES);
+
+	/* The mapped pages are zeroed, not freed, and still back the file */
+	close(fd);
+	fd = open(TEST_FILE, O_RDWR | O_TRUNC);
+	UK_TEST_ASSERT(fd >= 0);
+	UK_TEST_EXPECT_ZERO(*(volatile char *)(va + 2 * PAGE_SIZE));
+
+	memset(buf, 'b', sizeof(buf));
+	UK_TEST_EXPECT_SNUM_EQ(pwrite(fd, buf, sizeof(buf), 2 * PAGE_SIZE),
+			       sizeof(buf));
+	UK_TEST_EXPECT_SNUM_EQ(*(volatile char *)(va + 2 * PAGE_SIZE), 'b');
+
+	UK_TEST_EXPECT_ZERO(uk_vma_unmap(vas, va, TEST_LEN, 0));
+	UK_TEST_EXPECT_ZERO(np->rn_mapcnt);
+
+	close(fd);
+	unlink(TEST_FILE);
+	umount(TEST_DIR);
+}
+
+uk_testsuite_register(ramfs, NULL);
@@ -38,11 +38,17 @@
 #include <uk/arch/ctx.h>
 #include <uk/assert.h>
 #include <uk/essentials.h>
+#include <uk/trace.h>
 #include "arch/regmap_linuxabi.h"
 #if CONFIG_LIBSYSCALL_SHIM_STRACE
 #include <uk/plat/console.h> /* ukplat_coutk */
 #endif /* CONFIG_LIBSYSCALL_SHIM_STRACE */
 
+UK_TRACEPOINT(trace_syscall_binary, "%lu (%#lx, %#lx, %#lx)",
+	      unsigned long, unsigned long, unsigned long, unsigned long);
+UK_TRACEPOINT(trace_syscall_binary_ret, "%lu = %ld",
+	      unsigned long, long);
+
 void ukplat_syscall_handler(struct uk_syscall_ctx *usc)
 {
 #if CONFIG_LIBSYSCALL_SHIM_STRACE
@@ -70,7 +76,10 @@ void ukplat_syscall_handler(struct uk_syscall_ctx *usc)
 		    usc->regs.rarg1);
 #endif /* CONFIG_LIBSYSCALL_SHIM_DEBUG_HANDLER */
 
+	trace_syscall_binary(usc->regs.rsyscall, usc->regs.rarg0,
+			     usc->regs.rarg1, usc->regs.rarg2);
 	usc->regs.rret0 = uk_syscall6_r_u(usc);
+	trace_syscall_binary_ret(usc->regs.rsyscall, usc->regs.rret0);
 
 #if CONFIG_LIBSYSCALL_SHIM_STRACE
 	prsyscalllen = uk_snprsyscall(prsyscallbuf, ARRAY_SIZE(prsyscallbuf),
@@ -45,7 +45,7 @@ UK_TRACEPOINT(uk_9p_trace_ready, "tag %u", uint16_t);
 UK_TRACEPOINT(uk_9p_trace_sent, "tag %u", uint16_t);
 UK_TRACEPOINT(uk_9p_trace_received, "tag %u", uint16_t);
 
-static inline int send_and_wait_zc(struct uk_9pdev *dev, struct uk_9preq *req,
+static inline int send_zc(struct uk_9pdev *dev, struct uk_9preq *req,
 		enum uk_9preq_zcdir zc_dir, void *zc_buf, uint32_t zc_size,
 		uint32_t zc_offset)
 {
@@ -59,6 +59,13 @@ static inline int send_and_wait_zc(struct uk_9pdev *dev, struct uk_9preq *req,
 		return rc;
 	uk_9p_trace_sent(req->tag);
 
+	return 0;
+}
+
+static inline int wait_reply(struct uk_9preq *req)
+{
+	int rc;
+
 	if ((rc = uk_9preq_waitreply(req)))
 		return rc;
 	uk_9p_trace_received(req->tag);
@@ -66,6 +73,18 @@ static inline int send_and_wait_zc(struct uk_9pdev *dev, struct uk_9preq *req,
 	return 0;
 }
 
+static inline int send_and_wait_zc(struct uk_9pdev *dev, struct uk_9preq *req,
+		enum uk_9preq_zcdir zc_dir, void *zc_buf, uint32_t zc_size,
+		uint32_t zc_offset)
+{
+	int rc;
+
+	if ((rc = send_zc(dev, req, zc_dir, zc_buf, zc_size, zc_offset)))
+		return rc;
+
+	return wait_reply(req);
+}
+
 static inline int send_and_wait_no_zc(struct uk_9pdev *dev,
 		struct uk_9preq *req)
 {
@@ -435,28 +454,39 @@ out:
 	return rc;
 }
 
-int64_t uk_9p_read(struct uk_9pdev *dev, struct uk_9pfid *fid,
-		uint64_t offset, uint32_t count, char *buf)
+struct uk_9preq *uk_9p_read_start(struct uk_9pdev *dev,
+		struct uk_9pfid *fid, uint64_t offset, uint32_t count,
+		char *buf)
 {
 	struct uk_9preq *req;
-	int64_t rc;
+	int rc;
 
-	if (fid->iounit != 0)
-		count = MIN(count, fid->iounit);
-	count = MIN(count, dev->msize - 11);
+	count = MIN(count, uk_9p_read_maxcount(dev, fid));
 
 	uk_pr_debug("TREAD fid %u offset %lu count %u\n", fid->fid,
 			offset, count);
 
 	req = request_create(dev, UK_9P_TREAD);
 	if (PTRISERR(req))
-		return PTR2ERR(req);
+		return req;
 
 	if ((rc = uk_9preq_write32(req, fid->fid)) ||
 		(rc = uk_9preq_write64(req, offset)) ||
 		(rc = uk_9preq_write32(req, count)) ||
-		(rc = send_and_wait_zc(dev, req, UK_9PREQ_ZCDIR_READ, buf,
-				       count, 11)) ||
+		(rc = send_zc(dev, req, UK_9PREQ_ZCDIR_READ, buf, count, 11))) {
+		uk_9pdev_req_remove(dev, req);
+		return ERR2PTR(rc);
+	}
+
+	return req;
+}
+
+int64_t uk_9p_read_wait(struct uk_9pdev *dev, struct uk_9preq *req)
+{
+	uint32_t count;
+	int64_t rc;
+
+	if ((rc = wait_reply(req)) ||
 		(rc = uk_9preq_read32(req, &count)))
 		goto out;
 
@@ -469,27 +499,51 @@ out:
 	return rc;
 }
 
-int64_t uk_9p_write(struct uk_9pdev *dev, struct uk_9pfid *fid,
-		uint64_t offset, uint32_t count, const char *buf)
+int64_t uk_9p_read(struct uk_9pdev *dev, struct uk_9pfid *fid,
+		uint64_t offset, uint32_t count, char *buf)
 {
 	struct uk_9preq *req;
-	int64_t rc;
 
-	if (fid->iounit != 0)
-		count = MIN(count, fid->iounit);
-	count = MIN(count, dev->msize - 23);
+	req = uk_9p_read_start(dev, fid, offset, count, buf);
+	if (PTRISERR(req))
+		return PTR2ERR(req);
+
+	return uk_9p_read_wait(dev, req);
+}
+
+struct uk_9preq *uk_9p_write_start(struct uk_9pdev *dev,
+		struct uk_9pfid *fid, uint64_t offset, uint32_t count,
+		const char *buf)
+{
+	struct uk_9preq *req;
+	int rc;
+
+	count = MIN(count, uk_9p_write_maxcount(dev, fid));
 
 	uk_pr_debug("TWRITE fid %u offset %lu count %u\n", fid->fid,
 			offset, count);
 	req = request_create(dev, UK_9P_TWRITE);
 	if (PTRISERR(req))
-		return PTR2ERR(req);
+		return req;
 
 	if ((rc = uk_9preq_write32(req, fid->fid)) ||
 		(rc = uk_9preq_write64(req, offset)) ||
 		(rc = uk_9preq_write32(req, count)) ||
-		(rc = send_and_wait_zc(dev, req, UK_9PREQ_ZCDIR_WRITE,
-				(void *)buf, count, 23)) ||
+		(rc = send_zc(dev, req, UK_9PREQ_ZCDIR_WRITE,
+				(void *)buf, count, 23))) {
+		uk_9pdev_req_remove(dev, req);
+		return ERR2PTR(rc);
+	}
+
+	return req;
+}
+
+int64_t uk_9p_write_wait(struct uk_9pdev *dev, struct uk_9preq *req)
+{
+	uint32_t count;
+	int64_t rc;
+
+	if ((rc = wait_reply(req)) ||
 		(rc = uk_9preq_read32(req, &count)))
 		goto out;
 
@@ -502,6 +556,18 @@ out:
 	return rc;
 }
 
+int64_t uk_9p_write(struct uk_9pdev *dev, struct uk_9pfid *fid,
+		uint64_t offset, uint32_t count, const char *buf)
+{
+	struct uk_9preq *req;
+
+	req = uk_9p_write_start(dev, fid, offset, count, buf);
+	if (PTRISERR(req))
+		return PTR2ERR(req);
+
+	return uk_9p_write_wait(dev, req);
+}
+
 struct uk_9preq *uk_9p_stat(struct uk_9pdev *dev, struct uk_9pfid *fid,
 		struct uk_9p_stat *stat)
 {
@@ -128,6 +128,7 @@ static void _req_mgmt_init(struct uk_9pdev_req_mgmt *req_mgmt)
 {
 	ukarch_spin_init(&req_mgmt->spinlock);
 	uk_bitmap_zero(req_mgmt->tag_bm, UK_9P_NUMTAGS);
+	req_mgmt->next_tag = 0;
 	UK_INIT_LIST_HEAD(&req_mgmt->req_list);
 	UK_INIT_LIST_HEAD(&req_mgmt->req_free_list);
 }
@@ -167,9 +168,25 @@ static void _req_mgmt_req_to_freelist_locked(struct uk_9pdev_req_mgmt *req_mgmt,
 	uk_list_add(&req->_list, &req_mgmt->req_free_list);
 }
 
-static uint16_t _req_mgmt_next_tag_locked(struct uk_9pdev_req_mgmt *req_mgmt)
+/*
+ * Tags are handed out round-robin, so that the search does not have to skip
+ * the tags of the requests in flight every time and a tag is not reused right
+ * after its request was removed. NOTAG is never handed out.
+ */
+static int _req_mgmt_next_tag_locked(struct uk_9pdev_req_mgmt *req_mgmt)
 {
-	return uk_find_next_zero_bit(req_mgmt->tag_bm, UK_9P_NUMTAGS, 0);
+	unsigned long tag;
+
+	tag = uk_find_next_zero_bit(req_mgmt->tag_bm, UK_9P_MAXTAG + 1,
+				    req_mgmt->next_tag);
+	if (tag > UK_9P_MAXTAG)
+		tag = uk_find_next_zero_bit(req_mgmt->tag_bm,
+					    UK_9P_MAXTAG + 1, 0);
+	if (tag > UK_9P_MAXTAG)
+		return -ENOMEM;
+
+	req_mgmt->next_tag = tag < UK_9P_MAXTAG ? tag + 1 : 0;
+	return tag;
 }
 
 static void _req_mgmt_cleanup(struct uk_9pdev_req_mgmt *req_mgmt __unused)
@@ -361,10 +378,19 @@ struct uk_9preq *uk_9pdev_req_create(struct uk_9pdev *dev, uint8_t type)
 	req->recv.size = MIN(req->recv.size, dev->msize);
 	req->xmit.size = MIN(req->xmit.size, dev->msize);
 
-	if (type == UK_9P_TVERSION)
+	if (type == UK_9P_TVERSION) {
 		tag = UK_9P_NOTAG;
-	else
-		tag = _req_mgmt_next_tag_locked(&dev->_req_mgmt);
+	} else {
+		rc = _req_mgmt_next_tag_locked(&dev->_req_mgmt);
+		if (rc < 0) {
+			/* All tags are in use by requests in flight. */
+			_req_mgmt_req_to_freelist_locked(&dev->_req_mgmt, req);
+			ukplat_spin_unlock_irqrestore(&dev->_req_mgmt.spinlock,
+						      flags);
+			goto out;
+		}
+		tag = rc;
+	}
 
 	req->tag = tag;
 	req->xmit.type = type;
@@ -244,6 +244,67 @@ int uk_9p_clunk(struct uk_9pdev *dev, struct uk_9pfid *fid);
 int64_t uk_9p_read(struct uk_9pdev *dev, struct uk_9pfid *fid,
 		uint64_t offset, uint32_t count, char *buf);
 
+/**
+ * Returns the maximum number of bytes that a single read request on the fid
+ * transfers, as limited by the message size of the device and the I/O unit
+ * of the fid.
+ *
+ * @param dev
+ *   The Unikraft 9P Device.
+ * @param fid
+ *   9P fid to read from.
+ * @return
+ *   Maximum count of a read request.
+ */
+static inline uint32_t uk_9p_read_maxcount(struct uk_9pdev *dev,
+		struct uk_9pfid *fid)
+{
+	uint32_t count = dev->msize - 11;
+
+	if (fid->iounit != 0)
+		count = MIN(count, fid->iounit);
+	return count;
+}
+
+/**
+ * Sends a read request without waiting for the reply, so that several
+ * requests can be in flight at the same time. The request reads at most
+ * `uk_9p_read_maxcount()` bytes. Its result must be collected with
+ * `uk_9p_read_wait()`, which also removes the request. The buffer must not be
+ * accessed until then.
+ *
+ * @param dev
+ *   The Unikraft 9P Device.
+ * @param fid
+ *   9P fid to read from.
+ * @param offset
+ *   Offset at which to start reading.
+ * @param count
+ *   Maximum number of bytes to read.
+ * @param buf
+ *   Buffer to read into.
+ * @return
+ *   - (!ERRPTR): The request in flight.
+ *   - ERRPTR: The error returned by the API.
+ */
+struct uk_9preq *uk_9p_read_start(struct uk_9pdev *dev,
+		struct uk_9pfid *fid, uint64_t offset, uint32_t count,
+		char *buf);
+
+/**
+ * Waits for the reply to a request sent with `uk_9p_read_start()` and
+ * removes the request.
+ *
+ * @param dev
+ *   The Unikraft 9P Device.
+ * @param req
+ *   The request returned by `uk_9p_read_start()`.
+ * @return
+ *   - (>= 0): Amount of bytes read.
+ *   - (< 0): An error occurred.
+ */
+int64_t uk_9p_read_wait(struct uk_9pdev *dev, struct uk_9preq *req);
+
 /**
  * Writes count bytes from buf to the fid, starting from the given offset.
  *
@@ -264,6 +325,65 @@ int64_t uk_9p_read(struct uk_9pdev *dev, struct uk_9pfid *fid,
 int64_t uk_9p_write(struct uk_9pdev *dev, struct uk_9pfid *fid,
 		uint64_t offset, uint32_t count, const char *buf);
 
+/**
+ * Returns the maximum number of bytes that a single write request on the fid
+ * transfers, as limited by the message size of the device and the I/O unit
+ * of the fid.
+ *
+ * @param dev
+ *   The Unikraft 9P Device.
+ * @param fid
+ *   9P fid to write to.
+ * @return
+ *   Maximum count of a write request.
+ */
+static inline uint32_t uk_9p_write_maxcount(struct uk_9pdev *dev,
+		struct uk_9pfid *fid)
+{
+	uint32_t count = dev->msize - 23;
+
+	if (fid->iounit != 0)
+		count = MIN(count, fid->iounit);
+	return count;
+}
+
+/**
+ * Sends a write request without waiting for the reply, like
+ * `uk_9p_read_start()`. Its result must be collected with
+ * `uk_9p_write_wait()`. The buffer must not be modified until then.
+ *
+ * @param dev
+ *   The Unikraft 9P Device.
+ * @param fid
+ *   9P fid to write to.
+ * @param offset
+ *   Offset at which to start writing.
+ * @param count
+ *   Maximum number of bytes to write.
+ * @param buf
+ *   Data to be written.
+ * @return
+ *   - (!ERRPTR): The request in flight.
+ *   - ERRPTR: The error returned by the API.
+ */
+struct uk_9preq *uk_9p_write_start(struct uk_9pdev *dev,
+		struct uk_9pfid *fid, uint64_t offset, uint32_t count,
+		const char *buf);
+
+/**
+ * Waits for the reply to a request sent with `uk_9p_write_start()` and
+ * removes the request.
+ *
+ * @param dev
+ *   The Unikraft 9P Device.
+ * @param req
+ *   The request returned by `uk_9p_write_start()`.
+ * @return
+ *   - (>= 0): Amount of bytes written.
+ *   - (< 0): An error occurred.
+ */
+int64_t uk_9p_write_wait(struct uk_9pdev *dev, struct uk_9preq *req);
+
 /**
  * Stats the given fid and places the data into the given stat structure.
  *
@@ -116,6 +116,8 @@ struct uk_9pdev_req_mgmt {
 	__spinlock                      spinlock;
 	/* Bitmap of available tags. */
 	unsigned long                   tag_bm[UK_BITS_TO_LONGS(UK_9P_NUMTAGS)];
+	/* Tag from which the search for a free tag starts. */
+	uint16_t                        next_tag;
 	/* List of requests allocated and not yet removed. */
 	struct uk_list_head             req_list;
 	/* Free-list of requests. */
@@ -70,6 +70,36 @@ int uk_alloc_register(struct uk_alloc *a)
 	return 0;
 }
 
+void uk_alloc_set_default(struct uk_alloc *a)
+{
+	struct uk_alloc **pprev = &_uk_alloc_head;
+
+	UK_ASSERT(a);
+
+	while (*pprev && *pprev != a)
+		pprev = &(*pprev)->next;
+	UK_ASSERT(*pprev == a);
+
+	*pprev = a->next;
+	a->next = _uk_alloc_head;
+	_uk_alloc_head = a;
+}
+
+void uk_alloc_unregister(struct uk_alloc *a)
+{
+	struct uk_alloc **pprev = &_uk_alloc_head;
+
+	UK_ASSERT(a);
+	UK_ASSERT(a != _uk_alloc_head);
+
+	while (*pprev && *pprev != a)
+		pprev = &(*pprev)->next;
+	UK_ASSERT(*pprev == a);
+
+	*pprev = a->next;
+	a->next = __NULL;
+}
+
 #ifdef CONFIG_HAVE_MEMTAG
 #define __align_metadata_ifpages __align(MEMTAG_GRANULE)
 #else
@@ -47,6 +47,20 @@ extern "C" {
 
 int uk_alloc_register(struct uk_alloc *a);
 
+/**
+ * Moves a registered allocator to the head of the allocator list, which
+ * makes it the default allocator. This is used by allocators that register
+ * a backing allocator before registering themselves.
+ */
+void uk_alloc_set_default(struct uk_alloc *a);
+
+/**
+ * Removes a registered allocator from the allocator list, e.g., before the
+ * memory that it manages is given back. The allocator must not be the
+ * default allocator.
+ */
+void uk_alloc_unregister(struct uk_alloc *a);
+
 /**
  * Compatibility functions that can be used by allocator implementations to
  * fill out callback functions in `struct uk_alloc` when just a subset of the
@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <uk/essentials.h>
+#include <uk/alloc_impl.h>
+#include <uk/allocpool.h>
+#include <uk/arch/lcpu.h>
+#include <uk/arch/spinlock.h>
+#include <uk/plat/lcpu.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * CACHE: MEMORY LAYOUT
+ *
+ *          ++----------------------------++
+ *          || struct uk_allocpool_cache  ||
+ *          ++----------------------------++
+ *          |    // padding //             |
+ *          +==============================+
+ *          | LCPU 0: count, obj[2 * batch]|
+ *          +==============================+
+ *          | LCPU 1: count, obj[2 * batch]|
+ *          +==============================+
+ *          |            ...               |
+ *          v                              v
+ *
+ * Every LCPU area starts on its own cache line so that LCPUs do not share
+ * cache lines when they take and return objects.
+ *
+ * An LCPU magazine holds up to `2 * batch` objects. It is refilled with
+ * `batch` objects from the pool when it runs empty. When it is full, the
+ * `batch` least recently returned objects go back to the pool. This keeps
+ * alternating take/return sequences off the pool.
+ *
+ * NOTE: Allocations are not accounted on the cache's uk_alloc statistics
+ *       since these are not maintained per LCPU. The pool accounts the
+ *       objects that are moved into and out of the caches.
+ */
+
+struct uk_allocpool_cache {
+	struct uk_alloc self;
+
+	struct uk_allocpool *pool;
+	/* Serializes batch exchanges with the pool */
+	__spinlock depot_lock;
+
+	unsigned int batch;
+	__sz lcpu_stride;
+	void *lcpu_base;
+
+	struct uk_alloc *parent;
+};
+
+struct cache_lcpu {
+	unsigned int count;
+	void *obj[];
+};
+
+static inline struct uk_allocpool_cache *ukalloc2cache(struct uk_alloc *a)
+{
+	UK_ASSERT(a);
+	return __containerof(a, struct uk_allocpool_cache, self);
+}
+
+#define cache2ukalloc(c) \
+	(&(c)->self)
+
+static inline struct cache_lcpu *cache_lcpu(struct uk_allocpool_cache *c,
+					    __lcpuidx idx)
+{
+	UK_ASSERT(idx < CONFIG_UKPLAT_LCPU_MAXCOUNT);
+	return (struct cache_lcpu *)((__uptr)c->lcpu_base +
+				     idx * c->lcpu_stride);
+}
+
+struct uk_alloc *uk_allocpool_cache2ukalloc(struct uk_allocpool_cache *c)
+{
+	UK_ASSERT(c);
+	return cache2ukalloc(c);
+}
+
+void *uk_allocpool_cache_take(struct uk_allocpool_cache *c)
+{
+	struct cache_lcpu *l;
+	unsigned long flags;
+	void *obj = NULL;
+
+	UK_ASSERT(c);
+
+	/* Objects may be returned from interrupt context and the thread may
+	 * be migrated to another LCPU, so the magazine is only accessed with
+	 * interrupts disabled
+	 */
+	flags = ukplat_lcpu_save_irqf();
+	l = cache_lcpu(c, ukplat_lcpu_idx());
+	if (unlikely(l->count == 0)) {
+		ukarch_spin_lock(&c->depot_lock);
+		l->count = uk_allocpool_take_batch(c->pool, l->obj, c->batch);
+		ukarch_spin_unlock(&c->depot_lock);
+	}
+	if (likely(l->count > 0))
+		obj = l->obj[--l->count];
+	ukplat_lcpu_restore_irqf(flags);
+
+	return obj;
+}
+
+void uk_allocpool_cache_return(struct uk_allocpool_cache *c, void *obj)
+{
+	struct cache_lcpu *l;
+	unsigned long flags;
+
+	UK_ASSERT(c);
+	UK_ASSERT(obj);
+
+	flags = ukplat_lcpu_save_irqf();
+	l = cache_lcpu(c, ukplat_lcpu_idx());
+	if (unlikely(l->count == 2 * c->batch)) {
+		/* Hand the coldest objects back and keep the hot ones */
+		ukarch_spin_lock(&c->depot_lock);
+		uk_allocpool_return_batch(c->pool, l->obj, c->batch);
+		ukarch_spin_unlock(&c->depot_lock);
+		memmove(l->obj, &l->obj[c->batch], c->batch * sizeof(void *));
+		l->count = c->batch;
+	}
+	l->obj[l->count++] = obj;
+	ukplat_lcpu_restore_irqf(flags);
+}
+
+void uk_allocpool_cache_flush(struct uk_allocpool_cache *c)
+{
+	struct cache_lcpu *l;
+	unsigned long flags;
+
+	UK_ASSERT(c);
+
+	flags = ukplat_lcpu_save_irqf();
+	l = cache_lcpu(c, ukplat_lcpu_idx());
+	if (l->count > 0) {
+		ukarch_spin_lock(&c->depot_lock);
+		uk_allocpool_return_batch(c->pool, l->obj, l->count);
+		ukarch_spin_unlock(&c->depot_lock);
+		l->count = 0;
+	}
+	ukplat_lcpu_restore_irqf(flags);
+}
+
+unsigned int uk_allocpool_cache_availcount(struct uk_allocpool_cache *c)
+{
+	unsigned int count;
+	__lcpuidx i;
+
+	UK_ASSERT(c);
+
+	count = uk_allocpool_availcount(c->pool);
+	for (i = 0; i < CONFIG_UKPLAT_LCPU_MAXCOUNT; ++i)
+		count += cache_lcpu(c, i)->count;
+	return count;
+}
+
+static void cache_free(struct uk_alloc *a, void *ptr)
+{
+	if (likely(ptr))
+		uk_allocpool_cache_return(ukalloc2cache(a), ptr);
+}
+
+static void *cache_malloc(struct uk_alloc *a, __sz size)
+{
+	struct uk_allocpool_cache *c = ukalloc2cache(a);
+	void *obj;
+
+	if (unlikely(size > uk_allocpool_objlen(c->pool))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	obj = uk_allocpool_cache_take(c);
+	if (unlikely(!obj))
+		errno = ENOMEM;
+	return obj;
+}
+
+static int cache_posix_memalign(struct uk_alloc *a, void **memptr,
+				__sz align, __sz size)
+{
+	struct uk_allocpool_cache *c = ukalloc2cache(a);
+	void *obj;
+
+	if (unlikely((size > uk_allocpool_objlen(c->pool))
+		     || (align > uk_allocpool_objalign(c->pool))))
+		return ENOMEM;
+
+	obj = uk_allocpool_cache_take(c);
+	if (unlikely(!obj))
+		return ENOMEM;
+
+	*memptr = obj;
+	return 0;
+}
+
+static __ssz cache_availmem(struct uk_alloc *a)
+{
+	struct uk_allocpool_cache *c = ukalloc2cache(a);
+
+	return (__ssz) (uk_allocpool_cache_availcount(c)
+			* uk_allocpool_objlen(c->pool));
+}
+
+static __ssz cache_maxalloc(struct uk_alloc *a)
+{
+	struct uk_allocpool_cache *c = ukalloc2cache(a);
+
+	return (__ssz) uk_allocpool_objlen(c->pool);
+}
+
+struct uk_allocpool_cache *uk_allocpool_cache_alloc(struct uk_alloc *parent,
+						    struct uk_allocpool *p,
+						    unsigned int batch)
+{
+	struct uk_allocpool_cache *c;
+	__sz stride, hdr_len;
+
+	UK_ASSERT(parent);
+	UK_ASSERT(p);
+
+	if (unlikely(batch == 0)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	stride = ALIGN_UP(sizeof(struct cache_lcpu)
+			  + 2 * (__sz) batch * sizeof(void *),
+			  CACHE_LINE_SIZE);
+	hdr_len = ALIGN_UP(sizeof(*c), CACHE_LINE_SIZE);
+	c = uk_memalign(parent, CACHE_LINE_SIZE,
+			hdr_len + CONFIG_UKPLAT_LCPU_MAXCOUNT * stride);
+	if (!c)
+		return NULL;
+
+	memset(c, 0, hdr_len + CONFIG_UKPLAT_LCPU_MAXCOUNT * stride);
+	c->pool        = p;
+	c->batch       = batch;
+	c->lcpu_stride = stride;
+	c->lcpu_base   = (void *)((__uptr) c + hdr_len);
+	c->parent      = parent;
+	ukarch_spin_init(&c->depot_lock);
+
+	uk_alloc_init_malloc(cache2ukalloc(c),
+			     cache_malloc,
+			     uk_calloc_compat,
+			     uk_realloc_compat,
+			     cache_free,
+			     cache_posix_memalign,
+			     uk_memalign_compat,
+			     cache_maxalloc,
+			     cache_availmem,
+			     NULL);
+
+	uk_pr_debug("%p: Cache created for pool %p: %u LCPUs, batches of %u objs\n",
+		    c, p, CONFIG_UKPLAT_LCPU_MAXCOUNT, batch);
+	return c;
+}
@@ -142,6 +142,16 @@ unsigned int uk_allocpool_availcount(struct uk_allocpool *p);
  */
 __sz uk_allocpool_objlen(struct uk_allocpool *p);
 
+/**
+ * Return the alignment of an object.
+ *
+ * @param p
+ *  Pointer to memory pool.
+ * @return
+ *  Alignment of an object.
+ */
+__sz uk_allocpool_objalign(struct uk_allocpool *p);
+
 /**
  * Get one object from a pool.
  * HINT: It is recommended to use this call instead of uk_malloc() whenever
@@ -197,6 +207,87 @@ void uk_allocpool_return(struct uk_allocpool *p, void *obj);
 void uk_allocpool_return_batch(struct uk_allocpool *p,
 			       void *obj[], unsigned int count);
 
+/*
+ * PER-LCPU OBJECT CACHES
+ *
+ * A pool itself does not do any locking. A cache puts a magazine of free
+ * objects in front of the pool for every logical CPU, so that objects can be
+ * taken and returned on any LCPU without taking a lock. Only when the
+ * magazine of an LCPU runs empty or full, a batch of objects is exchanged
+ * with the pool under a lock.
+ * Once a cache is attached to a pool, the pool must only be accessed through
+ * the cache.
+ */
+struct uk_allocpool_cache;
+
+/**
+ * Allocates a per-LCPU cache in front of a memory pool.
+ *
+ * @param parent
+ *  Allocator on which the cache will be allocated.
+ * @param p
+ *  Pointer to memory pool that backs the cache.
+ * @param batch
+ *  Number of objects that are exchanged with the pool at once. Every LCPU
+ *  caches up to twice this number of objects.
+ * @return
+ *  - (NULL): If allocation failed (e.g., ENOMEM).
+ *  - pointer to allocated cache.
+ */
+struct uk_allocpool_cache *uk_allocpool_cache_alloc(struct uk_alloc *parent,
+						    struct uk_allocpool *p,
+						    unsigned int batch);
+
+/**
+ * Return uk_alloc compatible interface for a cache.
+ *
+ * @param c
+ *  Pointer to cache.
+ * @return
+ *  Pointer to uk_alloc interface of given cache.
+ */
+struct uk_alloc *uk_allocpool_cache2ukalloc(struct uk_allocpool_cache *c);
+
+/**
+ * Get one object from the cache of the current LCPU.
+ *
+ * @param c
+ *  Pointer to cache.
+ * @return
+ *  - (NULL): No more free objects available.
+ *  - Pointer to object.
+ */
+void *uk_allocpool_cache_take(struct uk_allocpool_cache *c);
+
+/**
+ * Return one object to the cache of the current LCPU.
+ *
+ * @param c
+ *  Pointer to cache.
+ * @param obj
+ *  Pointer to object that should be returned.
+ */
+void uk_allocpool_cache_return(struct uk_allocpool_cache *c, void *obj);
+
+/**
+ * Return all objects of the cache of the current LCPU to the pool.
+ *
+ * @param c
+ *  Pointer to cache.
+ */
+void uk_allocpool_cache_flush(struct uk_allocpool_cache *c);
+
+/**
+ * Return the number of available objects in the pool and in all caches.
+ * Without synchronization with the other LCPUs, this is only a hint.
+ *
+ * @param c
+ *  Pointer to cache.
+ * @return
+ *  Number of free objects.
+ */
+unsigned int uk_allocpool_cache_availcount(struct uk_allocpool_cache *c);
+
 #ifdef __cplusplus
 }
 #endif
@@ -271,6 +271,11 @@ __sz uk_allocpool_objlen(struct uk_allocpool *p)
 	return p->obj_len;
 }
 
+__sz uk_allocpool_objalign(struct uk_allocpool *p)
+{
+	return p->obj_align;
+}
+
 struct uk_allocpool *uk_allocpool_init(void *base, __sz len,
 				       __sz obj_len, __sz obj_align)
 {
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/config.h>
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/allocpool.h>
+
+#define NR_OBJS		64
+#define OBJ_LEN		48
+#define OBJ_ALIGN	16
+#define CACHE_BATCH	8
+
+/* Checks that all objects are distinct and returns the number of
+ * duplicates found.
+ */
+static int count_dups(void *obj[], unsigned int count)
+{
+	unsigned int i, j;
+	int dups = 0;
+
+	for (i = 0; i < count; i++)
+		for (j = i + 1; j < count; j++)
+			dups += (obj[i] == obj[j]);
+	return dups;
+}
+
+UK_TESTCASE(ukallocpool, test_pool_batch)
+{
+	struct uk_allocpool *p;
+	void *obj[NR_OBJS + 1];
+	unsigned int cnt;
+
+	p = uk_allocpool_alloc(uk_alloc_get_default(), NR_OBJS, OBJ_LEN,
+			       OBJ_ALIGN);
+	UK_TEST_ASSERT(p != NULL);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_availcount(p), NR_OBJS);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_objalign(p), OBJ_ALIGN);
+
+	cnt = uk_allocpool_take_batch(p, obj, NR_OBJS + 1);
+	UK_TEST_EXPECT_SNUM_EQ(cnt, NR_OBJS);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_availcount(p), 0);
+	UK_TEST_EXPECT_NULL(uk_allocpool_take(p));
+	UK_TEST_EXPECT_ZERO(count_dups(obj, cnt));
+
+	uk_allocpool_return_batch(p, obj, cnt);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_availcount(p), NR_OBJS);
+}
+
+#if CONFIG_LIBUKALLOCPOOL_CACHE
+UK_TESTCASE(ukallocpool, test_cache)
+{
+	struct uk_allocpool *p;
+	struct uk_allocpool_cache *c;
+	struct uk_alloc *a;
+	void *obj[NR_OBJS];
+	unsigned int i;
+
+	p = uk_allocpool_alloc(uk_alloc_get_default(), NR_OBJS, OBJ_LEN,
+			       OBJ_ALIGN);
+	UK_TEST_ASSERT(p != NULL);
+	c = uk_allocpool_cache_alloc(uk_alloc_get_default(), p, CACHE_BATCH);
+	UK_TEST_ASSERT(c != NULL);
+	a = uk_allocpool_cache2ukalloc(c);
+
+	/* The first object pulls a whole batch into the cache */
+	obj[0] = uk_malloc(a, OBJ_LEN);
+	UK_TEST_EXPECT_NOT_NULL(obj[0]);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_availcount(p),
+			       NR_OBJS - CACHE_BATCH);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_cache_availcount(c), NR_OBJS - 1);
+
+	/* Requests that the pool cannot serve are rejected */
+	UK_TEST_EXPECT_NULL(uk_malloc(a, OBJ_LEN + OBJ_ALIGN));
+	UK_TEST_EXPECT_NULL(uk_memalign(a, 2 * OBJ_ALIGN, OBJ_LEN));
+
+	for (i = 1; i < NR_OBJS; i++) {
+		obj[i] = uk_allocpool_cache_take(c);
+		UK_TEST_EXPECT_NOT_NULL(obj[i]);
+	}
+	UK_TEST_EXPECT_NULL(uk_allocpool_cache_take(c));
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_cache_availcount(c), 0);
+	UK_TEST_EXPECT_ZERO(count_dups(obj, NR_OBJS));
+
+	/* A full magazine hands a batch back to the pool */
+	for (i = 0; i < NR_OBJS; i++)
+		uk_free(a, obj[i]);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_availcount(p),
+			       NR_OBJS - 2 * CACHE_BATCH);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_cache_availcount(c), NR_OBJS);
+
+	/* The most recently returned object is handed out first */
+	UK_TEST_EXPECT_PTR_EQ(uk_allocpool_cache_take(c), obj[NR_OBJS - 1]);
+	uk_allocpool_cache_return(c, obj[NR_OBJS - 1]);
+
+	uk_allocpool_cache_flush(c);
+	UK_TEST_EXPECT_SNUM_EQ(uk_allocpool_availcount(p), NR_OBJS);
+}
+#endif /* CONFIG_LIBUKALLOCPOOL_CACHE */
+
+uk_testsuite_register(ukallocpool, NULL);
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UKALLOCSLAB_H__
+#define __UKALLOCSLAB_H__
+
+#include <uk/alloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initializes a slab allocator on the given memory range. Pages are managed
+ * by a binary buddy allocator on the same range. Small objects are served
+ * from size-classed slabs through per-LCPU caches, larger requests directly
+ * from the page allocator. If the slab allocator is the first allocator of
+ * the system, it becomes the default allocator.
+ *
+ * @param base
+ *   Base address of the memory range
+ * @param len
+ *   Length of the memory range (bytes)
+ * @return
+ *   The allocator or NULL if the range is too small
+ */
+struct uk_alloc *uk_allocslab_init(void *base, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UKALLOCSLAB_H__ */
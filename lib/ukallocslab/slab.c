@@ -0,0 +1,545 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Slab allocator with per-LCPU caches
+ *
+ * Small requests (up to SLAB_MAX_OBJ bytes) are rounded up to one of a few
+ * size classes. Objects of a class are carved from single-page slabs. Every
+ * LCPU keeps a magazine of free objects per class, so that most allocations
+ * and releases neither take a lock nor touch shared cache lines. Magazines
+ * exchange batches of objects with the slabs of the class under a per-class
+ * lock. Larger requests are served by a binary buddy page allocator that
+ * manages the same memory, protected by a page lock.
+ *
+ * Every allocation can be classified by the page that contains the byte
+ * in front of it: Slab objects never start at the beginning of a slab page,
+ * so this page is the slab page with its header. Large allocations always
+ * have a header in this page.
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <uk/allocslab.h>
+#include <uk/allocbbuddy.h>
+#include <uk/alloc_impl.h>
+#include <uk/arch/lcpu.h>
+#include <uk/arch/limits.h>
+#include <uk/arch/paging.h>
+#include <uk/arch/spinlock.h>
+#include <uk/plat/lcpu.h>
+#include <uk/essentials.h>
+#include <uk/assert.h>
+#include <uk/print.h>
+#include <uk/list.h>
+
+#define SLAB_MAGIC		0x51ab51abU
+#define LARGE_MAGIC		0x1a26e51bU
+
+#define SLAB_MIN_ALIGN		16
+#define SLAB_MAX_OBJ		1024
+#define SLAB_NR_CLASSES		ARRAY_SIZE(slab_class_len)
+#define SLAB_MAG_SIZE		CONFIG_LIBUKALLOCSLAB_MAGSIZE
+#define SLAB_MAG_BATCH		(SLAB_MAG_SIZE / 2)
+
+#define size_to_num_pages(size) \
+	(PAGE_ALIGN_UP((unsigned long)(size)) / __PAGE_SIZE)
+/* Page that holds the header of an allocation */
+#define hdr_page(ptr) \
+	PAGE_ALIGN_DOWN((__uptr)(ptr) - 1)
+
+static const __u16 slab_class_len[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+
+/* Header at the beginning of every slab page */
+struct slab_page {
+	__u32 magic;
+	__u16 cls;
+	__u16 nr_free;
+	/* Free objects, linked through their first word */
+	void *free;
+	/* Entry in the partial list of the class while objects are free */
+	struct uk_list_head list;
+};
+
+/* Header of an allocation that is served by the page allocator */
+struct large_hdr {
+	__u32 magic;
+	void *base;
+	unsigned long num_pages;
+	/* Usable size of the allocation */
+	__sz len;
+};
+
+struct slab_class {
+	__spinlock lock;
+	__u16 obj_len;
+	/* Alignment of objects and offset of the first object in a slab */
+	__u16 obj_align;
+	__u16 obj_off;
+	__u16 nr_objs;
+	/* Slabs with free objects. Partially used slabs are kept at the
+	 * front so that slabs fill up and empty slabs can be released.
+	 */
+	struct uk_list_head partial;
+	/* Number of completely free slabs, we keep at most one */
+	unsigned int nr_empty;
+};
+
+struct slab_mag {
+	unsigned int count;
+	void *obj[SLAB_MAG_SIZE];
+};
+
+struct slab_lcpu {
+	struct slab_mag mag[SLAB_NR_CLASSES];
+} __align(CACHE_LINE_SIZE);
+
+struct uk_allocslab {
+	struct uk_alloc self;
+
+	/* Page allocator and the lock that serializes access to it */
+	struct uk_alloc *pa;
+	__spinlock page_lock;
+
+	/* Size class index by size in units of SLAB_MIN_ALIGN */
+	__u8 size_class[SLAB_MAX_OBJ / SLAB_MIN_ALIGN + 1];
+	struct slab_class cls[SLAB_NR_CLASSES];
+	struct slab_lcpu lcpu[CONFIG_UKPLAT_LCPU_MAXCOUNT];
+};
+
+static inline struct uk_allocslab *ukalloc2slab(struct uk_alloc *a)
+{
+	UK_ASSERT(a);
+	return __containerof(a, struct uk_allocslab, self);
+}
+
+static inline int slab_class_of(struct uk_allocslab *s, __sz size)
+{
+	if (size > SLAB_MAX_OBJ)
+		return -1;
+	return s->size_class[DIV_ROUND_UP(size, SLAB_MIN_ALIGN)];
+}
+
+/* Freeing a slab object from interrupt context may release its page, so the
+ * page lock is only taken with interrupts disabled
+ */
+static void *slab_page_alloc(struct uk_allocslab *s, unsigned long num_pages)
+{
+	unsigned long flags;
+	void *p;
+
+	flags = ukplat_lcpu_save_irqf();
+	ukarch_spin_lock(&s->page_lock);
+	p = uk_palloc(s->pa, num_pages);
+	ukarch_spin_unlock(&s->page_lock);
+	ukplat_lcpu_restore_irqf(flags);
+	return p;
+}
+
+static void slab_page_free(struct uk_allocslab *s, void *p,
+			   unsigned long num_pages)
+{
+	unsigned long flags;
+
+	flags = ukplat_lcpu_save_irqf();
+	ukarch_spin_lock(&s->page_lock);
+	uk_pfree(s->pa, p, num_pages);
+	ukarch_spin_unlock(&s->page_lock);
+	ukplat_lcpu_restore_irqf(flags);
+}
+
+/* Must be called with the class lock held */
+static struct slab_page *slab_create(struct uk_allocslab *s, unsigned int ci)
+{
+	struct slab_class *c = &s->cls[ci];
+	struct slab_page *sp;
+	__u8 *obj;
+	unsigned int i;
+
+	sp = slab_page_alloc(s, 1);
+	if (unlikely(!sp))
+		return NULL;
+
+	sp->magic = SLAB_MAGIC;
+	sp->cls = ci;
+	sp->nr_free = c->nr_objs;
+	sp->free = NULL;
+
+	/* Link the objects so that they are handed out in address order */
+	obj = (__u8 *)sp + c->obj_off + (c->nr_objs - 1) * c->obj_len;
+	for (i = 0; i < c->nr_objs; ++i, obj -= c->obj_len) {
+		*(void **)obj = sp->free;
+		sp->free = obj;
+	}
+
+	uk_list_add_tail(&sp->list, &c->partial);
+	c->nr_empty++;
+	return sp;
+}
+
+static unsigned int slab_class_take(struct uk_allocslab *s, unsigned int ci,
+				    void *obj[], unsigned int count)
+{
+	struct slab_class *c = &s->cls[ci];
+	struct slab_page *sp;
+	unsigned int n = 0;
+
+	ukarch_spin_lock(&c->lock);
+	while (n < count) {
+		if (uk_list_empty(&c->partial) && !slab_create(s, ci))
+			break;
+
+		sp = uk_list_first_entry(&c->partial, struct slab_page, list);
+		if (sp->nr_free == c->nr_objs)
+			c->nr_empty--;
+		while (n < count && sp->free) {
+			obj[n++] = sp->free;
+			sp->free = *(void **)sp->free;
+			sp->nr_free--;
+		}
+		if (!sp->free)
+			uk_list_del(&sp->list);
+	}
+	ukarch_spin_unlock(&c->lock);
+
+	return n;
+}
+
+static void slab_class_return(struct uk_allocslab *s, unsigned int ci,
+			      void *obj[], unsigned int count)
+{
+	struct slab_class *c = &s->cls[ci];
+	struct slab_page *sp;
+	unsigned int i;
+
+	ukarch_spin_lock(&c->lock);
+	for (i = 0; i < count; ++i) {
+		sp = (struct slab_page *)hdr_page(obj[i]);
+		UK_ASSERT(sp->magic == SLAB_MAGIC && sp->cls == ci);
+
+		*(void **)obj[i] = sp->free;
+		sp->free = obj[i];
+		if (sp->nr_free++ == 0)
+			uk_list_add(&sp->list, &c->partial);
+		if (sp->nr_free < c->nr_objs)
+			continue;
+
+		/* The slab became empty */
+		if (c->nr_empty > 0) {
+			uk_list_del(&sp->list);
+			sp->magic = 0;
+			slab_page_free(s, sp, 1);
+		} else {
+			uk_list_move_tail(&sp->list, &c->partial);
+			c->nr_empty++;
+		}
+	}
+	ukarch_spin_unlock(&c->lock);
+}
+
+static void *slab_obj_take(struct uk_allocslab *s, unsigned int ci)
+{
+	struct slab_mag *m;
+	unsigned long flags;
+	void *obj = NULL;
+
+	/* Objects may be freed from interrupt context and the thread may be
+	 * migrated to another LCPU, so the magazine is only accessed with
+	 * interrupts disabled
+	 */
+	flags = ukplat_lcpu_save_irqf();
+	m = &s->lcpu[ukplat_lcpu_idx()].mag[ci];
+	if (unlikely(m->count == 0))
+		m->count = slab_class_take(s, ci, m->obj, SLAB_MAG_BATCH);
+	if (likely(m->count > 0))
+		obj = m->obj[--m->count];
+	ukplat_lcpu_restore_irqf(flags);
+
+	return obj;
+}
+
+static void slab_obj_return(struct uk_allocslab *s, unsigned int ci,
+			    void *obj)
+{
+	struct slab_mag *m;
+	unsigned long flags;
+
+	flags = ukplat_lcpu_save_irqf();
+	m = &s->lcpu[ukplat_lcpu_idx()].mag[ci];
+	if (unlikely(m->count == SLAB_MAG_SIZE)) {
+		/* Hand the coldest objects back and keep the hot ones */
+		slab_class_return(s, ci, m->obj, SLAB_MAG_BATCH);
+		memmove(m->obj, &m->obj[SLAB_MAG_BATCH],
+			(SLAB_MAG_SIZE - SLAB_MAG_BATCH) * sizeof(void *));
+		m->count -= SLAB_MAG_BATCH;
+	}
+	m->obj[m->count++] = obj;
+	ukplat_lcpu_restore_irqf(flags);
+}
+
+static void *large_alloc(struct uk_allocslab *s, __sz align, __sz size)
+{
+	struct large_hdr *hdr;
+	unsigned long num_pages;
+	__uptr base, ptr;
+	__sz off;
+
+	align = MAX(align, (__sz)SLAB_MIN_ALIGN);
+	size = MAX(size, (__sz)1);
+	if (unlikely(size > __SZ_MAX - 2 * MAX(align, (__sz)__PAGE_SIZE)))
+		return NULL;
+
+	/* The header is in the page in front of the allocation if the
+	 * alignment does not leave room for it in the same page.
+	 */
+	off = ALIGN_UP(sizeof(*hdr), align);
+	if (off < __PAGE_SIZE)
+		num_pages = size_to_num_pages(off + size);
+	else
+		num_pages = align / __PAGE_SIZE + size_to_num_pages(size);
+
+	base = (__uptr)slab_page_alloc(s, num_pages);
+	if (unlikely(!base))
+		return NULL;
+
+	if (off < __PAGE_SIZE)
+		ptr = base + off;
+	else
+		ptr = ALIGN_UP(base + __PAGE_SIZE, align);
+
+	hdr = (struct large_hdr *)hdr_page(ptr);
+	hdr->magic = LARGE_MAGIC;
+	hdr->base = (void *)base;
+	hdr->num_pages = num_pages;
+	hdr->len = base + num_pages * __PAGE_SIZE - ptr;
+	return (void *)ptr;
+}
+
+static __sz slab_usable_size(struct uk_allocslab *s, void *ptr)
+{
+	struct slab_page *sp = (struct slab_page *)hdr_page(ptr);
+	struct large_hdr *hdr;
+
+	if (sp->magic == SLAB_MAGIC)
+		return s->cls[sp->cls].obj_len;
+
+	hdr = (struct large_hdr *)sp;
+	UK_ASSERT(hdr->magic == LARGE_MAGIC);
+	return hdr->len;
+}
+
+static void slab_free(struct uk_alloc *a, void *ptr)
+{
+	struct uk_allocslab *s = ukalloc2slab(a);
+	struct slab_page *sp;
+	struct large_hdr *hdr;
+
+	if (unlikely(!ptr))
+		return;
+
+	uk_alloc_stats_count_free(a, ptr, slab_usable_size(s, ptr));
+
+	sp = (struct slab_page *)hdr_page(ptr);
+	if (sp->magic == SLAB_MAGIC) {
+		slab_obj_return(s, sp->cls, ptr);
+		return;
+	}
+
+	hdr = (struct large_hdr *)sp;
+	UK_ASSERT(hdr->magic == LARGE_MAGIC);
+	hdr->magic = 0;
+	slab_page_free(s, hdr->base, hdr->num_pages);
+}
+
+static void *slab_malloc(struct uk_alloc *a, __sz size)
+{
+	struct uk_allocslab *s = ukalloc2slab(a);
+	void *ptr;
+	int ci;
+
+	ci = slab_class_of(s, size);
+	if (ci >= 0)
+		ptr = slab_obj_take(s, ci);
+	else
+		ptr = large_alloc(s, 0, size);
+
+	if (unlikely(!ptr)) {
+		uk_alloc_stats_count_enomem(a, size);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	uk_alloc_stats_count_alloc(a, ptr, slab_usable_size(s, ptr));
+	return ptr;
+}
+
+static int slab_posix_memalign(struct uk_alloc *a, void **memptr, __sz align,
+			       __sz size)
+{
+	struct uk_allocslab *s = ukalloc2slab(a);
+	unsigned int i;
+	void *ptr = NULL;
+	int ci;
+
+	if (unlikely(!POWER_OF_2(align)))
+		return EINVAL;
+
+	/* Find the first class that also satisfies the alignment */
+	ci = slab_class_of(s, size);
+	if (ci >= 0) {
+		for (i = ci; i < SLAB_NR_CLASSES; ++i) {
+			if (s->cls[i].obj_align >= align) {
+				ptr = slab_obj_take(s, i);
+				break;
+			}
+		}
+		if (i == SLAB_NR_CLASSES)
+			ptr = large_alloc(s, align, size);
+	} else {
+		ptr = large_alloc(s, align, size);
+	}
+
+	if (unlikely(!ptr)) {
+		uk_alloc_stats_count_enomem(a, size);
+		return ENOMEM;
+	}
+
+	uk_alloc_stats_count_alloc(a, ptr, slab_usable_size(s, ptr));
+	*memptr = ptr;
+	return 0;
+}
+
+static void *slab_realloc(struct uk_alloc *a, void *ptr, __sz size)
+{
+	struct uk_allocslab *s = ukalloc2slab(a);
+	void *retptr;
+	__sz len;
+
+	if (!ptr)
+		return slab_malloc(a, size);
+
+	if (!size) {
+		slab_free(a, ptr);
+		return NULL;
+	}
+
+	len = slab_usable_size(s, ptr);
+	if (size <= len)
+		return ptr;
+
+	retptr = slab_malloc(a, size);
+	if (!retptr)
+		return NULL;
+
+	memcpy(retptr, ptr, len);
+	slab_free(a, ptr);
+	return retptr;
+}
+
+static void *slab_palloc(struct uk_alloc *a, unsigned long num_pages)
+{
+	return slab_page_alloc(ukalloc2slab(a), num_pages);
+}
+
+static void slab_pfree(struct uk_alloc *a, void *ptr, unsigned long num_pages)
+{
+	slab_page_free(ukalloc2slab(a), ptr, num_pages);
+}
+
+static __ssz slab_maxalloc(struct uk_alloc *a)
+{
+	return uk_alloc_maxalloc(ukalloc2slab(a)->pa);
+}
+
+static __ssz slab_availmem(struct uk_alloc *a)
+{
+	return uk_alloc_availmem(ukalloc2slab(a)->pa);
+}
+
+static long slab_pmaxalloc(struct uk_alloc *a)
+{
+	return uk_alloc_pmaxalloc(ukalloc2slab(a)->pa);
+}
+
+static long slab_pavailmem(struct uk_alloc *a)
+{
+	return uk_alloc_pavailmem(ukalloc2slab(a)->pa);
+}
+
+static int slab_addmem(struct uk_alloc *a, void *base, __sz len)
+{
+	struct uk_allocslab *s = ukalloc2slab(a);
+	unsigned long flags;
+	int rc;
+
+	flags = ukplat_lcpu_save_irqf();
+	ukarch_spin_lock(&s->page_lock);
+	rc = uk_alloc_addmem(s->pa, base, len);
+	ukarch_spin_unlock(&s->page_lock);
+	ukplat_lcpu_restore_irqf(flags);
+	return rc;
+}
+
+struct uk_alloc *uk_allocslab_init(void *base, size_t len)
+{
+	struct uk_allocslab *s;
+	struct slab_class *c;
+	struct uk_alloc *pa;
+	struct uk_alloc *a;
+	unsigned int i, ci;
+
+	pa = uk_allocbbuddy_init(base, len);
+	if (!pa)
+		return NULL;
+
+	s = uk_palloc(pa, size_to_num_pages(sizeof(*s)));
+	if (!s) {
+		uk_pr_err("Not enough space for slab allocator: %"__PRIsz" B required\n",
+			  sizeof(*s));
+		return NULL;
+	}
+	memset(s, 0, sizeof(*s));
+	a = &s->self;
+	uk_pr_info("Initialize slab allocator %"__PRIuptr"\n", (__uptr)a);
+
+	s->pa = pa;
+	ukarch_spin_init(&s->page_lock);
+
+	for (ci = 0; ci < SLAB_NR_CLASSES; ++ci) {
+		c = &s->cls[ci];
+		ukarch_spin_init(&c->lock);
+		UK_INIT_LIST_HEAD(&c->partial);
+		c->obj_len   = slab_class_len[ci];
+		/* Largest power of two that divides the object size */
+		c->obj_align = c->obj_len & -c->obj_len;
+		c->obj_off   = ALIGN_UP(sizeof(struct slab_page), c->obj_align);
+		c->nr_objs   = (__PAGE_SIZE - c->obj_off) / c->obj_len;
+		UK_ASSERT(c->nr_objs > 1);
+	}
+	for (i = 0, ci = 0; i < ARRAY_SIZE(s->size_class); ++i) {
+		while (slab_class_len[ci] < i * SLAB_MIN_ALIGN)
+			++ci;
+		s->size_class[i] = ci;
+	}
+
+	uk_alloc_init_malloc(a, slab_malloc, uk_calloc_compat, slab_realloc,
+			     slab_free, slab_posix_memalign,
+			     uk_memalign_compat, slab_maxalloc, slab_availmem,
+			     slab_addmem);
+	a->palloc    = slab_palloc;
+	a->pfree     = slab_pfree;
+	a->pmaxalloc = slab_pmaxalloc;
+	a->pavailmem = slab_pavailmem;
+
+	/* Take the place of our page allocator as default allocator */
+	if (_uk_alloc_head == pa)
+		uk_alloc_set_default(a);
+
+	return a;
+}
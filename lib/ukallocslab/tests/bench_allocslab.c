@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/alloc_impl.h>
+#include <uk/allocslab.h>
+#include <uk/allocbbuddy.h>
+#include <uk/arch/limits.h>
+#include <uk/arch/paging.h>
+#include <uk/plat/time.h>
+
+#define HEAP_PAGES		2048
+#define NR_LIVE			256
+#define BENCH_ITERATIONS	50000
+
+/* Unregisters the allocators that were set up in the heap, i.e., the heap
+ * allocator and its page allocator, and gives the heap back
+ */
+static void del_heap(void *base)
+{
+	__uptr start = (__uptr)base;
+	__uptr end = start + HEAP_PAGES * __PAGE_SIZE;
+	struct uk_alloc *a;
+	int found;
+
+	do {
+		found = 0;
+		uk_alloc_foreach(a) {
+			if ((__uptr)a >= start && (__uptr)a < end) {
+				uk_alloc_unregister(a);
+				found = 1;
+				break;
+			}
+		}
+	} while (found);
+
+	uk_pfree(uk_alloc_get_default(), base, HEAP_PAGES);
+}
+
+static struct uk_alloc *new_heap(struct uk_alloc *(*init)(void *, size_t),
+				 void **base)
+{
+	struct uk_alloc *a;
+
+	*base = uk_palloc(uk_alloc_get_default(), HEAP_PAGES);
+	if (!*base)
+		return NULL;
+	a = init(*base, HEAP_PAGES * __PAGE_SIZE);
+	if (!a)
+		del_heap(*base);
+	return a;
+}
+
+static __u32 lcg_next(__u32 *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+/* Keeps a window of live allocations with random small sizes and replaces
+ * the oldest one in every iteration. Returns the elapsed time in ns.
+ */
+static __nsec bench_churn(struct uk_alloc *a)
+{
+	static void *obj[NR_LIVE];
+	__u32 seed = 42;
+	__nsec start;
+	unsigned int i;
+
+	memset(obj, 0, sizeof(obj));
+	start = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		uk_free(a, obj[i % NR_LIVE]);
+		obj[i % NR_LIVE] = uk_malloc(a, 8 + lcg_next(&seed) % 504);
+	}
+	for (i = 0; i < NR_LIVE; i++)
+		uk_free(a, obj[i]);
+	return ukplat_monotonic_clock() - start;
+}
+
+UK_TESTCASE(ukallocslab_bench, bench_slab_vs_bbuddy)
+{
+	struct uk_alloc *slab, *bbuddy;
+	__nsec t_slab, t_bbuddy;
+	void *slab_base, *bbuddy_base;
+
+	slab = new_heap(uk_allocslab_init, &slab_base);
+	UK_TEST_ASSERT(slab != NULL);
+	bbuddy = new_heap(uk_allocbbuddy_init, &bbuddy_base);
+	UK_TEST_ASSERT(bbuddy != NULL);
+
+	t_slab = bench_churn(slab);
+	t_bbuddy = bench_churn(bbuddy);
+	uk_pr_info("%u malloc/free pairs: slab %"__PRIu64" ns, bbuddy %"__PRIu64" ns\n",
+		   BENCH_ITERATIONS, t_slab, t_bbuddy);
+
+	del_heap(bbuddy_base);
+	del_heap(slab_base);
+}
+
+uk_testsuite_register(ukallocslab_bench, NULL);
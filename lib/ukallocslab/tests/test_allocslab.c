@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/alloc_impl.h>
+#include <uk/allocslab.h>
+#include <uk/allocbbuddy.h>
+#include <uk/arch/limits.h>
+#include <uk/arch/paging.h>
+
+#define HEAP_PAGES		2048
+#define NR_LIVE			256
+#define NR_SMALL		1000
+#define SMALL_LEN		64
+
+/* Unregisters the allocators that were set up in the heap, i.e., the heap
+ * allocator and its page allocator, and gives the heap back
+ */
+static void del_heap(void *base)
+{
+	__uptr start = (__uptr)base;
+	__uptr end = start + HEAP_PAGES * __PAGE_SIZE;
+	struct uk_alloc *a;
+	int found;
+
+	do {
+		found = 0;
+		uk_alloc_foreach(a) {
+			if ((__uptr)a >= start && (__uptr)a < end) {
+				uk_alloc_unregister(a);
+				found = 1;
+				break;
+			}
+		}
+	} while (found);
+
+	uk_pfree(uk_alloc_get_default(), base, HEAP_PAGES);
+}
+
+static struct uk_alloc *new_heap(struct uk_alloc *(*init)(void *, size_t),
+				 void **base)
+{
+	struct uk_alloc *a;
+
+	*base = uk_palloc(uk_alloc_get_default(), HEAP_PAGES);
+	if (!*base)
+		return NULL;
+	a = init(*base, HEAP_PAGES * __PAGE_SIZE);
+	if (!a)
+		del_heap(*base);
+	return a;
+}
+
+static __u32 lcg_next(__u32 *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+/* Allocates objects of many sizes, fills each with its own pattern and
+ * checks that no allocation overwrote another one. Returns the number of
+ * errors found.
+ */
+static int fill_and_check(struct uk_alloc *a)
+{
+	static void *obj[NR_LIVE];
+	__sz len[NR_LIVE];
+	__u32 seed = 1;
+	unsigned int i, j;
+	int err = 0;
+
+	for (i = 0; i < NR_LIVE; i++) {
+		len[i] = (i < 16) ? i : lcg_next(&seed) % 3000;
+		obj[i] = uk_malloc(a, len[i]);
+		if (!obj[i])
+			return -1;
+		err += ((__uptr)obj[i] & 15) != 0;
+		memset(obj[i], (int)i, len[i]);
+	}
+	for (i = 0; i < NR_LIVE; i++) {
+		for (j = 0; j < len[i]; j++)
+			err += ((__u8 *)obj[i])[j] != (__u8)i;
+		uk_free(a, obj[i]);
+	}
+	return err;
+}
+
+UK_TESTCASE(ukallocslab, test_slab_malloc)
+{
+	struct uk_alloc *a;
+	__ssz avail;
+	void *base;
+	void *p;
+
+	a = new_heap(uk_allocslab_init, &base);
+	UK_TEST_ASSERT(a != NULL);
+	avail = uk_alloc_availmem(a);
+
+	UK_TEST_EXPECT_ZERO(fill_and_check(a));
+	/* Another round reuses the cached objects and slabs */
+	UK_TEST_EXPECT_ZERO(fill_and_check(a));
+
+	/* Large allocations go back to the page allocator */
+	p = uk_malloc(a, 64 * __PAGE_SIZE);
+	UK_TEST_EXPECT_NOT_NULL(p);
+	UK_TEST_EXPECT(uk_alloc_availmem(a) < avail);
+	uk_free(a, p);
+	UK_TEST_EXPECT_SNUM_GE(uk_alloc_availmem(a), avail - 64 * __PAGE_SIZE);
+
+	del_heap(base);
+}
+
+UK_TESTCASE(ukallocslab, test_slab_memalign)
+{
+	static const __sz sizes[] = { 1, 100, 1000, 5000 };
+	struct uk_alloc *a;
+	unsigned int i;
+	__sz align;
+	void *base;
+	void *p;
+
+	a = new_heap(uk_allocslab_init, &base);
+	UK_TEST_ASSERT(a != NULL);
+
+	for (align = sizeof(void *); align <= 4 * __PAGE_SIZE; align <<= 1) {
+		for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+			p = uk_memalign(a, align, sizes[i]);
+			UK_TEST_EXPECT_NOT_NULL(p);
+			if (!p)
+				continue;
+			UK_TEST_EXPECT_ZERO((__uptr)p & (align - 1));
+			memset(p, 0xa5, sizes[i]);
+			uk_free(a, p);
+		}
+	}
+
+	del_heap(base);
+}
+
+UK_TESTCASE(ukallocslab, test_slab_realloc)
+{
+	struct uk_alloc *a;
+	__u8 *p, *q;
+	__sz len;
+	int err = 0;
+	void *base;
+	__sz i;
+
+	a = new_heap(uk_allocslab_init, &base);
+	UK_TEST_ASSERT(a != NULL);
+
+	p = uk_malloc(a, 10);
+	UK_TEST_ASSERT(p != NULL);
+	memset(p, 0x5a, 10);
+	for (len = 10; len < 3 * __PAGE_SIZE; len = len * 3 / 2) {
+		q = uk_realloc(a, p, len * 3 / 2);
+		UK_TEST_ASSERT(q != NULL);
+		for (i = 0; i < len; i++)
+			err += q[i] != 0x5a;
+		memset(q, 0x5a, len * 3 / 2);
+		p = q;
+	}
+	UK_TEST_EXPECT_ZERO(err);
+	uk_free(a, p);
+
+	del_heap(base);
+}
+
+/* Returns the memory taken from the allocator for NR_SMALL small objects */
+static __ssz footprint(struct uk_alloc *a)
+{
+	static void *obj[NR_SMALL];
+	__ssz before, after;
+	unsigned int i;
+
+	before = uk_alloc_availmem(a);
+	for (i = 0; i < NR_SMALL; i++)
+		obj[i] = uk_malloc(a, SMALL_LEN);
+	after = uk_alloc_availmem(a);
+	for (i = 0; i < NR_SMALL; i++)
+		uk_free(a, obj[i]);
+	return before - after;
+}
+
+UK_TESTCASE(ukallocslab, test_slab_footprint)
+{
+	struct uk_alloc *slab, *bbuddy;
+	__ssz m_slab, m_bbuddy;
+	void *slab_base, *bbuddy_base;
+
+	slab = new_heap(uk_allocslab_init, &slab_base);
+	UK_TEST_ASSERT(slab != NULL);
+	bbuddy = new_heap(uk_allocbbuddy_init, &bbuddy_base);
+	UK_TEST_ASSERT(bbuddy != NULL);
+
+	/* Slabs pack small objects densely instead of using a page each */
+	m_slab = footprint(slab);
+	m_bbuddy = footprint(bbuddy);
+	UK_TEST_EXPECT_SNUM_LT(m_slab, m_bbuddy / 8);
+
+	del_heap(bbuddy_base);
+	del_heap(slab_base);
+}
+
+uk_testsuite_register(ukallocslab, NULL);
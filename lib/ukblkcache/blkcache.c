@@ -0,0 +1,674 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <uk/alloc.h>
+#include <uk/arch/limits.h>
+#include <uk/assert.h>
+#include <uk/atomic.h>
+#include <uk/blkcache.h>
+#include <uk/blkdev.h>
+#include <uk/errptr.h>
+#include <uk/mutex.h>
+#include <uk/print.h>
+#include <uk/sched.h>
+#include <uk/wait.h>
+
+#define BUF_VALID		0x1	/* Data matches or supersedes disk */
+#define BUF_DIRTY		0x2	/* Data must be written back */
+#define BUF_IO			0x4	/* Request in flight */
+
+/* Number of dirty blocks written at once to make room */
+#define WRITEBACK_BATCH		32
+
+struct uk_blkcache {
+	struct uk_blkdev *dev;
+	struct uk_alloc *a;
+	__sz bsize;
+	__sector spb;			/* Sectors per block */
+	__sector nblocks;
+	__sz align;
+
+	struct uk_mutex lock;
+	struct uk_hlist_head *hash;
+	unsigned long hash_mask;
+	struct uk_list_head lru;	/* Least recently used first */
+	unsigned long nbufs;
+	unsigned long maxbufs;
+	unsigned long ndirty;
+	__sector last_miss;
+
+	int polled;			/* No interrupts, poll for completions */
+	struct uk_waitq wq;
+	unsigned long completions;
+};
+
+static inline struct uk_hlist_head *blkcache_bucket(struct uk_blkcache *bc,
+						    __sector blkno)
+{
+	return &bc->hash[(blkno * 0x9e3779b97f4a7c15ULL >> 32) & bc->hash_mask];
+}
+
+static struct uk_blkbuf *blkcache_lookup(struct uk_blkcache *bc,
+					 __sector blkno)
+{
+	struct uk_blkbuf *buf;
+
+	uk_hlist_for_each_entry(buf, blkcache_bucket(bc, blkno), hash_link) {
+		if (buf->blkno == blkno)
+			return buf;
+	}
+	return NULL;
+}
+
+/* Called by the driver when a request completes, possibly in interrupt
+ * context
+ */
+static void blkcache_req_done(struct uk_blkreq *req __unused, void *cookie)
+{
+	struct uk_blkcache *bc = (struct uk_blkcache *)cookie;
+
+	uk_inc(&bc->completions);
+	if (!bc->polled)
+		uk_waitq_wake_up(&bc->wq);
+}
+
+/* Requests complete with blkcache_req_done(), so the queue event does not
+ * refer to a particular cache
+ */
+static void blkcache_queue_event(struct uk_blkdev *dev, uint16_t queue_id,
+				 void *argp __unused)
+{
+	uk_blkdev_queue_finish_reqs(dev, queue_id);
+}
+
+static void blkcache_wait_req(struct uk_blkcache *bc, struct uk_blkreq *req)
+{
+	if (!bc->polled) {
+		uk_waitq_wait_event(&bc->wq, uk_blkreq_is_done(req));
+		return;
+	}
+
+	for (;;) {
+		uk_blkdev_queue_finish_reqs(bc->dev, 0);
+		if (uk_blkreq_is_done(req))
+			break;
+		uk_sched_yield();
+	}
+}
+
+/* Waits until at least one request completed, to make room in the queue */
+static void blkcache_wait_any(struct uk_blkcache *bc)
+{
+	unsigned long c = uk_load_n(&bc->completions);
+
+	if (bc->polled) {
+		uk_blkdev_queue_finish_reqs(bc->dev, 0);
+		if (uk_load_n(&bc->completions) == c)
+			uk_sched_yield();
+		return;
+	}
+	uk_waitq_wait_event(&bc->wq, uk_load_n(&bc->completions) != c);
+}
+
+static int blkcache_submit_req(struct uk_blkcache *bc, struct uk_blkreq *req,
+			       int wait)
+{
+	int rc;
+
+	for (;;) {
+		rc = uk_blkdev_queue_submit_one(bc->dev, 0, req);
+		if (uk_blkdev_status_successful(rc))
+			return 0;
+		if (unlikely(rc < 0))
+			return rc;
+		if (!wait)
+			return -EAGAIN;
+
+		/* The queue is full */
+		blkcache_wait_any(bc);
+	}
+}
+
+static int blkcache_submit(struct uk_blkcache *bc, struct uk_blkbuf *buf,
+			   enum uk_blkreq_op op, int wait)
+{
+	int rc;
+
+	UK_ASSERT(!(buf->flags & BUF_IO));
+
+	uk_blkreq_init(&buf->req, op, buf->blkno * bc->spb, bc->spb,
+		       buf->data, blkcache_req_done, bc);
+	rc = blkcache_submit_req(bc, &buf->req, wait);
+	if (unlikely(rc))
+		return rc;
+
+	buf->flags |= BUF_IO;
+	if (op == UK_BLKREQ_WRITE) {
+		buf->flags &= ~BUF_DIRTY;
+		bc->ndirty--;
+	}
+	return 0;
+}
+
+/* Completes the request of a buffer once it finished */
+static int blkcache_end_io(struct uk_blkcache *bc, struct uk_blkbuf *buf)
+{
+	int rc = buf->req.result;
+
+	UK_ASSERT(buf->flags & BUF_IO);
+	UK_ASSERT(uk_blkreq_is_done(&buf->req));
+
+	buf->flags &= ~BUF_IO;
+	if (buf->req.operation == UK_BLKREQ_READ) {
+		if (likely(rc >= 0))
+			buf->flags |= BUF_VALID;
+	} else if (unlikely(rc < 0) && !(buf->flags & BUF_DIRTY)) {
+		/* Keep the data so that it is written again */
+		buf->flags |= BUF_DIRTY;
+		bc->ndirty++;
+	}
+
+	if (unlikely(rc < 0)) {
+		uk_pr_err("blkdev%"__PRIu16": Failed to %s block %"__PRIsctr": %d\n",
+			  uk_blkdev_id_get(bc->dev),
+			  buf->req.operation == UK_BLKREQ_READ ?
+			  "read" : "write", buf->blkno, rc);
+		return -EIO;
+	}
+	return 0;
+}
+
+static int blkcache_wait(struct uk_blkcache *bc, struct uk_blkbuf *buf)
+{
+	if (!(buf->flags & BUF_IO))
+		return 0;
+
+	blkcache_wait_req(bc, &buf->req);
+	return blkcache_end_io(bc, buf);
+}
+
+/* Writes back dirty blocks, at most `max` unless 0. Blocks that are referenced
+ * are included only if `all` is set.
+ */
+static int blkcache_writeback(struct uk_blkcache *bc, unsigned long max,
+			      int all)
+{
+	struct uk_blkbuf *buf;
+	unsigned long n = 0;
+	int rc = 0, ret;
+
+	uk_list_for_each_entry(buf, &bc->lru, lru_link) {
+		if (!(buf->flags & BUF_DIRTY) || (buf->flags & BUF_IO))
+			continue;
+		if (buf->refs && !all)
+			continue;
+
+		ret = blkcache_submit(bc, buf, UK_BLKREQ_WRITE, 1);
+		if (unlikely(ret)) {
+			rc = ret;
+			break;
+		}
+		if (++n == max)
+			break;
+	}
+
+	uk_list_for_each_entry(buf, &bc->lru, lru_link) {
+		if (!(buf->flags & BUF_IO) ||
+		    buf->req.operation != UK_BLKREQ_WRITE)
+			continue;
+		ret = blkcache_wait(bc, buf);
+		if (unlikely(ret) && !rc)
+			rc = ret;
+	}
+	return rc;
+}
+
+static struct uk_blkbuf *blkcache_new(struct uk_blkcache *bc)
+{
+	struct uk_blkbuf *buf;
+
+	buf = uk_malloc(bc->a, sizeof(*buf));
+	if (unlikely(!buf))
+		return NULL;
+
+	buf->data = uk_memalign(bc->a, bc->align, bc->bsize);
+	if (unlikely(!buf->data)) {
+		uk_free(bc->a, buf);
+		return NULL;
+	}
+
+	UK_INIT_HLIST_NODE(&buf->hash_link);
+	uk_list_add_tail(&buf->lru_link, &bc->lru);
+	buf->bc = bc;
+	buf->refs = 0;
+	buf->flags = 0;
+	bc->nbufs++;
+	return buf;
+}
+
+/*
+ * Returns an unreferenced buffer that is not in the hash table anymore. If
+ * the cache is full, the least recently used clean buffer is reused. If
+ * `wait` is set, dirty buffers are written back and requests in flight are
+ * waited for if needed.
+ */
+static struct uk_blkbuf *blkcache_alloc(struct uk_blkcache *bc, int wait)
+{
+	struct uk_blkbuf *buf;
+	int busy;
+
+	if (bc->nbufs < bc->maxbufs) {
+		buf = blkcache_new(bc);
+		if (likely(buf))
+			return buf;
+	}
+
+	for (;;) {
+		busy = 0;
+		uk_list_for_each_entry(buf, &bc->lru, lru_link) {
+			if (buf->refs)
+				continue;
+			if (buf->flags & BUF_IO) {
+				if (!uk_blkreq_is_done(&buf->req)) {
+					busy = 1;
+					continue;
+				}
+				blkcache_end_io(bc, buf);
+			}
+			if (buf->flags & BUF_DIRTY)
+				continue;
+
+			uk_hlist_del_init(&buf->hash_link);
+			buf->flags = 0;
+			return buf;
+		}
+
+		if (!wait)
+			return NULL;
+		if (bc->ndirty) {
+			blkcache_writeback(bc, WRITEBACK_BATCH, 0);
+			continue;
+		}
+		if (!busy)
+			return NULL;
+		blkcache_wait_any(bc);
+	}
+}
+
+static void blkcache_insert(struct uk_blkcache *bc, struct uk_blkbuf *buf,
+			    __sector blkno)
+{
+	buf->blkno = blkno;
+	uk_hlist_add_head(&buf->hash_link, blkcache_bucket(bc, blkno));
+	uk_list_move_tail(&buf->lru_link, &bc->lru);
+}
+
+/* Reads blocks ahead as far as there are free buffers and queue slots */
+static void blkcache_do_readahead(struct uk_blkcache *bc, __sector blkno,
+				  __sector count)
+{
+	struct uk_blkbuf *buf;
+
+	if (blkno >= bc->nblocks)
+		return;
+	count = MIN(count, bc->nblocks - blkno);
+
+	for (; count > 0; count--, blkno++) {
+		if (blkcache_lookup(bc, blkno))
+			continue;
+
+		buf = blkcache_alloc(bc, 0);
+		if (!buf)
+			break;
+		blkcache_insert(bc, buf, blkno);
+		if (blkcache_submit(bc, buf, UK_BLKREQ_READ, 0)) {
+			uk_hlist_del_init(&buf->hash_link);
+			uk_list_move(&buf->lru_link, &bc->lru);
+			break;
+		}
+	}
+}
+
+struct uk_blkbuf *uk_blkcache_get(struct uk_blkcache *bc, __sector blkno,
+				  int flags)
+{
+	struct uk_blkbuf *buf;
+	int rc;
+
+	UK_ASSERT(bc);
+
+	if (unlikely(blkno >= bc->nblocks))
+		return ERR2PTR(-EINVAL);
+
+	uk_mutex_lock(&bc->lock);
+	buf = blkcache_lookup(bc, blkno);
+	if (buf) {
+		buf->refs++;
+		uk_list_move_tail(&buf->lru_link, &bc->lru);
+
+		/* A failed read-ahead is retried below */
+		blkcache_wait(bc, buf);
+		rc = 0;
+		if (buf->flags & BUF_VALID)
+			goto out;
+	} else {
+		buf = blkcache_alloc(bc, 1);
+		if (unlikely(!buf)) {
+			uk_mutex_unlock(&bc->lock);
+			return ERR2PTR(-ENOMEM);
+		}
+		blkcache_insert(bc, buf, blkno);
+		buf->refs = 1;
+	}
+
+	if (flags & UK_BLKCACHE_NOREAD) {
+		buf->flags |= BUF_VALID;
+		rc = 0;
+		goto out;
+	}
+
+	rc = blkcache_submit(bc, buf, UK_BLKREQ_READ, 1);
+	if (unlikely(rc))
+		goto out;
+
+	/* Sequential misses read ahead while the block is being read */
+	if (CONFIG_LIBUKBLKCACHE_READAHEAD && blkno == bc->last_miss + 1)
+		blkcache_do_readahead(bc, blkno + 1,
+				      CONFIG_LIBUKBLKCACHE_READAHEAD);
+	bc->last_miss = blkno;
+
+	rc = blkcache_wait(bc, buf);
+
+out:
+	if (unlikely(rc)) {
+		buf->refs--;
+		uk_mutex_unlock(&bc->lock);
+		return ERR2PTR(rc);
+	}
+	uk_mutex_unlock(&bc->lock);
+	return buf;
+}
+
+void uk_blkcache_put(struct uk_blkbuf *buf)
+{
+	struct uk_blkcache *bc = buf->bc;
+
+	uk_mutex_lock(&bc->lock);
+	UK_ASSERT(buf->refs > 0);
+	buf->refs--;
+	uk_mutex_unlock(&bc->lock);
+}
+
+void uk_blkcache_dirty(struct uk_blkbuf *buf)
+{
+	struct uk_blkcache *bc = buf->bc;
+
+	UK_ASSERT(buf->refs > 0);
+
+	uk_mutex_lock(&bc->lock);
+	if (!(buf->flags & BUF_DIRTY)) {
+		buf->flags |= BUF_DIRTY;
+		bc->ndirty++;
+	}
+	uk_mutex_unlock(&bc->lock);
+}
+
+void uk_blkcache_readahead(struct uk_blkcache *bc, __sector blkno,
+			   __sector count)
+{
+	uk_mutex_lock(&bc->lock);
+	blkcache_do_readahead(bc, blkno, count);
+	uk_mutex_unlock(&bc->lock);
+}
+
+void uk_blkcache_forget(struct uk_blkcache *bc, __sector blkno)
+{
+	struct uk_blkbuf *buf;
+
+	uk_mutex_lock(&bc->lock);
+	buf = blkcache_lookup(bc, blkno);
+	if (buf) {
+		UK_ASSERT(!buf->refs);
+		blkcache_wait(bc, buf);
+		if (buf->flags & BUF_DIRTY)
+			bc->ndirty--;
+		buf->flags = 0;
+		uk_hlist_del_init(&buf->hash_link);
+		uk_list_move(&buf->lru_link, &bc->lru);
+	}
+	uk_mutex_unlock(&bc->lock);
+}
+
+static int blkcache_flush(struct uk_blkcache *bc)
+{
+	struct uk_blkreq req;
+	int rc;
+
+	uk_blkreq_init(&req, UK_BLKREQ_FFLUSH, 0, 0, NULL, blkcache_req_done,
+		       bc);
+	rc = blkcache_submit_req(bc, &req, 1);
+	if (rc == -ENOTSUP)
+		return 0;
+	if (unlikely(rc))
+		return rc;
+
+	blkcache_wait_req(bc, &req);
+	return (req.result < 0) ? -EIO : 0;
+}
+
+int uk_blkcache_sync(struct uk_blkcache *bc)
+{
+	int rc;
+
+	uk_mutex_lock(&bc->lock);
+	rc = blkcache_writeback(bc, 0, 1);
+	if (!rc)
+		rc = blkcache_flush(bc);
+	uk_mutex_unlock(&bc->lock);
+	return rc;
+}
+
+__sz uk_blkcache_bsize(struct uk_blkcache *bc)
+{
+	return bc->bsize;
+}
+
+__sector uk_blkcache_blocks(struct uk_blkcache *bc)
+{
+	return bc->nblocks;
+}
+
+/*
+ * Devices that were started by a cache. They are kept running when the cache
+ * is destroyed because not all drivers support restarting a device, and are
+ * reused by later caches.
+ */
+struct blkcache_dev {
+	struct uk_blkdev *dev;
+	int polled;
+	struct blkcache_dev *next;
+};
+
+static struct blkcache_dev *blkcache_devs;
+static struct uk_mutex blkcache_devs_lock =
+	UK_MUTEX_INITIALIZER(blkcache_devs_lock);
+
+static int blkcache_dev_configure(struct uk_blkdev *dev, struct uk_alloc *a,
+				  int *polled)
+{
+	struct uk_blkdev_conf conf = { .nb_queues = 1 };
+	struct uk_blkdev_queue_info qinfo;
+	struct uk_blkdev_queue_conf qconf = {
+		.a = a,
+		.callback = blkcache_queue_event,
+		.callback_cookie = NULL,
+#if CONFIG_LIBUKBLKDEV_DISPATCHERTHREADS
+		.s = uk_sched_current(),
+#endif
+	};
+	int rc;
+
+	rc = uk_blkdev_configure(dev, &conf);
+	if (unlikely(rc))
+		return rc;
+	rc = uk_blkdev_queue_get_info(dev, 0, &qinfo);
+	if (unlikely(rc))
+		goto err_unconfigure;
+	rc = uk_blkdev_queue_configure(dev, 0, qinfo.nb_max, &qconf);
+	if (unlikely(rc))
+		goto err_unconfigure;
+	rc = uk_blkdev_start(dev);
+	if (unlikely(rc))
+		goto err_queue;
+
+	rc = uk_blkdev_queue_intr_enable(dev, 0);
+	if (rc == -ENOTSUP) {
+		*polled = 1;
+	} else if (unlikely(rc < 0)) {
+		uk_blkdev_stop(dev);
+		goto err_queue;
+	} else {
+		*polled = 0;
+	}
+	return 0;
+
+err_queue:
+	uk_blkdev_queue_unconfigure(dev, 0);
+err_unconfigure:
+	uk_blkdev_unconfigure(dev);
+	return rc;
+}
+
+static int blkcache_dev_start(struct uk_blkcache *bc)
+{
+	struct uk_blkdev *dev = bc->dev;
+	struct blkcache_dev *bd;
+	int rc = 0;
+
+	uk_mutex_lock(&blkcache_devs_lock);
+	for (bd = blkcache_devs; bd; bd = bd->next) {
+		if (bd->dev == dev) {
+			bc->polled = bd->polled;
+			goto out;
+		}
+	}
+
+	switch (uk_blkdev_state_get(dev)) {
+	case UK_BLKDEV_RUNNING:
+		/* Somebody else set up the device, we do not get events */
+		if (PTRISERR(dev->_queue[0]))
+			rc = -EINVAL;
+		bc->polled = 1;
+		goto out;
+	case UK_BLKDEV_UNCONFIGURED:
+		break;
+	default:
+		rc = -EBUSY;
+		goto out;
+	}
+
+	bd = uk_malloc(bc->a, sizeof(*bd));
+	if (unlikely(!bd)) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	rc = blkcache_dev_configure(dev, bc->a, &bd->polled);
+	if (unlikely(rc)) {
+		uk_free(bc->a, bd);
+		goto out;
+	}
+	bd->dev = dev;
+	bd->next = blkcache_devs;
+	blkcache_devs = bd;
+	bc->polled = bd->polled;
+
+out:
+	uk_mutex_unlock(&blkcache_devs_lock);
+	return rc;
+}
+
+struct uk_blkcache *uk_blkcache_create(struct uk_blkdev *dev, __sz bsize,
+				       unsigned long nbufs)
+{
+	struct uk_blkcache *bc;
+	struct uk_alloc *a = uk_alloc_get_default();
+	unsigned long buckets;
+	__sz ssize;
+	int rc;
+
+	UK_ASSERT(dev);
+
+	if (unlikely(!bsize || (bsize & (bsize - 1))))
+		return ERR2PTR(-EINVAL);
+
+	bc = uk_zalloc(a, sizeof(*bc));
+	if (unlikely(!bc))
+		return ERR2PTR(-ENOMEM);
+
+	bc->dev = dev;
+	bc->a = a;
+	uk_mutex_init(&bc->lock);
+	uk_waitq_init(&bc->wq);
+	UK_INIT_LIST_HEAD(&bc->lru);
+	bc->last_miss = (__sector)-2;
+
+	rc = blkcache_dev_start(bc);
+	if (unlikely(rc))
+		goto err_free;
+
+	ssize = uk_blkdev_ssize(dev);
+	if (unlikely(bsize < ssize || bsize % ssize)) {
+		rc = -EINVAL;
+		goto err_free;
+	}
+	bc->bsize = bsize;
+	bc->spb = bsize / ssize;
+	bc->nblocks = uk_blkdev_sectors(dev) / bc->spb;
+	bc->align = MAX((__sz)uk_blkdev_ioalign(dev),
+			MIN(bsize, (__sz)__PAGE_SIZE));
+
+	bc->maxbufs = nbufs ? nbufs : CONFIG_LIBUKBLKCACHE_NBUFS;
+	for (buckets = 1; buckets < bc->maxbufs; buckets <<= 1)
+		;
+	bc->hash = uk_calloc(a, buckets, sizeof(*bc->hash));
+	if (unlikely(!bc->hash)) {
+		rc = -ENOMEM;
+		goto err_free;
+	}
+	bc->hash_mask = buckets - 1;
+
+	return bc;
+
+err_free:
+	uk_free(a, bc);
+	return ERR2PTR(rc);
+}
+
+int uk_blkcache_destroy(struct uk_blkcache *bc)
+{
+	struct uk_blkbuf *buf, *next;
+	int rc;
+
+	rc = uk_blkcache_sync(bc);
+
+	uk_list_for_each_entry_safe(buf, next, &bc->lru, lru_link) {
+		UK_ASSERT(!buf->refs);
+		if (buf->flags & BUF_IO) {
+			blkcache_wait_req(bc, &buf->req);
+			blkcache_end_io(bc, buf);
+		}
+		uk_list_del(&buf->lru_link);
+		uk_free(bc->a, buf->data);
+		uk_free(bc->a, buf);
+	}
+
+	uk_free(bc->a, bc->hash);
+	uk_free(bc->a, bc);
+	return rc;
+}
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UK_BLKCACHE_H__
+#define __UK_BLKCACHE_H__
+
+#include <uk/arch/types.h>
+#include <uk/blkdev.h>
+#include <uk/essentials.h>
+#include <uk/list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Block buffer cache
+ *
+ * Caches the blocks of a block device in memory for file system drivers. A
+ * block is a multiple of the sector size of the device, typically the block
+ * size of the file system. Blocks are written back lazily: modified blocks
+ * are written when they are evicted or on uk_blkcache_sync(). Unreferenced
+ * blocks are evicted in LRU order.
+ *
+ * Misses right after the previously missed block are considered sequential
+ * and read the following blocks ahead, asynchronously. Callers that know
+ * their access pattern can also start read-ahead explicitly.
+ *
+ * The cache uses queue 0 of the device. If the device is not configured yet,
+ * the cache configures and starts it, using interrupts if the driver supports
+ * them and polling otherwise. The device then stays running for later caches.
+ */
+
+struct uk_blkcache;
+
+struct uk_blkbuf {
+	__sector blkno;			/* Block number */
+	void *data;			/* Block contents */
+
+	/* Internal */
+	struct uk_hlist_node hash_link;
+	struct uk_list_head lru_link;
+	unsigned int refs;
+	unsigned int flags;
+	struct uk_blkreq req;
+	struct uk_blkcache *bc;
+};
+
+/* Do not read the block from the device, the caller overwrites it */
+#define UK_BLKCACHE_NOREAD	0x1
+
+/**
+ * Creates a block cache for a block device.
+ *
+ * @param dev
+ *   Block device, either unconfigured or running with queue 0 configured
+ * @param bsize
+ *   Block size in bytes. Must be a power of two and a multiple of the sector
+ *   size of the device.
+ * @param nbufs
+ *   Maximum number of cached blocks, or 0 for the default
+ * @return
+ *   The block cache on success, an error pointer otherwise
+ */
+struct uk_blkcache *uk_blkcache_create(struct uk_blkdev *dev, __sz bsize,
+				       unsigned long nbufs);
+
+/**
+ * Writes back all modified blocks and releases the cache. No block may be
+ * referenced anymore.
+ *
+ * @return
+ *   0 on success, a negative error code if blocks could not be written back.
+ *   The cache is released in any case.
+ */
+int uk_blkcache_destroy(struct uk_blkcache *bc);
+
+/**
+ * Returns a referenced buffer with the contents of a block, reading it from
+ * the device if it is not cached. The buffer stays valid until it is released
+ * with uk_blkcache_put().
+ *
+ * @param flags
+ *   UK_BLKCACHE_NOREAD to skip reading a block that is not cached. The
+ *   contents of the buffer are undefined in this case.
+ * @return
+ *   The buffer on success, an error pointer otherwise
+ */
+struct uk_blkbuf *uk_blkcache_get(struct uk_blkcache *bc, __sector blkno,
+				  int flags);
+
+/**
+ * Releases a buffer returned by uk_blkcache_get().
+ */
+void uk_blkcache_put(struct uk_blkbuf *buf);
+
+/**
+ * Marks a referenced buffer as modified so that it is written back.
+ */
+void uk_blkcache_dirty(struct uk_blkbuf *buf);
+
+/**
+ * Starts reading blocks into the cache without waiting for them. Blocks that
+ * are cached already are skipped.
+ */
+void uk_blkcache_readahead(struct uk_blkcache *bc, __sector blkno,
+			   __sector count);
+
+/**
+ * Drops a block from the cache without writing it back, e.g., when a file
+ * system frees the block. The block must not be referenced.
+ */
+void uk_blkcache_forget(struct uk_blkcache *bc, __sector blkno);
+
+/**
+ * Writes back all modified blocks and flushes the write cache of the device.
+ *
+ * @return
+ *   0 on success, a negative error code otherwise
+ */
+int uk_blkcache_sync(struct uk_blkcache *bc);
+
+/**
+ * Returns the block size of a cache.
+ */
+__sz uk_blkcache_bsize(struct uk_blkcache *bc);
+
+/**
+ * Returns the number of blocks of the underlying device.
+ */
+__sector uk_blkcache_blocks(struct uk_blkcache *bc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_BLKCACHE_H__ */
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/blkcache.h>
+#include <uk/blkdev_ramdisk.h>
+#include <uk/errptr.h>
+#include <uk/plat/time.h>
+
+/* fio-like throughput of the cache over a RAM disk: sequential and random
+ * block reads and writes, cold and cached
+ */
+#define BENCH_BSIZE		4096
+#define BENCH_DISK_BLOCKS	(UK_BLKDEV_RAMDISK_SECTORS *		\
+				 UK_BLKDEV_RAMDISK_SSIZE / BENCH_BSIZE)
+#define BENCH_BLOCKS		(64 * BENCH_DISK_BLOCKS)
+
+/* Polled disk of the unit tests, which set it up the same way */
+#define BENCH_DISK		1
+
+static struct uk_blkdev_ramdisk *bench_disk;
+
+static void bench_run(struct uk_blkcache *bc, const char *name, int rw,
+		      int random)
+{
+	struct uk_blkbuf *buf;
+	unsigned long seed = 1;
+	__sector blkno;
+	__nsec t;
+	unsigned int i;
+
+	t = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_BLOCKS; i++) {
+		if (random) {
+			seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+			blkno = (seed >> 33) % BENCH_DISK_BLOCKS;
+		} else {
+			blkno = i % BENCH_DISK_BLOCKS;
+		}
+
+		buf = uk_blkcache_get(bc, blkno, rw ? UK_BLKCACHE_NOREAD : 0);
+		if (PTRISERR(buf))
+			break;
+		if (rw) {
+			memset(buf->data, (int)i, BENCH_BSIZE);
+			uk_blkcache_dirty(buf);
+		}
+		uk_blkcache_put(buf);
+	}
+	if (rw)
+		uk_blkcache_sync(bc);
+	t = ukplat_monotonic_clock() - t;
+
+	uk_pr_info("%-16s %6"__PRIu64" MB/s, %7"__PRIu64" IOPS (%u reads, %u writes)\n",
+		   name,
+		   (__u64)i * BENCH_BSIZE * 1000 / MAX(t, (__nsec)1),
+		   (__u64)i * 1000000000 / MAX(t, (__nsec)1),
+		   bench_disk->reads, bench_disk->writes);
+	bench_disk->reads = 0;
+	bench_disk->writes = 0;
+}
+
+UK_TESTCASE(ukblkcache_bench, bench_blkcache)
+{
+	struct uk_blkcache *bc;
+
+	bench_disk = uk_blkdev_ramdisk_get(BENCH_DISK, 0);
+	UK_TEST_ASSERT(bench_disk != NULL);
+
+	/* A cache of a quarter of the disk */
+	bc = uk_blkcache_create(&bench_disk->blkdev, BENCH_BSIZE,
+				BENCH_DISK_BLOCKS / 4);
+	UK_TEST_ASSERT(!PTRISERR(bc));
+	bench_run(bc, "seq read", 0, 0);
+	bench_run(bc, "seq write", 1, 0);
+	bench_run(bc, "rand read", 0, 1);
+	bench_run(bc, "rand write", 1, 1);
+	UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+
+	/* A cache of the whole disk */
+	bc = uk_blkcache_create(&bench_disk->blkdev, BENCH_BSIZE,
+				BENCH_DISK_BLOCKS);
+	UK_TEST_ASSERT(!PTRISERR(bc));
+	bench_run(bc, "cached seq read", 0, 0);
+	bench_run(bc, "cached rand read", 0, 1);
+	UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+}
+
+uk_testsuite_register(ukblkcache_bench, NULL);
@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/blkcache.h>
+#include <uk/blkdev_ramdisk.h>
+#include <uk/errptr.h>
+
+#define TEST_BSIZE		4096
+#define TEST_BLOCKS		(UK_BLKDEV_RAMDISK_SECTORS *		\
+				 UK_BLKDEV_RAMDISK_SSIZE / TEST_BSIZE)
+
+/* RAM disks without and with interrupts */
+#define TEST_DISK_POLLED	1
+#define TEST_DISK_INTR		2
+
+static struct uk_blkdev_ramdisk *test_disk;
+static char *test_data;
+
+static struct uk_blkdev *test_disk_reset(int intr)
+{
+	unsigned int i;
+
+	test_disk = uk_blkdev_ramdisk_get(intr ? TEST_DISK_INTR
+					       : TEST_DISK_POLLED, intr);
+	if (!test_disk)
+		return NULL;
+
+	test_data = test_disk->data;
+	for (i = 0; i < TEST_BLOCKS * TEST_BSIZE; i++)
+		test_data[i] = (char)(i * 7 + i / TEST_BSIZE);
+	return &test_disk->blkdev;
+}
+
+/* Completions are polled or signaled, depending on the driver */
+UK_TESTCASE(ukblkcache, test_blkcache_rw)
+{
+	struct uk_blkcache *bc;
+	struct uk_blkbuf *buf;
+	struct uk_blkdev *dev;
+	int intr;
+
+	for (intr = 0; intr <= 1; intr++) {
+		dev = test_disk_reset(intr);
+		UK_TEST_ASSERT(dev != NULL);
+		bc = uk_blkcache_create(dev, TEST_BSIZE, 0);
+		UK_TEST_ASSERT(!PTRISERR(bc));
+		UK_TEST_EXPECT_SNUM_EQ(uk_blkcache_blocks(bc), TEST_BLOCKS);
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->queues[0].intr_enabled, intr);
+
+		/* A miss reads the block, a hit does not */
+		buf = uk_blkcache_get(bc, 3, 0);
+		UK_TEST_ASSERT(!PTRISERR(buf));
+		UK_TEST_EXPECT_ZERO(memcmp(buf->data,
+					   test_data + 3 * TEST_BSIZE,
+					   TEST_BSIZE));
+		uk_blkcache_put(buf);
+		buf = uk_blkcache_get(bc, 3, 0);
+		UK_TEST_ASSERT(!PTRISERR(buf));
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->reads, 1);
+
+		/* Modified blocks are written back on sync only */
+		memset(buf->data, 'x', TEST_BSIZE);
+		uk_blkcache_dirty(buf);
+		uk_blkcache_put(buf);
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->writes, 0);
+		UK_TEST_EXPECT_NOT_ZERO(memcmp(buf->data,
+					       test_data + 3 * TEST_BSIZE,
+					       TEST_BSIZE));
+		UK_TEST_EXPECT_ZERO(uk_blkcache_sync(bc));
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->writes, 1);
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->flushes, 1);
+		UK_TEST_EXPECT_SNUM_EQ(test_data[3 * TEST_BSIZE], 'x');
+
+		/* Overwritten blocks are not read */
+		buf = uk_blkcache_get(bc, 10, UK_BLKCACHE_NOREAD);
+		UK_TEST_ASSERT(!PTRISERR(buf));
+		memset(buf->data, 'y', TEST_BSIZE);
+		uk_blkcache_dirty(buf);
+		uk_blkcache_put(buf);
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->reads, 1);
+
+		UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+		UK_TEST_EXPECT_SNUM_EQ(test_data[10 * TEST_BSIZE], 'y');
+
+		/* The device stays set up for the next cache */
+		bc = uk_blkcache_create(dev, TEST_BSIZE, 0);
+		UK_TEST_ASSERT(!PTRISERR(bc));
+		UK_TEST_EXPECT_SNUM_EQ(test_disk->queues[0].intr_enabled, intr);
+		UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+	}
+}
+
+UK_TESTCASE(ukblkcache, test_blkcache_evict)
+{
+	struct uk_blkbuf *bufs[8], *buf;
+	struct uk_blkcache *bc;
+	unsigned int i;
+
+	bc = uk_blkcache_create(test_disk_reset(0), TEST_BSIZE, 8);
+	UK_TEST_ASSERT(!PTRISERR(bc));
+
+	/* Evicted dirty blocks are written back */
+	for (i = 0; i < 16; i++) {
+		buf = uk_blkcache_get(bc, 2 * i, 0);
+		UK_TEST_ASSERT(!PTRISERR(buf));
+		memset(buf->data, 'a' + i, TEST_BSIZE);
+		uk_blkcache_dirty(buf);
+		uk_blkcache_put(buf);
+	}
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads, 16);
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->writes, 8);
+	for (i = 0; i < 8; i++)
+		UK_TEST_EXPECT_SNUM_EQ(test_data[2 * i * TEST_BSIZE], 'a' + i);
+
+	/* The least recently used block is evicted first */
+	buf = uk_blkcache_get(bc, 0, 0);
+	UK_TEST_ASSERT(!PTRISERR(buf));
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads, 17);
+	UK_TEST_EXPECT_SNUM_EQ(((char *)buf->data)[0], 'a');
+	uk_blkcache_put(buf);
+	buf = uk_blkcache_get(bc, 30, 0);
+	UK_TEST_ASSERT(!PTRISERR(buf));
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads, 17);
+	uk_blkcache_put(buf);
+
+	/* Referenced blocks are never evicted */
+	for (i = 0; i < 8; i++) {
+		bufs[i] = uk_blkcache_get(bc, 100 + 2 * i, 0);
+		UK_TEST_ASSERT(!PTRISERR(bufs[i]));
+	}
+	buf = uk_blkcache_get(bc, 200, 0);
+	UK_TEST_EXPECT_SNUM_EQ(PTR2ERR(buf), -ENOMEM);
+	for (i = 0; i < 8; i++)
+		uk_blkcache_put(bufs[i]);
+
+	UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+}
+
+UK_TESTCASE(ukblkcache, test_blkcache_readahead)
+{
+	struct uk_blkcache *bc;
+	struct uk_blkbuf *buf;
+	unsigned int i;
+
+	bc = uk_blkcache_create(test_disk_reset(0), TEST_BSIZE, 0);
+	UK_TEST_ASSERT(!PTRISERR(bc));
+
+	/* The second of two sequential misses reads ahead */
+	for (i = 0; i < 2 + CONFIG_LIBUKBLKCACHE_READAHEAD; i++) {
+		buf = uk_blkcache_get(bc, 50 + i, 0);
+		UK_TEST_ASSERT(!PTRISERR(buf));
+		UK_TEST_EXPECT_ZERO(memcmp(buf->data,
+					   test_data + (50 + i) * TEST_BSIZE,
+					   TEST_BSIZE));
+		uk_blkcache_put(buf);
+	}
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads,
+			       2 + CONFIG_LIBUKBLKCACHE_READAHEAD);
+
+	/* Explicit read-ahead skips cached blocks and ends at the disk end */
+	uk_blkcache_readahead(bc, TEST_BLOCKS - 4, 8);
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads,
+			       6 + CONFIG_LIBUKBLKCACHE_READAHEAD);
+	uk_blkcache_readahead(bc, TEST_BLOCKS - 4, 8);
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads,
+			       6 + CONFIG_LIBUKBLKCACHE_READAHEAD);
+	buf = uk_blkcache_get(bc, TEST_BLOCKS - 1, 0);
+	UK_TEST_ASSERT(!PTRISERR(buf));
+	uk_blkcache_put(buf);
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads,
+			       6 + CONFIG_LIBUKBLKCACHE_READAHEAD);
+	UK_TEST_EXPECT_SNUM_EQ(PTR2ERR(uk_blkcache_get(bc, TEST_BLOCKS, 0)),
+			       -EINVAL);
+
+	UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+}
+
+UK_TESTCASE(ukblkcache, test_blkcache_forget)
+{
+	struct uk_blkcache *bc;
+	struct uk_blkbuf *buf;
+
+	bc = uk_blkcache_create(test_disk_reset(0), TEST_BSIZE, 0);
+	UK_TEST_ASSERT(!PTRISERR(bc));
+
+	/* Forgotten blocks are neither written back nor served again */
+	buf = uk_blkcache_get(bc, 7, UK_BLKCACHE_NOREAD);
+	UK_TEST_ASSERT(!PTRISERR(buf));
+	memset(buf->data, 'z', TEST_BSIZE);
+	uk_blkcache_dirty(buf);
+	uk_blkcache_put(buf);
+	uk_blkcache_forget(bc, 7);
+	UK_TEST_EXPECT_ZERO(uk_blkcache_sync(bc));
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->writes, 0);
+
+	buf = uk_blkcache_get(bc, 7, 0);
+	UK_TEST_ASSERT(!PTRISERR(buf));
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->reads, 1);
+	UK_TEST_EXPECT_ZERO(memcmp(buf->data, test_data + 7 * TEST_BSIZE,
+				   TEST_BSIZE));
+	uk_blkcache_put(buf);
+
+	UK_TEST_EXPECT_ZERO(uk_blkcache_destroy(bc));
+}
+
+uk_testsuite_register(ukblkcache, NULL);
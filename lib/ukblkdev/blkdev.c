@@ -43,6 +43,7 @@
 #include <uk/ctors.h>
 #include <uk/atomic.h>
 #include <uk/blkdev.h>
+#include <uk/plat/spinlock.h>
 
 struct uk_blkdev_list uk_blkdev_list =
 UK_TAILQ_HEAD_INITIALIZER(uk_blkdev_list);
@@ -54,6 +55,7 @@ static struct uk_blkdev_data *_alloc_data(struct uk_alloc *a,
 		const char *drv_name)
 {
 	struct uk_blkdev_data *data;
+	int i;
 
 	data = uk_calloc(a, 1, sizeof(*data));
 	if (!data)
@@ -62,6 +64,8 @@ static struct uk_blkdev_data *_alloc_data(struct uk_alloc *a,
 	data->drv_name = drv_name;
 	data->state    = UK_BLKDEV_UNCONFIGURED;
 	data->a = a;
+	for (i = 0; i < CONFIG_LIBUKBLKDEV_MAXNBQUEUES; i++)
+		ukarch_spin_init(&data->queue_lock[i]);
 	/* This is the only place where we set the device ID;
 	 * during the rest of the device's life time this ID is read-only
 	 */
@@ -168,11 +172,22 @@ int uk_blkdev_get_info(struct uk_blkdev *dev,
 	return rc;
 }
 
+/* Counts the LCPUs that use each queue */
+static void _update_queue_users(struct uk_blkdev_data *data)
+{
+	unsigned int i;
+
+	memset(data->queue_users, 0, sizeof(data->queue_users));
+	for (i = 0; i < ukplat_lcpu_count(); i++)
+		data->queue_users[ukplat_per_lcpu(data->lcpu_queue, i)]++;
+}
+
 int uk_blkdev_configure(struct uk_blkdev *dev,
 		const struct uk_blkdev_conf *conf)
 {
 	int rc = 0;
 	struct uk_blkdev_info dev_info;
+	unsigned int i;
 
 	UK_ASSERT(dev);
 	UK_ASSERT(dev->_data);
@@ -195,6 +210,11 @@ int uk_blkdev_configure(struct uk_blkdev *dev,
 		uk_pr_info("blkdev%"PRIu16": Configured interface\n",
 				dev->_data->id);
 		dev->_data->state = UK_BLKDEV_CONFIGURED;
+		dev->_data->nb_queues = conf->nb_queues;
+		for (i = 0; i < ukplat_lcpu_count(); i++)
+			ukplat_per_lcpu(dev->_data->lcpu_queue, i) =
+				(conf->nb_queues) ? i % conf->nb_queues : 0;
+		_update_queue_users(dev->_data);
 	} else
 		uk_pr_err("blkdev%"PRIu16": Failed to configure interface %d\n",
 				dev->_data->id, rc);
@@ -392,6 +412,18 @@ int uk_blkdev_queue_submit_one(struct uk_blkdev *dev,
 	UK_ASSERT(!PTRISERR(dev->_queue[queue_id]));
 	UK_ASSERT(req != NULL);
 
+	if (dev->_data->queue_users[queue_id] > 1) {
+		unsigned long irqf;
+		int rc;
+
+		ukplat_spin_lock_irqsave(&dev->_data->queue_lock[queue_id],
+					 irqf);
+		rc = dev->submit_one(dev, dev->_queue[queue_id], req);
+		ukplat_spin_unlock_irqrestore(&dev->_data->queue_lock[queue_id],
+					      irqf);
+		return rc;
+	}
+
 	return dev->submit_one(dev, dev->_queue[queue_id], req);
 }
 
@@ -405,9 +437,76 @@ int uk_blkdev_queue_finish_reqs(struct uk_blkdev *dev,
 	UK_ASSERT(dev->_data->state == UK_BLKDEV_RUNNING);
 	UK_ASSERT(!PTRISERR(dev->_queue[queue_id]));
 
+	if (dev->_data->queue_users[queue_id] > 1) {
+		unsigned long irqf;
+		int rc;
+
+		ukplat_spin_lock_irqsave(&dev->_data->queue_lock[queue_id],
+					 irqf);
+		rc = dev->finish_reqs(dev, dev->_queue[queue_id]);
+		ukplat_spin_unlock_irqrestore(&dev->_data->queue_lock[queue_id],
+					      irqf);
+		return rc;
+	}
+
 	return dev->finish_reqs(dev, dev->_queue[queue_id]);
 }
 
+int uk_blkdev_lcpu_queue_set(struct uk_blkdev *dev, unsigned int lcpu_idx,
+		uint16_t queue_id)
+{
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->_data);
+
+	if (dev->_data->state == UK_BLKDEV_RUNNING)
+		return -EBUSY;
+
+	if (dev->_data->state != UK_BLKDEV_CONFIGURED ||
+	    lcpu_idx >= ukplat_lcpu_count() ||
+	    queue_id >= dev->_data->nb_queues)
+		return -EINVAL;
+
+	ukplat_per_lcpu(dev->_data->lcpu_queue, lcpu_idx) = queue_id;
+	_update_queue_users(dev->_data);
+	return 0;
+}
+
+int uk_blkdev_submit_one(struct uk_blkdev *dev, struct uk_blkreq *req)
+{
+	unsigned long irqf;
+	int rc;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->_data);
+
+	/* The queue of this LCPU is only used without a lock if nothing else
+	 * runs on this LCPU until we are done with it. Masking interrupts
+	 * keeps the thread from being preempted and migrated, and event
+	 * callbacks of the queue from interrupting us.
+	 */
+	irqf = ukplat_lcpu_save_irqf();
+	rc = uk_blkdev_queue_submit_one(dev, uk_blkdev_lcpu_queue(dev), req);
+	ukplat_lcpu_restore_irqf(irqf);
+
+	return rc;
+}
+
+int uk_blkdev_poll(struct uk_blkdev *dev)
+{
+	unsigned long irqf;
+	int rc;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->_data);
+
+	/* See uk_blkdev_submit_one() */
+	irqf = ukplat_lcpu_save_irqf();
+	rc = uk_blkdev_queue_finish_reqs(dev, uk_blkdev_lcpu_queue(dev));
+	ukplat_lcpu_restore_irqf(irqf);
+
+	return rc;
+}
+
 #if CONFIG_LIBUKBLKDEV_SYNC_IO_BLOCKED_WAITING
 /**
  * Used for sending a synchronous request.
@@ -430,16 +529,10 @@ static void __sync_io_callback(struct uk_blkreq *req __unused,
 	uk_semaphore_up(&sync_io_req->s);
 }
 
-int uk_blkdev_sync_io(struct uk_blkdev *dev,
-		uint16_t queue_id,
-		enum uk_blkreq_op operation,
-		__sector start_sector,
-		__sector nb_sectors,
-		void *buf)
+static int __sync_io_submit(struct uk_blkdev *dev, uint16_t queue_id,
+			    struct uk_blkdev_sync_io_request *sync_io_req)
 {
-	struct uk_blkreq *req;
-	int rc = 0;
-	struct uk_blkdev_sync_io_request sync_io_req;
+	int rc;
 
 	UK_ASSERT(dev != NULL);
 	UK_ASSERT(queue_id < CONFIG_LIBUKBLKDEV_MAXNBQUEUES);
@@ -448,20 +541,59 @@ int uk_blkdev_sync_io(struct uk_blkdev *dev,
 	UK_ASSERT(dev->_data->state == UK_BLKDEV_RUNNING);
 	UK_ASSERT(!PTRISERR(dev->_queue[queue_id]));
 
-	req = &sync_io_req.req;
-	uk_blkreq_init(req, operation, start_sector, nb_sectors, buf,
-			__sync_io_callback, (void *)&sync_io_req);
-	uk_semaphore_init(&sync_io_req.s, 0);
+	uk_semaphore_init(&sync_io_req->s, 0);
 
-	rc = uk_blkdev_queue_submit_one(dev, queue_id, req);
+	rc = uk_blkdev_queue_submit_one(dev, queue_id, &sync_io_req->req);
 	if (unlikely(!uk_blkdev_status_successful(rc))) {
 		uk_pr_err("blkdev%"PRIu16"-q%"PRIu16": Failed to submit I/O req: %d\n",
 				dev->_data->id, queue_id, rc);
 		return rc;
 	}
 
-	uk_semaphore_down(&sync_io_req.s);
-	return req->result;
+	/* Polled queues have no event callback that would finish the request */
+	if (!dev->_data->queue_handler[queue_id].callback) {
+		while (!uk_blkreq_is_done(&sync_io_req->req)) {
+			uk_blkdev_queue_finish_reqs(dev, queue_id);
+			if (!uk_blkreq_is_done(&sync_io_req->req))
+				uk_sched_yield();
+		}
+		return sync_io_req->req.result;
+	}
+
+	uk_semaphore_down(&sync_io_req->s);
+	return sync_io_req->req.result;
+}
+
+int uk_blkdev_sync_io(struct uk_blkdev *dev,
+		uint16_t queue_id,
+		enum uk_blkreq_op operation,
+		__sector start_sector,
+		__sector nb_sectors,
+		void *buf)
+{
+	struct uk_blkdev_sync_io_request sync_io_req;
+
+	uk_blkreq_init(&sync_io_req.req, operation, start_sector, nb_sectors,
+			buf, __sync_io_callback, (void *)&sync_io_req);
+	return __sync_io_submit(dev, queue_id, &sync_io_req);
+}
+
+int uk_blkdev_sync_io_iov(struct uk_blkdev *dev,
+		uint16_t queue_id,
+		enum uk_blkreq_op operation,
+		__sector start_sector,
+		__sector nb_sectors,
+		const struct iovec *iov,
+		int iovcnt)
+{
+	struct uk_blkdev_sync_io_request sync_io_req;
+
+	UK_ASSERT(iov || !iovcnt);
+
+	uk_blkreq_init_iov(&sync_io_req.req, operation, start_sector,
+			nb_sectors, iov, iovcnt, __sync_io_callback,
+			(void *)&sync_io_req);
+	return __sync_io_submit(dev, queue_id, &sync_io_req);
 }
 #endif
 
@@ -149,6 +149,9 @@ int uk_blkdev_get_info(struct uk_blkdev *dev,
  * This function must be invoked first before any other function in the
  * Unikraft BLK API. This function can also be re-invoked when a device is
  * in the stopped state.
+ * The LCPUs are spread over the configured queues: LCPU i submits to
+ * queue (i % nb_queues) with `uk_blkdev_submit_one()`. With one queue per
+ * LCPU, every queue is owned by a single LCPU and used without locking.
  *
  * @param dev
  *	The Unikraft Block Device.
@@ -258,6 +261,16 @@ static inline const struct uk_blkdev_cap *uk_blkdev_capabilities(
 
 #define uk_blkdev_ioalign(blkdev) \
 	(uk_blkdev_capabilities(blkdev)->ioalign)
+
+#define uk_blkdev_max_segments(blkdev) \
+	(uk_blkdev_capabilities(blkdev)->max_segments)
+
+#define uk_blkdev_max_discard_sectors(blkdev) \
+	(uk_blkdev_capabilities(blkdev)->max_discard_sectors)
+
+#define uk_blkdev_max_write_zeroes_sectors(blkdev) \
+	(uk_blkdev_capabilities(blkdev)->max_write_zeroes_sectors)
+
 /**
  * Enable interrupts for a queue.
  *
@@ -323,8 +336,13 @@ static inline int uk_blkdev_queue_intr_disable(struct uk_blkdev *dev,
  *	The index of the receive queue to receive from.
  *	The value must be in the range [0, nb_queue - 1] previously supplied
  *	to uk_blkdev_configure().
+ *	Queues that are used by more than one LCPU (see
+ *	`uk_blkdev_lcpu_queue_set()`) are locked, other queues must only be
+ *	used by the LCPU that owns them.
  * @param req
- *	Request structure
+ *	Request structure. Discard and write zeroes requests carry no data and
+ *	are rejected with -ENOTSUP by devices that do not support them
+ *	(see `uk_blkdev_max_discard_sectors()`).
  * @return
  *	- (>=0): Positive value with status flags
  *		- UK_BLKDEV_STATUS_SUCCESS: `req` was successfully put to the
@@ -424,6 +442,74 @@ int uk_blkdev_queue_submit_one(struct uk_blkdev *dev, uint16_t queue_id,
  */
 int uk_blkdev_queue_finish_reqs(struct uk_blkdev *dev, uint16_t queue_id);
 
+/**
+ * Get the queue that the calling LCPU uses for `uk_blkdev_submit_one()` and
+ * `uk_blkdev_poll()`.
+ *
+ * @param dev
+ *	The Unikraft Block Device in configured or running state.
+ * @return
+ *	Queue id
+ */
+static inline uint16_t uk_blkdev_lcpu_queue(struct uk_blkdev *dev)
+{
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->_data);
+
+	return ukplat_per_lcpu_current(dev->_data->lcpu_queue);
+}
+
+/**
+ * Assign a queue to an LCPU, replacing the assignment done by
+ * `uk_blkdev_configure()`. Queues that are assigned to more than one LCPU
+ * are locked for every request and while their completed requests are
+ * reaped. Request callbacks of such queues must not submit requests to
+ * the same queue.
+ *
+ * @param dev
+ *	The Unikraft Block Device in configured state.
+ * @param lcpu_idx
+ *	Index of the LCPU
+ * @param queue_id
+ *	The value must be in the range [0, nb_queue - 1] previously supplied
+ *	to uk_blkdev_configure().
+ * @return
+ *	- 0: Success
+ *	- (-EINVAL): LCPU or queue out of range
+ *	- (-EBUSY): The device is running
+ */
+int uk_blkdev_lcpu_queue_set(struct uk_blkdev *dev, unsigned int lcpu_idx,
+		uint16_t queue_id);
+
+/**
+ * Make an aio request on the queue of the calling LCPU.
+ * A queue that is owned by the LCPU is used without locking, with interrupts
+ * disabled on the LCPU. Its completed requests should be reaped on the same
+ * LCPU, either with `uk_blkdev_poll()` if the queue is polled, or by an event
+ * callback whose interrupt is delivered to the LCPU.
+ *
+ * @param dev
+ *	The Unikraft Block Device
+ * @param req
+ *	Request structure
+ * @return
+ *	See `uk_blkdev_queue_submit_one()`
+ */
+int uk_blkdev_submit_one(struct uk_blkdev *dev, struct uk_blkreq *req);
+
+/**
+ * Get responses from the queue of the calling LCPU. This is how completed
+ * requests of polled queues, which have no event callback, are reaped.
+ * Request callbacks are called with interrupts disabled on the LCPU.
+ *
+ * @param dev
+ *	The Unikraft Block Device
+ * @return
+ *	- 0: Success
+ *	- (<0): on error returned by driver
+ */
+int uk_blkdev_poll(struct uk_blkdev *dev);
+
 #if CONFIG_LIBUKBLKDEV_SYNC_IO_BLOCKED_WAITING
 /**
  * Make a sync io request on a specific queue.
@@ -453,6 +539,37 @@ int uk_blkdev_sync_io(struct uk_blkdev *dev,
 		__sector nb_sectors,
 		void *buf);
 
+/**
+ * Make a sync io request with a list of data buffers on a specific queue.
+ * The same rules as for `uk_blkdev_sync_io()` apply. The buffers must meet
+ * the requirements listed at `uk_blkreq_init_iov()`.
+ *
+ * @param dev
+ *	The Unikraft Block Device
+ * @param queue_id
+ *	queue_id
+ * @param op
+ *	Type of operation
+ * @param sector
+ *	Start Sector
+ * @param nb_sectors
+ *	Number of sectors
+ * @param iov
+ *	Buffers where data is found
+ * @param iovcnt
+ *	Number of buffers
+ * @return
+ *	- 0: Success
+ *	- (<0): on error returned by driver
+ */
+int uk_blkdev_sync_io_iov(struct uk_blkdev *dev,
+		uint16_t queue_id,
+		enum uk_blkreq_op op,
+		__sector sector,
+		__sector nb_sectors,
+		const struct iovec *iov,
+		int iovcnt);
+
 /*
  * Wrappers for uk_blkdev_sync_io
  */
@@ -472,6 +589,20 @@ int uk_blkdev_sync_io(struct uk_blkdev *dev,
 	uk_blkdev_sync_io(blkdev, queue_id, UK_BLKREQ_READ, sector, \
 			  nb_sectors, buf)			    \
 
+#define uk_blkdev_sync_discard(blkdev,\
+		queue_id,	\
+		sector,		\
+		nb_sectors)	\
+	uk_blkdev_sync_io(blkdev, queue_id, UK_BLKREQ_DISCARD, sector, \
+			  nb_sectors, NULL)				\
+
+#define uk_blkdev_sync_write_zeroes(blkdev,\
+		queue_id,	\
+		sector,		\
+		nb_sectors)	\
+	uk_blkdev_sync_io(blkdev, queue_id, UK_BLKREQ_WRITE_ZEROES, sector, \
+			  nb_sectors, NULL)				     \
+
 #endif /* CONFIG_LIBUKBLKDEV_SYNC_IO_BLOCKED_WAITING */
 
 /**
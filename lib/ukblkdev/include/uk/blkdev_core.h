@@ -37,6 +37,8 @@
 #include <uk/list.h>
 #include <uk/config.h>
 #include <uk/blkreq.h>
+#include <uk/arch/spinlock.h>
+#include <uk/plat/lcpu.h>
 #include <fcntl.h>
 #if defined(CONFIG_LIBUKBLKDEV_DISPATCHERTHREADS) || \
 		defined(CONFIG_LIBUKBLKDEV_SYNC_IO_BLOCKED_WAITING)
@@ -136,7 +138,10 @@ typedef void (*uk_blkdev_queue_event_t)(struct uk_blkdev *dev,
 struct uk_blkdev_queue_conf {
 	/* Allocator used for descriptor rings */
 	struct uk_alloc *a;
-	/* Event callback function */
+	/* Event callback function, NULL for a polled queue whose completed
+	 * requests are reaped with uk_blkdev_poll() or
+	 * uk_blkdev_queue_finish_reqs()
+	 */
 	uk_blkdev_queue_event_t callback;
 	/* Argument pointer for callback*/
 	void *callback_cookie;
@@ -238,6 +243,12 @@ struct uk_blkdev_cap {
 	__sector max_sectors_per_req;
 	/* Alignment (number of bytes) for data used in future requests */
 	uint16_t ioalign;
+	/* Max nb of data buffers for an op (see uk_blkreq_init_iov()) */
+	uint16_t max_segments;
+	/* Max nb of sectors for a discard op, 0 if not supported */
+	__sector max_discard_sectors;
+	/* Max nb of sectors for a write zeroes op, 0 if not supported */
+	__sector max_write_zeroes_sectors;
 };
 
 /**
@@ -282,6 +293,14 @@ struct uk_blkdev_data {
 	const char *drv_name;
 	/* Allocator */
 	struct uk_alloc *a;
+	/* Number of configured queues */
+	uint16_t nb_queues;
+	/* Queue used by each LCPU (see uk_blkdev_submit_one()) */
+	UKPLAT_PER_LCPU_DEFINE(uint16_t, lcpu_queue);
+	/* Number of LCPUs that use each queue */
+	uint16_t queue_users[CONFIG_LIBUKBLKDEV_MAXNBQUEUES];
+	/* Serializes queues that are used by more than one LCPU */
+	__spinlock queue_lock[CONFIG_LIBUKBLKDEV_MAXNBQUEUES];
 };
 
 struct uk_blkdev {
@@ -88,7 +88,9 @@ static inline void uk_blkdev_drv_queue_event(struct uk_blkdev *dev,
 	queue_handler = &dev->_data->queue_handler[queue_id];
 
 #if CONFIG_LIBUKBLKDEV_DISPATCHERTHREADS
-	uk_semaphore_up(&queue_handler->events);
+	/* Polled queues do not have a dispatcher thread */
+	if (queue_handler->callback)
+		uk_semaphore_up(&queue_handler->events);
 #else
 	if (queue_handler->callback)
 		queue_handler->callback(dev, queue_id, queue_handler->cookie);
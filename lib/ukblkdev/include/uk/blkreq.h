@@ -51,6 +51,7 @@ typedef __sz __sector;
 #define __PRIsctr __PRIsz
 
 struct uk_blkreq;
+struct iovec;
 
 /**
  *	Operation status
@@ -69,7 +70,11 @@ enum uk_blkreq_op {
 	/* Write operation */
 	UK_BLKREQ_WRITE,
 	/* Flush the volatile write cache */
-	UK_BLKREQ_FFLUSH = 4
+	UK_BLKREQ_FFLUSH = 4,
+	/* Discard sectors, their contents become undefined */
+	UK_BLKREQ_DISCARD = 11,
+	/* Set sectors to zero without transferring data */
+	UK_BLKREQ_WRITE_ZEROES = 13
 };
 
 /**
@@ -93,8 +98,12 @@ struct uk_blkreq {
 	__sector				start_sector;
 	/* Size in number of sectors */
 	__sector				nb_sectors;
-	/* Pointer to data */
+	/* Pointer to data, unused if iovcnt > 0 */
 	void					*aio_buf;
+	/* Scatter-gather list of data buffers (see uk_blkreq_init_iov()) */
+	const struct iovec			*iov;
+	/* Number of elements in iov, 0 if aio_buf is used */
+	int					iovcnt;
 	/* Request callback and its parameters */
 	uk_blkreq_event_t			cb;
 	void					*cb_cookie;
@@ -133,11 +142,50 @@ static inline void uk_blkreq_init(struct uk_blkreq *req,
 	req->start_sector = start;
 	req->nb_sectors = nb_sectors;
 	req->aio_buf = aio_buf;
+	req->iov = __NULL;
+	req->iovcnt = 0;
 	uk_store_n(&req->state.counter, UK_BLKREQ_UNFINISHED);
 	req->cb = cb;
 	req->cb_cookie = cb_cookie;
 }
 
+/**
+ * Initializes a request structure that transfers data from or to a list of
+ * buffers, e.g., the pages of a file, without copying it to a contiguous
+ * buffer first.
+ * Every buffer must be aligned to the I/O alignment of the device and its
+ * length must be a multiple of the sector size. The lengths must add up to
+ * `nb_sectors` sectors and `iovcnt` must not exceed the maximum number of
+ * segments of the device (see `uk_blkdev_max_segments()`). Drivers may split
+ * large buffers into several segments, which count against the same limit.
+ *
+ * @param req
+ *	The request structure
+ * @param op
+ *	The operation
+ * @param start
+ *	The start sector
+ * @param nb_sectors
+ *	Number of sectors
+ * @param iov
+ *	Data buffers, must stay valid until the request is finished
+ * @param iovcnt
+ *	Number of data buffers
+ * @param cb
+ *	Request callback
+ * @param cb_cookie
+ *	Request callback parameters
+ **/
+static inline void uk_blkreq_init_iov(struct uk_blkreq *req,
+		enum uk_blkreq_op op, __sector start, __sector nb_sectors,
+		const struct iovec *iov, int iovcnt,
+		uk_blkreq_event_t cb, void *cb_cookie)
+{
+	uk_blkreq_init(req, op, start, nb_sectors, __NULL, cb, cb_cookie);
+	req->iov = iov;
+	req->iovcnt = iovcnt;
+}
+
 /**
  * Checks if request is finished.
  *
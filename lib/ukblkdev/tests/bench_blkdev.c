@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/test.h>
+#include <uk/blkdev.h>
+#include <uk/blkdev_ramdisk.h>
+#include <uk/plat/time.h>
+
+#define BENCH_REQS		100000
+
+/* The disk of the unit tests, which leave it unconfigured */
+#define BENCH_DISK		0
+
+static void bench_req_done(struct uk_blkreq *req __unused, void *cookie)
+{
+	(*(int *)cookie)++;
+}
+
+/* Cost of submitting a request to the queue of this LCPU and polling for
+ * its completion, with a RAM disk that completes requests immediately
+ */
+UK_TESTCASE(ukblkdev_bench, bench_blkdev_submit_poll)
+{
+	struct uk_blkdev_conf conf = { .nb_queues = 1 };
+	struct uk_blkdev_queue_conf qconf = { 0 };
+	struct uk_blkdev_ramdisk *disk;
+	struct uk_blkdev *dev;
+	struct uk_blkreq req;
+	char buf[UK_BLKDEV_RAMDISK_SSIZE];
+	__nsec t0, t1;
+	int ncb = 0;
+	int i;
+
+	disk = uk_blkdev_ramdisk_get(BENCH_DISK, 0);
+	UK_TEST_ASSERT(disk != NULL);
+	dev = &disk->blkdev;
+
+	qconf.a = uk_alloc_get_default();
+	UK_TEST_ASSERT(uk_blkdev_configure(dev, &conf) == 0);
+	UK_TEST_ASSERT(uk_blkdev_queue_configure(dev, 0,
+						 UK_BLKDEV_RAMDISK_QDEPTH,
+						 &qconf) == 0);
+	UK_TEST_ASSERT(uk_blkdev_start(dev) == 0);
+
+	t0 = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_REQS; i++) {
+		uk_blkreq_init(&req, UK_BLKREQ_READ, 0, 1, buf,
+			       bench_req_done, &ncb);
+		uk_blkdev_submit_one(dev, &req);
+		uk_blkdev_poll(dev);
+	}
+	t1 = ukplat_monotonic_clock();
+	UK_TEST_EXPECT_SNUM_EQ(ncb, BENCH_REQS);
+
+	uk_pr_info("bench_blkdev_submit_poll: %"__PRInsec" ns per request\n",
+		   (t1 - t0) / BENCH_REQS);
+
+	uk_blkdev_stop(dev);
+	uk_blkdev_queue_unconfigure(dev, 0);
+	uk_blkdev_unconfigure(dev);
+}
+
+uk_testsuite_register(ukblkdev_bench, NULL);
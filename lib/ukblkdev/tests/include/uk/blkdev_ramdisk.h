@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UK_BLKDEV_RAMDISK_H__
+#define __UK_BLKDEV_RAMDISK_H__
+
+#include <uk/arch/types.h>
+#include <uk/blkdev.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * RAM disks for the unit tests of block device users
+ *
+ * Requests are carried out on submission and completed by finish_reqs. If
+ * interrupts are enabled on a queue, each submission also signals an event.
+ * The disks count the requests they serve.
+ */
+
+#define UK_BLKDEV_RAMDISK_SSIZE		512
+#define UK_BLKDEV_RAMDISK_SECTORS	8192
+#define UK_BLKDEV_RAMDISK_NBQUEUES	2
+#define UK_BLKDEV_RAMDISK_QDEPTH	16
+#define UK_BLKDEV_RAMDISK_COUNT		4
+
+struct uk_blkdev_ramdisk_queue {
+	struct uk_blkreq *done[UK_BLKDEV_RAMDISK_QDEPTH];
+	unsigned int ndone;
+	unsigned int submitted;
+	uint16_t id;
+	int intr_enabled;
+};
+
+struct uk_blkdev_ramdisk {
+	struct uk_blkdev blkdev;
+	int id;
+	int intr_supported;
+	struct uk_blkdev_ramdisk_queue queues[UK_BLKDEV_RAMDISK_NBQUEUES];
+	char *data;
+	unsigned int reads;
+	unsigned int writes;
+	unsigned int flushes;
+};
+
+/**
+ * Returns a zeroed RAM disk with reset request counters. The disk is
+ * registered with ukblkdev on first use and is never unregistered, so it
+ * keeps its configuration from earlier calls: a test that configures the
+ * disk itself must unconfigure it again.
+ *
+ * @param idx
+ *   Index of the disk, below UK_BLKDEV_RAMDISK_COUNT. Test suites that set
+ *   up disks differently must use different disks.
+ * @param intr
+ *   Whether the disk supports interrupts. Only taken into account when the
+ *   disk is registered.
+ * @return
+ *   The disk, or NULL if it could not be allocated or registered
+ */
+struct uk_blkdev_ramdisk *uk_blkdev_ramdisk_get(unsigned int idx, int intr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_BLKDEV_RAMDISK_H__ */
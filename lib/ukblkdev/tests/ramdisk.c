@@ -0,0 +1,224 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <uk/alloc.h>
+#include <uk/blkdev.h>
+#include <uk/blkdev_driver.h>
+#include <uk/blkdev_ramdisk.h>
+#include <uk/errptr.h>
+
+#define RAMDISK_SIZE	(UK_BLKDEV_RAMDISK_SECTORS * UK_BLKDEV_RAMDISK_SSIZE)
+
+static struct uk_blkdev_ramdisk ramdisks[UK_BLKDEV_RAMDISK_COUNT];
+
+#define to_ramdisk(dev) __containerof(dev, struct uk_blkdev_ramdisk, blkdev)
+#define to_ramdisk_queue(queue) ((struct uk_blkdev_ramdisk_queue *)(queue))
+
+static void ramdisk_get_info(struct uk_blkdev *dev __unused,
+			     struct uk_blkdev_info *info)
+{
+	info->max_queues = UK_BLKDEV_RAMDISK_NBQUEUES;
+}
+
+static int ramdisk_configure(struct uk_blkdev *dev __unused,
+			     const struct uk_blkdev_conf *conf __unused)
+{
+	return 0;
+}
+
+static int ramdisk_queue_get_info(struct uk_blkdev *dev __unused,
+				  uint16_t queue_id __unused,
+				  struct uk_blkdev_queue_info *qinfo)
+{
+	qinfo->nb_min = UK_BLKDEV_RAMDISK_QDEPTH;
+	qinfo->nb_max = UK_BLKDEV_RAMDISK_QDEPTH;
+	qinfo->nb_align = 1;
+	qinfo->nb_is_power_of_two = 1;
+	return 0;
+}
+
+static struct uk_blkdev_queue *
+ramdisk_queue_configure(struct uk_blkdev *dev, uint16_t queue_id,
+			uint16_t nb_desc __unused,
+			const struct uk_blkdev_queue_conf *conf __unused)
+{
+	struct uk_blkdev_ramdisk_queue *queue;
+
+	queue = &to_ramdisk(dev)->queues[queue_id];
+	memset(queue, 0, sizeof(*queue));
+	queue->id = queue_id;
+	return (struct uk_blkdev_queue *)queue;
+}
+
+static int ramdisk_start(struct uk_blkdev *dev __unused)
+{
+	return 0;
+}
+
+static int ramdisk_intr_enable(struct uk_blkdev *dev,
+			       struct uk_blkdev_queue *queue)
+{
+	if (!to_ramdisk(dev)->intr_supported)
+		return -ENOTSUP;
+	to_ramdisk_queue(queue)->intr_enabled = 1;
+	return 0;
+}
+
+static int ramdisk_intr_disable(struct uk_blkdev *dev __unused,
+				struct uk_blkdev_queue *queue)
+{
+	to_ramdisk_queue(queue)->intr_enabled = 0;
+	return 0;
+}
+
+static void ramdisk_copy(struct uk_blkreq *req, char *p)
+{
+	__sz len = req->nb_sectors * UK_BLKDEV_RAMDISK_SSIZE;
+	int i;
+
+	if (!req->iovcnt) {
+		if (req->operation == UK_BLKREQ_READ)
+			memcpy(req->aio_buf, p, len);
+		else
+			memcpy(p, req->aio_buf, len);
+		return;
+	}
+
+	for (i = 0; i < req->iovcnt; i++) {
+		if (req->operation == UK_BLKREQ_READ)
+			memcpy(req->iov[i].iov_base, p, req->iov[i].iov_len);
+		else
+			memcpy(p, req->iov[i].iov_base, req->iov[i].iov_len);
+		p += req->iov[i].iov_len;
+	}
+}
+
+static int ramdisk_submit_one(struct uk_blkdev *dev,
+			      struct uk_blkdev_queue *q,
+			      struct uk_blkreq *req)
+{
+	struct uk_blkdev_ramdisk_queue *queue = to_ramdisk_queue(q);
+	struct uk_blkdev_ramdisk *disk = to_ramdisk(dev);
+
+	if (queue->ndone == UK_BLKDEV_RAMDISK_QDEPTH)
+		return 0;
+
+	switch (req->operation) {
+	case UK_BLKREQ_READ:
+	case UK_BLKREQ_WRITE:
+		if (req->start_sector + req->nb_sectors >
+		    UK_BLKDEV_RAMDISK_SECTORS)
+			return -EINVAL;
+		ramdisk_copy(req, disk->data +
+			     req->start_sector * UK_BLKDEV_RAMDISK_SSIZE);
+		if (req->operation == UK_BLKREQ_READ)
+			disk->reads++;
+		else
+			disk->writes++;
+		break;
+	case UK_BLKREQ_FFLUSH:
+		disk->flushes++;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+	req->result = 0;
+	queue->done[queue->ndone++] = req;
+	queue->submitted++;
+
+	if (queue->intr_enabled)
+		uk_blkdev_drv_queue_event(dev, queue->id);
+
+	return UK_BLKDEV_STATUS_SUCCESS |
+	       (queue->ndone < UK_BLKDEV_RAMDISK_QDEPTH ?
+		UK_BLKDEV_STATUS_MORE : 0);
+}
+
+static int ramdisk_finish_reqs(struct uk_blkdev *dev __unused,
+			       struct uk_blkdev_queue *q)
+{
+	struct uk_blkdev_ramdisk_queue *queue = to_ramdisk_queue(q);
+	struct uk_blkreq *req;
+
+	while (queue->ndone) {
+		req = queue->done[--queue->ndone];
+		uk_blkreq_finished(req);
+		if (req->cb)
+			req->cb(req, req->cb_cookie);
+	}
+	return 0;
+}
+
+static int ramdisk_stop(struct uk_blkdev *dev __unused)
+{
+	return 0;
+}
+
+static int ramdisk_queue_unconfigure(struct uk_blkdev *dev __unused,
+				     struct uk_blkdev_queue *queue __unused)
+{
+	return 0;
+}
+
+static int ramdisk_unconfigure(struct uk_blkdev *dev __unused)
+{
+	return 0;
+}
+
+static const struct uk_blkdev_ops ramdisk_ops = {
+	.get_info		= ramdisk_get_info,
+	.dev_configure		= ramdisk_configure,
+	.queue_get_info		= ramdisk_queue_get_info,
+	.queue_configure	= ramdisk_queue_configure,
+	.dev_start		= ramdisk_start,
+	.dev_stop		= ramdisk_stop,
+	.queue_intr_enable	= ramdisk_intr_enable,
+	.queue_intr_disable	= ramdisk_intr_disable,
+	.queue_unconfigure	= ramdisk_queue_unconfigure,
+	.dev_unconfigure	= ramdisk_unconfigure,
+};
+
+struct uk_blkdev_ramdisk *uk_blkdev_ramdisk_get(unsigned int idx, int intr)
+{
+	struct uk_blkdev_ramdisk *disk;
+	struct uk_alloc *a = uk_alloc_get_default();
+
+	if (idx >= UK_BLKDEV_RAMDISK_COUNT)
+		return NULL;
+	disk = &ramdisks[idx];
+
+	if (!disk->blkdev.dev_ops) {
+		disk->data = uk_malloc(a, RAMDISK_SIZE);
+		if (!disk->data)
+			return NULL;
+
+		disk->blkdev.dev_ops = &ramdisk_ops;
+		disk->blkdev.submit_one = ramdisk_submit_one;
+		disk->blkdev.finish_reqs = ramdisk_finish_reqs;
+		disk->blkdev._data = ERR2PTR(-EINVAL);
+		disk->blkdev.capabilities.sectors = UK_BLKDEV_RAMDISK_SECTORS;
+		disk->blkdev.capabilities.ssize = UK_BLKDEV_RAMDISK_SSIZE;
+		disk->blkdev.capabilities.mode = O_RDWR;
+		disk->blkdev.capabilities.max_sectors_per_req =
+			UK_BLKDEV_RAMDISK_SECTORS;
+		disk->blkdev.capabilities.ioalign = UK_BLKDEV_RAMDISK_SSIZE;
+		disk->blkdev.capabilities.max_segments = UK_BLKDEV_RAMDISK_QDEPTH;
+		disk->intr_supported = intr;
+		disk->id = uk_blkdev_drv_register(&disk->blkdev, a, "ramdisk");
+	}
+	if (disk->id < 0)
+		return NULL;
+
+	memset(disk->data, 0, RAMDISK_SIZE);
+	disk->reads = 0;
+	disk->writes = 0;
+	disk->flushes = 0;
+	return disk;
+}
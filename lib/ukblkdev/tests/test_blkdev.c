@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/blkdev.h>
+#include <uk/blkdev_ramdisk.h>
+
+#define TEST_SSIZE		UK_BLKDEV_RAMDISK_SSIZE
+#define TEST_NBQUEUES		UK_BLKDEV_RAMDISK_NBQUEUES
+#define TEST_QDEPTH		UK_BLKDEV_RAMDISK_QDEPTH
+#define TEST_DISK		0
+
+static struct uk_blkdev_ramdisk *test_disk;
+
+/* Returns the test device configured with polled queues, but not started */
+static struct uk_blkdev *test_dev_setup(void)
+{
+	struct uk_blkdev_conf conf = { .nb_queues = TEST_NBQUEUES };
+	struct uk_blkdev_queue_conf qconf = { 0 };
+	struct uk_blkdev *dev;
+	uint16_t q;
+
+	test_disk = uk_blkdev_ramdisk_get(TEST_DISK, 0);
+	if (!test_disk)
+		return NULL;
+	dev = &test_disk->blkdev;
+
+	if (uk_blkdev_configure(dev, &conf))
+		return NULL;
+
+	qconf.a = uk_alloc_get_default();
+	for (q = 0; q < TEST_NBQUEUES; q++)
+		if (uk_blkdev_queue_configure(dev, q, TEST_QDEPTH, &qconf))
+			return NULL;
+
+	return dev;
+}
+
+static void test_dev_teardown(struct uk_blkdev *dev)
+{
+	uint16_t q;
+
+	if (uk_blkdev_state_get(dev) == UK_BLKDEV_RUNNING)
+		uk_blkdev_stop(dev);
+	for (q = 0; q < TEST_NBQUEUES; q++)
+		uk_blkdev_queue_unconfigure(dev, q);
+	uk_blkdev_unconfigure(dev);
+}
+
+static void test_req_done(struct uk_blkreq *req __unused, void *cookie)
+{
+	(*(int *)cookie)++;
+}
+
+UK_TESTCASE(ukblkdev, test_blkdev_lcpu_queue)
+{
+	struct uk_blkdev *dev;
+	struct uk_blkreq req;
+	char buf[TEST_SSIZE];
+	int ncb = 0;
+
+	if (CONFIG_LIBUKBLKDEV_MAXNBQUEUES < TEST_NBQUEUES)
+		return;
+
+	dev = test_dev_setup();
+	UK_TEST_ASSERT(dev != NULL);
+
+	/* LCPUs are spread over the queues */
+	UK_TEST_EXPECT_SNUM_EQ(uk_blkdev_lcpu_queue(dev),
+			       ukplat_lcpu_idx() % TEST_NBQUEUES);
+
+	UK_TEST_EXPECT_SNUM_EQ(uk_blkdev_lcpu_queue_set(dev,
+							ukplat_lcpu_idx(),
+							TEST_NBQUEUES),
+			       -EINVAL);
+	UK_TEST_EXPECT_SNUM_EQ(uk_blkdev_lcpu_queue_set(dev,
+							ukplat_lcpu_count(),
+							1),
+			       -EINVAL);
+	UK_TEST_EXPECT_ZERO(uk_blkdev_lcpu_queue_set(dev, ukplat_lcpu_idx(),
+						     1));
+	UK_TEST_EXPECT_SNUM_EQ(uk_blkdev_lcpu_queue(dev), 1);
+
+	UK_TEST_ASSERT(uk_blkdev_start(dev) == 0);
+	UK_TEST_EXPECT_SNUM_EQ(uk_blkdev_lcpu_queue_set(dev,
+							ukplat_lcpu_idx(), 0),
+			       -EBUSY);
+
+	/* Requests go to the queue of the LCPU and complete when polled */
+	memset(test_disk->data + TEST_SSIZE, 'a', TEST_SSIZE);
+	uk_blkreq_init(&req, UK_BLKREQ_READ, 1, 1, buf, test_req_done, &ncb);
+	UK_TEST_EXPECT(uk_blkdev_status_successful(
+			       uk_blkdev_submit_one(dev, &req)));
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->queues[1].submitted, 1);
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->queues[0].submitted, 0);
+	UK_TEST_EXPECT(!uk_blkreq_is_done(&req));
+	UK_TEST_EXPECT_ZERO(ncb);
+
+	UK_TEST_EXPECT_ZERO(uk_blkdev_poll(dev));
+	UK_TEST_EXPECT(uk_blkreq_is_done(&req));
+	UK_TEST_EXPECT_SNUM_EQ(ncb, 1);
+	UK_TEST_EXPECT_SNUM_EQ(buf[0], 'a');
+
+#if CONFIG_LIBUKBLKDEV_SYNC_IO_BLOCKED_WAITING
+	/* Synchronous requests on polled queues poll for their completion */
+	memset(buf, 'b', sizeof(buf));
+	UK_TEST_EXPECT_ZERO(uk_blkdev_sync_write(dev, 0, 2, 1, buf));
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->data[2 * TEST_SSIZE], 'b');
+	UK_TEST_EXPECT_SNUM_EQ(test_disk->queues[0].submitted, 1);
+#endif
+
+	test_dev_teardown(dev);
+}
+
+uk_testsuite_register(ukblkdev, NULL);
@@ -54,6 +54,9 @@
 #elif CONFIG_LIBUKBOOT_INITREGION
 #include <uk/allocregion.h>
 #define uk_alloc_init uk_allocregion_init
+#elif CONFIG_LIBUKBOOT_INITSLAB
+#include <uk/allocslab.h>
+#define uk_alloc_init uk_allocslab_init
 #elif CONFIG_LIBUKBOOT_INITMIMALLOC
 #include <uk/mimalloc.h>
 #define uk_alloc_init uk_mimalloc_init
@@ -70,6 +73,9 @@
 #if CONFIG_LIBUKBOOT_INITSCHEDCOOP
 #include <uk/schedcoop.h>
 #endif /* CONFIG_LIBUKBOOT_INITSCHEDCOOP */
+#if CONFIG_LIBUKBOOT_INITSCHEDMQ
+#include <uk/schedmq.h>
+#endif /* CONFIG_LIBUKBOOT_INITSCHEDMQ */
 #include <uk/arch/lcpu.h>
 #include <uk/plat/bootstrap.h>
 #include <uk/plat/memory.h>
@@ -364,6 +370,8 @@ void ukplat_entry(int argc, char *argv[])
 	uk_pr_info("Initialize scheduling...\n");
 #if CONFIG_LIBUKBOOT_INITSCHEDCOOP
 	s = uk_schedcoop_create(a);
+#elif CONFIG_LIBUKBOOT_INITSCHEDMQ
+	s = uk_schedmq_create(a, 0);
 #endif
 	if (unlikely(!s))
 		UK_CRASH("Failed to initialize scheduling\n");
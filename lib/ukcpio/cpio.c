@@ -47,6 +47,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <utime.h>
+#if CONFIG_LIBUKCPIO_ZEROCOPY
+#include <vfscore/file.h>
+#include <vfscore/dentry.h>
+#include <vfscore/vnode.h>
+#include <ramfs/ramfs.h>
+#endif /* CONFIG_LIBUKCPIO_ZEROCOPY */
 
 /*
  * Currently only supports BSD new-style cpio archive format.
@@ -144,6 +150,32 @@ int uk_syscall_r_mkdir(const char *, mode_t);
 int uk_syscall_r_symlink(const char *, const char *);
 int uk_syscall_r_stat(const char *, struct stat *);
 
+#if CONFIG_LIBUKCPIO_ZEROCOPY
+/*
+ * Makes the file reference its contents in the archive instead of copying
+ * them. The archive stays in memory anyway, so this saves the copy and
+ * the memory for it. Files are copied on their first write.
+ */
+static int
+reference_file(int fd, const char *contents, size_t len)
+{
+	struct vfscore_file *fp;
+	struct vnode *vp;
+	int rc;
+
+	fp = vfscore_get_file(fd);
+	if (unlikely(!fp))
+		return EBADF;
+
+	vp = fp->f_dentry->d_vnode;
+	vn_lock(vp);
+	rc = ramfs_set_file_data(vp, contents, len);
+	vn_unlock(vp);
+	vfscore_put_file(fp);
+	return rc;
+}
+#endif /* CONFIG_LIBUKCPIO_ZEROCOPY */
+
 static enum ukcpio_error
 extract_file(const char *path, const char *contents, size_t len,
 	     mode_t mode, uint32_t mtime)
@@ -163,6 +195,12 @@ extract_file(const char *path, const char *contents, size_t len,
 		goto out;
 	}
 
+#if CONFIG_LIBUKCPIO_ZEROCOPY
+	/* Fall back to copying if the destination is not on ramfs */
+	if (len && !reference_file(fd, contents, len))
+		len = 0;
+#endif /* CONFIG_LIBUKCPIO_ZEROCOPY */
+
 	while (len) {
 		ssize_t written = uk_syscall_r_write(fd, contents, len);
 
@@ -59,6 +59,11 @@ enum ukcpio_error {
 /**
  * Extracts the given CPIO buffer to the path destination.
  *
+ * With `CONFIG_LIBUKCPIO_ZEROCOPY`, regular files that are extracted to
+ * ramfs reference their data in `buf` instead of holding a copy. The buffer
+ * must then stay mapped and must not be modified for the lifetime of these
+ * files, or until they are first written to.
+ *
  * @param dest
  *  The path location where the buffer will be extracted to.
  * @param buf
@@ -38,6 +38,7 @@
 #include <uk/plat/time.h>
 #include <string.h>
 #include <uk/arch/lcpu.h>
+#include <uk/atomic.h>
 #include <uk/plat/lcpu.h>
 
 /* There is no justification of the limit of 80 symbols. But there
@@ -46,7 +47,10 @@
  * for another number
  */
 #define __UK_TRACE_MAX_STRLEN 80
+#define __UK_TRACE_MAX_ARGS 7
 #define UK_TP_HEADER_MAGIC 0x64685254 /* TRhd */
+#define UK_TP_PAD_MAGIC 0x64615054 /* TPad */
+#define UK_TP_END_MAGIC 0x646e4554 /* TEnd */
 #define UK_TP_DEF_MAGIC 0x65645054 /* TPde */
 
 enum __uk_trace_arg_type {
@@ -57,50 +61,103 @@ enum __uk_trace_arg_type {
 struct uk_tracepoint_header {
 	uint32_t magic;
 	uint32_t size;
-	__nsec time;
+	/* Timestamp in uk_trace_clock() ticks */
+	__u64 time;
 	void *cookie;
 };
 
-extern size_t uk_trace_buffer_free;
-extern char *uk_trace_buffer_writep;
+/* Records start at aligned offsets so that headers can be accessed directly */
+#define UK_TRACE_RECORD_ALIGN 8
+#define UK_TRACE_RECORD_MAX						\
+	ALIGN_UP(sizeof(struct uk_tracepoint_header) +			\
+		 __UK_TRACE_MAX_ARGS * (__UK_TRACE_MAX_STRLEN + 1),	\
+		 UK_TRACE_RECORD_ALIGN)
+#if CONFIG_LIBUKDEBUG_TRACEPOINTS
+#define UK_TRACE_RING_SIZE						\
+	ALIGN_DOWN(CONFIG_LIBUKDEBUG_TRACE_BUFFER_SIZE, UK_TRACE_RECORD_ALIGN)
 
+UK_CTASSERT(UK_TRACE_RING_SIZE >= 2 * UK_TRACE_RECORD_MAX);
+
+/* The clock reference of a ring is refreshed after this many ticks */
+#define UK_TRACE_CLOCK_REF_TICKS (1ULL << 24)
+
+/*
+ * Every LCPU records its tracepoints in its own ring, with interrupts
+ * disabled, so writers never contend. When a ring is full, the oldest records
+ * are overwritten.
+ *
+ * `head` and `tail` are positions in the stream of bytes that was written to
+ * the ring; the byte offset in `data` is the position modulo the ring size.
+ * Records do not wrap around: if a record does not fit before the end of
+ * `data`, the rest is skipped (with a pad record if there is room for a
+ * header) and the record starts at offset 0.
+ */
+struct uk_trace_ring {
+	/* Position of the next record */
+	__u64 head;
+	/* Position of the oldest record */
+	__u64 tail;
+	/* Number of records that were overwritten */
+	__u64 lost;
+	/*
+	 * Two points in time in uk_trace_clock() ticks and in nanoseconds of
+	 * ukplat_monotonic_clock(): the first record and the most recent
+	 * refresh. They are used to convert timestamps offline.
+	 */
+	__u64 clock0;
+	__u64 nsec0;
+	__u64 clock1;
+	__u64 nsec1;
+	char data[UK_TRACE_RING_SIZE] __align(UK_TRACE_RECORD_ALIGN);
+} __align64;
+
+extern UKPLAT_PER_LCPU_DEFINE(struct uk_trace_ring, uk_trace_rings);
+#endif /* CONFIG_LIBUKDEBUG_TRACEPOINTS */
+
+/**
+ * Returns a timestamp for trace records: the time stamp counter on x86_64,
+ * the virtual counter on arm64 and the monotonic clock elsewhere.
+ */
+static inline __u64 uk_trace_clock(void)
+{
+#if defined(__X86_64__)
+	__u32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((__u64)hi << 32) | lo;
+#elif defined(__ARM_64__)
+	__u64 val;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(val));
+	return val;
+#else
+	return ukplat_monotonic_clock();
+#endif
+}
 
 static inline void __uk_trace_save_arg(char **pbuff,
-				      size_t *pfree,
 				      enum __uk_trace_arg_type type,
 				      int size,
 				      long arg)
 {
 	char *buff = *pbuff;
-	size_t free = *pfree;
 	int len;
 
-	if (type == __UK_TRACE_ARG_STRING) {
-		len = strnlen((char *) arg, __UK_TRACE_MAX_STRLEN);
-		/* The '+1' is for storing length of the string */
-		size = len + 1;
-	}
-
-	if (free < (size_t) size) {
-		/* Block the next invocations of trace points */
-		*pfree = 0;
-		uk_trace_buffer_free = 0;
-		return;
-	}
-
 	switch (type) {
 	case __UK_TRACE_ARG_INT:
 		/* for simplicity we do not care about alignment */
 		memcpy(buff, &arg, size);
 		break;
 	case __UK_TRACE_ARG_STRING:
+		len = strnlen((char *) arg, __UK_TRACE_MAX_STRLEN);
+		/* The '+1' is for storing length of the string */
+		size = len + 1;
 		*((uint8_t *) buff) = len;
 		memcpy(buff + 1, (char *) arg, len);
 		break;
 	}
 
 	*pbuff = buff + size;
-	*pfree -= size;
 }
 
 #define __UK_TRACE_GET_TYPE(arg) (					\
@@ -112,7 +169,6 @@ static inline void __uk_trace_save_arg(char **pbuff,
 
 #define __UK_TRACE_SAVE_ONE(arg) __uk_trace_save_arg(	\
 		&buff,					\
-		&free,					\
 		__UK_TRACE_GET_TYPE(arg),		\
 		sizeof(arg),				\
 		(long) arg)
@@ -196,53 +252,138 @@ static inline void __uk_trace_save_arg(char **pbuff,
 		__UK_TRACE_ARG_TYPES(NR, __VA_ARGS__),		\
 		#trace_name, fmt }
 
-static inline char *__uk_trace_get_buff(size_t *free)
-{
-	struct uk_tracepoint_header *ret;
+#if CONFIG_LIBUKDEBUG_TRACEPOINTS
+void __uk_trace_ring_evict(struct uk_trace_ring *ring, __u64 pos);
+void __uk_trace_ring_clock_ref(struct uk_trace_ring *ring, __u64 clock);
 
-	if (uk_trace_buffer_free < sizeof(*ret))
-		return 0;
-	ret = (struct uk_tracepoint_header *) uk_trace_buffer_writep;
+static inline char *__uk_trace_get_buff(struct uk_trace_ring *ring)
+{
+	__u64 off = ring->head % UK_TRACE_RING_SIZE;
+	__u64 skip = 0;
+	struct uk_tracepoint_header *head;
+
+	/* Records do not wrap around the end of the ring */
+	if (off + UK_TRACE_RECORD_MAX > UK_TRACE_RING_SIZE)
+		skip = UK_TRACE_RING_SIZE - off;
+
+	/* Make room for the largest possible record */
+	if (ring->head + skip + UK_TRACE_RECORD_MAX - ring->tail >
+	    UK_TRACE_RING_SIZE)
+		__uk_trace_ring_evict(ring, ring->head + skip +
+					    UK_TRACE_RECORD_MAX -
+					    UK_TRACE_RING_SIZE);
+
+	if (skip) {
+		if (skip >= sizeof(*head)) {
+			head = (struct uk_tracepoint_header *)
+				&ring->data[off];
+			head->magic = UK_TP_PAD_MAGIC;
+			head->size = skip - sizeof(*head);
+		}
+		off = 0;
+		wmb();
+		UK_WRITE_ONCE(ring->head, ring->head + skip);
+	}
 
 	/* In case we fail to fill the tracepoint for any reason, make
 	 * sure we do not confuse parser. We fill the header only
 	 * after the full tracepoint is completed
 	 */
-	ret->magic = 0;
-	*free = uk_trace_buffer_free - sizeof(*ret);
-	return (char *) (ret + 1);
+	head = (struct uk_tracepoint_header *) &ring->data[off];
+	head->magic = 0;
+	return (char *) (head + 1);
 }
 
-static inline void __uk_trace_finalize_buff(char *new_buff_pos, void *cookie)
+static inline void __uk_trace_finalize_buff(struct uk_trace_ring *ring,
+					    char *new_buff_pos, void *cookie)
 {
-	uint32_t size;
-	struct uk_tracepoint_header *head =
-		(struct uk_tracepoint_header *) uk_trace_buffer_writep;
-
-	if (uk_trace_buffer_free == 0) {
-		/**
-		 * This means that the buffer was large enough for the header.
-		 * (__uk_trace_get_buff would have return NULL and the
-		 * tracepoint would have short-circuited), but the tracepoint
-		 * wanted to write some data which did not fit into the
-		 * remaining space. Therefore, the free variable was also set to
-		 * zero.
-		 * This implies that the event is incomplete and we must not
-		 * mark it as usable via the magic variable.
-		 */
-		return;
-	}
+	struct uk_tracepoint_header *head = (struct uk_tracepoint_header *)
+		&ring->data[ring->head % UK_TRACE_RING_SIZE];
+	__u64 clock = uk_trace_clock();
 
-	size = new_buff_pos - uk_trace_buffer_writep;
-	uk_trace_buffer_writep += size;
-	uk_trace_buffer_free -= size;
+	if (unlikely(clock - ring->clock1 >= UK_TRACE_CLOCK_REF_TICKS))
+		__uk_trace_ring_clock_ref(ring, clock);
 
-	head->time = ukplat_monotonic_clock();
-	head->size = size - sizeof(*head);
+	head->time = clock;
+	head->size = new_buff_pos - (char *) (head + 1);
 	head->cookie = cookie;
-	barrier();
+	wmb();
 	head->magic = UK_TP_HEADER_MAGIC;
+	UK_WRITE_ONCE(ring->head,
+		      ring->head + ALIGN_UP(sizeof(*head) + head->size,
+					    UK_TRACE_RECORD_ALIGN));
 }
+#endif /* CONFIG_LIBUKDEBUG_TRACEPOINTS */
+
+/*
+ * Binary format of trace dumps, which is produced by uk_trace_dump() and by
+ * the `uk trace save` gdb command:
+ *
+ *   struct uk_trace_dump_header
+ *   for each LCPU:
+ *     struct uk_trace_dump_ring
+ *     records (struct uk_tracepoint_header + arguments, each aligned to
+ *              UK_TRACE_RECORD_ALIGN), oldest first
+ *     struct uk_tracepoint_header with magic UK_TP_END_MAGIC
+ *
+ * All fields are in the byte order of the machine. The arguments of records
+ * are decoded with the tracepoint definitions from the `.uk_tracepoints_list`
+ * section of the debug image; `cookie` is the address of the definition.
+ */
+#define UK_TRACE_DUMP_MAGIC 0x72744b55 /* UKtr */
+#define UK_TRACE_DUMP_VERSION 2
+#define UK_TRACE_DUMP_RING_MAGIC 0x676e5254 /* TRng */
+
+struct uk_trace_dump_header {
+	__u32 magic;
+	__u16 version;
+	/* sizeof(void *), which is the size of record cookies */
+	__u16 ptr_size;
+	__u32 nr_rings;
+	__u32 ring_size;
+	/* Clock reference taken when the dump was started */
+	__u64 clock;
+	__u64 nsec;
+};
+
+struct uk_trace_dump_ring {
+	__u32 magic;
+	__u32 lcpu_idx;
+	__u64 lost;
+	/* See struct uk_trace_ring */
+	__u64 clock0;
+	__u64 nsec0;
+	__u64 clock1;
+	__u64 nsec1;
+};
+
+/**
+ * Function that receives the output of uk_trace_dump()
+ *
+ * @param cookie
+ *   Argument that was passed to uk_trace_dump()
+ * @param buf
+ *   Next part of the dump
+ * @param len
+ *   Length of `buf` in bytes
+ * @return
+ *   0 on success, a negative errno value to abort the dump
+ */
+typedef int (*uk_trace_dump_func_t)(void *cookie, const void *buf, __sz len);
+
+/**
+ * Writes the records of all trace rings in the dump format described above.
+ * Tracing continues while the dump is taken: records that are overwritten
+ * before they could be copied are left out.
+ *
+ * @param func
+ *   Function that writes the dump, called for consecutive parts
+ * @param cookie
+ *   Argument for `func`
+ * @return
+ *   0 on success, the return value of `func` if it fails
+ */
+int uk_trace_dump(uk_trace_dump_func_t func, void *cookie);
 
 /* Makes from "const char*" "const char* arg1".
  */
@@ -263,13 +404,12 @@ static inline void __uk_trace_finalize_buff(char *new_buff_pos, void *cookie)
 	static inline void trace_name(__UK_TRACE_ARGS_MAP(n, __VA_ARGS__)) \
 	{								\
 		unsigned long flags = ukplat_lcpu_save_irqf();		\
-		size_t free __maybe_unused;				\
-		char *buff = __uk_trace_get_buff(&free);		\
-		if (buff) {						\
-			__UK_TRACE_SAVE_ARGS ## n();			\
-			__uk_trace_finalize_buff(			\
-				buff, &regdata_name);			\
-		}							\
+		struct uk_trace_ring *ring =				\
+			&ukplat_per_lcpu_current(uk_trace_rings);	\
+		char *buff = __uk_trace_get_buff(ring);			\
+									\
+		__UK_TRACE_SAVE_ARGS ## n();				\
+		__uk_trace_finalize_buff(ring, buff, &regdata_name);	\
 		ukplat_lcpu_restore_irqf(flags);			\
 	}
 #else
@@ -31,17 +31,140 @@
  */
 
 #include <stddef.h>
+#include <uk/assert.h>
 #include <uk/essentials.h>
+#include <uk/trace.h>
 
-/* If the buffer is full, tracing disables itself.
- * Using a circular buffer will not make it better: in any case, losing trace
- * data is undesired and we should keep this as simple as possible.
+/* Rings never stop recording: when a ring is full, the oldest records are
+ * overwritten, so that the most recent history is always available.
  */
-char uk_trace_buffer[CONFIG_LIBUKDEBUG_TRACE_BUFFER_SIZE];
+UKPLAT_PER_LCPU_DEFINE(struct uk_trace_ring, uk_trace_rings);
 
-size_t uk_trace_buffer_free = CONFIG_LIBUKDEBUG_TRACE_BUFFER_SIZE;
-char *uk_trace_buffer_writep = uk_trace_buffer;
+void __uk_trace_ring_evict(struct uk_trace_ring *ring, __u64 pos)
+{
+	struct uk_tracepoint_header *head;
+	__u64 tail = ring->tail;
+	__u64 off;
 
+	while (tail < pos) {
+		off = tail % UK_TRACE_RING_SIZE;
+		head = (struct uk_tracepoint_header *) &ring->data[off];
+		if (UK_TRACE_RING_SIZE - off < sizeof(*head) ||
+		    head->magic == UK_TP_PAD_MAGIC) {
+			tail += UK_TRACE_RING_SIZE - off;
+			continue;
+		}
+
+		tail += ALIGN_UP(sizeof(*head) + head->size,
+				 UK_TRACE_RECORD_ALIGN);
+		ring->lost++;
+	}
+
+	/* Readers must see the new tail before the records are overwritten */
+	UK_WRITE_ONCE(ring->tail, tail);
+	wmb();
+}
+
+void __uk_trace_ring_clock_ref(struct uk_trace_ring *ring, __u64 clock)
+{
+	__u64 nsec = ukplat_monotonic_clock();
+
+	if (!ring->clock0) {
+		ring->clock0 = clock;
+		ring->nsec0 = nsec;
+	}
+	ring->clock1 = clock;
+	ring->nsec1 = nsec;
+}
+
+static int trace_dump_ring(struct uk_trace_ring *ring, __u32 lcpu_idx,
+			   uk_trace_dump_func_t func, void *cookie)
+{
+	union {
+		struct uk_tracepoint_header head;
+		char buf[UK_TRACE_RECORD_MAX];
+	} rec;
+	struct uk_trace_dump_ring dr;
+	__u64 pos, head, off, len;
+	int rc;
+
+	dr.magic = UK_TRACE_DUMP_RING_MAGIC;
+	dr.lcpu_idx = lcpu_idx;
+	dr.lost = UK_READ_ONCE(ring->lost);
+	dr.clock0 = ring->clock0;
+	dr.nsec0 = ring->nsec0;
+	dr.clock1 = ring->clock1;
+	dr.nsec1 = ring->nsec1;
+	rc = func(cookie, &dr, sizeof(dr));
+	if (unlikely(rc))
+		return rc;
+
+	head = UK_READ_ONCE(ring->head);
+	rmb();
+	pos = UK_READ_ONCE(ring->tail);
+	while (pos < head) {
+		off = pos % UK_TRACE_RING_SIZE;
+		len = MIN(sizeof(rec), UK_TRACE_RING_SIZE - off);
+		memcpy(rec.buf, &ring->data[off], len);
+
+		/* The copy is only valid if the writer did not evict the
+		 * record in the meantime, otherwise continue with the oldest
+		 * record that is left.
+		 */
+		rmb();
+		if (UK_READ_ONCE(ring->tail) > pos) {
+			pos = UK_READ_ONCE(ring->tail);
+			continue;
+		}
+
+		if (len < sizeof(rec.head) ||
+		    rec.head.magic == UK_TP_PAD_MAGIC) {
+			pos += UK_TRACE_RING_SIZE - off;
+			continue;
+		}
+
+		UK_ASSERT(rec.head.magic == UK_TP_HEADER_MAGIC);
+		len = ALIGN_UP(sizeof(rec.head) + rec.head.size,
+			       UK_TRACE_RECORD_ALIGN);
+		rc = func(cookie, rec.buf, len);
+		if (unlikely(rc))
+			return rc;
+		pos += len;
+	}
+
+	memset(&rec.head, 0, sizeof(rec.head));
+	rec.head.magic = UK_TP_END_MAGIC;
+	return func(cookie, &rec.head, sizeof(rec.head));
+}
+
+int uk_trace_dump(uk_trace_dump_func_t func, void *cookie)
+{
+	struct uk_trace_dump_header dh;
+	__u32 i;
+	int rc;
+
+	UK_ASSERT(func);
+
+	dh.magic = UK_TRACE_DUMP_MAGIC;
+	dh.version = UK_TRACE_DUMP_VERSION;
+	dh.ptr_size = sizeof(void *);
+	dh.nr_rings = ukplat_lcpu_count();
+	dh.ring_size = UK_TRACE_RING_SIZE;
+	dh.clock = uk_trace_clock();
+	dh.nsec = ukplat_monotonic_clock();
+	rc = func(cookie, &dh, sizeof(dh));
+	if (unlikely(rc))
+		return rc;
+
+	for (i = 0; i < dh.nr_rings; i++) {
+		rc = trace_dump_ring(&ukplat_per_lcpu(uk_trace_rings, i), i,
+				     func, cookie);
+		if (unlikely(rc))
+			return rc;
+	}
+
+	return 0;
+}
 
 /* Store a string in format "key = value" in the section
  * .uk_trace_keyvals. This can be anything what you want trace.py
@@ -59,4 +182,4 @@ char *uk_trace_buffer_writep = uk_trace_buffer;
 	static const char key[] __used =		\
 		#key " = " #val
 
-TRACE_DEFINE_KEY(format_version, 1);
+TRACE_DEFINE_KEY(format_version, 2);
@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/netbuf.h>
+#include <uk/netstructs.h>
+#include <uk/netdev_gro.h>
+
+/* Number of flows that are tracked at the same time within a burst */
+#define GRO_MAX_FLOWS	8
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define gro_ntohs(x)	__builtin_bswap16(x)
+#define gro_ntohl(x)	__builtin_bswap32(x)
+#else /* __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ */
+#define gro_ntohs(x)	(x)
+#define gro_ntohl(x)	(x)
+#endif /* __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ */
+#define gro_htons(x)	gro_ntohs(x)
+
+/* Headers of a TCP segment that is a candidate for coalescing */
+struct gro_pkt {
+	struct uk_netbuf *pkt;
+	__u8 *eth;
+	/* Exactly one of `ip4` and `ip6` is set */
+	struct uk_iphdr *ip4;
+	struct uk_ip6hdr *ip6;
+	struct uk_tcphdr *th;
+	/* Length of the TCP header, including options */
+	__u16 thlen;
+	/* Length of the Ethernet, IP, and TCP headers */
+	__u16 hdr_len;
+	__u16 payload;
+	__u32 seq;
+};
+
+struct gro_flow {
+	/* First segment, its headers become the ones of the coalesced packet */
+	struct gro_pkt head;
+	/* Last netbuf of the chain */
+	struct uk_netbuf *tail;
+	__u32 next_seq;
+	__u32 payload;
+	/* Segment size, given by the first segment */
+	__u16 mss;
+	__u16 nb_segs;
+	/* Set when the flow must not grow anymore, e.g., after a PSH */
+	int closed;
+};
+
+static int gro_parse(struct uk_netbuf *pkt, struct gro_pkt *p)
+{
+	struct uk_netbuf *nb;
+	__u32 chain_len = 0;
+	__u16 ethertype, l3len, iplen;
+
+	/* The TCP checksum will not be valid anymore after coalescing */
+	if ((pkt->flags & (UK_NETBUF_F_DATA_VALID | UK_NETBUF_F_PARTIAL_CSUM |
+			   UK_NETBUF_F_GSO_TCPV4 | UK_NETBUF_F_GSO_TCPV6))
+	    != UK_NETBUF_F_DATA_VALID)
+		return -1;
+	if (pkt->len < UK_ETH_HDR_UNTAGGED_LEN + sizeof(struct uk_iphdr))
+		return -1;
+
+	p->pkt = pkt;
+	p->eth = pkt->data;
+	ethertype = (p->eth[2 * UK_ETH_ADDR_LEN] << 8) |
+		    p->eth[2 * UK_ETH_ADDR_LEN + 1];
+
+	switch (ethertype) {
+	case UK_ETHERTYPE_IP:
+		p->ip4 = (struct uk_iphdr *)(p->eth + UK_ETH_HDR_UNTAGGED_LEN);
+		p->ip6 = NULL;
+		if (p->ip4->ip_v != 4 || p->ip4->ip_hl != 5 ||
+		    p->ip4->ip_p != UK_IPPROTO_TCP ||
+		    gro_ntohs(p->ip4->ip_off) & (UK_IP_MF | UK_IP_OFFMASK))
+			return -1;
+		l3len = sizeof(struct uk_iphdr);
+		iplen = gro_ntohs(p->ip4->ip_len);
+		break;
+	case UK_ETHERTYPE_IPV6:
+		if (pkt->len < UK_ETH_HDR_UNTAGGED_LEN +
+			       sizeof(struct uk_ip6hdr))
+			return -1;
+		p->ip4 = NULL;
+		p->ip6 = (struct uk_ip6hdr *)(p->eth + UK_ETH_HDR_UNTAGGED_LEN);
+		if ((gro_ntohl(p->ip6->ip6_flow) >> 28) != 6 ||
+		    p->ip6->ip6_nxt != UK_IPPROTO_TCP)
+			return -1;
+		l3len = sizeof(struct uk_ip6hdr);
+		iplen = l3len + gro_ntohs(p->ip6->ip6_plen);
+		break;
+	default:
+		return -1;
+	}
+
+	if (pkt->len < UK_ETH_HDR_UNTAGGED_LEN + l3len +
+		       sizeof(struct uk_tcphdr))
+		return -1;
+	p->th = (struct uk_tcphdr *)(p->eth + UK_ETH_HDR_UNTAGGED_LEN + l3len);
+	p->thlen = p->th->th_off * 4;
+	p->hdr_len = UK_ETH_HDR_UNTAGGED_LEN + l3len + p->thlen;
+
+	/* Plain data segments only */
+	if (p->th->th_x2 || (p->th->th_flags & ~UK_TH_PUSH) != UK_TH_ACK)
+		return -1;
+
+	/* All headers have to be in the first netbuf. We also do not handle
+	 * Ethernet padding, which only small frames have anyway.
+	 */
+	UK_NETBUF_CHAIN_FOREACH(nb, pkt)
+		chain_len += nb->len;
+	if (p->thlen < sizeof(struct uk_tcphdr) || pkt->len < p->hdr_len ||
+	    iplen <= l3len + p->thlen ||
+	    chain_len != (__u32)UK_ETH_HDR_UNTAGGED_LEN + iplen)
+		return -1;
+
+	p->payload = iplen - l3len - p->thlen;
+	p->seq = gro_ntohl(p->th->th_seq);
+	return 0;
+}
+
+static int gro_same_flow(struct gro_flow *f, struct gro_pkt *p)
+{
+	struct gro_pkt *h = &f->head;
+
+	/* Compares MAC addresses and the ethertype */
+	if (memcmp(h->eth, p->eth, UK_ETH_HDR_UNTAGGED_LEN))
+		return 0;
+
+	if (h->ip4) {
+		if (h->ip4->ip_src != p->ip4->ip_src ||
+		    h->ip4->ip_dst != p->ip4->ip_dst ||
+		    h->ip4->ip_tos != p->ip4->ip_tos ||
+		    h->ip4->ip_ttl != p->ip4->ip_ttl)
+			return 0;
+	} else {
+		if (h->ip6->ip6_flow != p->ip6->ip6_flow ||
+		    h->ip6->ip6_hlim != p->ip6->ip6_hlim ||
+		    memcmp(h->ip6->ip6_src, p->ip6->ip6_src,
+			   sizeof(h->ip6->ip6_src)) ||
+		    memcmp(h->ip6->ip6_dst, p->ip6->ip6_dst,
+			   sizeof(h->ip6->ip6_dst)))
+			return 0;
+	}
+
+	return h->th->th_sport == p->th->th_sport &&
+	       h->th->th_dport == p->th->th_dport;
+}
+
+static int gro_can_merge(struct gro_flow *f, struct gro_pkt *p)
+{
+	struct gro_pkt *h = &f->head;
+
+	if (f->closed || p->seq != f->next_seq ||
+	    p->th->th_ack != h->th->th_ack || p->payload > f->mss)
+		return 0;
+
+	/* Options (e.g., timestamps) have to be identical */
+	if (p->thlen != h->thlen ||
+	    memcmp(h->th + 1, p->th + 1, h->thlen - sizeof(*h->th)))
+		return 0;
+
+	/* The IP length field has to cover the coalesced packet */
+	return (h->hdr_len - UK_ETH_HDR_UNTAGGED_LEN + f->payload + p->payload
+		<= UINT16_MAX);
+}
+
+static void gro_start(struct gro_flow *f, struct gro_pkt *p)
+{
+	f->head = *p;
+	f->tail = uk_netbuf_chain_last(p->pkt);
+	f->next_seq = p->seq + p->payload;
+	f->payload = p->payload;
+	f->mss = p->payload;
+	f->nb_segs = 1;
+	f->closed = !!(p->th->th_flags & UK_TH_PUSH);
+}
+
+static void gro_merge(struct gro_flow *f, struct gro_pkt *p)
+{
+	int rc __maybe_unused;
+
+	/* The coalesced packet carries the newest window and PSH */
+	f->head.th->th_win = p->th->th_win;
+	f->head.th->th_flags |= p->th->th_flags & UK_TH_PUSH;
+	if (p->payload < f->mss || (p->th->th_flags & UK_TH_PUSH))
+		f->closed = 1;
+
+	rc = uk_netbuf_header(p->pkt, -((int16_t)p->hdr_len));
+	UK_ASSERT(rc == 1);
+	uk_netbuf_connect(f->tail, p->pkt);
+	f->tail = uk_netbuf_chain_last(p->pkt);
+
+	f->next_seq += p->payload;
+	f->payload += p->payload;
+	f->nb_segs++;
+}
+
+static __u16 gro_ip4_csum(struct uk_iphdr *ip)
+{
+	__u16 *w = (__u16 *)ip;
+	__u32 sum = 0;
+	unsigned int i;
+
+	ip->ip_sum = 0;
+	for (i = 0; i < sizeof(*ip) / sizeof(*w); i++)
+		sum += w[i];
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return (__u16)~sum;
+}
+
+static void gro_finish(struct gro_flow *f)
+{
+	struct gro_pkt *h = &f->head;
+
+	if (f->nb_segs == 1)
+		return;
+
+	if (h->ip4) {
+		h->ip4->ip_len = gro_htons(sizeof(*h->ip4) + h->thlen +
+					   f->payload);
+		h->ip4->ip_sum = gro_ip4_csum(h->ip4);
+		h->pkt->flags |= UK_NETBUF_F_GSO_TCPV4;
+	} else {
+		h->ip6->ip6_plen = gro_htons(h->thlen + f->payload);
+		h->pkt->flags |= UK_NETBUF_F_GSO_TCPV6;
+	}
+	h->pkt->gso_size = f->mss;
+	h->pkt->header_len = h->hdr_len;
+}
+
+uint16_t uk_netdev_gro_burst(struct uk_netbuf **pkts, uint16_t cnt)
+{
+	struct gro_flow flows[GRO_MAX_FLOWS];
+	unsigned int nb_flows = 0;
+	struct gro_pkt p;
+	uint16_t i, out = 0;
+	unsigned int f;
+
+	UK_ASSERT(pkts || cnt == 0);
+
+	for (i = 0; i < cnt; i++) {
+		if (gro_parse(pkts[i], &p) < 0) {
+			pkts[out++] = pkts[i];
+			continue;
+		}
+
+		for (f = 0; f < nb_flows; f++)
+			if (gro_same_flow(&flows[f], &p))
+				break;
+
+		if (f < nb_flows) {
+			if (gro_can_merge(&flows[f], &p)) {
+				gro_merge(&flows[f], &p);
+				continue;
+			}
+
+			/* Continue the flow with this segment as head */
+			gro_finish(&flows[f]);
+			gro_start(&flows[f], &p);
+		} else if (nb_flows < ARRAY_SIZE(flows)) {
+			gro_start(&flows[nb_flows++], &p);
+		}
+		pkts[out++] = pkts[i];
+	}
+
+	for (f = 0; f < nb_flows; f++)
+		gro_finish(&flows[f]);
+
+	return out;
+}
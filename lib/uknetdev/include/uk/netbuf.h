@@ -125,10 +125,18 @@ typedef void (*uk_netbuf_dtor_t)(struct uk_netbuf *);
 
 /* Indicates the packet should be sent with the help of TCP Segmentation
  * Offloading. This requires that the device supports this.
+ * On receive, it indicates that the packet was coalesced from several TCP
+ * segments of `gso_size` bytes (see UK_NETDEV_F_LRO). The TCP checksum of
+ * such a packet is not valid anymore, so it always comes with
+ * UK_NETBUF_F_DATA_VALID or UK_NETBUF_F_PARTIAL_CSUM.
  */
 #define UK_NETBUF_F_GSO_TCPV4_BIT    2
 #define UK_NETBUF_F_GSO_TCPV4        (1 << UK_NETBUF_F_GSO_TCPV4_BIT)
 
+/* Same as UK_NETBUF_F_GSO_TCPV4 for TCP over IPv6 */
+#define UK_NETBUF_F_GSO_TCPV6_BIT    3
+#define UK_NETBUF_F_GSO_TCPV6        (1 << UK_NETBUF_F_GSO_TCPV6_BIT)
+
 struct uk_netbuf {
 	struct uk_netbuf *next;
 	struct uk_netbuf *prev;
@@ -583,7 +583,204 @@ static inline int uk_netdev_tx_one(struct uk_netdev *dev, uint16_t queue_id,
 }
 
 /**
- * Tests for status flags returned by `uk_netdev_rx_one` or `uk_netdev_tx_one`.
+ * Receive multiple packets with a single call and re-program used receive
+ * descriptors once for the whole batch. The same rules as for
+ * uk_netdev_rx_one() apply regarding queue interrupts and the receive buffer
+ * allocator. Drivers that do not provide a batched receive function are
+ * served by repeated calls to their single packet receive function.
+ *
+ * @param dev
+ *   The Unikraft Network Device.
+ * @param queue_id
+ *   The index of the receive queue to receive from.
+ *   The value must be in the range [0, nb_rx_queue - 1] previously supplied
+ *   to uk_netdev_configure().
+ * @param pkts
+ *   Array of netbuf pointers that is filled with the received packets.
+ *   `pkts` has never to be `NULL`.
+ * @param[inout] cnt
+ *   [IN] Number of elements in `pkts`, has to be greater than 0.
+ *   [OUT] Number of received packets.
+ * @return
+ *   - (>=0): Positive value with status flags
+ *     - UK_NETDEV_STATUS_SUCCESS: At least one packet was received.
+ *     - UK_NETDEV_STATUS_MORE: Indicates that more received packets are
+ *        available on the receive queue. When interrupts are used, they are
+ *        disabled until this flag is unset by a subsequent call.
+ *        This flag may only be set together with UK_NETDEV_STATUS_SUCCESS.
+ *     - UK_NETDEV_STATUS_UNDERRUN: Informs that some available slots of the
+ *        receive queue could not be programmed with a receive buffer.
+ *   - (<0): Negative value with error code from driver, no packet is returned.
+ */
+static inline int uk_netdev_rx_burst(struct uk_netdev *dev, uint16_t queue_id,
+				     struct uk_netbuf **pkts, uint16_t *cnt)
+{
+	uint16_t i;
+	int ret, st;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->rx_one);
+	UK_ASSERT(queue_id < CONFIG_LIBUKNETDEV_MAXNBQUEUES);
+	UK_ASSERT(dev->_data->state == UK_NETDEV_RUNNING);
+	UK_ASSERT(!PTRISERR(dev->_rx_queue[queue_id]));
+	UK_ASSERT(pkts);
+	UK_ASSERT(cnt && *cnt > 0);
+
+	if (dev->rx_burst) {
+		ret = dev->rx_burst(dev, dev->_rx_queue[queue_id], pkts, cnt);
+	} else {
+		ret = 0x0;
+		for (i = 0; i < *cnt; ++i) {
+			st = dev->rx_one(dev, dev->_rx_queue[queue_id],
+					 &pkts[i]);
+			if (unlikely(st < 0)) {
+				if (i == 0)
+					ret = st;
+				break;
+			}
+			ret = (ret & ~UK_NETDEV_STATUS_MORE) | st;
+			if (!(st & UK_NETDEV_STATUS_SUCCESS)
+			    || !(st & UK_NETDEV_STATUS_MORE)) {
+				i += (st & UK_NETDEV_STATUS_SUCCESS) ? 1 : 0;
+				break;
+			}
+		}
+		*cnt = i;
+	}
+
+#ifdef CONFIG_LIBUKNETDEV_STATS
+	if (ret >= 0 && (ret & UK_NETDEV_STATUS_SUCCESS)) {
+		struct uk_netbuf *nb;
+
+		ukarch_spin_lock(&dev->_stats_lock);
+		for (i = 0; i < *cnt; ++i) {
+			UK_NETBUF_CHAIN_FOREACH(nb, pkts[i])
+				dev->_stats.rx_m.bytes += nb->len;
+		}
+		dev->_stats.rx_m.packets += *cnt;
+		if (ret & UK_NETDEV_STATUS_UNDERRUN)
+			dev->_stats.rx_m.fifo++;
+		ukarch_spin_unlock(&dev->_stats_lock);
+		return ret;
+	}
+	if (ret >= 0 && (ret & UK_NETDEV_STATUS_UNDERRUN)) {
+		ukarch_spin_lock(&dev->_stats_lock);
+		dev->_stats.rx_m.fifo++;
+		ukarch_spin_unlock(&dev->_stats_lock);
+		return ret;
+	}
+	if (ret < 0) {
+		ukarch_spin_lock(&dev->_stats_lock);
+		dev->_stats.rx_m.errors++;
+		ukarch_spin_unlock(&dev->_stats_lock);
+		return ret;
+	}
+#endif /* CONFIG_LIBUKNETDEV_STATS */
+
+	return ret;
+}
+
+/**
+ * Transmit multiple packets with a single call. Drivers notify the device
+ * only once for the whole batch. Drivers that do not provide a batched
+ * transmit function are served by repeated calls to their single packet
+ * transmit function.
+ *
+ * @param dev
+ *   The Unikraft Network Device.
+ * @param queue_id
+ *   The index of the transmit queue to send to.
+ *   The value must be in the range [0, nb_tx_queue - 1] previously supplied
+ *   to uk_netdev_configure().
+ * @param pkts
+ *   Array of netbufs to send. Packets are free'd by the driver after sending
+ *   was successfully finished by the device. The same headroom requirements
+ *   as for uk_netdev_tx_one() apply. `pkts` has never to be `NULL`.
+ * @param[inout] cnt
+ *   [IN] Number of packets in `pkts`, has to be greater than 0.
+ *   [OUT] Number of packets that were put to the transmit queue. These are
+ *   always the first packets of `pkts`; the remaining ones stay owned by
+ *   the caller.
+ * @return
+ *   - (>=0): Positive value with status flags
+ *     - UK_NETDEV_STATUS_SUCCESS: At least one packet was put to the transmit
+ *        queue. Whenever this flag is not set, there was no space left on the
+ *        transmit queue.
+ *     - UK_NETDEV_STATUS_MORE: Indicates there is still at least one descriptor
+ *         available for a subsequent transmission. If the flag is unset means
+ *         that the transmit queue is full.
+ *         This flag may only be set together with UK_NETDEV_STATUS_SUCCESS.
+ *   - (<0): Negative value with error code from driver, no packet was sent.
+ */
+static inline int uk_netdev_tx_burst(struct uk_netdev *dev, uint16_t queue_id,
+				     struct uk_netbuf **pkts, uint16_t *cnt)
+{
+	uint16_t i;
+	int ret, st;
+
+	UK_ASSERT(dev);
+	UK_ASSERT(dev->tx_one);
+	UK_ASSERT(queue_id < CONFIG_LIBUKNETDEV_MAXNBQUEUES);
+	UK_ASSERT(dev->_data->state == UK_NETDEV_RUNNING);
+	UK_ASSERT(!PTRISERR(dev->_tx_queue[queue_id]));
+	UK_ASSERT(pkts);
+	UK_ASSERT(cnt && *cnt > 0);
+
+	if (dev->tx_burst) {
+		ret = dev->tx_burst(dev, dev->_tx_queue[queue_id], pkts, cnt);
+	} else {
+		ret = 0x0;
+		for (i = 0; i < *cnt; ++i) {
+			st = dev->tx_one(dev, dev->_tx_queue[queue_id],
+					 pkts[i]);
+			if (unlikely(st < 0)) {
+				if (i == 0)
+					ret = st;
+				break;
+			}
+			ret = (ret & ~UK_NETDEV_STATUS_MORE) | st;
+			if (!(st & UK_NETDEV_STATUS_SUCCESS)
+			    || !(st & UK_NETDEV_STATUS_MORE)) {
+				i += (st & UK_NETDEV_STATUS_SUCCESS) ? 1 : 0;
+				break;
+			}
+		}
+		*cnt = i;
+	}
+
+#ifdef CONFIG_LIBUKNETDEV_STATS
+	if (ret >= 0 && (ret & UK_NETDEV_STATUS_SUCCESS)) {
+		struct uk_netbuf *nb;
+
+		ukarch_spin_lock(&dev->_stats_lock);
+		for (i = 0; i < *cnt; ++i) {
+			UK_NETBUF_CHAIN_FOREACH(nb, pkts[i])
+				dev->_stats.tx_m.bytes += nb->len;
+		}
+		dev->_stats.tx_m.packets += *cnt;
+		ukarch_spin_unlock(&dev->_stats_lock);
+		return ret;
+	}
+	if (ret >= 0 && (ret & UK_NETDEV_STATUS_UNDERRUN)) {
+		ukarch_spin_lock(&dev->_stats_lock);
+		dev->_stats.tx_m.fifo++;
+		ukarch_spin_unlock(&dev->_stats_lock);
+		return ret;
+	}
+	if (ret < 0) {
+		ukarch_spin_lock(&dev->_stats_lock);
+		dev->_stats.tx_m.errors++;
+		ukarch_spin_unlock(&dev->_stats_lock);
+		return ret;
+	}
+#endif /* CONFIG_LIBUKNETDEV_STATS */
+
+	return ret;
+}
+
+/**
+ * Tests for status flags returned by `uk_netdev_rx_one`, `uk_netdev_tx_one`,
+ * `uk_netdev_rx_burst`, or `uk_netdev_tx_burst`.
  * When the functions returned an error code or one of the selected flags is
  * unset, this macro returns False.
  *
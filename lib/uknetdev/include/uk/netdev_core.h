@@ -147,6 +147,12 @@ struct uk_hwaddr {
 #define UK_NETDEV_F_TSO4_BIT		3
 #define UK_NETDEV_F_TSO4		(1UL << UK_NETDEV_F_TSO4_BIT)
 
+/* Indicates that the network device may deliver coalesced TCP packets,
+ * i.e., netbuf chains with UK_NETBUF_F_GSO_TCPV4 or UK_NETBUF_F_GSO_TCPV6 set.
+ */
+#define UK_NETDEV_F_LRO_BIT		4
+#define UK_NETDEV_F_LRO			(1UL << UK_NETDEV_F_LRO_BIT)
+
 #define uk_netdev_rxintr_supported(feature)	\
 	(feature & (UK_NETDEV_F_RXQ_INTR))
 #define uk_netdev_txintr_supported(feature)	\
@@ -155,6 +161,8 @@ struct uk_hwaddr {
 	(feature & (UK_NETDEV_F_PARTIAL_CSUM))
 #define uk_netdev_tso4_supported(feature) \
 	(feature & (UK_NETDEV_F_TSO4))
+#define uk_netdev_lro_supported(feature) \
+	(feature & (UK_NETDEV_F_LRO))
 /**
  * A structure used to describe network device capabilities.
  */
@@ -389,6 +397,26 @@ typedef int (*uk_netdev_tx_one_t)(struct uk_netdev *dev,
 				  struct uk_netdev_tx_queue *queue,
 				  struct uk_netbuf *pkt);
 
+/**
+ * Driver callback type to retrieve multiple packets from a RX queue.
+ * `cnt` provides the size of `pkts` and returns the number of received
+ * packets.
+ */
+typedef int (*uk_netdev_rx_burst_t)(struct uk_netdev *dev,
+				    struct uk_netdev_rx_queue *queue,
+				    struct uk_netbuf **pkts,
+				    __u16 *cnt);
+
+/**
+ * Driver callback type to submit multiple packets to a TX queue.
+ * `cnt` provides the number of packets in `pkts` and returns the number of
+ * packets that were put to the queue.
+ */
+typedef int (*uk_netdev_tx_burst_t)(struct uk_netdev *dev,
+				    struct uk_netdev_tx_queue *queue,
+				    struct uk_netbuf **pkts,
+				    __u16 *cnt);
+
 /**
  * A structure containing the functions exported by a driver.
  */
@@ -496,10 +524,10 @@ struct uk_netdev_stats {
  * NETDEV
  * A structure used to interact with a network device.
  *
- * Function callbacks (tx_one, rx_one, ops) are registered by the driver before
- * registering the netdev. They change during device life time. Packet RX/TX
- * functions are added directly to this structure for performance reasons.
- * It prevents another indirection to ops.
+ * Function callbacks (tx_one, rx_one, tx_burst, rx_burst, ops) are registered
+ * by the driver before registering the netdev. They change during device life
+ * time. Packet RX/TX functions are added directly to this structure for
+ * performance reasons. It prevents another indirection to ops.
  */
 struct uk_netdev {
 	/** Packet transmission. */
@@ -508,6 +536,12 @@ struct uk_netdev {
 	/** Packet reception. */
 	uk_netdev_rx_one_t          rx_one; /* by driver */
 
+	/** Batched packet transmission. */
+	uk_netdev_tx_burst_t        tx_burst; /* by driver, optional */
+
+	/** Batched packet reception. */
+	uk_netdev_rx_burst_t        rx_burst; /* by driver, optional */
+
 	/** Pointer to API-internal state data. */
 	struct uk_netdev_data       *_data;
 
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef __UK_NETDEV_GRO__
+#define __UK_NETDEV_GRO__
+
+#include <stdint.h>
+#include <uk/netbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Software generic receive offload (GRO)
+ *
+ * Coalesces consecutive TCP segments of the same flow within a burst of
+ * received packets (e.g., as returned by `uk_netdev_rx_burst()`), so that the
+ * network stack processes one large packet instead of many small ones.
+ * Coalesced packets are netbuf chains with UK_NETBUF_F_GSO_TCPV4 or
+ * UK_NETBUF_F_GSO_TCPV6 set, `gso_size` set to the size of the segments and
+ * `header_len` set to the size of the Ethernet, IP, and TCP headers. Their IP
+ * length field is updated, their TCP checksum is not.
+ *
+ * Only segments that the device marked with UK_NETBUF_F_DATA_VALID and that
+ * carry plain TCP data (ACK and optionally PSH set) without IP options or
+ * IPv6 extension headers are coalesced. All other packets are passed through
+ * unmodified.
+ *
+ * @param pkts
+ *   Array of received packets. The array is compacted in place; the relative
+ *   order of the packets of a flow is preserved.
+ * @param cnt
+ *   Number of packets in `pkts`
+ * @return
+ *   Number of packets remaining in `pkts`
+ */
+uint16_t uk_netdev_gro_burst(struct uk_netbuf **pkts, uint16_t cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_NETDEV_GRO__ */
@@ -99,6 +99,21 @@ struct uk_iphdr {
 #define	UK_IPPROTO_UDP		17		/* user datagram protocol */
 #define	UK_IPPROTO_IPV6		41		/* IP6 header */
 
+/*
+ * Definition for internet protocol version 6.
+ * RFC 2460
+ */
+struct uk_ip6hdr {
+	uint32_t	ip6_flow;		/* 4 bits version, 8 bits TC,
+						 * 20 bits flow-ID
+						 */
+	uint16_t	ip6_plen;		/* payload length */
+	uint8_t		ip6_nxt;		/* next header */
+	uint8_t		ip6_hlim;		/* hop limit */
+	uint8_t		ip6_src[16];		/* source address */
+	uint8_t		ip6_dst[16];		/* destination address */
+} __packed;
+
 /*
  * TCP header.
  * Per RFC 793, September, 1981.
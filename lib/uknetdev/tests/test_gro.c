@@ -0,0 +1,290 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/test.h>
+#include <uk/alloc.h>
+#include <uk/netbuf.h>
+#include <uk/netstructs.h>
+#include <uk/netdev_gro.h>
+
+#define SEG_LEN		1000
+#define BUF_LEN		2048
+#define TEST_SEQ	0x10000000U
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define be16(x)		__builtin_bswap16(x)
+#define be32(x)		__builtin_bswap32(x)
+#else /* __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ */
+#define be16(x)		(x)
+#define be32(x)		(x)
+#endif /* __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ */
+
+static const __u8 eth_dst[UK_ETH_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+static const __u8 eth_src[UK_ETH_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x02 };
+
+/* Builds an Ethernet frame with a TCP segment of `payload` bytes. Payload
+ * bytes are derived from the sequence number so that the coalesced stream
+ * can be verified.
+ */
+static struct uk_netbuf *tcp_pkt(int ipv6, __u16 sport, __u32 seq,
+				 __u16 payload, __u8 flags)
+{
+	struct uk_netbuf *nb;
+	struct uk_iphdr *ip4;
+	struct uk_ip6hdr *ip6;
+	struct uk_tcphdr *th;
+	__u8 *p, *data;
+	__u16 l3len;
+	__u16 i;
+
+	nb = uk_netbuf_alloc_buf(uk_alloc_get_default(), BUF_LEN, 8, 0, 0,
+				 NULL);
+	if (!nb)
+		return NULL;
+
+	p = nb->data;
+	memcpy(p, eth_dst, UK_ETH_ADDR_LEN);
+	memcpy(p + UK_ETH_ADDR_LEN, eth_src, UK_ETH_ADDR_LEN);
+	p += 2 * UK_ETH_ADDR_LEN;
+	*(__u16 *)p = be16(ipv6 ? UK_ETHERTYPE_IPV6 : UK_ETHERTYPE_IP);
+	p += 2;
+
+	if (ipv6) {
+		ip6 = (struct uk_ip6hdr *)p;
+		memset(ip6, 0, sizeof(*ip6));
+		ip6->ip6_flow = be32(6U << 28);
+		ip6->ip6_plen = be16(sizeof(*th) + payload);
+		ip6->ip6_nxt = UK_IPPROTO_TCP;
+		ip6->ip6_hlim = 64;
+		ip6->ip6_src[15] = 1;
+		ip6->ip6_dst[15] = 2;
+		l3len = sizeof(*ip6);
+	} else {
+		ip4 = (struct uk_iphdr *)p;
+		memset(ip4, 0, sizeof(*ip4));
+		ip4->ip_v = 4;
+		ip4->ip_hl = 5;
+		ip4->ip_len = be16(sizeof(*ip4) + sizeof(*th) + payload);
+		ip4->ip_off = be16(UK_IP_DF);
+		ip4->ip_ttl = 64;
+		ip4->ip_p = UK_IPPROTO_TCP;
+		ip4->ip_src = be32(0x0a000001);
+		ip4->ip_dst = be32(0x0a000002);
+		l3len = sizeof(*ip4);
+	}
+	p += l3len;
+
+	th = (struct uk_tcphdr *)p;
+	memset(th, 0, sizeof(*th));
+	th->th_sport = be16(sport);
+	th->th_dport = be16(80);
+	th->th_seq = be32(seq);
+	th->th_ack = be32(1);
+	th->th_off = sizeof(*th) / 4;
+	th->th_flags = flags;
+	th->th_win = be16(512);
+
+	data = (__u8 *)(th + 1);
+	for (i = 0; i < payload; i++)
+		data[i] = (__u8)(seq + i);
+
+	nb->len = UK_ETH_HDR_UNTAGGED_LEN + l3len + sizeof(*th) + payload;
+	nb->flags |= UK_NETBUF_F_DATA_VALID;
+	return nb;
+}
+
+static void free_pkts(struct uk_netbuf **pkts, __u16 cnt)
+{
+	__u16 i;
+
+	for (i = 0; i < cnt; i++)
+		uk_netbuf_free(pkts[i]);
+}
+
+/* Checks that the payload of a (coalesced) packet is the contiguous stream
+ * starting at `seq` and returns the number of errors found.
+ */
+static int check_stream(struct uk_netbuf *pkt, __u16 hdr_len, __u32 seq,
+			__u32 payload)
+{
+	struct uk_netbuf *nb;
+	__u32 off = 0, total = 0;
+	__u8 *data;
+	__u16 i, skip = hdr_len;
+	int err = 0;
+
+	UK_NETBUF_CHAIN_FOREACH(nb, pkt) {
+		data = (__u8 *)nb->data + skip;
+		for (i = 0; i < nb->len - skip; i++, off++)
+			err += (data[i] != (__u8)(seq + off));
+		total += nb->len - skip;
+		skip = 0;
+	}
+
+	return err + (total != payload);
+}
+
+UK_TESTCASE(uknetdev_gro, test_gro_coalesce_ipv4)
+{
+	struct uk_netbuf *pkts[4];
+	struct uk_iphdr *ip4;
+	struct uk_tcphdr *th;
+	__u16 hdr_len = UK_ETH_HDR_UNTAGGED_LEN + sizeof(*ip4) + sizeof(*th);
+	__u16 cnt, i;
+
+	for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+		pkts[i] = tcp_pkt(0, 1234, TEST_SEQ + i * SEG_LEN, SEG_LEN,
+				  UK_TH_ACK);
+		UK_TEST_ASSERT(pkts[i] != NULL);
+	}
+	pkts[3]->flags &= ~UK_NETBUF_F_DATA_VALID;
+
+	cnt = uk_netdev_gro_burst(pkts, ARRAY_SIZE(pkts));
+	UK_TEST_EXPECT_SNUM_EQ(cnt, 2);
+
+	ip4 = (struct uk_iphdr *)((__u8 *)pkts[0]->data +
+				  UK_ETH_HDR_UNTAGGED_LEN);
+	th = (struct uk_tcphdr *)(ip4 + 1);
+	UK_TEST_EXPECT(pkts[0]->flags & UK_NETBUF_F_GSO_TCPV4);
+	UK_TEST_EXPECT_SNUM_EQ(pkts[0]->gso_size, SEG_LEN);
+	UK_TEST_EXPECT_SNUM_EQ(pkts[0]->header_len, hdr_len);
+	UK_TEST_EXPECT_SNUM_EQ(be16(ip4->ip_len),
+			       sizeof(*ip4) + sizeof(*th) + 3 * SEG_LEN);
+	UK_TEST_EXPECT_SNUM_EQ(be32(th->th_seq), TEST_SEQ);
+	UK_TEST_EXPECT_ZERO(check_stream(pkts[0], hdr_len, TEST_SEQ,
+					 3 * SEG_LEN));
+
+	/* The packet without a validated checksum is passed through */
+	UK_TEST_EXPECT(!(pkts[1]->flags & UK_NETBUF_F_GSO_TCPV4));
+	UK_TEST_EXPECT_SNUM_EQ(be32(((struct uk_tcphdr *)
+				     ((__u8 *)pkts[1]->data + hdr_len -
+				      sizeof(*th)))->th_seq),
+			       TEST_SEQ + 3 * SEG_LEN);
+
+	free_pkts(pkts, cnt);
+}
+
+UK_TESTCASE(uknetdev_gro, test_gro_interleaved_flows)
+{
+	struct uk_netbuf *pkts[6];
+	__u16 hdr_len = UK_ETH_HDR_UNTAGGED_LEN + sizeof(struct uk_iphdr) +
+			sizeof(struct uk_tcphdr);
+	__u16 cnt, i;
+
+	/* Segments of two flows alternate within the burst */
+	for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+		pkts[i] = tcp_pkt(0, 1000 + (i % 2),
+				  TEST_SEQ + (i / 2) * SEG_LEN, SEG_LEN,
+				  UK_TH_ACK);
+		UK_TEST_ASSERT(pkts[i] != NULL);
+	}
+
+	cnt = uk_netdev_gro_burst(pkts, ARRAY_SIZE(pkts));
+	UK_TEST_EXPECT_SNUM_EQ(cnt, 2);
+	for (i = 0; i < cnt; i++)
+		UK_TEST_EXPECT_ZERO(check_stream(pkts[i], hdr_len, TEST_SEQ,
+						 3 * SEG_LEN));
+
+	free_pkts(pkts, cnt);
+}
+
+UK_TESTCASE(uknetdev_gro, test_gro_no_coalesce)
+{
+	struct uk_netbuf *pkts[6];
+	__u16 cnt, i;
+
+	/* A short segment ends the coalesced packet */
+	pkts[0] = tcp_pkt(0, 1234, TEST_SEQ, SEG_LEN, UK_TH_ACK);
+	pkts[1] = tcp_pkt(0, 1234, TEST_SEQ + SEG_LEN, SEG_LEN / 2,
+			  UK_TH_ACK);
+	pkts[2] = tcp_pkt(0, 1234, TEST_SEQ + SEG_LEN + SEG_LEN / 2, SEG_LEN,
+			  UK_TH_ACK);
+	/* Sequence gap */
+	pkts[3] = tcp_pkt(0, 1234, TEST_SEQ + 4 * SEG_LEN, SEG_LEN,
+			  UK_TH_ACK);
+	/* Control segments are never coalesced */
+	pkts[4] = tcp_pkt(0, 4321, TEST_SEQ, 0, UK_TH_ACK);
+	pkts[5] = tcp_pkt(0, 4321, TEST_SEQ, SEG_LEN, UK_TH_ACK | UK_TH_FIN);
+	for (cnt = 0; cnt < ARRAY_SIZE(pkts); cnt++)
+		UK_TEST_ASSERT(pkts[cnt] != NULL);
+
+	cnt = uk_netdev_gro_burst(pkts, ARRAY_SIZE(pkts));
+	UK_TEST_EXPECT_SNUM_EQ(cnt, 5);
+	UK_TEST_EXPECT_NOT_NULL(pkts[0]->next);
+	for (i = 1; i < cnt; i++)
+		UK_TEST_EXPECT_NULL(pkts[i]->next);
+
+	free_pkts(pkts, cnt);
+}
+
+UK_TESTCASE(uknetdev_gro, test_gro_push_closes_flow)
+{
+	struct uk_netbuf *pkts[4];
+	struct uk_tcphdr *th;
+	__u16 hdr_len = UK_ETH_HDR_UNTAGGED_LEN + sizeof(struct uk_iphdr) +
+			sizeof(struct uk_tcphdr);
+	__u16 cnt;
+
+	pkts[0] = tcp_pkt(0, 1234, TEST_SEQ, SEG_LEN, UK_TH_ACK);
+	pkts[1] = tcp_pkt(0, 1234, TEST_SEQ + SEG_LEN, SEG_LEN,
+			  UK_TH_ACK | UK_TH_PUSH);
+	pkts[2] = tcp_pkt(0, 1234, TEST_SEQ + 2 * SEG_LEN, SEG_LEN,
+			  UK_TH_ACK);
+	pkts[3] = tcp_pkt(0, 1234, TEST_SEQ + 3 * SEG_LEN, SEG_LEN,
+			  UK_TH_ACK);
+	for (cnt = 0; cnt < ARRAY_SIZE(pkts); cnt++)
+		UK_TEST_ASSERT(pkts[cnt] != NULL);
+
+	cnt = uk_netdev_gro_burst(pkts, ARRAY_SIZE(pkts));
+	UK_TEST_EXPECT_SNUM_EQ(cnt, 2);
+
+	/* PSH is carried by the coalesced packet that ends with it */
+	th = (struct uk_tcphdr *)((__u8 *)pkts[0]->data + hdr_len -
+				  sizeof(*th));
+	UK_TEST_EXPECT(th->th_flags & UK_TH_PUSH);
+	UK_TEST_EXPECT_ZERO(check_stream(pkts[0], hdr_len, TEST_SEQ,
+					 2 * SEG_LEN));
+	th = (struct uk_tcphdr *)((__u8 *)pkts[1]->data + hdr_len -
+				  sizeof(*th));
+	UK_TEST_EXPECT(!(th->th_flags & UK_TH_PUSH));
+	UK_TEST_EXPECT_ZERO(check_stream(pkts[1], hdr_len,
+					 TEST_SEQ + 2 * SEG_LEN,
+					 2 * SEG_LEN));
+
+	free_pkts(pkts, cnt);
+}
+
+UK_TESTCASE(uknetdev_gro, test_gro_coalesce_ipv6)
+{
+	struct uk_netbuf *pkts[3];
+	struct uk_ip6hdr *ip6;
+	__u16 hdr_len = UK_ETH_HDR_UNTAGGED_LEN + sizeof(*ip6) +
+			sizeof(struct uk_tcphdr);
+	__u16 cnt;
+
+	for (cnt = 0; cnt < ARRAY_SIZE(pkts); cnt++) {
+		pkts[cnt] = tcp_pkt(1, 1234, TEST_SEQ + cnt * SEG_LEN, SEG_LEN,
+				    UK_TH_ACK);
+		UK_TEST_ASSERT(pkts[cnt] != NULL);
+	}
+
+	cnt = uk_netdev_gro_burst(pkts, ARRAY_SIZE(pkts));
+	UK_TEST_EXPECT_SNUM_EQ(cnt, 1);
+
+	ip6 = (struct uk_ip6hdr *)((__u8 *)pkts[0]->data +
+				   UK_ETH_HDR_UNTAGGED_LEN);
+	UK_TEST_EXPECT(pkts[0]->flags & UK_NETBUF_F_GSO_TCPV6);
+	UK_TEST_EXPECT_SNUM_EQ(pkts[0]->gso_size, SEG_LEN);
+	UK_TEST_EXPECT_SNUM_EQ(be16(ip6->ip6_plen),
+			       sizeof(struct uk_tcphdr) + 3 * SEG_LEN);
+	UK_TEST_EXPECT_ZERO(check_stream(pkts[0], hdr_len, TEST_SEQ,
+					 3 * SEG_LEN));
+
+	free_pkts(pkts, cnt);
+}
+
+uk_testsuite_register(uknetdev_gro, NULL);
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <errno.h>
+#include <uk/arch/time.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/intctlr.h>
+#include <uk/plat/lcpu.h>
+#include <uk/plat/time.h>
+#include <uk/print.h>
+#include <x86/cpu.h>
+#include "prof.h"
+#include "source.h"
+
+/* Time over which the frequency of the sample clock is measured */
+#define UKPROF_CALIBRATE_NSEC	ukarch_time_msec_to_nsec(10)
+
+unsigned int ukprof_irq;
+__u32 ukprof_period;
+
+#if CONFIG_LIBUKPROF_SOURCE_TIMER
+/* Returns the frequency of the APIC timer with the divider we use */
+static __u64 ukprof_clock_hz(void)
+{
+	unsigned long flags;
+	__nsec start, now;
+	__u32 lo, hi;
+
+	flags = ukplat_lcpu_save_irqf();
+	wrmsr(APIC_MSR_LVT_TIMER, APIC_LVT_MASKED, 0);
+	wrmsr(APIC_MSR_TIMER_DCR, APIC_TIMER_DCR_DIV16, 0);
+	start = ukplat_monotonic_clock();
+	wrmsr(APIC_MSR_TIMER_IC, ~0U, 0);
+	do
+		now = ukplat_monotonic_clock();
+	while (now - start < UKPROF_CALIBRATE_NSEC);
+	rdmsr(APIC_MSR_TIMER_CC, &lo, &hi);
+	wrmsr(APIC_MSR_TIMER_IC, 0, 0);
+	ukplat_lcpu_restore_irqf(flags);
+
+	return (__u64)(~0U - lo) * UKARCH_NSEC_PER_SEC / (now - start);
+}
+
+/* The interrupt controller also acknowledges IRQs up to 16 at the PIC, which
+ * does not deliver ours, so we skip over them
+ */
+#define UKPROF_IRQ_MIN		17
+
+static int ukprof_source_init(void)
+{
+	unsigned int irqs[UKPROF_IRQ_MIN + 1];
+	unsigned int i, n;
+	int rc;
+
+	/* The IRQs are held until we are done, so they are distinct and the
+	 * last one possible is UKPROF_IRQ_MIN or above
+	 */
+	for (n = 0; n < ARRAY_SIZE(irqs); n++) {
+		rc = uk_intctlr_irq_alloc(&irqs[n], 1);
+		if (unlikely(rc) || irqs[n] >= UKPROF_IRQ_MIN)
+			break;
+	}
+	UK_ASSERT(n < ARRAY_SIZE(irqs));
+
+	for (i = 0; i < n; i++)
+		uk_intctlr_irq_free(&irqs[i], 1);
+
+	if (unlikely(rc)) {
+		uk_pr_err("Could not allocate profiling interrupt: %d\n", rc);
+		return rc;
+	}
+
+	ukprof_irq = irqs[n];
+	return 0;
+}
+
+void ukprof_arch_start_lcpu(void)
+{
+	wrmsr(APIC_MSR_TIMER_DCR, APIC_TIMER_DCR_DIV16, 0);
+	wrmsr(APIC_MSR_LVT_TIMER,
+	      APIC_LVT_TIMER_PERIODIC | (32 + ukprof_irq), 0);
+	wrmsr(APIC_MSR_TIMER_IC, ukprof_period, 0);
+}
+
+void ukprof_arch_stop_lcpu(void)
+{
+	wrmsr(APIC_MSR_LVT_TIMER, APIC_LVT_MASKED, 0);
+	wrmsr(APIC_MSR_TIMER_IC, 0, 0);
+}
+#endif /* CONFIG_LIBUKPROF_SOURCE_TIMER */
+
+#if CONFIG_LIBUKPROF_SOURCE_PMU
+/* Returns the frequency of the time stamp counter, which we take as the
+ * frequency of unhalted core cycles
+ */
+static __u64 ukprof_clock_hz(void)
+{
+	unsigned long flags;
+	__nsec start, now;
+	__u64 tsc;
+
+	flags = ukplat_lcpu_save_irqf();
+	start = ukplat_monotonic_clock();
+	tsc = rdtsc();
+	do
+		now = ukplat_monotonic_clock();
+	while (now - start < UKPROF_CALIBRATE_NSEC);
+	tsc = rdtsc() - tsc;
+	ukplat_lcpu_restore_irqf(flags);
+
+	return tsc * UKARCH_NSEC_PER_SEC / (now - start);
+}
+
+static int ukprof_source_init(void)
+{
+	__u32 eax, ebx, ecx, edx;
+
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	if (eax < X86_CPUID_PMU)
+		return -ENOTSUP;
+
+	/* We need version 2 for the global control and status registers and
+	 * the unhalted core cycles event, which is available if its bit in
+	 * EBX is clear.
+	 */
+	cpuid(X86_CPUID_PMU, 0, &eax, &ebx, &ecx, &edx);
+	if ((eax & 0xff) < 2 || ((eax >> 8) & 0xff) < 1 ||
+	    ((eax >> 24) & 0xff) < 1 || (ebx & 0x1)) {
+		uk_pr_err("No architectural performance counters\n");
+		return -ENOTSUP;
+	}
+
+	return 0;
+}
+
+void ukprof_arch_start_lcpu(void)
+{
+	wrmsrl(X86_MSR_PERFEVTSEL0, 0);
+	ukprof_pmc_reload();
+	wrmsr(APIC_MSR_LVT_PERF, APIC_ICR_DMODE_NMI, 0);
+	wrmsrl(X86_MSR_PERFEVTSEL0, X86_PERFEVTSEL_CORE_CYCLES |
+				    X86_PERFEVTSEL_USR | X86_PERFEVTSEL_OS |
+				    X86_PERFEVTSEL_INT | X86_PERFEVTSEL_EN);
+	wrmsrl(X86_MSR_PERF_GLOBAL_CTRL,
+	       rdmsrl(X86_MSR_PERF_GLOBAL_CTRL) | 0x1);
+}
+
+void ukprof_arch_stop_lcpu(void)
+{
+	wrmsrl(X86_MSR_PERF_GLOBAL_CTRL,
+	       rdmsrl(X86_MSR_PERF_GLOBAL_CTRL) & ~0x1ULL);
+	wrmsrl(X86_MSR_PERFEVTSEL0, 0);
+	wrmsr(APIC_MSR_LVT_PERF, APIC_LVT_MASKED | APIC_ICR_DMODE_NMI, 0);
+	wrmsrl(X86_MSR_PERF_GLOBAL_OVF_CTRL, 0x1);
+}
+#endif /* CONFIG_LIBUKPROF_SOURCE_PMU */
+
+int ukprof_arch_init(void)
+{
+	__u64 hz, period;
+	int rc;
+
+	rc = ukprof_source_init();
+	if (unlikely(rc))
+		return rc;
+
+	hz = ukprof_clock_hz();
+	period = hz / CONFIG_LIBUKPROF_FREQ;
+	if (unlikely(!period || period > (1UL << 31) - 1)) {
+		uk_pr_err("Cannot sample at %d Hz with a %"__PRIu64" Hz clock\n",
+			  CONFIG_LIBUKPROF_FREQ, hz);
+		return -ENOTSUP;
+	}
+
+	ukprof_period = period;
+	uk_pr_info("Sampling every %"__PRIu64" ticks of a %"__PRIu64" Hz clock\n",
+		   period, hz);
+	return 0;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UKPROF_X86_64_SOURCE_H__
+#define __UKPROF_X86_64_SOURCE_H__
+
+#include <uk/config.h>
+#include <uk/intctlr/apic.h>
+
+/* Local vector table entries */
+#define APIC_LVT_MASKED			(1 << 16)
+#define APIC_LVT_TIMER_PERIODIC		(1 << 17)
+
+/* Divide configuration register: divide by 16 */
+#define APIC_TIMER_DCR_DIV16		0x3
+
+/* Architectural performance monitoring */
+#define X86_CPUID_PMU			0x0a
+#define X86_MSR_PMC0			0x0c1
+#define X86_MSR_PERFEVTSEL0		0x186
+#define X86_MSR_PERF_GLOBAL_STATUS	0x38e
+#define X86_MSR_PERF_GLOBAL_CTRL	0x38f
+#define X86_MSR_PERF_GLOBAL_OVF_CTRL	0x390
+
+#define X86_PERFEVTSEL_USR		(1 << 16)
+#define X86_PERFEVTSEL_OS		(1 << 17)
+#define X86_PERFEVTSEL_INT		(1 << 20)
+#define X86_PERFEVTSEL_EN		(1 << 22)
+/* Architectural event "UnHalted Core Cycles" */
+#define X86_PERFEVTSEL_CORE_CYCLES	0x003c
+
+/* Vector of the APIC timer interrupt, as IRQ number of uk_intctlr */
+extern unsigned int ukprof_irq;
+/* APIC timer ticks or core cycles between two samples */
+extern __u32 ukprof_period;
+
+/* Loads the counter such that it overflows after `ukprof_period` cycles.
+ * Writes to the legacy counter MSR are sign-extended from bit 31.
+ */
+static inline void ukprof_pmc_reload(void)
+{
+	wrmsr(X86_MSR_PMC0, -ukprof_period, 0);
+}
+
+#endif /* __UKPROF_X86_64_SOURCE_H__ */
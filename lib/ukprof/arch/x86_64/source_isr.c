@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <uk/arch/limits.h>
+#include <uk/arch/traps.h>
+#include <uk/essentials.h>
+#include <uk/event.h>
+#include <uk/intctlr.h>
+#include <uk/nofault.h>
+#include <x86/cpu.h>
+#include "prof.h"
+#include "source.h"
+
+/* Frame pointers of the interrupted code are only followed upwards and
+ * within one stack size from the interrupted stack pointer. Code that uses
+ * RBP as a general purpose register thus ends the walk instead of sending it
+ * to arbitrary memory. The range may still reach past the end of the stack
+ * into unmapped memory, so frames are read without faulting.
+ */
+__sz ukprof_arch_unwind(struct __regs *regs, __uptr *pc, __sz max)
+{
+	__sz depth = 0;
+#if !__OMIT_FRAMEPOINTER__
+	__uptr low = regs->rsp;
+	__uptr high = regs->rsp + __STACK_SIZE;
+	__uptr frame[2];
+	__uptr fp;
+#endif /* !__OMIT_FRAMEPOINTER__ */
+
+	pc[depth++] = regs->rip;
+
+#if !__OMIT_FRAMEPOINTER__
+	fp = regs->rbp;
+	while (depth < max) {
+		if (fp < low || fp > high - 2 * sizeof(__uptr) ||
+		    !IS_ALIGNED(fp, sizeof(__uptr)))
+			break;
+
+		/* frame[0] is the frame pointer of the caller, frame[1] the
+		 * return address into it
+		 */
+		if (uk_nofault_memcpy((char *)frame, (const char *)fp,
+				      sizeof(frame), UK_NOFAULTF_NOPAGING) !=
+		    sizeof(frame))
+			break;
+		if (!frame[1])
+			break;
+		pc[depth++] = frame[1];
+
+		low = fp + 2 * sizeof(__uptr);
+		fp = frame[0];
+	}
+#endif /* !__OMIT_FRAMEPOINTER__ */
+
+	return depth;
+}
+
+#if CONFIG_LIBUKPROF_SOURCE_TIMER
+static int ukprof_timer_handler(void *data)
+{
+	struct uk_intctlr_event_irq_data *ctx = data;
+
+	if (!ukprof_irq || ctx->irq != ukprof_irq)
+		return UK_EVENT_NOT_HANDLED;
+
+	/* The interrupt controller driver acknowledges the interrupt */
+	ukprof_sample(ctx->regs);
+	return UK_EVENT_HANDLED;
+}
+
+UK_EVENT_HANDLER(UK_INTCTLR_EVENT_IRQ, ukprof_timer_handler);
+#endif /* CONFIG_LIBUKPROF_SOURCE_TIMER */
+
+#if CONFIG_LIBUKPROF_SOURCE_PMU
+static int ukprof_pmu_handler(void *data)
+{
+	struct ukarch_trap_ctx *ctx = data;
+
+	/* NMIs have other sources as well */
+	if (!(rdmsrl(X86_MSR_PERF_GLOBAL_STATUS) & 0x1))
+		return UK_EVENT_NOT_HANDLED;
+
+	ukprof_pmc_reload();
+	wrmsrl(X86_MSR_PERF_GLOBAL_OVF_CTRL, 0x1);
+	ukprof_sample(ctx->regs);
+
+	/* The local APIC masks the entry when it delivers the interrupt */
+	wrmsr(APIC_MSR_LVT_PERF, APIC_ICR_DMODE_NMI, 0);
+	return UK_EVENT_HANDLED;
+}
+
+UK_EVENT_HANDLER(UKARCH_TRAP_NMI, ukprof_pmu_handler);
+#endif /* CONFIG_LIBUKPROF_SOURCE_PMU */
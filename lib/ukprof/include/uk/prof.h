@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UK_PROF_H__
+#define __UK_PROF_H__
+
+#include <uk/arch/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sampling profiler
+ *
+ * While profiling, every LCPU is interrupted CONFIG_LIBUKPROF_FREQ times per
+ * second. Each interrupt records the interrupted instruction pointer and the
+ * return addresses found by walking the frame-pointer chain of the
+ * interrupted code. Identical stacks are counted in a table per LCPU.
+ *
+ * The profile is exported in folded-stack format: one line per distinct
+ * stack, with the frames from the outermost caller to the sampled
+ * instruction as hexadecimal addresses separated by `;`, followed by a space
+ * and the number of samples. support/scripts/ukprof/ukprof.py symbolizes
+ * the addresses with the debug image for use with flamegraph tools.
+ */
+
+struct ukprof_stats {
+	/* Samples taken */
+	__u64 samples;
+	/* Samples that did not fit into the stack table of their LCPU */
+	__u64 dropped;
+	/* Distinct stacks in the stack tables */
+	__u64 stacks;
+};
+
+/**
+ * Starts profiling on all LCPUs. Samples of a previous profile are
+ * discarded.
+ *
+ * @return
+ *   0 on success, -EBUSY if profiling is already running, -ENOTSUP if the
+ *   configured sample source is not available, -ENOMEM if the stack tables
+ *   could not be allocated
+ */
+int ukprof_start(void);
+
+/**
+ * Stops profiling on all LCPUs. The profile is kept until profiling is
+ * started again.
+ *
+ * @return
+ *   0 on success, -EINVAL if profiling is not running
+ */
+int ukprof_stop(void);
+
+/**
+ * Returns statistics of the current or last profile, summed over all LCPUs
+ */
+void ukprof_stats(struct ukprof_stats *stats);
+
+/**
+ * Function that receives the output of ukprof_dump()
+ *
+ * @param cookie
+ *   Argument that was passed to ukprof_dump()
+ * @param buf
+ *   Next line of the profile, including the newline character
+ * @param len
+ *   Length of `buf` in bytes
+ * @return
+ *   0 on success, a negative errno value to abort the dump
+ */
+typedef int (*ukprof_dump_func_t)(void *cookie, const char *buf, __sz len);
+
+/**
+ * Writes the profile in folded-stack format. Profiling must be stopped.
+ *
+ * @param func
+ *   Function that writes the profile, called once per line
+ * @param cookie
+ *   Argument for `func`
+ * @return
+ *   0 on success, -EBUSY if profiling is running, the return value of `func`
+ *   if it fails
+ */
+int ukprof_dump(ukprof_dump_func_t func, void *cookie);
+
+/**
+ * Writes the profile in folded-stack format to the output that is
+ * configured with CONFIG_LIBUKPROF_OUTPUT (console or file). Profiling must
+ * be stopped.
+ *
+ * @return
+ *   0 on success, a negative errno value otherwise
+ */
+int ukprof_dump_output(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_PROF_H__ */
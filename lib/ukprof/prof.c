@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <uk/alloc.h>
+#include <uk/assert.h>
+#include <uk/atomic.h>
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <uk/init.h>
+#include <uk/plat/console.h>
+#include <uk/print.h>
+#include <uk/prof.h>
+#include "prof.h"
+
+#if CONFIG_LIBUKPROF_OUTPUT_FILE
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* CONFIG_LIBUKPROF_OUTPUT_FILE */
+
+#define UKPROF_CONSOLE_BEGIN	"UKPROF_FOLDED_BEGIN\n"
+#define UKPROF_CONSOLE_END	"UKPROF_FOLDED_END\n"
+
+/* "0x" and 16 hex digits plus ';' per frame, the count and the newline */
+#define UKPROF_LINE_MAX		(UKPROF_MAX_DEPTH * 19 + 16)
+
+UKPLAT_PER_LCPU_DEFINE(struct ukprof_lcpu, ukprof_lcpus);
+int ukprof_running;
+
+static int ukprof_initialized;
+
+static void ukprof_lcpu_start(struct __regs *regs __unused, void *arg __unused)
+{
+	ukprof_arch_start_lcpu();
+}
+
+static void ukprof_lcpu_stop(struct __regs *regs __unused, void *arg __unused)
+{
+	ukprof_arch_stop_lcpu();
+}
+
+#ifdef CONFIG_HAVE_SMP
+/* Runs `fn` on all other LCPUs that are online. LCPUs that come online
+ * later are not sampled.
+ */
+static void ukprof_run_others(void (*fn)(struct __regs *, void *))
+{
+	struct ukplat_lcpu_func f = { .fn = fn, .user = __NULL };
+	int rc;
+
+	rc = ukplat_lcpu_run(__NULL, __NULL, &f, 0);
+	if (unlikely(rc))
+		uk_pr_warn("Could not reach all LCPUs: %d\n", rc);
+}
+#else /* !CONFIG_HAVE_SMP */
+#define ukprof_run_others(fn) do { (void)(fn); } while (0)
+#endif /* !CONFIG_HAVE_SMP */
+
+int ukprof_start(void)
+{
+	struct uk_alloc *a = uk_alloc_get_default();
+	struct ukprof_lcpu *pl;
+	__u32 i;
+	int rc;
+
+	if (UK_READ_ONCE(ukprof_running))
+		return -EBUSY;
+
+	if (!ukprof_initialized) {
+		rc = ukprof_arch_init();
+		if (unlikely(rc))
+			return rc;
+		ukprof_initialized = 1;
+	}
+
+	for (i = 0; i < ukplat_lcpu_count(); i++) {
+		pl = &ukplat_per_lcpu(ukprof_lcpus, i);
+		if (!pl->stacks) {
+			UK_ASSERT(a);
+			pl->stacks = uk_calloc(a, UKPROF_NR_STACKS,
+					       sizeof(*pl->stacks));
+			if (unlikely(!pl->stacks))
+				return -ENOMEM;
+		} else {
+			memset(pl->stacks, 0,
+			       UKPROF_NR_STACKS * sizeof(*pl->stacks));
+		}
+		pl->samples = 0;
+		pl->dropped = 0;
+	}
+
+	UK_WRITE_ONCE(ukprof_running, 1);
+	mb();
+
+	ukprof_arch_start_lcpu();
+	ukprof_run_others(ukprof_lcpu_start);
+	return 0;
+}
+
+int ukprof_stop(void)
+{
+	__u32 i;
+
+	if (!UK_READ_ONCE(ukprof_running))
+		return -EINVAL;
+
+	ukprof_arch_stop_lcpu();
+	ukprof_run_others(ukprof_lcpu_stop);
+
+	/* Samples that are still taken on other LCPUs see that profiling
+	 * stopped. Wait for the ones that are already past this check, so that
+	 * the stack tables do not change anymore.
+	 */
+	UK_WRITE_ONCE(ukprof_running, 0);
+	mb();
+	for (i = 0; i < ukplat_lcpu_count(); i++)
+		while (UK_READ_ONCE(ukplat_per_lcpu(ukprof_lcpus, i).busy))
+			ukarch_spinwait();
+
+	return 0;
+}
+
+void ukprof_stats(struct ukprof_stats *stats)
+{
+	struct ukprof_lcpu *pl;
+	__u32 i;
+	__sz j;
+
+	UK_ASSERT(stats);
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < ukplat_lcpu_count(); i++) {
+		pl = &ukplat_per_lcpu(ukprof_lcpus, i);
+		if (!pl->stacks)
+			continue;
+
+		stats->samples += UK_READ_ONCE(pl->samples);
+		stats->dropped += UK_READ_ONCE(pl->dropped);
+		for (j = 0; j < UKPROF_NR_STACKS; j++)
+			stats->stacks += !!UK_READ_ONCE(pl->stacks[j].count);
+	}
+}
+
+/* Folded stacks list the outermost caller first */
+static int ukprof_format(const struct ukprof_stack *s, char *buf, __sz len)
+{
+	int pos = 0;
+	__sz i;
+
+	for (i = s->depth; i > 0; i--)
+		pos += snprintf(buf + pos, len - pos, "%s0x%"__PRIuptr,
+				i == s->depth ? "" : ";", s->pc[i - 1]);
+	pos += snprintf(buf + pos, len - pos, " %"__PRIu32"\n", s->count);
+
+	UK_ASSERT((__sz)pos < len);
+	return pos;
+}
+
+int ukprof_dump(ukprof_dump_func_t func, void *cookie)
+{
+	char line[UKPROF_LINE_MAX];
+	struct ukprof_lcpu *pl;
+	__u32 i;
+	__sz j;
+	int rc;
+
+	UK_ASSERT(func);
+
+	if (UK_READ_ONCE(ukprof_running))
+		return -EBUSY;
+
+	for (i = 0; i < ukplat_lcpu_count(); i++) {
+		pl = &ukplat_per_lcpu(ukprof_lcpus, i);
+		if (!pl->stacks)
+			continue;
+
+		for (j = 0; j < UKPROF_NR_STACKS; j++) {
+			if (!pl->stacks[j].count)
+				continue;
+
+			rc = func(cookie, line,
+				  ukprof_format(&pl->stacks[j], line,
+						sizeof(line)));
+			if (unlikely(rc))
+				return rc;
+		}
+	}
+
+	return 0;
+}
+
+#if CONFIG_LIBUKPROF_OUTPUT_CONSOLE
+static int ukprof_dump_console(void *cookie __unused, const char *buf,
+			       __sz len)
+{
+	int rc;
+
+	while (len) {
+		rc = ukplat_coutk(buf, len);
+		if (unlikely(rc < 0))
+			return rc;
+		buf += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+int ukprof_dump_output(void)
+{
+	int rc;
+
+	rc = ukprof_dump_console(__NULL, UKPROF_CONSOLE_BEGIN,
+				 sizeof(UKPROF_CONSOLE_BEGIN) - 1);
+	if (unlikely(rc))
+		return rc;
+
+	rc = ukprof_dump(ukprof_dump_console, __NULL);
+	if (unlikely(rc))
+		return rc;
+
+	return ukprof_dump_console(__NULL, UKPROF_CONSOLE_END,
+				   sizeof(UKPROF_CONSOLE_END) - 1);
+}
+#endif /* CONFIG_LIBUKPROF_OUTPUT_CONSOLE */
+
+#if CONFIG_LIBUKPROF_OUTPUT_FILE
+static int ukprof_dump_file(void *cookie, const char *buf, __sz len)
+{
+	int fd = *(int *)cookie;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, buf, len);
+		if (unlikely(rc < 0))
+			return -errno;
+		buf += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+int ukprof_dump_output(void)
+{
+	int fd;
+	int rc;
+
+	fd = open(CONFIG_LIBUKPROF_OUTPUT_FILENAME,
+		  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (unlikely(fd < 0))
+		return -errno;
+
+	rc = ukprof_dump(ukprof_dump_file, &fd);
+	if (unlikely(close(fd) && !rc))
+		rc = -errno;
+
+	return rc;
+}
+#endif /* CONFIG_LIBUKPROF_OUTPUT_FILE */
+
+#if CONFIG_LIBUKPROF_AUTOSTART
+static int ukprof_autostart(struct uk_init_ctx *ictx __unused)
+{
+	int rc;
+
+	rc = ukprof_start();
+	if (unlikely(rc))
+		uk_pr_err("Could not start profiling: %d\n", rc);
+
+	/* Failing to profile should not keep the application from running */
+	return 0;
+}
+
+static void ukprof_autostop(const struct uk_term_ctx *tctx __unused)
+{
+	struct ukprof_stats stats;
+	int rc;
+
+	if (ukprof_stop())
+		return;
+
+	ukprof_stats(&stats);
+	uk_pr_info("%"__PRIu64" samples, %"__PRIu64" dropped, %"__PRIu64
+		   " stacks\n", stats.samples, stats.dropped, stats.stacks);
+
+	rc = ukprof_dump_output();
+	if (unlikely(rc))
+		uk_pr_err("Could not write profile: %d\n", rc);
+}
+
+uk_late_initcall(ukprof_autostart, ukprof_autostop);
+#endif /* CONFIG_LIBUKPROF_AUTOSTART */
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UKPROF_PROF_H__
+#define __UKPROF_PROF_H__
+
+#include <uk/arch/lcpu.h>
+#include <uk/essentials.h>
+#include <uk/plat/lcpu.h>
+
+#define UKPROF_MAX_DEPTH	CONFIG_LIBUKPROF_MAX_DEPTH
+#define UKPROF_NR_STACKS	(1UL << CONFIG_LIBUKPROF_NR_STACKS_ORDER)
+/* Slots that are probed for a stack before its sample is dropped */
+#define UKPROF_MAX_PROBES	16
+
+struct ukprof_stack {
+	/* Number of samples, 0 for free slots */
+	__u32 count;
+	__u32 depth;
+	__u64 hash;
+	/* Sampled instruction, followed by the return addresses of callers */
+	__uptr pc[UKPROF_MAX_DEPTH];
+};
+
+struct ukprof_lcpu {
+	/* Open-addressing hash table with UKPROF_NR_STACKS slots */
+	struct ukprof_stack *stacks;
+	__u64 samples;
+	__u64 dropped;
+	/* Set while the LCPU takes a sample, see ukprof_stop() */
+	int busy;
+};
+
+extern UKPLAT_PER_LCPU_DEFINE(struct ukprof_lcpu, ukprof_lcpus);
+extern int ukprof_running;
+
+/**
+ * Records a sample of the interrupted context. Must be called from the
+ * interrupt or NMI handler of the sample source.
+ */
+void ukprof_sample(struct __regs *regs);
+
+/**
+ * Prepares the sample source, e.g., allocates an interrupt vector and
+ * calibrates the sampling period. Called once, before the first start.
+ *
+ * @return
+ *   0 on success, -ENOTSUP if the sample source is not available
+ */
+int ukprof_arch_init(void);
+
+/**
+ * Stores the interrupted instruction pointer and the return addresses of its
+ * callers in `pc`, innermost first.
+ *
+ * @return
+ *   Number of addresses stored, at least 1 and at most `max`
+ */
+__sz ukprof_arch_unwind(struct __regs *regs, __uptr *pc, __sz max);
+
+/* Starts and stops the sample source on the current LCPU */
+void ukprof_arch_start_lcpu(void);
+void ukprof_arch_stop_lcpu(void);
+
+#endif /* __UKPROF_PROF_H__ */
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <uk/atomic.h>
+#include <uk/essentials.h>
+#include "prof.h"
+
+/* The code below runs in interrupt and NMI context and is compiled without
+ * extended registers, so it does not use memcpy() and friends.
+ */
+static __u64 ukprof_hash(const __uptr *pc, __sz depth)
+{
+	__u64 hash = depth;
+	__sz i;
+
+	for (i = 0; i < depth; i++) {
+		hash ^= pc[i];
+		hash *= 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+
+	return hash;
+}
+
+static int ukprof_stack_equal(const struct ukprof_stack *s, __u64 hash,
+			      const __uptr *pc, __sz depth)
+{
+	__sz i;
+
+	if (s->hash != hash || s->depth != depth)
+		return 0;
+
+	for (i = 0; i < depth; i++)
+		if (s->pc[i] != pc[i])
+			return 0;
+
+	return 1;
+}
+
+static void ukprof_record(struct ukprof_lcpu *pl, const __uptr *pc,
+			  __sz depth)
+{
+	__u64 hash = ukprof_hash(pc, depth);
+	struct ukprof_stack *s;
+	__sz i, j;
+
+	for (i = 0; i < UKPROF_MAX_PROBES; i++) {
+		s = &pl->stacks[(hash + i) & (UKPROF_NR_STACKS - 1)];
+		if (!s->count) {
+			s->hash = hash;
+			s->depth = depth;
+			for (j = 0; j < depth; j++)
+				s->pc[j] = pc[j];
+			s->count = 1;
+			return;
+		}
+
+		if (ukprof_stack_equal(s, hash, pc, depth)) {
+			s->count++;
+			return;
+		}
+	}
+
+	pl->dropped++;
+}
+
+void ukprof_sample(struct __regs *regs)
+{
+	struct ukprof_lcpu *pl = &ukplat_per_lcpu_current(ukprof_lcpus);
+	__uptr pc[UKPROF_MAX_DEPTH];
+	__sz depth;
+
+	/* Pairs with ukprof_stop(): either the sample sees that profiling
+	 * stopped or ukprof_stop() waits for it to complete.
+	 */
+	UK_WRITE_ONCE(pl->busy, 1);
+	mb();
+	if (unlikely(!UK_READ_ONCE(ukprof_running) || !pl->stacks))
+		goto out;
+
+	depth = ukprof_arch_unwind(regs, pc, UKPROF_MAX_DEPTH);
+	ukprof_record(pl, pc, depth);
+	pl->samples++;
+
+out:
+	barrier();
+	UK_WRITE_ONCE(pl->busy, 0);
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <errno.h>
+#include <string.h>
+#include <uk/test.h>
+#include <uk/prof.h>
+#include <uk/plat/time.h>
+
+#define MSEC(ms)		((__nsec)(ms) * 1000000UL)
+
+struct test_dump {
+	__u64 lines;
+	__u64 samples;
+	int malformed;
+};
+
+/* Checks that lines look like "0x...;0x... <count>\n" and sums the counts */
+static int test_dump_fn(void *cookie, const char *buf, __sz len)
+{
+	struct test_dump *td = cookie;
+	const char *p = memchr(buf, ' ', len);
+	__u64 count = 0;
+
+	td->lines++;
+	if (!p || strncmp(buf, "0x", 2) || buf[len - 1] != '\n') {
+		td->malformed = 1;
+		return 0;
+	}
+
+	for (p++; *p >= '0' && *p <= '9'; p++)
+		count = count * 10 + (*p - '0');
+	td->malformed |= (*p != '\n' || !count);
+	td->samples += count;
+	return 0;
+}
+
+static volatile unsigned long test_prof_sink;
+
+static __noinline void test_prof_spin(__nsec duration)
+{
+	__nsec end = ukplat_monotonic_clock() + duration;
+
+	while (ukplat_monotonic_clock() < end)
+		test_prof_sink++;
+}
+
+UK_TESTCASE(ukprof, test_prof_samples)
+{
+	struct ukprof_stats stats;
+	struct test_dump td = { 0 };
+	int rc;
+
+	rc = ukprof_start();
+	if (rc == -ENOTSUP || rc == -EBUSY) {
+		/* No sample source in this VM, or profiling from boot */
+		uk_pr_warn("Skipping profiler test: %d\n", rc);
+		return;
+	}
+	UK_TEST_EXPECT_ZERO(rc);
+	UK_TEST_EXPECT_SNUM_EQ(ukprof_start(), -EBUSY);
+	UK_TEST_EXPECT_SNUM_EQ(ukprof_dump(test_dump_fn, &td), -EBUSY);
+
+	test_prof_spin(MSEC(200));
+	UK_TEST_EXPECT_ZERO(ukprof_stop());
+	UK_TEST_EXPECT_SNUM_EQ(ukprof_stop(), -EINVAL);
+
+	ukprof_stats(&stats);
+	UK_TEST_EXPECT_SNUM_GT(stats.samples, 0);
+	UK_TEST_EXPECT_SNUM_GT(stats.stacks, 0);
+
+	/* Every sample that was not dropped appears in the profile */
+	UK_TEST_EXPECT_ZERO(ukprof_dump(test_dump_fn, &td));
+	UK_TEST_EXPECT_ZERO(td.malformed);
+	UK_TEST_EXPECT_SNUM_EQ(td.lines, stats.stacks);
+	UK_TEST_EXPECT_SNUM_EQ(td.samples, stats.samples - stats.dropped);
+}
+
+uk_testsuite_register(ukprof, NULL);
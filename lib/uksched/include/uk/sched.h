@@ -38,6 +38,7 @@
 #define __UK_SCHED_H__
 
 #include <uk/plat/tls.h>
+#include <uk/arch/spinlock.h>
 #include <uk/alloc.h>
 #include <uk/thread.h>
 #include <uk/assert.h>
@@ -72,6 +73,9 @@ typedef void  (*uk_sched_thread_blocked_func_t)
 typedef void  (*uk_sched_thread_woken_func_t)
 		(struct uk_sched *s, struct uk_thread *t);
 
+typedef void  (*uk_sched_thread_lock_func_t)
+		(struct uk_sched *s, struct uk_thread *t);
+
 typedef const struct uk_thread * (*uk_sched_idle_thread_func_t)
 		(struct uk_sched *s, unsigned int proc_id);
 
@@ -87,10 +91,18 @@ struct uk_sched {
 	uk_sched_thread_woken_func_t    thread_woken_isr;
 	uk_sched_idle_thread_func_t     idle_thread;
 
+	/* Optional: Serialize state changes of a thread with the scheduler
+	 * on other LCPUs. `thread_blocked`, `thread_woken`, and
+	 * `thread_woken_isr` are called with the thread locked.
+	 */
+	uk_sched_thread_lock_func_t     thread_lock;
+	uk_sched_thread_lock_func_t     thread_unlock;
+
 	uk_sched_start_t sched_start;
 
 	/* internal */
 	bool is_started;
+	__spinlock tl_lock; /**< protects thread_list and exited_threads */
 	struct uk_thread_list thread_list;
 	struct uk_thread_list exited_threads;
 	struct uk_alloc *a;       /**< default allocator for struct uk_thread */
@@ -117,6 +129,28 @@ int uk_sched_thread_add(struct uk_sched *s, struct uk_thread *t);
 
 int uk_sched_thread_remove(struct uk_thread *t);
 
+/**
+ * Locks the scheduling state of a thread: Runnable and queueable flags as
+ * well as the wakeup time of `t` must only be changed while the lock is held.
+ * Interrupts must be disabled. This is a no-op for threads that are not
+ * assigned to a scheduler or whose scheduler runs on a single LCPU.
+ */
+static inline void uk_sched_thread_lock(struct uk_thread *t)
+{
+	UK_ASSERT(t);
+
+	if (t->sched && t->sched->thread_lock)
+		t->sched->thread_lock(t->sched, t);
+}
+
+static inline void uk_sched_thread_unlock(struct uk_thread *t)
+{
+	UK_ASSERT(t);
+
+	if (t->sched && t->sched->thread_unlock)
+		t->sched->thread_unlock(t->sched, t);
+}
+
 static inline void uk_sched_thread_blocked(struct uk_thread *t)
 {
 	struct uk_sched *s;
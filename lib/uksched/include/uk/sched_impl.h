@@ -66,12 +66,15 @@ int uk_sched_register(struct uk_sched *s);
 		(s)->thread_woken     = thread_woken_func; \
 		(s)->thread_woken_isr = thread_woken_isr_func; \
 		(s)->idle_thread      = idle_thread_func; \
+		(s)->thread_lock      = NULL; \
+		(s)->thread_unlock    = NULL; \
 		uk_sched_register((s)); \
 		\
 		(s)->a = (def_allocator); \
 		(s)->a_stack = (def_allocator); \
 		(s)->a_auxstack = (def_allocator); \
 		(s)->a_uktls = (def_allocator); \
+		ukarch_spin_init(&(s)->tl_lock); \
 		UK_TAILQ_INIT(&(s)->thread_list); \
 		UK_TAILQ_INIT(&(s)->exited_threads); \
 	} while (0)
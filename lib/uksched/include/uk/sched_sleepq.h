@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef __UK_SCHED_SLEEPQ_H__
+#define __UK_SCHED_SLEEPQ_H__
+
+#include <uk/arch/types.h>
+#include <uk/thread.h>
+#include <uk/timerwheel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * NOTE: This header should only be used by actual scheduler implementations.
+ *
+ * Sleep queue of threads on a hierarchical timer wheel (see uk/timerwheel.h),
+ * keyed by their `wakeup_time`. The `queue_slot` of a sleeping thread is its
+ * slot on the wheel.
+ */
+#define UK_SLEEPQ_NR_SLOTS	UK_TIMERWHEEL_NR_SLOTS
+
+struct uk_sched_sleepq {
+	struct uk_thread_list slot[UK_SLEEPQ_NR_SLOTS];
+	struct uk_timerwheel wheel;
+	unsigned long count;			/* Number of queued threads */
+};
+
+void uk_sched_sleepq_init(struct uk_sched_sleepq *q, __nsec now);
+
+/* Enqueues a thread that has a non-zero `wakeup_time` */
+void uk_sched_sleepq_add(struct uk_sched_sleepq *q, struct uk_thread *t);
+
+/* Dequeues a thread that was added with `uk_sched_sleepq_add()` */
+void uk_sched_sleepq_remove(struct uk_sched_sleepq *q, struct uk_thread *t);
+
+typedef void (*uk_sched_sleepq_expired_func_t)(struct uk_thread *t,
+					      void *argp);
+
+/**
+ * Dequeues all threads whose wakeup time is before or at `now` and calls
+ * `expired` for each of them. Threads are already removed from the queue
+ * when the callback is executed.
+ */
+void uk_sched_sleepq_expire(struct uk_sched_sleepq *q, __nsec now,
+			    uk_sched_sleepq_expired_func_t expired,
+			    void *argp);
+
+/**
+ * Returns the time when the wheel needs to be serviced next. This is the
+ * earliest wakeup time of all queued threads, or a lower bound of it if
+ * the next event is a cascade of a higher wheel level. Returns 0 if the
+ * queue is empty.
+ */
+__nsec uk_sched_sleepq_next(struct uk_sched_sleepq *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_SCHED_SLEEPQ_H__ */
@@ -63,6 +63,8 @@ struct uk_thread {
 
 	UK_TAILQ_ENTRY(struct uk_thread) queue;
 	uint32_t flags;
+	uint32_t queue_slot;		/**< Scheduler queue index (internal!) */
+	uint32_t lcpu;			/**< Assigned LCPU index (internal!) */
 	__snsec wakeup_time;
 	struct uk_sched *sched;
 
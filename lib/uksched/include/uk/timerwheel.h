@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef __UK_TIMERWHEEL_H__
+#define __UK_TIMERWHEEL_H__
+
+#include <uk/arch/time.h>
+#include <uk/arch/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hierarchical timer wheel
+ *
+ * Expiry times are bucketed into ticks of 2^UK_TIMERWHEEL_TICK_SHIFT
+ * nanoseconds. Each of the UK_TIMERWHEEL_LVL_DEPTH levels has
+ * UK_TIMERWHEEL_LVL_SIZE slots; level `l` holds entries whose tick agrees with
+ * the current wheel clock in all bits above `UK_TIMERWHEEL_LVL_BITS * (l + 1)`.
+ * Slots of higher levels are cascaded into lower levels when the clock enters
+ * their range. Entries that are further away than the wheel spans are kept on
+ * an overflow slot which is re-filed whenever the top level wraps.
+ *
+ * The wheel only keeps track of the clock and of which slots are occupied.
+ * The user keeps the entries on a list per slot and provides the operations
+ * that walk these lists. Insertion and removal are O(1), expiry is O(1)
+ * amortized per entry, and the next deadline is found with one bitmap scan
+ * per level.
+ */
+#define UK_TIMERWHEEL_TICK_SHIFT	20 /* ~1ms */
+#define UK_TIMERWHEEL_LVL_BITS		6
+#define UK_TIMERWHEEL_LVL_SIZE		(1UL << UK_TIMERWHEEL_LVL_BITS)
+#define UK_TIMERWHEEL_LVL_MASK		(UK_TIMERWHEEL_LVL_SIZE - 1)
+#define UK_TIMERWHEEL_LVL_DEPTH		4
+#define UK_TIMERWHEEL_OVERFLOW		\
+	(UK_TIMERWHEEL_LVL_DEPTH * UK_TIMERWHEEL_LVL_SIZE)
+#define UK_TIMERWHEEL_NR_SLOTS		(UK_TIMERWHEEL_OVERFLOW + 1)
+
+struct uk_timerwheel {
+	/* Bitmap of non-empty slots, one word per level. The overflow slot
+	 * is bit 0 of the last word.
+	 */
+	__u64 pending[UK_TIMERWHEEL_LVL_DEPTH + 1];
+	__u64 clk;				/* Current wheel tick */
+};
+
+struct uk_timerwheel_ops {
+	/* Re-inserts all entries of slot `idx` with uk_timerwheel_link().
+	 * The entries must be taken off the slot first, since they may be
+	 * filed to the same slot again.
+	 */
+	void (*refile)(struct uk_timerwheel *w, unsigned int idx, void *argp);
+	/* Takes the entries of slot `idx` that expire at or before `now` off
+	 * the wheel and calls uk_timerwheel_unlink() for the slot
+	 */
+	void (*expire)(struct uk_timerwheel *w, unsigned int idx, __nsec now,
+		       void *argp);
+	/* Returns the earliest expiry time of the entries of slot `idx`, or
+	 * 0 if the slot is empty
+	 */
+	__nsec (*slot_min)(struct uk_timerwheel *w, unsigned int idx,
+			   void *argp);
+};
+
+void uk_timerwheel_init(struct uk_timerwheel *w, __nsec now);
+
+/**
+ * Returns the slot for an entry that expires at `expires` and marks it as
+ * occupied. The caller adds the entry to the list of the slot.
+ */
+unsigned int uk_timerwheel_link(struct uk_timerwheel *w, __nsec expires);
+
+/**
+ * Updates the wheel after entries were removed from slot `idx`. `empty`
+ * tells whether the list of the slot is empty now.
+ */
+static inline void uk_timerwheel_unlink(struct uk_timerwheel *w,
+					unsigned int idx, int empty)
+{
+	if (empty)
+		w->pending[idx / UK_TIMERWHEEL_LVL_SIZE] &=
+			~(1ULL << (idx & UK_TIMERWHEEL_LVL_MASK));
+}
+
+/**
+ * Advances the wheel clock to `now`. Slots are cascaded on the way with
+ * `ops->refile` and the entries that expired are handed to `ops->expire`.
+ */
+void uk_timerwheel_advance(struct uk_timerwheel *w, __nsec now,
+			   const struct uk_timerwheel_ops *ops, void *argp);
+
+/**
+ * Returns the time when the wheel needs to be advanced next. This is the
+ * earliest expiry time of all entries, or a lower bound of it if the next
+ * event is a cascade of a higher wheel level. Returns 0 if the wheel is
+ * empty.
+ */
+__nsec uk_timerwheel_next(struct uk_timerwheel *w,
+			  const struct uk_timerwheel_ops *ops, void *argp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_TIMERWHEEL_H__ */
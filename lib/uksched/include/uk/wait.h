@@ -113,9 +113,11 @@ do { \
 				break; \
 			} \
 			uk_waitq_add(wq, &__wait); \
+			uk_sched_thread_lock(__current); \
 			__current->wakeup_time = deadline; \
 			uk_thread_set_blocked(__current); \
 			uk_sched_thread_blocked(__current); \
+			uk_sched_thread_unlock(__current); \
 			ukplat_spin_unlock_irqrestore(&((wq)->sl), flags); \
 			if (lock) \
 				unlock_fn(lock); \
@@ -148,9 +150,11 @@ do { \
 	__current = uk_thread_current(); \
 	ukplat_spin_lock_irqsave(&((wq)->sl), flags); \
 	uk_waitq_add(wq, &__wait); \
+	uk_sched_thread_lock(__current); \
 	__current->wakeup_time = deadline; \
 	uk_thread_set_blocked(__current); \
 	uk_sched_thread_blocked(__current); \
+	uk_sched_thread_unlock(__current); \
 	ukplat_spin_unlock_irqrestore(&((wq)->sl), flags); \
 	if (lock) \
 		unlock_fn(lock); \
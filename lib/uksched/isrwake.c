@@ -11,11 +11,13 @@ void uk_thread_wake_isr(struct uk_thread *thread)
 	unsigned long flags;
 
 	flags = ukplat_lcpu_save_irqf();
+	uk_sched_thread_lock(thread);
 	if (!uk_thread_is_runnable(thread)) {
 		uk_thread_set_runnable(thread);
 		if (thread->sched)
 			uk_sched_thread_woken_isr(thread);
 	}
 	thread->wakeup_time = 0LL;
+	uk_sched_thread_unlock(thread);
 	ukplat_lcpu_restore_irqf(flags);
 }
@@ -39,6 +39,7 @@
 #include <uk/plat/time.h>
 #include <uk/alloc.h>
 #include <uk/plat/lcpu.h>
+#include <uk/plat/spinlock.h>
 #include <uk/sched.h>
 #include <uk/syscall.h>
 
@@ -235,7 +236,9 @@ int uk_sched_start(struct uk_sched *s)
 	ukplat_per_lcpu_current(__uk_sched_thread_current) = main_thread;
 
 	/* Add main to the scheduler's thread list */
+	ukarch_spin_lock(&s->tl_lock);
 	UK_TAILQ_INSERT_TAIL(&s->thread_list, main_thread, thread_list);
+	ukarch_spin_unlock(&s->tl_lock);
 
 	/* Enable scheduler, like time slicing, etc. and notify that `s`
 	 * has an (already) scheduled thread
@@ -255,20 +258,37 @@ err_out:
 
 unsigned int uk_sched_thread_gc(struct uk_sched *sched)
 {
+	struct uk_thread_list gc_list = UK_TAILQ_HEAD_INITIALIZER(gc_list);
 	struct uk_thread *thread, *tmp;
 	unsigned int num = 0;
+	unsigned long flags;
 
-	/* Cleanup finished threads */
+	/* Collect finished threads */
+	ukplat_spin_lock_irqsave(&sched->tl_lock, flags);
 	UK_TAILQ_FOREACH_SAFE(thread, &sched->exited_threads,
 			      thread_list, tmp) {
 		UK_ASSERT(thread != uk_thread_current());
 		UK_ASSERT(uk_thread_is_exited(thread));
 
+#ifdef CONFIG_HAVE_SMP
+		/* Only the LCPU that executed the thread last can be sure
+		 * that the thread was switched out already.
+		 */
+		if (thread->lcpu != ukplat_lcpu_idx())
+			continue;
+#endif /* CONFIG_HAVE_SMP */
+
+		UK_TAILQ_REMOVE(&sched->exited_threads, thread, thread_list);
+		UK_TAILQ_INSERT_TAIL(&gc_list, thread, thread_list);
+	}
+	ukplat_spin_unlock_irqrestore(&sched->tl_lock, flags);
+
+	/* Cleanup finished threads */
+	UK_TAILQ_FOREACH_SAFE(thread, &gc_list, thread_list, tmp) {
 		uk_pr_debug("%p: garbage collect thread %p (%s)\n",
 			    sched, thread,
 			    thread->name ? thread->name : "<unnamed>");
 
-		UK_TAILQ_REMOVE(&sched->exited_threads, thread, thread_list);
 		if (thread->_gc_fn)
 			thread->_gc_fn(thread,  thread->_gc_argp);
 		uk_thread_release(thread);
@@ -281,6 +301,7 @@ unsigned int uk_sched_thread_gc(struct uk_sched *sched)
 void uk_sched_thread_terminate(struct uk_thread *thread)
 {
 	struct uk_sched *sched;
+	unsigned long flags;
 
 	UK_ASSERT(thread);
 	 /* NOTE: The following assertion can also fail on a double-termination.
@@ -306,8 +327,10 @@ void uk_sched_thread_terminate(struct uk_thread *thread)
 		uk_pr_debug("%p: thread %p (%s) on gc list\n",
 			    sched, thread, thread->name ?
 					   thread->name : "<unnamed>");
+		ukplat_spin_lock_irqsave(&sched->tl_lock, flags);
 		UK_TAILQ_INSERT_TAIL(&sched->exited_threads, thread,
 				     thread_list);
+		ukplat_spin_unlock_irqrestore(&sched->tl_lock, flags);
 
 		/* leave this thread */
 		sched->yield(sched); /* we won't return */
@@ -360,7 +383,9 @@ int uk_sched_thread_add(struct uk_sched *s, struct uk_thread *t)
 		goto out;
 
 	t->sched = s;
+	ukarch_spin_lock(&s->tl_lock);
 	UK_TAILQ_INSERT_TAIL(&s->thread_list, t, thread_list);
+	ukarch_spin_unlock(&s->tl_lock);
 out:
 	ukplat_lcpu_restore_irqf(flags);
 	return rc;
@@ -378,7 +403,9 @@ int uk_sched_thread_remove(struct uk_thread *t)
 	s = t->sched;
 	s->thread_remove(s, t);
 	t->sched = NULL;
+	ukarch_spin_lock(&s->tl_lock);
 	UK_TAILQ_REMOVE(&s->thread_list, t, thread_list);
+	ukarch_spin_unlock(&s->tl_lock);
 	ukplat_lcpu_restore_irqf(flags);
 	return 0;
 }
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/sched_sleepq.h>
+
+struct sleepq_expire_args {
+	uk_sched_sleepq_expired_func_t expired;
+	void *argp;
+};
+
+#define wheel2sleepq(w) \
+	__containerof(w, struct uk_sched_sleepq, wheel)
+
+static inline void sleepq_link(struct uk_sched_sleepq *q, struct uk_thread *t)
+{
+	UK_ASSERT(t->wakeup_time > 0);
+
+	t->queue_slot = uk_timerwheel_link(&q->wheel, (__nsec) t->wakeup_time);
+	UK_TAILQ_INSERT_TAIL(&q->slot[t->queue_slot], t, queue);
+}
+
+static inline void sleepq_unlink(struct uk_sched_sleepq *q,
+				 struct uk_thread *t)
+{
+	unsigned int idx = t->queue_slot;
+
+	UK_ASSERT(idx < UK_SLEEPQ_NR_SLOTS);
+
+	UK_TAILQ_REMOVE(&q->slot[idx], t, queue);
+	uk_timerwheel_unlink(&q->wheel, idx, UK_TAILQ_EMPTY(&q->slot[idx]));
+}
+
+static void sleepq_refile(struct uk_timerwheel *w, unsigned int idx,
+			  void *argp __unused)
+{
+	struct uk_sched_sleepq *q = wheel2sleepq(w);
+	struct uk_thread_list tmp;
+	struct uk_thread *t;
+
+	UK_TAILQ_INIT(&tmp);
+	UK_TAILQ_CONCAT(&tmp, &q->slot[idx], queue);
+
+	while ((t = UK_TAILQ_FIRST(&tmp))) {
+		UK_TAILQ_REMOVE(&tmp, t, queue);
+		sleepq_link(q, t);
+	}
+}
+
+static void sleepq_expire(struct uk_timerwheel *w, unsigned int idx,
+			  __nsec now, void *argp)
+{
+	struct sleepq_expire_args *args = (struct sleepq_expire_args *)argp;
+	struct uk_sched_sleepq *q = wheel2sleepq(w);
+	struct uk_thread *t, *tmp;
+
+	UK_TAILQ_FOREACH_SAFE(t, &q->slot[idx], queue, tmp) {
+		if ((__nsec) t->wakeup_time <= now) {
+			uk_sched_sleepq_remove(q, t);
+			args->expired(t, args->argp);
+		}
+	}
+}
+
+static __nsec sleepq_slot_min(struct uk_timerwheel *w, unsigned int idx,
+			      void *argp __unused)
+{
+	struct uk_sched_sleepq *q = wheel2sleepq(w);
+	struct uk_thread *t;
+	__nsec min = 0;
+
+	UK_TAILQ_FOREACH(t, &q->slot[idx], queue) {
+		if (!min || (__nsec) t->wakeup_time < min)
+			min = (__nsec) t->wakeup_time;
+	}
+	return min;
+}
+
+static const struct uk_timerwheel_ops sleepq_ops = {
+	.refile   = sleepq_refile,
+	.expire   = sleepq_expire,
+	.slot_min = sleepq_slot_min,
+};
+
+void uk_sched_sleepq_init(struct uk_sched_sleepq *q, __nsec now)
+{
+	unsigned int i;
+
+	UK_ASSERT(q);
+
+	for (i = 0; i < UK_SLEEPQ_NR_SLOTS; ++i)
+		UK_TAILQ_INIT(&q->slot[i]);
+	uk_timerwheel_init(&q->wheel, now);
+	q->count = 0;
+}
+
+void uk_sched_sleepq_add(struct uk_sched_sleepq *q, struct uk_thread *t)
+{
+	UK_ASSERT(q);
+	UK_ASSERT(t);
+
+	sleepq_link(q, t);
+	q->count++;
+}
+
+void uk_sched_sleepq_remove(struct uk_sched_sleepq *q, struct uk_thread *t)
+{
+	UK_ASSERT(q);
+	UK_ASSERT(t);
+	UK_ASSERT(q->count > 0);
+
+	sleepq_unlink(q, t);
+	q->count--;
+}
+
+void uk_sched_sleepq_expire(struct uk_sched_sleepq *q, __nsec now,
+			    uk_sched_sleepq_expired_func_t expired,
+			    void *argp)
+{
+	struct sleepq_expire_args args = { .expired = expired, .argp = argp };
+
+	UK_ASSERT(q);
+	UK_ASSERT(expired);
+
+	uk_timerwheel_advance(&q->wheel, now, &sleepq_ops, &args);
+}
+
+__nsec uk_sched_sleepq_next(struct uk_sched_sleepq *q)
+{
+	UK_ASSERT(q);
+
+	if (!q->count)
+		return 0;
+	return uk_timerwheel_next(&q->wheel, &sleepq_ops, __NULL);
+}
@@ -45,11 +45,15 @@
 #include <uk/assert.h>
 #include <uk/arch/tls.h>
 #include <uk/plat/memory.h>
+#include <uk/trace.h>
 
 #if CONFIG_LIBUKSCHED_TCB_INIT && !CONFIG_UKARCH_TLS_HAVE_TCB
 #error CONFIG_LIBUKSCHED_TCB_INIT requires that a TLS contains reserved space for a TCB
 #endif
 
+UK_TRACEPOINT(trace_uksched_thread_block, "%p until %ld", void *, long);
+UK_TRACEPOINT(trace_uksched_thread_wake, "%p", void *);
+
 extern const struct uk_thread_inittab_entry _uk_thread_inittab_start[];
 extern const struct uk_thread_inittab_entry _uk_thread_inittab_end;
 
@@ -1058,12 +1062,15 @@ void uk_thread_block_until(struct uk_thread *thread, __snsec until)
 	UK_ASSERT(thread);
 
 	flags = ukplat_lcpu_save_irqf();
+	trace_uksched_thread_block(thread, until);
+	uk_sched_thread_lock(thread);
 	thread->wakeup_time = until;
 	if (uk_thread_is_runnable(thread)) {
 		uk_thread_set_blocked(thread);
 		if (thread->sched)
 			uk_sched_thread_blocked(thread);
 	}
+	uk_sched_thread_unlock(thread);
 	ukplat_lcpu_restore_irqf(flags);
 }
 
@@ -1088,11 +1095,14 @@ void uk_thread_wake(struct uk_thread *thread)
 	unsigned long flags;
 
 	flags = ukplat_lcpu_save_irqf();
+	trace_uksched_thread_wake(thread);
+	uk_sched_thread_lock(thread);
 	if (!uk_thread_is_runnable(thread)) {
 		uk_thread_set_runnable(thread);
 		if (thread->sched)
 			uk_sched_thread_woken(thread);
 	}
 	thread->wakeup_time = 0LL;
+	uk_sched_thread_unlock(thread);
 	ukplat_lcpu_restore_irqf(flags);
 }
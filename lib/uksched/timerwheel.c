@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/timerwheel.h>
+
+#define TIMERWHEEL_LVL_SHIFT(lvl)	(UK_TIMERWHEEL_LVL_BITS * (lvl))
+#define TIMERWHEEL_NO_TICK		(~0ULL)
+
+static inline __u64 timerwheel_tick(__nsec expires)
+{
+	return ((__u64) expires) >> UK_TIMERWHEEL_TICK_SHIFT;
+}
+
+static inline int timerwheel_pending(struct uk_timerwheel *w,
+				     unsigned int idx)
+{
+	return !!(w->pending[idx / UK_TIMERWHEEL_LVL_SIZE]
+		  & (1ULL << (idx & UK_TIMERWHEEL_LVL_MASK)));
+}
+
+/* Computes the slot for an entry that expires at `tick` */
+static unsigned int timerwheel_slot(struct uk_timerwheel *w, __u64 tick)
+{
+	unsigned int lvl;
+
+	/* Overdue entries are placed on the slot of the current tick */
+	if (tick < w->clk)
+		tick = w->clk;
+
+	for (lvl = 0; lvl < UK_TIMERWHEEL_LVL_DEPTH; ++lvl) {
+		if (((tick ^ w->clk) >> TIMERWHEEL_LVL_SHIFT(lvl + 1)) == 0)
+			return (lvl * UK_TIMERWHEEL_LVL_SIZE)
+			       + ((tick >> TIMERWHEEL_LVL_SHIFT(lvl))
+				  & UK_TIMERWHEEL_LVL_MASK);
+	}
+	return UK_TIMERWHEEL_OVERFLOW;
+}
+
+/* Re-inserts all entries of a slot relative to the current clock */
+static void timerwheel_refile(struct uk_timerwheel *w, unsigned int idx,
+			      const struct uk_timerwheel_ops *ops, void *argp)
+{
+	if (!timerwheel_pending(w, idx))
+		return;
+
+	uk_timerwheel_unlink(w, idx, 1);
+	ops->refile(w, idx, argp);
+}
+
+/* Moves down the higher level slots whose range starts at the current tick */
+static void timerwheel_cascade(struct uk_timerwheel *w,
+			       const struct uk_timerwheel_ops *ops, void *argp)
+{
+	unsigned int lvl;
+
+	for (lvl = 1; lvl < UK_TIMERWHEEL_LVL_DEPTH; ++lvl) {
+		if (w->clk & ((1ULL << TIMERWHEEL_LVL_SHIFT(lvl)) - 1))
+			return;
+		timerwheel_refile(w, (lvl * UK_TIMERWHEEL_LVL_SIZE)
+				     + ((w->clk >> TIMERWHEEL_LVL_SHIFT(lvl))
+					& UK_TIMERWHEEL_LVL_MASK),
+				  ops, argp);
+	}
+	if (!(w->clk
+	      & ((1ULL << TIMERWHEEL_LVL_SHIFT(UK_TIMERWHEEL_LVL_DEPTH)) - 1)))
+		timerwheel_refile(w, UK_TIMERWHEEL_OVERFLOW, ops, argp);
+}
+
+/**
+ * Returns the next tick after the current clock at which a slot needs to be
+ * processed, either for expiry (level 0) or for a cascade. `idx` is set to
+ * the corresponding slot.
+ */
+static __u64 timerwheel_next_tick(struct uk_timerwheel *w, unsigned int *idx)
+{
+	__u64 next = TIMERWHEEL_NO_TICK;
+	__u64 pending, tick;
+	unsigned int lvl, shift, digit;
+
+	for (lvl = 0; lvl < UK_TIMERWHEEL_LVL_DEPTH; ++lvl) {
+		shift = TIMERWHEEL_LVL_SHIFT(lvl);
+		digit = (w->clk >> shift) & UK_TIMERWHEEL_LVL_MASK;
+
+		/* Only slots after the current one can be occupied */
+		pending = w->pending[lvl] & ~((2ULL << digit) - 1);
+		if (!pending)
+			continue;
+
+		digit = __builtin_ctzll(pending);
+		tick  = (w->clk >> (shift + UK_TIMERWHEEL_LVL_BITS))
+			<< (shift + UK_TIMERWHEEL_LVL_BITS);
+		tick |= ((__u64) digit) << shift;
+		if (tick < next) {
+			next = tick;
+			*idx = (lvl * UK_TIMERWHEEL_LVL_SIZE) + digit;
+		}
+	}
+
+	if (timerwheel_pending(w, UK_TIMERWHEEL_OVERFLOW)) {
+		shift = TIMERWHEEL_LVL_SHIFT(UK_TIMERWHEEL_LVL_DEPTH);
+		tick  = ((w->clk >> shift) + 1) << shift;
+		if (tick < next) {
+			next = tick;
+			*idx = UK_TIMERWHEEL_OVERFLOW;
+		}
+	}
+	return next;
+}
+
+/* Hands the current level 0 slot to `ops->expire` if it is occupied */
+static void timerwheel_expire_slot(struct uk_timerwheel *w, __nsec now,
+				   const struct uk_timerwheel_ops *ops,
+				   void *argp)
+{
+	unsigned int idx = w->clk & UK_TIMERWHEEL_LVL_MASK;
+
+	if (timerwheel_pending(w, idx))
+		ops->expire(w, idx, now, argp);
+}
+
+void uk_timerwheel_init(struct uk_timerwheel *w, __nsec now)
+{
+	unsigned int i;
+
+	UK_ASSERT(w);
+
+	for (i = 0; i <= UK_TIMERWHEEL_LVL_DEPTH; ++i)
+		w->pending[i] = 0;
+	w->clk = timerwheel_tick(now);
+}
+
+unsigned int uk_timerwheel_link(struct uk_timerwheel *w, __nsec expires)
+{
+	unsigned int idx;
+
+	UK_ASSERT(w);
+
+	idx = timerwheel_slot(w, timerwheel_tick(expires));
+	w->pending[idx / UK_TIMERWHEEL_LVL_SIZE] |=
+		(1ULL << (idx & UK_TIMERWHEEL_LVL_MASK));
+	return idx;
+}
+
+void uk_timerwheel_advance(struct uk_timerwheel *w, __nsec now,
+			   const struct uk_timerwheel_ops *ops, void *argp)
+{
+	__u64 now_tick = timerwheel_tick(now);
+	unsigned int idx;
+	__u64 next;
+
+	UK_ASSERT(w);
+	UK_ASSERT(ops);
+
+	timerwheel_expire_slot(w, now, ops, argp);
+	for (;;) {
+		next = timerwheel_next_tick(w, &idx);
+		if (next > now_tick)
+			break;
+
+		w->clk = next;
+		timerwheel_cascade(w, ops, argp);
+		timerwheel_expire_slot(w, now, ops, argp);
+	}
+
+	/* No occupied slot is crossed anymore until `now`, so we can
+	 * advance the clock without moving any entry.
+	 */
+	if (now_tick > w->clk)
+		w->clk = now_tick;
+}
+
+__nsec uk_timerwheel_next(struct uk_timerwheel *w,
+			  const struct uk_timerwheel_ops *ops, void *argp)
+{
+	unsigned int idx;
+	__nsec min;
+	__u64 next;
+
+	UK_ASSERT(w);
+	UK_ASSERT(ops);
+
+	/* Entries on the current tick always expire first */
+	idx = w->clk & UK_TIMERWHEEL_LVL_MASK;
+	if (timerwheel_pending(w, idx)) {
+		min = ops->slot_min(w, idx, argp);
+		if (min)
+			return min;
+	}
+
+	next = timerwheel_next_tick(w, &idx);
+	if (next == TIMERWHEEL_NO_TICK)
+		return 0;
+	if (idx < UK_TIMERWHEEL_LVL_SIZE)
+		return ops->slot_min(w, idx, argp);
+	return (__nsec) (next << UK_TIMERWHEEL_TICK_SHIFT);
+}
@@ -36,13 +36,25 @@
 #include <uk/sched_impl.h>
 #include <uk/schedcoop.h>
 #include <uk/essentials.h>
+#include <uk/trace.h>
 #include "schedcoop.h"
 
+UK_TRACEPOINT(trace_ukschedcoop_switch, "%p (%s) -> %p (%s)",
+	      void *, const char *, void *, const char *);
+
+static void schedcoop_thread_expired(struct uk_thread *t,
+				     void *argp __unused)
+{
+	/* The thread was already dequeued from the sleep queue */
+	t->wakeup_time = 0LL;
+	uk_thread_wake(t);
+}
+
 static void schedcoop_schedule(struct uk_sched *s)
 {
 	struct schedcoop *c = uksched2schedcoop(s);
-	struct uk_thread *prev, *next, *thread, *tmp;
-	__snsec now, min_wakeup_time;
+	struct uk_thread *prev, *next;
+	__snsec now;
 	unsigned long flags;
 
 	if (unlikely(ukplat_lcpu_irqs_disabled()))
@@ -65,20 +77,9 @@ static void schedcoop_schedule(struct uk_sched *s)
 	prev->exec_time += now - c->ts_prev_switch;
 	c->ts_prev_switch = now;
 
-	/* Examine all sleeping threads.
-	 * Wake up expired ones and find the time when the next timeout expires.
-	 */
-	min_wakeup_time = 0;
-	UK_TAILQ_FOREACH_SAFE(thread, &c->sleep_queue,
-			      queue, tmp) {
-		if (likely(thread->wakeup_time)) {
-			if (thread->wakeup_time <= now)
-				uk_thread_wake(thread);
-			else if (!min_wakeup_time
-				 || thread->wakeup_time < min_wakeup_time)
-				min_wakeup_time = thread->wakeup_time;
-		}
-	}
+	/* Wake up sleeping threads whose timeout expired */
+	uk_sched_sleepq_expire(&c->sleep_queue, now,
+			       schedcoop_thread_expired, NULL);
 
 	next = UK_TAILQ_FIRST(&c->run_queue);
 	if (next) {
@@ -103,7 +104,7 @@ static void schedcoop_schedule(struct uk_sched *s)
 		 * We select the idle thread only if we do not have anything
 		 * else to execute
 		 */
-		c->idle_return_time = min_wakeup_time;
+		c->idle_return_time = uk_sched_sleepq_next(&c->sleep_queue);
 		next = &c->idle;
 	}
 
@@ -122,8 +123,11 @@ static void schedcoop_schedule(struct uk_sched *s)
 	/* Interrupting the switch is equivalent to having the next thread
 	 * interrupted at the return instruction. And therefore at safe point.
 	 */
-	if (prev != next)
+	if (prev != next) {
+		trace_ukschedcoop_switch(prev, prev->name ? prev->name : "",
+					 next, next->name ? next->name : "");
 		uk_sched_thread_switch(next);
+	}
 }
 
 static int schedcoop_thread_add(struct uk_sched *s, struct uk_thread *t)
@@ -148,6 +152,9 @@ static void schedcoop_thread_remove(struct uk_sched *s, struct uk_thread *t)
 	if (t != uk_thread_current()
 	    && uk_thread_is_runnable(t))
 		UK_TAILQ_REMOVE(&c->run_queue, t, queue);
+	/* Remove from sleep_queue if the thread is sleeping with a timeout */
+	else if (!uk_thread_is_runnable(t) && t->wakeup_time > 0)
+		uk_sched_sleepq_remove(&c->sleep_queue, t);
 }
 
 static void schedcoop_thread_blocked(struct uk_sched *s, struct uk_thread *t)
@@ -159,7 +166,7 @@ static void schedcoop_thread_blocked(struct uk_sched *s, struct uk_thread *t)
 	if (t != uk_thread_current())
 		UK_TAILQ_REMOVE(&c->run_queue, t, queue);
 	if (t->wakeup_time > 0)
-		UK_TAILQ_INSERT_TAIL(&c->sleep_queue, t, queue);
+		uk_sched_sleepq_add(&c->sleep_queue, t);
 }
 
 static __noreturn void idle_thread_fn(void *argp)
@@ -266,7 +273,7 @@ struct uk_sched *uk_schedcoop_create(struct uk_alloc *a)
 		goto err_out;
 
 	UK_TAILQ_INIT(&c->run_queue);
-	UK_TAILQ_INIT(&c->sleep_queue);
+	uk_sched_sleepq_init(&c->sleep_queue, ukplat_monotonic_clock());
 
 	/* Create idle thread */
 	rc = uk_thread_init_fn1(&c->idle,
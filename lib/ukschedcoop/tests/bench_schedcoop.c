@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <stdio.h>
+#include <errno.h>
+
+#include <uk/test.h>
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/arch/limits.h>
+#include <uk/plat/time.h>
+
+#define BENCH_YIELDS		10000
+#define BENCH_FAR_NSEC		ukarch_time_sec_to_nsec(3600)
+
+static void wait_thread(struct uk_thread *t)
+{
+	while (!uk_thread_is_exited(t))
+		uk_sched_yield();
+}
+
+static volatile int bench_stop;
+
+static __noreturn void bench_peer_fn(void *argp __unused)
+{
+	while (!bench_stop)
+		uk_sched_yield();
+	uk_sched_thread_exit();
+}
+
+static __noreturn void bench_sleeper_fn(void *argp __unused)
+{
+	/* Sleepers are blocked before they get scheduled for the first time */
+	UK_CRASH("Benchmark sleeper unexpectedly scheduled\n");
+}
+
+/* Measures the cost of a context switch between two threads while a
+ * varying number of threads are sleeping on the scheduler.
+ */
+static int bench_switch(struct uk_sched *s, unsigned long nr_sleepers)
+{
+	struct uk_thread **sleepers;
+	struct uk_thread *peer;
+	__nsec start, end;
+	unsigned long i, n;
+	__snsec deadline;
+	int rc = 0;
+
+	sleepers = uk_calloc(s->a, nr_sleepers, sizeof(*sleepers));
+	if (!sleepers)
+		return -ENOMEM;
+
+	deadline = ukplat_monotonic_clock() + BENCH_FAR_NSEC;
+	for (n = 0; n < nr_sleepers; ++n) {
+		sleepers[n] = uk_sched_thread_create_fn1(s, bench_sleeper_fn,
+							 NULL,
+							 __PAGE_SIZE,
+							 __PAGE_SIZE,
+							 true, true,
+							 NULL, NULL, NULL);
+		if (!sleepers[n]) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		/* Spread deadlines so that all wheel levels get populated */
+		uk_thread_block_until(sleepers[n], deadline
+				      - (__snsec)((n * 2654435761UL)
+						  % (unsigned long)
+						    BENCH_FAR_NSEC));
+	}
+
+	bench_stop = 0;
+	peer = uk_sched_thread_create(s, bench_peer_fn, NULL, NULL);
+	if (!peer) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	start = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_YIELDS; ++i)
+		uk_sched_yield();
+	end = ukplat_monotonic_clock();
+
+	bench_stop = 1;
+	wait_thread(peer);
+
+	printf("schedcoop: %8lu sleepers: %6lu ns per yield\n",
+	       nr_sleepers, (unsigned long)((end - start) / BENCH_YIELDS));
+
+out:
+	for (i = 0; i < n; ++i)
+		uk_thread_terminate(sleepers[i]);
+	uk_free(s->a, sleepers);
+	return rc;
+}
+
+UK_TESTCASE(ukschedcoop_bench, bench_sleepers_switch)
+{
+	static const unsigned long nr_sleepers[] = { 10, 1000, 100000 };
+	struct uk_sched *s = uk_sched_current();
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(nr_sleepers); ++i) {
+		rc = bench_switch(s, nr_sleepers[i]);
+		if (rc == -ENOMEM) {
+			printf("schedcoop: %8lu sleepers: not enough memory\n",
+			       nr_sleepers[i]);
+			break;
+		}
+		UK_TEST_EXPECT_ZERO(rc);
+	}
+}
+
+uk_testsuite_register(ukschedcoop_bench, NULL);
@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <stdio.h>
+#include <errno.h>
+
+#include <uk/test.h>
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/arch/limits.h>
+#include <uk/plat/time.h>
+
+#define NR_SLEEPERS		32
+#define SLEEP_STEP_NSEC		ukarch_time_msec_to_nsec(7)
+#define SLEEP_FAR_NSEC		ukarch_time_sec_to_nsec(3600)
+
+struct sleeper {
+	__snsec deadline;
+	__snsec woken;
+};
+
+static __noreturn void sleeper_fn(void *argp)
+{
+	struct sleeper *s = (struct sleeper *)argp;
+
+	uk_thread_block_until(uk_thread_current(), s->deadline);
+	uk_sched_yield();
+	s->woken = ukplat_monotonic_clock();
+	uk_sched_thread_exit();
+}
+
+static void wait_thread(struct uk_thread *t)
+{
+	while (!uk_thread_is_exited(t))
+		uk_sched_yield();
+}
+
+/* Sleeps with deadlines spread across several wheel levels and checks that
+ * nobody wakes up early or is lost.
+ */
+UK_TESTCASE(ukschedcoop, test_sleep_expiry)
+{
+	struct uk_sched *s = uk_sched_current();
+	struct sleeper sl[NR_SLEEPERS];
+	struct uk_thread *t[NR_SLEEPERS];
+	__snsec now = ukplat_monotonic_clock();
+	int i;
+
+	for (i = 0; i < NR_SLEEPERS; ++i) {
+		/* Scatter the creation order across the deadlines */
+		sl[i].deadline = now + SLEEP_STEP_NSEC
+				 * (((i * 13) % NR_SLEEPERS) + 1);
+		sl[i].woken = 0;
+		t[i] = uk_sched_thread_create(s, sleeper_fn, &sl[i], NULL);
+		UK_TEST_ASSERT(t[i] != NULL);
+	}
+
+	for (i = 0; i < NR_SLEEPERS; ++i)
+		wait_thread(t[i]);
+
+	for (i = 0; i < NR_SLEEPERS; ++i)
+		UK_TEST_EXPECT(sl[i].woken >= sl[i].deadline);
+}
+
+/* Wakes up and terminates threads before their timeout expired */
+UK_TESTCASE(ukschedcoop, test_sleep_cancel)
+{
+	struct uk_sched *s = uk_sched_current();
+	struct sleeper sl[2];
+	struct uk_thread *t[2];
+	__snsec now = ukplat_monotonic_clock();
+
+	sl[0].deadline = now + SLEEP_FAR_NSEC;
+	sl[0].woken = 0;
+	sl[1] = sl[0];
+
+	t[0] = uk_sched_thread_create(s, sleeper_fn, &sl[0], NULL);
+	UK_TEST_ASSERT(t[0] != NULL);
+	t[1] = uk_sched_thread_create(s, sleeper_fn, &sl[1], NULL);
+	UK_TEST_ASSERT(t[1] != NULL);
+
+	/* Let both threads block */
+	uk_sched_yield();
+	UK_TEST_EXPECT(!uk_thread_is_runnable(t[0]));
+	UK_TEST_EXPECT(!uk_thread_is_runnable(t[1]));
+
+	uk_thread_wake(t[0]);
+	wait_thread(t[0]);
+	UK_TEST_EXPECT(sl[0].woken > 0 && sl[0].woken < sl[0].deadline);
+
+	uk_thread_terminate(t[1]);
+	UK_TEST_EXPECT_ZERO(sl[1].woken);
+}
+
+uk_testsuite_register(ukschedcoop, NULL);
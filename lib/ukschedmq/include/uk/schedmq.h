@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * Non-preemptive (cooperative) Round Robin scheduler with one run queue per
+ * logical CPU.
+ */
+
+#ifndef __UK_SCHEDMQ_H__
+#define __UK_SCHEDMQ_H__
+
+#include <uk/sched.h>
+#include <uk/alloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a multi-queue scheduler instance. The boot LCPU is the first one
+ * that is driven by the scheduler; the remaining LCPUs are started with
+ * `uk_sched_start()`.
+ *
+ * @param a
+ *   Allocator for the scheduler, its idle threads, and new threads
+ * @param nr_lcpus
+ *   Number of logical CPUs to schedule on, including the boot LCPU.
+ *   0 selects all LCPUs present in the system.
+ * @return
+ *   Reference to the scheduler, or NULL on failure
+ */
+struct uk_sched *uk_schedmq_create(struct uk_alloc *a, unsigned int nr_lcpus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_SCHEDMQ_H__ */
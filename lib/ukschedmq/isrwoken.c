@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/arch/lcpu.h>
+#include "schedmq.h"
+
+/* Makes sure that a new runnable thread on `c` gets picked up: if `c` is
+ * halted, it is woken up. Otherwise, another halted LCPU is woken up so
+ * that it can steal the thread.
+ */
+void schedmq_kick(struct schedmq_lcpu *c __maybe_unused)
+{
+#ifdef CONFIG_HAVE_SMP
+	struct schedmq *mq = c->mq;
+	__lcpuidx idx = c->idx;
+	unsigned int num = 1;
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+	unsigned int i;
+#endif /* CONFIG_LIBUKSCHEDMQ_STEAL */
+
+	/* Pairs with the barrier in the idle loop between setting `halted`
+	 * and checking the run queue for the last time.
+	 */
+	mb();
+
+	if (c->idx == ukplat_lcpu_idx() || !c->halted) {
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+		for (i = 0; i < mq->nr_lcpus; ++i) {
+			if (mq->lcpu[i].halted && i != ukplat_lcpu_idx())
+				break;
+		}
+		if (i == mq->nr_lcpus)
+			return;
+		idx = i;
+#else /* !CONFIG_LIBUKSCHEDMQ_STEAL */
+		return;
+#endif /* !CONFIG_LIBUKSCHEDMQ_STEAL */
+	}
+
+	ukplat_lcpu_wakeup(&idx, &num);
+#endif /* CONFIG_HAVE_SMP */
+}
+
+/* Called with the thread locked */
+void schedmq_thread_woken_isr(struct uk_sched *s, struct uk_thread *t)
+{
+	struct schedmq_lcpu *c = schedmq_thread_lcpu(uksched2schedmq(s), t);
+
+	UK_ASSERT(ukplat_lcpu_irqs_disabled());
+
+	if (t->queue_slot < UK_SLEEPQ_NR_SLOTS)
+		schedmq_dequeue(c, t);
+	if (uk_thread_is_queueable(t) && uk_thread_is_runnable(t)
+	    && t->queue_slot != SCHEDMQ_SLOT_RUNQ) {
+		schedmq_runq_add(c, t);
+		uk_thread_clear_queueable(t);
+
+		/* Sending the wakeup IPI does not need the lock */
+		schedmq_kick(c);
+	}
+}
@@ -0,0 +1,591 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+/*
+ * The scheduler is non-preemptive (cooperative) and schedules according to
+ * the Round Robin algorithm. In contrast to ukschedcoop, every logical CPU
+ * has its own run queue and sleep queue, protected by a per-LCPU lock.
+ * A thread stays on the LCPU it was last queued on. Idle LCPUs steal
+ * threads from the run queues of busy LCPUs.
+ */
+#include <string.h>
+#include <uk/arch/lcpu.h>
+#include <uk/plat/config.h>
+#include <uk/plat/lcpu.h>
+#include <uk/plat/memory.h>
+#include <uk/plat/time.h>
+#include <uk/plat/tls.h>
+#include <uk/sched_impl.h>
+#include <uk/schedmq.h>
+#include <uk/essentials.h>
+#include <uk/trace.h>
+#include "schedmq.h"
+
+UK_TRACEPOINT(trace_ukschedmq_switch, "%p (%s) -> %p (%s)",
+	      void *, const char *, void *, const char *);
+
+#ifdef CONFIG_HAVE_SMP
+/* Size of the stack that secondary LCPUs use until they switch to their
+ * idle thread
+ */
+#define SCHEDMQ_LCPU_BOOTSTACK_SIZE	__PAGE_SIZE
+
+static struct schedmq *schedmq_smp;
+#endif /* CONFIG_HAVE_SMP */
+
+static void schedmq_thread_expired(struct uk_thread *t, void *argp)
+{
+	struct schedmq_lcpu *c = (struct schedmq_lcpu *)argp;
+
+	/* The thread was already dequeued from the sleep queue. We are
+	 * holding the LCPU lock, so we cannot go through uk_thread_wake().
+	 */
+	t->queue_slot = SCHEDMQ_SLOT_NONE;
+	t->wakeup_time = 0LL;
+	uk_thread_set_runnable(t);
+	if (uk_thread_is_queueable(t)) {
+		schedmq_runq_add(c, t);
+		uk_thread_clear_queueable(t);
+	}
+}
+
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+/* Takes a thread from the run queue of another LCPU. We do not wait for
+ * locks of other LCPUs: a victim whose lock is contended is busy with
+ * scheduling and is skipped, which also avoids lock ordering issues since
+ * we are holding our own lock already.
+ */
+static struct uk_thread *schedmq_steal(struct schedmq_lcpu *c)
+{
+	struct schedmq *mq = c->mq;
+	struct schedmq_lcpu *v;
+	struct uk_thread *t = NULL;
+	unsigned int i;
+
+	for (i = 1; i < mq->nr_lcpus; ++i) {
+		v = &mq->lcpu[(c->idx + i) % mq->nr_lcpus];
+		if (!v->nr_queued)
+			continue;
+		if (!ukarch_spin_trylock(&v->lock))
+			continue;
+
+		/* Take from the tail where the threads with the coldest
+		 * caches are queued
+		 */
+		t = UK_TAILQ_LAST(&v->run_queue, uk_thread_list);
+		if (t && t == v->switching)
+			t = UK_TAILQ_PREV(t, uk_thread_list, queue);
+		if (t) {
+			schedmq_runq_del(v, t);
+
+			/* Re-assign while the victim is still locked so that
+			 * schedmq_lock_thread() callers follow the thread.
+			 */
+			t->lcpu = c->idx;
+		}
+		ukarch_spin_unlock(&v->lock);
+
+		if (t)
+			break;
+	}
+
+	return t;
+}
+#endif /* CONFIG_LIBUKSCHEDMQ_STEAL */
+
+#ifdef CONFIG_HAVE_SMP
+/* Only the boot LCPU receives timer interrupts on all platforms. It arms its
+ * timer for the earliest deadline of all halted LCPUs and wakes up the LCPUs
+ * whose sleeping threads timed out whenever it schedules.
+ */
+static __nsec schedmq_timer_next(struct schedmq *mq)
+{
+	__nsec next = 0, t;
+	unsigned int i;
+
+	for (i = 0; i < mq->nr_lcpus; ++i) {
+		if (i > 0 && !mq->lcpu[i].halted)
+			continue;
+
+		t = (volatile __nsec)mq->lcpu[i].idle_return_time;
+		if (t && (!next || t < next))
+			next = t;
+	}
+
+	return next;
+}
+
+/* Called by a halting secondary LCPU. If the boot LCPU scanned the deadlines
+ * before we announced that we halt, it must see ours: the barrier after
+ * setting `halted` makes sure that we then see it halted. Its timer is reset
+ * to 0 before it clears `halted`, so a deadline that it did not arm yet reads
+ * as none.
+ */
+static void schedmq_timer_kick(struct schedmq *mq, __nsec deadline)
+{
+	__nsec armed = mq->timer_armed;
+	__lcpuidx idx = 0;
+	unsigned int num = 1;
+
+	if (mq->lcpu[0].halted && (!armed || deadline < armed))
+		ukplat_lcpu_wakeup(&idx, &num);
+}
+
+static void schedmq_timer_broadcast(struct schedmq *mq, __nsec now)
+{
+	struct schedmq_lcpu *v;
+	__lcpuidx idx;
+	unsigned int i, num;
+	__nsec t;
+
+	for (i = 1; i < mq->nr_lcpus; ++i) {
+		v = &mq->lcpu[i];
+		t = (volatile __nsec)v->idle_return_time;
+		if (v->halted && t && t <= now) {
+			idx = i;
+			num = 1;
+			ukplat_lcpu_wakeup(&idx, &num);
+		}
+	}
+}
+#endif /* CONFIG_HAVE_SMP */
+
+static void schedmq_schedule(struct uk_sched *s)
+{
+	struct schedmq *mq = uksched2schedmq(s);
+	struct schedmq_lcpu *c;
+	struct uk_thread *prev, *next;
+	__snsec now;
+	unsigned long flags;
+	bool prev_runnable;
+
+	if (unlikely(ukplat_lcpu_irqs_disabled()))
+		UK_CRASH("Must not call %s with IRQs disabled\n", __func__);
+
+	now = ukplat_monotonic_clock();
+	prev = uk_thread_current();
+	flags = ukplat_lcpu_save_irqf();
+	c = schedmq_lcpu_current(mq);
+
+	/* Update execution time of current thread */
+	prev->exec_time += now - c->ts_prev_switch;
+	c->ts_prev_switch = now;
+
+	ukarch_spin_lock(&c->lock);
+
+	/* The previous switch on this LCPU is complete */
+	c->switching = NULL;
+
+	/* Wake up sleeping threads whose timeout expired */
+	uk_sched_sleepq_expire(&c->sleep_queue, now,
+			       schedmq_thread_expired, c);
+
+	prev_runnable = (prev != &c->idle)
+			&& uk_thread_is_runnable(prev)
+			&& !uk_thread_is_exited(prev);
+
+	next = UK_TAILQ_FIRST(&c->run_queue);
+	if (next)
+		schedmq_runq_del(c, next);
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+	else if (!prev_runnable)
+		next = schedmq_steal(c);
+#endif /* CONFIG_LIBUKSCHEDMQ_STEAL */
+
+	if (next) {
+		UK_ASSERT(next != prev);
+		UK_ASSERT(uk_thread_is_runnable(next));
+		UK_ASSERT(!uk_thread_is_exited(next));
+
+		/* Put previous thread on the end of the list */
+		if (prev_runnable)
+			schedmq_runq_add(c, prev);
+	} else if (prev_runnable) {
+		next = prev;
+	} else {
+		/*
+		 * Schedule idle thread that will halt the CPU
+		 * We select the idle thread only if we do not have anything
+		 * else to execute
+		 */
+		c->idle_return_time = uk_sched_sleepq_next(&c->sleep_queue);
+		next = &c->idle;
+	}
+
+	if (next != prev) {
+		/*
+		 * Queueable is used to cover the case when during a
+		 * context switch, the thread that is about to be
+		 * evacuated is interrupted and woken up.
+		 */
+		uk_thread_set_queueable(prev);
+		uk_thread_clear_queueable(next);
+
+		/* The previous thread can be queued again by a wakeup on
+		 * another LCPU as soon as we drop the lock, even if it just
+		 * blocked. Keep it from being stolen until its context is
+		 * saved.
+		 */
+		c->switching = prev;
+	}
+
+	ukarch_spin_unlock(&c->lock);
+
+	/* There is more work than this LCPU can do right now: let a halted
+	 * LCPU steal it
+	 */
+	if (c->nr_queued > 0 && next != &c->idle)
+		schedmq_kick(c);
+
+#ifdef CONFIG_HAVE_SMP
+	if (c->idx == 0)
+		schedmq_timer_broadcast(mq, now);
+#endif /* CONFIG_HAVE_SMP */
+
+	ukplat_lcpu_restore_irqf(flags);
+
+	/* Interrupting the switch is equivalent to having the next thread
+	 * interrupted at the return instruction. And therefore at safe point.
+	 */
+	if (prev != next) {
+		trace_ukschedmq_switch(prev, prev->name ? prev->name : "",
+				       next, next->name ? next->name : "");
+		uk_sched_thread_switch(next);
+	}
+}
+
+static int schedmq_thread_add(struct uk_sched *s, struct uk_thread *t)
+{
+	struct schedmq *mq = uksched2schedmq(s);
+	struct schedmq_lcpu *c;
+	unsigned long flags;
+	bool queued = false;
+
+	UK_ASSERT(t);
+	UK_ASSERT(!uk_thread_is_exited(t));
+
+	/* New threads start on the LCPU that created them */
+	flags = ukplat_lcpu_save_irqf();
+	c = schedmq_lcpu_current(mq);
+	ukarch_spin_lock(&c->lock);
+	t->lcpu = c->idx;
+	t->queue_slot = SCHEDMQ_SLOT_NONE;
+
+	/* Add to run queue if runnable */
+	if (uk_thread_is_runnable(t)) {
+		schedmq_runq_add(c, t);
+		queued = true;
+	}
+	ukarch_spin_unlock(&c->lock);
+
+	if (queued)
+		schedmq_kick(c);
+	ukplat_lcpu_restore_irqf(flags);
+
+	return 0;
+}
+
+static void schedmq_thread_remove(struct uk_sched *s, struct uk_thread *t)
+{
+	struct schedmq *mq = uksched2schedmq(s);
+	struct schedmq_lcpu *c;
+	unsigned long flags;
+
+	/* Remove from run queue or sleep queue */
+	flags = ukplat_lcpu_save_irqf();
+	c = schedmq_lock_thread(mq, t);
+	schedmq_dequeue(c, t);
+	ukarch_spin_unlock(&c->lock);
+	ukplat_lcpu_restore_irqf(flags);
+}
+
+static void schedmq_thread_lock(struct uk_sched *s, struct uk_thread *t)
+{
+	UK_ASSERT(ukplat_lcpu_irqs_disabled());
+
+	schedmq_lock_thread(uksched2schedmq(s), t);
+}
+
+static void schedmq_thread_unlock(struct uk_sched *s, struct uk_thread *t)
+{
+	ukarch_spin_unlock(&schedmq_thread_lcpu(uksched2schedmq(s), t)->lock);
+}
+
+/* Called with the thread locked */
+static void schedmq_thread_blocked(struct uk_sched *s, struct uk_thread *t)
+{
+	struct schedmq_lcpu *c = schedmq_thread_lcpu(uksched2schedmq(s), t);
+
+	UK_ASSERT(ukplat_lcpu_irqs_disabled());
+
+	if (t->queue_slot == SCHEDMQ_SLOT_RUNQ)
+		schedmq_runq_del(c, t);
+	if (t->wakeup_time > 0 && t->queue_slot == SCHEDMQ_SLOT_NONE)
+		uk_sched_sleepq_add(&c->sleep_queue, t);
+}
+
+static __noreturn void idle_thread_fn(void *argp)
+{
+	struct schedmq_lcpu *c = (struct schedmq_lcpu *)argp;
+	struct schedmq *mq;
+	__nsec now, wake_up_time;
+	unsigned long flags;
+	bool work;
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+	unsigned int i;
+#endif /* CONFIG_LIBUKSCHEDMQ_STEAL */
+
+	UK_ASSERT(c);
+	mq = c->mq;
+
+	for (;;) {
+		flags = ukplat_lcpu_save_irqf();
+
+		/*
+		 * NOTE: This idle thread must be non-blocking so that the
+		 *       scheduler has always something to schedule.
+		 */
+		if (uk_sched_thread_gc(&mq->sched) > 0 || c->nr_queued) {
+			ukplat_lcpu_restore_irqf(flags);
+			schedmq_schedule(&mq->sched);
+
+			continue;
+		}
+
+		/* Announce that we are going to halt and check one last time
+		 * for new work. schedmq_kick() pairs with the barrier.
+		 */
+		c->halted = 1;
+		mb();
+		work = c->nr_queued > 0;
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+		for (i = 0; i < mq->nr_lcpus && !work; ++i)
+			work = mq->lcpu[i].nr_queued > 0;
+#endif /* CONFIG_LIBUKSCHEDMQ_STEAL */
+
+		/* Read return time set by last schedule operation */
+		wake_up_time = (volatile __nsec)c->idle_return_time;
+#ifdef CONFIG_HAVE_SMP
+		if (c->idx == 0) {
+			wake_up_time = schedmq_timer_next(mq);
+			mq->timer_armed = wake_up_time;
+		}
+#endif /* CONFIG_HAVE_SMP */
+		now = ukplat_monotonic_clock();
+
+		if (!work && (!wake_up_time || wake_up_time > now)) {
+#ifdef CONFIG_HAVE_SMP
+			if (wake_up_time && c->idx != 0)
+				schedmq_timer_kick(mq, wake_up_time);
+#endif /* CONFIG_HAVE_SMP */
+			if (wake_up_time && c->idx == 0)
+				ukplat_lcpu_halt_irq_until(wake_up_time);
+			else
+				ukplat_lcpu_halt_irq();
+
+			/* handle pending events if any */
+			ukplat_lcpu_irqs_handle_pending();
+		}
+#ifdef CONFIG_HAVE_SMP
+		if (c->idx == 0)
+			mq->timer_armed = 0;
+#endif /* CONFIG_HAVE_SMP */
+		c->halted = 0;
+
+#ifdef CONFIG_HAVE_SMP
+		if (c->idx == 0)
+			schedmq_timer_broadcast(mq, ukplat_monotonic_clock());
+#endif /* CONFIG_HAVE_SMP */
+
+		ukplat_lcpu_restore_irqf(flags);
+
+		/* try to schedule a thread that might now be available */
+		schedmq_schedule(&mq->sched);
+	}
+}
+
+#ifdef CONFIG_HAVE_SMP
+static void __noreturn schedmq_lcpu_entry(void)
+{
+	struct schedmq_lcpu *c = schedmq_lcpu_current(schedmq_smp);
+	struct ukarch_ctx boot_ctx;
+
+	/* Enter the idle thread of this LCPU. We never return to the boot
+	 * context, so its stack is simply abandoned.
+	 */
+	c->ts_prev_switch = ukplat_monotonic_clock();
+	ukplat_per_lcpu_current(__uk_sched_thread_current) = &c->idle;
+	ukplat_tlsp_set(c->idle.tlsp);
+	if (c->idle.ectx)
+		ukarch_ectx_load(c->idle.ectx);
+	ukplat_lcpu_set_auxsp(c->idle.auxsp);
+
+	ukplat_lcpu_enable_irq();
+	ukarch_ctx_switch(&boot_ctx, &c->idle.ctx);
+
+	UK_CRASH("LCPU %u returned to boot context\n", c->idx);
+}
+
+static int schedmq_lcpu_start(struct schedmq *mq)
+{
+	__lcpuidx lcpuidx[CONFIG_UKPLAT_LCPU_MAXCOUNT];
+	ukplat_lcpu_entry_t entry[CONFIG_UKPLAT_LCPU_MAXCOUNT];
+	void *sp[CONFIG_UKPLAT_LCPU_MAXCOUNT];
+	unsigned int i, num;
+	void *stack;
+	int rc;
+
+	if (mq->nr_lcpus < 2)
+		return 0;
+
+	schedmq_smp = mq;
+	for (i = 1; i < mq->nr_lcpus; ++i) {
+		stack = uk_malloc(mq->sched.a, SCHEDMQ_LCPU_BOOTSTACK_SIZE);
+		if (unlikely(!stack)) {
+			mq->nr_lcpus = i;
+			break;
+		}
+
+		lcpuidx[i - 1] = i;
+		entry[i - 1] = schedmq_lcpu_entry;
+		sp[i - 1] = (void *)ukarch_gen_sp((__uptr)stack,
+						  SCHEDMQ_LCPU_BOOTSTACK_SIZE);
+	}
+
+	num = mq->nr_lcpus - 1;
+	rc = ukplat_lcpu_start(lcpuidx, &num, sp, entry, 0);
+	if (unlikely(rc)) {
+		uk_pr_err("Failed to start LCPUs: %d. Continuing with %u LCPUs\n",
+			  rc, num + 1);
+
+		/* The started LCPUs are at the beginning of the list */
+		mq->nr_lcpus = num + 1;
+	}
+
+	return 0;
+}
+#endif /* CONFIG_HAVE_SMP */
+
+static int schedmq_start(struct uk_sched *s, struct uk_thread *main_thread)
+{
+	struct schedmq *mq = uksched2schedmq(s);
+	struct schedmq_lcpu *c = schedmq_lcpu_current(mq);
+	int rc = 0;
+
+	UK_ASSERT(main_thread);
+	UK_ASSERT(main_thread->sched == s);
+	UK_ASSERT(uk_thread_is_runnable(main_thread));
+	UK_ASSERT(!uk_thread_is_exited(main_thread));
+	UK_ASSERT(uk_thread_current() == main_thread);
+
+	main_thread->lcpu = c->idx;
+	main_thread->queue_slot = SCHEDMQ_SLOT_NONE;
+
+	/* Since we are now starting to schedule, we save the current timestamp
+	 * as the start time for the first time slice.
+	 */
+	c->ts_prev_switch = ukplat_monotonic_clock();
+
+#ifdef CONFIG_HAVE_SMP
+	rc = schedmq_lcpu_start(mq);
+	if (unlikely(rc < 0))
+		return rc;
+#endif /* CONFIG_HAVE_SMP */
+
+	ukplat_lcpu_enable_irq();
+
+	return rc;
+}
+
+static const struct uk_thread *schedmq_idle_thread(struct uk_sched *s,
+						   unsigned int proc_id)
+{
+	struct schedmq *mq = uksched2schedmq(s);
+
+	if (proc_id >= mq->nr_lcpus)
+		return NULL;
+
+	return &mq->lcpu[proc_id].idle;
+}
+
+struct uk_sched *uk_schedmq_create(struct uk_alloc *a, unsigned int nr_lcpus)
+{
+	struct schedmq *mq = NULL;
+	struct schedmq_lcpu *c;
+	unsigned int i;
+	int rc;
+
+	if (!nr_lcpus || nr_lcpus > ukplat_lcpu_count())
+		nr_lcpus = ukplat_lcpu_count();
+
+	uk_pr_info("Initializing multi-queue scheduler on %u LCPUs\n",
+		   nr_lcpus);
+	mq = uk_zalloc(a, sizeof(struct schedmq));
+	if (!mq)
+		goto err_out;
+
+	mq->lcpu = uk_memalign(a, CACHE_LINE_SIZE,
+			       nr_lcpus * sizeof(struct schedmq_lcpu));
+	if (!mq->lcpu)
+		goto err_free_mq;
+	memset(mq->lcpu, 0, nr_lcpus * sizeof(struct schedmq_lcpu));
+	mq->nr_lcpus = nr_lcpus;
+
+	for (i = 0; i < nr_lcpus; ++i) {
+		c = &mq->lcpu[i];
+		ukarch_spin_init(&c->lock);
+		UK_TAILQ_INIT(&c->run_queue);
+		uk_sched_sleepq_init(&c->sleep_queue,
+				     ukplat_monotonic_clock());
+		c->mq = mq;
+		c->idx = i;
+
+		/* Create idle thread */
+		rc = uk_thread_init_fn1(&c->idle,
+					idle_thread_fn, (void *)c,
+					a, STACK_SIZE,
+					a, 0,  /* Default auxiliary stack size */
+					a, false,
+					NULL,
+					"idle",
+					NULL,
+					NULL);
+		if (rc < 0)
+			goto err_free_idle;
+
+		c->idle.sched = &mq->sched;
+		c->idle.lcpu = i;
+		c->idle.queue_slot = SCHEDMQ_SLOT_NONE;
+	}
+
+	uk_sched_init(&mq->sched,
+			schedmq_start,
+			schedmq_schedule,
+			schedmq_thread_add,
+			schedmq_thread_remove,
+			schedmq_thread_blocked,
+			schedmq_thread_woken_isr,
+			schedmq_thread_woken_isr,
+			schedmq_idle_thread,
+			a);
+	mq->sched.thread_lock = schedmq_thread_lock;
+	mq->sched.thread_unlock = schedmq_thread_unlock;
+
+	/* Add idle threads to the scheduler's thread list */
+	for (i = 0; i < nr_lcpus; ++i)
+		UK_TAILQ_INSERT_TAIL(&mq->sched.thread_list,
+				     &mq->lcpu[i].idle, thread_list);
+
+	return &mq->sched;
+
+err_free_idle:
+	while (i-- > 0)
+		uk_thread_release(&mq->lcpu[i].idle);
+	uk_free(a, mq->lcpu);
+err_free_mq:
+	uk_free(a, mq);
+err_out:
+	return NULL;
+}
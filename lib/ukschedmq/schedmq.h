@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#ifndef __UK_SCHEDMQ_SCHEDMQ_H__
+#define __UK_SCHEDMQ_SCHEDMQ_H__
+
+#include <uk/schedmq.h>
+#include <uk/sched_sleepq.h>
+#include <uk/arch/spinlock.h>
+#include <uk/plat/lcpu.h>
+#include <uk/essentials.h>
+
+/* `queue_slot` values used in addition to the sleep queue slots */
+#define SCHEDMQ_SLOT_NONE	(UK_SLEEPQ_NR_SLOTS)
+#define SCHEDMQ_SLOT_RUNQ	(UK_SLEEPQ_NR_SLOTS + 1)
+
+struct schedmq;
+
+/* Scheduling state of a single logical CPU. Remote LCPUs access it only
+ * while holding `lock`, except for `nr_queued` and `halted` which are
+ * polled without the lock to find work or LCPUs that need a wakeup.
+ */
+struct schedmq_lcpu {
+	__spinlock lock;
+	struct uk_thread_list run_queue;
+	volatile unsigned int nr_queued;
+	struct uk_sched_sleepq sleep_queue;
+
+	/* Thread that is being switched away from and whose context is not
+	 * saved yet. It must not be taken over by another LCPU, even if it
+	 * was put back to the run queue or woken up in the meantime.
+	 */
+	struct uk_thread *switching;
+	volatile int halted;
+
+	struct uk_thread idle;
+	__nsec idle_return_time;
+	__nsec ts_prev_switch;
+
+	struct schedmq *mq;
+	__lcpuidx idx;
+} __align(CACHE_LINE_SIZE);
+
+struct schedmq {
+	struct uk_sched sched;
+	unsigned int nr_lcpus;
+	struct schedmq_lcpu *lcpu;
+	/* Time until which the boot LCPU halts, 0 if it has no deadline */
+	volatile __nsec timer_armed;
+};
+
+static inline struct schedmq *uksched2schedmq(struct uk_sched *s)
+{
+	UK_ASSERT(s);
+
+	return __containerof(s, struct schedmq, sched);
+}
+
+static inline struct schedmq_lcpu *schedmq_lcpu_current(struct schedmq *mq)
+{
+	UK_ASSERT(ukplat_lcpu_idx() < mq->nr_lcpus);
+
+	return &mq->lcpu[ukplat_lcpu_idx()];
+}
+
+/* Returns the LCPU that the thread is assigned to. The assignment is only
+ * stable while the thread is locked.
+ */
+static inline struct schedmq_lcpu *schedmq_thread_lcpu(struct schedmq *mq,
+						       struct uk_thread *t)
+{
+	UK_ASSERT(t->lcpu < mq->nr_lcpus);
+
+	return &mq->lcpu[t->lcpu];
+}
+
+/* Locks the LCPU that the thread is assigned to. The assignment can only
+ * change while the old LCPU is locked, so we retry if the thread was
+ * migrated while we were waiting for the lock.
+ */
+static inline struct schedmq_lcpu *schedmq_lock_thread(struct schedmq *mq,
+						       struct uk_thread *t)
+{
+	struct schedmq_lcpu *c;
+
+	for (;;) {
+		c = &mq->lcpu[*(volatile __u32 *)&t->lcpu];
+		ukarch_spin_lock(&c->lock);
+		if (likely(t->lcpu == c->idx))
+			return c;
+		ukarch_spin_unlock(&c->lock);
+	}
+}
+
+static inline void schedmq_runq_add(struct schedmq_lcpu *c,
+				    struct uk_thread *t)
+{
+	UK_ASSERT(t->queue_slot == SCHEDMQ_SLOT_NONE);
+
+	UK_TAILQ_INSERT_TAIL(&c->run_queue, t, queue);
+	t->queue_slot = SCHEDMQ_SLOT_RUNQ;
+	t->lcpu = c->idx;
+	c->nr_queued++;
+}
+
+static inline void schedmq_runq_del(struct schedmq_lcpu *c,
+				    struct uk_thread *t)
+{
+	UK_ASSERT(t->queue_slot == SCHEDMQ_SLOT_RUNQ);
+	UK_ASSERT(c->nr_queued > 0);
+
+	UK_TAILQ_REMOVE(&c->run_queue, t, queue);
+	t->queue_slot = SCHEDMQ_SLOT_NONE;
+	c->nr_queued--;
+}
+
+/* Takes the thread off the run queue or sleep queue of its LCPU */
+static inline void schedmq_dequeue(struct schedmq_lcpu *c,
+				   struct uk_thread *t)
+{
+	if (t->queue_slot == SCHEDMQ_SLOT_RUNQ) {
+		schedmq_runq_del(c, t);
+	} else if (t->queue_slot < UK_SLEEPQ_NR_SLOTS) {
+		uk_sched_sleepq_remove(&c->sleep_queue, t);
+		t->queue_slot = SCHEDMQ_SLOT_NONE;
+	}
+}
+
+void schedmq_kick(struct schedmq_lcpu *c);
+void schedmq_thread_woken_isr(struct uk_sched *s, struct uk_thread *t);
+
+#endif /* __UK_SCHEDMQ_SCHEDMQ_H__ */
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/test.h>
+#include <uk/atomic.h>
+#include <uk/sched.h>
+#include <uk/thread.h>
+#include <uk/wait.h>
+#include <uk/plat/lcpu.h>
+#include <uk/plat/time.h>
+
+#define NR_WORKERS		8
+#define NR_ROUNDS		1000
+#define TEST_TIMEOUT_NSEC	ukarch_time_sec_to_nsec(10)
+#define SPIN_NSEC		ukarch_time_msec_to_nsec(50)
+
+static __maybe_unused unsigned int nr_sched_lcpus(struct uk_sched *s)
+{
+	unsigned int n = 0;
+
+	while (uk_sched_idle_thread(s, n))
+		n++;
+	return n;
+}
+
+static void wait_thread(struct uk_thread *t)
+{
+	while (!uk_thread_is_exited(t))
+		uk_sched_yield();
+}
+
+struct pingpong {
+	struct uk_waitq wq;
+	volatile unsigned long seq;
+	volatile unsigned long ack;
+	volatile int stop;
+	struct uk_thread *t;
+};
+
+static unsigned long remote_wakeups;
+
+static __noreturn void pingpong_fn(void *argp)
+{
+	struct pingpong *pp = (struct pingpong *)argp;
+	unsigned long seen = 0;
+
+	for (;;) {
+		uk_waitq_wait_event(&pp->wq, pp->seq != seen || pp->stop);
+		if (pp->stop)
+			break;
+
+		seen = pp->seq;
+		pp->ack = seen;
+	}
+	uk_sched_thread_exit();
+}
+
+/* Wakes up blocked threads that are scheduled on other LCPUs and checks that
+ * no wakeup is lost. Workers that are woken up while their previous LCPU is
+ * still switching away from them must neither run twice nor get lost.
+ */
+UK_TESTCASE(ukschedmq, test_wake_remote)
+{
+	struct uk_sched *s = uk_sched_current();
+	struct pingpong pp[NR_WORKERS];
+	__nsec deadline;
+	unsigned long r;
+	int i;
+
+	remote_wakeups = 0;
+	for (i = 0; i < NR_WORKERS; ++i) {
+		uk_waitq_init(&pp[i].wq);
+		pp[i].seq = 0;
+		pp[i].ack = 0;
+		pp[i].stop = 0;
+		pp[i].t = uk_sched_thread_create(s, pingpong_fn, &pp[i], NULL);
+		UK_TEST_ASSERT(pp[i].t != NULL);
+	}
+
+	deadline = ukplat_monotonic_clock() + TEST_TIMEOUT_NSEC;
+	for (r = 1; r <= NR_ROUNDS; ++r) {
+		for (i = 0; i < NR_WORKERS; ++i) {
+			if (pp[i].t->lcpu != ukplat_lcpu_idx())
+				uk_inc(&remote_wakeups);
+			pp[i].seq = r;
+			uk_waitq_wake_up(&pp[i].wq);
+		}
+
+		for (i = 0; i < NR_WORKERS; ++i) {
+			while (pp[i].ack != r &&
+			       ukplat_monotonic_clock() < deadline)
+				uk_sched_yield();
+			if (pp[i].ack != r)
+				break;
+		}
+		if (i < NR_WORKERS)
+			break;
+	}
+	UK_TEST_EXPECT_SNUM_EQ(r, NR_ROUNDS + 1);
+
+	for (i = 0; i < NR_WORKERS; ++i) {
+		pp[i].stop = 1;
+		uk_waitq_wake_up(&pp[i].wq);
+	}
+	for (i = 0; i < NR_WORKERS; ++i)
+		wait_thread(pp[i].t);
+
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+	/* The workers are created on this LCPU and only get to the others
+	 * by being stolen
+	 */
+	if (nr_sched_lcpus(s) > 1)
+		UK_TEST_EXPECT_SNUM_GT(remote_wakeups, 0);
+#endif /* CONFIG_LIBUKSCHEDMQ_STEAL */
+}
+
+static unsigned long spinner_lcpus;
+
+static __noreturn void spinner_fn(void *argp __unused)
+{
+	__nsec end = ukplat_monotonic_clock() + SPIN_NSEC;
+
+	while (ukplat_monotonic_clock() < end) {
+		uk_or(&spinner_lcpus, 1UL << ukplat_lcpu_idx());
+		uk_sched_yield();
+	}
+	uk_sched_thread_exit();
+}
+
+/* Creates more runnable threads than one LCPU can run and checks that idle
+ * LCPUs take them over
+ */
+UK_TESTCASE(ukschedmq, test_steal)
+{
+	struct uk_sched *s = uk_sched_current();
+	struct uk_thread *t[NR_WORKERS];
+	int i;
+
+	spinner_lcpus = 0;
+	for (i = 0; i < NR_WORKERS; ++i) {
+		t[i] = uk_sched_thread_create(s, spinner_fn, NULL, NULL);
+		UK_TEST_ASSERT(t[i] != NULL);
+	}
+
+	for (i = 0; i < NR_WORKERS; ++i)
+		wait_thread(t[i]);
+
+	UK_TEST_EXPECT_NOT_ZERO(spinner_lcpus);
+#if CONFIG_LIBUKSCHEDMQ_STEAL
+	if (nr_sched_lcpus(s) > 1)
+		UK_TEST_EXPECT_SNUM_GT(__builtin_popcountl(spinner_lcpus), 1);
+#else /* !CONFIG_LIBUKSCHEDMQ_STEAL */
+	/* Without stealing, threads stay on the LCPU that created them */
+	UK_TEST_EXPECT_SNUM_EQ(spinner_lcpus, 1UL << ukplat_lcpu_idx());
+#endif /* !CONFIG_LIBUKSCHEDMQ_STEAL */
+}
+
+uk_testsuite_register(ukschedmq, NULL);
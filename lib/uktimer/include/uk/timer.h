@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __UK_TIMER_H__
+#define __UK_TIMER_H__
+
+#include <uk/arch/time.h>
+#include <uk/essentials.h>
+#include <uk/list.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Kernel timers
+ *
+ * A timer calls a function once the monotonic clock reaches its expiry time.
+ * Timers are kept on a timer wheel of the LCPU on which they were armed. Each
+ * wheel is serviced by a timer thread that sleeps until the next expiry, so
+ * any number of timers shares a single thread and stack per LCPU.
+ *
+ * Timer functions run in the context of the timer thread, one after another.
+ * They must not block and should be short, as they delay the other timers of
+ * the LCPU. A timer function may re-arm its own timer, e.g., to implement a
+ * periodic timer.
+ *
+ * Arming and disarming the same timer must be serialized by the caller. The
+ * timer function of the timer may run concurrently to this, though. Timers
+ * cannot be armed or disarmed from interrupt context.
+ */
+
+struct uk_timer;
+
+typedef void (*uk_timer_func_t)(struct uk_timer *t, void *argp);
+
+struct uk_timer {
+	__nsec expires;			/* Monotonic expiry time */
+	uk_timer_func_t func;
+	void *argp;
+
+	/* Internal */
+	struct uk_list_head link;
+	void *base;			/* Wheel the timer was last armed on */
+	unsigned int slot;
+	void *runner;			/* Thread running `func` */
+};
+
+#define UK_TIMER_INITIALIZER(func_, argp_)				\
+	((struct uk_timer){ .expires = 0, .func = (func_),		\
+			    .argp = (argp_), .base = __NULL,		\
+			    .slot = ~0U, .runner = __NULL })
+
+static inline void uk_timer_init(struct uk_timer *t, uk_timer_func_t func,
+				 void *argp)
+{
+	*t = UK_TIMER_INITIALIZER(func, argp);
+}
+
+/**
+ * Arms a timer on the wheel of the current LCPU. A pending timer is moved to
+ * the new expiry time.
+ *
+ * @param t
+ *   Timer to arm
+ * @param expires
+ *   Expiry time in nanoseconds of the monotonic clock. If the time is in the
+ *   past, the timer expires as soon as possible.
+ * @return
+ *   0 on success, -ENOMEM if the timer thread of the LCPU could not be
+ *   created
+ */
+int uk_timer_arm(struct uk_timer *t, __nsec expires);
+
+/**
+ * Disarms a timer. If the timer function is currently running, waits until
+ * it returned, unless called from the timer function itself. Afterwards, the
+ * timer may be freed.
+ *
+ * @param t
+ *   Timer to disarm
+ * @return
+ *   1 if the timer was pending, 0 otherwise
+ */
+int uk_timer_disarm(struct uk_timer *t);
+
+/**
+ * Returns whether a timer is armed and did not expire yet. The result is
+ * only a snapshot if the timer function runs concurrently.
+ */
+static inline int uk_timer_pending(const struct uk_timer *t)
+{
+	return t->slot != ~0U;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UK_TIMER_H__ */
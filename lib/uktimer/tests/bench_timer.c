@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/test.h>
+#include <uk/timer.h>
+#include <uk/plat/time.h>
+
+#define BENCH_NR_TIMERS		4096
+
+#define MSEC(ms)		((__nsec)(ms) * 1000000UL)
+
+static void bench_timer_fn(struct uk_timer *t __unused, void *argp __unused)
+{
+}
+
+static __u32 lcg_next(__u32 *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+UK_TESTCASE(uktimer_bench, bench_timer)
+{
+	static struct uk_timer t[BENCH_NR_TIMERS];
+	__nsec now, t_arm, t_disarm;
+	__u32 seed = 7;
+	unsigned int i;
+
+	/* Random expiry times on all levels of the wheel */
+	now = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_NR_TIMERS; i++)
+		uk_timer_init(&t[i], bench_timer_fn, NULL);
+	t_arm = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_NR_TIMERS; i++)
+		uk_timer_arm(&t[i],
+			     now + MSEC(1000 + lcg_next(&seed) % 1000000));
+	t_arm = ukplat_monotonic_clock() - t_arm;
+	t_disarm = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_NR_TIMERS; i++)
+		uk_timer_disarm(&t[i]);
+	t_disarm = ukplat_monotonic_clock() - t_disarm;
+	uk_pr_info("%u timers: arm %"__PRIu64" ns, disarm %"__PRIu64" ns per timer\n",
+		   BENCH_NR_TIMERS, t_arm / BENCH_NR_TIMERS,
+		   t_disarm / BENCH_NR_TIMERS);
+}
+
+uk_testsuite_register(uktimer_bench, NULL);
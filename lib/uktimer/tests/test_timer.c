@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <uk/test.h>
+#include <uk/timer.h>
+#include <uk/sched.h>
+#include <uk/plat/time.h>
+
+#define NR_ORDER		8
+#define NR_PERIODS		5
+#define NR_MANY			4096
+
+#define MSEC(ms)		((__nsec)(ms) * 1000000UL)
+
+struct test_timer {
+	struct uk_timer t;
+	unsigned int fired;
+	int early;		/* Fired before the expiry time */
+	unsigned int seq;	/* Position in the firing order */
+};
+
+static unsigned int fire_seq;
+
+static void test_timer_fn(struct uk_timer *t, void *argp __unused)
+{
+	struct test_timer *tt = __containerof(t, struct test_timer, t);
+
+	tt->early |= ukplat_monotonic_clock() < t->expires;
+	tt->seq = fire_seq++;
+	tt->fired++;
+}
+
+static void test_timer_setup(struct test_timer *tt)
+{
+	uk_timer_init(&tt->t, test_timer_fn, NULL);
+	tt->fired = 0;
+	tt->early = 0;
+	tt->seq = 0;
+}
+
+UK_TESTCASE(uktimer, test_timer_order)
+{
+	static struct test_timer tt[NR_ORDER];
+	__nsec now = ukplat_monotonic_clock();
+	unsigned int i;
+	int err = 0;
+
+	fire_seq = 0;
+	for (i = 0; i < NR_ORDER; i++) {
+		test_timer_setup(&tt[i]);
+		UK_TEST_EXPECT_ZERO(uk_timer_arm(&tt[i].t,
+						 now + MSEC(2 * (NR_ORDER - i))));
+	}
+	uk_sched_thread_sleep(MSEC(2 * NR_ORDER + 10));
+
+	for (i = 0; i < NR_ORDER; i++) {
+		err += tt[i].fired != 1 || tt[i].early;
+		err += tt[i].seq != NR_ORDER - 1 - i;
+		err += uk_timer_pending(&tt[i].t);
+	}
+	UK_TEST_EXPECT_ZERO(err);
+}
+
+UK_TESTCASE(uktimer, test_timer_disarm)
+{
+	struct test_timer tt;
+
+	test_timer_setup(&tt);
+	UK_TEST_EXPECT_ZERO(uk_timer_disarm(&tt.t));
+
+	UK_TEST_EXPECT_ZERO(uk_timer_arm(&tt.t,
+					 ukplat_monotonic_clock() + MSEC(5)));
+	UK_TEST_EXPECT(uk_timer_pending(&tt.t));
+	UK_TEST_EXPECT_SNUM_EQ(uk_timer_disarm(&tt.t), 1);
+	UK_TEST_EXPECT_ZERO(uk_timer_disarm(&tt.t));
+	uk_sched_thread_sleep(MSEC(10));
+	UK_TEST_EXPECT_ZERO(tt.fired);
+
+	/* Re-arming moves the timer */
+	UK_TEST_EXPECT_ZERO(uk_timer_arm(&tt.t,
+					 ukplat_monotonic_clock() + MSEC(1)));
+	UK_TEST_EXPECT_ZERO(uk_timer_arm(&tt.t,
+					 ukplat_monotonic_clock() + MSEC(20)));
+	uk_sched_thread_sleep(MSEC(10));
+	UK_TEST_EXPECT_ZERO(tt.fired);
+	uk_sched_thread_sleep(MSEC(20));
+	UK_TEST_EXPECT_SNUM_EQ(tt.fired, 1);
+	UK_TEST_EXPECT_ZERO(tt.early);
+}
+
+UK_TESTCASE(uktimer, test_timer_cascade)
+{
+	struct test_timer near, far;
+	__nsec now = ukplat_monotonic_clock();
+
+	/* Beyond the first level and beyond the whole wheel */
+	test_timer_setup(&near);
+	test_timer_setup(&far);
+	UK_TEST_EXPECT_ZERO(uk_timer_arm(&near.t, now + MSEC(100)));
+	UK_TEST_EXPECT_ZERO(uk_timer_arm(&far.t, now + MSEC(600000)));
+
+	uk_sched_thread_sleep(MSEC(120));
+	UK_TEST_EXPECT_SNUM_EQ(near.fired, 1);
+	UK_TEST_EXPECT_ZERO(near.early);
+	UK_TEST_EXPECT_ZERO(far.fired);
+	UK_TEST_EXPECT_SNUM_EQ(uk_timer_disarm(&far.t), 1);
+}
+
+static void test_periodic_fn(struct uk_timer *t, void *argp)
+{
+	unsigned int *count = (unsigned int *)argp;
+
+	if (++(*count) < NR_PERIODS)
+		uk_timer_arm(t, t->expires + MSEC(1));
+}
+
+UK_TESTCASE(uktimer, test_timer_periodic)
+{
+	unsigned int count = 0;
+	struct uk_timer t;
+
+	uk_timer_init(&t, test_periodic_fn, &count);
+	UK_TEST_EXPECT_ZERO(uk_timer_arm(&t,
+					 ukplat_monotonic_clock() + MSEC(1)));
+	uk_sched_thread_sleep(MSEC(NR_PERIODS + 20));
+	UK_TEST_EXPECT_SNUM_EQ(count, NR_PERIODS);
+	UK_TEST_EXPECT_ZERO(uk_timer_pending(&t));
+}
+
+/* Many timers that expire within a few milliseconds on one thread */
+UK_TESTCASE(uktimer, test_timer_many)
+{
+	static struct test_timer tt[NR_MANY];
+	unsigned int i, fired = 0;
+	int early = 0;
+	__nsec now;
+
+	now = ukplat_monotonic_clock();
+	for (i = 0; i < NR_MANY; i++) {
+		test_timer_setup(&tt[i]);
+		uk_timer_arm(&tt[i].t, now + MSEC(1 + i % 5));
+	}
+	uk_sched_thread_sleep(MSEC(50));
+	for (i = 0; i < NR_MANY; i++) {
+		fired += tt[i].fired;
+		early |= tt[i].early;
+	}
+	UK_TEST_EXPECT_SNUM_EQ(fired, NR_MANY);
+	UK_TEST_EXPECT_ZERO(early);
+}
+
+uk_testsuite_register(uktimer, NULL);
@@ -0,0 +1,277 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <errno.h>
+
+#include <uk/timer.h>
+#include <uk/assert.h>
+#include <uk/atomic.h>
+#include <uk/essentials.h>
+#include <uk/print.h>
+#include <uk/sched.h>
+#include <uk/spinlock.h>
+#include <uk/thread.h>
+#include <uk/timerwheel.h>
+#include <uk/plat/lcpu.h>
+#include <uk/plat/time.h>
+
+/*
+ * TIMER WHEEL
+ *
+ * Every LCPU has a hierarchical timer wheel (see uk/timerwheel.h), the same
+ * as the sleep queue of the schedulers. Arming and disarming are O(1).
+ *
+ * Expired timers are moved to the `expired` list of the wheel, from which the
+ * timer thread takes them one by one. They count as pending until their
+ * function is called, so they can still be disarmed.
+ */
+#define TIMER_SLOT_EXPIRED	UK_TIMERWHEEL_NR_SLOTS
+#define TIMER_SLOT_NONE		(~0U)
+
+enum timer_base_state {
+	TIMER_BASE_OFF = 0,
+	TIMER_BASE_STARTING,
+	TIMER_BASE_RUNNING
+};
+
+struct timer_base {
+	uk_spinlock lock;
+	struct uk_list_head slot[UK_TIMERWHEEL_NR_SLOTS];
+	struct uk_list_head expired;
+	struct uk_timerwheel wheel;
+	unsigned long count;		/* Number of timers on the wheel */
+	__nsec next;			/* Wakeup time of the thread, 0: none */
+	struct uk_thread *thread;
+	int state;
+} __align(CACHE_LINE_SIZE);
+
+static struct timer_base timer_bases[CONFIG_UKPLAT_LCPU_MAXCOUNT];
+
+#define wheel2base(w) \
+	__containerof(w, struct timer_base, wheel)
+
+static void timer_link(struct timer_base *b, struct uk_timer *t)
+{
+	t->slot = uk_timerwheel_link(&b->wheel, t->expires);
+	uk_list_add_tail(&t->link, &b->slot[t->slot]);
+}
+
+static void timer_unlink(struct timer_base *b, struct uk_timer *t)
+{
+	unsigned int idx = t->slot;
+
+	UK_ASSERT(idx <= TIMER_SLOT_EXPIRED);
+	UK_ASSERT(b->count > 0);
+
+	uk_list_del(&t->link);
+	if (idx < UK_TIMERWHEEL_NR_SLOTS)
+		uk_timerwheel_unlink(&b->wheel, idx,
+				     uk_list_empty(&b->slot[idx]));
+	t->slot = TIMER_SLOT_NONE;
+	b->count--;
+}
+
+static void timer_refile(struct uk_timerwheel *w, unsigned int idx,
+			 void *argp __unused)
+{
+	struct timer_base *b = wheel2base(w);
+	UK_LIST_HEAD(tmp);
+	struct uk_timer *t, *tn;
+
+	uk_list_splice_init(&b->slot[idx], &tmp);
+	uk_list_for_each_entry_safe(t, tn, &tmp, link)
+		timer_link(b, t);
+}
+
+/* Moves the expired timers of a level 0 slot to `expired` */
+static void timer_expire(struct uk_timerwheel *w, unsigned int idx,
+			 __nsec now, void *argp __unused)
+{
+	struct timer_base *b = wheel2base(w);
+	struct uk_timer *t, *tn;
+
+	uk_list_for_each_entry_safe(t, tn, &b->slot[idx], link) {
+		if (t->expires <= now) {
+			uk_list_move_tail(&t->link, &b->expired);
+			t->slot = TIMER_SLOT_EXPIRED;
+		}
+	}
+	uk_timerwheel_unlink(w, idx, uk_list_empty(&b->slot[idx]));
+}
+
+static __nsec timer_slot_min(struct uk_timerwheel *w, unsigned int idx,
+			     void *argp __unused)
+{
+	struct timer_base *b = wheel2base(w);
+	struct uk_timer *t;
+	__nsec min = 0;
+
+	uk_list_for_each_entry(t, &b->slot[idx], link) {
+		if (!min || t->expires < min)
+			min = t->expires;
+	}
+	return min;
+}
+
+static const struct uk_timerwheel_ops timer_ops = {
+	.refile   = timer_refile,
+	.expire   = timer_expire,
+	.slot_min = timer_slot_min,
+};
+
+/*
+ * TIMER THREAD
+ */
+
+static __noreturn void timer_thread_fn(void *argp)
+{
+	struct timer_base *b = (struct timer_base *)argp;
+	struct uk_timer *t;
+
+	for (;;) {
+		uk_spin_lock(&b->lock);
+		if (uk_list_empty(&b->expired))
+			uk_timerwheel_advance(&b->wheel,
+					      ukplat_monotonic_clock(),
+					      &timer_ops, NULL);
+
+		t = uk_list_first_entry_or_null(&b->expired,
+						struct uk_timer, link);
+		if (t) {
+			timer_unlink(b, t);
+			uk_store_n(&t->runner, uk_thread_current());
+			uk_spin_unlock(&b->lock);
+
+			t->func(t, t->argp);
+
+			/* The timer may be freed as soon as this is visible */
+			uk_store_n(&t->runner, NULL);
+			continue;
+		}
+
+		/* Sleep until the next expiry. Timers that are armed before
+		 * we yield wake us up again.
+		 */
+		b->next = uk_timerwheel_next(&b->wheel, &timer_ops, NULL);
+		uk_thread_block_until(uk_thread_current(), (__snsec)b->next);
+		uk_spin_unlock(&b->lock);
+
+		uk_sched_yield();
+	}
+}
+
+static int timer_base_start(struct timer_base *b)
+{
+	struct uk_thread *thread;
+	unsigned int i;
+	int state = TIMER_BASE_OFF;
+
+	if (!uk_compare_exchange_n(&b->state, &state, TIMER_BASE_STARTING)) {
+		/* Another thread is starting the wheel */
+		while ((state = uk_load_n(&b->state)) == TIMER_BASE_STARTING)
+			uk_sched_yield();
+		return (state == TIMER_BASE_RUNNING) ? 0 : -ENOMEM;
+	}
+
+	uk_spin_init(&b->lock);
+	for (i = 0; i < UK_TIMERWHEEL_NR_SLOTS; ++i)
+		UK_INIT_LIST_HEAD(&b->slot[i]);
+	UK_INIT_LIST_HEAD(&b->expired);
+	uk_timerwheel_init(&b->wheel, ukplat_monotonic_clock());
+	b->count = 0;
+	b->next = 0;
+
+	thread = uk_sched_thread_create(uk_sched_current(), timer_thread_fn,
+					b, "timer");
+	if (unlikely(!thread)) {
+		uk_pr_err("Failed to create timer thread\n");
+		uk_store_n(&b->state, TIMER_BASE_OFF);
+		return -ENOMEM;
+	}
+	b->thread = thread;
+	uk_store_n(&b->state, TIMER_BASE_RUNNING);
+	return 0;
+}
+
+/*
+ * API
+ */
+
+/* Removes a pending timer from its wheel. Returns 1 if it was pending. */
+static int timer_dequeue(struct uk_timer *t)
+{
+	struct timer_base *b;
+	int ret = 0;
+
+	while ((b = (struct timer_base *)uk_load_n(&t->base))) {
+		uk_spin_lock(&b->lock);
+		if (likely(t->base == b)) {
+			if (t->slot != TIMER_SLOT_NONE) {
+				timer_unlink(b, t);
+				ret = 1;
+			}
+			uk_spin_unlock(&b->lock);
+			break;
+		}
+		/* The timer function moved the timer to another wheel */
+		uk_spin_unlock(&b->lock);
+	}
+	return ret;
+}
+
+int uk_timer_arm(struct uk_timer *t, __nsec expires)
+{
+	struct timer_base *b;
+	int wake = 0;
+	int rc;
+
+	UK_ASSERT(t);
+	UK_ASSERT(t->func);
+
+	b = &timer_bases[ukplat_lcpu_idx()];
+	if (unlikely(uk_load_n(&b->state) != TIMER_BASE_RUNNING)) {
+		rc = timer_base_start(b);
+		if (unlikely(rc))
+			return rc;
+	}
+
+	(void)timer_dequeue(t);
+
+	uk_spin_lock(&b->lock);
+	/* An expiry time of 0 would mean no timeout to the scheduler */
+	t->expires = MAX(expires, (__nsec)1);
+	t->base = b;
+	timer_link(b, t);
+	b->count++;
+	if (!b->next || t->expires < b->next) {
+		b->next = t->expires;
+		wake = 1;
+	}
+	uk_spin_unlock(&b->lock);
+
+	if (wake)
+		uk_thread_wake(b->thread);
+	return 0;
+}
+
+int uk_timer_disarm(struct uk_timer *t)
+{
+	void *runner;
+	int ret = 0;
+
+	UK_ASSERT(t);
+
+	for (;;) {
+		ret |= timer_dequeue(t);
+
+		/* Do not wait for ourselves if called by the timer function */
+		runner = uk_load_n(&t->runner);
+		if (!runner || runner == uk_thread_current())
+			break;
+		uk_sched_yield();
+	}
+	return ret;
+}
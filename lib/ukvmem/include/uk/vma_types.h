@@ -211,10 +211,12 @@ static inline int uk_vma_map_dma(struct uk_vas *vas, __vaddr_t *vaddr,
  *
  * Note that the current file mapping implementation only allows private
  * mappings and will return -ENOTSUP for shared mappings. Accordingly,
- * modifications are not synched back to the file. Similarly, changes to the
- * file via regular read() and write() operations are not visible in the
- * mapping. Instead, the whole file contents is loaded into memory when the
- * mapping is established.
+ * modifications are not synched back to the file. The whole file contents is
+ * loaded into memory when the mapping is established. If the file system
+ * provides the pages of the file (vop_getpage), read-only mappings reference
+ * these pages instead of copies, so that changes to the file via regular
+ * write() operations are visible in the mapping. Such a mapping switches to
+ * private copies when it is made writable.
  */
 extern const struct uk_vma_ops uk_vma_file_ops;
 
@@ -229,6 +231,9 @@ struct uk_vma_file {
 
 	/** Start offset describing what position in the file is mapped */
 	__off offset;
+
+	/** Mapped pages are owned by the file system and not copies */
+	int shared_pages;
 };
 
 struct uk_vma_file_args {
@@ -68,6 +68,9 @@ struct uk_vas {
 	/** List of VMAs, sorted by address */
 	struct uk_list_head vma_list;
 
+	/** Root of the VMA tree, indexing the VMAs by address */
+	struct uk_vma *vma_root;
+
 	/** VAS flags */
 #define UK_VAS_FLAG_NO_PAGING		0x1 /* On-demand paging disabled */
 	unsigned long flags;
@@ -115,6 +118,16 @@ struct uk_vma {
 
 	struct uk_list_head vma_list;
 
+	/** Node in the VMA tree of the VAS (internal to ukvmem) */
+	struct {
+		struct uk_vma *parent;
+		struct uk_vma *left;
+		struct uk_vma *right;
+		/** Largest hole in front of a VMA of this subtree */
+		__sz max_gap;
+		int red;
+	} vma_node;
+
 	/** Page attributes for pages in the VMA (see PAGE_ATTR_*) */
 	unsigned long attr;
 
@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+
+#include <uk/vmem.h>
+#include <uk/test.h>
+#include <uk/list.h>
+#include <uk/print.h>
+#include <uk/arch/paging.h>
+#include <uk/plat/paging.h>
+#include <uk/plat/time.h>
+#include <uk/nofault.h>
+#include <uk/arch/limits.h>
+
+#undef PROT_R
+#define PROT_R PAGE_ATTR_PROT_READ
+
+#undef PROT_RW
+#define PROT_RW PAGE_ATTR_PROT_RW
+
+#define pr_info(fmt, ...)						\
+	_uk_printk(KLVL_INFO, __NULL, __NULL, 0x0, fmt, ##__VA_ARGS__)
+
+#define vmem_bug_on(cond)						\
+	do {								\
+		if (unlikely(cond))					\
+			UK_CRASH("'%s' during test execution.\n",	\
+				 STRINGIFY(cond));			\
+	} while (0)
+
+static struct uk_vas *vas_init(void)
+{
+	struct uk_vas *vas = uk_vas_get_active();
+
+	vmem_bug_on(vas == __NULL);
+	return vas;
+}
+
+static void vas_clean(struct uk_vas *vas)
+{
+	struct uk_vma *vma;
+	int restart, rc;
+
+	do {
+		restart = 0;
+		uk_list_for_each_entry(vma, &vas->vma_list, vma_list) {
+			if (vma->name && strcmp("heap", vma->name) == 0)
+				continue;
+
+			rc = uk_vma_unmap(vas, vma->start,
+					  vma->end - vma->start, 0);
+			vmem_bug_on(rc != 0);
+
+			restart = 1;
+			break;
+		}
+	} while (restart);
+}
+
+static inline __sz probe_rw(__vaddr_t vaddr, __sz len)
+{
+	return uk_nofault_probe_rw(vaddr, len, UK_NOFAULTF_CONTINUE);
+}
+
+#define BENCH_NR_VMAS 1024
+
+/**
+ * Measures the latency of page faults and of placing new mappings in an
+ * address space with many VMAs. A mapping is split into VMAs with
+ * alternating protections so that the VMAs cannot merge.
+ */
+UK_TESTCASE(ukvmem_bench, bench_vma_fault)
+{
+	struct uk_vas *vas = vas_init();
+	__nsec t_fault, t_map;
+	__vaddr_t va, va1;
+	unsigned int i;
+	__sz len = 0;
+	int rc;
+
+	va = __VADDR_ANY;
+	rc = uk_vma_map_anon(vas, &va, 2 * BENCH_NR_VMAS * PAGE_SIZE, PROT_RW,
+			     0, NULL);
+	vmem_bug_on(rc != 0);
+
+	for (i = 0; i < BENCH_NR_VMAS; i++) {
+		rc = uk_vma_set_attr(vas, va + (2 * i + 1) * PAGE_SIZE,
+				     PAGE_SIZE, PROT_R, 0);
+		vmem_bug_on(rc != 0);
+	}
+
+	t_fault = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_NR_VMAS; i++)
+		len += probe_rw(va + 2 * i * PAGE_SIZE, PAGE_SIZE);
+	t_fault = ukplat_monotonic_clock() - t_fault;
+	UK_TEST_EXPECT_SNUM_EQ(len, BENCH_NR_VMAS * PAGE_SIZE);
+
+	t_map = ukplat_monotonic_clock();
+	for (i = 0; i < BENCH_NR_VMAS; i++) {
+		va1 = __VADDR_ANY;
+		rc = uk_vma_reserve(vas, &va1, PAGE_SIZE);
+		vmem_bug_on(rc != 0);
+	}
+	t_map = ukplat_monotonic_clock() - t_map;
+
+	pr_info("   %u VMAs: %" __PRIu64 " ns/fault, %" __PRIu64 " ns/map\n",
+		2 * BENCH_NR_VMAS, t_fault / BENCH_NR_VMAS,
+		t_map / BENCH_NR_VMAS);
+
+	vas_clean(vas);
+}
+
+uk_testsuite_register(ukvmem_bench, NULL);
@@ -839,4 +839,48 @@ UK_TESTCASE(ukvmem, test_vma_replace)
 	vas_clean(vas);
 }
 
+/**
+ * Tests if new mappings are placed in the first hole that is large enough
+ * and that holes that are too small are skipped.
+ */
+UK_TESTCASE(ukvmem, test_vma_first_fit)
+{
+	struct uk_vas *vas = vas_init();
+	__vaddr_t va, va1;
+	int rc;
+
+	va = __VADDR_ANY;
+	rc = uk_vma_reserve(vas, &va, 0x10000);
+	vmem_bug_on(rc != 0);
+
+	/* Punch a 1-page and a 4-page hole */
+	rc = uk_vma_unmap(vas, va + 0x1000, 0x1000, 0);
+	UK_TEST_EXPECT_ZERO(rc);
+	rc = uk_vma_unmap(vas, va + 0x4000, 0x4000, 0);
+	UK_TEST_EXPECT_ZERO(rc);
+
+	va1 = __VADDR_ANY;
+	rc = uk_vma_reserve(vas, &va1, 0x2000);
+	UK_TEST_EXPECT_ZERO(rc);
+	UK_TEST_EXPECT_SNUM_EQ(va1, va + 0x4000);
+
+	va1 = __VADDR_ANY;
+	rc = uk_vma_reserve(vas, &va1, 0x1000);
+	UK_TEST_EXPECT_ZERO(rc);
+	UK_TEST_EXPECT_SNUM_EQ(va1, va + 0x1000);
+
+	/* The remaining 2-page hole is too small for this one */
+	va1 = __VADDR_ANY;
+	rc = uk_vma_reserve(vas, &va1, 0x3000);
+	UK_TEST_EXPECT_ZERO(rc);
+	UK_TEST_EXPECT_SNUM_EQ(va1, va + 0x10000);
+
+	UK_TEST_EXPECT_ZERO(chk_vas(vas, (struct vma_entry[]){
+		{va, va + 0x6000, 0},
+		{va + 0x8000, va + 0x13000, 0},
+	}, 2));
+
+	vas_clean(vas);
+}
+
 uk_testsuite_register(ukvmem, NULL);
@@ -17,7 +17,9 @@
 #ifdef CONFIG_HAVE_PAGING
 #include <uk/plat/paging.h>
 #endif /* CONFIG_HAVE_PAGING */
+#include <uk/plat/io.h>
 #include <vfscore/file.h>
+#include <vfscore/pagecache.h>
 #include <vfscore/vnode.h>
 #include <vfscore/uio.h>
 #include <uk/isr/string.h>
@@ -37,6 +39,7 @@ int vma_op_file_new(struct uk_vas *vas, __vaddr_t vaddr __unused,
 {
 	struct uk_vma_file_args *args = (struct uk_vma_file_args *)data;
 	struct uk_vma_file *vma_file;
+	struct vnode *vp;
 
 	UK_ASSERT(data);
 	UK_ASSERT(args->fd >= 0);
@@ -71,6 +74,14 @@ int vma_op_file_new(struct uk_vas *vas, __vaddr_t vaddr __unused,
 	}
 	vma_file->offset = args->offset;
 
+	/* Read-only mappings with base pages can reference the pages of the
+	 * file directly if the file system or the page cache provides them
+	 */
+	vp = vma_file->f->f_dentry->d_vnode;
+	vma_file->shared_pages = vfscore_has_pages(vp) &&
+				 !(attr & PAGE_ATTR_PROT_WRITE) &&
+				 UK_VMA_MAP_SIZE_TO_ORDER(*flags) <= PAGE_SHIFT;
+
 	/* Use the file name as VMA name. Since the memory management of the
 	 * string is tied to the file object, we do not need to care about
 	 * freeing it. So it is ok, if the caller should override the name.
@@ -109,7 +120,10 @@ static int vma_file_read(struct vfscore_file *fp, __vaddr_t buf, __sz len,
 	int rc;
 
 	vn_lock(vp);
-	rc = VOP_READ(vp, fp, &uio, 0);
+	if (vfscore_pagecache_enabled(vp))
+		rc = vfscore_pagecache_read(fp, &uio);
+	else
+		rc = VOP_READ(vp, fp, &uio, 0);
 	vn_unlock(vp);
 
 	if (unlikely(rc))
@@ -121,6 +135,67 @@ static int vma_file_read(struct vfscore_file *fp, __vaddr_t buf, __sz len,
 	return 0;
 }
 
+static int vma_file_getpage(struct uk_vma_file *vma_file,
+			    struct uk_vm_fault *fault)
+{
+	struct vnode *vp = vma_file->f->f_dentry->d_vnode;
+	void *page;
+	__off off;
+	int rc;
+
+	/* Let the mapper retry with base pages */
+	if (fault->len != PAGE_SIZE)
+		return -ENOMEM;
+
+	off = (fault->vbase - vma_file->base.start) + vma_file->offset;
+
+	vn_lock(vp);
+	rc = vfscore_getpage(vma_file->f, off, &page);
+	vn_unlock(vp);
+
+	if (unlikely(rc))
+		return -rc;
+
+	fault->paddr = ukplat_virt_to_phys(page);
+	return 0;
+}
+
+/* Unmaps the pages of the file and releases the references that were taken
+ * when they were faulted in. Pages that are not present in the page table
+ * never took a reference and are skipped.
+ */
+static int vma_file_unmap_pages(struct uk_vma_file *vma_file, __vaddr_t vaddr,
+				__sz len)
+{
+	struct uk_pagetable *pt = vma_file->base.vas->pt;
+	struct vnode *vp = vma_file->f->f_dentry->d_vnode;
+	unsigned int lvl;
+	__pte_t pte;
+	__off off;
+	int rc = 0;
+
+	off = (vaddr - vma_file->base.start) + vma_file->offset;
+
+	vn_lock(vp);
+	for (; len > 0; len -= PAGE_SIZE, vaddr += PAGE_SIZE, off += PAGE_SIZE) {
+		/* Shared pages are always base pages */
+		lvl = PAGE_LEVEL;
+		if (ukplat_pt_walk(pt, vaddr, &lvl, __NULL, &pte) ||
+		    lvl != PAGE_LEVEL || !PT_Lx_PTE_PRESENT(pte, PAGE_LEVEL))
+			continue;
+
+		/* The frames belong to the file */
+		rc = ukplat_page_unmap(pt, vaddr, 1, PAGE_FLAG_KEEP_FRAMES);
+		if (unlikely(rc))
+			break;
+
+		vfscore_putpage(vp, off);
+	}
+	vn_unlock(vp);
+
+	return rc;
+}
+
 static int vma_op_file_fault(struct uk_vma *vma, struct uk_vm_fault *fault)
 {
 	struct uk_vma_file *vma_file = (struct uk_vma_file *)vma;
@@ -136,6 +211,9 @@ static int vma_op_file_fault(struct uk_vma *vma, struct uk_vm_fault *fault)
 	UK_ASSERT(fault->len == PAGE_Lx_SIZE(fault->level));
 	UK_ASSERT(fault->type & UK_VMA_FAULT_NONPRESENT);
 
+	if (vma_file->shared_pages)
+		return vma_file_getpage(vma_file, fault);
+
 	rc = pt->fa->falloc(pt->fa, &paddr, pages, FALLOC_FLAG_ALIGNED);
 	if (unlikely(rc))
 		return rc;
@@ -187,6 +265,7 @@ static int vma_op_file_split(struct uk_vma *vma, __vaddr_t vaddr,
 
 	fhold(vma_file->f);
 	v->f = vma_file->f;
+	v->shared_pages = vma_file->shared_pages;
 
 	UK_ASSERT(new_vma);
 	*new_vma = &v->base;
@@ -212,26 +291,79 @@ static int vma_op_file_merge(struct uk_vma *vma, struct uk_vma *next)
 	if (next_file->offset != vma_file->offset + off)
 		return -EPERM;
 
+	/* ...and both either share the pages of the file or not */
+	if (next_file->shared_pages != vma_file->shared_pages)
+		return -EPERM;
+
 	/* We call fdrop() in the destructor */
 
 	return 0;
 }
 
+static int vma_op_file_unmap(struct uk_vma *vma, __vaddr_t vaddr, __sz len)
+{
+	struct uk_vma_file *vma_file = (struct uk_vma_file *)vma;
+
+	/* Default handler */
+	if (!vma_file->shared_pages)
+		return vma_op_unmap(vma, vaddr, len);
+
+	UK_ASSERT(vaddr >= vma->start);
+	UK_ASSERT(vaddr + len <= vma->end);
+	UK_ASSERT(PAGE_ALIGNED(len));
+
+	return vma_file_unmap_pages(vma_file, vaddr, len);
+}
+
 static int vma_op_file_set_attr(struct uk_vma *vma, unsigned long attr)
 {
+	struct uk_vma_file *vma_file = (struct uk_vma_file *)vma;
+	__sz len = vma->end - vma->start;
+	int rc;
+
 	/* Writable shared mappings are not supported. */
 	if ((vma->flags & UK_VMA_FILE_SHARED) && (attr & PAGE_ATTR_PROT_WRITE))
 		return -EPERM;
 
+	/* Writes must not reach the pages of the file. Replace them with
+	 * private copies, using the current attributes.
+	 */
+	if (vma_file->shared_pages && (attr & PAGE_ATTR_PROT_WRITE)) {
+		rc = vma_op_file_unmap(vma, vma->start, len);
+		if (unlikely(rc))
+			return rc;
+
+		vma_file->shared_pages = 0;
+
+		rc = vma_op_advise(vma, vma->start, len, UK_VMA_ADV_WILLNEED);
+		if (unlikely(rc))
+			return rc;
+	}
+
 	/* Default handler */
 	return vma_op_set_attr(vma, attr);
 }
 
+static int vma_op_file_advise(struct uk_vma *vma, __vaddr_t vaddr, __sz len,
+			      unsigned long advice)
+{
+	struct uk_vma_file *vma_file = (struct uk_vma_file *)vma;
+
+	/* Dropping the pages of the file would not free any memory and the
+	 * pages could not be faulted in again
+	 */
+	if (vma_file->shared_pages && !(advice & UK_VMA_ADV_WILLNEED))
+		return 0;
+
+	/* Default handler */
+	return vma_op_advise(vma, vaddr, len, advice);
+}
+
 /* We only support private mappings. Changes are not carried through to the
- * underlying file. So we can just use the default unmap handler that unmaps
- * the memory and forgets about it. Private file mappings can also change their
- * protections without checking for the permissions on the underlying file. We
- * can thus also use the default attribute setter.
+ * underlying file. So unless the mapping references the pages of the file, we
+ * can just use the default unmap handler that unmaps the memory and forgets
+ * about it. Private file mappings can also change their protections without
+ * checking for the permissions on the underlying file.
  */
 const struct uk_vma_ops uk_vma_file_ops = {
 #ifdef CONFIG_LIBUKVMEM_FILE_BASE
@@ -242,9 +374,9 @@ const struct uk_vma_ops uk_vma_file_ops = {
 	.new		= vma_op_file_new,
 	.destroy	= vma_op_file_destroy,
 	.fault		= vma_op_file_fault,
-	.unmap		= vma_op_unmap,		/* default */
+	.unmap		= vma_op_file_unmap,
 	.split		= vma_op_file_split,
 	.merge		= vma_op_file_merge,
 	.set_attr	= vma_op_file_set_attr,
-	.advise		= vma_op_advise,	/* default */
+	.advise		= vma_op_file_advise,
 };
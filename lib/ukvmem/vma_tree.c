@@ -0,0 +1,397 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include "vmem.h"
+
+#include <uk/essentials.h>
+#include <uk/assert.h>
+#include <uk/list.h>
+
+/*
+ * VMA TREE
+ *
+ * In addition to the sorted VMA list, every VAS indexes its VMAs in a
+ * red-black tree keyed by the start address. The list remains the way to
+ * iterate over neighboring VMAs, while the tree provides O(log n) address
+ * lookups for page faults and mapping operations.
+ *
+ * The tree is augmented with the size of the largest hole in the address
+ * space that precedes a VMA in each subtree (i.e., the distance between the
+ * start of a VMA and the end of its predecessor in the list). This lets the
+ * first-fit search skip whole subtrees that cannot accommodate a mapping.
+ *
+ * Since the gap of a VMA is derived from the list, the list must be updated
+ * before the tree. Whenever the end of a VMA or the predecessor of a VMA
+ * changes without a tree operation, vmem_vma_tree_update() must be called on
+ * the affected VMA.
+ */
+
+#define node(vma)	((vma)->vma_node)
+
+static inline __sz vma_tree_gap(struct uk_vma *vma)
+{
+	const struct uk_vma *prev = uk_vma_prev(vma);
+
+	return vma->start - ((prev) ? prev->end : 0);
+}
+
+static inline __sz vma_tree_max_gap(struct uk_vma *vma)
+{
+	return (vma) ? node(vma).max_gap : 0;
+}
+
+static inline int vma_tree_is_red(struct uk_vma *vma)
+{
+	return (vma) ? node(vma).red : 0;
+}
+
+static inline void vma_tree_recompute(struct uk_vma *vma)
+{
+	__sz max_gap = vma_tree_gap(vma);
+
+	max_gap = MAX(max_gap, vma_tree_max_gap(node(vma).left));
+	max_gap = MAX(max_gap, vma_tree_max_gap(node(vma).right));
+	node(vma).max_gap = max_gap;
+}
+
+static void vma_tree_propagate(struct uk_vma *vma)
+{
+	while (vma) {
+		vma_tree_recompute(vma);
+		vma = node(vma).parent;
+	}
+}
+
+void vmem_vma_tree_update(struct uk_vma *vma)
+{
+	UK_ASSERT(vma);
+
+	vma_tree_propagate(vma);
+}
+
+/* Replaces the child `old` of `parent` with `new` */
+static inline void vma_tree_relink(struct uk_vas *vas, struct uk_vma *parent,
+				   struct uk_vma *old, struct uk_vma *new)
+{
+	if (!parent)
+		vas->vma_root = new;
+	else if (node(parent).left == old)
+		node(parent).left = new;
+	else
+		node(parent).right = new;
+}
+
+/* Rotations do not change the set of VMAs in the rotated subtree, so only
+ * the two rotated VMAs need to recompute their augmented value.
+ */
+static void vma_tree_rotate_left(struct uk_vas *vas, struct uk_vma *x)
+{
+	struct uk_vma *y = node(x).right;
+
+	node(x).right = node(y).left;
+	if (node(y).left)
+		node(node(y).left).parent = x;
+
+	node(y).parent = node(x).parent;
+	vma_tree_relink(vas, node(x).parent, x, y);
+
+	node(y).left = x;
+	node(x).parent = y;
+
+	vma_tree_recompute(x);
+	vma_tree_recompute(y);
+}
+
+static void vma_tree_rotate_right(struct uk_vas *vas, struct uk_vma *x)
+{
+	struct uk_vma *y = node(x).left;
+
+	node(x).left = node(y).right;
+	if (node(y).right)
+		node(node(y).right).parent = x;
+
+	node(y).parent = node(x).parent;
+	vma_tree_relink(vas, node(x).parent, x, y);
+
+	node(y).right = x;
+	node(x).parent = y;
+
+	vma_tree_recompute(x);
+	vma_tree_recompute(y);
+}
+
+void vmem_vma_tree_insert(struct uk_vas *vas, struct uk_vma *vma)
+{
+	struct uk_vma *parent = __NULL, **link = &vas->vma_root;
+	struct uk_vma *p, *g, *u;
+
+	UK_ASSERT(vas);
+	UK_ASSERT(vma);
+
+	while (*link) {
+		parent = *link;
+		link = (vma->start < parent->start) ? &node(parent).left :
+						      &node(parent).right;
+	}
+
+	node(vma).parent = parent;
+	node(vma).left   = __NULL;
+	node(vma).right  = __NULL;
+	node(vma).red    = 1;
+	*link = vma;
+
+	vma_tree_propagate(vma);
+
+	/* Restore the red-black properties */
+	while ((p = node(vma).parent) && node(p).red) {
+		g = node(p).parent;
+		UK_ASSERT(g);
+
+		if (p == node(g).left) {
+			u = node(g).right;
+			if (vma_tree_is_red(u)) {
+				node(p).red = 0;
+				node(u).red = 0;
+				node(g).red = 1;
+				vma = g;
+				continue;
+			}
+
+			if (vma == node(p).right) {
+				vma_tree_rotate_left(vas, p);
+				vma = p;
+				p = node(vma).parent;
+			}
+
+			node(p).red = 0;
+			node(g).red = 1;
+			vma_tree_rotate_right(vas, g);
+		} else {
+			u = node(g).left;
+			if (vma_tree_is_red(u)) {
+				node(p).red = 0;
+				node(u).red = 0;
+				node(g).red = 1;
+				vma = g;
+				continue;
+			}
+
+			if (vma == node(p).left) {
+				vma_tree_rotate_right(vas, p);
+				vma = p;
+				p = node(vma).parent;
+			}
+
+			node(p).red = 0;
+			node(g).red = 1;
+			vma_tree_rotate_left(vas, g);
+		}
+	}
+
+	node(vas->vma_root).red = 0;
+}
+
+static void vma_tree_remove_fixup(struct uk_vas *vas, struct uk_vma *x,
+				  struct uk_vma *xp)
+{
+	struct uk_vma *w;
+
+	while (x != vas->vma_root && !vma_tree_is_red(x)) {
+		UK_ASSERT(xp);
+
+		if (x == node(xp).left) {
+			w = node(xp).right;
+			if (vma_tree_is_red(w)) {
+				node(w).red  = 0;
+				node(xp).red = 1;
+				vma_tree_rotate_left(vas, xp);
+				w = node(xp).right;
+			}
+
+			if (!vma_tree_is_red(node(w).left) &&
+			    !vma_tree_is_red(node(w).right)) {
+				node(w).red = 1;
+				x  = xp;
+				xp = node(x).parent;
+				continue;
+			}
+
+			if (!vma_tree_is_red(node(w).right)) {
+				node(node(w).left).red = 0;
+				node(w).red = 1;
+				vma_tree_rotate_right(vas, w);
+				w = node(xp).right;
+			}
+
+			node(w).red  = node(xp).red;
+			node(xp).red = 0;
+			node(node(w).right).red = 0;
+			vma_tree_rotate_left(vas, xp);
+		} else {
+			w = node(xp).left;
+			if (vma_tree_is_red(w)) {
+				node(w).red  = 0;
+				node(xp).red = 1;
+				vma_tree_rotate_right(vas, xp);
+				w = node(xp).left;
+			}
+
+			if (!vma_tree_is_red(node(w).left) &&
+			    !vma_tree_is_red(node(w).right)) {
+				node(w).red = 1;
+				x  = xp;
+				xp = node(x).parent;
+				continue;
+			}
+
+			if (!vma_tree_is_red(node(w).left)) {
+				node(node(w).right).red = 0;
+				node(w).red = 1;
+				vma_tree_rotate_left(vas, w);
+				w = node(xp).left;
+			}
+
+			node(w).red  = node(xp).red;
+			node(xp).red = 0;
+			node(node(w).left).red = 0;
+			vma_tree_rotate_right(vas, xp);
+		}
+
+		x = vas->vma_root;
+		break;
+	}
+
+	if (x)
+		node(x).red = 0;
+}
+
+void vmem_vma_tree_remove(struct uk_vas *vas, struct uk_vma *vma)
+{
+	struct uk_vma *y, *x, *xp;
+	int red;
+
+	UK_ASSERT(vas);
+	UK_ASSERT(vma);
+
+	/* Find the VMA that is actually unlinked from its position: the VMA
+	 * itself or its in-order successor if it has two children.
+	 */
+	y = vma;
+	if (node(vma).left && node(vma).right) {
+		y = node(vma).right;
+		while (node(y).left)
+			y = node(y).left;
+	}
+
+	x   = (node(y).left) ? node(y).left : node(y).right;
+	xp  = node(y).parent;
+	red = node(y).red;
+
+	if (x)
+		node(x).parent = xp;
+	vma_tree_relink(vas, xp, y, x);
+
+	if (y != vma) {
+		/* Move the successor into the position of the removed VMA */
+		if (xp == vma)
+			xp = y;
+
+		node(y) = node(vma);
+		vma_tree_relink(vas, node(y).parent, vma, y);
+		if (node(y).left)
+			node(node(y).left).parent = y;
+		if (node(y).right)
+			node(node(y).right).parent = y;
+	}
+
+	vma_tree_propagate(xp);
+
+	if (!red)
+		vma_tree_remove_fixup(vas, x, xp);
+}
+
+struct uk_vma *vmem_vma_tree_lookup(struct uk_vas *vas, __vaddr_t vaddr)
+{
+	struct uk_vma *vma = vas->vma_root;
+	struct uk_vma *found = __NULL;
+
+	/* VMAs do not overlap, so they are sorted by their end as well */
+	while (vma) {
+		if (vma->end > vaddr) {
+			found = vma;
+			vma = node(vma).left;
+		} else {
+			vma = node(vma).right;
+		}
+	}
+
+	return found;
+}
+
+static __vaddr_t vma_tree_first_fit(struct uk_vma *vma, __vaddr_t base,
+				    __sz align, __sz len)
+{
+	const struct uk_vma *prev;
+	__vaddr_t vaddr;
+
+	if (!vma || node(vma).max_gap < len)
+		return __VADDR_INV;
+
+	/* Holes in front of this VMA and its left subtree end below base */
+	if (vma->start <= base)
+		return vma_tree_first_fit(node(vma).right, base, align, len);
+
+	vaddr = vma_tree_first_fit(node(vma).left, base, align, len);
+	if (vaddr != __VADDR_INV)
+		return vaddr;
+
+	/* The hole in front of this VMA may still be too small after
+	 * clipping it at base and aligning its start
+	 */
+	if (vma_tree_gap(vma) >= len) {
+		prev  = uk_vma_prev(vma);
+		vaddr = MAX((prev) ? prev->end : 0, base);
+
+		if (likely(vaddr <= __VADDR_MAX - align)) {
+			vaddr = ALIGN_UP(vaddr, align);
+			if (vaddr < vma->start && vma->start - vaddr >= len)
+				return vaddr;
+		}
+	}
+
+	return vma_tree_first_fit(node(vma).right, base, align, len);
+}
+
+__vaddr_t vmem_vma_tree_first_fit(struct uk_vas *vas, __vaddr_t base,
+				  __sz align, __sz len)
+{
+	const struct uk_vma *last;
+	__vaddr_t vaddr;
+
+	UK_ASSERT(vas);
+	UK_ASSERT(len > 0);
+
+	vaddr = vma_tree_first_fit(vas->vma_root, base, align, len);
+	if (vaddr != __VADDR_INV)
+		return vaddr;
+
+	/* Place the mapping behind the last VMA */
+	last  = uk_vma_last(vas);
+	vaddr = (last) ? MAX(last->end, base) : base;
+
+	/* Since we are scanning the VAS for an empty address range, we need
+	 * to be careful not to overflow. Checks are thus always active and not
+	 * just asserts.
+	 */
+	if (unlikely(vaddr > __VADDR_MAX - align))
+		return __VADDR_INV;
+
+	vaddr = ALIGN_UP(vaddr, align);
+	if (unlikely(vaddr > __VADDR_MAX - len))
+		return __VADDR_INV;
+
+	return vaddr;
+}
@@ -68,6 +68,7 @@ int uk_vas_init(struct uk_vas *vas, struct uk_pagetable *pt __maybe_unused,
 	vas->flags = 0;
 
 	UK_INIT_LIST_HEAD(&vas->vma_list);
+	vas->vma_root = __NULL;
 
 	return 0;
 }
@@ -82,6 +83,7 @@ void uk_vas_destroy(struct uk_vas *vas)
 	}
 
 	UK_ASSERT(uk_list_empty(&vas->vma_list));
+	UK_ASSERT(!vas->vma_root);
 
 	if (vmem_active_vas == vas)
 		vmem_active_vas = __NULL;
@@ -99,27 +101,65 @@ static void vmem_vma_destroy(struct uk_vma *vma)
 
 static void vmem_vma_unlink_and_free(struct uk_vma *vma)
 {
+	struct uk_vma *next;
+
 	UK_ASSERT(vma);
 	UK_ASSERT(!uk_list_empty(&vma->vma_list));
 
+	next = (struct uk_vma *)uk_vma_next(vma);
+
 	uk_list_del(&vma->vma_list);
+	vmem_vma_tree_remove(vma->vas, vma);
+
+	/* The hole in front of the next VMA grew */
+	if (next)
+		vmem_vma_tree_update(next);
+
 	vmem_vma_destroy(vma);
 }
 
+static void vmem_vma_unlink_vmas(struct uk_vma *start, struct uk_vma *end)
+{
+	struct uk_vas *vas = start->vas;
+	struct uk_vma *vma = start, *next;
+
+	UK_ASSERT(start);
+	UK_ASSERT(end);
+
+	next = (struct uk_vma *)uk_vma_next(end);
+
+	/* Unlink all VMAs starting from start to end. The links between the
+	 * unlinked VMAs stay intact so that the caller can still walk them.
+	 */
+	start->vma_list.prev->next = end->vma_list.next;
+	end->vma_list.next->prev   = start->vma_list.prev;
+
+	while (vma != end) {
+		vmem_vma_tree_remove(vas, vma);
+		vma = uk_list_next_entry(vma, vma_list);
+	}
+
+	vmem_vma_tree_remove(vas, end);
+
+	if (next)
+		vmem_vma_tree_update(next);
+}
+
 static struct uk_vma *vmem_vma_find(struct uk_vas *vas, __vaddr_t vaddr,
 				    __sz len)
 {
 	struct uk_vma *vma;
-	__vaddr_t vstart = vaddr;
 	__vaddr_t vend = vaddr + MAX(len, (__sz)1);
 
 	UK_ASSERT(vas);
 	UK_ASSERT(vaddr <= __VADDR_MAX - len);
 
-	uk_list_for_each_entry(vma, &vas->vma_list, vma_list) {
-		if ((vend > vma->start) && (vstart < vma->end))
-			return vma;
-	}
+	/* The first VMA ending above vaddr is the only candidate for the
+	 * first VMA that overlaps with the range
+	 */
+	vma = vmem_vma_tree_lookup(vas, vaddr);
+	if (vma && vend > vma->start)
+		return vma;
 
 	return __NULL;
 }
@@ -227,26 +267,26 @@ static int vmem_vma_find_range(struct uk_vas *vas, __vaddr_t *vaddr, __sz *len,
 
 static void vmem_vma_insert(struct uk_vas *vas, struct uk_vma *vma)
 {
-	struct uk_list_head *prev;
-	struct uk_vma *cur;
+	struct uk_vma *next;
 
 	UK_ASSERT(vas);
 	UK_ASSERT(uk_list_empty(&vma->vma_list));
 	UK_ASSERT(!vmem_vma_find(vas, vma->start, vma->end - vma->start));
 
-	prev = &vas->vma_list;
-	uk_list_for_each_entry(cur, &vas->vma_list, vma_list) {
-		if (vma->start < cur->end) {
-			UK_ASSERT(vma->end <= cur->start);
-
-			uk_list_add(&vma->vma_list, prev);
-			return;
-		}
+	next = vmem_vma_tree_lookup(vas, vma->start);
+	if (next) {
+		UK_ASSERT(vma->end <= next->start);
 
-		prev = &cur->vma_list;
+		uk_list_add_tail(&vma->vma_list, &next->vma_list);
+	} else {
+		uk_list_add_tail(&vma->vma_list, &vas->vma_list);
 	}
 
-	uk_list_add_tail(&vma->vma_list, &vas->vma_list);
+	vmem_vma_tree_insert(vas, vma);
+
+	/* The hole in front of the next VMA shrunk */
+	if (next)
+		vmem_vma_tree_update(next);
 }
 
 static inline int vmem_vma_can_merge(struct uk_vma *vma, struct uk_vma *next)
@@ -353,6 +393,7 @@ static int vmem_vma_split(struct uk_vma *vma, __vaddr_t vaddr,
 	vma->end	= vaddr;
 
 	uk_list_add(&v->vma_list, &vma->vma_list);
+	vmem_vma_tree_insert(vma->vas, v);
 
 	*new_vma = v;
 	return 0;
@@ -511,48 +552,12 @@ int uk_vma_unmap(struct uk_vas *vas, __vaddr_t vaddr, __sz len,
 		return rc;
 	}
 
-	/* Unlink all VMAs starting from vma_start to vma_end */
-	vma_start->vma_list.prev->next = vma_end->vma_list.next;
-	vma_end->vma_list.next->prev   = vma_start->vma_list.prev;
-
+	vmem_vma_unlink_vmas(vma_start, vma_end);
 	vmem_vma_unmap_and_free_vmas(vma_start, vma_end);
 
 	return 0;
 }
 
-static __vaddr_t vmem_first_fit(struct uk_vas *vas, __vaddr_t base, __sz align,
-				__sz len)
-{
-	__vaddr_t vaddr = base;
-	struct uk_vma *cur;
-
-	UK_ASSERT(vas);
-
-	/* Since we are scanning the VAS for an empty address range, we need
-	 * to be careful not to overflow. Checks are thus always active and not
-	 * just asserts.
-	 */
-	uk_list_for_each_entry(cur, &vas->vma_list, vma_list) {
-		if (unlikely(vaddr > __VADDR_MAX - align))
-			return __VADDR_INV;
-
-		vaddr = ALIGN_UP(vaddr, align);
-
-		if (unlikely(vaddr > __VADDR_MAX - len))
-			return __VADDR_INV;
-
-		if (vaddr + len <= cur->start)
-			return vaddr;
-
-		vaddr = MAX(cur->end, base);
-	}
-
-	if (unlikely(vaddr > __VADDR_MAX - align))
-		return __VADDR_INV;
-
-	return ALIGN_UP(vaddr, align);
-}
-
 static int vmem_mapx_populate(struct uk_pagetable *pt __unused,
 			      __vaddr_t vaddr, __vaddr_t pt_vaddr __unused,
 			      unsigned int level, __pte_t *pte, void *user)
@@ -629,7 +634,8 @@ int uk_vma_map(struct uk_vas *vas, __vaddr_t *vaddr, __sz len,
 		base = (ops->get_base) ? ops->get_base(vas, args, flags) :
 					 vas->vma_base;
 
-		va = vmem_first_fit(vas, base, PAGE_Lx_SIZE(algn_lvl), len);
+		va = vmem_vma_tree_first_fit(vas, base,
+					     PAGE_Lx_SIZE(algn_lvl), len);
 		if (unlikely(va == __VADDR_INV))
 			return -ENOMEM;
 	} else {
@@ -689,10 +695,7 @@ int uk_vma_map(struct uk_vas *vas, __vaddr_t *vaddr, __sz len,
 	if (vma_start) {
 		UK_ASSERT(vma_end);
 
-		/* Unlink all VMAs starting from vma_start to vma_end */
-		vma_start->vma_list.prev->next = vma_end->vma_list.next;
-		vma_end->vma_list.next->prev   = vma_start->vma_list.prev;
-
+		vmem_vma_unlink_vmas(vma_start, vma_end);
 		vmem_vma_unmap_and_free_vmas(vma_start, vma_end);
 	}
 
@@ -83,6 +83,37 @@ static inline __sz vmem_vma_len(struct uk_vma *vma)
 	return vma->end - vma->start;
 }
 
+/**
+ * Links a VMA into the VMA tree of the VAS. The VMA must already be linked
+ * into the VMA list.
+ */
+void vmem_vma_tree_insert(struct uk_vas *vas, struct uk_vma *vma);
+
+/**
+ * Unlinks a VMA from the VMA tree of the VAS. The next VMA must be updated
+ * with vmem_vma_tree_update() after the VMA has been removed from the list.
+ */
+void vmem_vma_tree_remove(struct uk_vas *vas, struct uk_vma *vma);
+
+/**
+ * Updates the tree after the hole in front of a VMA changed size.
+ */
+void vmem_vma_tree_update(struct uk_vma *vma);
+
+/**
+ * Returns the first VMA that ends above the given address or __NULL if
+ * there is no such VMA.
+ */
+struct uk_vma *vmem_vma_tree_lookup(struct uk_vas *vas, __vaddr_t vaddr);
+
+/**
+ * Returns the lowest address at or above base that is aligned to align and
+ * is followed by at least len bytes of unused address space, or
+ * __VADDR_INV if there is none.
+ */
+__vaddr_t vmem_vma_tree_first_fit(struct uk_vas *vas, __vaddr_t base,
+				  __sz align, __sz len);
+
 /* Default VMA op handlers */
 int vma_op_deny();
 
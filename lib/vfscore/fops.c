@@ -34,11 +34,17 @@
 #define _GNU_SOURCE
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vfscore/file.h>
+#include <vfscore/pagecache.h>
 #include "vfs.h"
 
 #include <uk/assert.h>
 
+/* Number of iovecs that vfs_write() saves on the stack for the page cache */
+#define PAGECACHE_IOV_STACK	8
+
 int vfs_close(struct vfscore_file *fp)
 {
 	struct vnode *vp = fp->f_dentry->d_vnode;
@@ -81,7 +87,10 @@ int vfs_read(struct vfscore_file *fp, struct uio *uio, int flags)
 	if ((flags & FOF_OFFSET) == 0)
 		uio->uio_offset = fp->f_offset;
 
-	error = VOP_READ(vp, fp, uio, 0);
+	if (vfscore_pagecache_enabled(vp) && !(fp->f_flags & O_DIRECT))
+		error = vfscore_pagecache_read(fp, uio);
+	else
+		error = VOP_READ(vp, fp, uio, 0);
 	if (!error) {
 		count = bytes - uio->uio_resid;
 		if (((flags & FOF_OFFSET) == 0) &&
@@ -97,6 +106,9 @@ int vfs_read(struct vfscore_file *fp, struct uio *uio, int flags)
 int vfs_write(struct vfscore_file *fp, struct uio *uio, int flags)
 {
 	struct vnode *vp = fp->f_dentry->d_vnode;
+	struct iovec iov_stack[PAGECACHE_IOV_STACK];
+	struct iovec *iov = NULL;
+	int iovcnt = uio->uio_iovcnt;
 	int ioflags = 0;
 	int error;
 	size_t count;
@@ -106,6 +118,21 @@ int vfs_write(struct vfscore_file *fp, struct uio *uio, int flags)
 
 	vn_lock(vp);
 
+	/* The file system consumes the I/O vector, keep a copy to update the
+	 * cached pages with the written data afterwards
+	 */
+	if (vfscore_pagecache_enabled(vp)) {
+		iov = iov_stack;
+		if (iovcnt > PAGECACHE_IOV_STACK) {
+			iov = malloc(iovcnt * sizeof(*iov));
+			if (unlikely(!iov)) {
+				vn_unlock(vp);
+				return ENOMEM;
+			}
+		}
+		memcpy(iov, uio->uio_iov, iovcnt * sizeof(*iov));
+	}
+
 	if (fp->f_flags & O_APPEND)
 		ioflags |= IO_APPEND;
 	if (fp->f_flags & (O_DSYNC|O_SYNC))
@@ -115,14 +142,19 @@ int vfs_write(struct vfscore_file *fp, struct uio *uio, int flags)
 		uio->uio_offset = fp->f_offset;
 
 	error = VOP_WRITE(vp, uio, ioflags);
+	count = bytes - uio->uio_resid;
+	if (iov && count)
+		vfscore_pagecache_write(vp, uio->uio_offset - count, count,
+					iov, iovcnt);
 	if (!error) {
-		count = bytes - uio->uio_resid;
 		if (!(flags & FOF_OFFSET) &&
 		    !(fp->f_vfs_flags & UK_VFSCORE_NOPOS))
 			fp->f_offset += count;
 	}
 
 	vn_unlock(vp);
+	if (iov != iov_stack)
+		free(iov);
 	return error;
 }
 
@@ -149,3 +181,22 @@ int vfs_stat(struct vfscore_file *fp, struct stat *st)
 
 	return error;
 }
+
+int vfscore_getpage(struct vfscore_file *fp, off_t off, void **page)
+{
+	struct vnode *vp = fp->f_dentry->d_vnode;
+
+	if (vp->v_op->vop_getpage)
+		return VOP_GETPAGE(vp, off, page);
+	if (vfscore_pagecache_enabled(vp))
+		return vfscore_pagecache_getpage(fp, off, page);
+	return ENOTSUP;
+}
+
+void vfscore_putpage(struct vnode *vp, off_t off)
+{
+	if (vp->v_op->vop_putpage)
+		VOP_PUTPAGE(vp, off);
+	else
+		vfscore_pagecache_putpage(vp, off);
+}
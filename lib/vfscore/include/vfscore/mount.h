@@ -122,6 +122,7 @@ struct mount {
 #ifndef	MNT_ROOTFS
 #define	MNT_ROOTFS	0x00004000	/* identifies the root filesystem */
 #endif
+#define MNT_PAGECACHE	0x00010000	/* file data is in the page cache */
 
 /*
  * Mask of flags that are visible to statfs()
@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#ifndef __VFSCORE_PAGECACHE_H__
+#define __VFSCORE_PAGECACHE_H__
+
+#include <errno.h>
+#include <uk/config.h>
+#include <uk/essentials.h>
+#include <vfscore/file.h>
+#include <vfscore/mount.h>
+#include <vfscore/uio.h>
+#include <vfscore/vnode.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Page cache
+ *
+ * Caches the data of regular files in pages, keyed by vnode and page index.
+ * The same pages serve read() and write() as well as read-only file mappings,
+ * so all of them see the same data. File systems opt in per mount by setting
+ * MNT_PAGECACHE; file systems that keep their data in pages anyway provide
+ * vop_getpage instead.
+ *
+ * Writes go through to the file system and update the cached pages. Pages
+ * are evicted in LRU order once the cache is full or an allocation fails.
+ * Pages referenced by mappings are never evicted.
+ *
+ * All functions expect the vnode to be locked.
+ */
+
+#if CONFIG_LIBVFSCORE_PAGECACHE
+static inline int vfscore_pagecache_enabled(struct vnode *vp)
+{
+	return vp->v_type == VREG && vp->v_mount &&
+	       (vp->v_mount->m_flags & MNT_PAGECACHE);
+}
+
+/**
+ * Reads file data through the page cache, filling missing pages from the
+ * file system with read-ahead.
+ */
+int vfscore_pagecache_read(struct vfscore_file *fp, struct uio *uio);
+
+/**
+ * Updates the cached pages after the file system wrote `len` bytes at
+ * `off`. `iov` describes the data as it was before the write.
+ */
+void vfscore_pagecache_write(struct vnode *vp, off_t off, size_t len,
+			     const struct iovec *iov, int iovcnt);
+
+/**
+ * Drops the cached data beyond `length` after a truncation.
+ */
+void vfscore_pagecache_truncate(struct vnode *vp, off_t length);
+
+/**
+ * Drops all cached pages of a vnode that is released.
+ */
+void vfscore_pagecache_drop(struct vnode *vp);
+
+/**
+ * Returns the cached page at the page aligned offset `off`, filling it if
+ * needed, and keeps it from being evicted until vfscore_pagecache_putpage().
+ */
+int vfscore_pagecache_getpage(struct vfscore_file *fp, off_t off,
+			      void **page);
+
+/**
+ * Releases one reference taken with vfscore_pagecache_getpage(). Must not be
+ * called for pages that the caller did not get.
+ */
+void vfscore_pagecache_putpage(struct vnode *vp, off_t off);
+#else /* !CONFIG_LIBVFSCORE_PAGECACHE */
+static inline int vfscore_pagecache_enabled(struct vnode *vp __unused)
+{
+	return 0;
+}
+
+static inline int vfscore_pagecache_read(struct vfscore_file *fp __unused,
+					 struct uio *uio __unused)
+{
+	return ENOTSUP;
+}
+
+static inline void vfscore_pagecache_write(struct vnode *vp __unused,
+					   off_t off __unused,
+					   size_t len __unused,
+					   const struct iovec *iov __unused,
+					   int iovcnt __unused)
+{
+}
+
+static inline void vfscore_pagecache_truncate(struct vnode *vp __unused,
+					      off_t length __unused)
+{
+}
+
+static inline void vfscore_pagecache_drop(struct vnode *vp __unused)
+{
+}
+
+static inline int vfscore_pagecache_getpage(struct vfscore_file *fp __unused,
+					    off_t off __unused,
+					    void **page __unused)
+{
+	return ENOTSUP;
+}
+
+static inline void vfscore_pagecache_putpage(struct vnode *vp __unused,
+					     off_t off __unused)
+{
+}
+#endif /* !CONFIG_LIBVFSCORE_PAGECACHE */
+
+/**
+ * Returns whether the pages of a file can be mapped with vfscore_getpage().
+ */
+static inline int vfscore_has_pages(struct vnode *vp)
+{
+	return vp->v_op->vop_getpage || vfscore_pagecache_enabled(vp);
+}
+
+/**
+ * Returns the page holding the file data at the page aligned offset `off`,
+ * from the file system or the page cache. The page stays valid until it is
+ * released with vfscore_putpage(). Call with the vnode locked.
+ *
+ * @return
+ *   0 on success, a positive errno value otherwise
+ */
+int vfscore_getpage(struct vfscore_file *fp, off_t off, void **page);
+
+/**
+ * Releases a page returned by vfscore_getpage(). Call exactly once for every
+ * page that was obtained, and only for those.
+ */
+void vfscore_putpage(struct vnode *vp, off_t off);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VFSCORE_PAGECACHE_H__ */
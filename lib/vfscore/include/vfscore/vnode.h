@@ -95,6 +95,7 @@ struct vnode {
 	struct uk_mutex	v_lock;		/* lock for this vnode */
 	struct uk_list_head v_names;	/* directory entries pointing at this */
 	void		*v_data;	/* private data for fs */
+	struct uk_list_head v_pages;	/* pages in the page cache */
 };
 
 /* flags for vnode */
@@ -191,6 +192,8 @@ typedef int (*vnop_readlink_t)  (struct vnode *, struct uio *);
 typedef int (*vnop_symlink_t)   (struct vnode *, const char *, const char *);
 typedef int (*vnop_poll_t)	(struct vnode *, unsigned int *,
 				 struct eventpoll_cb *);
+typedef int (*vnop_getpage_t)	(struct vnode *, off_t, void **);
+typedef int (*vnop_putpage_t)	(struct vnode *, off_t);
 
 /*
  * vnode operations
@@ -220,6 +223,13 @@ struct vnops {
 	vnop_readlink_t		vop_readlink;
 	vnop_symlink_t		vop_symlink;
 	vnop_poll_t		vop_poll;
+	/*
+	 * Optional: returns the page that holds the file data at a page
+	 * aligned offset so that it can be mapped into memory directly. The
+	 * page stays valid until it is released with vop_putpage.
+	 */
+	vnop_getpage_t		vop_getpage;
+	vnop_putpage_t		vop_putpage;
 };
 
 /*
@@ -250,6 +260,8 @@ struct vnops {
 #define VOP_READLINK(VP, U)        ((VP)->v_op->vop_readlink)(VP, U)
 #define VOP_SYMLINK(DVP, NP, OP)   ((DVP)->v_op->vop_symlink)(DVP, NP, OP)
 #define VOP_POLL(VP, EP, ECP)	   ((VP)->v_op->vop_poll)(VP, EP, ECP)
+#define VOP_GETPAGE(VP, OFF, PP)   ((VP)->v_op->vop_getpage)(VP, OFF, PP)
+#define VOP_PUTPAGE(VP, OFF)	   ((VP)->v_op->vop_putpage)(VP, OFF)
 
 int vfscore_vop_nullop();
 int vfscore_vop_einval();
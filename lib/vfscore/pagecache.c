@@ -0,0 +1,391 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <uk/alloc.h>
+#include <uk/arch/limits.h>
+#include <uk/assert.h>
+#include <uk/essentials.h>
+#include <uk/list.h>
+#include <uk/mutex.h>
+#include <vfscore/pagecache.h>
+
+#define PAGECACHE_HASH_SHIFT	10
+#define PAGECACHE_HASH_SIZE	(1UL << PAGECACHE_HASH_SHIFT)
+#define PAGECACHE_READAHEAD	CONFIG_LIBVFSCORE_PAGECACHE_READAHEAD
+
+struct vfscore_page {
+	struct uk_hlist_node hash_link;
+	struct uk_list_head lru_link;	/* Least recently used first */
+	struct uk_list_head vp_link;	/* Pages of the same vnode */
+	struct vnode *vp;
+	unsigned long index;		/* Page index within the file */
+	unsigned int refs;		/* Users and mappings; no eviction */
+	char *data;
+};
+
+/* The lock protects the lookup structures and the reference counts. The data
+ * of the pages of a vnode is protected by the vnode lock.
+ */
+static struct uk_mutex pagecache_lock = UK_MUTEX_INITIALIZER(pagecache_lock);
+static struct uk_hlist_head pagecache_hash[PAGECACHE_HASH_SIZE];
+static UK_LIST_HEAD(pagecache_lru);
+static unsigned long pagecache_nr_pages;
+
+static inline struct uk_hlist_head *pagecache_bucket(struct vnode *vp,
+						     unsigned long index)
+{
+	__u64 key = ((__uptr)vp >> 4) + index;
+
+	return &pagecache_hash[(key * 0x9e3779b97f4a7c15ULL) >>
+			       (64 - PAGECACHE_HASH_SHIFT)];
+}
+
+/* Call with pagecache_lock held */
+static struct vfscore_page *pagecache_lookup(struct vnode *vp,
+					     unsigned long index)
+{
+	struct vfscore_page *pg;
+
+	uk_hlist_for_each_entry(pg, pagecache_bucket(vp, index), hash_link) {
+		if (pg->vp == vp && pg->index == index)
+			return pg;
+	}
+	return NULL;
+}
+
+/* Call with pagecache_lock held */
+static void pagecache_remove(struct vfscore_page *pg)
+{
+	uk_hlist_del(&pg->hash_link);
+	uk_list_del(&pg->lru_link);
+	uk_list_del(&pg->vp_link);
+	pagecache_nr_pages--;
+}
+
+static void pagecache_free(struct vfscore_page *pg)
+{
+	uk_pfree(uk_alloc_get_default(), pg->data, 1);
+	free(pg);
+}
+
+/* Call with pagecache_lock held. Returns 0 if all pages are in use. */
+static int pagecache_evict(void)
+{
+	struct vfscore_page *pg;
+
+	uk_list_for_each_entry(pg, &pagecache_lru, lru_link) {
+		if (pg->refs)
+			continue;
+		pagecache_remove(pg);
+		pagecache_free(pg);
+		return 1;
+	}
+	return 0;
+}
+
+/* Returns a referenced page with undefined contents that is not yet in the
+ * cache, evicting other pages if needed
+ */
+static struct vfscore_page *pagecache_alloc(void)
+{
+	struct vfscore_page *pg;
+	int evicted;
+
+	uk_mutex_lock(&pagecache_lock);
+	while (pagecache_nr_pages >= CONFIG_LIBVFSCORE_PAGECACHE_MAX_PAGES &&
+	       pagecache_evict())
+		;
+	uk_mutex_unlock(&pagecache_lock);
+
+	pg = malloc(sizeof(*pg));
+	if (unlikely(!pg))
+		return NULL;
+
+	do {
+		pg->data = uk_palloc(uk_alloc_get_default(), 1);
+		if (likely(pg->data))
+			break;
+
+		/* Memory pressure: make room at the expense of the cache */
+		uk_mutex_lock(&pagecache_lock);
+		evicted = pagecache_evict();
+		uk_mutex_unlock(&pagecache_lock);
+	} while (evicted);
+
+	if (unlikely(!pg->data)) {
+		free(pg);
+		return NULL;
+	}
+	pg->refs = 1;
+	return pg;
+}
+
+/* Call with pagecache_lock held */
+static void pagecache_insert(struct vfscore_page *pg, struct vnode *vp,
+			     unsigned long index)
+{
+	pg->vp = vp;
+	pg->index = index;
+	uk_hlist_add_head(&pg->hash_link, pagecache_bucket(vp, index));
+	uk_list_add_tail(&pg->lru_link, &pagecache_lru);
+	uk_list_add_tail(&pg->vp_link, &vp->v_pages);
+	pagecache_nr_pages++;
+}
+
+/* Returns the page with a reference, if it is cached */
+static struct vfscore_page *pagecache_find(struct vnode *vp,
+					   unsigned long index)
+{
+	struct vfscore_page *pg;
+
+	uk_mutex_lock(&pagecache_lock);
+	pg = pagecache_lookup(vp, index);
+	if (pg) {
+		pg->refs++;
+		uk_list_move_tail(&pg->lru_link, &pagecache_lru);
+	}
+	uk_mutex_unlock(&pagecache_lock);
+	return pg;
+}
+
+static void pagecache_release(struct vfscore_page *pg)
+{
+	uk_mutex_lock(&pagecache_lock);
+	UK_ASSERT(pg->refs > 0);
+	pg->refs--;
+	uk_mutex_unlock(&pagecache_lock);
+}
+
+static int pagecache_cached(struct vnode *vp, unsigned long index)
+{
+	int rc;
+
+	uk_mutex_lock(&pagecache_lock);
+	rc = pagecache_lookup(vp, index) != NULL;
+	uk_mutex_unlock(&pagecache_lock);
+	return rc;
+}
+
+/*
+ * Returns the page with the given index with a reference, reading it from the
+ * file system if it is not cached. Misses at the start of the file or right
+ * after a cached page look like sequential reads and also read the pages that
+ * follow, in a single request to the file system.
+ */
+static int pagecache_get(struct vfscore_file *fp, unsigned long index,
+			 struct vfscore_page **pgp)
+{
+	struct vnode *vp = fp->f_dentry->d_vnode;
+	struct vfscore_page *pages[PAGECACHE_READAHEAD];
+	struct iovec iov[PAGECACHE_READAHEAD];
+	unsigned long n, i, eof;
+	struct uio uio;
+	size_t bytes, filled;
+	int error;
+
+	*pgp = pagecache_find(vp, index);
+	if (*pgp)
+		return 0;
+
+	n = 1;
+	if (PAGECACHE_READAHEAD > 1 &&
+	    (index == 0 || pagecache_cached(vp, index - 1))) {
+		eof = DIV_ROUND_UP((unsigned long)vp->v_size, __PAGE_SIZE);
+		if (eof > index)
+			n = MIN(eof - index, PAGECACHE_READAHEAD);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (i > 0 && pagecache_cached(vp, index + i))
+			break;
+		pages[i] = pagecache_alloc();
+		if (!pages[i]) {
+			if (i == 0)
+				return ENOMEM;
+			break;
+		}
+		iov[i].iov_base = pages[i]->data;
+		iov[i].iov_len = __PAGE_SIZE;
+	}
+	n = i;
+
+	uio = (struct uio){
+		.uio_iov = iov,
+		.uio_iovcnt = n,
+		.uio_offset = (off_t)index * __PAGE_SIZE,
+		.uio_resid = n * __PAGE_SIZE,
+		.uio_rw = UIO_READ,
+	};
+	error = VOP_READ(vp, fp, &uio, 0);
+	if (unlikely(error)) {
+		for (i = 0; i < n; i++)
+			pagecache_free(pages[i]);
+		return error;
+	}
+
+	/* Everything past the end of the file reads as zeros */
+	bytes = n * __PAGE_SIZE - uio.uio_resid;
+	uk_mutex_lock(&pagecache_lock);
+	for (i = 0; i < n; i++) {
+		filled = MIN(bytes, __PAGE_SIZE);
+		if (filled < __PAGE_SIZE)
+			memset(pages[i]->data + filled, 0,
+			       __PAGE_SIZE - filled);
+		bytes -= filled;
+		pagecache_insert(pages[i], vp, index + i);
+		if (i > 0)
+			pages[i]->refs--;
+	}
+	uk_mutex_unlock(&pagecache_lock);
+
+	*pgp = pages[0];
+	return 0;
+}
+
+int vfscore_pagecache_read(struct vfscore_file *fp, struct uio *uio)
+{
+	struct vnode *vp = fp->f_dentry->d_vnode;
+	struct vfscore_page *pg;
+	size_t off, len;
+	int error;
+
+	if (uio->uio_offset < 0)
+		return EINVAL;
+
+	while (uio->uio_resid > 0 && uio->uio_offset < vp->v_size) {
+		off = uio->uio_offset % __PAGE_SIZE;
+		len = MIN((size_t)uio->uio_resid, __PAGE_SIZE - off);
+		len = MIN(len, (size_t)(vp->v_size - uio->uio_offset));
+
+		error = pagecache_get(fp, uio->uio_offset / __PAGE_SIZE, &pg);
+		if (unlikely(error))
+			return error;
+
+		error = vfscore_uiomove(pg->data + off, len, uio);
+		pagecache_release(pg);
+		if (unlikely(error))
+			return error;
+	}
+	return 0;
+}
+
+/* Copies `len` bytes that start `skip` bytes into the I/O vector */
+static void iov_copy_from(char *dst, const struct iovec *iov, int iovcnt,
+			  size_t skip, size_t len)
+{
+	size_t n;
+
+	for (; iovcnt > 0 && len > 0; iov++, iovcnt--) {
+		if (skip >= iov->iov_len) {
+			skip -= iov->iov_len;
+			continue;
+		}
+		n = MIN(iov->iov_len - skip, len);
+		memcpy(dst, (const char *)iov->iov_base + skip, n);
+		dst += n;
+		len -= n;
+		skip = 0;
+	}
+}
+
+void vfscore_pagecache_write(struct vnode *vp, off_t off, size_t len,
+			     const struct iovec *iov, int iovcnt)
+{
+	struct vfscore_page *pg;
+	size_t done, pgoff, n;
+
+	if (!vfscore_pagecache_enabled(vp))
+		return;
+
+	for (done = 0; done < len; done += n) {
+		pgoff = (off + done) % __PAGE_SIZE;
+		n = MIN(len - done, __PAGE_SIZE - pgoff);
+
+		pg = pagecache_find(vp, (off + done) / __PAGE_SIZE);
+		if (!pg)
+			continue;
+		iov_copy_from(pg->data + pgoff, iov, iovcnt, done, n);
+		pagecache_release(pg);
+	}
+}
+
+void vfscore_pagecache_truncate(struct vnode *vp, off_t length)
+{
+	struct vfscore_page *pg, *next;
+	unsigned long index = length / __PAGE_SIZE;
+	size_t off = length % __PAGE_SIZE;
+
+	if (!vfscore_pagecache_enabled(vp))
+		return;
+
+	/* Pages that are still mapped are zeroed instead */
+	uk_mutex_lock(&pagecache_lock);
+	uk_list_for_each_entry_safe(pg, next, &vp->v_pages, vp_link) {
+		if (pg->index == index && off) {
+			memset(pg->data + off, 0, __PAGE_SIZE - off);
+		} else if (pg->index >= index) {
+			if (pg->refs) {
+				memset(pg->data, 0, __PAGE_SIZE);
+				continue;
+			}
+			pagecache_remove(pg);
+			pagecache_free(pg);
+		}
+	}
+	uk_mutex_unlock(&pagecache_lock);
+}
+
+void vfscore_pagecache_drop(struct vnode *vp)
+{
+	struct vfscore_page *pg, *next;
+
+	if (!vfscore_pagecache_enabled(vp))
+		return;
+
+	uk_mutex_lock(&pagecache_lock);
+	uk_list_for_each_entry_safe(pg, next, &vp->v_pages, vp_link) {
+		/* Mappings keep the file and thus the vnode alive */
+		UK_ASSERT(!pg->refs);
+		pagecache_remove(pg);
+		pagecache_free(pg);
+	}
+	uk_mutex_unlock(&pagecache_lock);
+}
+
+int vfscore_pagecache_getpage(struct vfscore_file *fp, off_t off, void **page)
+{
+	struct vfscore_page *pg;
+	int error;
+
+	UK_ASSERT(off >= 0 && !(off % __PAGE_SIZE));
+
+	error = pagecache_get(fp, off / __PAGE_SIZE, &pg);
+	if (unlikely(error))
+		return error;
+
+	/* The reference is kept by the mapping */
+	*page = pg->data;
+	return 0;
+}
+
+void vfscore_pagecache_putpage(struct vnode *vp, off_t off)
+{
+	struct vfscore_page *pg;
+
+	uk_mutex_lock(&pagecache_lock);
+	pg = pagecache_lookup(vp, off / __PAGE_SIZE);
+
+	/* Referenced pages are neither evicted nor dropped by truncation */
+	UK_ASSERT(pg);
+	UK_ASSERT(pg->refs > 0);
+	pg->refs--;
+	uk_mutex_unlock(&pagecache_lock);
+}
@@ -203,6 +203,8 @@ static struct vnops stdio_vnops = {
 	stdio_readlink,		/* read link */
 	stdio_symlink,		/* symbolic link */
 	stdio_poll,		/* poll */
+	(vnop_getpage_t) NULL,	/* get page */
+	(vnop_putpage_t) NULL,	/* put page */
 };
 
 static struct vnode stdio_vnode = {
@@ -54,6 +54,7 @@
 #include <vfscore/prex.h>
 #include <vfscore/vnode.h>
 #include <vfscore/file.h>
+#include <vfscore/pagecache.h>
 
 #include "vfs.h"
 #include <vfscore/fs.h>
@@ -219,6 +220,7 @@ sys_open(char *path, int flags, mode_t mode, struct vfscore_file **fpp)
 		error = VOP_TRUNCATE(vp, 0);
 		if (error)
 			goto out_fp_free_unlock;
+		vfscore_pagecache_truncate(vp, 0);
 	}
 
 	error = VOP_OPEN(vp, fp);
@@ -1179,6 +1181,8 @@ sys_truncate(char *path, off_t length)
 
 	vn_lock(dp->d_vnode);
 	error = VOP_TRUNCATE(dp->d_vnode, length);
+	if (!error)
+		vfscore_pagecache_truncate(dp->d_vnode, length);
 	vn_unlock(dp->d_vnode);
 
 	drele(dp);
@@ -1197,6 +1201,8 @@ sys_ftruncate(struct vfscore_file *fp, off_t length)
 	vp = fp->f_dentry->d_vnode;
 	vn_lock(vp);
 	error = VOP_TRUNCATE(vp, length);
+	if (!error)
+		vfscore_pagecache_truncate(vp, length);
 	vn_unlock(vp);
 
 	return error;
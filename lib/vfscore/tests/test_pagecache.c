@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+ * Licensed under the BSD-3-Clause License (the "License").
+ * You may not use this file except in compliance with the License.
+ */
+#include <string.h>
+#include <sys/param.h>
+
+#include <uk/test.h>
+#include <uk/arch/limits.h>
+#include <vfscore/dentry.h>
+#include <vfscore/pagecache.h>
+#include "../vfs.h"
+
+#define TEST_READAHEAD		CONFIG_LIBVFSCORE_PAGECACHE_READAHEAD
+#define TEST_PAGES		(4 * TEST_READAHEAD + 8)
+#define TEST_SIZE		((off_t)(TEST_PAGES * __PAGE_SIZE))
+
+/* A file system with a single file that counts the requests it serves */
+static char test_data[TEST_SIZE];
+static unsigned int test_reads;
+static unsigned int test_writes;
+
+static int test_read(struct vnode *vp, struct vfscore_file *fp __unused,
+		     struct uio *uio, int ioflag __unused)
+{
+	test_reads++;
+	if (uio->uio_offset >= vp->v_size)
+		return 0;
+	return vfscore_uiomove(test_data + uio->uio_offset,
+			       MIN(uio->uio_resid,
+				   vp->v_size - uio->uio_offset), uio);
+}
+
+static int test_write(struct vnode *vp, struct uio *uio, int ioflag __unused)
+{
+	off_t end = uio->uio_offset + uio->uio_resid;
+	int error;
+
+	test_writes++;
+	if (end > TEST_SIZE)
+		return EFBIG;
+	error = vfscore_uiomove(test_data + uio->uio_offset, uio->uio_resid,
+				uio);
+	if (!error && end > vp->v_size)
+		vp->v_size = end;
+	return error;
+}
+
+static int test_truncate(struct vnode *vp, off_t length)
+{
+	if (length > TEST_SIZE)
+		return EFBIG;
+	if (length < vp->v_size)
+		memset(test_data + length, 0, vp->v_size - length);
+	vp->v_size = length;
+	return 0;
+}
+
+static struct vnops test_vnops = {
+	.vop_read	= test_read,
+	.vop_write	= test_write,
+	.vop_truncate	= test_truncate,
+};
+
+static struct mount test_mnt = { .m_flags = MNT_PAGECACHE };
+static struct vnode test_vp;
+static struct dentry test_dp = { .d_vnode = &test_vp, .d_mount = &test_mnt };
+static struct vfscore_file test_fp = { .f_dentry = &test_dp };
+
+static void test_file_reset(off_t size)
+{
+	unsigned int i;
+
+	if (test_vp.v_refcnt)
+		vfscore_pagecache_drop(&test_vp);
+
+	test_vp = (struct vnode){
+		.v_mount = &test_mnt,
+		.v_op = &test_vnops,
+		.v_refcnt = 1,
+		.v_type = VREG,
+		.v_size = size,
+	};
+	uk_mutex_init_config(&test_vp.v_lock, UK_MUTEX_CONFIG_RECURSE);
+	UK_INIT_LIST_HEAD(&test_vp.v_pages);
+
+	for (i = 0; i < TEST_SIZE; i++)
+		test_data[i] = (i < size) ? (char)(i * 7 + i / __PAGE_SIZE) : 0;
+	test_reads = 0;
+	test_writes = 0;
+}
+
+static int test_pread(void *buf, size_t len, off_t off, size_t *bytes)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct uio uio = {
+		.uio_iov = &iov,
+		.uio_iovcnt = 1,
+		.uio_offset = off,
+		.uio_resid = len,
+		.uio_rw = UIO_READ,
+	};
+	int error;
+
+	error = vfs_read(&test_fp, &uio, FOF_OFFSET);
+	*bytes = len - uio.uio_resid;
+	return error;
+}
+
+static int test_pwrite(const void *buf, size_t len, off_t off)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)buf, .iov_len = len / 2 },
+		{ .iov_base = (char *)buf + len / 2, .iov_len = len - len / 2 },
+	};
+	struct uio uio = {
+		.uio_iov = iov,
+		.uio_iovcnt = 2,
+		.uio_offset = off,
+		.uio_resid = len,
+		.uio_rw = UIO_WRITE,
+	};
+
+	return vfs_write(&test_fp, &uio, FOF_OFFSET);
+}
+
+UK_TESTCASE(vfscore_pagecache, test_pagecache_readahead)
+{
+	static char buf[TEST_SIZE];
+	size_t bytes;
+	unsigned int i;
+
+	test_file_reset(TEST_SIZE - 100);
+
+	/* A read at the start of the file reads ahead */
+	UK_TEST_EXPECT_ZERO(test_pread(buf, 1, 0, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, 1);
+	for (i = 0; i < TEST_READAHEAD; i++)
+		UK_TEST_EXPECT_ZERO(test_pread(buf, __PAGE_SIZE,
+					       i * __PAGE_SIZE, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, 1);
+
+	/* Sequential reads continue to read ahead, random reads do not */
+	UK_TEST_EXPECT_ZERO(test_pread(buf, 1, TEST_READAHEAD * __PAGE_SIZE,
+				       &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, 2);
+	UK_TEST_EXPECT_ZERO(test_pread(buf, 1, (TEST_PAGES - 3) * __PAGE_SIZE,
+				       &bytes));
+	UK_TEST_EXPECT_ZERO(test_pread(buf, 1, (TEST_PAGES - 2) * __PAGE_SIZE,
+				       &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, 4);
+
+	/* The data is read up to the end of the file */
+	UK_TEST_EXPECT_ZERO(test_pread(buf, TEST_SIZE, 0, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(bytes, TEST_SIZE - 100);
+	UK_TEST_EXPECT_ZERO(memcmp(buf, test_data, TEST_SIZE - 100));
+}
+
+UK_TESTCASE(vfscore_pagecache, test_pagecache_write)
+{
+	static char buf[3 * __PAGE_SIZE];
+	char data[__PAGE_SIZE + 200];
+	unsigned int reads;
+	size_t bytes;
+
+	test_file_reset(3 * __PAGE_SIZE - 100);
+	memset(data, 'x', sizeof(data));
+
+	/* Writes go through to the file system and update cached pages */
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+	reads = test_reads;
+	UK_TEST_EXPECT_ZERO(test_pwrite(data, sizeof(data), 100));
+	UK_TEST_EXPECT_SNUM_EQ(test_writes, 1);
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, reads);
+	UK_TEST_EXPECT_ZERO(memcmp(buf, test_data, bytes));
+	UK_TEST_EXPECT_ZERO(memcmp(buf + 100, data, sizeof(data)));
+
+	/* Appended data is visible in the cached last page */
+	UK_TEST_EXPECT_ZERO(test_pwrite(data, 10, 3 * __PAGE_SIZE - 100));
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 2 * __PAGE_SIZE,
+				       &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, reads);
+	UK_TEST_EXPECT_SNUM_EQ(bytes, __PAGE_SIZE - 90);
+	UK_TEST_EXPECT_ZERO(memcmp(buf + __PAGE_SIZE - 100, data, 10));
+}
+
+UK_TESTCASE(vfscore_pagecache, test_pagecache_truncate)
+{
+	static char buf[2 * __PAGE_SIZE];
+	static const char zero[2 * __PAGE_SIZE];
+	size_t bytes;
+
+	test_file_reset(4 * __PAGE_SIZE);
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+
+	/* The truncated part reads as zeros when the file grows again */
+	UK_TEST_EXPECT_ZERO(sys_ftruncate(&test_fp, 100));
+	UK_TEST_EXPECT_ZERO(sys_ftruncate(&test_fp, 2 * __PAGE_SIZE));
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(bytes, sizeof(buf));
+	UK_TEST_EXPECT_ZERO(memcmp(buf, test_data, 100));
+	UK_TEST_EXPECT_ZERO(memcmp(buf + 100, zero, sizeof(buf) - 100));
+}
+
+UK_TESTCASE(vfscore_pagecache, test_pagecache_getpage)
+{
+	char buf[16];
+	size_t bytes;
+	void *page;
+
+	test_file_reset(2 * __PAGE_SIZE);
+
+	/* Pages are shared with read() and kept while they are referenced */
+	vn_lock(&test_vp);
+	UK_TEST_ASSERT(vfscore_has_pages(&test_vp));
+	UK_TEST_EXPECT_ZERO(vfscore_getpage(&test_fp, __PAGE_SIZE, &page));
+	vn_unlock(&test_vp);
+	UK_TEST_EXPECT_ZERO(memcmp(page, test_data + __PAGE_SIZE,
+				   __PAGE_SIZE));
+
+	UK_TEST_EXPECT_ZERO(test_pwrite("hello", 5, __PAGE_SIZE + 8));
+	UK_TEST_EXPECT_ZERO(memcmp((char *)page + 8, "hello", 5));
+
+	UK_TEST_EXPECT_ZERO(sys_ftruncate(&test_fp, 0));
+	UK_TEST_EXPECT_ZERO(((char *)page)[8]);
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), __PAGE_SIZE,
+				       &bytes));
+	UK_TEST_EXPECT_ZERO(bytes);
+
+	vn_lock(&test_vp);
+	vfscore_putpage(&test_vp, __PAGE_SIZE);
+	vn_unlock(&test_vp);
+}
+
+/* Every mapping holds its own reference on a page */
+UK_TESTCASE(vfscore_pagecache, test_pagecache_getpage_refs)
+{
+	void *page, *page2;
+
+	test_file_reset(__PAGE_SIZE);
+
+	vn_lock(&test_vp);
+	UK_TEST_EXPECT_ZERO(vfscore_getpage(&test_fp, 0, &page));
+	UK_TEST_EXPECT_ZERO(vfscore_getpage(&test_fp, 0, &page2));
+	UK_TEST_EXPECT_PTR_EQ(page, page2);
+	vfscore_putpage(&test_vp, 0);
+	vn_unlock(&test_vp);
+
+	/* The remaining reference keeps the page */
+	UK_TEST_EXPECT_ZERO(sys_ftruncate(&test_fp, 0));
+	UK_TEST_EXPECT(!uk_list_empty(&test_vp.v_pages));
+
+	vn_lock(&test_vp);
+	vfscore_putpage(&test_vp, 0);
+	vn_unlock(&test_vp);
+
+	UK_TEST_EXPECT_ZERO(sys_ftruncate(&test_fp, 0));
+	UK_TEST_EXPECT(uk_list_empty(&test_vp.v_pages));
+}
+
+UK_TESTCASE(vfscore_pagecache, test_pagecache_drop)
+{
+	char buf[16];
+	size_t bytes;
+
+	test_file_reset(__PAGE_SIZE);
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, 1);
+
+	vfscore_pagecache_drop(&test_vp);
+	UK_TEST_EXPECT(uk_list_empty(&test_vp.v_pages));
+	UK_TEST_EXPECT_ZERO(test_pread(buf, sizeof(buf), 0, &bytes));
+	UK_TEST_EXPECT_SNUM_EQ(test_reads, 2);
+	UK_TEST_EXPECT_ZERO(memcmp(buf, test_data, sizeof(buf)));
+}
+
+uk_testsuite_register(vfscore_pagecache, NULL);
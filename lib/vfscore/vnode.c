@@ -47,6 +47,7 @@
 #include <vfscore/prex.h>
 #include <vfscore/dentry.h>
 #include <vfscore/vnode.h>
+#include <vfscore/pagecache.h>
 #include "vfs.h"
 
 #define __UK_S_BLKSIZE 512
@@ -198,6 +199,7 @@ vfscore_vget(struct mount *mp, uint64_t ino, struct vnode **vpp)
 	}
 
 	UK_INIT_LIST_HEAD(&vp->v_names);
+	UK_INIT_LIST_HEAD(&vp->v_pages);
 	vp->v_ino = ino;
 	vp->v_mount = mp;
 	vp->v_refcnt = 1;
@@ -242,6 +244,8 @@ vput(struct vnode *vp)
 	uk_list_del(&vp->v_link);
 	VNODE_UNLOCK();
 
+	vfscore_pagecache_drop(vp);
+
 	/*
 	 * Deallocate fs specific vnode data
 	 */
@@ -289,6 +293,8 @@ vrele(struct vnode *vp)
 	uk_list_del(&vp->v_link);
 	VNODE_UNLOCK();
 
+	vfscore_pagecache_drop(vp);
+
 	/*
 	 * Deallocate fs specific vnode data
 	 */
@@ -33,6 +33,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <uk/assert.h>
 #include <uk/print.h>
 #include <uk/alloc.h>
@@ -181,10 +182,8 @@ static void blkfront_request_map_grefs(struct blkif_request *ring_req,
 {
 	uint16_t gref_index;
 	struct blkfront_request *blkfront_req;
-	struct uk_blkreq *req;
 	uint16_t nb_segments;
 	uintptr_t data;
-	uintptr_t start_sector;
 	struct blkfront_gref *ref_elem;
 #if CONFIG_XEN_BLKFRONT_GREFPOOL
 	int rc;
@@ -193,12 +192,10 @@ static void blkfront_request_map_grefs(struct blkif_request *ring_req,
 	UK_ASSERT(ring_req);
 
 	blkfront_req = (struct blkfront_request *)ring_req->id;
-	req = blkfront_req->req;
-	start_sector = round_pgdown((uintptr_t)req->aio_buf);
 	nb_segments = blkfront_req->nb_segments;
 
 	for (gref_index = 0; gref_index < nb_segments; ++gref_index) {
-		data = start_sector + gref_index * PAGE_SIZE;
+		data = blkfront_req->seg_page[gref_index];
 		ref_elem = blkfront_req->gref[gref_index];
 
 #if CONFIG_XEN_BLKFRONT_GREFPOOL
@@ -216,53 +213,98 @@ static void blkfront_request_map_grefs(struct blkif_request *ring_req,
 	}
 }
 
-static void blkif_request_init(struct blkif_request *ring_req,
-		__sector sector_size)
+/* Adds a segment for each page of a data buffer to the ring request */
+static int blkif_request_add_buf(struct blkif_request *ring_req,
+		uintptr_t start_data, size_t len, __sector sector_size)
 {
-	uintptr_t start_sector, end_sector;
-	uint16_t nb_segments;
 	struct blkfront_request *blkfront_req;
-	struct uk_blkreq *req;
-	uintptr_t start_data, end_data;
+	uintptr_t end_data, page;
 	uint16_t seg;
 
-	UK_ASSERT(ring_req);
 	blkfront_req = (struct blkfront_request *)ring_req->id;
-	req = blkfront_req->req;
-	start_data = (uintptr_t)req->aio_buf;
-	end_data = (uintptr_t)req->aio_buf + req->nb_sectors * sector_size;
+	end_data = start_data + len;
 
 	/* Can't io non-sector-aligned buffer */
-	UK_ASSERT(!(start_data & (sector_size - 1)));
+	if (unlikely((start_data | len) & (sector_size - 1)) || len == 0)
+		return -EINVAL;
 
 	/*
-	 * Find number of segments (pages)
 	 * Being sector-size aligned buffer, it may not be aligned
-	 * to page_size. If so, it is necessary to find the start and end
-	 * of the pages the buffer is allocated, in order to calculate the
-	 * number of pages the request has.
+	 * to page_size. If so, only the sectors of the first and the last
+	 * page that belong to the buffer are part of the request.
 	 **/
-	start_sector = round_pgdown(start_data);
-	end_sector = round_pgup(end_data);
-	nb_segments = (end_sector - start_sector) / PAGE_SIZE;
-	UK_ASSERT(nb_segments <= BLKIF_MAX_SEGMENTS_PER_REQUEST);
+	for (page = round_pgdown(start_data); page < end_data;
+	     page += PAGE_SIZE) {
+		seg = ring_req->nr_segments;
+		if (unlikely(seg == BLKIF_MAX_SEGMENTS_PER_REQUEST))
+			return -EINVAL;
+
+		blkfront_req->seg_page[seg] = page;
+		ring_req->seg[seg].first_sect = (page < start_data) ?
+			SECTOR_INDEX_IN_PAGE(start_data, sector_size) : 0;
+		ring_req->seg[seg].last_sect = (page + PAGE_SIZE > end_data) ?
+			SECTOR_INDEX_IN_PAGE(end_data - 1, sector_size) :
+			PAGE_SIZE / sector_size - 1;
+		ring_req->nr_segments++;
+	}
+
+	return 0;
+}
+
+static int blkif_request_init(struct blkif_request *ring_req,
+		__sector sector_size)
+{
+	struct blkfront_request *blkfront_req;
+	struct uk_blkreq *req;
+	int i, rc;
+
+	UK_ASSERT(ring_req);
+	blkfront_req = (struct blkfront_request *)ring_req->id;
+	req = blkfront_req->req;
 
 	/* Set ring request */
 	ring_req->operation = (req->operation == UK_BLKREQ_WRITE) ?
 			BLKIF_OP_WRITE : BLKIF_OP_READ;
-	ring_req->nr_segments = nb_segments;
+	ring_req->nr_segments = 0;
 	ring_req->sector_number = req->start_sector;
 
 	/* Set for each page the offset of sectors used for request */
-	for (seg = 0; seg < nb_segments; ++seg) {
-		ring_req->seg[seg].first_sect = 0;
-		ring_req->seg[seg].last_sect = PAGE_SIZE / sector_size - 1;
+	if (req->iovcnt == 0)
+		return blkif_request_add_buf(ring_req,
+				(uintptr_t)req->aio_buf,
+				req->nb_sectors * sector_size, sector_size);
+
+	for (i = 0; i < req->iovcnt; ++i) {
+		rc = blkif_request_add_buf(ring_req,
+				(uintptr_t)req->iov[i].iov_base,
+				req->iov[i].iov_len, sector_size);
+		if (rc)
+			return rc;
 	}
 
-	ring_req->seg[0].first_sect =
-			SECTOR_INDEX_IN_PAGE(start_data, sector_size);
-	ring_req->seg[nb_segments - 1].last_sect =
-			SECTOR_INDEX_IN_PAGE(end_data - 1, sector_size);
+	return 0;
+}
+
+/* Checks that the data buffers of a request cover exactly its sectors */
+static int blkfront_request_check_iov(struct uk_blkdev_cap *cap,
+		struct uk_blkreq *req)
+{
+	size_t data_size = 0;
+	int i;
+
+	if (req->iov == NULL || req->iovcnt > cap->max_segments)
+		return -EINVAL;
+
+	for (i = 0; i < req->iovcnt; ++i) {
+		if (req->iov[i].iov_base == NULL)
+			return -EINVAL;
+		data_size += req->iov[i].iov_len;
+	}
+
+	if (data_size != req->nb_sectors * cap->ssize)
+		return -EINVAL;
+
+	return 0;
 }
 
 static int blkfront_request_write(struct blkfront_request *blkfront_req,
@@ -282,8 +324,13 @@ static int blkfront_request_write(struct blkfront_request *blkfront_req,
 	if (req->operation == UK_BLKREQ_WRITE && cap->mode == O_RDONLY)
 		return -EPERM;
 
-	if (req->aio_buf == NULL)
+	if (req->iovcnt > 0) {
+		rc = blkfront_request_check_iov(cap, req);
+		if (rc)
+			return rc;
+	} else if (req->aio_buf == NULL) {
 		return -EINVAL;
+	}
 
 	if (req->nb_sectors == 0)
 		return -EINVAL;
@@ -294,7 +341,9 @@ static int blkfront_request_write(struct blkfront_request *blkfront_req,
 	if (req->nb_sectors > cap->max_sectors_per_req)
 		return -EINVAL;
 
-	blkif_request_init(ring_req, sector_size);
+	rc = blkif_request_init(ring_req, sector_size);
+	if (rc)
+		return rc;
 	blkfront_req->nb_segments = ring_req->nr_segments;
 
 	/* Get blkfront_grefs from pool or allocate new ones */
@@ -332,6 +381,42 @@ static int blkfront_request_flush(struct blkfront_request *blkfront_req,
 	return 0;
 }
 
+static int blkfront_request_discard(struct blkfront_request *blkfront_req,
+		struct blkif_request *ring_req)
+{
+	struct blkif_request_discard *discard_req;
+	struct uk_blkdev_cap *cap;
+	struct uk_blkreq *req;
+
+	UK_ASSERT(ring_req);
+
+	req = blkfront_req->req;
+	cap = &blkfront_req->queue->dev->blkdev.capabilities;
+
+	/* There is no ring operation for writing zeroes */
+	if (req->operation != UK_BLKREQ_DISCARD || !cap->max_discard_sectors)
+		return -ENOTSUP;
+
+	if (cap->mode == O_RDONLY)
+		return -EPERM;
+
+	if (req->nb_sectors == 0)
+		return -EINVAL;
+
+	if (req->start_sector + req->nb_sectors > cap->sectors)
+		return -EINVAL;
+
+	/* Id and handle are at the same place as for other requests */
+	discard_req = (struct blkif_request_discard *)ring_req;
+	discard_req->operation = BLKIF_OP_DISCARD;
+	discard_req->flag = 0;
+	discard_req->sector_number = req->start_sector;
+	discard_req->nr_sectors = req->nb_sectors;
+	blkfront_req->nb_segments = 0;
+
+	return 0;
+}
+
 static int blkfront_queue_enqueue(struct uk_blkdev_queue *queue,
 		struct uk_blkreq *req)
 {
@@ -363,6 +448,9 @@ static int blkfront_queue_enqueue(struct uk_blkdev_queue *queue,
 		rc = blkfront_request_write(blkfront_req, ring_req);
 	else if (req->operation == UK_BLKREQ_FFLUSH)
 		rc =  blkfront_request_flush(blkfront_req, ring_req);
+	else if (req->operation == UK_BLKREQ_DISCARD ||
+			req->operation == UK_BLKREQ_WRITE_ZEROES)
+		rc = blkfront_request_discard(blkfront_req, ring_req);
 	else
 		rc = -EINVAL;
 
@@ -491,6 +579,9 @@ static int blkfront_queue_dequeue(struct uk_blkdev_queue *queue,
 		if (status != BLKIF_RSP_OKAY)
 			uk_pr_err("Flush_diskcache error %d\n", status);
 		break;
+	case BLKIF_OP_DISCARD:
+		CHECK_STATUS(req_from_q, status, "discard");
+		break;
 	default:
 		uk_pr_err("Unrecognized block operation %d (rsp %d)\n",
 				rsp->operation, status);
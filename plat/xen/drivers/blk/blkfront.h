@@ -96,6 +96,8 @@ struct blkfront_request {
 	struct blkfront_gref *gref[BLKIF_MAX_SEGMENTS_PER_REQUEST];
 	/* Number of segments. */
 	uint16_t nb_segments;
+	/* Start address of the page of each segment. */
+	uintptr_t seg_page[BLKIF_MAX_SEGMENTS_PER_REQUEST];
 	/* Queue in which the request will be stored */
 	struct uk_blkdev_queue *queue;
 };
@@ -142,6 +144,10 @@ struct blkfront_dev {
 	 * BLKIF_OP_WRITE_FLUSH_DISKCACHE request opcode.
 	 */
 	int flush;
+	/* Value which indicates that the backend can process requests with the
+	 * BLKIF_OP_DISCARD request opcode.
+	 */
+	int discard;
 	/* Number of configured queues used for requests */
 	uint16_t nb_queues;
 	/* Vector of queues used for communication with backend */
@@ -205,6 +205,12 @@ static int blkfront_xb_get_capabilities(struct blkfront_dev *blkdev)
 		return err;
 	}
 
+	/* Backends that do not support discard may omit the entry */
+	err = xs_scanf(XBT_NIL, xendev->otherend, "feature-discard",
+					"%d", &blkdev->discard);
+	if (err < 0)
+		blkdev->discard = 0;
+
 	mode = xs_read(XBT_NIL, xendev->otherend, "mode");
 	if (PTRISERR(mode)) {
 		uk_pr_err("Failed to read mode from xs: %d.\n", err);
@@ -216,6 +222,11 @@ static int blkfront_xb_get_capabilities(struct blkfront_dev *blkdev)
 			(BLKIF_MAX_SEGMENTS_PER_REQUEST - 1) *
 			(PAGE_SIZE / blkdev->blkdev.capabilities.ssize) + 1;
 	blkdev->blkdev.capabilities.ioalign = blkdev->blkdev.capabilities.ssize;
+	blkdev->blkdev.capabilities.max_segments =
+			BLKIF_MAX_SEGMENTS_PER_REQUEST;
+	blkdev->blkdev.capabilities.max_discard_sectors = (blkdev->discard) ?
+			blkdev->blkdev.capabilities.sectors : 0;
+	blkdev->blkdev.capabilities.max_write_zeroes_sectors = 0;
 
 	free(mode);
 	return 0;
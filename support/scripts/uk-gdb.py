@@ -51,22 +51,34 @@ def get_trace_buffer():
     inf = gdb.selected_inferior()
 
     try:
-        trace_buff = gdb.parse_and_eval("uk_trace_buffer")
-        # trace_buff_size = trace_buff.type.sizeof
-        trace_buff_addr = int(trace_buff.address)
-        trace_buff_writep = int(gdb.parse_and_eval("uk_trace_buffer_writep"))
+        trace_rings = gdb.parse_and_eval("uk_trace_rings")
     except gdb.error:
-        gdb.write("Error getting the trace buffer. Is tracing enabled?\n")
+        gdb.write("Error getting the trace rings. Is tracing enabled?\n")
         raise gdb.error
 
-    if trace_buff_writep == 0:
-        # This can happen as effect of compile optimization if none of
-        # tracepoints were called
-        used = 0
-    else:
-        used = trace_buff_writep - trace_buff_addr
+    nr_rings = trace_rings.type.range()[1] + 1
+    ring_size = trace_rings[0]["data"].type.sizeof
+    rings = []
+    for i in range(nr_rings):
+        ring = trace_rings[i]
+        fields = {
+            name: int(ring[name])
+            for name in (
+                "head",
+                "tail",
+                "lost",
+                "clock0",
+                "nsec0",
+                "clock1",
+                "nsec1",
+            )
+        }
+        fields["data"] = bytes(
+            inf.read_memory(int(ring["data"].address), ring_size)
+        )
+        rings.append(fields)
 
-    return bytes(inf.read_memory(trace_buff_addr, used))
+    return parse.dump_from_rings(rings, ring_size, PTR_SIZE)
 
 
 def save_traces(out):
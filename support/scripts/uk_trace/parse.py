@@ -36,13 +36,25 @@ import re
 import tempfile
 
 TP_HEADER_MAGIC = "TRhd"
+TP_PAD_MAGIC = "TPad"
+TP_END_MAGIC = "TEnd"
 TP_DEF_MAGIC = "TPde"
+DUMP_MAGIC = "UKtr"
+DUMP_RING_MAGIC = "TRng"
 UK_TRACE_ARG_INT = 0
 UK_TRACE_ARG_STRING = 1
 # Not sure why gcc aligns data on 32 bytes
 __STRUCT_ALIGNMENT = 32
+# Alignment of records in trace rings and dumps
+RECORD_ALIGNMENT = 8
 
-FORMAT_VERSION = 1
+FORMAT_VERSION = 2
+DUMP_VERSION = 2
+
+# printf conversions, to find the arguments that are signed
+PRINTF_CONVERSION = re.compile(
+    r"%[#0 +'-]*[0-9*]*(?:\.[0-9*]+)?(?:hh|h|ll|l|L|q|j|z|t)?([a-zA-Z%])"
+)
 
 
 def align_down(v, alignment):
@@ -54,18 +66,22 @@ def align_up(v, alignment):
 
 
 class tp_sample:
-    def __init__(self, tp, time, args):
+    def __init__(self, tp, time, args, cpu=0):
         self.tp = tp
         self.args = args
         self.time = time
+        self.cpu = cpu
+
+    def msg(self):
+        return self.tp.fmt % self.args
 
     def __str__(self):
-        return ("%016d %s: " % (self.time, self.tp.name)) + (
-            self.tp.fmt % self.args
+        return ("%016d %3d %s: " % (self.time, self.cpu, self.tp.name)) + (
+            self.msg()
         )
 
     def tabulate_fmt(self):
-        return [self.time, self.tp.name, (self.tp.fmt % self.args)]
+        return [self.time, self.cpu, self.tp.name, self.msg()]
 
 
 class EndOfBuffer(Exception):
@@ -86,39 +102,130 @@ class EndOfBuffer(Exception):
 # gdb to a running instance or not
 class sample_parser:
     def __init__(self, keyvals, tp_defs_data, trace_buff, ptr_size):
-        if int(keyvals["format_version"]) > FORMAT_VERSION:
+        self.version = int(keyvals["format_version"])
+        if self.version > FORMAT_VERSION:
             print(
                 "Warning: Version of trace format is more recent",
                 file=sys.stderr,
             )
         self.data = unpacker(trace_buff)
+        self.ptr_size = ptr_size
         self.tps = get_tp_definitions(tp_defs_data, ptr_size)
+        self.lost = dict()
 
-    def __iter__(self):
-        self.data.pos = 0
-        return self
-
-    def __next__(self):
-        try:
-            # TODO: generate format. Cookie can be 4 bytes long on other
-            # platforms
-            magic, _, time, cookie = self.data.unpack("4sLQQ")
-        except EndOfBuffer:
-            raise StopIteration
+        if self.version < 2:
+            self.samples = self.parse_v1()
+        else:
+            self.samples = self.parse_dump()
 
-        magic = magic.decode()
-        if magic != TP_HEADER_MAGIC:
-            raise StopIteration
+    def __iter__(self):
+        return iter(self.samples)
 
-        tp = self.tps[cookie]
+    def parse_args(self, tp):
         args = []
         for i in range(tp.args_nr):
             if tp.types[i] == UK_TRACE_ARG_STRING:
                 args += [self.data.unpack_string()]
             else:
-                args += [self.data.unpack_int(tp.sizes[i])]
+                val = self.data.unpack_int(tp.sizes[i])
+                if tp.signed[i] and val >= 1 << (tp.sizes[i] * 8 - 1):
+                    val -= 1 << (tp.sizes[i] * 8)
+                args += [val]
+
+        return tuple(args)
+
+    def parse_v1(self):
+        ret = []
+
+        while True:
+            try:
+                # TODO: generate format. Cookie can be 4 bytes long on
+                # other platforms
+                magic, _, time, cookie = self.data.unpack("4sLQQ")
+            except EndOfBuffer:
+                break
+
+            magic = magic.decode()
+            if magic != TP_HEADER_MAGIC:
+                break
+
+            tp = self.tps[cookie]
+            ret.append(tp_sample(tp, time, self.parse_args(tp)))
+
+        return ret
 
-        return tp_sample(tp, time, tuple(args))
+    # Dumps consist of a header, followed by the records of each LCPU,
+    # see lib/ukdebug/include/uk/trace.h. Record timestamps are converted
+    # from clock ticks to nanoseconds.
+    def parse_dump(self):
+        magic, version, ptr_size, nr_rings, _, clock, nsec = self.data.unpack(
+            "4sHHIIQQ"
+        )
+        if magic.decode() != DUMP_MAGIC:
+            raise Exception("Wrong trace dump magic")
+        if version > DUMP_VERSION:
+            print(
+                "Warning: Version of trace dump is more recent",
+                file=sys.stderr,
+            )
+
+        cookie_fmt = "Q" if ptr_size == 8 else "I"
+        header_fmt = "4sIQ" + cookie_fmt
+        header_size = align_up(struct.calcsize("<" + header_fmt), 8)
+
+        rings = []
+        for _ in range(nr_rings):
+            (
+                magic,
+                cpu,
+                lost,
+                clock0,
+                nsec0,
+                clock1,
+                nsec1,
+            ) = self.data.unpack("4sIQQQQQ")
+            if magic.decode() != DUMP_RING_MAGIC:
+                raise Exception("Wrong trace ring magic")
+            self.lost[cpu] = lost
+
+            records = []
+            while True:
+                start = self.data.pos
+                magic, size, time, cookie = self.data.unpack(header_fmt)
+                magic = magic.decode()
+                if magic == TP_END_MAGIC:
+                    break
+                if magic != TP_HEADER_MAGIC:
+                    raise Exception("Wrong trace record magic")
+
+                self.data.pos = start + header_size
+                tp = self.tps[cookie]
+                records.append((tp, time, self.parse_args(tp)))
+                self.data.pos = start + align_up(
+                    header_size + size, RECORD_ALIGNMENT
+                )
+
+            rings.append((cpu, (clock0, nsec0, clock1, nsec1), records))
+
+        # Rings that did not run long enough to measure the clock rate
+        # use the clock reference of the dump or the rate of other rings
+        rates = dict()
+        for cpu, (clock0, nsec0, clock1, nsec1), _ in rings:
+            if clock1 > clock0:
+                rates[cpu] = (nsec1 - nsec0) / (clock1 - clock0)
+            elif clock > clock0 and clock0:
+                rates[cpu] = (nsec - nsec0) / (clock - clock0)
+        fallback = sum(rates.values()) / len(rates) if rates else 1.0
+
+        ret = []
+        for cpu, (clock0, nsec0, _, _), records in rings:
+            rate = rates.get(cpu, fallback)
+            for tp, time, args in records:
+                time = nsec0 + int((time - clock0) * rate)
+                ret.append(tp_sample(tp, time, args, cpu))
+
+        ret.sort(key=lambda sample: sample.time)
+        return ret
 
 
 class unpacker:
@@ -166,6 +273,12 @@ class tp_definition:
         self.sizes = sizes
         self.types = types
 
+        conversions = [c for c in PRINTF_CONVERSION.findall(fmt) if c != "%"]
+        self.signed = [
+            i < len(conversions) and conversions[i] in "di"
+            for i in range(args_nr)
+        ]
+
     def __str__(self):
         return "%s %s" % (self.name, self.fmt)
 
@@ -199,6 +312,10 @@ def get_tp_definitions(tp_data, ptr_size):
 
         # Convert from c-printf format into python one
         fmt = fmt.replace("%p", ptr_fmt)
+        # Python ignores or rejects C length modifiers
+        fmt = re.sub(
+            r"%([#0 +-]*[0-9]*(?:\.[0-9]+)?)(?:hh|ll|h|l|z|j|t)", r"%\1", fmt
+        )
 
         ret[cookie] = tp_definition(name, args_nr, fmt, sizes, types)
 
@@ -227,3 +344,56 @@ def get_keyvals(elf):
         ret[key] = val
 
     return ret
+
+
+# Builds a dump from the trace rings of a (halted) Unikraft instance, in
+# the format of uk_trace_dump(). `rings` is a list of dicts with the fields
+# of struct uk_trace_ring, where "data" holds the bytes of the ring.
+def dump_from_rings(rings, ring_size, ptr_size):
+    cookie_fmt = "Q" if ptr_size == 8 else "I"
+    header_fmt = "<4sIQ" + cookie_fmt
+    header_size = align_up(struct.calcsize(header_fmt), 8)
+
+    ret = struct.pack(
+        "<4sHHIIQQ",
+        DUMP_MAGIC.encode(),
+        DUMP_VERSION,
+        ptr_size,
+        len(rings),
+        ring_size,
+        0,
+        0,
+    )
+    for cpu, ring in enumerate(rings):
+        ret += struct.pack(
+            "<4sIQQQQQ",
+            DUMP_RING_MAGIC.encode(),
+            cpu,
+            ring["lost"],
+            ring["clock0"],
+            ring["nsec0"],
+            ring["clock1"],
+            ring["nsec1"],
+        )
+
+        data = ring["data"]
+        pos = ring["tail"]
+        while pos < ring["head"]:
+            off = pos % ring_size
+            if ring_size - off < header_size:
+                pos += ring_size - off
+                continue
+
+            magic, size, _, _ = struct.unpack_from(header_fmt, data, off)
+            if magic.decode() == TP_PAD_MAGIC:
+                pos += ring_size - off
+                continue
+
+            length = align_up(header_size + size, RECORD_ALIGNMENT)
+            ret += data[off : off + length]
+            pos += length
+
+        ret += struct.pack(header_fmt, TP_END_MAGIC.encode(), 0, 0, 0)
+        ret += bytes(header_size - struct.calcsize(header_fmt))
+
+    return ret
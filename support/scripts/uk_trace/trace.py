@@ -31,9 +31,11 @@
 # POSSIBILITY OF SUCH DAMAGE.
 
 import click
+import json
 import os
 import sys
 import pickle
+import struct
 import subprocess
 from tabulate import tabulate
 
@@ -45,13 +47,32 @@ def cli():
     pass
 
 
-def parse_tf(trace_file):
+def parse_tf(trace_file, elf=None):
+    # Dumps written by uk_trace_dump() contain only the trace rings. The
+    # tracepoint definitions are read from the debug image.
+    with open(trace_file, "rb") as tf:
+        is_dump = tf.read(4) == parse.DUMP_MAGIC.encode()
+
+    if is_dump:
+        if not elf:
+            print("Trace dumps require the debug image (--elf)")
+            quit(-1)
+        with open(trace_file, "rb") as tf:
+            trace_buff = tf.read()
+        (ptr_size,) = struct.unpack_from("<H", trace_buff, 6)
+        return parse.sample_parser(
+            parse.get_keyvals(elf),
+            parse.get_tp_sections(elf),
+            trace_buff,
+            ptr_size,
+        )
+
     try:
         with open(trace_file, "rb") as tf:
             unpickler = pickle.Unpickler(tf)
 
             keyvals = unpickler.load()
-            # elf = unpickler.load()
+            unpickler.load()  # elf
             ptr_size = unpickler.load()
             tp_defs = unpickler.load()
             trace_buff = unpickler.load()
@@ -65,19 +86,128 @@ def parse_tf(trace_file):
     return parse.sample_parser(keyvals, tp_defs, trace_buff, ptr_size)
 
 
+# Tracepoints come in pairs like `trace_vfs_open` and `trace_vfs_open_ret`
+# (or `_err`). Matching pairs on the same LCPU become complete events with
+# a duration, all other tracepoints become instant events.
+def chrome_trace(samples):
+    exit_suffixes = ("_ret", "_err")
+
+    def stem(name):
+        for suffix in exit_suffixes:
+            if name.endswith(suffix):
+                return name[: -len(suffix)]
+        return None
+
+    def label(name):
+        return name[len("trace_") :] if name.startswith("trace_") else name
+
+    def instant(sample):
+        return {
+            "name": label(sample.tp.name),
+            "ph": "i",
+            "s": "t",
+            "ts": sample.time / 1000,
+            "pid": 0,
+            "tid": sample.cpu,
+            "args": {"msg": sample.msg()},
+        }
+
+    entries = {stem(tp.name) for tp in samples.tps.values()} - {None}
+    events = []
+    stacks = dict()
+    for sample in samples:
+        stack = stacks.setdefault(sample.cpu, [])
+        name = stem(sample.tp.name)
+
+        if name is None and sample.tp.name in entries:
+            stack.append(sample)
+            continue
+
+        if name is None or not any(s.tp.name == name for s in stack):
+            events.append(instant(sample))
+            continue
+
+        # Entries without a matching exit are emitted as instants
+        begin = stack.pop()
+        while begin.tp.name != name:
+            events.append(instant(begin))
+            begin = stack.pop()
+
+        events.append(
+            {
+                "name": label(name),
+                "ph": "X",
+                "ts": begin.time / 1000,
+                "dur": (sample.time - begin.time) / 1000,
+                "pid": 0,
+                "tid": sample.cpu,
+                "args": {"entry": begin.msg(), "exit": sample.msg()},
+            }
+        )
+
+    for stack in stacks.values():
+        events += [instant(sample) for sample in stack]
+
+    cpus = {sample.cpu for sample in samples} | set(samples.lost.keys())
+    events += [
+        {
+            "name": "thread_name",
+            "ph": "M",
+            "pid": 0,
+            "tid": cpu,
+            "args": {"name": "LCPU %d" % cpu},
+        }
+        for cpu in sorted(cpus)
+    ]
+
+    return {
+        "traceEvents": events,
+        "displayTimeUnit": "ns",
+        "otherData": {
+            "lost": {str(cpu): lost for cpu, lost in samples.lost.items()}
+        },
+    }
+
+
 @cli.command()
 @click.argument("trace_file", type=click.Path(exists=True), default="tracefile")
 @click.option("--no-tabulate", is_flag=True, help="No pretty printing")
-def list(trace_file, no_tabulate):
+@click.option(
+    "--elf",
+    type=click.Path(exists=True),
+    help="Debug image, required for dumps written by uk_trace_dump()",
+)
+def list(trace_file, no_tabulate, elf):
     """Parse binary trace file fetched from Unikraft"""
     if not no_tabulate:
-        print_data = [x.tabulate_fmt() for x in parse_tf(trace_file)]
-        print(tabulate(print_data, headers=["time", "tp_name", "msg"]))
+        print_data = [x.tabulate_fmt() for x in parse_tf(trace_file, elf)]
+        print(tabulate(print_data, headers=["time", "cpu", "tp_name", "msg"]))
     else:
-        for i in parse_tf(trace_file):
+        for i in parse_tf(trace_file, elf):
             print(i)
 
 
+@cli.command()
+@click.argument("trace_file", type=click.Path(exists=True), default="tracefile")
+@click.option(
+    "--elf",
+    type=click.Path(exists=True),
+    help="Debug image, required for dumps written by uk_trace_dump()",
+)
+@click.option(
+    "--out",
+    "-o",
+    type=click.Path(),
+    default="trace.json",
+    show_default=True,
+    help="Output JSON file",
+)
+def chrome(trace_file, elf, out):
+    """Convert a trace file to Chrome trace / Perfetto JSON"""
+    with open(out, "w") as f:
+        json.dump(chrome_trace(parse_tf(trace_file, elf)), f)
+
+
 @cli.command()
 @click.argument("uk_img", type=click.Path(exists=True))
 @click.option(
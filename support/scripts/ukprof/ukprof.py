@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2023, Unikraft GmbH and The Unikraft Authors.
+# Licensed under the BSD-3-Clause License (the "License").
+# You may not use this file except in compliance with the License.
+
+# Symbolizes a profile written by lib/ukprof. The input is either the
+# console log of the unikernel, or the file that ukprof wrote. The output
+# is in folded-stack format with function names, which can be turned into
+# a flamegraph, e.g., with:
+#
+#   ukprof.py --elf build/app_qemu-x86_64.dbg console.log | flamegraph.pl
+#
+# NOTE: The script requires pyelftools (pip3 install)
+import sys
+import bisect
+import argparse
+from collections import Counter
+from elftools.elf.elffile import ELFFile
+
+FOLDED_BEGIN = "UKPROF_FOLDED_BEGIN"
+FOLDED_END = "UKPROF_FOLDED_END"
+
+
+class Symbolizer:
+    def __init__(self, elf_path, offsets):
+        self._offsets = offsets
+        self._starts = []
+        self._syms = []
+
+        with open(elf_path, "rb") as f:
+            symtab = ELFFile(f).get_section_by_name(".symtab")
+            if symtab is None:
+                raise Exception("%s has no symbol table" % elf_path)
+
+            syms = []
+            for sym in symtab.iter_symbols():
+                if sym["st_info"]["type"] != "STT_FUNC" or not sym.name:
+                    continue
+                syms.append((sym["st_value"], sym["st_size"], sym.name))
+
+        for start, size, name in sorted(syms):
+            self._starts.append(start)
+            self._syms.append((start, size, name))
+
+    # Return addresses may already belong to the next line or function, so
+    # they are looked up with `adjust` 1
+    def lookup(self, addr, adjust=0):
+        i = bisect.bisect_right(self._starts, addr - adjust) - 1
+        if i >= 0:
+            start, size, name = self._syms[i]
+            if addr - adjust < start + max(size, 1):
+                if self._offsets:
+                    return "%s+%#x" % (name, addr - start)
+                return name
+
+        return "%#x" % addr
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Symbolize a ukprof profile into folded stacks"
+    )
+    parser.add_argument(
+        "--elf",
+        required=True,
+        type=str,
+        help="Debug image of the profiled unikernel",
+    )
+    parser.add_argument(
+        "--offsets",
+        action="store_true",
+        help="Append the offset into the function to every frame",
+    )
+    parser.add_argument(
+        "--output",
+        type=str,
+        help="Output file (default: standard output)",
+    )
+    parser.add_argument(
+        "profile",
+        type=str,
+        help="Console log or profile file written by ukprof",
+    )
+
+    return parser.parse_args()
+
+
+def read_folded(path):
+    with open(path, "r", errors="replace") as f:
+        lines = [line.strip() for line in f]
+
+    # Console logs have the profile between markers, the last one wins
+    if FOLDED_BEGIN in lines:
+        start = len(lines) - lines[::-1].index(FOLDED_BEGIN)
+        end = len(lines)
+        if FOLDED_END in lines[start:]:
+            end = lines.index(FOLDED_END, start)
+        lines = lines[start:end]
+
+    ret = []
+    for line in lines:
+        frames, _, count = line.rpartition(" ")
+        if not frames.startswith("0x") or not count.isdigit():
+            continue
+        ret.append(([int(pc, 16) for pc in frames.split(";")], int(count)))
+
+    return ret
+
+
+def main():
+    args = parse_args()
+    sym = Symbolizer(args.elf, args.offsets)
+
+    stacks = Counter()
+    for pcs, count in read_folded(args.profile):
+        # All frames but the last (the sampled instruction) are return
+        # addresses
+        names = [sym.lookup(pc, 1) for pc in pcs[:-1]]
+        names.append(sym.lookup(pcs[-1]))
+        stacks[";".join(names)] += count
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    for stack, count in sorted(stacks.items()):
+        print("%s %d" % (stack, count), file=out)
+    if args.output:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()